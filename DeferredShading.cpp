@@ -15,8 +15,27 @@
 #include "SDKmisc.h"
 #include "SDKmesh.h"
 #include "resource.h"
+#include "Portable/AssetLoader.h"
+#include "Portable/BatchRender.h"
+#include "Portable/BlueNoise.h"
+#include "Portable/EffectCache.h"
+#include "Portable/FrameArena.h"
+#include "Portable/FrameReplay.h"
+#include "Portable/MappedFile.h"
+#include "Portable/OutputSink.h"
+#include "Portable/SceneStream.h"
+#include "Portable/ShadowCache.h"
+#include "Portable/SimdMath.h"
+#include "Portable/TextureCook.h"
+#include "Portable/VertexQuantize.h"
+#include <wincodec.h>
+#include <algorithm>
+#include <cfloat>
+#include <map>
 #include <vector>
 
+#pragma comment( lib, "windowscodecs.lib" )
+
 #define DEG2RAD( a ) ( a * D3DX_PI / 180.f )
 
 // define the vertex type
@@ -49,10 +68,97 @@ CDXUTTextHelper*                    g_pTxtHelper = NULL;
 ID3D10Effect*                       g_pEffect = NULL;       // D3DX effect interface
 ID3D10InputLayout*                  g_pVertexLayout = NULL; // Vertex Layout
 ID3D10EffectTechnique*              g_pTechnique = NULL;
+ID3D10EffectTechnique*              g_pCompositeTechnique = NULL;	// one pass per (view mode, ao) permutation
+
+// Startup and memory cost of the effect and its composite permutations
+float								_effectLoadMs = 0.0f;		// time to compile/load DeferredShading.fx
+const WCHAR*						_effectOrigin = L"compiled";	// where the compiled effect came from
+EffectCache*						_effectCache = NULL;		// compiled effects, keyed by a hash of their inputs
+std::shared_future<EffectCacheEntry>	_effectRequest;			// DeferredShading.fx, requested in InitApp
+
+// Transient CPU-side data of a frame (double buffered: the render thread only)
+FrameArenas*						_frameArenas = NULL;
+unsigned int						_cpuFrame = 0;				// frames rendered; picks the arena
+
+// Debug builds count the heap allocations of the render thread during a frame's own work
+// (the UI aside), to check that what should come from the arena does
+#if defined(DEBUG) | defined(_DEBUG)
+DWORD								_renderThreadId = 0;
+bool								_countAllocations = false;	// inside a frame?
+UINT								_frameAllocations = 0;		// so far this frame
+UINT								_lastFrameAllocations = 0;
+
+int __cdecl CountFrameAllocations( int allocType, void* pUserData, size_t size, int blockType, long request,
+								   const unsigned char* fileName, int line ) {
+	if (_countAllocations && ( allocType == _HOOK_ALLOC || allocType == _HOOK_REALLOC ) &&
+		GetCurrentThreadId() == _renderThreadId)
+		++_frameAllocations;
+	return TRUE;
+}
+#endif
+
+// Asset loading
+AssetLoader*						_assetLoader = NULL;		// reads and decodes the mesh, its textures and the rotations
+std::map<std::string, ID3D10ShaderResourceView*>	_meshTextures;	// material textures, while the mesh is created
+float								_assetLoadMs = 0.0f;		// device creation -> every asset created
+float								_assetSumMs = 0.0f;			// the same assets loaded one after another
+UINT								_numCompositePasses = 0;	// number of composite permutations
+UINT								_compositeBytes = 0;		// pixel shader bytecode of all permutations
+UINT								_quadShaderBytes = 0;		// pixel shader bytecode of the branching PSQuad
 
 // Some mesh? 
 CDXUTSDKMesh                        g_Mesh;
 
+// The mesh's vertices quantized by VertexQuantizer (tiny.sdkmesh.qvtx), if it's there
+ID3D10Buffer*						_quantizedVB = NULL;		// 16 bytes per vertex instead of 32
+ID3D10InputLayout*					g_pQuantizedLayout = NULL;
+std::vector<VertexRange>			_quantRanges;				// the box of every vertex range
+std::vector<unsigned int>			_subsetRange;				// which range every subset is in
+bool								_quantizedVertices = true;	// draw with them (when loaded)?
+ID3D10EffectVectorVariable*			g_QuantOffset = NULL;
+ID3D10EffectVectorVariable*			g_QuantScale = NULL;
+
+// An out-of-core scene in Scene/ (chunks of quantized vertices, see StreamBench), if it's there
+SceneStreamer*						_sceneStreamer = NULL;
+std::vector<ID3D10Buffer*>			_chunkVB;					// per chunk, made on its first draw
+std::vector<ID3D10Buffer*>			_chunkIB;
+D3DXVECTOR3							_prevEye( 0, 0, 0 );		// for the camera velocity
+UINT								_chunkDraws = 0;			// this frame
+UINT								_chunkHiZTests = 0;			// ... of which the GPU may have skipped
+bool								_hiZCulling = true;			// test the chunks against last frame's pyramid?
+std::vector<ID3D10Predicate*>		_chunkPredicates;			// one per chunk drawn in a frame, made as needed
+ID3D10EffectVectorVariable*			_hiZBoxMinVariable = NULL;
+ID3D10EffectVectorVariable*			_hiZBoxMaxVariable = NULL;
+
+// Frame export: the G-buffer slices, the blurred AO and the composite, through a ring of
+// staging textures per output and the OutputSink's encoder threads
+#define EXPORT_RING 3
+#define NUM_EXPORTS 6
+struct ExportTarget {
+	const char*						name;
+	OutputEncoding					encoding;
+	const char*						channels;					// of the .exr
+	ID3D10Texture2D*				resolve;					// for a multisampled back buffer
+	ID3D10Texture2D*				staging[EXPORT_RING];
+	UINT							frame[EXPORT_RING];			// export copied into it, 0 = none
+};
+ExportTarget						_exportTargets[NUM_EXPORTS] = {	// _mrtTex slices, _vgTex, back buffer
+	{ "diffuse", OUTPUT_IMAGE, "" },
+	{ "normal", OUTPUT_EXR_HALF, "RGB" },
+	{ "position", OUTPUT_EXR_HALF, "RGB" },
+	{ "depth", OUTPUT_EXR_HALF, "Z" },
+	{ "ao", OUTPUT_EXR_HALF, "Y" },
+	{ "composite", OUTPUT_IMAGE, "" },
+};
+bool								_exportFrames = false;
+OutputSink*							_outputSink = NULL;
+UINT								_exportCount = 0;			// frames exported
+UINT								_exportStalls = 0;			// readbacks that waited on the GPU
+
+// Inputs of every frame (cameras, world, settings) for FrameReplay
+FrameCaptureWriter					_frameCapture;
+bool								_captureFrames = false;
+
 // A shader resource variable to send in the model's texture
 ID3D10EffectShaderResourceVariable* g_ptxDiffuseVariable = NULL;
 
@@ -81,11 +187,69 @@ ID3D10ShaderResourceView*           _mrtSRV;					// Shader resource view for the
 ID3D10EffectShaderResourceVariable* _mrtTextureVariable = NULL; // for sending in the mrts
 ID3D10Texture2D*                    _mrtMapDepth;				// Depth stencil for the environment map
 ID3D10DepthStencilView*             _mrtDSV;					// Depth stencil view for environment map for all 6 faces
+ID3D10RenderTargetView*             _mrtSliceRTV[4];			// one render target view per slice (all bound at once)
+ID3D10DepthStencilView*             _mrtSliceDSV;				// depth stencil view of the first slice
 #define	NUMRTS 4;												// number of render targets
 #define TEXSCALE 2;												// scale of the render targets
+int									_texScale = TEXSCALE;		// TEXSCALE, or 1 with -msaa
 short								_textureToRender = 0;		// keeps track of which texture to render
 ID3D10EffectScalarVariable*			g_TexToRender = NULL;		// variable to send in which texture to render
 
+// Edge-aware MSAA (-msaa): the G-buffer is rendered with MSAA_SAMPLES samples at 1x
+// instead of TEXSCALE, then resolved into _mrtTex (sample 0) and an edge mask, and only
+// the edge pixels are shaded per sample
+#define MSAA_SAMPLES 4
+bool								_msaa = false;
+ID3D10Texture2D*                    _msaaTex;					// the slices, multisampled
+ID3D10RenderTargetView*             _msaaSliceRTV[4];			// one render target view per slice
+ID3D10ShaderResourceView*           _msaaSRV;
+ID3D10Texture2D*                    _msaaDepthTex;				// multisampled depth
+ID3D10DepthStencilView*             _msaaDSV;
+ID3D10Texture2D*                    _edgeTex;					// 1 where the samples of a pixel differ
+ID3D10RenderTargetView*             _edgeRTV;
+ID3D10ShaderResourceView*           _edgeSRV;
+ID3D10EffectShaderResourceVariable* _msaaVariable = NULL;
+ID3D10EffectShaderResourceVariable* _edgeVariable = NULL;
+ID3D10EffectTechnique*              g_pCompositeMsaaTechnique = NULL;	// Composite, edges shaded per sample
+
+// Variable-rate AO: a shading rate per RATETILE x RATETILE tile from the G-buffer, and
+// the simple AO of the tiles that can be shaded in 2x2 and 4x4 blocks at half and
+// quarter resolution
+#define RATETILE 16												// RATE_TILE of the shader
+bool								_variableRate = false;
+ID3D10Texture2D*                    _rateTex;					// rate / 4 of every tile
+ID3D10RenderTargetView*             _rateRTV;
+ID3D10ShaderResourceView*           _rateSRV;
+ID3D10Texture2D*                    _coarseAOTex[2];			// 2x2 and 4x4 tiles
+ID3D10RenderTargetView*             _coarseAORTV[2];
+ID3D10ShaderResourceView*           _coarseAOSRV[2];
+ID3D10EffectShaderResourceVariable* _rateVariable = NULL;
+ID3D10EffectShaderResourceVariable* _coarseAOVariable[2] = { NULL, NULL };
+
+// Shadows of the scene light, kept up to date incrementally (see UpdateShadows): the
+// static casters' depth is cached in _shadowTex[1] and copied into the map, _shadowTex[0],
+// only where the mesh was or is; the cache itself only when the light or the resident
+// chunks change
+#define SHADOWSIZE 1024
+#define SHADOWFOV 1.0f											// radians
+bool								_shadows = false;
+Vec3								_shadowLightEye = { 300.0f, 400.0f, -700.0f };	// world space, looks at the origin
+ID3D10Texture2D*                    _shadowTex[2];				// map, static cache
+ID3D10DepthStencilView*             _shadowDSV[2];
+ID3D10ShaderResourceView*           _shadowSRV[2];
+Versioned<Mat4>						_shadowLight;				// what the map was rendered with
+Versioned<Mat4>						_shadowWorld;
+Versioned<float>					_shadowPuffiness;
+std::vector<unsigned int>			_shadowChunks;				// in the static cache
+D3D10_RECT							_shadowCasterRect;			// the mesh's texels in the map
+UINT								_shadowTexels = 0;			// re-rendered last frame
+bool								_shadowStaticRendered = false;
+ID3D10EffectShaderResourceVariable* _shadowMapVariable = NULL;
+ID3D10EffectShaderResourceVariable* _shadowStaticVariable = NULL;
+ID3D10EffectMatrixVariable*         _shadowViewProjectionVariable = NULL;
+ID3D10EffectMatrixVariable*         _viewToShadowVariable = NULL;
+ID3D10EffectVectorVariable*         _lightPosVariable = NULL;
+
 // Ambient Occlusion variables
 bool								_ambientOcclusion = true;	// ao off or on?
 ID3D10Texture2D*                    _aoTex;						// Ambient Occlusion texture
@@ -95,9 +259,13 @@ ID3D10Texture2D*                    _aoMapDepth;				// Depth stencil for the ao
 ID3D10DepthStencilView*             _aoDSV;						// Depth stencil view for the ao texture
 ID3D10EffectShaderResourceVariable* _aoTextureVariable = NULL;	// for sending in the ao texture
 ID3D10EffectScalarVariable*			g_UseAO = NULL;				// render AO or not?
-// The random vector texture
+// The random vector texture: blue noise generated at startup (cached in BlueNoise\),
+// or vectors.png with BLUE_NOISE_ROTATIONS 0
+#define BLUE_NOISE_ROTATIONS 1
+BlueNoiseParams						_blueNoiseParams;			// 64x64, rotation and offset layers
 ID3D10ShaderResourceView*			_vectorSRV;
 ID3D10EffectShaderResourceVariable* _vectorVariable;
+ID3D10EffectVectorVariable*			g_NoiseScale = NULL;		// rotation texture repeats: one texel per AO pixel
 
 // The gaussian blur textures (for Ambient Occlusion)
 
@@ -120,10 +288,94 @@ ID3D10DepthStencilView*             _vgDSV;						// Depth stencil view for the g
 
 ID3D10EffectScalarVariable*			g_UseGB = NULL;				// render GB or not?
 
+// Hierarchical depth pyramid (min/max linear view-space Z), built after the G-buffer pass.
+// Read by every AO technique but the simple one: mip 0 is their linear depth, and the
+// pyramid technique fetches far taps from coarser mips. The next frame's G-buffer pass
+// tests the streamed chunks against it (see RenderSceneChunks). Only built when one of
+// them is on.
+#define PYRAMIDMIPS 5											// number of mips in the depth pyramid
+ID3D10Texture2D*                    _pyramidTex;				// depth pyramid texture (R = min Z, G = max Z)
+ID3D10RenderTargetView*             _pyramidRTV[PYRAMIDMIPS];	// one render target view per mip
+ID3D10ShaderResourceView*           _pyramidMipSRV[PYRAMIDMIPS];// one shader resource view per mip (downsample source)
+ID3D10ShaderResourceView*           _pyramidSRV;				// shader resource view over the whole pyramid
+ID3D10EffectShaderResourceVariable* _pyramidVariable = NULL;	// for sending in the whole pyramid
+ID3D10EffectShaderResourceVariable* _pyramidSrcVariable = NULL;	// for sending in the mip being downsampled
+unsigned int						_pyramidFrame = 0;			// _cpuFrame it was built in (0: never, or lost)
+
+// Deinterleaved ambient occlusion: the G-buffer is split into 4x4 quarter-resolution layers
+#define INTERLEAVE 4											// layers are INTERLEAVE pixels apart
+#define NUMLAYERS 16											// INTERLEAVE * INTERLEAVE
+ID3D10Texture2D*                    _deintTex;					// normals + linear Z of every layer
+ID3D10RenderTargetView*             _deintRTV[NUMLAYERS];		// one render target view per layer
+ID3D10ShaderResourceView*           _deintSRV;					// shader resource view over all layers
+ID3D10Texture2D*                    _layerAOTex;				// ambient occlusion of every layer
+ID3D10RenderTargetView*             _layerAORTV[NUMLAYERS];		// one render target view per layer
+ID3D10ShaderResourceView*           _layerAOSRV;				// shader resource view over all layers
+ID3D10EffectShaderResourceVariable* _deintVariable = NULL;		// for sending in the layers
+ID3D10EffectShaderResourceVariable* _layerAOVariable = NULL;	// for sending in the layer ao
+ID3D10EffectScalarVariable*			g_InterleaveLayer = NULL;	// which layer is being rendered
+
+// Which ambient occlusion technique to use
+#define AO_SIMPLE   0											// PSAO: full-resolution depth for every tap
+#define AO_PYRAMID  1											// PSAOPyramid: mip chosen from tap distance
+#define AO_DEINTERLEAVED 2										// PSAOLayer: one pass per 4x4 layer
+#define AO_TEMPORAL 3											// PSAOTemporal: 4 taps per frame + reprojected history
+#define AO_HORIZON 4											// PSAOHorizon: horizon search along a few directions
+int									_aoTechnique = AO_SIMPLE;
+
+// Horizon-based ambient occlusion presets (directions x steps)
+struct HorizonPreset
+{
+	const WCHAR*	name;
+	int				directions;
+	int				steps;
+};
+HorizonPreset						_horizonPresets[] =
+{
+	{ L"HBAO Low (4x3)",		4, 3 },
+	{ L"HBAO Medium (6x4)",		6, 4 },
+	{ L"HBAO High (8x6)",		8, 6 },
+};
+int									_horizonPreset = 1;
+ID3D10EffectScalarVariable*			g_HorizonDirections = NULL;
+ID3D10EffectScalarVariable*			g_HorizonSteps = NULL;
+
+// Temporal ambient occlusion: two history textures, written and read in turn
+ID3D10Texture2D*                    _aoHistoryTex[2];			// accumulated ao (.a = history length)
+ID3D10RenderTargetView*             _aoHistoryRTV[2];
+ID3D10ShaderResourceView*           _aoHistorySRV[2];
+ID3D10Texture2D*                    _prevNormalTex;				// last frame's normal slice
+ID3D10ShaderResourceView*           _prevNormalSRV;
+ID3D10Texture2D*                    _prevDepthTex;				// last frame's linear depth (pyramid mip 0)
+ID3D10ShaderResourceView*           _prevDepthSRV;
+ID3D10EffectShaderResourceVariable* _aoHistoryVariable = NULL;
+ID3D10EffectShaderResourceVariable* _prevNormalVariable = NULL;
+ID3D10EffectShaderResourceVariable* _prevDepthVariable = NULL;
+ID3D10EffectMatrixVariable*         g_pViewInverseVariable = NULL;			// View Matrix Inverse
+ID3D10EffectMatrixVariable*         g_pPrevViewVariable = NULL;				// last frame's View Matrix
+ID3D10EffectMatrixVariable*         g_pPrevViewProjectionVariable = NULL;	// last frame's View * Projection
+ID3D10EffectScalarVariable*			g_FrameIndex = NULL;		// rotates the tap pattern
+ID3D10EffectScalarVariable*			g_HistoryValid = NULL;		// is there a history to blend with?
+UINT								_historyIndex = 0;			// which history texture is written this frame
+UINT								_frameIndex = 0;
+bool								_historyValid = false;		// did the last frame write a history?
+Mat4								_prevView;					// the G-buffer camera's view last frame
+
+// GPU timing of the ambient occlusion passes, read back without stalling: a timestamp
+// before them and one after every stage. Only the deinterleaved AO has the first two
+// stages (the others end them right away, at no cost); the AO stage is its reinterleave.
+enum AOStage { AO_STAGE_DEINTERLEAVE, AO_STAGE_LAYERS, AO_STAGE_AO, AO_STAGE_BLUR, AO_STAGES };
+ID3D10Query*                        _aoTimerDisjoint = NULL;
+ID3D10Query*                        _aoTimestamps[AO_STAGES + 1];	// start, then the end of every stage
+bool								_aoTiming = false;			// are this frame's passes timed?
+bool								_aoTimerPending = false;	// waiting for the results?
+float								_aoStageMs[AO_STAGES];		// last measured times
+float								_aoTimeMs = 0.0f;			// ... all stages
+
 
 
 // World Matrices
-D3DXMATRIX                          g_World, t_World, ao_World;
+Mat4                                g_World, t_World, ao_World;
 
 // window width and height
 int						_width, _height;
@@ -139,6 +391,14 @@ int						_width, _height;
 #define IDC_PUFF_SCALE          5
 #define IDC_PUFF_STATIC         6
 #define IDC_TOGGLEWARP          7
+#define IDC_AOTECHNIQUE        16
+#define IDC_HBAOPRESET         17
+#define IDC_TOGGLEQUANTIZED    18
+#define IDC_TOGGLEEXPORT       19
+#define IDC_TOGGLECAPTURE      20
+#define IDC_TOGGLEVRS          21
+#define IDC_TOGGLESHADOWS      22
+#define IDC_TOGGLEHIZ          23
 
 // for texture
 #define IDC_TEXTUREGROUP        8
@@ -171,6 +431,12 @@ bool CALLBACK ModifyDeviceSettings( DXUTDeviceSettings* pDeviceSettings, void* p
 
 void RenderText();
 void InitApp();
+void RequestEffect();
+void ReleaseExportTargets();
+void MarkAOTimer( AOStage stage );
+bool MediaPath( const WCHAR* name, std::string& path );
+int RunBatch( const WCHAR* batchFile );
+int RunReplay( const WCHAR* captureFile );
 
 
 //--------------------------------------------------------------------------------------
@@ -182,8 +448,36 @@ INT WINAPI wWinMain( HINSTANCE, HINSTANCE, LPWSTR, int )
     // Enable run-time memory check for debug builds.
 #if defined(DEBUG) | defined(_DEBUG)
     _CrtSetDbgFlag( _CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF );
+	_renderThreadId = GetCurrentThreadId();		// DXUTMainLoop renders on this thread
+	_CrtSetAllocHook( CountFrameAllocations );
 #endif
 
+	// -batch cameras.txt: renders the camera list on the CPU and exits, no window or device
+	// -replay session.fcap: replays a capture on the CPU, timings to session.csv, and exits
+	// -capture session.fcap: records the inputs of every frame from the start
+	// -msaa: 4x MSAA G-buffer at 1x, edges shaded per sample, instead of TEXSCALE
+	int argc = 0;
+	LPWSTR* argv = CommandLineToArgvW( GetCommandLineW(), &argc );
+	for (int i = 1; argv && i < argc; ++i) {
+		if (!_wcsicmp( argv[i], L"-msaa" )) {
+			_msaa = true;
+			_texScale = 1;
+		}
+	}
+	for (int i = 1; argv && i + 1 < argc; ++i) {
+		if (!_wcsicmp( argv[i], L"-batch" ) || !_wcsicmp( argv[i], L"-replay" )) {
+			int exitCode = _wcsicmp( argv[i], L"-batch" ) ? RunReplay( argv[i + 1] ) : RunBatch( argv[i + 1] );
+			LocalFree( argv );
+			return exitCode;
+		}
+		if (!_wcsicmp( argv[i], L"-capture" )) {
+			char path[MAX_PATH];
+			_captureFrames = WideCharToMultiByte( CP_ACP, 0, argv[i + 1], -1, path, MAX_PATH, NULL, NULL ) &&
+							 _frameCapture.Open( path, _texScale );
+		}
+	}
+	LocalFree( argv );
+
     // DXUT will create and use the best device (either D3D9 or D3D10) 
     // that is available on the system depending on which D3D callbacks are set below
 
@@ -204,17 +498,139 @@ INT WINAPI wWinMain( HINSTANCE, HINSTANCE, LPWSTR, int )
     DXUTSetCursorSettings( true, true ); // Show the cursor and clip it when in full screen
 
     InitApp();
+	_frameArenas = new FrameArenas( 1, 2, 256 * 1024 );
+    RequestEffect();		// compiles on the cache's worker thread while the window and device are created
 
     DXUTCreateWindow( L"DeferredShading" );
 	_width = 1024;
 	_height = 768;
     DXUTCreateDevice( true, _width, _height );			// set up window size
     DXUTMainLoop(); // Enter into the DXUT render loop
+	_frameCapture.Close();
+	SAFE_DELETE( _effectCache );
+	SAFE_DELETE( _frameArenas );
 
     return DXUTGetExitCode();
 }
 
 
+//--------------------------------------------------------------------------------------
+// Headless batch mode: the mesh is loaded once and every view of the batch file is
+// rendered through the CPU G-buffer, AO and composite passes on the job system
+//--------------------------------------------------------------------------------------
+void BatchMessage( const char* format, ... ) {
+	char line[512];
+	va_list args;
+	va_start( args, format );
+	vsnprintf_s( line, sizeof( line ), _TRUNCATE, format, args );
+	va_end( args );
+	printf( "%s", line );
+	OutputDebugStringA( line );
+}
+
+int RunBatch( const WCHAR* batchFile ) {
+	// started from a console: print there
+	if (AttachConsole( ATTACH_PARENT_PROCESS )) {
+		FILE* console = NULL;
+		freopen_s( &console, "CONOUT$", "w", stdout );
+	}
+
+	char narrow[MAX_PATH];
+	std::string meshPath, error;
+	if (!WideCharToMultiByte( CP_ACP, 0, batchFile, -1, narrow, MAX_PATH, NULL, NULL ) ||
+		!MediaPath( L"Tiny\\tiny.sdkmesh", meshPath )) {
+		BatchMessage( "batch: can't find the batch file or the mesh\n" );
+		return 1;
+	}
+
+	std::vector<BatchView> views;
+	if (!ReadBatchFile( narrow, views, &error )) {
+		BatchMessage( "batch: %s\n", error.c_str() );
+		return 1;
+	}
+
+	CpuMesh mesh;
+	int missing = 0;
+	if (!LoadCpuMesh( meshPath, mesh, &error, &missing )) {
+		BatchMessage( "batch: %s\n", error.c_str() );
+		return 1;
+	}
+	if (missing)
+		BatchMessage( "batch: %d textures not found, drawn gray\n", missing );
+
+	JobSystem jobs;
+	BatchStats stats;
+	bool ok = RenderBatch( jobs, mesh, views, stats );
+	double perView = stats.views ? 1.0 / stats.views : 0.0;
+	BatchMessage( "batch: %u views in %.1f ms on %d workers: %.2f views/s\n", stats.views, stats.wallMs,
+				  jobs.NumWorkers(), stats.ViewsPerSecond() );
+	BatchMessage( "batch: per view G-buffer %.2f ms, AO %.2f ms, composite %.2f ms, write %.2f ms\n",
+				  stats.gbufferMs * perView, stats.aoMs * perView, stats.compositeMs * perView, stats.writeMs * perView );
+	BatchMessage( "batch: vertex cache %.0f%% hits, %.2f ms saved\n", stats.vertices.HitRate() * 100.0,
+				  stats.vertices.SavedMs() );
+	BatchMessage( "batch: %u files, encoding %.1f MB/s, workers waited %u times for %.1f ms\n", stats.output.frames,
+				  stats.output.EncodeMBps(), stats.output.blocked, stats.output.blockedMs );
+	if (stats.failedWrites)
+		BatchMessage( "batch: %u files could not be written\n", stats.failedWrites );
+	return ok ? 0 : 1;
+}
+
+// Replays a capture of this sample headless, as fast as possible, and writes the
+// per-pass timings next to it (FrameReplay -diff compares two of them)
+int RunReplay( const WCHAR* captureFile ) {
+	if (AttachConsole( ATTACH_PARENT_PROCESS )) {
+		FILE* console = NULL;
+		freopen_s( &console, "CONOUT$", "w", stdout );
+	}
+
+	char narrow[MAX_PATH];
+	std::string meshPath, error;
+	if (!WideCharToMultiByte( CP_ACP, 0, captureFile, -1, narrow, MAX_PATH, NULL, NULL ) ||
+		!MediaPath( L"Tiny\\tiny.sdkmesh", meshPath )) {
+		BatchMessage( "replay: can't find the capture or the mesh\n" );
+		return 1;
+	}
+
+	FrameCapture capture;
+	CpuMesh mesh;
+	if (!ReadFrameCapture( narrow, capture, &error ) || !LoadCpuMesh( meshPath, mesh, &error )) {
+		BatchMessage( "replay: %s\n", error.c_str() );
+		return 1;
+	}
+
+	JobSystem jobs;
+	ReplayResult result;
+	if (!ReplayCapture( jobs, mesh, capture, ReplayOptions(), result, &error )) {
+		BatchMessage( "replay: %s\n", error.c_str() );
+		return 1;
+	}
+	double total[NUM_REPLAY_PASSES] = { 0.0 };
+	for (size_t i = 0; i < result.frames.size(); ++i)
+		for (int p = 0; p < NUM_REPLAY_PASSES; ++p)
+			total[p] += result.frames[i].passMs[p];
+	double perFrame = result.frames.empty() ? 0.0 : 1.0 / result.frames.size();
+	BatchMessage( "replay: %u frames of %dx%d in %.1f ms on %d workers%s\n", ( UINT )result.frames.size(), result.width,
+				  result.height, result.wallMs, jobs.NumWorkers(), capture.truncated ? " (capture cut short)" : "" );
+	BatchMessage( "replay: per frame G-buffer %.2f ms, AO %.2f ms, blur %.2f ms, composite %.2f ms\n",
+				  total[REPLAY_GBUFFER] * perFrame, total[REPLAY_AO] * perFrame, total[REPLAY_BLUR] * perFrame,
+				  total[REPLAY_COMPOSITE] * perFrame );
+	BatchMessage( "replay: vertex cache %.0f%% hits, %.2f ms saved\n", result.vertices.HitRate() * 100.0,
+				  result.vertices.SavedMs() );
+
+	std::string timings = narrow;
+	size_t dot = timings.find_last_of( '.' );
+	if (dot != std::string::npos && timings.find_first_of( "\\/", dot ) == std::string::npos)
+		timings.erase( dot );
+	timings += ".csv";
+	if (!WriteReplayTimings( timings, result, std::vector<std::string>( 1, std::string( "capture " ) + narrow ), &error )) {
+		BatchMessage( "replay: %s\n", error.c_str() );
+		return 1;
+	}
+	BatchMessage( "replay: timings in %s\n", timings.c_str() );
+	return 0;
+}
+
+
 //--------------------------------------------------------------------------------------
 // Initialize the app 
 //--------------------------------------------------------------------------------------
@@ -252,6 +668,42 @@ void InitApp()
 	iY += 24;
     g_SampleUI.AddCheckBox( IDC_TOGGLEAO, L"Toggle Ambient Occlusion", 35, iY += 24, 125, 22, _ambientOcclusion );
 
+	// which ambient occlusion technique to use
+	CDXUTComboBox* pAOCombo;
+	g_SampleUI.AddComboBox( IDC_AOTECHNIQUE, 35, iY += 24, 125, 22, 0, false, &pAOCombo );
+	pAOCombo->AddItem( L"Simple SSAO", IntToPtr( AO_SIMPLE ) );
+	pAOCombo->AddItem( L"Depth Pyramid SSAO", IntToPtr( AO_PYRAMID ) );
+	pAOCombo->AddItem( L"Deinterleaved SSAO", IntToPtr( AO_DEINTERLEAVED ) );
+	pAOCombo->AddItem( L"Temporal SSAO", IntToPtr( AO_TEMPORAL ) );
+	pAOCombo->AddItem( L"Horizon-Based AO", IntToPtr( AO_HORIZON ) );
+	pAOCombo->SetSelectedByData( IntToPtr( _aoTechnique ) );
+
+	// tap and direction counts of the horizon-based ambient occlusion
+	CDXUTComboBox* pPresetCombo;
+	g_SampleUI.AddComboBox( IDC_HBAOPRESET, 35, iY += 24, 125, 22, 0, false, &pPresetCombo );
+	for (int i = 0; i < sizeof( _horizonPresets ) / sizeof( _horizonPresets[0] ); ++i)
+		pPresetCombo->AddItem( _horizonPresets[i].name, IntToPtr( i ) );
+	pPresetCombo->SetSelectedByData( IntToPtr( _horizonPreset ) );
+
+	// the simple AO in 2x2 and 4x4 blocks where the G-buffer is smooth
+	g_SampleUI.AddCheckBox( IDC_TOGGLEVRS, L"Variable-Rate AO", 35, iY += 24, 125, 22, _variableRate );
+
+	// shadows of the scene light, re-rendered only where something moved
+	g_SampleUI.AddCheckBox( IDC_TOGGLESHADOWS, L"Shadows", 35, iY += 24, 125, 22, _shadows );
+
+	// skip the streamed chunks last frame's depth pyramid hides
+	g_SampleUI.AddCheckBox( IDC_TOGGLEHIZ, L"Hi-Z Culling", 35, iY += 24, 125, 22, _hiZCulling );
+
+	// 16-byte vertices in the G-buffer pass (if tiny.sdkmesh.qvtx was there)
+	iY += 24;
+	g_SampleUI.AddCheckBox( IDC_TOGGLEQUANTIZED, L"Quantized Vertices", 35, iY += 24, 125, 22, _quantizedVertices );
+
+	// G-buffer slices, AO and composite to Export\ every frame
+	g_SampleUI.AddCheckBox( IDC_TOGGLEEXPORT, L"Export Frames", 35, iY += 24, 125, 22, _exportFrames );
+
+	// the inputs of every frame to Capture\, for FrameReplay
+	g_SampleUI.AddCheckBox( IDC_TOGGLECAPTURE, L"Capture Frames", 35, iY += 24, 125, 22, _captureFrames );
+
 	// textures
 	g_HUD.AddStatic( -1, L"Texture To Render:", 35, iY += 24, 100, 22 ); 
 	g_HUD.AddRadioButton( IDC_VIEWDIFFUSE, IDC_TEXTUREGROUP, L"Diffuse", 35, iY+= 24, 64, 18, true );   
@@ -283,10 +735,9 @@ bool InitializeQuad() {
 
 	// initialize the quad
 
-	// the vertex info
-	vector<VPNS> _quadVertices;
-
-	VPNS v[4];
+	// the vertex info (only needed until the buffer is created)
+	VPNS _quadVertices[4];
+	VPNS* v = _quadVertices;
 
 	/*
 	  2----3
@@ -309,13 +760,8 @@ bool InitializeQuad() {
 	v[3].Normal = D3DXVECTOR3(0, 0, 1.0);
 	v[3].TexCoord = D3DXVECTOR2(1, 1);
 
-	_quadVertices.push_back(v[0]);
-	_quadVertices.push_back(v[1]);
-	_quadVertices.push_back(v[2]);
-	_quadVertices.push_back(v[3]);
-
 	// setup the vertex buffer
-	_numVQuad = _quadVertices.size();
+	_numVQuad = 4;
 
 	D3D10_BUFFER_DESC bd;
 	bd.Usage = D3D10_USAGE_DEFAULT;
@@ -325,7 +771,7 @@ bool InitializeQuad() {
 	bd.MiscFlags = 0;
     
 	D3D10_SUBRESOURCE_DATA InitData;
-	InitData.pSysMem = _quadVertices.data();
+	InitData.pSysMem = _quadVertices;
 	
 	// Do the creation of the actual vertex buffer
 	hr = (*DXUTGetD3D10Device()).CreateBuffer(&bd, &InitData, &_quadVB);
@@ -365,8 +811,8 @@ HRESULT SetupMRTs(ID3D10Device* pd3dDevice) {
 	// Create depth stencil texture.
     D3D10_TEXTURE2D_DESC dstex;
 	ZeroMemory( &dstex, sizeof(dstex) );
-    dstex.Width = _width * TEXSCALE;
-    dstex.Height = _height * TEXSCALE;
+    dstex.Width = _width * _texScale;
+    dstex.Height = _height * _texScale;
     dstex.MipLevels = 1;
     dstex.ArraySize = NUMRTS;
     dstex.SampleDesc.Count = 1;
@@ -393,6 +839,11 @@ HRESULT SetupMRTs(ID3D10Device* pd3dDevice) {
 
     V_RETURN (  pd3dDevice->CreateDepthStencilView( _mrtMapDepth, &DescDS, &_mrtDSV ) );
 
+	// and the one for the first slice only (used when all slices are bound at once)
+    DescDS.Texture2DArray.ArraySize = 1;
+	_mrtSliceDSV = NULL;
+    V_RETURN (  pd3dDevice->CreateDepthStencilView( _mrtMapDepth, &DescDS, &_mrtSliceDSV ) );
+
     // Create all the multiple render target textures
     dstex.Format = DXGI_FORMAT_R16G16B16A16_UNORM;
     dstex.BindFlags = D3D10_BIND_RENDER_TARGET | D3D10_BIND_SHADER_RESOURCE;
@@ -410,6 +861,13 @@ HRESULT SetupMRTs(ID3D10Device* pd3dDevice) {
     DescRT.Texture2DArray.MipSlice = 0;
     V_RETURN ( pd3dDevice->CreateRenderTargetView( _mrtTex, &DescRT, &_mrtRTV ) ); 
 
+	// and one view per slice, so they can be bound as simultaneous render targets
+    DescRT.Texture2DArray.ArraySize = 1;
+	for (UINT slice = 0; slice < 4; ++slice) {
+		DescRT.Texture2DArray.FirstArraySlice = slice;
+		V_RETURN ( pd3dDevice->CreateRenderTargetView( _mrtTex, &DescRT, &_mrtSliceRTV[slice] ) );
+	}
+
 	// Create the shader resource view for the cubic env map
     D3D10_SHADER_RESOURCE_VIEW_DESC SRVDesc;
     ZeroMemory( &SRVDesc, sizeof( SRVDesc ) );
@@ -427,6 +885,70 @@ HRESULT SetupMRTs(ID3D10Device* pd3dDevice) {
 	return S_OK;
 }
 
+//----------------------------------------------
+// Sets up the multisampled G-buffer and the edge mask of -msaa
+//----------------------------------------------
+HRESULT SetupMsaa(ID3D10Device* pd3dDevice) {
+	HRESULT hr;
+
+	// the slices, same format as the mrts
+    D3D10_TEXTURE2D_DESC dstex;
+	ZeroMemory( &dstex, sizeof(dstex) );
+    dstex.Width = _width;
+    dstex.Height = _height;
+    dstex.MipLevels = 1;
+    dstex.ArraySize = NUMRTS;
+    dstex.SampleDesc.Count = MSAA_SAMPLES;
+    dstex.SampleDesc.Quality = 0;
+    dstex.Format = DXGI_FORMAT_R16G16B16A16_UNORM;
+    dstex.Usage = D3D10_USAGE_DEFAULT;
+    dstex.BindFlags = D3D10_BIND_RENDER_TARGET | D3D10_BIND_SHADER_RESOURCE;
+	_msaaTex = NULL;
+    V_RETURN ( pd3dDevice->CreateTexture2D( &dstex, NULL, &_msaaTex ) );
+
+    D3D10_RENDER_TARGET_VIEW_DESC DescRT;
+    DescRT.Format = dstex.Format;
+    DescRT.ViewDimension = D3D10_RTV_DIMENSION_TEXTURE2DMSARRAY;
+    DescRT.Texture2DMSArray.ArraySize = 1;
+	for (UINT slice = 0; slice < 4; ++slice) {
+		DescRT.Texture2DMSArray.FirstArraySlice = slice;
+		V_RETURN ( pd3dDevice->CreateRenderTargetView( _msaaTex, &DescRT, &_msaaSliceRTV[slice] ) );
+	}
+
+    D3D10_SHADER_RESOURCE_VIEW_DESC SRVDesc;
+    ZeroMemory( &SRVDesc, sizeof( SRVDesc ) );
+	SRVDesc.Format = dstex.Format;
+    SRVDesc.ViewDimension = D3D10_SRV_DIMENSION_TEXTURE2DMSARRAY;
+	SRVDesc.Texture2DMSArray.FirstArraySlice = 0;
+	SRVDesc.Texture2DMSArray.ArraySize = NUMRTS;
+	_msaaSRV = NULL;
+    V_RETURN ( pd3dDevice->CreateShaderResourceView( _msaaTex, &SRVDesc, &_msaaSRV ) );
+
+	// multisampled depth (only the first slice is ever bound)
+    dstex.ArraySize = 1;
+    dstex.Format = DXGI_FORMAT_D32_FLOAT;
+    dstex.BindFlags = D3D10_BIND_DEPTH_STENCIL;
+	_msaaDepthTex = NULL;
+    V_RETURN ( pd3dDevice->CreateTexture2D( &dstex, NULL, &_msaaDepthTex ) );
+
+    D3D10_DEPTH_STENCIL_VIEW_DESC DescDS;
+	DescDS.Format = dstex.Format;
+    DescDS.ViewDimension = D3D10_DSV_DIMENSION_TEXTURE2DMS;
+	_msaaDSV = NULL;
+    V_RETURN ( pd3dDevice->CreateDepthStencilView( _msaaDepthTex, &DescDS, &_msaaDSV ) );
+
+	// the edge mask, single-sampled
+    dstex.SampleDesc.Count = 1;
+    dstex.Format = DXGI_FORMAT_R8_UNORM;
+    dstex.BindFlags = D3D10_BIND_RENDER_TARGET | D3D10_BIND_SHADER_RESOURCE;
+	_edgeTex = NULL;
+    V_RETURN ( pd3dDevice->CreateTexture2D( &dstex, NULL, &_edgeTex ) );
+    V_RETURN ( pd3dDevice->CreateRenderTargetView( _edgeTex, NULL, &_edgeRTV ) );
+    V_RETURN ( pd3dDevice->CreateShaderResourceView( _edgeTex, NULL, &_edgeSRV ) );
+
+	return S_OK;
+}
+
 //----------------------------------------------
 // Sets up the Ambient Occlusion & Gaussian Blur Textures
 //----------------------------------------------
@@ -436,8 +958,8 @@ HRESULT SetupAO(ID3D10Device* pd3dDevice) {
 	// Create depth stencil texture.
     D3D10_TEXTURE2D_DESC dstex;
 	ZeroMemory( &dstex, sizeof(dstex) );
-    dstex.Width = _width * TEXSCALE;		// TODO: Maybe downsample for gaussian buffer?
-    dstex.Height = _height * TEXSCALE;
+    dstex.Width = _width * _texScale;		// TODO: Maybe downsample for gaussian buffer?
+    dstex.Height = _height * _texScale;
     dstex.MipLevels = 1;
     dstex.ArraySize = 1;
     dstex.SampleDesc.Count = 1;
@@ -502,6 +1024,691 @@ HRESULT SetupAO(ID3D10Device* pd3dDevice) {
 	return S_OK;
 }
 
+//----------------------------------------------
+// Sets up the hierarchical depth pyramid
+// (mip 0 matches the G-buffer, every further mip halves it)
+//----------------------------------------------
+HRESULT SetupDepthPyramid(ID3D10Device* pd3dDevice) {
+	HRESULT hr;
+
+	D3D10_TEXTURE2D_DESC dstex;
+	ZeroMemory( &dstex, sizeof(dstex) );
+	dstex.Width = _width * _texScale;
+	dstex.Height = _height * _texScale;
+	dstex.MipLevels = PYRAMIDMIPS;
+	dstex.ArraySize = 1;
+	dstex.SampleDesc.Count = 1;
+	dstex.SampleDesc.Quality = 0;
+	dstex.Format = DXGI_FORMAT_R32G32_FLOAT;		// min and max linear view-space Z
+	dstex.Usage = D3D10_USAGE_DEFAULT;
+	dstex.BindFlags = D3D10_BIND_RENDER_TARGET | D3D10_BIND_SHADER_RESOURCE;
+	dstex.CPUAccessFlags = 0;
+
+	_pyramidTex = NULL;
+	_pyramidFrame = 0;
+	V_RETURN ( pd3dDevice->CreateTexture2D( &dstex, NULL, &_pyramidTex ) );
+
+	// One render target view and one shader resource view per mip:
+	// mip i is written while mip i-1 is read
+	D3D10_RENDER_TARGET_VIEW_DESC DescRT;
+	DescRT.Format = dstex.Format;
+	DescRT.ViewDimension = D3D10_RTV_DIMENSION_TEXTURE2D;
+
+	D3D10_SHADER_RESOURCE_VIEW_DESC SRVDesc;
+	ZeroMemory( &SRVDesc, sizeof( SRVDesc ) );
+	SRVDesc.Format = dstex.Format;
+	SRVDesc.ViewDimension = D3D10_SRV_DIMENSION_TEXTURE2D;
+	SRVDesc.Texture2D.MipLevels = 1;
+
+	for (UINT mip = 0; mip < PYRAMIDMIPS; ++mip) {
+		DescRT.Texture2D.MipSlice = mip;
+		V_RETURN ( pd3dDevice->CreateRenderTargetView( _pyramidTex, &DescRT, &_pyramidRTV[mip] ) );
+
+		SRVDesc.Texture2D.MostDetailedMip = mip;
+		V_RETURN ( pd3dDevice->CreateShaderResourceView( _pyramidTex, &SRVDesc, &_pyramidMipSRV[mip] ) );
+	}
+
+	// The whole pyramid (sampled with SampleLevel by the AO pass)
+	SRVDesc.Texture2D.MostDetailedMip = 0;
+	SRVDesc.Texture2D.MipLevels = PYRAMIDMIPS;
+	_pyramidSRV = NULL;
+	V_RETURN ( pd3dDevice->CreateShaderResourceView( _pyramidTex, &SRVDesc, &_pyramidSRV ) );
+
+	return S_OK;
+}
+
+//----------------------------------------------
+// Sets up the quarter-resolution layers for deinterleaved AO
+// and the queries for timing the AO passes
+//----------------------------------------------
+HRESULT SetupDeinterleavedAO(ID3D10Device* pd3dDevice) {
+	HRESULT hr;
+
+	UINT width = _width * _texScale;
+	UINT height = _height * _texScale;
+
+	D3D10_TEXTURE2D_DESC dstex;
+	ZeroMemory( &dstex, sizeof(dstex) );
+	dstex.Width = ( width + INTERLEAVE - 1 ) / INTERLEAVE;
+	dstex.Height = ( height + INTERLEAVE - 1 ) / INTERLEAVE;
+	dstex.MipLevels = 1;
+	dstex.ArraySize = NUMLAYERS;
+	dstex.SampleDesc.Count = 1;
+	dstex.SampleDesc.Quality = 0;
+	dstex.Format = DXGI_FORMAT_R32G32B32A32_FLOAT;	// normal + linear view-space Z
+	dstex.Usage = D3D10_USAGE_DEFAULT;
+	dstex.BindFlags = D3D10_BIND_RENDER_TARGET | D3D10_BIND_SHADER_RESOURCE;
+	dstex.CPUAccessFlags = 0;
+
+	_deintTex = NULL;
+	V_RETURN ( pd3dDevice->CreateTexture2D( &dstex, NULL, &_deintTex ) );
+
+	dstex.Format = DXGI_FORMAT_R16G16B16A16_UNORM;	// same as the ao texture
+	_layerAOTex = NULL;
+	V_RETURN ( pd3dDevice->CreateTexture2D( &dstex, NULL, &_layerAOTex ) );
+
+	// One render target view per layer
+	D3D10_RENDER_TARGET_VIEW_DESC DescRT;
+	DescRT.ViewDimension = D3D10_RTV_DIMENSION_TEXTURE2DARRAY;
+	DescRT.Texture2DArray.ArraySize = 1;
+	DescRT.Texture2DArray.MipSlice = 0;
+	for (UINT layer = 0; layer < NUMLAYERS; ++layer) {
+		DescRT.Texture2DArray.FirstArraySlice = layer;
+
+		DescRT.Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
+		V_RETURN ( pd3dDevice->CreateRenderTargetView( _deintTex, &DescRT, &_deintRTV[layer] ) );
+		DescRT.Format = DXGI_FORMAT_R16G16B16A16_UNORM;
+		V_RETURN ( pd3dDevice->CreateRenderTargetView( _layerAOTex, &DescRT, &_layerAORTV[layer] ) );
+	}
+
+	// One shader resource view over all layers
+	D3D10_SHADER_RESOURCE_VIEW_DESC SRVDesc;
+	ZeroMemory( &SRVDesc, sizeof( SRVDesc ) );
+	SRVDesc.ViewDimension = D3D10_SRV_DIMENSION_TEXTURE2DARRAY;
+	SRVDesc.Texture2DArray.ArraySize = NUMLAYERS;
+	SRVDesc.Texture2DArray.FirstArraySlice = 0;
+	SRVDesc.Texture2DArray.MipLevels = 1;
+	SRVDesc.Texture2DArray.MostDetailedMip = 0;
+
+	SRVDesc.Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
+	_deintSRV = NULL;
+	V_RETURN ( pd3dDevice->CreateShaderResourceView( _deintTex, &SRVDesc, &_deintSRV ) );
+	SRVDesc.Format = DXGI_FORMAT_R16G16B16A16_UNORM;
+	_layerAOSRV = NULL;
+	V_RETURN ( pd3dDevice->CreateShaderResourceView( _layerAOTex, &SRVDesc, &_layerAOSRV ) );
+
+	// Timestamp queries for the ao passes
+	D3D10_QUERY_DESC queryDesc;
+	queryDesc.MiscFlags = 0;
+	queryDesc.Query = D3D10_QUERY_TIMESTAMP_DISJOINT;
+	V_RETURN ( pd3dDevice->CreateQuery( &queryDesc, &_aoTimerDisjoint ) );
+	queryDesc.Query = D3D10_QUERY_TIMESTAMP;
+	for (int i = 0; i <= AO_STAGES; ++i)
+		V_RETURN ( pd3dDevice->CreateQuery( &queryDesc, &_aoTimestamps[i] ) );
+
+	return S_OK;
+}
+
+//----------------------------------------------
+// Sets up the history textures for temporal AO
+//----------------------------------------------
+HRESULT SetupTemporalAO(ID3D10Device* pd3dDevice) {
+	HRESULT hr;
+
+	D3D10_TEXTURE2D_DESC dstex;
+	ZeroMemory( &dstex, sizeof(dstex) );
+	dstex.Width = _width * _texScale;
+	dstex.Height = _height * _texScale;
+	dstex.MipLevels = 1;
+	dstex.ArraySize = 1;
+	dstex.SampleDesc.Count = 1;
+	dstex.SampleDesc.Quality = 0;
+	dstex.Format = DXGI_FORMAT_R16G16B16A16_UNORM;	// same as the ao texture (copied into it)
+	dstex.Usage = D3D10_USAGE_DEFAULT;
+	dstex.BindFlags = D3D10_BIND_RENDER_TARGET | D3D10_BIND_SHADER_RESOURCE;
+	dstex.CPUAccessFlags = 0;
+
+	D3D10_RENDER_TARGET_VIEW_DESC DescRT;
+	DescRT.Format = dstex.Format;
+	DescRT.ViewDimension = D3D10_RTV_DIMENSION_TEXTURE2D;
+	DescRT.Texture2D.MipSlice = 0;
+
+	D3D10_SHADER_RESOURCE_VIEW_DESC SRVDesc;
+	ZeroMemory( &SRVDesc, sizeof( SRVDesc ) );
+	SRVDesc.Format = dstex.Format;
+	SRVDesc.ViewDimension = D3D10_SRV_DIMENSION_TEXTURE2D;
+	SRVDesc.Texture2D.MipLevels = 1;
+	SRVDesc.Texture2D.MostDetailedMip = 0;
+
+	for (UINT i = 0; i < 2; ++i) {
+		V_RETURN ( pd3dDevice->CreateTexture2D( &dstex, NULL, &_aoHistoryTex[i] ) );
+		V_RETURN ( pd3dDevice->CreateRenderTargetView( _aoHistoryTex[i], &DescRT, &_aoHistoryRTV[i] ) );
+		V_RETURN ( pd3dDevice->CreateShaderResourceView( _aoHistoryTex[i], &SRVDesc, &_aoHistorySRV[i] ) );
+	}
+
+	// last frame's normals (copied from the normal slice of the mrts)
+	dstex.BindFlags = D3D10_BIND_SHADER_RESOURCE;
+	V_RETURN ( pd3dDevice->CreateTexture2D( &dstex, NULL, &_prevNormalTex ) );
+	V_RETURN ( pd3dDevice->CreateShaderResourceView( _prevNormalTex, &SRVDesc, &_prevNormalSRV ) );
+
+	// last frame's linear depth (copied from mip 0 of the depth pyramid)
+	dstex.Format = DXGI_FORMAT_R32G32_FLOAT;
+	SRVDesc.Format = dstex.Format;
+	V_RETURN ( pd3dDevice->CreateTexture2D( &dstex, NULL, &_prevDepthTex ) );
+	V_RETURN ( pd3dDevice->CreateShaderResourceView( _prevDepthTex, &SRVDesc, &_prevDepthSRV ) );
+
+	_historyValid = false;
+	return S_OK;
+}
+
+//----------------------------------------------
+// Sets up the shading rate map and the coarse ambient occlusion (variable-rate AO)
+//----------------------------------------------
+HRESULT SetupShadingRate(ID3D10Device* pd3dDevice) {
+	HRESULT hr;
+
+	UINT width = _width * _texScale;
+	UINT height = _height * _texScale;
+
+	D3D10_TEXTURE2D_DESC dstex;
+	ZeroMemory( &dstex, sizeof(dstex) );
+	dstex.Width = ( width + RATETILE - 1 ) / RATETILE;
+	dstex.Height = ( height + RATETILE - 1 ) / RATETILE;
+	dstex.MipLevels = 1;
+	dstex.ArraySize = 1;
+	dstex.SampleDesc.Count = 1;
+	dstex.SampleDesc.Quality = 0;
+	dstex.Format = DXGI_FORMAT_R8_UNORM;
+	dstex.Usage = D3D10_USAGE_DEFAULT;
+	dstex.BindFlags = D3D10_BIND_RENDER_TARGET | D3D10_BIND_SHADER_RESOURCE;
+	dstex.CPUAccessFlags = 0;
+	V_RETURN ( pd3dDevice->CreateTexture2D( &dstex, NULL, &_rateTex ) );
+	V_RETURN ( pd3dDevice->CreateRenderTargetView( _rateTex, NULL, &_rateRTV ) );
+	V_RETURN ( pd3dDevice->CreateShaderResourceView( _rateTex, NULL, &_rateSRV ) );
+
+	// same format as the ao texture, 1/2 and 1/4 of its size
+	dstex.Format = DXGI_FORMAT_R16G16B16A16_UNORM;
+	for (UINT i = 0; i < 2; ++i) {
+		UINT rate = 2 << i;
+		dstex.Width = ( width + rate - 1 ) / rate;
+		dstex.Height = ( height + rate - 1 ) / rate;
+		V_RETURN ( pd3dDevice->CreateTexture2D( &dstex, NULL, &_coarseAOTex[i] ) );
+		V_RETURN ( pd3dDevice->CreateRenderTargetView( _coarseAOTex[i], NULL, &_coarseAORTV[i] ) );
+		V_RETURN ( pd3dDevice->CreateShaderResourceView( _coarseAOTex[i], NULL, &_coarseAOSRV[i] ) );
+	}
+	return S_OK;
+}
+
+// The shadow map and the static cache: depth targets that are read as textures
+HRESULT SetupShadows(ID3D10Device* pd3dDevice) {
+	HRESULT hr;
+
+	D3D10_TEXTURE2D_DESC dstex;
+	ZeroMemory( &dstex, sizeof(dstex) );
+	dstex.Width = SHADOWSIZE;
+	dstex.Height = SHADOWSIZE;
+	dstex.MipLevels = 1;
+	dstex.ArraySize = 1;
+	dstex.SampleDesc.Count = 1;
+	dstex.SampleDesc.Quality = 0;
+	dstex.Format = DXGI_FORMAT_R32_TYPELESS;
+	dstex.Usage = D3D10_USAGE_DEFAULT;
+	dstex.BindFlags = D3D10_BIND_DEPTH_STENCIL | D3D10_BIND_SHADER_RESOURCE;
+	dstex.CPUAccessFlags = 0;
+
+	D3D10_DEPTH_STENCIL_VIEW_DESC descDSV;
+	ZeroMemory( &descDSV, sizeof(descDSV) );
+	descDSV.Format = DXGI_FORMAT_D32_FLOAT;
+	descDSV.ViewDimension = D3D10_DSV_DIMENSION_TEXTURE2D;
+	descDSV.Texture2D.MipSlice = 0;
+
+	D3D10_SHADER_RESOURCE_VIEW_DESC descSRV;
+	ZeroMemory( &descSRV, sizeof(descSRV) );
+	descSRV.Format = DXGI_FORMAT_R32_FLOAT;
+	descSRV.ViewDimension = D3D10_SRV_DIMENSION_TEXTURE2D;
+	descSRV.Texture2D.MostDetailedMip = 0;
+	descSRV.Texture2D.MipLevels = 1;
+
+	for (UINT i = 0; i < 2; ++i) {
+		V_RETURN ( pd3dDevice->CreateTexture2D( &dstex, NULL, &_shadowTex[i] ) );
+		V_RETURN ( pd3dDevice->CreateDepthStencilView( _shadowTex[i], &descDSV, &_shadowDSV[i] ) );
+		V_RETURN ( pd3dDevice->CreateShaderResourceView( _shadowTex[i], &descSRV, &_shadowSRV[i] ) );
+	}
+
+	// new targets: everything is rendered again on the first frame
+	_shadowLight = Versioned<Mat4>();
+	_shadowWorld = Versioned<Mat4>();
+	_shadowPuffiness = Versioned<float>();
+	_shadowChunks.clear();
+	SetRectEmpty( &_shadowCasterRect );
+	return S_OK;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Size of the pixel shader bytecode of an effect pass
+//--------------------------------------------------------------------------------------
+UINT PixelShaderBytes( ID3D10EffectPass* pPass ) {
+	D3D10_PASS_SHADER_DESC passShader;
+	D3D10_EFFECT_SHADER_DESC shaderDesc;
+	if (FAILED( pPass->GetPixelShaderDesc( &passShader ) ) ||
+		FAILED( passShader.pShaderVariable->GetShaderDesc( passShader.ShaderIndex, &shaderDesc ) ))
+		return 0;
+	return shaderDesc.BytecodeLength;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Compiling the effect through the cache
+//--------------------------------------------------------------------------------------
+DWORD EffectShaderFlags() {
+    DWORD dwShaderFlags = D3D10_SHADER_ENABLE_STRICTNESS;
+#if defined( DEBUG ) || defined( _DEBUG )
+    // Set the D3D10_SHADER_DEBUG flag to embed debug information in the shaders.
+    // Setting this flag improves the shader debugging experience, but still allows 
+    // the shaders to be optimized and to run exactly the way they will run in 
+    // the release configuration of this program.
+    dwShaderFlags |= D3D10_SHADER_DEBUG;
+    #endif
+	return dwShaderFlags;
+}
+
+// Serves #includes from the files LoadEffectSource read (and hashed), resolved
+// against the including file the way LoadEffectSource resolved them
+class CachedEffectInclude : public ID3D10Include {
+public:
+	CachedEffectInclude( const EffectSource& source ) : _source( source ) {}
+
+	STDMETHOD( Open )( D3D10_INCLUDE_TYPE IncludeType, LPCSTR pFileName, LPCVOID pParentData, LPCVOID* ppData, UINT* pBytes ) {
+		// pParentData is the text Open returned for the including file, NULL for the effect itself
+		const std::string* from = &_source.path;
+		for (size_t i = 0; i < _source.includes.size(); ++i)
+			if (pParentData == _source.includes[i].text.data())
+				from = &_source.includes[i].path;
+		const std::string* text = _source.FindInclude( pFileName, *from );
+		if (!text)
+			return E_FAIL;
+		*ppData = text->data();
+		*pBytes = (UINT)text->size();
+		return S_OK;
+	}
+	STDMETHOD( Close )( LPCVOID pData ) {
+		return S_OK;
+	}
+
+private:
+	const EffectSource& _source;
+};
+
+// The compiler the cache runs on its worker thread (needs no device)
+bool CompileEffect( const EffectSource& source, std::vector<char>& blob, std::string& errors ) {
+	std::vector<D3D10_SHADER_MACRO> macros;
+	for (size_t i = 0; i < source.defines.size(); ++i) {
+		D3D10_SHADER_MACRO macro = { source.defines[i].name.c_str(), source.defines[i].definition.c_str() };
+		macros.push_back( macro );
+	}
+	D3D10_SHADER_MACRO end = { NULL, NULL };
+	macros.push_back( end );
+
+	CachedEffectInclude include( source );
+	ID3D10Blob* pCompiled = NULL;
+	ID3D10Blob* pErrors = NULL;
+	HRESULT hr = D3DX10CompileFromMemory( source.text.data(), source.text.size(), source.path.c_str(), &macros[0],
+										  &include, NULL, source.profile.c_str(), source.flags, 0, NULL,
+										  &pCompiled, &pErrors, NULL );
+	if (pErrors) {
+		errors.assign( (const char*)pErrors->GetBufferPointer(), pErrors->GetBufferSize() );
+		SAFE_RELEASE( pErrors );
+	}
+	if (FAILED( hr ) || !pCompiled) {
+		SAFE_RELEASE( pCompiled );
+		return false;
+	}
+	const char* data = (const char*)pCompiled->GetBufferPointer();
+	blob.assign( data, data + pCompiled->GetBufferSize() );
+	SAFE_RELEASE( pCompiled );
+	return true;
+}
+
+// Starts loading/compiling DeferredShading.fx. If the source can't be read here,
+// OnD3D10CreateDevice falls back to D3DX10CreateEffectFromFile.
+void RequestEffect() {
+	WCHAR str[MAX_PATH];
+	char path[MAX_PATH];
+	EffectSource source;
+	if (FAILED( DXUTFindDXSDKMediaFileCch( str, MAX_PATH, L"DeferredShading.fx" ) ) ||
+		!WideCharToMultiByte( CP_ACP, 0, str, -1, path, MAX_PATH, NULL, NULL ) ||
+		!LoadEffectSource( path, source ))
+		return;
+	char compiler[64];
+	sprintf_s( compiler, sizeof( compiler ), "D3DX10 %d, D3D10 %d", D3DX10_SDK_VERSION, D3D10_SDK_VERSION );
+	source.compiler = compiler;
+	source.profile = "fx_4_0";
+	source.flags = EffectShaderFlags();
+
+	_effectCache = new EffectCache( "EffectCache", CompileEffect );
+	_effectRequest = _effectCache->Request( source );
+}
+
+
+//--------------------------------------------------------------------------------------
+// Loading the assets (mesh, material textures, random vectors) on the loader's threads
+//--------------------------------------------------------------------------------------
+struct DecodedImage {
+	UINT width, height;
+	std::vector<BYTE> pixels;		// R8G8B8A8
+};
+
+bool MediaPath( const WCHAR* name, std::string& path ) {
+	WCHAR str[MAX_PATH];
+	char narrow[MAX_PATH];
+	if (FAILED( DXUTFindDXSDKMediaFileCch( str, MAX_PATH, name ) ) ||
+		!WideCharToMultiByte( CP_ACP, 0, str, -1, narrow, MAX_PATH, NULL, NULL ))
+		return false;
+	path = narrow;
+	return true;
+}
+
+// Pool thread: decodes PNG/JPG/BMP with WIC. Formats WIC doesn't know (DDS) are already
+// laid out for the GPU, so they are only checked here and created by D3DX on finalize.
+bool DecodeImage( Asset& asset ) {
+	if (asset.bytes.empty())
+		return false;
+
+	HRESULT hrInit = CoInitializeEx( NULL, COINIT_MULTITHREADED );
+	IWICImagingFactory* pFactory = NULL;
+	IWICStream* pStream = NULL;
+	IWICBitmapDecoder* pDecoder = NULL;
+	IWICBitmapFrameDecode* pFrame = NULL;
+	IWICFormatConverter* pConverter = NULL;
+	DecodedImage* pImage = new DecodedImage;
+	HRESULT hr = CoCreateInstance( CLSID_WICImagingFactory, NULL, CLSCTX_INPROC_SERVER, __uuidof( IWICImagingFactory ),
+								   (LPVOID*)&pFactory );
+	if (SUCCEEDED( hr )) hr = pFactory->CreateStream( &pStream );
+	if (SUCCEEDED( hr )) hr = pStream->InitializeFromMemory( (BYTE*)&asset.bytes[0], (DWORD)asset.bytes.size() );
+	if (SUCCEEDED( hr )) hr = pFactory->CreateDecoderFromStream( pStream, NULL, WICDecodeMetadataCacheOnDemand, &pDecoder );
+	if (SUCCEEDED( hr )) hr = pDecoder->GetFrame( 0, &pFrame );
+	if (SUCCEEDED( hr )) hr = pFactory->CreateFormatConverter( &pConverter );
+	if (SUCCEEDED( hr )) hr = pConverter->Initialize( pFrame, GUID_WICPixelFormat32bppRGBA, WICBitmapDitherTypeNone,
+													  NULL, 0.0, WICBitmapPaletteTypeCustom );
+	if (SUCCEEDED( hr )) hr = pConverter->GetSize( &pImage->width, &pImage->height );
+	if (SUCCEEDED( hr )) {
+		pImage->pixels.resize( pImage->width * pImage->height * 4 );
+		hr = pConverter->CopyPixels( NULL, pImage->width * 4, (UINT)pImage->pixels.size(), &pImage->pixels[0] );
+	}
+	SAFE_RELEASE( pConverter );
+	SAFE_RELEASE( pFrame );
+	SAFE_RELEASE( pDecoder );
+	SAFE_RELEASE( pStream );
+	SAFE_RELEASE( pFactory );
+	if (SUCCEEDED( hrInit ))
+		CoUninitialize();
+
+	if (SUCCEEDED( hr )) {
+		asset.decoded = std::shared_ptr<void>( pImage );
+		return true;
+	}
+	delete pImage;
+	D3DX10_IMAGE_INFO info;
+	return SUCCEEDED( D3DX10GetImageInfoFromMemory( &asset.bytes[0], asset.bytes.size(), NULL, &info, NULL ) );
+}
+
+// Render thread: the texture of a decoded image asset
+HRESULT CreateTextureFromAsset( ID3D10Device* pd3dDevice, const Asset& asset, ID3D10ShaderResourceView** ppSRV ) {
+	HRESULT hr;
+	const DecodedImage* pImage = (const DecodedImage*)asset.decoded.get();
+	if (!pImage)
+		return D3DX10CreateShaderResourceViewFromMemory( pd3dDevice, &asset.bytes[0], asset.bytes.size(), NULL, NULL,
+														 ppSRV, NULL );
+
+	D3D10_TEXTURE2D_DESC dstex;
+	ZeroMemory( &dstex, sizeof(dstex) );
+	dstex.Width = pImage->width;
+	dstex.Height = pImage->height;
+	dstex.MipLevels = 1;
+	dstex.ArraySize = 1;
+	dstex.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	dstex.SampleDesc.Count = 1;
+	dstex.Usage = D3D10_USAGE_IMMUTABLE;
+	dstex.BindFlags = D3D10_BIND_SHADER_RESOURCE;
+	D3D10_SUBRESOURCE_DATA initData = { &pImage->pixels[0], pImage->width * 4, 0 };
+	ID3D10Texture2D* pTexture = NULL;
+	V_RETURN( pd3dDevice->CreateTexture2D( &dstex, &initData, &pTexture ) );
+	hr = pd3dDevice->CreateShaderResourceView( pTexture, NULL, ppSRV );
+	SAFE_RELEASE( pTexture );
+	return hr;
+}
+
+// Textures cooked by TextureCooker: the levels are used straight from the mapped file
+struct CookedTexture {
+	MappedFile file;
+	CookedTextureView view;
+};
+
+std::string CookedPath( const std::string& path ) {
+	size_t dot = path.find_last_of( '.' );
+	return path.substr( 0, dot == std::string::npos || dot < path.find_last_of( "\\/" ) + 1 ? path.size() : dot ) + ".ctex";
+}
+
+bool MapCookedTexture( const std::string& path, Asset& asset ) {
+	CookedTexture* pCooked = new CookedTexture;
+	asset.decoded = std::shared_ptr<void>( pCooked );
+	return pCooked->file.Open( path ) && ParseCookedTexture( pCooked->file.Data(), pCooked->file.Size(), pCooked->view );
+}
+
+HRESULT CreateCookedTexture( ID3D10Device* pd3dDevice, const CookedTexture& cooked, ID3D10ShaderResourceView** ppSRV ) {
+	HRESULT hr;
+	const CookedTextureHeader* pHeader = cooked.view.header;
+	D3D10_TEXTURE2D_DESC dstex;
+	ZeroMemory( &dstex, sizeof(dstex) );
+	dstex.Width = pHeader->width;
+	dstex.Height = pHeader->height;
+	dstex.MipLevels = pHeader->mipCount;
+	dstex.ArraySize = 1;
+	dstex.Format = (DXGI_FORMAT)pHeader->dxgiFormat;
+	dstex.SampleDesc.Count = 1;
+	dstex.Usage = D3D10_USAGE_IMMUTABLE;
+	dstex.BindFlags = D3D10_BIND_SHADER_RESOURCE;
+	D3D10_SUBRESOURCE_DATA initData[COOKED_MAX_MIPS];
+	for (UINT i = 0; i < pHeader->mipCount; ++i) {
+		initData[i].pSysMem = cooked.view.levels[i];
+		initData[i].SysMemPitch = pHeader->levels[i].rowPitch;
+		initData[i].SysMemSlicePitch = 0;
+	}
+	ID3D10Texture2D* pTexture = NULL;
+	V_RETURN( pd3dDevice->CreateTexture2D( &dstex, initData, &pTexture ) );
+	hr = pd3dDevice->CreateShaderResourceView( pTexture, NULL, ppSRV );
+	SAFE_RELEASE( pTexture );
+	return hr;
+}
+
+// Queues a texture: the cooked .ctex next to it if there is one, otherwise the source.
+// If an optional one can't be made, *ppSRV stays NULL and what needs it goes on.
+AssetId AddTexture( ID3D10Device* pd3dDevice, const std::string& name, const std::string& path,
+					const std::vector<AssetId>& dependencies, ID3D10ShaderResourceView** ppSRV, bool optional ) {
+	std::string cookedPath = CookedPath( path );
+	FILE* pFile = fopen( cookedPath.c_str(), "rb" );
+	if (pFile) {
+		fclose( pFile );
+		return _assetLoader->Add( name + " (cooked)", "", dependencies, [=]( Asset& asset ) -> bool {
+			return MapCookedTexture( cookedPath, asset );
+		}, [=]( Asset& asset ) -> bool {
+			return SUCCEEDED( CreateCookedTexture( pd3dDevice, *(const CookedTexture*)asset.decoded.get(), ppSRV ) );
+		}, optional );
+	}
+	return _assetLoader->Add( name, path, dependencies, DecodeImage, [=]( Asset& asset ) -> bool {
+		return SUCCEEDED( CreateTextureFromAsset( pd3dDevice, asset, ppSRV ) );
+	}, optional );
+}
+
+// What the mesh's decode step found: its material textures, made by their own assets
+// (a NULL one failed, and the mesh gets the error resource for it)
+struct MeshMaterials {
+	std::vector<std::string> names;
+	std::vector<ID3D10ShaderResourceView*> textures;
+
+	~MeshMaterials() {
+		for (size_t i = 0; i < textures.size(); ++i)
+			SAFE_RELEASE( textures[i] );		// the mesh holds its own references
+	}
+};
+
+// Hands the mesh the material textures the loader already created
+void CALLBACK MeshTextureFromLoader( ID3D10Device* pDev, char* szFileName, ID3D10ShaderResourceView** ppRV,
+									 void* pContext ) {
+	std::map<std::string, ID3D10ShaderResourceView*>::iterator found = _meshTextures.find( szFileName );
+	if (found == _meshTextures.end() || !found->second) {
+		*ppRV = (ID3D10ShaderResourceView*)ERROR_RESOURCE_VALUE;
+		return;
+	}
+	*ppRV = found->second;
+	( *ppRV )->AddRef();			// the mesh releases it in Destroy
+}
+
+// Vertex buffer of the quantized vertices and the boxes. A .qvtx made from another
+// mesh is left out (the float vertices are used).
+HRESULT CreateQuantizedVB( ID3D10Device* pd3dDevice, const MappedFile& file ) {
+	QuantizedMeshView view;
+	ParseQuantizedMesh( file.Data(), file.Size(), view );
+	if (view.header->numVertices != g_Mesh.GetNumVertices( 0, 0 ) || view.header->numSubsets != g_Mesh.GetNumSubsets( 0 ) ||
+		view.header->sourceStride != g_Mesh.GetVertexStride( 0, 0 )) {
+		OutputDebugStringA( "tiny.sdkmesh.qvtx doesn't match the mesh, using the float vertices\n" );
+		return S_OK;
+	}
+
+	D3D10_BUFFER_DESC bd;
+	bd.Usage = D3D10_USAGE_IMMUTABLE;
+	bd.ByteWidth = view.header->numVertices * sizeof( PackedVertex );
+	bd.BindFlags = D3D10_BIND_VERTEX_BUFFER;
+	bd.CPUAccessFlags = 0;
+	bd.MiscFlags = 0;
+	D3D10_SUBRESOURCE_DATA InitData;
+	InitData.pSysMem = view.vertices;
+	HRESULT hr;
+	V_RETURN( pd3dDevice->CreateBuffer( &bd, &InitData, &_quantizedVB ) );
+	_quantRanges.assign( view.ranges, view.ranges + view.header->numRanges );
+	_subsetRange.assign( view.subsetRange, view.subsetRange + view.header->numSubsets );
+	return S_OK;
+}
+
+// Queues the assets. The mesh is parsed first for its material textures; the mesh
+// buffers are created once those are.
+HRESULT LoadAssets( ID3D10Device* pd3dDevice ) {
+	std::string meshPath, vectorsPath;
+	if (!MediaPath( L"Tiny\\tiny.sdkmesh", meshPath ))
+		return DXUTERR_MEDIANOTFOUND;
+
+	_assetLoader = new AssetLoader();
+	std::vector<AssetId> none;
+
+	// the random vectors
+#if BLUE_NOISE_ROTATIONS
+	BlueNoiseParams params = _blueNoiseParams;
+	_assetLoader->Add( "blue noise", "", none, [=]( Asset& asset ) -> bool {
+		std::vector<unsigned short> ranks;
+		if (!LoadOrGenerateBlueNoise( "BlueNoise", params, (int)std::thread::hardware_concurrency(), ranks )) {
+			asset.error = "bad blue noise parameters";
+			return false;
+		}
+		std::shared_ptr<DecodedImage> pImage( new DecodedImage );
+		pImage->width = pImage->height = params.size;
+		MakeRotationTexture( params, ranks, pImage->pixels );
+		asset.decoded = pImage;
+		return true;
+	}, [=]( Asset& asset ) -> bool {
+		return SUCCEEDED( CreateTextureFromAsset( pd3dDevice, asset, &_vectorSRV ) );
+	} );
+#else
+	if (!MediaPath( L"vectors.png", vectorsPath ))
+		return DXUTERR_MEDIANOTFOUND;
+	AddTexture( pd3dDevice, "vectors.png", vectorsPath, none, &_vectorSRV, false );
+#endif
+
+	// the mesh: its materials name the textures
+	std::string meshDirectory = meshPath.substr( 0, meshPath.find_last_of( "\\/" ) + 1 );
+	_assetLoader->Add( "tiny.sdkmesh", meshPath, none, [=]( Asset& asset ) -> bool {
+		if (asset.bytes.size() < sizeof(SDKMESH_HEADER)) {
+			asset.error = "not an sdkmesh";
+			return false;
+		}
+		const BYTE* pData = (const BYTE*)&asset.bytes[0];
+		const SDKMESH_HEADER* pHeader = (const SDKMESH_HEADER*)pData;
+		if (pHeader->Version != SDKMESH_FILE_VERSION ||
+			pHeader->MaterialDataOffset + pHeader->NumMaterials * sizeof(SDKMESH_MATERIAL) > asset.bytes.size()) {
+			asset.error = "not an sdkmesh";
+			return false;
+		}
+
+		// the names go in the asset: _meshTextures is only touched on the render thread
+		std::shared_ptr<MeshMaterials> pMeshMaterials( new MeshMaterials );
+		std::vector<std::string>& names = pMeshMaterials->names;
+		const SDKMESH_MATERIAL* pMaterials = (const SDKMESH_MATERIAL*)( pData + pHeader->MaterialDataOffset );
+		for (UINT m = 0; m < pHeader->NumMaterials; ++m) {
+			std::string name( pMaterials[m].DiffuseTexture, strnlen( pMaterials[m].DiffuseTexture, MAX_TEXTURE_NAME ) );
+			if (name.empty() || std::find( names.begin(), names.end(), name ) != names.end())
+				continue;
+			names.push_back( name );
+		}
+		pMeshMaterials->textures.assign( names.size(), NULL );
+		asset.decoded = pMeshMaterials;
+
+		// the textures are optional: a missing one is drawn with the error resource
+		std::vector<AssetId> needed;
+		AssetId self = asset.id;
+		needed.push_back( self );
+		for (size_t i = 0; i < names.size(); ++i) {
+			needed.push_back( AddTexture( pd3dDevice, names[i], meshDirectory + names[i], std::vector<AssetId>( 1, self ),
+										  &pMeshMaterials->textures[i], true ) );
+		}
+
+		// vertex and index buffers, once every texture exists or failed
+		AssetId buffers = _assetLoader->Add( "tiny.sdkmesh buffers", "", needed, nullptr, [=]( Asset& ) -> bool {
+			for (size_t i = 0; i < pMeshMaterials->names.size(); ++i)
+				_meshTextures[pMeshMaterials->names[i]] = pMeshMaterials->textures[i];
+			SDKMESH_CALLBACKS10 callbacks = { MeshTextureFromLoader, NULL, NULL, NULL };
+			const std::vector<char>& bytes = _assetLoader->Get( self ).bytes;
+			HRESULT hr = g_Mesh.Create( pd3dDevice, (BYTE*)&bytes[0], (UINT)bytes.size(), true, true, &callbacks );
+			_meshTextures.clear();
+			return SUCCEEDED( hr );
+		} );
+
+		// the quantized vertices, if VertexQuantizer made them; checked against the mesh once it exists
+		std::string quantizedPath = meshPath + ".qvtx";
+		FILE* pFile = fopen( quantizedPath.c_str(), "rb" );
+		if (pFile) {
+			fclose( pFile );
+			_assetLoader->Add( "tiny.sdkmesh.qvtx", "", std::vector<AssetId>( 1, buffers ), [=]( Asset& asset ) -> bool {
+				// a truncated, corrupt or old one is left out like one that doesn't match
+				std::shared_ptr<MappedFile> pQuantized( new MappedFile );
+				QuantizedMeshView view;
+				if (!pQuantized->Open( quantizedPath ) || !ParseQuantizedMesh( pQuantized->Data(), pQuantized->Size(), view ))
+					OutputDebugStringA( "can't read tiny.sdkmesh.qvtx, using the float vertices\n" );
+				else
+					asset.decoded = pQuantized;
+				return true;
+			}, [=]( Asset& asset ) -> bool {
+				if (!asset.decoded)
+					return true;
+				return SUCCEEDED( CreateQuantizedVB( pd3dDevice, *(const MappedFile*)asset.decoded.get() ) );
+			} );
+		}
+		return true;
+	}, nullptr );
+	return S_OK;
+}
+
+// Creates the assets as they come in; returns once all of them exist
+HRESULT FinishLoadingAssets() {
+	bool ok = _assetLoader->Finalize( true );
+	AssetLoader::Stats stats = _assetLoader->GetStats();
+	_assetLoadMs = (float)stats.wallMs;
+	_assetSumMs = (float)stats.sumMs;
+	if (stats.failed)
+		OutputDebugStringA( ( _assetLoader->FirstError() + "\n" ).c_str() );
+	SAFE_DELETE( _assetLoader );		// and the loader's references to the material textures
+	return ok ? S_OK : E_FAIL;
+}
+
 
 //--------------------------------------------------------------------------------------
 // Create any D3D10 resources that aren't dependant on the back buffer
@@ -519,23 +1726,49 @@ HRESULT CALLBACK OnD3D10CreateDevice( ID3D10Device* pd3dDevice, const DXGI_SURFA
     V_RETURN( D3DX10CreateSprite( pd3dDevice, 512, &g_pSprite ) );
     g_pTxtHelper = new CDXUTTextHelper( NULL, NULL, g_pFont, g_pSprite, 15 );
 
-    DWORD dwShaderFlags = D3D10_SHADER_ENABLE_STRICTNESS;
-#if defined( DEBUG ) || defined( _DEBUG )
-    // Set the D3D10_SHADER_DEBUG flag to embed debug information in the shaders.
-    // Setting this flag improves the shader debugging experience, but still allows 
-    // the shaders to be optimized and to run exactly the way they will run in 
-    // the release configuration of this program.
-    dwShaderFlags |= D3D10_SHADER_DEBUG;
-    #endif
-
-    // Read the D3DX effect file
-    WCHAR str[MAX_PATH];
-    V_RETURN( DXUTFindDXSDKMediaFileCch( str, MAX_PATH, L"DeferredShading.fx" ) );
-    V_RETURN( D3DX10CreateEffectFromFile( str, NULL, NULL, "fx_4_0", dwShaderFlags, 0, pd3dDevice, NULL,
-                                          NULL, &g_pEffect, NULL, NULL ) );
+	// Start reading the mesh, its textures and the random vectors in the background
+	V_RETURN( LoadAssets( pd3dDevice ) );
+
+    // Create the effect from the cache (waits for the compile if it is still running;
+	// after a device reset the earlier request already has it)
+	LARGE_INTEGER loadStart, loadEnd, frequency;
+	QueryPerformanceCounter( &loadStart );
+	if (_effectRequest.valid()) {
+		const EffectCacheEntry& entry = _effectRequest.get();
+		if (!entry.ok) {
+			OutputDebugStringA( entry.errors.c_str() );
+			return E_FAIL;
+		}
+		V_RETURN( D3D10CreateEffectFromMemory( (void*)&( *entry.blob )[0], entry.blob->size(), 0, pd3dDevice, NULL,
+											   &g_pEffect ) );
+		static bool created = false;
+		_effectOrigin = created ? L"reused" : entry.fromCache ? L"disk cache" : L"compiled";
+		created = true;
+	}
+	else {
+		// Read the D3DX effect file
+		WCHAR str[MAX_PATH];
+		V_RETURN( DXUTFindDXSDKMediaFileCch( str, MAX_PATH, L"DeferredShading.fx" ) );
+		V_RETURN( D3DX10CreateEffectFromFile( str, NULL, NULL, "fx_4_0", EffectShaderFlags(), 0, pd3dDevice, NULL,
+											  NULL, &g_pEffect, NULL, NULL ) );
+	}
+	QueryPerformanceCounter( &loadEnd );
+	QueryPerformanceFrequency( &frequency );
+	_effectLoadMs = ( float )( ( double )( loadEnd.QuadPart - loadStart.QuadPart ) * 1000.0 / ( double )frequency.QuadPart );
 
     // Obtain the technique
     g_pTechnique = g_pEffect->GetTechniqueByName( "Render" );
+	g_pCompositeTechnique = g_pEffect->GetTechniqueByName( "Composite" );
+	g_pCompositeMsaaTechnique = g_pEffect->GetTechniqueByName( "CompositeMsaa" );
+
+	// Memory cost of the composite permutations (vs the single branching PSQuad)
+	D3D10_TECHNIQUE_DESC compositeDesc;
+	g_pCompositeTechnique->GetDesc( &compositeDesc );
+	_numCompositePasses = compositeDesc.Passes;
+	_compositeBytes = 0;
+	for (UINT p = 0; p < compositeDesc.Passes; ++p)
+		_compositeBytes += PixelShaderBytes( g_pCompositeTechnique->GetPassByIndex( p ) );
+	_quadShaderBytes = PixelShaderBytes( g_pTechnique->GetPassByIndex( 1 ) );
 
     // Obtain the variables
     g_ptxDiffuseVariable = g_pEffect->GetVariableByName( "g_txDiffuse" )->AsShaderResource();
@@ -544,11 +1777,30 @@ HRESULT CALLBACK OnD3D10CreateDevice( ID3D10Device* pd3dDevice, const DXGI_SURFA
 	_mrtTextureVariable = g_pEffect->GetVariableByName( "_mrtTextures" )->AsShaderResource();
 	_aoTextureVariable	= g_pEffect->GetVariableByName( "_aoTexture" )->AsShaderResource();
 	_vectorVariable		= g_pEffect->GetVariableByName( "_vectorTexture" )->AsShaderResource();
+	_pyramidVariable	= g_pEffect->GetVariableByName( "_depthPyramid" )->AsShaderResource();
+	_pyramidSrcVariable	= g_pEffect->GetVariableByName( "_depthPyramidSrc" )->AsShaderResource();
+	_deintVariable		= g_pEffect->GetVariableByName( "_deinterleavedTextures" )->AsShaderResource();
+	_layerAOVariable	= g_pEffect->GetVariableByName( "_layerAOTextures" )->AsShaderResource();
+	_aoHistoryVariable	= g_pEffect->GetVariableByName( "_aoHistory" )->AsShaderResource();
+	_prevNormalVariable	= g_pEffect->GetVariableByName( "_prevNormals" )->AsShaderResource();
+	_prevDepthVariable	= g_pEffect->GetVariableByName( "_prevDepth" )->AsShaderResource();
+	_msaaVariable		= g_pEffect->GetVariableByName( "_msaaTextures" )->AsShaderResource();
+	_edgeVariable		= g_pEffect->GetVariableByName( "_edgeTexture" )->AsShaderResource();
+	_rateVariable		= g_pEffect->GetVariableByName( "_rateTexture" )->AsShaderResource();
+	_coarseAOVariable[0] = g_pEffect->GetVariableByName( "_coarseAO2" )->AsShaderResource();
+	_coarseAOVariable[1] = g_pEffect->GetVariableByName( "_coarseAO4" )->AsShaderResource();
+	_shadowMapVariable	= g_pEffect->GetVariableByName( "_shadowMap" )->AsShaderResource();
+	_shadowStaticVariable = g_pEffect->GetVariableByName( "_shadowStatic" )->AsShaderResource();
 
 	g_pWorldVariable = g_pEffect->GetVariableByName( "World" )->AsMatrix();
     g_pViewVariable = g_pEffect->GetVariableByName( "View" )->AsMatrix();
     g_pProjectionVariable = g_pEffect->GetVariableByName( "Projection" )->AsMatrix();
 	g_pProjectionInverseVariable = g_pEffect->GetVariableByName( "ProjectionInverse" )->AsMatrix();
+	g_pViewInverseVariable = g_pEffect->GetVariableByName( "ViewInverse" )->AsMatrix();
+	g_pPrevViewVariable = g_pEffect->GetVariableByName( "PrevView" )->AsMatrix();
+	_hiZBoxMinVariable = g_pEffect->GetVariableByName( "HiZBoxMin" )->AsVector();
+	_hiZBoxMaxVariable = g_pEffect->GetVariableByName( "HiZBoxMax" )->AsVector();
+	g_pPrevViewProjectionVariable = g_pEffect->GetVariableByName( "PrevViewProjection" )->AsMatrix();
 	
 	// send in puffiness
     g_pPuffiness  = g_pEffect->GetVariableByName( "Puffiness" )->AsScalar();
@@ -563,6 +1815,35 @@ HRESULT CALLBACK OnD3D10CreateDevice( ID3D10Device* pd3dDevice, const DXGI_SURFA
 	g_UseAO = g_pEffect->GetVariableByName( "UseAO" )->AsScalar();
 	g_UseAO->SetBool( _ambientOcclusion );
 
+	// Send in which layer is rendered (deinterleaved ambient occlusion)
+	g_InterleaveLayer = g_pEffect->GetVariableByName( "InterleaveLayer" )->AsScalar();
+
+	// Tile the rotation texture once per AO pixel
+	g_NoiseScale = g_pEffect->GetVariableByName( "NoiseScale" )->AsVector();
+	float noiseScale[2];
+	noiseScale[0] = (float)_width / _blueNoiseParams.size * _texScale;
+	noiseScale[1] = (float)_height / _blueNoiseParams.size * _texScale;
+	g_NoiseScale->SetFloatVector( noiseScale );
+
+	// Box of the quantized vertices, set per subset
+	g_QuantOffset = g_pEffect->GetVariableByName( "QuantOffset" )->AsVector();
+	g_QuantScale = g_pEffect->GetVariableByName( "QuantScale" )->AsVector();
+
+	// Temporal ambient occlusion
+	g_FrameIndex = g_pEffect->GetVariableByName( "FrameIndex" )->AsScalar();
+	g_HistoryValid = g_pEffect->GetVariableByName( "HistoryValid" )->AsScalar();
+
+	// Horizon-based ambient occlusion preset
+	g_HorizonDirections = g_pEffect->GetVariableByName( "HorizonDirections" )->AsScalar();
+	g_HorizonDirections->SetInt( _horizonPresets[_horizonPreset].directions );
+	g_HorizonSteps = g_pEffect->GetVariableByName( "HorizonSteps" )->AsScalar();
+	g_HorizonSteps->SetInt( _horizonPresets[_horizonPreset].steps );
+
+	// Shadows: set every frame they're on
+	_shadowViewProjectionVariable = g_pEffect->GetVariableByName( "ShadowViewProjection" )->AsMatrix();
+	_viewToShadowVariable = g_pEffect->GetVariableByName( "ViewToShadow" )->AsMatrix();
+	_lightPosVariable = g_pEffect->GetVariableByName( "vLightPos" )->AsVector();
+
     // Define the input layout
     const D3D10_INPUT_ELEMENT_DESC layout[] =
     {
@@ -581,25 +1862,66 @@ HRESULT CALLBACK OnD3D10CreateDevice( ID3D10Device* pd3dDevice, const DXGI_SURFA
     // Set the input layout
     pd3dDevice->IASetInputLayout( g_pVertexLayout );
 
-    // Load the mesh
-    V_RETURN( g_Mesh.Create( pd3dDevice, L"Tiny\\tiny.sdkmesh", true ) );
+	// ... and the one of the quantized vertices (PackedVertex)
+	const D3D10_INPUT_ELEMENT_DESC quantizedLayout[] =
+	{
+		{ "POSITION", 0, DXGI_FORMAT_R16G16B16A16_UNORM, 0, 0, D3D10_INPUT_PER_VERTEX_DATA, 0 },
+		{ "NORMAL", 0, DXGI_FORMAT_R16G16_SNORM, 0, 8, D3D10_INPUT_PER_VERTEX_DATA, 0 },
+		{ "TEXCOORD", 0, DXGI_FORMAT_R16G16_FLOAT, 0, 12, D3D10_INPUT_PER_VERTEX_DATA, 0 },
+	};
+	g_pTechnique->GetPassByIndex( 15 )->GetDesc( &PassDesc );
+	V_RETURN( pd3dDevice->CreateInputLayout( quantizedLayout, sizeof( quantizedLayout ) / sizeof( quantizedLayout[0] ),
+											 PassDesc.pIAInputSignature, PassDesc.IAInputSignatureSize, &g_pQuantizedLayout ) );
+
+	// Stream the big scene when there is one (drawn with the quantized layout too)
+	SceneIndex sceneIndex;
+	if( ReadSceneIndex( "Scene", sceneIndex ) ) {
+		_sceneStreamer = new SceneStreamer( sceneIndex, StreamSettings() );
+		_chunkVB.assign( sceneIndex.chunks.size(), NULL );
+		_chunkIB.assign( sceneIndex.chunks.size(), NULL );
+	}
 
     // Initialize the world matrices
-    D3DXMatrixIdentity( &g_World );
-	D3DXMatrixIdentity( &t_World );
-	D3DXMatrixIdentity( &ao_World );
+    g_World = Mat4Identity();
+	t_World = Mat4Identity();
+	ao_World = Mat4Identity();
 
 	// Initialize the quad mesh (for render to texture)
 	InitializeQuad();
 
 	// Set up the multiple render targets
 	SetupMRTs(pd3dDevice);
+
+	// and the multisampled ones (-msaa), if the device has 4x for both formats
+	if (_msaa) {
+		UINT colorLevels = 0, depthLevels = 0;
+		pd3dDevice->CheckMultisampleQualityLevels( DXGI_FORMAT_R16G16B16A16_UNORM, MSAA_SAMPLES, &colorLevels );
+		pd3dDevice->CheckMultisampleQualityLevels( DXGI_FORMAT_D32_FLOAT, MSAA_SAMPLES, &depthLevels );
+		if (!colorLevels || !depthLevels || FAILED( SetupMsaa(pd3dDevice) ))
+			_msaa = false;		// the mrts are already 1x: renders without AA
+	}
    
 	// Setup the Ambient Occlusion Texture
 	SetupAO(pd3dDevice);
 
-	// Create the Random Vector texture
-	V_RETURN( D3DX10CreateShaderResourceViewFromFile( pd3dDevice, L"vectors.png", NULL, NULL, &_vectorSRV, NULL ) );
+	// Setup the hierarchical depth pyramid
+	SetupDepthPyramid(pd3dDevice);
+
+	// Setup the deinterleaved ambient occlusion layers
+	SetupDeinterleavedAO(pd3dDevice);
+
+	// Setup the temporal ambient occlusion history
+	SetupTemporalAO(pd3dDevice);
+
+	// Setup the shading rate map and the coarse ambient occlusion
+	SetupShadingRate(pd3dDevice);
+
+	// Setup the shadow map and its static cache
+	SetupShadows(pd3dDevice);
+
+	// Wait for the mesh and the Random Vector texture (loaded while the effect and
+	// render targets were set up)
+	V_RETURN( FinishLoadingAssets() );
 	
 	// Create cubic depth stencil texture.
     // Initialize the camera
@@ -649,6 +1971,110 @@ HRESULT CALLBACK OnD3D10ResizedSwapChain( ID3D10Device* pd3dDevice, IDXGISwapCha
     return S_OK;
 }
 
+//--------------------------------------------------------------------------------------
+// Draws the chunks of the streamed scene that are mapped, most important first.
+// Buffers are made the first time a chunk is drawn and released when it's evicted;
+// chunks still loading are skipped this frame.
+// With Hi-Z culling, and a pyramid from last frame, every chunk is drawn under an
+// occlusion predicate: a one-pixel draw that tests its box against that pyramid (pass
+// P25) decides on the GPU whether the chunk's draw happens, without a readback.
+// Something the moving mesh uncovered may show up a frame late.
+//--------------------------------------------------------------------------------------
+void RenderSceneChunks( ID3D10Device* pd3dDevice ) {
+	size_t evictedCount;
+	const unsigned int* evicted = _sceneStreamer->TakeEvicted( _frameArenas->Get( _cpuFrame, -1 ), evictedCount );
+	for (size_t i = 0; i < evictedCount; ++i) {
+		SAFE_RELEASE( _chunkVB[evicted[i]] );
+		SAFE_RELEASE( _chunkIB[evicted[i]] );
+	}
+
+	// the chunks are in world space, and keep the mesh's texture
+	Mat4 identity = Mat4Identity();
+	g_pWorldVariable->SetMatrix( ( float* )&identity );
+	pd3dDevice->IASetInputLayout( g_pQuantizedLayout );
+	pd3dDevice->IASetPrimitiveTopology( D3D10_PRIMITIVE_TOPOLOGY_TRIANGLELIST );
+
+	// last frame's pyramid is still there: it's rebuilt after this pass
+	bool hiZ = _hiZCulling && _pyramidFrame && _pyramidFrame + 1 == _cpuFrame;
+	if (hiZ) {
+		Mat4 prevViewProjection = _prevView * Mat4Load( ( const float* )g_Camera.GetProjMatrix() );
+		g_pPrevViewVariable->SetMatrix( ( float* )&_prevView );
+		g_pPrevViewProjectionVariable->SetMatrix( ( float* )&prevViewProjection );
+		_pyramidVariable->SetResource( _pyramidSRV );
+	}
+
+	_chunkDraws = 0;
+	_chunkHiZTests = 0;
+	const std::vector<unsigned int>& wanted = _sceneStreamer->Wanted();
+	for (size_t i = 0; i < wanted.size(); ++i) {
+		unsigned int id = wanted[i];
+		const ChunkView* chunk = _sceneStreamer->Acquire( id );
+		if (!chunk)
+			continue;
+
+		if (!_chunkVB[id]) {
+			D3D10_BUFFER_DESC bd;
+			bd.Usage = D3D10_USAGE_IMMUTABLE;
+			bd.BindFlags = D3D10_BIND_VERTEX_BUFFER;
+			bd.CPUAccessFlags = 0;
+			bd.MiscFlags = 0;
+			bd.ByteWidth = chunk->header->numVertices * sizeof( PackedVertex );
+			D3D10_SUBRESOURCE_DATA InitData;
+			InitData.pSysMem = chunk->vertices;
+			if (FAILED( pd3dDevice->CreateBuffer( &bd, &InitData, &_chunkVB[id] ) ))
+				continue;
+			bd.BindFlags = D3D10_BIND_INDEX_BUFFER;
+			bd.ByteWidth = chunk->header->numIndices * sizeof( unsigned int );
+			InitData.pSysMem = chunk->indices;
+			if (FAILED( pd3dDevice->CreateBuffer( &bd, &InitData, &_chunkIB[id] ) )) {
+				SAFE_RELEASE( _chunkVB[id] );
+				continue;
+			}
+		}
+
+		const QuantBox& box = chunk->header->box;
+		ID3D10Predicate* pPredicate = NULL;
+		if (hiZ) {
+			if (_chunkDraws >= _chunkPredicates.size())
+				_chunkPredicates.resize( _chunkDraws + 1, NULL );
+			D3D10_QUERY_DESC queryDesc = { D3D10_QUERY_OCCLUSION_PREDICATE, 0 };
+			if (_chunkPredicates[_chunkDraws] || SUCCEEDED( pd3dDevice->CreatePredicate( &queryDesc, &_chunkPredicates[_chunkDraws] ) ))
+				pPredicate = _chunkPredicates[_chunkDraws];
+		}
+		if (pPredicate) {
+			float boxMin[4] = { box.offset[0], box.offset[1], box.offset[2], 1.0f };
+			float boxMax[4] = { box.offset[0] + box.scale[0] * 65535.0f, box.offset[1] + box.scale[1] * 65535.0f,
+								box.offset[2] + box.scale[2] * 65535.0f, 1.0f };
+			_hiZBoxMinVariable->SetFloatVector( boxMin );
+			_hiZBoxMaxVariable->SetFloatVector( boxMax );
+			pd3dDevice->IASetInputLayout( NULL );
+			pd3dDevice->IASetPrimitiveTopology( D3D10_PRIMITIVE_TOPOLOGY_POINTLIST );
+			pPredicate->Begin();
+			g_pTechnique->GetPassByIndex( 25 )->Apply( 0 );
+			pd3dDevice->Draw( 1, 0 );
+			pPredicate->End();
+			pd3dDevice->IASetInputLayout( g_pQuantizedLayout );
+			pd3dDevice->IASetPrimitiveTopology( D3D10_PRIMITIVE_TOPOLOGY_TRIANGLELIST );
+			pd3dDevice->SetPredication( pPredicate, FALSE );		// skipped if no pixel passed
+			++_chunkHiZTests;
+		}
+
+		UINT stride = sizeof( PackedVertex ), offset = 0;
+		pd3dDevice->IASetVertexBuffers( 0, 1, &_chunkVB[id], &stride, &offset );
+		pd3dDevice->IASetIndexBuffer( _chunkIB[id], DXGI_FORMAT_R32_UINT, 0 );
+		float boxOffset[4] = { box.offset[0], box.offset[1], box.offset[2], 0.0f };
+		float boxScale[4] = { box.scale[0] * 65535.0f, box.scale[1] * 65535.0f, box.scale[2] * 65535.0f, 0.0f };
+		g_QuantOffset->SetFloatVector( boxOffset );
+		g_QuantScale->SetFloatVector( boxScale );
+		g_pTechnique->GetPassByIndex( 15 )->Apply( 0 );
+		pd3dDevice->DrawIndexed( chunk->header->numIndices, 0, 0 );
+		if (pPredicate)
+			pd3dDevice->SetPredication( NULL, FALSE );
+		++_chunkDraws;
+	}
+	g_pWorldVariable->SetMatrix( ( float* )&g_World );
+}
+
 //--------------------------------------------------------------------------------------
 // Renders all the textures:
 // -Diffuse
@@ -659,8 +2085,8 @@ HRESULT CALLBACK OnD3D10ResizedSwapChain( ID3D10Device* pd3dDevice, IDXGISwapCha
 void RenderTextures( ID3D10Device* pd3dDevice) {
 	// Set a new viewport for rendering to texture(s)
 	D3D10_VIEWPORT SMVP;
-	SMVP.Height = _height * TEXSCALE;
-	SMVP.Width = _width * TEXSCALE;
+	SMVP.Height = _height * _texScale;
+	SMVP.Width = _width * _texScale;
 	SMVP.MinDepth = 0;
 	SMVP.MaxDepth = 1;
 	SMVP.TopLeftX = 0;
@@ -670,8 +2096,15 @@ void RenderTextures( ID3D10Device* pd3dDevice) {
     float ClearColor[4] = { 0.0f, 0.125f, 0.3f, 1.0f };//{ 0.0f, 0.0f, 0.0f, 1.0f };
 
 	// Clear Textures
-    pd3dDevice->ClearRenderTargetView( _mrtRTV, ClearColor );
-    pd3dDevice->ClearDepthStencilView( _mrtDSV, D3D10_CLEAR_DEPTH, 1.0, 0 );
+	if (_msaa) {
+		for (UINT slice = 0; slice < 4; ++slice)
+			pd3dDevice->ClearRenderTargetView( _msaaSliceRTV[slice], ClearColor );
+		pd3dDevice->ClearDepthStencilView( _msaaDSV, D3D10_CLEAR_DEPTH, 1.0, 0 );
+	}
+	else {
+		pd3dDevice->ClearRenderTargetView( _mrtRTV, ClearColor );
+		pd3dDevice->ClearDepthStencilView( _mrtDSV, D3D10_CLEAR_DEPTH, 1.0, 0 );
+	}
 	
 	//ID3D10InputLayout* pLayout = g_pVertexLayoutCM;
     //ID3D10EffectTechnique* pTechnique = g_pRenderCubeMapTech;
@@ -679,10 +2112,12 @@ void RenderTextures( ID3D10Device* pd3dDevice) {
 	// set input layout
 	pd3dDevice->IASetInputLayout( g_pVertexLayout );
 
-	// Set all the render targets
-    ID3D10RenderTargetView* aRTViews[ 1 ] = { _mrtRTV };
-	UINT numRenderTargets = sizeof( aRTViews ) / sizeof( aRTViews[0] );
-	pd3dDevice->OMSetRenderTargets( numRenderTargets, aRTViews, _mrtDSV );
+	// Set all the render targets (every slice at once, see pass P14)
+	UINT numRenderTargets = sizeof( _mrtSliceRTV ) / sizeof( _mrtSliceRTV[0] );
+	if (_msaa)
+		pd3dDevice->OMSetRenderTargets( numRenderTargets, _msaaSliceRTV, _msaaDSV );
+	else
+		pd3dDevice->OMSetRenderTargets( numRenderTargets, _mrtSliceRTV, _mrtSliceDSV );
 
 	// Render the objects
 
@@ -698,12 +2133,15 @@ void RenderTextures( ID3D10Device* pd3dDevice) {
 	g_pWorldVariable->SetMatrix( ( float* )&g_World );
 
 	/** Render the Mesh ***/
+	bool quantized = _quantizedVertices && _quantizedVB;
 	UINT Strides[1];
 	UINT Offsets[1];
 	ID3D10Buffer* pVB[1];
-	pVB[0] = g_Mesh.GetVB10( 0, 0 );
-	Strides[0] = ( UINT )g_Mesh.GetVertexStride( 0, 0 );
+	pVB[0] = quantized ? _quantizedVB : g_Mesh.GetVB10( 0, 0 );
+	Strides[0] = quantized ? sizeof( PackedVertex ) : ( UINT )g_Mesh.GetVertexStride( 0, 0 );
 	Offsets[0] = 0;
+	if (quantized)
+		pd3dDevice->IASetInputLayout( g_pQuantizedLayout );
 	pd3dDevice->IASetVertexBuffers( 0, 1, pVB, Strides, Offsets );
 	pd3dDevice->IASetIndexBuffer( g_Mesh.GetIB10( 0 ), g_Mesh.GetIBFormat10( 0 ), 0 );
 
@@ -725,11 +2163,438 @@ void RenderTextures( ID3D10Device* pd3dDevice) {
 		pDiffuseRV = g_Mesh.GetMaterial( pSubset->MaterialID )->pDiffuseRV10;
 		g_ptxDiffuseVariable->SetResource( pDiffuseRV );
 
-		g_pTechnique->GetPassByIndex( 2 )->Apply( 0 );
+		if (quantized) {
+			const QuantBox& box = _quantRanges[_subsetRange[subset]].box;
+			float offset[4] = { box.offset[0], box.offset[1], box.offset[2], 0.0f };
+			float scale[4] = { box.scale[0] * 65535.0f, box.scale[1] * 65535.0f, box.scale[2] * 65535.0f, 0.0f };
+			g_QuantOffset->SetFloatVector( offset );
+			g_QuantScale->SetFloatVector( scale );
+		}
+		g_pTechnique->GetPassByIndex( quantized ? 15 : 14 )->Apply( 0 );
 		pd3dDevice->DrawIndexed( ( UINT )pSubset->IndexCount, 0, ( UINT )pSubset->VertexStart );
 	}
+
+	if (_sceneStreamer)
+		RenderSceneChunks( pd3dDevice );
 } // End Render Textures
 
+//--------------------------------------------------------------------------------------
+// The texels of the shadow map the mesh can cover: its bounding box, grown by the
+// puffiness, seen from the light. All of them if the box reaches behind the light.
+//--------------------------------------------------------------------------------------
+D3D10_RECT ShadowCasterRect( const Mat4& world, const Mat4& light ) {
+	D3D10_RECT rect = { 0, 0, SHADOWSIZE, SHADOWSIZE };
+	D3DXVECTOR3 center = g_Mesh.GetMeshBBoxCenter( 0 );
+	D3DXVECTOR3 extents = g_Mesh.GetMeshBBoxExtents( 0 ) + D3DXVECTOR3( 1.0f, 1.0f, 1.0f ) * fabsf( g_fModelPuffiness );
+	Mat4 toLight = world * light;
+
+	float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+	for (int i = 0; i < 8; ++i) {
+		Vec3 corner = MakeVec3( center.x + ( i & 1 ? extents.x : -extents.x ), center.y + ( i & 2 ? extents.y : -extents.y ),
+								center.z + ( i & 4 ? extents.z : -extents.z ) );
+		Vec4 p = Vec4Transform( MakeVec4( corner, 1.0f ), toLight );
+		if (p.w <= 0.0f)
+			return rect;
+		float x = ( p.x / p.w * 0.5f + 0.5f ) * SHADOWSIZE, y = ( 0.5f - p.y / p.w * 0.5f ) * SHADOWSIZE;
+		minX = min( minX, x );
+		minY = min( minY, y );
+		maxX = max( maxX, x );
+		maxY = max( maxY, y );
+	}
+	rect.left = ( LONG )max( 0.0f, floorf( minX ) );
+	rect.top = ( LONG )max( 0.0f, floorf( minY ) );
+	rect.right = ( LONG )min( ( float )SHADOWSIZE, ceilf( maxX ) + 1.0f );
+	rect.bottom = ( LONG )min( ( float )SHADOWSIZE, ceilf( maxY ) + 1.0f );
+	if (rect.left >= rect.right || rect.top >= rect.bottom)
+		SetRectEmpty( &rect );
+	return rect;
+}
+
+//--------------------------------------------------------------------------------------
+// Brings the shadow map up to date, rendering again only what changed, like
+// Portable/ShadowCache does per tile on the CPU:
+// -the static cache (the streamed chunks) when the light or the resident chunks changed
+// -then, under a scissor rect of where the mesh was and where it is now, the cache
+//  copied into the map and the mesh drawn over it
+// A frame where nothing moved renders nothing. Also sets what the composite needs.
+//--------------------------------------------------------------------------------------
+void UpdateShadows( ID3D10Device* pd3dDevice) {
+	if (!_shadows) {
+		float lightPos[4] = { 0.0f, -3.0f, -4.0f, 0.0f };		// the default: at the camera
+		_lightPosVariable->SetFloatVector( lightPos );
+		_shadowTexels = 0;
+		return;
+	}
+
+	// the light that casts the shadows also lights the composite (in the G-buffer camera's
+	// view space, like the positions it reconstructs)
+	Mat4 light = ShadowLightMatrix( _shadowLightEye, MakeVec3( 0.0f, 0.0f, 0.0f ), SHADOWFOV, 10.0f, 5000.0f );
+	Mat4 view = Mat4Load( ( const float* )g_Camera.GetViewMatrix() );
+	Mat4 viewToShadow = Mat4AffineInverse( view ) * light;
+	Vec3 lightPos = Vec3TransformCoord( _shadowLightEye, view );
+	float lightPos4[4] = { lightPos.x, lightPos.y, lightPos.z, 0.0f };
+	_lightPosVariable->SetFloatVector( lightPos4 );
+	_viewToShadowVariable->SetMatrix( ( float* )&viewToShadow );
+	_shadowViewProjectionVariable->SetMatrix( ( float* )&light );
+
+	// what changed since the last update (every Set has to run)
+	// (the resident chunks go in the frame's arena: nothing is allocated unless they changed)
+	unsigned int* resident = NULL;
+	size_t residentCount = 0;
+	if (_sceneStreamer) {
+		const std::vector<unsigned int>& wanted = _sceneStreamer->Wanted();
+		resident = _frameArenas->Get( _cpuFrame, -1 ).Allocate<unsigned int>( wanted.size() );
+		for (size_t i = 0; resident && i < wanted.size(); ++i)
+			if (_chunkVB[wanted[i]])
+				resident[residentCount++] = wanted[i];
+	}
+	bool residentChanged = residentCount != _shadowChunks.size() ||
+						   !std::equal( resident, resident + residentCount, _shadowChunks.begin() );
+	bool staticChanged = _shadowLight.Set( light ) | residentChanged;
+	bool moved = _shadowWorld.Set( g_World ) | _shadowPuffiness.Set( g_fModelPuffiness );
+	D3D10_RECT casterRect = ShadowCasterRect( g_World, light );
+	D3D10_RECT region;
+	SetRectEmpty( &region );
+	if (staticChanged)
+		SetRect( &region, 0, 0, SHADOWSIZE, SHADOWSIZE );
+	else if (moved)
+		UnionRect( &region, &_shadowCasterRect, &casterRect );
+	_shadowCasterRect = casterRect;
+	_shadowStaticRendered = staticChanged;
+	_shadowTexels = IsRectEmpty( &region ) ? 0 : ( region.right - region.left ) * ( region.bottom - region.top );
+	_shadowMapVariable->SetResource( _shadowSRV[0] );
+	if (!_shadowTexels)
+		return;
+
+	// the maps are about to be written, so they can't stay bound as inputs
+	ID3D10ShaderResourceView* pSRV[D3D10_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT];
+	memset( pSRV, 0, sizeof(pSRV) );
+	pd3dDevice->PSSetShaderResources( 0, D3D10_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT, pSRV );
+	_shadowMapVariable->SetResource( NULL );
+	_shadowStaticVariable->SetResource( NULL );
+
+	D3D10_VIEWPORT OldVP;
+	UINT cRT = 1;
+	pd3dDevice->RSGetViewports( &cRT, &OldVP );
+	D3D10_VIEWPORT SMVP;
+	SMVP.Height = SHADOWSIZE;
+	SMVP.Width = SHADOWSIZE;
+	SMVP.MinDepth = 0;
+	SMVP.MaxDepth = 1;
+	SMVP.TopLeftX = 0;
+	SMVP.TopLeftY = 0;
+	pd3dDevice->RSSetViewports( 1, &SMVP );
+	pd3dDevice->RSSetScissorRects( 1, &region );
+
+	// the static cache: all the resident chunks (world space)
+	if (staticChanged) {
+		_shadowChunks.assign( resident, resident + residentCount );
+		pd3dDevice->OMSetRenderTargets( 0, NULL, _shadowDSV[1] );
+		pd3dDevice->ClearDepthStencilView( _shadowDSV[1], D3D10_CLEAR_DEPTH, 1.0, 0 );
+		Mat4 identity = Mat4Identity();
+		g_pWorldVariable->SetMatrix( ( float* )&identity );
+		pd3dDevice->IASetInputLayout( g_pQuantizedLayout );
+		pd3dDevice->IASetPrimitiveTopology( D3D10_PRIMITIVE_TOPOLOGY_TRIANGLELIST );
+		for (size_t i = 0; i < _shadowChunks.size(); ++i) {
+			unsigned int id = _shadowChunks[i];
+			const ChunkView* chunk = _sceneStreamer->Acquire( id );
+			if (!chunk)
+				continue;
+			UINT stride = sizeof( PackedVertex ), offset = 0;
+			pd3dDevice->IASetVertexBuffers( 0, 1, &_chunkVB[id], &stride, &offset );
+			pd3dDevice->IASetIndexBuffer( _chunkIB[id], DXGI_FORMAT_R32_UINT, 0 );
+			const QuantBox& box = chunk->header->box;
+			float boxOffset[4] = { box.offset[0], box.offset[1], box.offset[2], 0.0f };
+			float boxScale[4] = { box.scale[0] * 65535.0f, box.scale[1] * 65535.0f, box.scale[2] * 65535.0f, 0.0f };
+			g_QuantOffset->SetFloatVector( boxOffset );
+			g_QuantScale->SetFloatVector( boxScale );
+			g_pTechnique->GetPassByIndex( 23 )->Apply( 0 );
+			pd3dDevice->DrawIndexed( chunk->header->numIndices, 0, 0 );
+		}
+	}
+
+	// the map, under the scissor rect: the static cache copied in (full-screen quad, same
+	// setup as the ambient occlusion pass)
+	pd3dDevice->OMSetRenderTargets( 0, NULL, _shadowDSV[0] );
+	g_pProjectionVariable->SetMatrix( ( float* )ao_Camera.GetProjMatrix() );
+	g_pViewVariable->SetMatrix( ( float* )ao_Camera.GetViewMatrix() );
+	g_pWorldVariable->SetMatrix( ( float* )&ao_World );
+	pd3dDevice->IASetInputLayout( g_pVertexLayout );
+	UINT stride = sizeof(VPNS);
+	UINT offset = 0;
+	pd3dDevice->IASetVertexBuffers(0, 1, &_quadVB, &stride, &offset);
+	pd3dDevice->IASetIndexBuffer(_quadIB, DXGI_FORMAT_R32_UINT, 0 );
+	pd3dDevice->IASetPrimitiveTopology(D3D10_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP);
+	_shadowStaticVariable->SetResource( _shadowSRV[1] );
+	g_pTechnique->GetPassByIndex(24)->Apply(0);
+	pd3dDevice->DrawIndexed(_numIQuad, 0, 0);
+	_shadowStaticVariable->SetResource( NULL );
+
+	// then the mesh over it (its float vertices, the puffiness applied)
+	g_pWorldVariable->SetMatrix( ( float* )&g_World );
+	ID3D10Buffer* pVB = g_Mesh.GetVB10( 0, 0 );
+	stride = ( UINT )g_Mesh.GetVertexStride( 0, 0 );
+	pd3dDevice->IASetVertexBuffers( 0, 1, &pVB, &stride, &offset );
+	pd3dDevice->IASetIndexBuffer( g_Mesh.GetIB10( 0 ), g_Mesh.GetIBFormat10( 0 ), 0 );
+	for (UINT subset = 0; subset < g_Mesh.GetNumSubsets( 0 ); ++subset) {
+		SDKMESH_SUBSET* pSubset = g_Mesh.GetSubset( 0, subset );
+		pd3dDevice->IASetPrimitiveTopology( g_Mesh.GetPrimitiveType10( ( SDKMESH_PRIMITIVE_TYPE )pSubset->PrimitiveType ) );
+		g_pTechnique->GetPassByIndex(22)->Apply(0);
+		pd3dDevice->DrawIndexed( ( UINT )pSubset->IndexCount, 0, ( UINT )pSubset->VertexStart );
+	}
+
+	// the other passes don't set a rasterizer state: back to the default (no scissor)
+	pd3dDevice->RSSetState( NULL );
+	pd3dDevice->OMSetRenderTargets( 0, NULL, NULL );
+	pd3dDevice->RSSetViewports( 1, &OldVP );
+	_shadowMapVariable->SetResource( _shadowSRV[0] );
+} // End Update Shadows
+
+//--------------------------------------------------------------------------------------
+// -msaa: resolves sample 0 of the multisampled slices into the mrts, so the passes after
+// it run on a 1x G-buffer as usual, and marks the pixels whose samples differ
+// (expects ProjectionInverse to hold the inverse of the G-buffer camera's projection)
+//--------------------------------------------------------------------------------------
+void ResolveMsaa( ID3D10Device* pd3dDevice) {
+	D3D10_VIEWPORT SMVP;
+	SMVP.Height = _height;
+	SMVP.Width = _width;
+	SMVP.MinDepth = 0;
+	SMVP.MaxDepth = 1;
+	SMVP.TopLeftX = 0;
+	SMVP.TopLeftY = 0;
+	pd3dDevice->RSSetViewports( 1, &SMVP );
+
+	// full-screen quad, same setup as the ambient occlusion pass
+	g_pProjectionVariable->SetMatrix( ( float* )ao_Camera.GetProjMatrix() );
+	g_pViewVariable->SetMatrix( ( float* )ao_Camera.GetViewMatrix() );
+	g_pWorldVariable->SetMatrix( ( float* )&ao_World );
+
+	pd3dDevice->IASetInputLayout( g_pVertexLayout );
+	UINT stride = sizeof(VPNS);
+	UINT offset = 0;
+	pd3dDevice->IASetVertexBuffers(0, 1, &_quadVB, &stride, &offset);
+	pd3dDevice->IASetIndexBuffer(_quadIB, DXGI_FORMAT_R32_UINT, 0 );
+	pd3dDevice->IASetPrimitiveTopology(D3D10_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP);
+
+	// the mrts are about to be written, so they can't stay bound as an input
+	_mrtTextureVariable->SetResource( NULL );
+	_edgeVariable->SetResource( NULL );
+	_msaaVariable->SetResource( _msaaSRV );
+
+	ID3D10RenderTargetView* aRTViews[ 5 ] = { _mrtSliceRTV[0], _mrtSliceRTV[1], _mrtSliceRTV[2], _mrtSliceRTV[3], _edgeRTV };
+	pd3dDevice->OMSetRenderTargets( 5, aRTViews, NULL );
+	g_pTechnique->GetPassByIndex(17)->Apply(0);
+	pd3dDevice->DrawIndexed(_numIQuad, 0, 0);
+
+	_edgeVariable->SetResource( _edgeSRV );
+} // End Resolve Msaa
+
+//--------------------------------------------------------------------------------------
+// Renders the shading rate of every tile, then the simple AO of the 2x2 and 4x4 tiles
+// at half and quarter resolution, for PSAOVrs
+// (expects the ao pass's quad, camera and mrts to be set)
+//--------------------------------------------------------------------------------------
+void RenderCoarseAO( ID3D10Device* pd3dDevice) {
+	D3D10_VIEWPORT SMVP;
+	SMVP.Height = ( _height * _texScale + RATETILE - 1 ) / RATETILE;
+	SMVP.Width = ( _width * _texScale + RATETILE - 1 ) / RATETILE;
+	SMVP.MinDepth = 0;
+	SMVP.MaxDepth = 1;
+	SMVP.TopLeftX = 0;
+	SMVP.TopLeftY = 0;
+	pd3dDevice->RSSetViewports( 1, &SMVP );
+
+	// the targets are about to be written, so they can't stay bound as inputs
+	_rateVariable->SetResource( NULL );
+	_coarseAOVariable[0]->SetResource( NULL );
+	_coarseAOVariable[1]->SetResource( NULL );
+
+	pd3dDevice->OMSetRenderTargets( 1, &_rateRTV, NULL );
+	g_pTechnique->GetPassByIndex(18)->Apply(0);
+	pd3dDevice->DrawIndexed(_numIQuad, 0, 0);
+
+	_rateVariable->SetResource( _rateSRV );
+	for (UINT i = 0; i < 2; ++i) {
+		UINT rate = 2 << i;
+		SMVP.Width = ( _width * _texScale + rate - 1 ) / rate;
+		SMVP.Height = ( _height * _texScale + rate - 1 ) / rate;
+		pd3dDevice->RSSetViewports( 1, &SMVP );
+		pd3dDevice->OMSetRenderTargets( 1, &_coarseAORTV[i], NULL );
+		g_pTechnique->GetPassByIndex(19 + i)->Apply(0);
+		pd3dDevice->DrawIndexed(_numIQuad, 0, 0);
+	}
+	_coarseAOVariable[0]->SetResource( _coarseAOSRV[0] );
+	_coarseAOVariable[1]->SetResource( _coarseAOSRV[1] );
+} // End Render Coarse AO
+
+//--------------------------------------------------------------------------------------
+// Builds the depth pyramid from the depth slice of the mrts:
+// -mip 0 is the linearized view-space Z
+// -each further mip keeps the min and max of the 2x2 texels below it
+// (expects ProjectionInverse to hold the inverse of the G-buffer camera's projection)
+//--------------------------------------------------------------------------------------
+void RenderDepthPyramid( ID3D10Device* pd3dDevice) {
+	D3D10_VIEWPORT SMVP;
+	SMVP.Height = _height * _texScale;
+	SMVP.Width = _width * _texScale;
+	SMVP.MinDepth = 0;
+	SMVP.MaxDepth = 1;
+	SMVP.TopLeftX = 0;
+	SMVP.TopLeftY = 0;
+
+	// full-screen quad, same setup as the ambient occlusion pass
+	g_pProjectionVariable->SetMatrix( ( float* )ao_Camera.GetProjMatrix() );
+	g_pViewVariable->SetMatrix( ( float* )ao_Camera.GetViewMatrix() );
+	g_pWorldVariable->SetMatrix( ( float* )&ao_World );
+
+	pd3dDevice->IASetInputLayout( g_pVertexLayout );
+	UINT stride = sizeof(VPNS);
+	UINT offset = 0;
+	pd3dDevice->IASetVertexBuffers(0, 1, &_quadVB, &stride, &offset);
+	pd3dDevice->IASetIndexBuffer(_quadIB, DXGI_FORMAT_R32_UINT, 0 );
+	pd3dDevice->IASetPrimitiveTopology(D3D10_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP);
+
+	// the pyramid is about to be written, so it can't stay bound as an input
+	_pyramidVariable->SetResource( NULL );
+	_mrtTextureVariable->SetResource( _mrtSRV );
+
+	for (UINT mip = 0; mip < PYRAMIDMIPS; ++mip) {
+		pd3dDevice->RSSetViewports( 1, &SMVP );
+		pd3dDevice->OMSetRenderTargets( 1, &_pyramidRTV[mip], NULL );
+
+		if (mip == 0) {
+			// linearize the depth slice
+			g_pTechnique->GetPassByIndex(6)->Apply(0);
+		}
+		else {
+			// downsample the previous mip
+			_pyramidSrcVariable->SetResource( _pyramidMipSRV[mip - 1] );
+			g_pTechnique->GetPassByIndex(7)->Apply(0);
+		}
+		pd3dDevice->DrawIndexed(_numIQuad, 0, 0);
+
+		// next mip is half the size (rounded down, never below 1)
+		SMVP.Width  = max( SMVP.Width / 2, (UINT)1 );
+		SMVP.Height = max( SMVP.Height / 2, (UINT)1 );
+	}
+	_pyramidFrame = _cpuFrame;
+} // End Render Depth Pyramid
+
+//--------------------------------------------------------------------------------------
+// Renders the quarter-resolution layers of the deinterleaved ambient occlusion:
+// -splits normals and linear Z into the 4x4 layers
+// -computes the ao of every layer (one rotation vector per layer)
+// (expects the full-screen quad to be set up)
+//--------------------------------------------------------------------------------------
+void RenderAOLayers( ID3D10Device* pd3dDevice) {
+	UINT width = _width * _texScale;
+	UINT height = _height * _texScale;
+
+	D3D10_VIEWPORT SMVP;
+	SMVP.Height = ( height + INTERLEAVE - 1 ) / INTERLEAVE;
+	SMVP.Width = ( width + INTERLEAVE - 1 ) / INTERLEAVE;
+	SMVP.MinDepth = 0;
+	SMVP.MaxDepth = 1;
+	SMVP.TopLeftX = 0;
+	SMVP.TopLeftY = 0;
+	pd3dDevice->RSSetViewports( 1, &SMVP );
+
+	// split into layers
+	_deintVariable->SetResource( NULL );
+	for (int layer = 0; layer < NUMLAYERS; ++layer) {
+		pd3dDevice->OMSetRenderTargets( 1, &_deintRTV[layer], NULL );
+		g_InterleaveLayer->SetInt( layer );
+		g_pTechnique->GetPassByIndex(9)->Apply(0);
+		pd3dDevice->DrawIndexed(_numIQuad, 0, 0);
+	}
+	MarkAOTimer( AO_STAGE_DEINTERLEAVE );
+
+	// ao of every layer
+	_deintVariable->SetResource( _deintSRV );
+	_layerAOVariable->SetResource( NULL );
+	for (int layer = 0; layer < NUMLAYERS; ++layer) {
+		pd3dDevice->OMSetRenderTargets( 1, &_layerAORTV[layer], NULL );
+		g_InterleaveLayer->SetInt( layer );
+		g_pTechnique->GetPassByIndex(10)->Apply(0);
+		pd3dDevice->DrawIndexed(_numIQuad, 0, 0);
+	}
+	MarkAOTimer( AO_STAGE_LAYERS );
+
+	_layerAOVariable->SetResource( _layerAOSRV );
+} // End Render AO Layers
+
+//--------------------------------------------------------------------------------------
+// Renders this frame's temporal ambient occlusion:
+// -blends a quarter of the taps into last frame's reprojected history
+// -copies the result into the ao texture (so the blur passes stay the same)
+// -keeps this frame's normals and depth for the next frame's history rejection
+// (expects the full-screen quad and the viewport to be set up)
+//--------------------------------------------------------------------------------------
+void RenderTemporalAO( ID3D10Device* pd3dDevice) {
+	UINT cur = _historyIndex;
+	UINT prev = 1 - _historyIndex;
+
+	// camera matrices of this and the last frame
+	Mat4 viewInverse = Mat4AffineInverse( Mat4Load( ( const float* )g_Camera.GetViewMatrix() ) );
+	Mat4 prevViewProjection = _prevView * Mat4Load( ( const float* )g_Camera.GetProjMatrix() );
+	g_pViewInverseVariable->SetMatrix( ( float* )&viewInverse );
+	g_pPrevViewVariable->SetMatrix( ( float* )&_prevView );
+	g_pPrevViewProjectionVariable->SetMatrix( ( float* )&prevViewProjection );
+	g_FrameIndex->SetInt( _frameIndex );
+	g_HistoryValid->SetBool( _historyValid );
+
+	_aoHistoryVariable->SetResource( _aoHistorySRV[prev] );
+	_prevNormalVariable->SetResource( _prevNormalSRV );
+	_prevDepthVariable->SetResource( _prevDepthSRV );
+
+	pd3dDevice->OMSetRenderTargets( 1, &_aoHistoryRTV[cur], NULL );
+	g_pTechnique->GetPassByIndex(12)->Apply(0);
+	pd3dDevice->DrawIndexed(_numIQuad, 0, 0);
+
+	// the blur passes read the ao texture
+	pd3dDevice->OMSetRenderTargets( 0, NULL, NULL );
+	pd3dDevice->CopyResource( _aoTex, _aoHistoryTex[cur] );
+
+	// keep this frame's normals and depth for the history rejection
+	pd3dDevice->CopySubresourceRegion( _prevNormalTex, 0, 0, 0, 0, _mrtTex, D3D10CalcSubresource( 0, 1, 1 ), NULL );
+	pd3dDevice->CopySubresourceRegion( _prevDepthTex, 0, 0, 0, 0, _pyramidTex, 0, NULL );
+
+	_historyIndex = prev;
+	_historyValid = true;
+	++_frameIndex;
+} // End Render Temporal AO
+
+//--------------------------------------------------------------------------------------
+// Reads back the timing of the ao passes once the GPU is done with them
+// (never waits: if the results aren't there yet, try again next frame)
+//--------------------------------------------------------------------------------------
+void ReadAOTimer() {
+	if (!_aoTimerPending)
+		return;
+
+	D3D10_QUERY_DATA_TIMESTAMP_DISJOINT disjoint;
+	UINT64 stamps[AO_STAGES + 1];
+	if (_aoTimerDisjoint->GetData( &disjoint, sizeof(disjoint), D3D10_ASYNC_GETDATA_DONOTFLUSH ) != S_OK)
+		return;
+	for (int i = 0; i <= AO_STAGES; ++i)
+		if (_aoTimestamps[i]->GetData( &stamps[i], sizeof(stamps[i]), D3D10_ASYNC_GETDATA_DONOTFLUSH ) != S_OK)
+			return;
+
+	if (!disjoint.Disjoint) {
+		for (int s = 0; s < AO_STAGES; ++s)
+			_aoStageMs[s] = ( float )( ( double )( stamps[s + 1] - stamps[s] ) / ( double )disjoint.Frequency * 1000.0 );
+		_aoTimeMs = ( float )( ( double )( stamps[AO_STAGES] - stamps[0] ) / ( double )disjoint.Frequency * 1000.0 );
+	}
+	_aoTimerPending = false;
+}
+
+// Ends a stage of the timed ao passes
+void MarkAOTimer( AOStage stage ) {
+	if (_aoTiming)
+		_aoTimestamps[stage + 1]->End();
+}
+
 //--------------------------------------------------------------------------------------
 // Renders the ambient occlusion texture
 //--------------------------------------------------------------------------------------
@@ -743,8 +2608,8 @@ void RenderAmbientOcclusion( ID3D10Device* pd3dDevice) {
 
 	// Set a new viewport for rendering to texture(s)
 	D3D10_VIEWPORT SMVP;
-	SMVP.Height = _height * TEXSCALE;
-	SMVP.Width = _width * TEXSCALE;
+	SMVP.Height = _height * _texScale;
+	SMVP.Width = _width * _texScale;
 	SMVP.MinDepth = 0;
 	SMVP.MaxDepth = 1;
 	SMVP.TopLeftX = 0;
@@ -767,9 +2632,10 @@ void RenderAmbientOcclusion( ID3D10Device* pd3dDevice) {
 
 	// attach all the textures
 	_mrtTextureVariable->SetResource(  _mrtSRV );
+	_pyramidVariable->SetResource( _pyramidSRV );
 
 	// Render the full-screen quad
-	
+
 	//
     // Update variables that change once per frame
     //
@@ -796,10 +2662,42 @@ void RenderAmbientOcclusion( ID3D10Device* pd3dDevice) {
 	D3D10_TECHNIQUE_DESC techDesc;
 	g_pTechnique->GetDesc( &techDesc );
 
-	// apply ambient occlusion pass
-    g_pTechnique->GetPassByIndex(3)->Apply(0);
-	// draw
-	pd3dDevice->DrawIndexed(_numIQuad, 0, 0);
+	// apply ambient occlusion pass (-msaa: the simple one per sample on edges)
+	if (_aoTechnique != AO_DEINTERLEAVED) {
+		MarkAOTimer( AO_STAGE_DEINTERLEAVE );
+		MarkAOTimer( AO_STAGE_LAYERS );
+	}
+	UINT aoPass = _msaa ? 16 : 3;
+	if (_aoTechnique == AO_SIMPLE && _variableRate && !_msaa) {
+		// the coarse tiles first, then every tile at its rate into the ao texture
+		RenderCoarseAO(pd3dDevice);
+		pd3dDevice->RSSetViewports( 1, &SMVP );
+		pd3dDevice->OMSetRenderTargets( numRenderTargets, aRTViews, _aoDSV );
+		aoPass = 21;
+	}
+	else if (_aoTechnique == AO_PYRAMID)
+		aoPass = 8;
+	else if (_aoTechnique == AO_HORIZON)
+		aoPass = 13;
+	else if (_aoTechnique == AO_DEINTERLEAVED) {
+		// ao of every quarter-resolution layer first, then put back together into the ao texture
+		RenderAOLayers(pd3dDevice);
+		pd3dDevice->RSSetViewports( 1, &SMVP );
+		pd3dDevice->OMSetRenderTargets( numRenderTargets, aRTViews, _aoDSV );
+		aoPass = 11;
+	}
+
+	if (_aoTechnique == AO_TEMPORAL) {
+		// accumulates into the history and copies the result into the ao texture
+		RenderTemporalAO(pd3dDevice);
+	}
+	else {
+		g_pTechnique->GetPassByIndex(aoPass)->Apply(0);
+		// draw
+		pd3dDevice->DrawIndexed(_numIQuad, 0, 0);
+		_historyValid = false;
+	}
+	MarkAOTimer( AO_STAGE_AO );
 
 	/** BLURRING **/
 	{
@@ -844,11 +2742,194 @@ void RenderAmbientOcclusion( ID3D10Device* pd3dDevice) {
 
 
 
+//--------------------------------------------------------------------------------------
+// Frame export. Every frame the outputs are copied into the next staging texture of
+// their ring; copies of earlier frames are mapped without waiting if the GPU is done
+// with them, copied into a frame of the OutputSink and encoded and written on its
+// threads. Rendering only waits when a staging texture is needed again before its copy
+// finished (a readback stall) or when every frame of the sink is still being written.
+//--------------------------------------------------------------------------------------
+bool ExportTexel( DXGI_FORMAT format, OutputTexel& texel ) {
+	switch (format) {
+		case DXGI_FORMAT_R8G8B8A8_UNORM:
+		case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:		// written as is: already sRGB
+			texel = OUTPUT_UNORM8; return true;
+		case DXGI_FORMAT_R16G16B16A16_UNORM:
+			texel = OUTPUT_UNORM16; return true;
+		case DXGI_FORMAT_R32G32B32A32_FLOAT:
+			texel = OUTPUT_FLOAT32; return true;
+	}
+	return false;
+}
+
+// Hands the copy in staging texture slot to the sink; false if the GPU isn't done with it
+// and wait is false
+bool ReadBackExport( ExportTarget& target, UINT slot, bool wait ) {
+	D3D10_MAPPED_TEXTURE2D mapped;
+	HRESULT hr = target.staging[slot]->Map( 0, D3D10_MAP_READ, D3D10_MAP_FLAG_DO_NOT_WAIT, &mapped );
+	if (hr == DXGI_ERROR_WAS_STILL_DRAWING) {
+		if (!wait)
+			return false;
+		++_exportStalls;
+		hr = target.staging[slot]->Map( 0, D3D10_MAP_READ, 0, &mapped );
+	}
+	if (SUCCEEDED( hr )) {
+		D3D10_TEXTURE2D_DESC desc;
+		target.staging[slot]->GetDesc( &desc );
+		OutputTexel texel;
+		ExportTexel( desc.Format, texel );
+		OutputFrame* frame = _outputSink->Acquire();
+		frame->Init( desc.Width, desc.Height, 4, texel );
+		for (UINT y = 0; y < desc.Height; ++y)
+			memcpy( frame->Row( y ), ( const BYTE* )mapped.pData + y * mapped.RowPitch, frame->rowPitch );
+		target.staging[slot]->Unmap( 0 );
+
+		char path[MAX_PATH];
+		sprintf_s( path, MAX_PATH, "Export\\%05u_%s%s", target.frame[slot], target.name,
+				   target.encoding == OUTPUT_IMAGE ? ".qoi" : ".exr" );
+		frame->path = path;				// the pooled frame's string keeps its capacity
+		frame->encoding = target.encoding;
+		frame->channels = target.channels;
+		_outputSink->Submit( frame );
+	}
+	target.frame[slot] = 0;
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+// Records what drives this frame: the three cameras, the world, the puffiness and the
+// settings, so FrameReplay (or -replay) can render it again without the window
+//--------------------------------------------------------------------------------------
+void CaptureFrame( float fElapsedTime ) {
+	if (!_frameCapture.IsOpen()) {
+		SYSTEMTIME now;
+		GetLocalTime( &now );
+		char path[MAX_PATH];
+		sprintf_s( path, MAX_PATH, "Capture\\%04u%02u%02u_%02u%02u%02u.fcap", now.wYear, now.wMonth, now.wDay, now.wHour,
+				   now.wMinute, now.wSecond );
+		CreateDirectoryA( "Capture", NULL );
+		if (!_frameCapture.Open( path, _texScale )) {
+			_captureFrames = false;
+			g_SampleUI.GetCheckBox( IDC_TOGGLECAPTURE )->SetChecked( false );
+			return;
+		}
+	}
+
+	FrameInputs frame;
+	frame.elapsed = fElapsedTime;
+	frame.world = g_World;
+	frame.view = Mat4Load( ( const float* )g_Camera.GetViewMatrix() );
+	frame.projection = Mat4Load( ( const float* )g_Camera.GetProjMatrix() );
+	frame.quadView = Mat4Load( ( const float* )t_Camera.GetViewMatrix() );
+	frame.quadProjection = Mat4Load( ( const float* )t_Camera.GetProjMatrix() );
+	frame.aoView = Mat4Load( ( const float* )ao_Camera.GetViewMatrix() );
+	frame.aoProjection = Mat4Load( ( const float* )ao_Camera.GetProjMatrix() );
+	frame.puffiness = g_fModelPuffiness;
+	frame.ambientOcclusion = _ambientOcclusion;
+	frame.textureToRender = _textureToRender;
+	frame.aoTechnique = _aoTechnique;
+	frame.horizonDirections = _horizonPresets[_horizonPreset].directions;
+	frame.horizonSteps = _horizonPresets[_horizonPreset].steps;
+	frame.width = _width;
+	frame.height = _height;
+	_frameCapture.Write( frame );
+}
+
+void ExportFrame( ID3D10Device* pd3dDevice ) {
+	if (!_outputSink) {
+		// two frames' worth (one being written, one queued) on top of the staging rings:
+		// at TEXSCALE 2 a G-buffer slice is 24 MB
+		CreateDirectoryA( "Export", NULL );
+		_outputSink = new OutputSink( 2 * NUM_EXPORTS );
+	}
+	++_exportCount;
+	UINT slot = _exportCount % EXPORT_RING;
+
+	ID3D10Resource* backBuffer = NULL;
+	DXUTGetD3D10RenderTargetView()->GetResource( &backBuffer );
+	for (int i = 0; i < NUM_EXPORTS; ++i) {
+		ExportTarget& target = _exportTargets[i];
+		ID3D10Texture2D* source = i < 4 ? _mrtTex : i == 4 ? _vgTex : ( ID3D10Texture2D* )backBuffer;
+		UINT subresource = i < 4 ? D3D10CalcSubresource( 0, i, 1 ) : 0;
+		D3D10_TEXTURE2D_DESC desc;
+		source->GetDesc( &desc );
+		OutputTexel texel;
+		if (!ExportTexel( desc.Format, texel ))
+			continue;
+
+		if (!target.staging[0]) {
+			D3D10_TEXTURE2D_DESC stagingDesc = desc;
+			stagingDesc.MipLevels = 1;
+			stagingDesc.ArraySize = 1;
+			stagingDesc.SampleDesc.Count = 1;
+			stagingDesc.SampleDesc.Quality = 0;
+			stagingDesc.MiscFlags = 0;
+			if (desc.SampleDesc.Count > 1) {
+				stagingDesc.Usage = D3D10_USAGE_DEFAULT;
+				stagingDesc.BindFlags = 0;
+				stagingDesc.CPUAccessFlags = 0;
+				if (FAILED( pd3dDevice->CreateTexture2D( &stagingDesc, NULL, &target.resolve ) ))
+					continue;
+			}
+			stagingDesc.Usage = D3D10_USAGE_STAGING;
+			stagingDesc.BindFlags = 0;
+			stagingDesc.CPUAccessFlags = D3D10_CPU_ACCESS_READ;
+			for (UINT s = 0; s < EXPORT_RING; ++s)
+				pd3dDevice->CreateTexture2D( &stagingDesc, NULL, &target.staging[s] );
+		}
+		if (!target.staging[slot])
+			continue;
+
+		// the ring is full: the copy made EXPORT_RING frames ago has to come out first
+		if (target.frame[slot])
+			ReadBackExport( target, slot, true );
+		if (target.resolve) {
+			pd3dDevice->ResolveSubresource( target.resolve, 0, source, subresource, desc.Format );
+			pd3dDevice->CopyResource( target.staging[slot], target.resolve );
+		}
+		else
+			pd3dDevice->CopySubresourceRegion( target.staging[slot], 0, 0, 0, 0, source, subresource, NULL );
+		target.frame[slot] = _exportCount;
+
+		// older copies, oldest first, as far as the GPU got
+		for (UINT age = EXPORT_RING - 1; age >= 1; --age) {
+			UINT older = ( _exportCount - age ) % EXPORT_RING;
+			if (target.frame[older] && !ReadBackExport( target, older, false ))
+				break;
+		}
+	}
+	SAFE_RELEASE( backBuffer );
+}
+
+// Writes the copies still in the rings (waiting for them) and releases the textures
+void ReleaseExportTargets() {
+	for (int i = 0; i < NUM_EXPORTS; ++i) {
+		ExportTarget& target = _exportTargets[i];
+		for (UINT age = EXPORT_RING; age >= 1; --age) {
+			UINT slot = ( _exportCount + EXPORT_RING - age + 1 ) % EXPORT_RING;
+			if (target.staging[slot] && target.frame[slot])
+				ReadBackExport( target, slot, true );
+		}
+		for (UINT s = 0; s < EXPORT_RING; ++s)
+			SAFE_RELEASE( target.staging[s] );
+		SAFE_RELEASE( target.resolve );
+	}
+}
+
+
 //--------------------------------------------------------------------------------------
 // Render the scene using the D3D10 device
 //--------------------------------------------------------------------------------------
 void CALLBACK OnD3D10FrameRender( ID3D10Device* pd3dDevice, double fTime, float fElapsedTime, void* pUserContext )
 {
+	_frameArenas->BeginFrame( ++_cpuFrame );
+#if defined(DEBUG) | defined(_DEBUG)
+	_frameAllocations = 0;
+	_countAllocations = true;
+#endif
+	if (_captureFrames)
+		CaptureFrame( fElapsedTime );
+
 	// send random vectors
 	_vectorVariable->SetResource( _vectorSRV );
 
@@ -864,22 +2945,54 @@ void CALLBACK OnD3D10FrameRender( ID3D10Device* pd3dDevice, double fTime, float
 
 	/** Start rendering to all the textures **/
 	RenderTextures(pd3dDevice);
-		
+
+	/** Bring the shadow map up to date where something moved **/
+	UpdateShadows(pd3dDevice);
+
 	// Restore old view port
 	//pd3dDevice->RSSetViewports( 1, &OldVP );
 
 
 	// Temporary: Inverse Projection Matrix
-	D3DXMATRIX inverseProj, inverseView;
-	D3DXMatrixInverse(&inverseView, 0, g_Camera.GetViewMatrix() );
-	D3DXMatrixInverse(&inverseProj, 0, g_Camera.GetProjMatrix() );
-	inverseView = inverseView * inverseProj;
-	g_pProjectionInverseVariable->SetMatrix( inverseProj );
+	Mat4 inverseProj = Mat4Identity();
+	Mat4Inverse( Mat4Load( ( const float* )g_Camera.GetProjMatrix() ), inverseProj );
+	g_pProjectionInverseVariable->SetMatrix( ( float* )&inverseProj );
+
+	/** -msaa: resolve the G-buffer and find its edges (needs the inverse projection) **/
+	if (_msaa)
+		ResolveMsaa(pd3dDevice);
+
+	/** Build the depth pyramid from the depth slice (needs the inverse projection), for
+	    the ao techniques that read it (the simple one samples the depth slice) and the
+	    next frame's Hi-Z culling **/
+	if (( _ambientOcclusion && _aoTechnique != AO_SIMPLE ) || ( _sceneStreamer && _hiZCulling ))
+		RenderDepthPyramid(pd3dDevice);
 
 	/** Now render the ambient occlusion texture - use mrts as input to generate it**/	
-	if (_ambientOcclusion)
+	if (!_ambientOcclusion)
+		_historyValid = false;
+	else {
+		// time the ao passes (only when the last measurement has been read back)
+		_aoTiming = !_aoTimerPending;
+		if (_aoTiming) {
+			_aoTimerDisjoint->Begin();
+			_aoTimestamps[0]->End();
+		}
+
 		RenderAmbientOcclusion(pd3dDevice);
 
+		if (_aoTiming) {
+			MarkAOTimer( AO_STAGE_BLUR );
+			_aoTimerDisjoint->End();
+			_aoTimerPending = true;
+			_aoTiming = false;
+		}
+		ReadAOTimer();
+	}
+
+	// temporal ao reprojects with last frame's camera
+	_prevView = Mat4Load( ( const float* )g_Camera.GetViewMatrix() );
+
 
 
 	/** Now render the full-screen quad with texture **/
@@ -906,6 +3019,9 @@ void CALLBACK OnD3D10FrameRender( ID3D10Device* pd3dDevice, double fTime, float
     // render it instead of rendering the app's scene
     if( g_D3DSettingsDlg.IsActive() )
     {
+#if defined(DEBUG) | defined(_DEBUG)
+		_countAllocations = false;
+#endif
         g_D3DSettingsDlg.OnRender( fElapsedTime );
         return;
     }
@@ -960,15 +3076,26 @@ void CALLBACK OnD3D10FrameRender( ID3D10Device* pd3dDevice, double fTime, float
 	D3D10_TECHNIQUE_DESC techDesc;
 	g_pTechnique->GetDesc( &techDesc );
 
-	// apply regular rendering
-    g_pTechnique->GetPassByIndex(1)->Apply(0);
+	// apply regular rendering: the permutation for this view mode, shadow and ao flag
+	// (picked once per frame instead of branching in every pixel)
+	UINT compositePass = _textureToRender * 4 + ( _shadows ? 2 : 0 ) + ( _ambientOcclusion ? 1 : 0 );
+	ID3D10EffectTechnique* compositeTechnique = _msaa ? g_pCompositeMsaaTechnique : g_pCompositeTechnique;
+    compositeTechnique->GetPassByIndex(compositePass)->Apply(0);
 	// draw
 	pd3dDevice->DrawIndexed(_numIQuad, 0, 0);
 
+	// copy this frame's outputs, hand the ones copied earlier to the sink (before the UI is drawn)
+	if (_exportFrames)
+		ExportFrame( pd3dDevice );
+
 
     //
     // Render the UI
     //
+#if defined(DEBUG) | defined(_DEBUG)
+	_countAllocations = false;
+	_lastFrameAllocations = _frameAllocations;
+#endif
     g_HUD.OnRender( fElapsedTime );
     g_SampleUI.OnRender( fElapsedTime );
 
@@ -978,10 +3105,10 @@ void CALLBACK OnD3D10FrameRender( ID3D10Device* pd3dDevice, double fTime, float
 	// reset texture
 	_aoTextureVariable->SetResource(  _mrtSRV );
 
-	//
-	ID3D10ShaderResourceView *pSRV[2];
+	// (also unbinds the depth pyramid so it can be rendered to next frame)
+	ID3D10ShaderResourceView *pSRV[8];
 	memset(pSRV, 0, sizeof(pSRV));
-	pd3dDevice->PSSetShaderResources(0, 2, pSRV);
+	pd3dDevice->PSSetShaderResources(0, 8, pSRV);
 
 	/*ID3D10ShaderResourceView *const pSRV[1] = {NULL};
 	pd3dDevice->PSSetShaderResources(0, 1, pSRV);*/
@@ -998,6 +3125,88 @@ void RenderText()
     g_pTxtHelper->SetForegroundColor( D3DXCOLOR( 1.0f, 1.0f, 0.0f, 1.0f ) );
     g_pTxtHelper->DrawTextLine( DXUTGetFrameStats( true ) );//DXUTIsVsyncEnabled() ) );
     g_pTxtHelper->DrawTextLine( DXUTGetDeviceStats() );
+
+	WCHAR sz[200];
+
+	// GPU time of the ambient occlusion passes
+	if (_ambientOcclusion) {
+		if (_aoTechnique == AO_DEINTERLEAVED)
+			swprintf_s( sz, 200, L"AO + blur: %0.3f ms (deinterleave %0.3f, layers %0.3f, reinterleave %0.3f, blur %0.3f)",
+						_aoTimeMs, _aoStageMs[AO_STAGE_DEINTERLEAVE], _aoStageMs[AO_STAGE_LAYERS], _aoStageMs[AO_STAGE_AO],
+						_aoStageMs[AO_STAGE_BLUR] );
+		else
+			swprintf_s( sz, 200, L"AO + blur: %0.3f ms (AO %0.3f, blur %0.3f)%s", _aoTimeMs, _aoStageMs[AO_STAGE_AO],
+						_aoStageMs[AO_STAGE_BLUR], _aoTechnique == AO_SIMPLE && _variableRate && !_msaa ? L" (variable rate)" : L"" );
+		g_pTxtHelper->DrawTextLine( sz );
+	}
+
+	// how much of the shadow map had to be rendered again
+	if (_shadows) {
+		swprintf_s( sz, 200, L"Shadows: %0.1f%% of the %dx%d map re-rendered%s",
+					100.0f * _shadowTexels / ( SHADOWSIZE * SHADOWSIZE ), SHADOWSIZE, SHADOWSIZE,
+					_shadowStaticRendered ? L" (static casters too)" : L"" );
+		g_pTxtHelper->DrawTextLine( sz );
+	}
+
+	// how the G-buffer is antialiased
+	if (_msaa)
+		swprintf_s( sz, 200, L"G-buffer: %dx%d, %dx MSAA, edges shaded per sample", _width, _height, MSAA_SAMPLES );
+	else
+		swprintf_s( sz, 200, L"G-buffer: %dx%d, supersampled %dx%d", _width * _texScale, _height * _texScale, _texScale,
+					_texScale );
+	g_pTxtHelper->DrawTextLine( sz );
+
+	// time until the assets were loaded
+	swprintf_s( sz, 200, L"Assets: %0.1f ms (%0.1f ms one after another)", _assetLoadMs, _assetSumMs );
+	g_pTxtHelper->DrawTextLine( sz );
+
+	// vertex fetch of the G-buffer pass
+	bool quantized = _quantizedVertices && _quantizedVB;
+	UINT stride = quantized ? sizeof( PackedVertex ) : ( UINT )g_Mesh.GetVertexStride( 0, 0 );
+	swprintf_s( sz, 200, L"Vertices: %u B each, %0.1f KB per G-buffer pass (%s)", stride,
+				g_Mesh.GetNumVertices( 0, 0 ) * stride / 1024.0f,
+				quantized ? L"quantized" : _quantizedVB ? L"float" : L"float, no .qvtx" );
+	g_pTxtHelper->DrawTextLine( sz );
+
+	// the streamed scene: what's mapped, what drew, what had to wait
+	if (_sceneStreamer) {
+		SceneStreamer::Stats streamStats = _sceneStreamer->GetStats();
+		swprintf_s( sz, 200, L"Streaming: %u chunks (%0.1f MB) mapped, %u drawn (%u Hi-Z tested), %u queued, %I64u misses, %I64u evictions",
+					streamStats.residentChunks, streamStats.residentBytes / 1048576.0f, _chunkDraws, _chunkHiZTests,
+					streamStats.queued, streamStats.misses, streamStats.evictions );
+		g_pTxtHelper->DrawTextLine( sz );
+	}
+
+	// transient frame memory: anything past the arena went to the heap
+	FrameArenas::Stats arenaStats = _frameArenas->GetStats();
+#if defined(DEBUG) | defined(_DEBUG)
+	swprintf_s( sz, 200, L"Frame arena: %0.1f of %0.1f KB, %u overflows, %u heap allocations last frame",
+				arenaStats.highWater / 1024.0f, arenaStats.capacity / 1024.0f, arenaStats.overflows, _lastFrameAllocations );
+#else
+	swprintf_s( sz, 200, L"Frame arena: %0.1f of %0.1f KB, %u overflows", arenaStats.highWater / 1024.0f,
+				arenaStats.capacity / 1024.0f, arenaStats.overflows );
+#endif
+	g_pTxtHelper->DrawTextLine( sz );
+
+	// frames written to Export\: encoding rate and the times rendering had to wait
+	if (_outputSink) {
+		OutputSink::Stats outputStats = _outputSink->GetStats();
+		swprintf_s( sz, 200, L"Export: %u files (%0.1f MB), encoding %0.0f MB/s, %u waits for a frame (%0.1f ms), %u readback stalls",
+					outputStats.frames, outputStats.fileBytes / 1048576.0f, outputStats.EncodeMBps(), outputStats.blocked,
+					outputStats.blockedMs, _exportStalls );
+		g_pTxtHelper->DrawTextLine( sz );
+	}
+
+	// frame inputs recorded for FrameReplay
+	if (_frameCapture.IsOpen()) {
+		swprintf_s( sz, 200, L"Capture: %u frames, %0.1f KB", _frameCapture.Frames(), _frameCapture.Bytes() / 1024.0f );
+		g_pTxtHelper->DrawTextLine( sz );
+	}
+
+	// startup and memory cost of the composite permutations
+	swprintf_s( sz, 200, L"Effect load: %0.1f ms (%s), %u composite permutations: %0.1f KB (PSQuad: %0.1f KB)",
+				_effectLoadMs, _effectOrigin, _numCompositePasses, _compositeBytes / 1024.0f, _quadShaderBytes / 1024.0f );
+	g_pTxtHelper->DrawTextLine( sz );
     g_pTxtHelper->End();
 }
 
@@ -1008,6 +3217,7 @@ void RenderText()
 void CALLBACK OnD3D10ReleasingSwapChain( void* pUserContext )
 {
     g_DialogResourceManager.OnD3D10ReleasingSwapChain();
+	ReleaseExportTargets();		// remade at the new back buffer size
 }
 
 
@@ -1023,7 +3233,23 @@ void CALLBACK OnD3D10DestroyDevice( void* pUserContext )
     SAFE_RELEASE( g_pSprite );
     SAFE_DELETE( g_pTxtHelper );
     SAFE_RELEASE( g_pVertexLayout );
+	SAFE_RELEASE( g_pQuantizedLayout );
+	SAFE_RELEASE( _quantizedVB );
+	SAFE_DELETE( _sceneStreamer );
+	for (size_t i = 0; i < _chunkVB.size(); ++i) {
+		SAFE_RELEASE( _chunkVB[i] );
+		SAFE_RELEASE( _chunkIB[i] );
+	}
+	_chunkVB.clear();
+	_chunkIB.clear();
+	for (size_t i = 0; i < _chunkPredicates.size(); ++i)
+		SAFE_RELEASE( _chunkPredicates[i] );
+	_chunkPredicates.clear();
+	ReleaseExportTargets();
+	SAFE_DELETE( _outputSink );		// writes what is still queued
     SAFE_RELEASE( g_pEffect );
+	SAFE_RELEASE( _vectorSRV );
+	SAFE_DELETE( _assetLoader );		// only left over if device creation failed halfway
 
 	// The Quad Mesh variables
 	SAFE_RELEASE(_quadVB);
@@ -1034,6 +3260,71 @@ void CALLBACK OnD3D10DestroyDevice( void* pUserContext )
 	SAFE_RELEASE(_mrtRTV);
 	SAFE_RELEASE(_mrtSRV);
 	SAFE_RELEASE(_mrtDSV);
+	for (UINT slice = 0; slice < 4; ++slice)
+		SAFE_RELEASE(_mrtSliceRTV[slice]);
+	SAFE_RELEASE(_mrtSliceDSV);
+
+	// -msaa
+	SAFE_RELEASE(_msaaTex);
+	for (UINT slice = 0; slice < 4; ++slice)
+		SAFE_RELEASE(_msaaSliceRTV[slice]);
+	SAFE_RELEASE(_msaaSRV);
+	SAFE_RELEASE(_msaaDepthTex);
+	SAFE_RELEASE(_msaaDSV);
+	SAFE_RELEASE(_edgeTex);
+	SAFE_RELEASE(_edgeRTV);
+	SAFE_RELEASE(_edgeSRV);
+
+	// variable-rate AO
+	SAFE_RELEASE(_rateTex);
+	SAFE_RELEASE(_rateRTV);
+	SAFE_RELEASE(_rateSRV);
+	for (UINT i = 0; i < 2; ++i) {
+		SAFE_RELEASE(_coarseAOTex[i]);
+		SAFE_RELEASE(_coarseAORTV[i]);
+		SAFE_RELEASE(_coarseAOSRV[i]);
+	}
+
+	// shadows
+	for (UINT i = 0; i < 2; ++i) {
+		SAFE_RELEASE(_shadowTex[i]);
+		SAFE_RELEASE(_shadowDSV[i]);
+		SAFE_RELEASE(_shadowSRV[i]);
+	}
+
+	// The depth pyramid
+	for (UINT mip = 0; mip < PYRAMIDMIPS; ++mip) {
+		SAFE_RELEASE(_pyramidRTV[mip]);
+		SAFE_RELEASE(_pyramidMipSRV[mip]);
+	}
+	SAFE_RELEASE(_pyramidSRV);
+	SAFE_RELEASE(_pyramidTex);
+
+	// The deinterleaved ambient occlusion layers
+	for (UINT layer = 0; layer < NUMLAYERS; ++layer) {
+		SAFE_RELEASE(_deintRTV[layer]);
+		SAFE_RELEASE(_layerAORTV[layer]);
+	}
+	SAFE_RELEASE(_deintSRV);
+	SAFE_RELEASE(_deintTex);
+	SAFE_RELEASE(_layerAOSRV);
+	SAFE_RELEASE(_layerAOTex);
+	SAFE_RELEASE(_aoTimerDisjoint);
+	for (int i = 0; i <= AO_STAGES; ++i)
+		SAFE_RELEASE(_aoTimestamps[i]);
+	_aoTimerPending = false;
+
+	// The temporal ambient occlusion history
+	for (UINT i = 0; i < 2; ++i) {
+		SAFE_RELEASE(_aoHistoryRTV[i]);
+		SAFE_RELEASE(_aoHistorySRV[i]);
+		SAFE_RELEASE(_aoHistoryTex[i]);
+	}
+	SAFE_RELEASE(_prevNormalSRV);
+	SAFE_RELEASE(_prevNormalTex);
+	SAFE_RELEASE(_prevDepthSRV);
+	SAFE_RELEASE(_prevDepthTex);
+	_historyValid = false;
 
 
     g_Mesh.Destroy();
@@ -1060,19 +3351,36 @@ void CALLBACK OnFrameMove( double fTime, float fElapsedTime, void* pUserContext
     // Update the camera's position based on user input 
     g_Camera.FrameMove( fElapsedTime );
 
+	// rank the streamed chunks for this camera, and where it's going
+	if (_sceneStreamer) {
+		D3DXVECTOR3 eye = *g_Camera.GetEyePt();
+		D3DXVECTOR3 direction = *g_Camera.GetLookAtPt() - eye;
+		float length = sqrtf( direction.x * direction.x + direction.y * direction.y + direction.z * direction.z );
+		StreamView view;
+		for (int c = 0; c < 3; ++c) {
+			view.eye[c] = eye[c];
+			view.direction[c] = length > 0.0f ? direction[c] / length : 0.0f;
+			view.velocity[c] = fElapsedTime > 0.0f ? ( eye[c] - _prevEye[c] ) / fElapsedTime : 0.0f;
+		}
+		view.lookahead = 0.5f;
+		view.fovY = D3DX_PI / 4;
+		view.screenHeight = ( float )_height;
+		_sceneStreamer->Update( view );
+		_prevEye = eye;
+	}
+
 
     if( g_bSpinning ) {
-        D3DXMatrixRotationZ( &g_World, 60.0f * DEG2RAD((float)fTime) );
+        g_World = Mat4RotationZ( 60.0f * DEG2RAD((float)fTime) );
 	}
     else {
-		D3DXMatrixRotationZ( &g_World, DEG2RAD( 180.0f ) );
-        //D3DXMatrixRotationZ( &g_World, DEG2RAD( 180.0f ) );
+		g_World = Mat4RotationZ( DEG2RAD( 180.0f ) );
+        //g_World = Mat4RotationZ( DEG2RAD( 180.0f ) );
 	}
 
 	// rotate the scene
-    D3DXMATRIX mRot, yRot;
-    //D3DXMatrixRotationX( &mRot, DEG2RAD( 90.0f ) );
-	//D3DXMatrixRotationY( &yRot, DEG2RAD( 180.0f ) );
+    //Mat4 mRot = Mat4RotationX( DEG2RAD( 90.0f ) );
+	//Mat4 yRot = Mat4RotationY( DEG2RAD( 180.0f ) );
 	
     //g_World = mRot * yRot * g_World;
 }
@@ -1168,6 +3476,52 @@ void CALLBACK OnGUIEvent( UINT nEvent, int nControlID, CDXUTControl* pControl, v
 			g_UseAO->SetBool (_ambientOcclusion );
             break;
         }
+		case IDC_AOTECHNIQUE: // Choose the Ambient Occlusion technique
+		{
+			_aoTechnique = PtrToInt( g_SampleUI.GetComboBox( IDC_AOTECHNIQUE )->GetSelectedData() );
+			break;
+		}
+		case IDC_HBAOPRESET: // Choose the directions and steps of the horizon-based AO
+		{
+			_horizonPreset = PtrToInt( g_SampleUI.GetComboBox( IDC_HBAOPRESET )->GetSelectedData() );
+			g_HorizonDirections->SetInt( _horizonPresets[_horizonPreset].directions );
+			g_HorizonSteps->SetInt( _horizonPresets[_horizonPreset].steps );
+			break;
+		}
+		case IDC_TOGGLEVRS: // Shade the simple AO at the rate of every tile
+		{
+			_variableRate = g_SampleUI.GetCheckBox( IDC_TOGGLEVRS )->GetChecked();
+			break;
+		}
+		case IDC_TOGGLESHADOWS: // Shadows of the scene light
+		{
+			_shadows = g_SampleUI.GetCheckBox( IDC_TOGGLESHADOWS )->GetChecked();
+			break;
+		}
+		case IDC_TOGGLEHIZ: // Occlusion-cull the streamed chunks
+		{
+			_hiZCulling = g_SampleUI.GetCheckBox( IDC_TOGGLEHIZ )->GetChecked();
+			break;
+		}
+		case IDC_TOGGLEQUANTIZED: // Draw the mesh with the quantized vertices or the floats
+		{
+			_quantizedVertices = g_SampleUI.GetCheckBox( IDC_TOGGLEQUANTIZED )->GetChecked();
+			break;
+		}
+		case IDC_TOGGLEEXPORT: // Write the G-buffer, AO and composite of every frame
+		{
+			_exportFrames = g_SampleUI.GetCheckBox( IDC_TOGGLEEXPORT )->GetChecked();
+			if (!_exportFrames)
+				ReleaseExportTargets();
+			break;
+		}
+		case IDC_TOGGLECAPTURE: // Record the inputs of every frame (a new file each time)
+		{
+			_captureFrames = g_SampleUI.GetCheckBox( IDC_TOGGLECAPTURE )->GetChecked();
+			if (!_captureFrames)
+				_frameCapture.Close();
+			break;
+		}
         case IDC_PUFF_SCALE:
         {
             WCHAR sz[100];
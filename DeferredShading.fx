@@ -19,6 +19,32 @@ Texture2DArray _mrtTextures;	// the multiple render textures
 Texture2D _aoTexture;			// the ao texture
 Texture2D g_txDiffuse;			// the diffuse texture for the mesh
 Texture2D _vectorTexture;		// the random vectors
+Texture2D _depthPyramid;		// the depth pyramid (R = min, G = max linear view-space Z)
+Texture2D _depthPyramidSrc;		// the depth pyramid mip being downsampled
+Texture2DArray _deinterleavedTextures;	// 4x4 quarter-resolution layers (xyz = normal, w = linear Z)
+Texture2DArray _layerAOTextures;		// ambient occlusion of every quarter-resolution layer
+Texture2D _aoHistory;			// accumulated ambient occlusion of the last frame (temporal AO)
+Texture2D _prevNormals;			// the normal slice of the last frame
+Texture2D _prevDepth;			// the linear depth (pyramid mip 0) of the last frame
+
+// Edge-aware MSAA (-msaa): the G-buffer slices with MSAA_SAMPLES samples a pixel, and
+// the mask PSMsaaEdges makes of the pixels whose samples differ
+#define MSAA_SAMPLES 4
+Texture2DMSArray<float4, MSAA_SAMPLES> _msaaTextures;
+Texture2D _edgeTexture;
+
+// Variable-rate AO: the shading rate (block size / 4) of every RATE_TILE x RATE_TILE tile
+// of the G-buffer, made by PSShadingRate, and the AO of the tiles shaded in 2x2 and 4x4
+// blocks (PSAOCoarse)
+#define RATE_TILE 16
+Texture2D _rateTexture;
+Texture2D _coarseAO2;
+Texture2D _coarseAO4;
+
+// Shadows of the scene light: the map the composite reads, and the cache of the static
+// casters' depth that is copied into it wherever the moving mesh was or is
+Texture2D _shadowMap;
+Texture2D _shadowStatic;
 
 SamplerState samLinear
 {
@@ -36,6 +62,16 @@ SamplerState samPoint
     AddressV = Wrap;
 };
 
+// 2x2 percentage-closer filtering; off the map is lit
+SamplerComparisonState samShadow
+{
+    Filter = COMPARISON_MIN_MAG_LINEAR_MIP_POINT;
+    AddressU = Border;
+    AddressV = Border;
+    BorderColor = float4(1.0, 1.0, 1.0, 1.0);
+    ComparisonFunc = LESS_EQUAL;
+};
+
 // lighting variables
 cbuffer cbConstant 
 {
@@ -62,6 +98,62 @@ cbuffer cbUserChanges
     float Puffiness;
 	int   TexToRender;	// which texture to render?
 	bool  UseAO;		// Use Ambient Occlusion or not?
+	int   InterleaveLayer;	// which 4x4 layer is being rendered (deinterleaved AO)
+	float2 NoiseScale = float2(2048, 1536) / 64.0;	// render target size / rotation texture size
+};
+
+// Temporal AO: everything needed to find a pixel in the last frame
+cbuffer cbTemporal
+{
+	matrix ViewInverse;			// inverse of the G-buffer camera's view
+	matrix PrevView;			// the G-buffer camera's view last frame
+	matrix PrevViewProjection;	// the G-buffer camera's view * projection last frame
+	int    FrameIndex;			// rotates the tap pattern every frame
+	bool   HistoryValid;		// is there a last frame to blend with?
+};
+
+// Hi-Z occlusion test of a streamed chunk: its world-space box
+cbuffer cbHiZ
+{
+	float4 HiZBoxMin;
+	float4 HiZBoxMax;
+};
+
+// Horizon-based AO: the preset picked in the UI
+cbuffer cbHorizon
+{
+	int    HorizonDirections = 8;	// screen-space directions per pixel
+	int    HorizonSteps = 4;		// taps along every direction
+};
+
+// Edge-aware MSAA: when two samples of a pixel count as different
+cbuffer cbMsaa
+{
+	float  EdgeDepthThreshold = 0.01;	// linear Z differs by more than this fraction
+	float  EdgeNormalThreshold = 0.9;	// the normals' cosine is below this
+};
+
+// Variable-rate AO: when a block may be shaded by one of its pixels
+cbuffer cbShadingRate
+{
+	float  RateLumaThreshold = 0.02;	// RMS difference of the diffuse luminance to the shaded pixels
+	float  RateDepthThreshold = 0.02;	// linear Z differs from the shaded pixel's by more than this fraction
+	float  RateNormalThreshold = 0.95;	// the normals' cosine is below this
+};
+
+// Shadows: the light's view * projection, and the G-buffer camera's view space to it
+cbuffer cbShadow
+{
+	matrix ShadowViewProjection;
+	matrix ViewToShadow;
+	float  ShadowBias = 0.0005;		// subtracted from the light-space depth of the point
+};
+
+// Quantized vertices (VertexQuantizer): the box positions are relative to, per subset
+cbuffer cbQuantization
+{
+	float3 QuantOffset;		// box corner
+	float3 QuantScale;		// box extent (the unorm positions are 0..1 within it)
 };
 
 struct VS_INPUT
@@ -71,6 +163,13 @@ struct VS_INPUT
     float2 Tex          : TEXCOORD0;        //texture coordinate
 };
 
+struct VS_QUANTIZED_INPUT
+{
+    float4 Pos          : POSITION;         // R16G16B16A16_UNORM within the box, w unused
+    float2 Norm         : NORMAL;           // R16G16_SNORM, octahedral
+    float2 Tex          : TEXCOORD0;        // R16G16_FLOAT
+};
+
 struct PS_INPUT
 {
     float4 Pos : SV_POSITION;
@@ -94,6 +193,38 @@ BlendState NoBlending
     BlendEnable[0] = FALSE;
 };
 
+// The static shadow cache copied into the map, whatever was there
+DepthStencilState OverwriteDepth
+{
+    DepthEnable = TRUE;
+    DepthWriteMask = ALL;
+    DepthFunc = ALWAYS;
+};
+
+// The Hi-Z test's pixel: counted by the occlusion predicate, never written
+DepthStencilState DisableDepth
+{
+    DepthEnable = FALSE;
+    DepthWriteMask = ZERO;
+};
+
+BlendState NoColorWrites
+{
+    AlphaToCoverageEnable = FALSE;
+    BlendEnable[0] = FALSE;
+    RenderTargetWriteMask[0] = 0x0;
+    RenderTargetWriteMask[1] = 0x0;
+    RenderTargetWriteMask[2] = 0x0;
+    RenderTargetWriteMask[3] = 0x0;
+};
+
+// Shadow casters: both faces, only within the region being re-rendered
+RasterizerState ShadowRegion
+{
+    CullMode = NONE;
+    ScissorEnable = TRUE;
+};
+
 
 //--------------------------------------------------------------------------------------
 // Basic Vertex Shader
@@ -134,30 +265,56 @@ float4 PS( PS_INPUT input) : SV_Target
 // 1 = normal (put specular in .w?)
 // 2 = position
 // 3 = depth
-float4 PSQuad( PS_INPUT input) : SV_Target 
+// 4 = composite
+// 5 = ambient occlusion
+// (shared by PSQuad, which branches at runtime, and the compile-time PSQuadVariant permutations)
+
+// A slice of the G-buffer at uv: the single-sampled (resolved) one for sample -1, else
+// that sample of the multisampled one
+float4 gbufferSlice( float2 uv, int slice, int sample )
+{
+	if (sample < 0)
+		return _mrtTextures.Sample( samPoint, float3(uv, slice) );
+	uint width, height, elements, samples;
+	_msaaTextures.GetDimensions( width, height, elements, samples );
+	return _msaaTextures.Load( int3(uv * float2(width, height), slice), sample );
+}
+
+// How lit the view-space point is by the shadow light (1 lit, 0 in shadow)
+float shadowVisibility( float3 position )
+{
+	float4 p = mul( float4(position, 1.0), ViewToShadow );
+	if (p.w <= 0.0)
+		return 1.0;
+	p.xyz /= p.w;
+	float2 uv = float2(p.x * 0.5 + 0.5, 0.5 - p.y * 0.5);
+	return _shadowMap.SampleCmpLevelZero( samShadow, uv, p.z - ShadowBias );
+}
+
+float4 shadeQuadSample( PS_INPUT input, int texToRender, bool useAO, bool useShadows, int sample )
 {
 	// get all the values
 
 	// Diffuse
-	float4 diffuse	= _mrtTextures.Sample( samPoint, float3(input.Tex, 0) );
-	if (TexToRender == 0)
+	float4 diffuse	= gbufferSlice( input.Tex, 0, sample );
+	if (texToRender == 0)
 		return diffuse;
 
 	// normals 
-	float4 normals	= _mrtTextures.Sample( samPoint, float3(input.Tex, 1) );
+	float4 normals	= gbufferSlice( input.Tex, 1, sample );
 	normals =  (normals - 0.5) * 2.0;
-	if (TexToRender == 1) {
+	if (texToRender == 1) {
 		//float4 final = (normals + diffuse)/2;
 		//final.a = 0.1;
 		return normals;//final;
 	}
 
 	// depth
-	float4 depth	= _mrtTextures.Sample( samPoint, float3(input.Tex, 3) );
+	float4 depth	= gbufferSlice( input.Tex, 3, sample );
 	// discard
 	if (depth.x == 0.0)
 		return float4( 0.0f, 0.125f, 0.3f, 1.0f );
-	if (TexToRender == 3)
+	if (texToRender == 3)
 		return depth;
 
 	// position
@@ -171,7 +328,7 @@ float4 PSQuad( PS_INPUT input) : SV_Target
 					 1);
 	float4 D = mul(H, ProjectionInverse);
 	float4 position = D / D.w;
-	if (TexToRender == 2) {
+	if (texToRender == 2) {
 		return position;
 	}
 	
@@ -179,9 +336,9 @@ float4 PSQuad( PS_INPUT input) : SV_Target
 
 	// ambient occlusion
 	float4 ao;
-	if (UseAO == true) {
+	if (useAO == true) {
 		ao		= _aoTexture.Sample( samLinear, input.Tex );
-		if (TexToRender == 5)
+		if (texToRender == 5)
 			return ao;
 	}
 
@@ -192,6 +349,7 @@ float4 PSQuad( PS_INPUT input) : SV_Target
 
 	float3 lightDir = vLightPos - position.xyz;
 	float3 eyeVec   = -position.xyz;
+	float  lit      = useShadows ? shadowVisibility( position.xyz ) : 1.0;
 	float3 N        = normalize(normals);
 	float3 E        = normalize(eyeVec);
 	float3 L        = normalize(lightDir);
@@ -200,13 +358,13 @@ float4 PSQuad( PS_INPUT input) : SV_Target
 	
 
 	// diffuse
-	float4 dTerm = diffuse * max(dot(N, L), 0.0);
+	float4 dTerm = diffuse * max(dot(N, L), 0.0) * lit;
 
 	// specular
 	float4 specular = matSpecular * pow(max(dot(reflectV, E), 0.0), matShininess);
 
 	float4 outputColor = dTerm;// + specular;
-	if (UseAO == true) {
+	if (useAO == true) {
 		//ao += 0.4; // slightly softer
 		outputColor = outputColor * ao;
 	}
@@ -214,6 +372,43 @@ float4 PSQuad( PS_INPUT input) : SV_Target
 	return outputColor;
 }
 
+float4 shadeQuad( PS_INPUT input, int texToRender, bool useAO, bool useShadows )
+{
+	return shadeQuadSample( input, texToRender, useAO, useShadows, -1 );
+}
+
+// -msaa: the resolved G-buffer where the samples agree, the average of every sample's
+// shading on edges
+float4 shadeQuadMsaa( PS_INPUT input, int texToRender, bool useAO, bool useShadows )
+{
+	if (_edgeTexture.Sample( samPoint, input.Tex ).x == 0.0)
+		return shadeQuadSample( input, texToRender, useAO, useShadows, -1 );
+
+	float4 color = 0.0;
+	[unroll]
+	for (int s = 0; s < MSAA_SAMPLES; ++s)
+		color += shadeQuadSample( input, texToRender, useAO, useShadows, s );
+	return color / MSAA_SAMPLES;
+}
+
+float4 PSQuad( PS_INPUT input) : SV_Target 
+{
+	return shadeQuad( input, TexToRender, UseAO, false );
+}
+
+// One permutation per view mode, shadow and ao flag: the uniform parameters are
+// compile-time constants, so every branch on them is folded away (see technique Composite)
+float4 PSQuadVariant( PS_INPUT input, uniform int texToRender, uniform bool useShadows, uniform bool useAO ) : SV_Target
+{
+	return shadeQuad( input, texToRender, useAO, useShadows );
+}
+
+// The same for -msaa (see technique CompositeMsaa)
+float4 PSQuadMsaaVariant( PS_INPUT input, uniform int texToRender, uniform bool useShadows, uniform bool useAO ) : SV_Target
+{
+	return shadeQuadMsaa( input, texToRender, useAO, useShadows );
+}
+
 /******* Multiple Render Target Functions***************/
 
 // Geometry Shader input - vertex shader output
@@ -313,16 +508,86 @@ float4 PSMRT( PS_MRT_INPUT input ) : SV_Target
     //return input.Pos;
 }
 
+//--------------------------------------------------------------------------------------
+// Quantized vertices: decoded here, then the same as VSMRT
+//--------------------------------------------------------------------------------------
+float3 octDecode(in float2 e)
+{
+	float3 n = float3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = saturate(-n.z);
+	n.xy += n.xy >= 0.0 ? -t : t;
+	return normalize(n);
+}
+
+VS_INPUT decodeVertex(in VS_QUANTIZED_INPUT input)
+{
+	VS_INPUT output;
+	output.Pos = QuantOffset + input.Pos.xyz * QuantScale;
+	output.Norm = octDecode(input.Norm);
+	output.Tex = input.Tex;
+	return output;
+}
+
+/******* Multiple Render Targets without the Geometry Shader ***************/
+// All four slices are bound as simultaneous render targets, so every triangle is
+// rasterized once and every pixel writes all slices without branching on RTIndex.
+
+// Pixel Shader in - Vertex Shader out
+struct PS_MRT_DIRECT_INPUT
+{
+    float4 Pos  : SV_POSITION;
+	float4 PosWV: TEXCOORD1;    // World View Position
+	float3 Norm: NORMAL;      //normal
+    float2 Tex : TEXCOORD0;
+};
+
+// Pixel Shader out - one value per slice
+struct PS_MRT_OUTPUT
+{
+	float4 Diffuse	: SV_Target0;
+	float4 Normal	: SV_Target1;
+	float4 Position	: SV_Target2;
+	float4 Depth	: SV_Target3;
+};
+
+PS_MRT_DIRECT_INPUT VSMRTDirect( VS_INPUT input )
+{
+	GS_IN vsOut = VSMRT( input );
+
+	PS_MRT_DIRECT_INPUT output;
+	output.Pos = vsOut.Pos;
+	output.PosWV = vsOut.PosWV;
+	output.Norm = vsOut.Norm;
+	output.Tex = vsOut.Tex;
+	return output;
+}
+
+PS_MRT_DIRECT_INPUT VSMRTDirectQuantized( VS_QUANTIZED_INPUT input )
+{
+	return VSMRTDirect( decodeVertex( input ) );
+}
+
+PS_MRT_OUTPUT PSMRTAll( PS_MRT_DIRECT_INPUT input )
+{
+	PS_MRT_OUTPUT output;
+
+	// same values PSMRT writes to every slice
+	output.Diffuse = g_txDiffuse.Sample( samLinear, input.Tex );
+	output.Normal = float4(input.Norm * 0.5 + 0.5, 1.0);
+	output.Position = input.PosWV;
+	float normalizedDistance = 1.0f - input.Pos.z / input.Pos.w;
+	output.Depth = float4(normalizedDistance, normalizedDistance, normalizedDistance, normalizedDistance);
+
+	return output;
+}
+
 /******* Ambient Occlusion Functions***************/
 // Taken from:
 // http://archive.gamedev.net/reference/programming/features/simpleSSAO/
 
 
-float4 getPosition(in float2 uv)
+float4 positionFromDepth(in float2 uv, in float4 depth)
 {
-	//return _mrtTextures.Sample( samPoint, float3(uv, 2) );
-
-	float4 depth	= _mrtTextures.Sample( samLinear, float3(uv, 3) );
 	float4 H = float4(uv.x * 2.0 - 1.0, 
 					 ( uv.y) * 2.0 - 1.0,  
 					  depth.x * 3,
@@ -334,6 +599,13 @@ float4 getPosition(in float2 uv)
 
 }
 
+float4 getPosition(in float2 uv)
+{
+	//return _mrtTextures.Sample( samPoint, float3(uv, 2) );
+
+	return positionFromDepth(uv, _mrtTextures.Sample( samLinear, float3(uv, 3) ));
+}
+
 float4 getNormal(in float2 uv)
 {
 	float4 normals = _mrtTextures.Sample( samPoint, float3(uv, 1) );
@@ -346,7 +618,7 @@ float2 getRandom(in float2 uv)
 	//return normalize(_vectorTexture.Sample( samPoint, uv ).xy) * 2.0f - 1.0f;
 	//return float2(-1, 1);
 	//return float2(-1, -1);
-	return normalize(_vectorTexture.Sample( samPoint, (float2(1024, 768) * uv )/ 64.0).xy) * 2.0f - 1.0f;
+	return normalize(_vectorTexture.Sample( samPoint, NoiseScale * uv ).xy * 2.0f - 1.0f);
 }
 
 float doAmbientOcclusion(in float2 tcoord,in float2 uv, in float3 p, in float3 cnorm)
@@ -365,16 +637,40 @@ float doAmbientOcclusion(in float2 tcoord,in float2 uv, in float3 p, in float3 c
 // Pixel Shader for AO
 //--------------------------------------------------------------------------------------
 
+// the occlusion of the point p (normal n) of the pixel at uv
+float simpleOcclusion(in float2 uv, in float3 p, in float3 n, in float2 rand)
+{
+	float g_sample_rad = 0.9;
+	const float2 vec[4] = {float2(1,0),float2(-1,0),
+						   float2(0,1),float2(0,-1)};
+
+	float ao = 0.0f;
+	float rad = g_sample_rad/p.z;
+
+	//**SSAO Calculation**//
+	#define ITERATIONS 4
+	[unroll]
+	for (int j = 0; j < ITERATIONS; ++j)
+	{
+		float2 coord1 = reflect(vec[j],rand)*rad;
+		float2 coord2 = float2(coord1.x*0.707 - coord1.y*0.707, coord1.x*0.707 + coord1.y*0.707);
+
+		ao += doAmbientOcclusion(uv,coord1*0.25, p, n);
+		ao += doAmbientOcclusion(uv,coord2*0.5, p, n);
+		ao += doAmbientOcclusion(uv,coord1*0.75, p, n);
+		ao += doAmbientOcclusion(uv,coord2, p, n);
+	} 
+ 
+	return ao / ((float)ITERATIONS*4);
+}
+
 // SSAO using position + normals texture
 //
 float4 PSAO( PS_INPUT input ) : SV_Target
 {
  
-	float g_sample_rad = 0.9;
 	float2 uv = float2(1.0 - input.Tex.x, 1.0 - input.Tex.y); // align properly
 	//o.color.rgb = 1.0f;
-	const float2 vec[4] = {float2(1,0),float2(-1,0),
-						   float2(0,1),float2(0,-1)};
 
 	float3 p = getPosition(uv).xyz;
 	//p = mul(Projection, p);
@@ -386,24 +682,7 @@ float4 PSAO( PS_INPUT input ) : SV_Target
 		float2 rand = getRandom(input.Tex);//uv);
 		//float2 rand = float2(-1, -1);
 
-		float ao = 0.0f;
-		float rad = g_sample_rad/p.z;
-
-		//**SSAO Calculation**//
-		#define ITERATIONS 4
-		[unroll]
-		for (int j = 0; j < ITERATIONS; ++j)
-		{
-			float2 coord1 = reflect(vec[j],rand)*rad;
-			float2 coord2 = float2(coord1.x*0.707 - coord1.y*0.707, coord1.x*0.707 + coord1.y*0.707);
-  
-			ao += doAmbientOcclusion(uv,coord1*0.25, p, n);
-			ao += doAmbientOcclusion(uv,coord2*0.5, p, n);
-			ao += doAmbientOcclusion(uv,coord1*0.75, p, n);
-			ao += doAmbientOcclusion(uv,coord2, p, n);
-		} 
-	 
-		ao/= ((float)ITERATIONS*4);
+		float ao = simpleOcclusion(uv, p, n, rand);
 
 		return float4(1-ao, 1-ao, 1-ao, 1.0);
 		//return float4(ao, ao, ao, 1.0);
@@ -412,6 +691,484 @@ float4 PSAO( PS_INPUT input ) : SV_Target
 	//return float4(0.0, 0.5, 0.0, 1.0);
 }
 
+// -msaa: PSAO where the samples agree, the occlusion of every sample averaged on edges
+// (their taps read the resolved G-buffer)
+float4 PSAOMsaa( PS_INPUT input ) : SV_Target
+{
+	float2 uv = float2(1.0 - input.Tex.x, 1.0 - input.Tex.y); // align properly
+	if (_edgeTexture.Sample( samPoint, uv ).x == 0.0)
+		return PSAO( input );
+
+	float2 rand = getRandom(input.Tex);
+	float ao = 0.0f;
+	[unroll]
+	for (int s = 0; s < MSAA_SAMPLES; ++s) {
+		float3 p = positionFromDepth(uv, gbufferSlice(uv, 3, s)).xyz;
+		if (p.z != 0.3) {	// background samples aren't occluded
+			float3 n = (gbufferSlice(uv, 1, s).xyz - 0.5) * 2.0;
+			ao += simpleOcclusion(uv, p, n, rand);
+		}
+	}
+	ao /= MSAA_SAMPLES;
+	return float4(1-ao, 1-ao, 1-ao, 1.0);
+}
+
+/******* Depth Pyramid Functions***************/
+// Mip 0 holds the linear view-space Z of the depth slice, every further mip
+// the min (R) and max (G) of the 2x2 texels below it.
+// Scalable Ambient Obscurance (McGuire et al. 2012) uses the same idea to keep
+// large-radius AO taps cache-friendly.
+
+#define LOG_MAX_OFFSET 3	// taps closer than 2^LOG_MAX_OFFSET pixels read mip 0
+#define MAX_MIP_LEVEL 4		// last mip of the pyramid (PYRAMIDMIPS - 1)
+
+// linear view-space Z from the value stored in the depth slice (1 - z/w)
+float linearizeDepth(in float storedDepth)
+{
+	float4 D = mul(float4(0.0, 0.0, 1.0 - storedDepth, 1.0), ProjectionInverse);
+	return D.z / D.w;
+}
+
+// view-space position of the pixel at uv, given its linear view-space Z
+float3 getViewPosition(in float2 uv, in float z)
+{
+	// ray through the pixel on the far plane, scaled to the requested depth
+	float4 D = mul(float4(uv.x * 2.0 - 1.0, 1.0 - uv.y * 2.0, 1.0, 1.0), ProjectionInverse);
+	float3 ray = D.xyz / D.w;
+	return ray * (z / ray.z);
+}
+
+// view-space position of an AO tap ssR pixels away from the center,
+// read from the mip where the tap pattern is still about 2^LOG_MAX_OFFSET texels wide
+float3 getPyramidPosition(in float2 uv, in float ssR)
+{
+	int mip = clamp((int)floor(log2(max(ssR, 1.0))) - LOG_MAX_OFFSET, 0, MAX_MIP_LEVEL);
+	float z = _depthPyramid.SampleLevel(samPoint, uv, mip).x;
+	return getViewPosition(uv, z);
+}
+
+#define HIZ_MAX_TEXELS 16	// a rectangle wider than this at the last mip counts as visible
+
+// Occlusion test against the depth pyramid: a screen rectangle (uv) is hidden when its
+// nearest view-space Z is behind the farthest depth stored over all of it. Reads the
+// texels covering it in the mip where that's about 2x2 (mip m texel t covers pixels
+// t * 2^m and on, the last one of a row or column also the odd pixel left over).
+bool isOccludedHiZ(in float2 uvMin, in float2 uvMax, in float nearestZ)
+{
+	uint w, h, levels;
+	_depthPyramid.GetDimensions(0, w, h, levels);
+	int2 size = int2(w, h);
+	int2 pixelMin = clamp(int2(floor(uvMin * size)), 0, size - 1);
+	int2 pixelMax = clamp(int2(floor(uvMax * size)), 0, size - 1);
+	int2 extent = pixelMax - pixelMin + 1;
+	int mip = min((int)ceil(log2((float)max(extent.x, extent.y))), (int)levels - 1);
+
+	uint mipW, mipH;
+	_depthPyramid.GetDimensions(mip, mipW, mipH, levels);
+	int2 texelMin = min(pixelMin >> mip, int2(mipW, mipH) - 1);
+	int2 texelMax = min(pixelMax >> mip, int2(mipW, mipH) - 1);
+	if (any(texelMax - texelMin >= HIZ_MAX_TEXELS))
+		return false;
+
+	float maxZ = 0.0;
+	[loop]
+	for (int y = texelMin.y; y <= texelMax.y; ++y) {
+		[loop]
+		for (int x = texelMin.x; x <= texelMax.x; ++x)
+			maxZ = max(maxZ, _depthPyramid.Load(int3(x, y, mip)).y);
+	}
+	return nearestZ > maxZ;
+}
+
+//--------------------------------------------------------------------------------------
+// Hi-Z occlusion test of a chunk, a single pixel drawn inside an occlusion predicate:
+// the chunk is drawn only if the pixel is. Its box is tested against last frame's
+// pyramid with last frame's camera; a box that reached behind that camera or past the
+// edges of its view is kept, since the pyramid knows nothing about what was there.
+//--------------------------------------------------------------------------------------
+float4 VSHiZTest( uint id : SV_VertexID ) : SV_Position
+{
+	return float4(0.0, 0.0, 0.5, 1.0);
+}
+
+float4 PSHiZTest( float4 pos : SV_Position ) : SV_Target
+{
+	float2 uvMin = 1.0, uvMax = 0.0;
+	float nearestZ = 1e30;
+	[unroll]
+	for (int i = 0; i < 8; ++i) {
+		float4 corner = float4((i & 1) ? HiZBoxMax.x : HiZBoxMin.x,
+							   (i & 2) ? HiZBoxMax.y : HiZBoxMin.y,
+							   (i & 4) ? HiZBoxMax.z : HiZBoxMin.z, 1.0);
+		float4 clip = mul(corner, PrevViewProjection);
+		if (clip.w <= 0.0)
+			return 0.0;
+		float2 uv = float2(clip.x / clip.w * 0.5 + 0.5, 0.5 - clip.y / clip.w * 0.5);
+		uvMin = min(uvMin, uv);
+		uvMax = max(uvMax, uv);
+		nearestZ = min(nearestZ, mul(corner, PrevView).z);
+	}
+	if (any(uvMin < 0.0) || any(uvMax > 1.0))
+		return 0.0;
+	if (isOccludedHiZ(uvMin, uvMax, nearestZ))
+		discard;
+	return 0.0;
+}
+
+//--------------------------------------------------------------------------------------
+// Pixel Shader for the first mip of the depth pyramid (linearize the depth slice)
+//--------------------------------------------------------------------------------------
+float4 PSDepthLinearize( PS_INPUT input ) : SV_Target
+{
+	int2 pixel = int2(input.Pos.xy);
+	float z = linearizeDepth(_mrtTextures.Load(int4(pixel, 3, 0)).x);
+	return float4(z, z, 0.0, 0.0);
+}
+
+//--------------------------------------------------------------------------------------
+// Pixel Shader for the other mips of the depth pyramid (2x2 min/max reduction)
+//--------------------------------------------------------------------------------------
+float4 PSDepthDownsample( PS_INPUT input ) : SV_Target
+{
+	int2 pixel = int2(input.Pos.xy) * 2;
+
+	// odd sized source: the last row/column also covers the texel that would be dropped
+	uint w, h;
+	_depthPyramidSrc.GetDimensions(w, h);
+	int2 last = int2((pixel.x + 3 == (int)w) ? 2 : 1, (pixel.y + 3 == (int)h) ? 2 : 1);
+
+	float2 minMax = float2(1e30, 0.0);
+	[loop]
+	for (int y = 0; y <= last.y; ++y) {
+		[loop]
+		for (int x = 0; x <= last.x; ++x) {
+			float2 texel = _depthPyramidSrc.Load(int3(pixel + int2(x, y), 0)).xy;
+			minMax.x = min(minMax.x, texel.x);
+			minMax.y = max(minMax.y, texel.y);
+		}
+	}
+	return float4(minMax, 0.0, 0.0);
+}
+
+// occlusion of p (with normal cnorm) by the view-space point q
+float aoTerm(in float3 p, in float3 cnorm, in float3 q, in float radius)
+{
+	float g_scale = 4;
+	float g_intensity = 2;
+	float g_bias = 0.00;
+
+	float3 diff = q - p;
+	float3 v = normalize(diff);
+	float d = length(diff) / radius * g_scale;	// distance relative to the sample radius
+	return max(0.0,dot(cnorm,v)-g_bias)*(1.0/(1.0+d))*g_intensity;
+}
+
+float doAmbientOcclusionPyramid(in float2 tcoord, in float2 uv, in float3 p, in float3 cnorm,
+								in float2 size, in float radius)
+{
+	return aoTerm(p, cnorm, getPyramidPosition(tcoord + uv, length(uv * size)), radius);
+}
+
+//--------------------------------------------------------------------------------------
+// Pixel Shader for AO using the depth pyramid
+//--------------------------------------------------------------------------------------
+
+// Same tap pattern as PSAO, but positions are reconstructed from linear view-space Z
+// and the radius is given in view-space units: far taps read coarser mips, so the
+// memory traffic per pixel stays flat as the radius grows
+float4 PSAOPyramid( PS_INPUT input ) : SV_Target
+{
+	float g_world_rad = 40.0;	// sample radius in view-space units
+	float2 uv = float2(1.0 - input.Tex.x, 1.0 - input.Tex.y); // align properly
+	const float2 vec[4] = {float2(1,0),float2(-1,0),
+						   float2(0,1),float2(0,-1)};
+
+	// background
+	if (_mrtTextures.Sample( samPoint, float3(uv, 3) ).x == 0.0)
+		return float4( 0.0f, 0.125f, 0.3f, 1.0f );
+
+	uint w, h, levels;
+	_depthPyramid.GetDimensions(0, w, h, levels);
+	float2 size = float2(w, h);
+
+	float3 p = getViewPosition(uv, _depthPyramid.SampleLevel(samPoint, uv, 0).x);
+	float3 n = normalize(getNormal(uv).xyz);
+	float2 rand = getRandom(input.Tex);
+
+	// project the view-space radius into texture space
+	float rad = 0.5 * g_world_rad / (p.z * ProjectionInverse._11);
+
+	float ao = 0.0f;
+	[unroll]
+	for (int j = 0; j < ITERATIONS; ++j)
+	{
+		float2 coord1 = reflect(vec[j],rand)*rad;
+		float2 coord2 = float2(coord1.x*0.707 - coord1.y*0.707, coord1.x*0.707 + coord1.y*0.707);
+
+		ao += doAmbientOcclusionPyramid(uv,coord1*0.25, p, n, size, g_world_rad);
+		ao += doAmbientOcclusionPyramid(uv,coord2*0.5, p, n, size, g_world_rad);
+		ao += doAmbientOcclusionPyramid(uv,coord1*0.75, p, n, size, g_world_rad);
+		ao += doAmbientOcclusionPyramid(uv,coord2, p, n, size, g_world_rad);
+	}
+
+	ao/= ((float)ITERATIONS*4);
+
+	return float4(1-ao, 1-ao, 1-ao, 1.0);
+}
+
+/******* Deinterleaved AO Functions***************/
+// The full-resolution G-buffer is split into 4x4 quarter-resolution layers: layer
+// (x % 4, y % 4) holds every pixel with that offset. All pixels of a layer share one
+// rotation vector, so neighbouring pixels of a layer fetch neighbouring texels.
+// (Bavoil & Jansen, "Particle Shadows & Cache-Efficient Post-Processing", 2013)
+
+#define INTERLEAVE 4		// layers are INTERLEAVE x INTERLEAVE pixels apart
+
+int2 layerOffset(in int layer)
+{
+	return int2(layer % INTERLEAVE, layer / INTERLEAVE);
+}
+
+//--------------------------------------------------------------------------------------
+// Pixel Shader for splitting normals + linear Z into one quarter-resolution layer
+//--------------------------------------------------------------------------------------
+float4 PSDeinterleave( PS_INPUT input ) : SV_Target
+{
+	int2 pixel = int2(input.Pos.xy) * INTERLEAVE + layerOffset(InterleaveLayer);
+
+	// background stays at Z = 0
+	float4 depth = _mrtTextures.Load(int4(pixel, 3, 0));
+	if (depth.x == 0.0)
+		return float4(0.0, 0.0, 0.0, 0.0);
+
+	float3 normal = (_mrtTextures.Load(int4(pixel, 1, 0)).xyz - 0.5) * 2.0;
+	return float4(normalize(normal), _depthPyramid.Load(int3(pixel, 0)).x);
+}
+
+//--------------------------------------------------------------------------------------
+// Pixel Shader for AO of one quarter-resolution layer
+//--------------------------------------------------------------------------------------
+
+// Same estimator and tap pattern as PSAOPyramid, but every tap is a texel of the
+// same layer (taps snap to multiples of INTERLEAVE full-resolution pixels)
+float4 PSAOLayer( PS_INPUT input ) : SV_Target
+{
+	float g_world_rad = 40.0;	// sample radius in view-space units
+	const float2 vec[4] = {float2(1,0),float2(-1,0),
+						   float2(0,1),float2(0,-1)};
+
+	uint w, h, slices;
+	_deinterleavedTextures.GetDimensions(w, h, slices);
+	float2 layerSize = float2(w, h);
+	float2 fullSize = layerSize * INTERLEAVE;
+	int2 offset = layerOffset(InterleaveLayer);
+
+	int2 texel = int2(input.Pos.xy);
+	float4 center = _deinterleavedTextures.Load(int4(texel, InterleaveLayer, 0));
+	if (center.w == 0.0)
+		return float4(1.0, 1.0, 1.0, 1.0);
+
+	float2 uv = (texel * INTERLEAVE + offset + 0.5) / fullSize;
+	float3 p = getViewPosition(uv, center.w);
+	float3 n = center.xyz;
+
+	// one rotation vector for the whole layer
+	float2 rand = normalize(_vectorTexture.Load(int3(offset, 0)).xy * 2.0f - 1.0f);
+
+	// radius in layer texels
+	float rad = 0.5 * g_world_rad / (p.z * ProjectionInverse._11) * layerSize.x;
+
+	float ao = 0.0f;
+	const float scales[4] = {0.25, 0.5, 0.75, 1.0};
+	[unroll]
+	for (int j = 0; j < ITERATIONS; ++j)
+	{
+		float2 coord1 = reflect(vec[j],rand)*rad;
+		float2 coord2 = float2(coord1.x*0.707 - coord1.y*0.707, coord1.x*0.707 + coord1.y*0.707);
+
+		[unroll]
+		for (int k = 0; k < 4; ++k)
+		{
+			int2 tap = texel + int2(round(((k & 1) ? coord2 : coord1) * scales[k]));
+			float4 tapData = _deinterleavedTextures.Load(int4(clamp(tap, int2(0, 0), int2(w, h) - 1), InterleaveLayer, 0));
+			if (tapData.w != 0.0) {
+				float2 tapUV = (tap * INTERLEAVE + offset + 0.5) / fullSize;
+				ao += aoTerm(p, n, getViewPosition(tapUV, tapData.w), g_world_rad);
+			}
+		}
+	}
+
+	ao/= ((float)ITERATIONS*4);
+
+	return float4(1-ao, 1-ao, 1-ao, 1.0);
+}
+
+//--------------------------------------------------------------------------------------
+// Pixel Shader for putting the AO layers back together at full resolution
+//--------------------------------------------------------------------------------------
+float4 PSReinterleave( PS_INPUT input ) : SV_Target
+{
+	uint w, h, slices;
+	_layerAOTextures.GetDimensions(w, h, slices);
+
+	// same source pixel as PSAO writes to this target pixel
+	float2 uv = float2(1.0 - input.Tex.x, 1.0 - input.Tex.y); // align properly
+	int2 pixel = int2(uv * float2(w, h) * INTERLEAVE);
+
+	// background
+	if (_mrtTextures.Load(int4(pixel, 3, 0)).x == 0.0)
+		return float4( 0.0f, 0.125f, 0.3f, 1.0f );
+
+	int2 offset = pixel % INTERLEAVE;
+	int layer = offset.y * INTERLEAVE + offset.x;
+	return _layerAOTextures.Load(int4(pixel / INTERLEAVE, layer, 0));
+}
+
+/******* Temporal AO Functions***************/
+// Every frame takes a quarter of the PSAOPyramid taps (one of the four directions),
+// so four frames cover the full pattern. The result is blended into a history that
+// is reprojected with last frame's camera and dropped where depth or normal disagree.
+
+#define TEMPORAL_MAX_HISTORY 16.0	// most frames blended into one pixel
+
+//--------------------------------------------------------------------------------------
+// Pixel Shader for temporally accumulated AO
+//--------------------------------------------------------------------------------------
+
+// .rgb = accumulated ao, .a = history length / TEMPORAL_MAX_HISTORY
+float4 PSAOTemporal( PS_INPUT input ) : SV_Target
+{
+	float g_world_rad = 40.0;	// sample radius in view-space units
+	float2 uv = float2(1.0 - input.Tex.x, 1.0 - input.Tex.y); // align properly
+	const float2 vec[4] = {float2(1,0),float2(-1,0),
+						   float2(0,1),float2(0,-1)};
+
+	// background
+	if (_mrtTextures.Sample( samPoint, float3(uv, 3) ).x == 0.0)
+		return float4( 0.0f, 0.125f, 0.3f, 0.0f );
+
+	uint w, h, levels;
+	_depthPyramid.GetDimensions(0, w, h, levels);
+	float2 size = float2(w, h);
+
+	float3 p = getViewPosition(uv, _depthPyramid.SampleLevel(samPoint, uv, 0).x);
+	float3 n = normalize(getNormal(uv).xyz);
+
+	// this frame's direction, with the rotation vector turned by the
+	// golden angle every four frames so the pattern keeps changing
+	float2 rand = getRandom(input.Tex);
+	float s, c;
+	sincos((FrameIndex / 4) * 2.39996, s, c);
+	rand = float2(rand.x * c - rand.y * s, rand.x * s + rand.y * c);
+
+	float rad = 0.5 * g_world_rad / (p.z * ProjectionInverse._11);
+	float2 coord1 = reflect(vec[FrameIndex % 4],rand)*rad;
+	float2 coord2 = float2(coord1.x*0.707 - coord1.y*0.707, coord1.x*0.707 + coord1.y*0.707);
+
+	float ao = 0.0f;
+	ao += doAmbientOcclusionPyramid(uv,coord1*0.25, p, n, size, g_world_rad);
+	ao += doAmbientOcclusionPyramid(uv,coord2*0.5, p, n, size, g_world_rad);
+	ao += doAmbientOcclusionPyramid(uv,coord1*0.75, p, n, size, g_world_rad);
+	ao += doAmbientOcclusionPyramid(uv,coord2, p, n, size, g_world_rad);
+	float current = 1 - ao / 4.0;
+
+	// where was this point last frame?
+	float4 world = mul(float4(p, 1.0), ViewInverse);
+	float4 prevClip = mul(world, PrevViewProjection);
+	float2 prevUV = float2(prevClip.x / prevClip.w * 0.5 + 0.5, 0.5 - prevClip.y / prevClip.w * 0.5);
+
+	float history = current;
+	float historyLength = 0.0;
+	if (HistoryValid && all(prevUV >= 0.0) && all(prevUV <= 1.0)) {
+		// only keep the history if it saw the same surface
+		float prevZ = _prevDepth.SampleLevel(samPoint, prevUV, 0).x;
+		float3 prevN = normalize((_prevNormals.SampleLevel(samPoint, prevUV, 0).xyz - 0.5) * 2.0);
+		float3 expectedN = mul(mul(n, (float3x3)ViewInverse), (float3x3)PrevView);
+
+		bool sameDepth = abs(prevZ - prevClip.w) < 0.02 * prevClip.w;	// w = view-space Z
+		bool sameNormal = dot(prevN, expectedN) > 0.9;
+		if (sameDepth && sameNormal) {
+			// the history has the same alignment as the ao texture
+			float4 prev = _aoHistory.SampleLevel(samPoint, float2(1.0 - prevUV.x, prevUV.y), 0);
+			history = prev.r;
+			historyLength = prev.a * TEMPORAL_MAX_HISTORY;
+		}
+	}
+
+	historyLength = min(historyLength + 1.0, TEMPORAL_MAX_HISTORY);
+	float result = lerp(history, current, 1.0 / historyLength);
+	return float4(result, result, result, historyLength / TEMPORAL_MAX_HISTORY);
+}
+
+/******* Horizon-Based AO Functions***************/
+// HBAO (Bavoil, Sainz & Dimitrov 2008) with the normal-oriented horizon of GTAO:
+// march a few screen-space directions, keep the highest horizon seen so far and
+// only count the part of each tap that rises above it. Far fewer taps than PSAO
+// for a smoother result.
+
+//--------------------------------------------------------------------------------------
+// Pixel Shader for horizon-based AO
+//--------------------------------------------------------------------------------------
+float4 PSAOHorizon( PS_INPUT input ) : SV_Target
+{
+	float g_world_rad = 40.0;	// sample radius in view-space units
+	float g_angle_bias = 0.1;	// sine of the smallest horizon angle that occludes
+	float g_intensity = 1.5;
+	float2 uv = float2(1.0 - input.Tex.x, 1.0 - input.Tex.y); // align properly
+
+	// background
+	if (_mrtTextures.Sample( samPoint, float3(uv, 3) ).x == 0.0)
+		return float4( 0.0f, 0.125f, 0.3f, 1.0f );
+
+	uint w, h, levels;
+	_depthPyramid.GetDimensions(0, w, h, levels);
+	float2 size = float2(w, h);
+
+	float3 p = getViewPosition(uv, _depthPyramid.SampleLevel(samPoint, uv, 0).x);
+	float3 n = normalize(getNormal(uv).xyz);
+
+	// step length in pixels; nothing to do when the radius is below a pixel
+	float radPixels = 0.5 * g_world_rad / (p.z * ProjectionInverse._11) * size.x;
+	float stepPixels = radPixels / (HorizonSteps + 1);
+	if (stepPixels < 1.0)
+		return float4(1.0, 1.0, 1.0, 1.0);
+
+	// the rotation vector turns the directions and offsets the first step
+	float2 rand = getRandom(input.Tex);
+	float baseAngle = atan2(rand.y, rand.x);
+	float jitter = frac(dot(rand, float2(0.5, 0.25)) + 0.5);
+	float angleStep = 6.2831853 / HorizonDirections;
+	float radius2 = g_world_rad * g_world_rad;
+
+	float ao = 0.0;
+	[loop]
+	for (int d = 0; d < HorizonDirections; ++d)
+	{
+		float s, c;
+		sincos(baseAngle + d * angleStep, s, c);
+		float2 dirUV = float2(c, s) * stepPixels / size;
+
+		float topSin = g_angle_bias;
+		[loop]
+		for (int k = 0; k < HorizonSteps; ++k)
+		{
+			float t = k + jitter + 1.0;
+			float3 H = getPyramidPosition(uv + dirUV * t, stepPixels * t) - p;
+			float l2 = dot(H, H);
+			if (l2 > 1e-4) {
+				float sinH = dot(n, H) * rsqrt(l2);
+				if (sinH > topSin) {
+					ao += (sinH - topSin) * saturate(1.0 - l2 / radius2);
+					topSin = sinH;
+				}
+			}
+		}
+	}
+
+	ao = saturate(ao / HorizonDirections * g_intensity);
+	return float4(1-ao, 1-ao, 1-ao, 1.0);
+}
+
 const float blurSize = 1.0/768.0;
 
 //--------------------------------------------------------------------------------------
@@ -464,6 +1221,175 @@ float4 PSVBlur( PS_INPUT input ) : SV_Target
 	
 }
 
+//--------------------------------------------------------------------------------------
+// Edge-aware MSAA (-msaa)
+// Resolves sample 0 of every slice into _mrtTextures, so the passes after it read a
+// 1x G-buffer as usual, and marks the pixels whose samples differ in coverage, depth
+// or normal: PSAOMsaa and CompositeMsaa shade only those per sample.
+//--------------------------------------------------------------------------------------
+struct PS_MSAA_RESOLVE_OUTPUT
+{
+	float4 Diffuse	: SV_Target0;
+	float4 Normal	: SV_Target1;
+	float4 Position	: SV_Target2;
+	float4 Depth	: SV_Target3;
+	float4 Edge		: SV_Target4;
+};
+
+PS_MSAA_RESOLVE_OUTPUT PSMsaaEdges( PS_INPUT input )
+{
+	int2 pixel = int2(input.Pos.xy);
+
+	PS_MSAA_RESOLVE_OUTPUT output;
+	output.Diffuse = _msaaTextures.Load( int3(pixel, 0), 0 );
+	output.Normal = _msaaTextures.Load( int3(pixel, 1), 0 );
+	output.Position = _msaaTextures.Load( int3(pixel, 2), 0 );
+	output.Depth = _msaaTextures.Load( int3(pixel, 3), 0 );
+
+	bool covered = output.Depth.x != 0.0;
+	float z = covered ? linearizeDepth(output.Depth.x) : 0.0;
+	float3 n = (output.Normal.xyz - 0.5) * 2.0;
+	bool edge = false;
+	[unroll]
+	for (int s = 1; s < MSAA_SAMPLES; ++s) {
+		float sampleDepth = _msaaTextures.Load( int3(pixel, 3), s ).x;
+		if ((sampleDepth != 0.0) != covered) {
+			edge = true;
+		}
+		else if (covered) {
+			float3 sampleNormal = (_msaaTextures.Load( int3(pixel, 1), s ).xyz - 0.5) * 2.0;
+			if (abs(linearizeDepth(sampleDepth) - z) > EdgeDepthThreshold * z ||
+				dot(sampleNormal, n) < EdgeNormalThreshold)
+				edge = true;
+		}
+	}
+	output.Edge = edge ? 1.0 : 0.0;
+
+	return output;
+}
+
+//--------------------------------------------------------------------------------------
+// Coarse (variable-rate) shading of the simple AO
+// Every tile gets the coarsest rate at which the pixels of each block still match the
+// one that is shaded (TileAllowsRate of Portable/ShadingRate.cpp). The AO of the 2x2
+// and 4x4 tiles is rendered at half and quarter resolution, and PSAOVrs reads it back
+// for them and runs PSAO only on the 1x1 tiles. Tiles are 16x16 pixels, so every
+// branch on the rate is coherent.
+//--------------------------------------------------------------------------------------
+float2 gbufferSize()
+{
+	uint width, height, elements;
+	_mrtTextures.GetDimensions( width, height, elements );
+	return float2(width, height);
+}
+
+// the rate (1, 2 or 4) of the tile of a G-buffer pixel
+int tileRate( int2 pixel )
+{
+	return (int)round( _rateTexture.Load( int3(pixel / RATE_TILE, 0) ).x * 4.0 );
+}
+
+float luminance( float3 color )
+{
+	return dot( color, float3(0.299, 0.587, 0.114) );
+}
+
+// can the tile at origin be shaded in rate x rate blocks?
+bool tileAllowsRate( int2 origin, int2 size, int rate )
+{
+	float lumaError = 0.0;
+	float pixels = 0.0;
+	int2 tileEnd = min( origin + RATE_TILE, size );
+	[loop]
+	for (int by = origin.y; by < tileEnd.y; by += rate) {
+		[loop]
+		for (int bx = origin.x; bx < tileEnd.x; bx += rate) {
+			int2 end = min( int2(bx, by) + rate, tileEnd );
+			int2 shaded = min( int2(bx, by) + rate / 2, end - 1 );
+			float sd = _mrtTextures.Load( int4(shaded, 3, 0) ).x;
+			float sz = sd != 0.0 ? linearizeDepth(sd) : 0.0;
+			float3 sn = _mrtTextures.Load( int4(shaded, 1, 0) ).xyz - 0.5;
+			float sl = luminance( _mrtTextures.Load( int4(shaded, 0, 0) ).rgb );
+			[loop]
+			for (int y = by; y < end.y; ++y) {
+				[loop]
+				for (int x = bx; x < end.x; ++x) {
+					float d = _mrtTextures.Load( int4(x, y, 3, 0) ).x;
+					if ((d != 0.0) != (sd != 0.0))
+						return false;
+					if (d != 0.0) {
+						float3 n = _mrtTextures.Load( int4(x, y, 1, 0) ).xyz - 0.5;
+						if (abs(linearizeDepth(d) - sz) > RateDepthThreshold * sz ||
+							dot(normalize(n), normalize(sn)) < RateNormalThreshold)
+							return false;
+					}
+					float e = luminance( _mrtTextures.Load( int4(x, y, 0, 0) ).rgb ) - sl;
+					lumaError += e * e;
+					pixels += 1.0;
+				}
+			}
+		}
+	}
+	return lumaError <= RateLumaThreshold * RateLumaThreshold * pixels;
+}
+
+// One pixel per tile (the rate map is rendered at 1/RATE_TILE of the G-buffer)
+float4 PSShadingRate( PS_INPUT input ) : SV_Target
+{
+	int2 origin = int2(input.Pos.xy) * RATE_TILE;
+	int2 size = int2(gbufferSize());
+	int rate = 1;
+	if (tileAllowsRate( origin, size, 4 ))
+		rate = 4;
+	else if (tileAllowsRate( origin, size, 2 ))
+		rate = 2;
+	return rate / 4.0;
+}
+
+// One pixel per rate x rate block (the target is 1/rate of the G-buffer): PSAO of the
+// block's pixel nearest its center, for the tiles at this rate
+float4 PSAOCoarse( PS_INPUT input, uniform int rate ) : SV_Target
+{
+	float2 size = gbufferSize();
+	// input.Tex is the center of the block, a pixel corner
+	int2 pixel = min( int2(floor((1.0 - input.Tex) * size + 0.5)), int2(size) - 1 );
+	if (tileRate( pixel ) != rate)
+		return 1.0;		// never read: PSAOVrs takes this tile from another rate
+
+	PS_INPUT shaded = input;
+	shaded.Tex = 1.0 - (pixel + 0.5) / size;
+	return PSAO( shaded );
+}
+
+float4 PSAOVrs( PS_INPUT input ) : SV_Target
+{
+	int rate = tileRate( int2((1.0 - input.Tex) * gbufferSize()) );
+	if (rate == 4)
+		return _coarseAO4.Sample( samPoint, input.Tex );
+	if (rate == 2)
+		return _coarseAO2.Sample( samPoint, input.Tex );
+	return PSAO( input );
+}
+
+//--------------------------------------------------------------------------------------
+// Shadow map: depth only, of the casters seen from the light (the puffiness included),
+// and the static cache restored under the scissor rect before the mesh is drawn again
+//--------------------------------------------------------------------------------------
+float4 VSShadow( VS_INPUT input ) : SV_POSITION
+{
+	float3 pos = input.Pos + input.Norm * Puffiness;
+	return mul( mul( float4(pos, 1.0), World ), ShadowViewProjection );
+}
+
+float4 VSShadowQuantized( VS_QUANTIZED_INPUT input ) : SV_POSITION
+{
+	return VSShadow( decodeVertex( input ) );
+}
+
+float PSShadowRestore( PS_INPUT input ) : SV_Depth
+{
+	return _shadowStatic.Load( int3(input.Pos.xy, 0) ).x;
+}
 
 //--------------------------------------------------------------------------------------
 // Technique
@@ -534,4 +1460,266 @@ technique10 Render
         SetDepthStencilState( EnableDepth, 0 );
         SetBlendState( NoBlending, float4( 0.0f, 0.0f, 0.0f, 0.0f ), 0xFFFFFFFF );
 	}
+
+	// depth pyramid: linearize the depth slice into mip 0
+	pass P6
+	{
+		SetVertexShader( CompileShader( vs_4_0, VS() ) );
+        SetGeometryShader( NULL );
+        SetPixelShader( CompileShader( ps_4_0, PSDepthLinearize() ) );
+
+        SetDepthStencilState( EnableDepth, 0 );
+        SetBlendState( NoBlending, float4( 0.0f, 0.0f, 0.0f, 0.0f ), 0xFFFFFFFF );
+	}
+
+	// depth pyramid: min/max downsample into the next mip
+	pass P7
+	{
+		SetVertexShader( CompileShader( vs_4_0, VS() ) );
+        SetGeometryShader( NULL );
+        SetPixelShader( CompileShader( ps_4_0, PSDepthDownsample() ) );
+
+        SetDepthStencilState( EnableDepth, 0 );
+        SetBlendState( NoBlending, float4( 0.0f, 0.0f, 0.0f, 0.0f ), 0xFFFFFFFF );
+	}
+
+	// ambient occlusion using the depth pyramid
+	pass P8
+	{
+		SetVertexShader( CompileShader( vs_4_0, VS() ) );
+        SetGeometryShader( NULL );
+        SetPixelShader( CompileShader( ps_4_0, PSAOPyramid() ) );
+
+        SetDepthStencilState( EnableDepth, 0 );
+        SetBlendState( NoBlending, float4( 0.0f, 0.0f, 0.0f, 0.0f ), 0xFFFFFFFF );
+	}
+
+	// deinterleaved ambient occlusion: split into quarter-resolution layers
+	pass P9
+	{
+		SetVertexShader( CompileShader( vs_4_0, VS() ) );
+        SetGeometryShader( NULL );
+        SetPixelShader( CompileShader( ps_4_0, PSDeinterleave() ) );
+
+        SetDepthStencilState( EnableDepth, 0 );
+        SetBlendState( NoBlending, float4( 0.0f, 0.0f, 0.0f, 0.0f ), 0xFFFFFFFF );
+	}
+
+	// deinterleaved ambient occlusion: AO of one layer
+	pass P10
+	{
+		SetVertexShader( CompileShader( vs_4_0, VS() ) );
+        SetGeometryShader( NULL );
+        SetPixelShader( CompileShader( ps_4_0, PSAOLayer() ) );
+
+        SetDepthStencilState( EnableDepth, 0 );
+        SetBlendState( NoBlending, float4( 0.0f, 0.0f, 0.0f, 0.0f ), 0xFFFFFFFF );
+	}
+
+	// deinterleaved ambient occlusion: back to full resolution
+	pass P11
+	{
+		SetVertexShader( CompileShader( vs_4_0, VS() ) );
+        SetGeometryShader( NULL );
+        SetPixelShader( CompileShader( ps_4_0, PSReinterleave() ) );
+
+        SetDepthStencilState( EnableDepth, 0 );
+        SetBlendState( NoBlending, float4( 0.0f, 0.0f, 0.0f, 0.0f ), 0xFFFFFFFF );
+	}
+
+	// temporally accumulated ambient occlusion
+	pass P12
+	{
+		SetVertexShader( CompileShader( vs_4_0, VS() ) );
+        SetGeometryShader( NULL );
+        SetPixelShader( CompileShader( ps_4_0, PSAOTemporal() ) );
+
+        SetDepthStencilState( EnableDepth, 0 );
+        SetBlendState( NoBlending, float4( 0.0f, 0.0f, 0.0f, 0.0f ), 0xFFFFFFFF );
+	}
+
+	// horizon-based ambient occlusion
+	pass P13
+	{
+		SetVertexShader( CompileShader( vs_4_0, VS() ) );
+        SetGeometryShader( NULL );
+        SetPixelShader( CompileShader( ps_4_0, PSAOHorizon() ) );
+
+        SetDepthStencilState( EnableDepth, 0 );
+        SetBlendState( NoBlending, float4( 0.0f, 0.0f, 0.0f, 0.0f ), 0xFFFFFFFF );
+	}
+
+	// Used to render to all four targets at once (no geometry shader)
+	pass P14
+	{
+		SetVertexShader( CompileShader( vs_4_0, VSMRTDirect() ) );
+        SetGeometryShader( NULL );
+        SetPixelShader( CompileShader( ps_4_0, PSMRTAll() ) );
+
+        SetDepthStencilState( EnableDepth, 0 );
+        SetBlendState( NoBlending, float4( 0.0f, 0.0f, 0.0f, 0.0f ), 0xFFFFFFFF );
+	}
+
+	// P14 with the 16-byte quantized vertices
+	pass P15
+	{
+		SetVertexShader( CompileShader( vs_4_0, VSMRTDirectQuantized() ) );
+        SetGeometryShader( NULL );
+        SetPixelShader( CompileShader( ps_4_0, PSMRTAll() ) );
+
+        SetDepthStencilState( EnableDepth, 0 );
+        SetBlendState( NoBlending, float4( 0.0f, 0.0f, 0.0f, 0.0f ), 0xFFFFFFFF );
+	}
+
+	// P3 shading every sample of the MSAA edges (-msaa)
+	pass P16
+	{
+		SetVertexShader( CompileShader( vs_4_0, VS() ) );
+        SetGeometryShader( NULL );
+        SetPixelShader( CompileShader( ps_4_0, PSAOMsaa() ) );
+
+        SetDepthStencilState( EnableDepth, 0 );
+        SetBlendState( NoBlending, float4( 0.0f, 0.0f, 0.0f, 0.0f ), 0xFFFFFFFF );
+	}
+
+	// MSAA resolve of sample 0 and the edge mask (-msaa)
+	pass P17
+	{
+		SetVertexShader( CompileShader( vs_4_0, VS() ) );
+        SetGeometryShader( NULL );
+        SetPixelShader( CompileShader( ps_4_0, PSMsaaEdges() ) );
+
+        SetDepthStencilState( EnableDepth, 0 );
+        SetBlendState( NoBlending, float4( 0.0f, 0.0f, 0.0f, 0.0f ), 0xFFFFFFFF );
+	}
+
+	// shading rate of every tile (variable-rate AO)
+	pass P18
+	{
+		SetVertexShader( CompileShader( vs_4_0, VS() ) );
+        SetGeometryShader( NULL );
+        SetPixelShader( CompileShader( ps_4_0, PSShadingRate() ) );
+
+        SetDepthStencilState( EnableDepth, 0 );
+        SetBlendState( NoBlending, float4( 0.0f, 0.0f, 0.0f, 0.0f ), 0xFFFFFFFF );
+	}
+
+	// P3 of the 2x2 tiles, at half resolution
+	pass P19
+	{
+		SetVertexShader( CompileShader( vs_4_0, VS() ) );
+        SetGeometryShader( NULL );
+        SetPixelShader( CompileShader( ps_4_0, PSAOCoarse( 2 ) ) );
+
+        SetDepthStencilState( EnableDepth, 0 );
+        SetBlendState( NoBlending, float4( 0.0f, 0.0f, 0.0f, 0.0f ), 0xFFFFFFFF );
+	}
+
+	// P3 of the 4x4 tiles, at quarter resolution
+	pass P20
+	{
+		SetVertexShader( CompileShader( vs_4_0, VS() ) );
+        SetGeometryShader( NULL );
+        SetPixelShader( CompileShader( ps_4_0, PSAOCoarse( 4 ) ) );
+
+        SetDepthStencilState( EnableDepth, 0 );
+        SetBlendState( NoBlending, float4( 0.0f, 0.0f, 0.0f, 0.0f ), 0xFFFFFFFF );
+	}
+
+	// P3 at the rate of every tile
+	pass P21
+	{
+		SetVertexShader( CompileShader( vs_4_0, VS() ) );
+        SetGeometryShader( NULL );
+        SetPixelShader( CompileShader( ps_4_0, PSAOVrs() ) );
+
+        SetDepthStencilState( EnableDepth, 0 );
+        SetBlendState( NoBlending, float4( 0.0f, 0.0f, 0.0f, 0.0f ), 0xFFFFFFFF );
+	}
+
+	// shadow casters (the mesh) into the shadow map
+	pass P22
+	{
+		SetVertexShader( CompileShader( vs_4_0, VSShadow() ) );
+        SetGeometryShader( NULL );
+        SetPixelShader( NULL );
+
+        SetDepthStencilState( EnableDepth, 0 );
+        SetRasterizerState( ShadowRegion );
+	}
+
+	// static shadow casters (the streamed scene, quantized) into the cache
+	pass P23
+	{
+		SetVertexShader( CompileShader( vs_4_0, VSShadowQuantized() ) );
+        SetGeometryShader( NULL );
+        SetPixelShader( NULL );
+
+        SetDepthStencilState( EnableDepth, 0 );
+        SetRasterizerState( ShadowRegion );
+	}
+
+	// the static cache into the shadow map, under the scissor rect
+	pass P24
+	{
+		SetVertexShader( CompileShader( vs_4_0, VS() ) );
+        SetGeometryShader( NULL );
+        SetPixelShader( CompileShader( ps_4_0, PSShadowRestore() ) );
+
+        SetDepthStencilState( OverwriteDepth, 0 );
+        SetRasterizerState( ShadowRegion );
+	}
+
+	// the Hi-Z occlusion test of a streamed chunk (a point, no input layout)
+	pass P25
+	{
+		SetVertexShader( CompileShader( vs_4_0, VSHiZTest() ) );
+        SetGeometryShader( NULL );
+        SetPixelShader( CompileShader( ps_4_0, PSHiZTest() ) );
+
+        SetDepthStencilState( DisableDepth, 0 );
+        SetBlendState( NoColorWrites, float4( 0.0f, 0.0f, 0.0f, 0.0f ), 0xFFFFFFFF );
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Composite permutations
+// One pass per (view mode, shadow flag, ao flag), generated from the matrix below:
+// pass index = view mode * 4 + shadow flag * 2 + ao flag
+//--------------------------------------------------------------------------------------
+#define COMPOSITE_PASS( ps, view, shadows, ao ) \
+	pass Composite_##view##_##shadows##_##ao \
+	{ \
+		SetVertexShader( CompileShader( vs_4_0, VS() ) ); \
+		SetGeometryShader( NULL ); \
+		SetPixelShader( CompileShader( ps_4_0, ps( view, shadows, ao ) ) ); \
+		SetDepthStencilState( EnableDepth, 0 ); \
+		SetBlendState( NoBlending, float4( 0.0f, 0.0f, 0.0f, 0.0f ), 0xFFFFFFFF ); \
+	}
+
+#define COMPOSITE_PASSES( ps, view ) \
+	COMPOSITE_PASS( ps, view, 0, 0 ) \
+	COMPOSITE_PASS( ps, view, 0, 1 ) \
+	COMPOSITE_PASS( ps, view, 1, 0 ) \
+	COMPOSITE_PASS( ps, view, 1, 1 )
+
+technique10 Composite
+{
+	COMPOSITE_PASSES( PSQuadVariant, 0 )	// diffuse
+	COMPOSITE_PASSES( PSQuadVariant, 1 )	// normals
+	COMPOSITE_PASSES( PSQuadVariant, 2 )	// position
+	COMPOSITE_PASSES( PSQuadVariant, 3 )	// depth
+	COMPOSITE_PASSES( PSQuadVariant, 4 )	// composite
+	COMPOSITE_PASSES( PSQuadVariant, 5 )	// ambient occlusion
+}
+
+// The same passes for -msaa, with the edges shaded per sample
+technique10 CompositeMsaa
+{
+	COMPOSITE_PASSES( PSQuadMsaaVariant, 0 )
+	COMPOSITE_PASSES( PSQuadMsaaVariant, 1 )
+	COMPOSITE_PASSES( PSQuadMsaaVariant, 2 )
+	COMPOSITE_PASSES( PSQuadMsaaVariant, 3 )
+	COMPOSITE_PASSES( PSQuadMsaaVariant, 4 )
+	COMPOSITE_PASSES( PSQuadMsaaVariant, 5 )
 }
\ No newline at end of file
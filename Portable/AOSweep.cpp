@@ -0,0 +1,293 @@
+//--------------------------------------------------------------------------------------
+// File: AOSweep.cpp
+//--------------------------------------------------------------------------------------
+#include "AOSweep.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+
+using namespace std;
+
+typedef chrono::high_resolution_clock Clock;
+
+static double Milliseconds( const Clock::time_point& start )
+{
+	return chrono::duration<double, milli>( Clock::now() - start ).count();
+}
+
+//--------------------------------------------------------------------------------------
+// Grid
+//--------------------------------------------------------------------------------------
+AOSweepGrid::AOSweepGrid()
+{
+	static const float scales[] = { 2.0f, 4.0f, 8.0f };
+	static const float intensities[] = { 1.0f, 2.0f, 3.0f };
+	static const float biases[] = { 0.0f, 0.05f };
+	static const int iterationCounts[] = { 1, 2, 4, 8 };
+	static const int blurs[] = { 0, 1, 2 };
+	radius.assign( 1, CpuAOParams().radius );
+	scale.assign( scales, scales + 3 );
+	intensity.assign( intensities, intensities + 3 );
+	bias.assign( biases, biases + 2 );
+	iterations.assign( iterationCounts, iterationCounts + 4 );
+	blur.assign( blurs, blurs + 3 );
+}
+
+void AOSweepGrid::Expand( vector<AOSweepConfig>& configs ) const
+{
+	configs.clear();
+	AOSweepConfig config;
+	for( size_t r = 0; r < radius.size(); ++r )
+		for( size_t s = 0; s < scale.size(); ++s )
+			for( size_t i = 0; i < intensity.size(); ++i )
+				for( size_t b = 0; b < bias.size(); ++b )
+					for( size_t n = 0; n < iterations.size(); ++n )
+						for( size_t f = 0; f < blur.size(); ++f )
+						{
+							config.params.radius = radius[r];
+							config.params.scale = scale[s];
+							config.params.intensity = intensity[i];
+							config.params.bias = bias[b];
+							config.params.iterations = iterations[n];
+							config.blur = blur[f];
+							configs.push_back( config );
+						}
+}
+
+bool ParseSweepList( const string& text, vector<float>& values )
+{
+	values.clear();
+	const char* p = text.c_str();
+	while( *p )
+	{
+		char* end = NULL;
+		double v = strtod( p, &end );
+		if( end == p || ( *end && *end != ',' ) )
+			return false;
+		values.push_back( ( float )v );
+		p = *end ? end + 1 : end;
+	}
+	return !values.empty();
+}
+
+bool ParseSweepList( const string& text, vector<int>& values )
+{
+	vector<float> floats;
+	if( !ParseSweepList( text, floats ) )
+		return false;
+	values.clear();
+	for( size_t i = 0; i < floats.size(); ++i )
+	{
+		if( floats[i] != floorf( floats[i] ) || floats[i] < 0.0f )
+			return false;
+		values.push_back( ( int )floats[i] );
+	}
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+// Ground truth
+//--------------------------------------------------------------------------------------
+struct TruthJob
+{
+	const CpuGBuffer*	gbuffer;
+	const CpuAOParams*	params;
+	int					directions, radii;
+	vector<float>*		ao;
+};
+
+static void TruthRows( void* data, int begin, int end )
+{
+	TruthJob& job = *( TruthJob* )data;
+	ComputeAOGroundTruth( *job.gbuffer, *job.params, job.directions, job.radii, begin, end, *job.ao );
+}
+
+void ComputeAOGroundTruth( JobSystem& jobs, const CpuGBuffer& gbuffer, const CpuAOParams& params, int directions,
+						   int radii, vector<float>& ao )
+{
+	ao.assign( ( size_t )gbuffer.width * gbuffer.height, 1.0f );
+	TruthJob job = { &gbuffer, &params, directions, radii, &ao };
+	JobCounter counter;
+	jobs.ParallelFor( 0, gbuffer.height, 4, TruthRows, &job, &counter );
+	jobs.Wait( counter );
+}
+
+//--------------------------------------------------------------------------------------
+// Error
+//--------------------------------------------------------------------------------------
+
+// Separable 11-tap Gaussian (sigma 1.5), clamped at the edges
+static void Gaussian( int w, int h, const vector<float>& in, vector<float>& scratch, vector<float>& out )
+{
+	float weights[11], sum = 0.0f;
+	for( int k = 0; k < 11; ++k )
+		sum += weights[k] = expf( -( k - 5 ) * ( k - 5 ) / ( 2.0f * 1.5f * 1.5f ) );
+	for( int k = 0; k < 11; ++k )
+		weights[k] /= sum;
+	scratch.resize( in.size() );
+	out.resize( in.size() );
+	for( int y = 0; y < h; ++y )
+		for( int x = 0; x < w; ++x )
+		{
+			float sum = 0.0f;
+			for( int k = 0; k < 11; ++k )
+				sum += in[y * w + min( max( x + k - 5, 0 ), w - 1 )] * weights[k];
+			scratch[y * w + x] = sum;
+		}
+	for( int y = 0; y < h; ++y )
+		for( int x = 0; x < w; ++x )
+		{
+			float sum = 0.0f;
+			for( int k = 0; k < 11; ++k )
+				sum += scratch[min( max( y + k - 5, 0 ), h - 1 ) * w + x] * weights[k];
+			out[y * w + x] = sum;
+		}
+}
+
+void CompareAO( const CpuGBuffer& gbuffer, const vector<float>& ao, const vector<float>& truth, double& rmse,
+				double& ssim )
+{
+	const int w = gbuffer.width;
+	const int h = gbuffer.height;
+	const size_t n = ( size_t )w * h;
+
+	double sumSq = 0.0;
+	size_t covered = 0;
+	for( size_t i = 0; i < n; ++i )
+		if( gbuffer.viewZ[i] != 0.0f )
+		{
+			double d = ao[i] - truth[i];
+			sumSq += d * d;
+			++covered;
+		}
+	rmse = covered ? sqrt( sumSq / covered ) : 0.0;
+
+	// local means, variances and covariance (AO spans 0..1: C1 = 0.01^2, C2 = 0.03^2)
+	vector<float> xx( n ), yy( n ), xy( n ), scratch, muX, muY, sXX, sYY, sXY;
+	for( size_t i = 0; i < n; ++i )
+	{
+		xx[i] = ao[i] * ao[i];
+		yy[i] = truth[i] * truth[i];
+		xy[i] = ao[i] * truth[i];
+	}
+	Gaussian( w, h, ao, scratch, muX );
+	Gaussian( w, h, truth, scratch, muY );
+	Gaussian( w, h, xx, scratch, sXX );
+	Gaussian( w, h, yy, scratch, sYY );
+	Gaussian( w, h, xy, scratch, sXY );
+	const double c1 = 0.01 * 0.01, c2 = 0.03 * 0.03;
+	double sum = 0.0;
+	for( size_t i = 0; i < n; ++i )
+	{
+		if( gbuffer.viewZ[i] == 0.0f )
+			continue;
+		double mx = muX[i], my = muY[i];
+		double vx = sXX[i] - mx * mx, vy = sYY[i] - my * my, cxy = sXY[i] - mx * my;
+		sum += ( 2.0 * mx * my + c1 ) * ( 2.0 * cxy + c2 ) / ( ( mx * mx + my * my + c1 ) * ( vx + vy + c2 ) );
+	}
+	ssim = covered ? sum / covered : 1.0;
+}
+
+//--------------------------------------------------------------------------------------
+// Sweep
+//--------------------------------------------------------------------------------------
+
+// AO and blur of config into ao; returns the milliseconds
+static double RunConfig( const CpuGBuffer& gbuffer, const AOSweepConfig& config, const CpuFloat2 rotations[CPU_NUMLAYERS],
+						 vector<float>& ao, vector<float>& scratch )
+{
+	Clock::time_point start = Clock::now();
+	ComputeAO( gbuffer, config.params, rotations, ao );
+	if( config.blur > 0 )
+		BlurAO( gbuffer.width, gbuffer.height, config.blur, ao, scratch );
+	return Milliseconds( start );
+}
+
+struct SweepJob
+{
+	const CpuGBuffer*				gbuffer;
+	const vector<float>*			truth;
+	const vector<AOSweepConfig>*	configs;
+	int								runs;
+	CpuFloat2						rotations[CPU_NUMLAYERS];
+	vector<AOSweepResult>*			results;
+};
+
+static void SweepConfigs( void* data, int begin, int end )
+{
+	SweepJob& job = *( SweepJob* )data;
+	vector<float> ao, scratch;
+	for( int c = begin; c < end; ++c )
+	{
+		AOSweepResult& result = ( *job.results )[c];
+		result.config = ( *job.configs )[c];
+		result.ms = 1e30;
+		for( int r = 0; r < max( job.runs, 1 ); ++r )
+			result.ms = min( result.ms, RunConfig( *job.gbuffer, result.config, job.rotations, ao, scratch ) );
+		CompareAO( *job.gbuffer, ao, *job.truth, result.rmse, result.ssim );
+		result.front = false;
+	}
+}
+
+void RunAOSweep( JobSystem& jobs, const CpuGBuffer& gbuffer, const vector<float>& truth,
+				 const vector<AOSweepConfig>& configs, int runs, vector<AOSweepResult>& results )
+{
+	results.resize( configs.size() );
+	SweepJob job;
+	job.gbuffer = &gbuffer;
+	job.truth = &truth;
+	job.configs = &configs;
+	job.runs = runs;
+	job.results = &results;
+	MakeRotationTable( job.rotations, 1 );
+	JobCounter counter;
+	jobs.ParallelFor( 0, ( int )configs.size(), 1, SweepConfigs, &job, &counter );
+	jobs.Wait( counter );
+}
+
+double TimeAOConfig( const CpuGBuffer& gbuffer, const AOSweepConfig& config, int runs )
+{
+	CpuFloat2 rotations[CPU_NUMLAYERS];
+	MakeRotationTable( rotations, 1 );
+	vector<float> ao, scratch;
+	double ms = 1e30;
+	for( int r = 0; r < max( runs, 1 ); ++r )
+		ms = min( ms, RunConfig( gbuffer, config, rotations, ao, scratch ) );
+	return ms;
+}
+
+static double SweepError( const AOSweepResult& result, bool bySsim )
+{
+	return bySsim ? 1.0 - result.ssim : result.rmse;
+}
+
+vector<AOSweepResult> MarkParetoFront( vector<AOSweepResult>& results, bool bySsim )
+{
+	// fastest first (the lower error first among equal times): a result is on the front
+	// when it beats the error of everything faster
+	vector<size_t> order( results.size() );
+	for( size_t i = 0; i < order.size(); ++i )
+		order[i] = i;
+	sort( order.begin(), order.end(), [&]( size_t a, size_t b )
+	{
+		if( results[a].ms != results[b].ms )
+			return results[a].ms < results[b].ms;
+		return SweepError( results[a], bySsim ) < SweepError( results[b], bySsim );
+	} );
+
+	vector<AOSweepResult> front;
+	double best = 1e30;
+	for( size_t i = 0; i < order.size(); ++i )
+	{
+		AOSweepResult& result = results[order[i]];
+		result.front = SweepError( result, bySsim ) < best;
+		if( result.front )
+		{
+			best = SweepError( result, bySsim );
+			front.push_back( result );
+		}
+	}
+	return front;
+}
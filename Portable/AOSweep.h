@@ -0,0 +1,68 @@
+//--------------------------------------------------------------------------------------
+// File: AOSweep.h
+//
+// Quality against cost of the PSAO parameters: g_sample_rad (radius), g_scale,
+// g_intensity, g_bias, ITERATIONS and the blur, which are constants in the shader.
+// Every configuration of a grid runs the CPU port of the kernel and the blur on one
+// G-buffer and is compared with a ground truth (ComputeAOGroundTruth at the reference
+// parameters, hundreds of taps a pixel): RMSE and mean SSIM over the covered pixels,
+// next to the milliseconds it took. The configurations nothing else beats on both
+// time and error are the Pareto front, the candidates for presets.
+//--------------------------------------------------------------------------------------
+#pragma once
+
+#include "CpuPasses.h"
+#include "JobSystem.h"
+
+#include <string>
+#include <vector>
+
+struct AOSweepConfig
+{
+	CpuAOParams		params;
+	int				blur;			// step of BlurAO in pixels, 0: no blur
+};
+
+// The values to try of every parameter; the grid is every combination
+struct AOSweepGrid
+{
+	std::vector<float>	radius, scale, intensity, bias;
+	std::vector<int>	iterations, blur;
+
+	AOSweepGrid();					// a few around the defaults of CpuAOParams
+	void Expand( std::vector<AOSweepConfig>& configs ) const;
+};
+
+// "1,2,4" into values; false if it isn't a list of numbers
+bool ParseSweepList( const std::string& text, std::vector<float>& values );
+bool ParseSweepList( const std::string& text, std::vector<int>& values );
+
+struct AOSweepResult
+{
+	AOSweepConfig	config;
+	double			ms;				// AO and blur
+	double			rmse;			// against the ground truth, covered pixels
+	double			ssim;			// mean SSIM, covered pixels
+	bool			front;			// on the Pareto front
+};
+
+// The ground truth of params on the JobSystem (bands of rows)
+void ComputeAOGroundTruth( JobSystem& jobs, const CpuGBuffer& gbuffer, const CpuAOParams& params, int directions,
+						   int radii, std::vector<float>& ao );
+
+// RMSE and mean SSIM (11x11 Gaussian window, sigma 1.5) of ao against truth over the
+// pixels the G-buffer covers
+void CompareAO( const CpuGBuffer& gbuffer, const std::vector<float>& ao, const std::vector<float>& truth,
+				double& rmse, double& ssim );
+
+// Runs every configuration as a job. Times are the fastest of runs; with more than one
+// worker they include the contention of the others, so re-time the front alone.
+void RunAOSweep( JobSystem& jobs, const CpuGBuffer& gbuffer, const std::vector<float>& truth,
+				 const std::vector<AOSweepConfig>& configs, int runs, std::vector<AOSweepResult>& results );
+
+// Times one configuration by itself (the fastest of runs)
+double TimeAOConfig( const CpuGBuffer& gbuffer, const AOSweepConfig& config, int runs );
+
+// Sets front on the results no other result beats in both time and error (1 - SSIM
+// instead of RMSE if bySsim) and returns them fastest first
+std::vector<AOSweepResult> MarkParetoFront( std::vector<AOSweepResult>& results, bool bySsim );
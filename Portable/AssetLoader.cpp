@@ -0,0 +1,313 @@
+//--------------------------------------------------------------------------------------
+// File: AssetLoader.cpp
+//
+// Asynchronous asset loading
+//--------------------------------------------------------------------------------------
+#include "AssetLoader.h"
+
+#include <algorithm>
+#include <cstdio>
+
+using namespace std;
+
+static bool ReadWholeFile( const string& path, vector<char>& bytes )
+{
+	FILE* file = fopen( path.c_str(), "rb" );
+	if( !file )
+		return false;
+	fseek( file, 0, SEEK_END );
+	long size = ftell( file );
+	fseek( file, 0, SEEK_SET );
+	bool ok = size >= 0;
+	if( ok )
+	{
+		bytes.resize( ( size_t )size );
+		ok = size == 0 || fread( &bytes[0], 1, bytes.size(), file ) == bytes.size();
+	}
+	fclose( file );
+	return ok;
+}
+
+//--------------------------------------------------------------------------------------
+// Setup
+//--------------------------------------------------------------------------------------
+AssetLoader::AssetLoader( int numThreads )
+	: _queueHead( 0 ), _quit( false ), _lastFinalize( 0.0 ), _start( chrono::high_resolution_clock::now() )
+{
+	if( numThreads <= 0 )
+		numThreads = max( 1, ( int )thread::hardware_concurrency() );
+	for( int i = 0; i < numThreads; ++i )
+		_threads.push_back( thread( &AssetLoader::WorkerLoop, this ) );
+}
+
+AssetLoader::~AssetLoader()
+{
+	{
+		lock_guard<mutex> lock( _mutex );
+		_quit = true;
+	}
+	_wakeWorkers.notify_all();
+	for( size_t i = 0; i < _threads.size(); ++i )
+		_threads[i].join();
+}
+
+double AssetLoader::Now() const
+{
+	return chrono::duration<double, milli>( chrono::high_resolution_clock::now() - _start ).count();
+}
+
+//--------------------------------------------------------------------------------------
+// Adding assets (any thread)
+//--------------------------------------------------------------------------------------
+AssetId AssetLoader::Add( const string& name, const string& path, const vector<AssetId>& dependencies,
+						  function<bool ( Asset& asset )> decode, function<bool ( Asset& asset )> finalize,
+						  bool optional )
+{
+	unique_ptr<Entry> entry( new Entry );
+	entry->asset.name = name;
+	entry->asset.path = path;
+	entry->asset.dependencies = dependencies;
+	entry->asset.decode = decode;
+	entry->asset.finalize = finalize;
+	entry->asset.optional = optional;
+	entry->state = WAITING;
+	entry->pending = 0;
+
+	lock_guard<mutex> lock( _mutex );
+	AssetId id = ( AssetId )_entries.size();
+	entry->asset.id = id;
+	string failedDependency;
+	for( size_t i = 0; i < dependencies.size(); ++i )
+	{
+		Entry& dependency = *_entries[dependencies[i]];
+		if( dependency.state == FAILED )
+		{
+			if( !dependency.asset.optional )
+				failedDependency = dependency.asset.name;
+		}
+		else if( dependency.state != LOADED && dependency.state != FINALIZED )
+		{
+			++entry->pending;
+			dependency.dependents.push_back( id );
+		}
+	}
+	_entries.push_back( move( entry ) );
+
+	if( !failedDependency.empty() )
+		Fail( id, "needs " + failedDependency + ", which failed" );
+	else if( _entries[id]->pending == 0 )
+		Queue( id );
+	return id;
+}
+
+void AssetLoader::Queue( AssetId id )
+{
+	_entries[id]->state = QUEUED;
+	_queue.push_back( id );
+	_wakeWorkers.notify_one();
+}
+
+// Fails id and everything waiting on it; an optional asset instead lets the assets
+// waiting on it go on as if it had loaded (unless it had, and failed to finalize)
+void AssetLoader::Fail( AssetId id, const string& error )
+{
+	Entry& entry = *_entries[id];
+	bool loaded = entry.state == LOADED;
+	entry.state = FAILED;
+	entry.asset.error = error;
+	for( size_t i = 0; i < entry.dependents.size(); ++i )
+	{
+		Entry& dependent = *_entries[entry.dependents[i]];
+		if( dependent.state != WAITING )
+			continue;
+		if( !entry.asset.optional )
+			Fail( entry.dependents[i], "needs " + entry.asset.name + ", which failed" );
+		else if( !loaded && --dependent.pending == 0 )
+			Queue( entry.dependents[i] );
+	}
+	_wakeRenderThread.notify_all();
+}
+
+//--------------------------------------------------------------------------------------
+// The pool
+//--------------------------------------------------------------------------------------
+void AssetLoader::WorkerLoop()
+{
+	for( ;; )
+	{
+		AssetId id;
+		{
+			unique_lock<mutex> lock( _mutex );
+			while( _queueHead == _queue.size() && !_quit )
+				_wakeWorkers.wait( lock );
+			if( _quit )
+				return;
+			id = _queue[_queueHead++];
+		}
+		Load( id );
+	}
+}
+
+void AssetLoader::Load( AssetId id )
+{
+	Entry* entry;
+	{
+		lock_guard<mutex> lock( _mutex );
+		entry = _entries[id].get();
+	}
+
+	// nothing else touches a queued asset, so it is read and decoded without the lock
+	Asset& asset = entry->asset;
+	string error;
+	double start = Now();
+	bool ok = asset.path.empty() || ReadWholeFile( asset.path, asset.bytes );
+	if( !ok )
+		error = "can't read " + asset.path;
+	double read = Now();
+	if( ok && asset.decode )
+	{
+		ok = asset.decode( asset );
+		if( !ok )
+			error = asset.error.empty() ? "can't decode " + asset.name : asset.error;
+	}
+	double decoded = Now();
+
+	lock_guard<mutex> lock( _mutex );
+	asset.readMs = read - start;
+	asset.decodeMs = decoded - read;
+	asset.loadedAt = decoded;
+	if( !ok )
+	{
+		Fail( id, error );
+		return;
+	}
+	entry->state = LOADED;
+	for( size_t i = 0; i < entry->dependents.size(); ++i )
+	{
+		Entry& dependent = *_entries[entry->dependents[i]];
+		if( --dependent.pending == 0 && dependent.state == WAITING )
+			Queue( entry->dependents[i] );
+	}
+	_wakeRenderThread.notify_all();
+}
+
+//--------------------------------------------------------------------------------------
+// Render thread
+//--------------------------------------------------------------------------------------
+bool AssetLoader::Finalize( bool wait )
+{
+	unique_lock<mutex> lock( _mutex );
+	for( ;; )
+	{
+		// in id order, so dependencies come first
+		bool progress = false;
+		bool busy = false;
+		for( AssetId id = 0; id < ( AssetId )_entries.size(); ++id )
+		{
+			Entry& entry = *_entries[id];
+			if( entry.state == WAITING || entry.state == QUEUED )
+				busy = true;
+			if( entry.state != LOADED )
+				continue;
+
+			bool ready = true;
+			string failedDependency;
+			for( size_t i = 0; i < entry.asset.dependencies.size(); ++i )
+			{
+				const Asset& dependency = _entries[entry.asset.dependencies[i]]->asset;
+				State state = _entries[entry.asset.dependencies[i]]->state;
+				if( state == FAILED && !dependency.optional )
+					failedDependency = dependency.name;
+				ready = ready && ( state == FINALIZED || state == FAILED );
+			}
+			if( !failedDependency.empty() )
+			{
+				Fail( id, "needs " + failedDependency + ", which failed" );
+				progress = true;
+				continue;
+			}
+			if( !ready )
+			{
+				busy = true;
+				continue;
+			}
+
+			lock.unlock();
+			double start = Now();
+			bool ok = !entry.asset.finalize || entry.asset.finalize( entry.asset );
+			double end = Now();
+			lock.lock();
+
+			entry.asset.finalizeMs = end - start;
+			entry.asset.finalizedAt = end;
+			_lastFinalize = end;
+			if( ok )
+				entry.state = FINALIZED;
+			else
+				Fail( id, entry.asset.error.empty() ? "can't create " + entry.asset.name : entry.asset.error );
+			progress = true;
+		}
+
+		if( progress )
+			continue;				// finalizing may have unblocked later entries
+		if( !busy || !wait )
+			break;
+		_wakeRenderThread.wait( lock );
+	}
+
+	for( size_t i = 0; i < _entries.size(); ++i )
+		if( _entries[i]->state == FAILED && !_entries[i]->asset.optional )
+			return false;
+	return true;
+}
+
+bool AssetLoader::Done() const
+{
+	lock_guard<mutex> lock( _mutex );
+	for( size_t i = 0; i < _entries.size(); ++i )
+		if( _entries[i]->state != FINALIZED && _entries[i]->state != FAILED )
+			return false;
+	return true;
+}
+
+shared_ptr<void> AssetLoader::Decoded( AssetId id ) const
+{
+	lock_guard<mutex> lock( _mutex );
+	return _entries[id]->asset.decoded;
+}
+
+const Asset& AssetLoader::Get( AssetId id ) const
+{
+	lock_guard<mutex> lock( _mutex );
+	return _entries[id]->asset;
+}
+
+string AssetLoader::FirstError() const
+{
+	lock_guard<mutex> lock( _mutex );
+	for( size_t i = 0; i < _entries.size(); ++i )
+		if( _entries[i]->state == FAILED )
+			return _entries[i]->asset.name + ": " + _entries[i]->asset.error;
+	return string();
+}
+
+AssetLoader::Stats AssetLoader::GetStats() const
+{
+	lock_guard<mutex> lock( _mutex );
+	Stats stats = { ( int )_entries.size(), 0, _lastFinalize, 0.0, 0.0 };
+	vector<double> chain( _entries.size(), 0.0 );
+	for( size_t i = 0; i < _entries.size(); ++i )
+	{
+		const Asset& asset = _entries[i]->asset;
+		double cost = asset.readMs + asset.decodeMs + asset.finalizeMs;
+		double before = 0.0;
+		for( size_t d = 0; d < asset.dependencies.size(); ++d )
+			before = max( before, chain[asset.dependencies[d]] );
+		chain[i] = before + cost;
+		stats.sumMs += cost;
+		stats.criticalMs = max( stats.criticalMs, chain[i] );
+		if( _entries[i]->state == FAILED )
+			++stats.failed;
+	}
+	return stats;
+}
@@ -0,0 +1,123 @@
+//--------------------------------------------------------------------------------------
+// File: AssetLoader.h
+//
+// Asynchronous asset loading. Every asset is read and decoded by a job on a small
+// thread pool as soon as the assets it depends on are loaded; the GPU side (the
+// finalize step) runs on the render thread, in dependency order, from Finalize().
+// Decode steps may add more assets, e.g. a mesh adds the textures its materials name,
+// so the time to load everything follows the slowest chain of assets instead of the
+// sum of all of them.
+// No D3D dependencies: the decode and finalize steps are passed in.
+//--------------------------------------------------------------------------------------
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef int AssetId;
+
+//--------------------------------------------------------------------------------------
+// One asset
+//--------------------------------------------------------------------------------------
+struct Asset
+{
+	AssetId						id;
+	std::string					name;
+	std::string					path;			// file read on the pool (empty: nothing to read)
+	std::vector<AssetId>		dependencies;	// loaded before decode runs, finalized before finalize runs
+	bool						optional;		// a failure doesn't fail the dependents, nor Finalize
+
+	// Pool thread: parse / decode bytes into decoded. May call AssetLoader::Add.
+	std::function<bool ( Asset& asset )>	decode;
+	// Render thread: create the GPU resources
+	std::function<bool ( Asset& asset )>	finalize;
+
+	std::vector<char>			bytes;			// contents of path
+	std::shared_ptr<void>		decoded;		// whatever decode made of them
+	std::string					error;
+
+	// milliseconds
+	double						readMs;
+	double						decodeMs;
+	double						finalizeMs;
+	double						loadedAt;		// since the loader was created
+	double						finalizedAt;
+
+	Asset() : id( -1 ), optional( false ), readMs( 0.0 ), decodeMs( 0.0 ), finalizeMs( 0.0 ), loadedAt( 0.0 ), finalizedAt( 0.0 ) {}
+};
+
+//--------------------------------------------------------------------------------------
+// The loader
+//--------------------------------------------------------------------------------------
+class AssetLoader
+{
+public:
+	struct Stats
+	{
+		int		assets;
+		int		failed;
+		double	wallMs;			// creation of the loader -> last finalize
+		double	sumMs;			// read + decode + finalize of every asset, one after another
+		double	criticalMs;		// the slowest chain of dependencies
+	};
+
+	// 0 threads: one per hardware thread
+	explicit AssetLoader( int numThreads = 0 );
+	~AssetLoader();				// waits for running jobs, drops queued ones
+
+	// Queues an asset; its job starts once its dependencies are loaded.
+	// Thread safe, also from decode steps. The dependents of an optional asset that
+	// fails go on without it (its decoded stays empty and finalize isn't called).
+	AssetId Add( const std::string& name, const std::string& path, const std::vector<AssetId>& dependencies,
+				 std::function<bool ( Asset& asset )> decode, std::function<bool ( Asset& asset )> finalize,
+				 bool optional = false );
+
+	// Render thread: finalizes every asset that is ready. With wait, blocks until all
+	// assets are finalized. Returns false once any asset that isn't optional failed
+	// (see FirstError; GetStats counts the optional failures too).
+	bool Finalize( bool wait );
+	bool Done() const;
+
+	// Decoded result of an asset (loaded assets only, e.g. dependencies in a decode step)
+	std::shared_ptr<void> Decoded( AssetId id ) const;
+	const Asset& Get( AssetId id ) const;		// render thread, after Finalize
+
+	std::string FirstError() const;
+	Stats GetStats() const;
+
+private:
+	enum State { WAITING, QUEUED, LOADED, FINALIZED, FAILED };
+
+	struct Entry
+	{
+		Asset		asset;
+		State		state;
+		int			pending;		// dependencies not loaded yet
+		std::vector<AssetId>	dependents;
+	};
+
+	// called with _mutex held
+	void Queue( AssetId id );
+	void Fail( AssetId id, const std::string& error );
+
+	void WorkerLoop();
+	void Load( AssetId id );
+	double Now() const;
+
+	mutable std::mutex						_mutex;
+	std::condition_variable					_wakeWorkers;
+	std::condition_variable					_wakeRenderThread;
+	std::vector<std::unique_ptr<Entry> >	_entries;		// by id; dependencies always have lower ids
+	std::vector<AssetId>					_queue;			// loaded first in, first out
+	size_t									_queueHead;
+	std::vector<std::thread>				_threads;
+	bool									_quit;
+	double									_lastFinalize;
+	std::chrono::high_resolution_clock::time_point	_start;
+};
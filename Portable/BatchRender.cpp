@@ -0,0 +1,467 @@
+//--------------------------------------------------------------------------------------
+// File: BatchRender.cpp
+//--------------------------------------------------------------------------------------
+#include "BatchRender.h"
+
+#include "MappedFile.h"
+#include "SdkmeshFile.h"
+#include "TextureCook.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+using namespace std;
+
+typedef chrono::high_resolution_clock Clock;
+
+static double Milliseconds( const Clock::time_point& start )
+{
+	return chrono::duration<double, milli>( Clock::now() - start ).count();
+}
+
+static bool Fail( string* error, const string& message )
+{
+	if( error )
+		*error = message;
+	return false;
+}
+
+//--------------------------------------------------------------------------------------
+// Batch files
+//--------------------------------------------------------------------------------------
+static const char* viewNames[NUM_VIEW_MODES] = { "diffuse", "normals", "position", "depth", "composite", "ao" };
+static const char* exportNames[NUM_EXPORTS] = { "diffuse", "normal", "depth", "ao" };
+
+// pattern with its first %d (or %0Nd) replaced by index
+static string FormatIndex( const string& pattern, unsigned int index )
+{
+	size_t percent = pattern.find( '%' );
+	if( percent == string::npos )
+		return pattern;
+	size_t end = percent + 1;
+	bool zeros = end < pattern.size() && pattern[end] == '0';
+	int width = 0;
+	while( end < pattern.size() && isdigit( ( unsigned char )pattern[end] ) )
+		width = width * 10 + ( pattern[end++] - '0' );
+	if( end >= pattern.size() || pattern[end] != 'd' )
+		return pattern;
+	string number = to_string( index );
+	if( ( int )number.size() < width )
+		number.insert( 0, width - number.size(), zeros ? '0' : ' ' );
+	return pattern.substr( 0, percent ) + number + pattern.substr( end + 1 );
+}
+
+bool ParseBatch( const string& text, vector<BatchView>& views, string* error )
+{
+	BatchView settings;
+	settings.eye = MakeVec3( 0.0f, 0.0f, -800.0f );
+	settings.at = MakeVec3( 0.0f, 0.0f, 0.0f );
+	settings.fovY = 3.14159265f / 4.0f;
+	settings.width = 1024;
+	settings.height = 768;
+	settings.ao = true;
+	settings.viewMode = VIEW_COMPOSITE;
+	settings.srgb = true;
+	settings.exports = 0;
+	settings.exrHalf = true;
+	string pattern = "view_%04d.ppm";
+
+	istringstream lines( text );
+	string line;
+	for( int number = 1; getline( lines, line ); ++number )
+	{
+		line = line.substr( 0, line.find( '#' ) );
+		istringstream in( line );
+		string command;
+		if( !( in >> command ) )
+			continue;
+
+		bool ok = true;
+		string word;
+		if( command == "size" )
+			ok = !!( in >> settings.width >> settings.height ) && settings.width > 0 && settings.height > 0;
+		else if( command == "ao" )
+		{
+			ok = !!( in >> word ) && ( word == "on" || word == "off" );
+			settings.ao = word == "on";
+		}
+		else if( command == "view" )
+		{
+			ok = !!( in >> word );
+			settings.viewMode = -1;
+			for( int v = 0; v < NUM_VIEW_MODES; ++v )
+				if( word == viewNames[v] )
+					settings.viewMode = v;
+			ok = ok && settings.viewMode >= 0;
+		}
+		else if( command == "fov" )
+		{
+			float degrees = 0.0f;
+			ok = !!( in >> degrees ) && degrees > 0.0f && degrees < 180.0f;
+			settings.fovY = degrees * 3.14159265f / 180.0f;
+		}
+		else if( command == "gamma" )
+		{
+			ok = !!( in >> word ) && ( word == "srgb" || word == "linear" );
+			settings.srgb = word == "srgb";
+		}
+		else if( command == "output" )
+			ok = !!( in >> pattern );
+		else if( command == "export" )
+		{
+			settings.exports = 0;
+			while( ok && in >> word )
+			{
+				int e = 0;
+				while( e < NUM_EXPORTS && word != exportNames[e] )
+					++e;
+				ok = e < NUM_EXPORTS || word == "none";
+				settings.exports |= e < NUM_EXPORTS ? 1u << e : 0u;
+			}
+		}
+		else if( command == "exr" )
+		{
+			ok = !!( in >> word ) && ( word == "half" || word == "float" );
+			settings.exrHalf = word == "half";
+		}
+		else if( command == "camera" )
+		{
+			BatchView view = settings;
+			ok = !!( in >> view.eye.x >> view.eye.y >> view.eye.z >> view.at.x >> view.at.y >> view.at.z );
+			view.output = FormatIndex( pattern, ( unsigned int )views.size() );
+			if( ok )
+				views.push_back( view );
+		}
+		else if( command == "orbit" )
+		{
+			// around the Y axis through the look-at point, starting in front of it (-Z)
+			int count = 0;
+			float radius = 0.0f, height = 0.0f;
+			BatchView view = settings;
+			ok = !!( in >> count >> radius >> height >> view.at.x >> view.at.y >> view.at.z ) && count > 0;
+			for( int i = 0; ok && i < count; ++i )
+			{
+				float angle = 2.0f * 3.14159265f * i / count;
+				view.eye = view.at + MakeVec3( radius * sinf( angle ), height, -radius * cosf( angle ) );
+				view.output = FormatIndex( pattern, ( unsigned int )views.size() );
+				views.push_back( view );
+			}
+		}
+		else
+			ok = false;
+		if( !ok )
+			return Fail( error, "line " + to_string( number ) + ": can't read \"" + line + "\"" );
+	}
+	return true;
+}
+
+bool ReadBatchFile( const string& path, vector<BatchView>& views, string* error )
+{
+	MappedFile file;
+	if( !file.Open( path ) )
+		return Fail( error, "can't read " + path );
+	return ParseBatch( string( ( const char* )file.Data(), file.Size() ), views, error );
+}
+
+//--------------------------------------------------------------------------------------
+// Mesh
+//--------------------------------------------------------------------------------------
+static bool LoadCpuTexture( const string& path, CpuTexture& texture )
+{
+	// the cooked one first, like the sample
+	size_t dot = path.find_last_of( '.' ), slash = path.find_last_of( "\\/" );
+	string cookedPath = path.substr( 0, dot == string::npos || ( slash != string::npos && dot < slash ) ? path.size() : dot ) + ".ctex";
+	MappedFile file;
+	CookedTextureView view;
+	Image image;
+	if( file.Open( cookedPath ) && ParseCookedTexture( file.Data(), file.Size(), view ) )
+	{
+		const CookedTextureHeader& header = *view.header;
+		CookedLevel level;
+		level.width = header.width;
+		level.height = header.height;
+		level.rowPitch = header.levels[0].rowPitch;
+		level.data.assign( view.levels[0], view.levels[0] + header.levels[0].size );
+		DecodeLevel( level, ( CookedFormat )header.format, image );
+		MakeCpuTexture( image, header.dxgiFormat == CookedDXGIFormat( ( CookedFormat )header.format, true ), texture );
+		return true;
+	}
+	if( !LoadImageFile( path, image ) )
+		return false;
+	MakeCpuTexture( image, false, texture );
+	return true;
+}
+
+bool LoadCpuMesh( const string& path, CpuMesh& mesh, string* error, int* missingTextures )
+{
+	MappedFile file;
+	SdkmeshData sdkmesh;
+	if( !file.Open( path ) )
+		return Fail( error, "can't read " + path );
+	if( !ReadSdkmesh( file.Data(), file.Size(), sdkmesh ) || sdkmesh.indices.empty() )
+		return Fail( error, path + ": not an sdkmesh with float3 position, float3 normal and float2 texcoord" );
+
+	mesh.vertices.swap( sdkmesh.vertices );
+	mesh.indices.swap( sdkmesh.indices );
+	mesh.subsets.clear();
+	mesh.textures.clear();
+	if( missingTextures )
+		*missingTextures = 0;
+
+	// every material texture once
+	string directory = path.substr( 0, path.find_last_of( "\\/" ) + 1 );
+	vector<int> materialTexture( sdkmesh.diffuseTextures.size(), -1 );
+	vector<string> names;
+	vector<int> nameTexture;
+	for( size_t m = 0; m < sdkmesh.diffuseTextures.size(); ++m )
+	{
+		const string& name = sdkmesh.diffuseTextures[m];
+		if( name.empty() )
+			continue;
+		vector<string>::iterator found = find( names.begin(), names.end(), name );
+		if( found != names.end() )
+		{
+			materialTexture[m] = nameTexture[found - names.begin()];
+			continue;
+		}
+		CpuTexture texture;
+		int index = -1;
+		if( LoadCpuTexture( directory + name, texture ) )
+		{
+			index = ( int )mesh.textures.size();
+			mesh.textures.push_back( texture );
+		}
+		else if( missingTextures )
+			++*missingTextures;
+		names.push_back( name );
+		nameTexture.push_back( index );
+		materialTexture[m] = index;
+	}
+
+	for( size_t s = 0; s < sdkmesh.subsets.size(); ++s )
+	{
+		const SdkmeshSubsetInfo& info = sdkmesh.subsets[s];
+		if( info.primitiveType != SDKMESH_TRIANGLE_LIST )
+			continue;
+		CpuMesh::Subset subset;
+		subset.indexStart = info.indexStart;
+		subset.indexCount = info.indexCount;
+		subset.vertexStart = info.vertexStart;
+		subset.texture = info.material < materialTexture.size() ? materialTexture[info.material] : -1;
+		mesh.subsets.push_back( subset );
+	}
+
+	// indices past the vertices would read out of bounds
+	for( size_t s = 0; s < mesh.subsets.size(); ++s )
+		for( unsigned int i = 0; i < mesh.subsets[s].indexCount; ++i )
+			if( mesh.indices[mesh.subsets[s].indexStart + i] + mesh.subsets[s].vertexStart >= mesh.vertices.size() )
+				return Fail( error, path + ": index out of range" );
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+// Rendering
+//--------------------------------------------------------------------------------------
+BatchContext::BatchContext() : gbufferMs( 0.0 ), aoMs( 0.0 ), compositeMs( 0.0 ), writeMs( 0.0 )
+{
+	memset( &rasterStats, 0, sizeof( rasterStats ) );
+}
+
+string ExportPath( const BatchView& view, int exportIndex )
+{
+	size_t slash = view.output.find_last_of( "/\\" );
+	size_t dot = view.output.rfind( '.' );
+	if( dot == string::npos || ( slash != string::npos && dot < slash ) )
+		dot = view.output.size();
+	return view.output.substr( 0, dot ) + "_" + exportNames[exportIndex] + ( exportIndex ? ".exr" : ".qoi" );
+}
+
+CpuCamera MakeBatchCamera( const BatchView& view )
+{
+	CpuCamera camera;
+	camera.world = Mat4RotationZ( 3.14159265f );
+	camera.view = Mat4LookAtLH( view.eye, view.at, MakeVec3( 0.0f, 1.0f, 0.0f ) );
+	camera.projection = Mat4PerspectiveFovLH( view.fovY, ( float )view.width / view.height, 0.1f, 5000.0f );
+	camera.puffiness = 0.0f;
+	return camera;
+}
+
+static unsigned char ToByte( float c, bool srgb )
+{
+	c = min( max( c, 0.0f ), 1.0f );
+	if( srgb )
+		c = c <= 0.0031308f ? c * 12.92f : 1.055f * powf( c, 1.0f / 2.4f ) - 0.055f;
+	return ( unsigned char )( c * 255.0f + 0.5f );
+}
+
+void RenderBatchView( const CpuMesh& mesh, const BatchView& view, BatchContext& context, Image& image )
+{
+	// the world and puffiness are the same for every view, so a camera seen before (the
+	// same view in another mode) reuses its vertices
+	Clock::time_point start = Clock::now();
+	CpuCamera camera = MakeBatchCamera( view );
+	context.view.Set( camera.view );
+	context.projection.Set( camera.projection );
+	context.gbuffer.Resize( view.width, view.height );
+	const CpuRasterScratch& vertices = context.vertices.Transform( mesh, 0, camera, 0, 0, 0,
+																   context.view.version + context.projection.version,
+																   context.gbuffer );
+	RasterizeRows( mesh, vertices, context.gbuffer, 0, view.height, &context.rasterStats );
+	context.gbufferMs += Milliseconds( start );
+
+	// AO at the resolution of the view, blurred like PSHBlur / PSVBlur
+	start = Clock::now();
+	bool needsAO = view.ao && ( view.viewMode == VIEW_COMPOSITE || view.viewMode == VIEW_AO );
+	if( needsAO || ( view.exports & EXPORT_AO ) )
+	{
+		CpuFloat2 rotations[CPU_NUMLAYERS];
+		MakeRotationTable( rotations, 1 );
+		ComputeAO( context.gbuffer, CpuAOParams(), rotations, context.ao );
+		BlurAO( view.width, view.height, max( 1, ( view.height + 384 ) / 768 ), context.ao, context.blur );
+	}
+	context.aoMs += Milliseconds( start );
+
+	start = Clock::now();
+	const CpuFloat3 lightPos = { 0.0f, -3.0f, -4.0f };	// vLightPos
+	context.color.resize( ( size_t )view.width * view.height );
+	SelectComposite( view.viewMode, needsAO )( context.gbuffer, context.ao, lightPos, 0, view.height, context.color );
+	image.width = view.width;
+	image.height = view.height;
+	image.rgba.resize( context.color.size() * 4 );
+	for( size_t i = 0; i < context.color.size(); ++i )
+	{
+		const CpuFloat4& c = context.color[i];
+		unsigned char* p = &image.rgba[i * 4];
+		p[0] = ToByte( c.x, view.srgb );
+		p[1] = ToByte( c.y, view.srgb );
+		p[2] = ToByte( c.z, view.srgb );
+		p[3] = ToByte( c.w, false );
+	}
+	context.compositeMs += Milliseconds( start );
+}
+
+struct BatchJob
+{
+	JobSystem*					jobs;
+	const CpuMesh*				mesh;
+	const vector<BatchView>*	views;
+	vector<BatchContext>*		contexts;		// by worker + 1
+	vector<Image>*				images;			// by view, or by worker + 1 when not kept
+	bool						keep;
+	OutputSink*					sink;
+};
+
+// Hands a float slice of the G-buffer (components floats per pixel) to the sink
+static void ExportSlice( OutputSink& sink, const BatchView& view, int exportIndex, const float* texels, int components,
+						 const char* channels )
+{
+	OutputFrame* frame = sink.Acquire();
+	frame->Init( view.width, view.height, components, OUTPUT_FLOAT32 );
+	memcpy( &frame->data[0], texels, frame->data.size() );
+	frame->path = ExportPath( view, exportIndex );
+	frame->encoding = exportIndex == 0 ? OUTPUT_IMAGE : view.exrHalf ? OUTPUT_EXR_HALF : OUTPUT_EXR_FLOAT;
+	frame->channels = channels;
+	sink.Submit( frame );
+}
+
+static void RenderViews( void* data, int begin, int end )
+{
+	BatchJob& job = *( BatchJob* )data;
+	int slot = job.jobs->CurrentWorker() + 1;
+	BatchContext& context = ( *job.contexts )[slot];
+	for( int v = begin; v < end; ++v )
+	{
+		const BatchView& view = ( *job.views )[v];
+		Image& image = ( *job.images )[job.keep ? v : slot];
+		RenderBatchView( *job.mesh, view, context, image );
+		if( view.output.empty() )
+			continue;
+
+		// the image goes to the sink as is: its buffer trades places with the pooled
+		// frame's unless the caller keeps it
+		Clock::time_point start = Clock::now();
+		OutputFrame* frame = job.sink->Acquire();
+		frame->Init( 0, 0, 4, OUTPUT_UNORM8 );
+		if( job.keep )
+			frame->data = image.rgba;
+		else
+			frame->data.swap( image.rgba );
+		frame->width = image.width;
+		frame->height = image.height;
+		frame->rowPitch = image.width * 4;
+		frame->path = view.output;
+		job.sink->Submit( frame );
+
+		const CpuGBuffer& gbuffer = context.gbuffer;
+		if( view.exports & EXPORT_DIFFUSE )
+			ExportSlice( *job.sink, view, 0, &gbuffer.diffuse[0].x, 4, "" );
+		if( view.exports & EXPORT_NORMAL )
+			ExportSlice( *job.sink, view, 1, &gbuffer.normal[0].x, 3, "RGB" );
+		if( view.exports & EXPORT_DEPTH )
+			ExportSlice( *job.sink, view, 2, &gbuffer.viewZ[0], 1, "Z" );
+		if( view.exports & EXPORT_AO )
+			ExportSlice( *job.sink, view, 3, &context.ao[0], 1, "Y" );
+		context.writeMs += Milliseconds( start );
+	}
+}
+
+bool RenderBatch( JobSystem& jobs, const CpuMesh& mesh, const vector<BatchView>& views, BatchStats& stats, OutputSink* sink,
+				  vector<Image>* images )
+{
+	Clock::time_point start = Clock::now();
+	int slots = jobs.NumWorkers() + 1;
+	vector<BatchContext> contexts( slots );
+	vector<Image> scratchImages;
+	if( images )
+		images->resize( views.size() );
+	else
+		scratchImages.resize( slots );
+	OutputSink* ownSink = sink ? NULL : new OutputSink( 4 * jobs.NumWorkers() );
+	if( !sink )
+		sink = ownSink;
+	OutputSink::Stats before = sink->GetStats();
+
+	BatchJob job = { &jobs, &mesh, &views, &contexts, images ? images : &scratchImages, images != NULL, sink };
+	JobCounter counter;
+	jobs.ParallelFor( 0, ( int )views.size(), 1, RenderViews, &job, &counter );
+	jobs.Wait( counter );
+	sink->Flush();
+
+	memset( &stats, 0, sizeof( stats ) );
+	stats.views = ( unsigned int )views.size();
+	for( int s = 0; s < slots; ++s )
+	{
+		stats.gbufferMs += contexts[s].gbufferMs;
+		stats.aoMs += contexts[s].aoMs;
+		stats.compositeMs += contexts[s].compositeMs;
+		stats.writeMs += contexts[s].writeMs;
+		stats.raster.triangles += contexts[s].rasterStats.triangles;
+		stats.raster.culled += contexts[s].rasterStats.culled;
+		stats.raster.clipped += contexts[s].rasterStats.clipped;
+		stats.raster.pixels += contexts[s].rasterStats.pixels;
+		stats.vertices.Add( contexts[s].vertices.GetStats() );
+	}
+
+	// what this batch added to the sink's stats
+	OutputSink::Stats after = sink->GetStats();
+	stats.output = after;
+	stats.output.frames -= before.frames;
+	stats.output.failed -= before.failed;
+	stats.output.dropped -= before.dropped;
+	stats.output.blocked -= before.blocked;
+	stats.output.blockedMs -= before.blockedMs;
+	stats.output.encodeMs -= before.encodeMs;
+	stats.output.writeMs -= before.writeMs;
+	stats.output.rawBytes -= before.rawBytes;
+	stats.output.fileBytes -= before.fileBytes;
+	stats.bytesWritten = stats.output.fileBytes;
+	stats.failedWrites = stats.output.failed;
+	delete ownSink;
+	stats.wallMs = Milliseconds( start );
+	return stats.failedWrites == 0;
+}
@@ -0,0 +1,109 @@
+//--------------------------------------------------------------------------------------
+// File: BatchRender.h
+//
+// Headless rendering of many views of one scene, for thumbnails and turntables on
+// machines without a window or a GPU. The mesh is loaded once; every view runs the CPU
+// G-buffer, AO, blur and composite passes as one job on the JobSystem, so a batch
+// renders as many views at a time as there are workers, and each one goes to an
+// OutputSink as soon as it is done, so workers never wait on the disk unless the
+// sink's pool is full. Used by DeferredShading -batch and Tools/BatchRender.
+//
+// Batch files are text, one command per line ('#' starts a comment). Settings hold
+// for the cameras after them:
+//   size 512 384            output resolution (default 1024 768)
+//   ao on                   ambient occlusion (default on)
+//   view composite          diffuse, normals, position, depth, composite or ao
+//   fov 45                  vertical field of view in degrees
+//   gamma srgb              srgb (like the sample's back buffer) or linear
+//   output thumbs/v%04d.ppm file of each view; %d is its number (.pam keeps alpha,
+//                           .qoi too and is compressed)
+//   export diffuse depth    also write these of diffuse, normal, depth, ao (blurred) or
+//                           none, next to the output: v0001_diffuse.qoi, v0001_depth.exr
+//   exr half                channels of the exported .exr: half or float
+//   camera ex ey ez ax ay az              eye and look-at point
+//   orbit count radius height ax ay az    count cameras around the look-at point
+//--------------------------------------------------------------------------------------
+#pragma once
+
+#include "CpuRaster.h"
+#include "JobSystem.h"
+#include "OutputSink.h"
+#include "VertexCache.h"
+
+#include <string>
+#include <vector>
+
+struct BatchView
+{
+	Vec3		eye, at;
+	float		fovY;				// radians
+	int			width, height;
+	bool		ao;
+	int			viewMode;			// CpuViewMode (_textureToRender)
+	bool		srgb;				// encode the output as sRGB
+	std::string	output;				// "" keeps the image in memory only
+	unsigned int	exports;		// BatchExport flags
+	bool		exrHalf;			// exported .exr channels are half, else float
+};
+
+enum BatchExport
+{
+	EXPORT_DIFFUSE	= 1,			// diffuse slice, 8-bit .qoi
+	EXPORT_NORMAL	= 2,			// view-space normal, .exr RGB
+	EXPORT_DEPTH	= 4,			// linear view-space Z (0 = background), .exr Z
+	EXPORT_AO		= 8,			// blurred AO, .exr Y
+	NUM_EXPORTS		= 4,
+};
+
+// Path of an exported slice of the view: the output with _name before the extension
+std::string ExportPath( const BatchView& view, int exportIndex );
+
+bool ParseBatch( const std::string& text, std::vector<BatchView>& views, std::string* error = NULL );
+bool ReadBatchFile( const std::string& path, std::vector<BatchView>& views, std::string* error = NULL );
+
+// The first mesh of an .sdkmesh (triangle lists) and its diffuse textures: the cooked
+// .ctex next to a texture if there is one, else the image itself, else mid gray.
+// missingTextures counts the ones that couldn't be read.
+bool LoadCpuMesh( const std::string& path, CpuMesh& mesh, std::string* error = NULL, int* missingTextures = NULL );
+
+// Everything one view needs, reused by the next view on the same worker
+struct BatchContext
+{
+	VertexCache				vertices;		// the displaced mesh, and views seen again
+	Versioned<Mat4>			view, projection;
+	CpuGBuffer				gbuffer;
+	std::vector<float>		ao, blur;
+	std::vector<CpuFloat4>	color;
+	CpuRasterStats			rasterStats;
+	double					gbufferMs, aoMs, compositeMs, writeMs;
+
+	BatchContext();
+};
+
+// The camera and world of the sample: the mesh turned 180 degrees about Z, clip planes
+// at 0.1 and 5000
+CpuCamera MakeBatchCamera( const BatchView& view );
+
+// Renders one view into image
+void RenderBatchView( const CpuMesh& mesh, const BatchView& view, BatchContext& context, Image& image );
+
+struct BatchStats
+{
+	unsigned int		views;
+	unsigned int		failedWrites;
+	double				wallMs;
+	double				gbufferMs, aoMs, compositeMs;		// summed over the workers
+	double				writeMs;			// handing frames to the sink, waits for one included
+	unsigned long long	bytesWritten;
+	CpuRasterStats		raster;
+	VertexCache::Stats	vertices;
+	OutputSink::Stats	output;
+
+	double ViewsPerSecond() const { return wallMs > 0.0 ? views * 1000.0 / wallMs : 0.0; }
+};
+
+// Renders every view on jobs and writes the ones with an output, and their exports,
+// through sink (NULL: a sink of 4 frames per worker for the batch). Returns once
+// everything is written. images (if not NULL) gets every image, in the order of views.
+bool RenderBatch( JobSystem& jobs, const CpuMesh& mesh, const std::vector<BatchView>& views, BatchStats& stats,
+				  OutputSink* sink = NULL, std::vector<Image>* images = NULL );
@@ -0,0 +1,232 @@
+//--------------------------------------------------------------------------------------
+// File: BlueNoise.cpp
+//
+// Void-and-cluster blue noise (Ulichney 1993)
+//--------------------------------------------------------------------------------------
+#include "BlueNoise.h"
+#include "EffectCache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+using namespace std;
+
+#define BLUENOISE_MAGIC 0x45534e42		// "BNSE"
+#define BLUENOISE_VERSION 1
+
+//--------------------------------------------------------------------------------------
+// One rank map
+//--------------------------------------------------------------------------------------
+class VoidAndCluster
+{
+public:
+	VoidAndCluster( int size, float sigma ) : _size( size )
+	{
+		// the gaussian is negligible past 4 sigma, so energy updates only touch a window
+		_radius = min( ( int )ceilf( sigma * 4.0f ), ( size - 1 ) / 2 );
+		int width = _radius * 2 + 1;
+		_kernel.resize( width * width );
+		for( int dy = -_radius; dy <= _radius; ++dy )
+			for( int dx = -_radius; dx <= _radius; ++dx )
+				_kernel[( dy + _radius ) * width + dx + _radius] = expf( -( dx * dx + dy * dy ) / ( 2.0f * sigma * sigma ) );
+		_pattern.assign( size * size, 0 );
+		_energy.assign( size * size, 0.0f );
+	}
+
+	void Set( int i, bool on )
+	{
+		_pattern[i] = on;
+		float sign = on ? 1.0f : -1.0f;
+		int x = i % _size, y = i / _size, width = _radius * 2 + 1;
+		for( int dy = -_radius; dy <= _radius; ++dy )
+		{
+			int row = ( ( y + dy + _size ) % _size ) * _size;
+			const float* k = &_kernel[( dy + _radius ) * width + _radius];
+			for( int dx = -_radius; dx <= _radius; ++dx )
+				_energy[row + ( x + dx + _size ) % _size] += sign * k[dx];
+		}
+	}
+
+	// the most crowded set pixel / the emptiest unset one
+	int TightestCluster() const
+	{
+		int best = -1;
+		for( int i = 0; i < ( int )_pattern.size(); ++i )
+			if( _pattern[i] && ( best < 0 || _energy[i] > _energy[best] ) )
+				best = i;
+		return best;
+	}
+
+	int LargestVoid() const
+	{
+		int best = -1;
+		for( int i = 0; i < ( int )_pattern.size(); ++i )
+			if( !_pattern[i] && ( best < 0 || _energy[i] < _energy[best] ) )
+				best = i;
+		return best;
+	}
+
+	void Generate( unsigned int seed, unsigned short* ranks )
+	{
+		const int n = _size * _size;
+		const int initial = max( 1, n / 10 );
+
+		// random initial pattern
+		unsigned int state = seed * 2654435761u + 1;
+		for( int placed = 0; placed < initial; )
+		{
+			state = state * 1664525u + 1013904223u;
+			int i = ( int )( ( state >> 8 ) % ( unsigned int )n );
+			if( !_pattern[i] )
+			{
+				Set( i, true );
+				++placed;
+			}
+		}
+
+		// move points from clusters into voids until that changes nothing
+		for( int iteration = 0; iteration < n; ++iteration )
+		{
+			int cluster = TightestCluster();
+			Set( cluster, false );
+			int hole = LargestVoid();
+			Set( hole, true );
+			if( hole == cluster )
+				break;
+		}
+		vector<char> pattern = _pattern;
+		vector<float> energy = _energy;
+
+		// phase 1: rank the initial points, tightest cluster first out (highest rank)
+		for( int rank = initial - 1; rank >= 0; --rank )
+		{
+			int cluster = TightestCluster();
+			Set( cluster, false );
+			ranks[cluster] = ( unsigned short )rank;
+		}
+
+		// phases 2 and 3: fill the largest void, one point at a time. (With a
+		// wrapping kernel the tightest cluster of the unset pixels is the largest
+		// void of the set ones, so the second half needs no separate pass.)
+		_pattern = pattern;
+		_energy = energy;
+		for( int rank = initial; rank < n; ++rank )
+		{
+			int hole = LargestVoid();
+			Set( hole, true );
+			ranks[hole] = ( unsigned short )rank;
+		}
+	}
+
+private:
+	int				_size, _radius;
+	vector<float>	_kernel;
+	vector<char>	_pattern;
+	vector<float>	_energy;
+};
+
+void GenerateBlueNoise( const BlueNoiseParams& params, int numThreads, vector<unsigned short>& ranks )
+{
+	const int n = params.size * params.size;
+	ranks.assign( ( size_t )n * params.layers, 0 );
+
+	// the layers are independent; each one is a single dependent chain of steps
+	vector<thread> threads;
+	numThreads = max( 1, min( numThreads, params.layers ) );
+	for( int t = 0; t < numThreads; ++t )
+		threads.push_back( thread( [&, t]() {
+			for( int layer = t; layer < params.layers; layer += numThreads )
+			{
+				VoidAndCluster generator( params.size, params.sigma );
+				generator.Generate( params.seed + layer * 7919u, &ranks[( size_t )layer * n] );
+			}
+		} ) );
+	for( size_t t = 0; t < threads.size(); ++t )
+		threads[t].join();
+}
+
+//--------------------------------------------------------------------------------------
+// Disk cache
+//--------------------------------------------------------------------------------------
+struct BlueNoiseHeader
+{
+	unsigned int	magic;
+	unsigned int	version;
+	int				size;
+	float			sigma;
+	unsigned int	seed;
+	int				layers;
+};
+
+static string CachePath( const string& directory, const BlueNoiseParams& params )
+{
+	BlueNoiseHeader header = { BLUENOISE_MAGIC, BLUENOISE_VERSION, params.size, params.sigma, params.seed, params.layers };
+	char name[64];
+	sprintf( name, "bluenoise_%016llx.bin", HashBytes( &header, sizeof( header ) ) );
+	return directory + "/" + name;
+}
+
+bool LoadOrGenerateBlueNoise( const string& directory, const BlueNoiseParams& params, int numThreads,
+							  vector<unsigned short>& ranks, bool* fromCache )
+{
+	if( params.size < 4 || params.size > 256 || params.layers < 1 )
+		return false;
+	const BlueNoiseHeader expected = { BLUENOISE_MAGIC, BLUENOISE_VERSION, params.size, params.sigma, params.seed, params.layers };
+	const size_t count = ( size_t )params.size * params.size * params.layers;
+	string path = CachePath( directory, params );
+
+	FILE* file = fopen( path.c_str(), "rb" );
+	if( file )
+	{
+		BlueNoiseHeader header;
+		ranks.resize( count );
+		bool ok = fread( &header, sizeof( header ), 1, file ) == 1 && !memcmp( &header, &expected, sizeof( header ) ) &&
+				  fread( &ranks[0], sizeof( unsigned short ), count, file ) == count;
+		fclose( file );
+		if( ok )
+		{
+			if( fromCache )
+				*fromCache = true;
+			return true;
+		}
+	}
+
+	GenerateBlueNoise( params, numThreads, ranks );
+	if( fromCache )
+		*fromCache = false;
+
+	// written aside and renamed, like the effect cache
+	MakeDirectory( directory );
+	string temp = UniqueTempPath( path );
+	file = fopen( temp.c_str(), "wb" );
+	if( file )
+	{
+		bool ok = fwrite( &expected, sizeof( expected ), 1, file ) == 1 &&
+				  fwrite( &ranks[0], sizeof( unsigned short ), count, file ) == count;
+		ok = fclose( file ) == 0 && ok;
+		if( !ok || !RenameOver( temp, path ) )
+			remove( temp.c_str() );
+	}
+	return true;		// a failed store only costs the next start
+}
+
+//--------------------------------------------------------------------------------------
+// Texture
+//--------------------------------------------------------------------------------------
+void MakeRotationTexture( const BlueNoiseParams& params, const vector<unsigned short>& ranks, vector<unsigned char>& rgba )
+{
+	const int n = params.size * params.size;
+	rgba.resize( ( size_t )n * 4 );
+	for( int i = 0; i < n; ++i )
+	{
+		float angle = ( ranks[i] + 0.5f ) / n * 6.2831853f;
+		int offsetLayer = min( 1, params.layers - 1 ), alphaLayer = min( 2, params.layers - 1 );
+		rgba[i * 4 + 0] = ( unsigned char )( ( cosf( angle ) * 0.5f + 0.5f ) * 255.0f + 0.5f );
+		rgba[i * 4 + 1] = ( unsigned char )( ( sinf( angle ) * 0.5f + 0.5f ) * 255.0f + 0.5f );
+		rgba[i * 4 + 2] = ( unsigned char )( ranks[( size_t )offsetLayer * n + i] * 256 / n );
+		rgba[i * 4 + 3] = ( unsigned char )( ranks[( size_t )alphaLayer * n + i] * 256 / n );
+	}
+}
@@ -0,0 +1,35 @@
+//--------------------------------------------------------------------------------------
+// File: BlueNoise.h
+//
+// Blue-noise rank maps (void-and-cluster) for the AO rotation texture. Every layer
+// is an independent size x size map of the ranks 0 .. size*size-1; thresholding it
+// at any level gives evenly spread points, so neighbouring pixels get rotations far
+// apart and a small blur removes most of the noise.
+// Maps are cached on disk by their parameters.
+//--------------------------------------------------------------------------------------
+#pragma once
+
+#include <string>
+#include <vector>
+
+struct BlueNoiseParams
+{
+	int				size;		// width and height, tiles seamlessly
+	float			sigma;		// of the gaussian energy filter
+	unsigned int	seed;		// initial random pattern
+	int				layers;		// independent maps: rotation, offset, ...
+
+	BlueNoiseParams() : size( 64 ), sigma( 1.5f ), seed( 1 ), layers( 2 ) {}
+};
+
+// layers * size * size ranks, layer after layer; the layers are generated in parallel
+void GenerateBlueNoise( const BlueNoiseParams& params, int numThreads, std::vector<unsigned short>& ranks );
+
+// From directory if it was generated before, otherwise generated and stored there
+bool LoadOrGenerateBlueNoise( const std::string& directory, const BlueNoiseParams& params, int numThreads,
+							  std::vector<unsigned short>& ranks, bool* fromCache = NULL );
+
+// The rotation texture (R8G8B8A8): rg = rotation vector from layer 0 (* 0.5 + 0.5),
+// b = offset from layer 1, a = layer 2 (or 1)
+void MakeRotationTexture( const BlueNoiseParams& params, const std::vector<unsigned short>& ranks,
+						  std::vector<unsigned char>& rgba );
@@ -0,0 +1,679 @@
+//--------------------------------------------------------------------------------------
+// File: CpuPasses.cpp
+//
+// Portable CPU ports of the passes in DeferredShading.fx
+//--------------------------------------------------------------------------------------
+#include "CpuPasses.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+using namespace std;
+
+//--------------------------------------------------------------------------------------
+// Small vector helpers
+//--------------------------------------------------------------------------------------
+static inline CpuFloat3 Sub( const CpuFloat3& a, const CpuFloat3& b )
+{
+	CpuFloat3 r = { a.x - b.x, a.y - b.y, a.z - b.z };
+	return r;
+}
+
+static inline float Dot( const CpuFloat3& a, const CpuFloat3& b )
+{
+	return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static inline CpuFloat2 Reflect( const CpuFloat2& i, const CpuFloat2& n )
+{
+	float d = 2.0f * ( i.x * n.x + i.y * n.y );
+	CpuFloat2 r = { i.x - d * n.x, i.y - d * n.y };
+	return r;
+}
+
+static double MillisecondsSince( const chrono::high_resolution_clock::time_point& start )
+{
+	return chrono::duration<double, milli>( chrono::high_resolution_clock::now() - start ).count();
+}
+
+//--------------------------------------------------------------------------------------
+// G-buffer
+//--------------------------------------------------------------------------------------
+void CpuGBuffer::Resize( int w, int h )
+{
+	width = w;
+	height = h;
+	CpuFloat4 clear = { 0.0f, 0.125f, 0.3f, 1.0f };
+	diffuse.assign( w * h, clear );
+	viewZ.assign( w * h, 0.0f );
+	CpuFloat3 zero = { 0.0f, 0.0f, 0.0f };
+	normal.assign( w * h, zero );
+}
+
+CpuFloat3 CpuGBuffer::ViewPosition( float x, float y, float z ) const
+{
+	// pixel centre -> normalized device coordinates -> view space
+	float ndcX = ( x + 0.5f ) / width * 2.0f - 1.0f;
+	float ndcY = 1.0f - ( y + 0.5f ) / height * 2.0f;
+	CpuFloat3 p = { ndcX * z / projScaleX, ndcY * z / projScaleY, z };
+	return p;
+}
+
+//--------------------------------------------------------------------------------------
+// Ambient occlusion
+//--------------------------------------------------------------------------------------
+
+// occlusion of p (with normal n) by the view-space point q (aoTerm in the shader)
+static inline float AOTerm( const CpuFloat3& p, const CpuFloat3& n, const CpuFloat3& q, const CpuAOParams& params )
+{
+	CpuFloat3 diff = Sub( q, p );
+	float len = sqrtf( Dot( diff, diff ) );
+	if( len < 1e-6f )
+		return 0.0f;
+	float d = len / params.radius * params.scale;
+	return max( 0.0f, Dot( n, diff ) / len - params.bias ) * ( 1.0f / ( 1.0f + d ) ) * params.intensity;
+}
+
+// the PSAO tap pattern: 4 directions reflected about the rotation vector,
+// alternating with the same directions rotated by 45 degrees
+static void TapOffsets( const CpuFloat2& rand, float rad, int iterations, vector<CpuFloat2>& taps )
+{
+	static const CpuFloat2 vec[4] = { { 1, 0 }, { -1, 0 }, { 0, 1 }, { 0, -1 } };
+	static const float scales[4] = { 0.25f, 0.5f, 0.75f, 1.0f };
+
+	taps.clear();
+	for( int j = 0; j < iterations; ++j )
+	{
+		CpuFloat2 coord1 = Reflect( vec[j & 3], rand );
+		coord1.x *= rad;
+		coord1.y *= rad;
+		CpuFloat2 coord2 = { coord1.x * 0.707f - coord1.y * 0.707f, coord1.x * 0.707f + coord1.y * 0.707f };
+		for( int k = 0; k < 4; ++k )
+		{
+			const CpuFloat2& c = ( k & 1 ) ? coord2 : coord1;
+			CpuFloat2 t = { c.x * scales[k], c.y * scales[k] };
+			taps.push_back( t );
+		}
+	}
+}
+
+void MakeRotationTable( CpuFloat2 rotations[CPU_NUMLAYERS], unsigned int seed )
+{
+	// small LCG so the table is the same on every platform
+	unsigned int state = seed;
+	for( int i = 0; i < CPU_NUMLAYERS; ++i )
+	{
+		state = state * 1664525u + 1013904223u;
+		float angle = ( state >> 8 ) * ( 1.0f / 16777216.0f ) * 6.2831853f;
+		rotations[i].x = cosf( angle );
+		rotations[i].y = sinf( angle );
+	}
+}
+
+float ComputeAOPixel( const CpuGBuffer& gbuffer, const CpuAOParams& params, const CpuFloat2& rotation, int x, int y,
+					  const CpuFloat3& p, const CpuFloat3& n, vector<CpuFloat2>& taps )
+{
+	const int w = gbuffer.width;
+	const int h = gbuffer.height;
+
+	// radius in pixels, rotation picked per pixel (neighbours sample far apart)
+	float rad = 0.5f * params.radius * gbuffer.projScaleX / p.z * w;
+	TapOffsets( rotation, rad, params.iterations, taps );
+
+	float occlusion = 0.0f;
+	for( size_t t = 0; t < taps.size(); ++t )
+	{
+		int tx = min( max( x + ( int )floorf( taps[t].x + 0.5f ), 0 ), w - 1 );
+		int ty = min( max( y + ( int )floorf( taps[t].y + 0.5f ), 0 ), h - 1 );
+		float tz = gbuffer.viewZ[ty * w + tx];
+		if( tz != 0.0f )
+			occlusion += AOTerm( p, n, gbuffer.ViewPosition( ( float )tx, ( float )ty, tz ), params );
+	}
+	return 1.0f - occlusion / taps.size();
+}
+
+void ComputeAO( const CpuGBuffer& gbuffer, const CpuAOParams& params,
+				const CpuFloat2 rotations[CPU_NUMLAYERS], vector<float>& ao )
+{
+	ComputeAORotationMap( gbuffer, params, rotations, CPU_INTERLEAVE, ao );
+}
+
+void ComputeAORotationMap( const CpuGBuffer& gbuffer, const CpuAOParams& params,
+						   const CpuFloat2* rotations, int mapSize, vector<float>& ao )
+{
+	const int w = gbuffer.width;
+	const int h = gbuffer.height;
+	ao.assign( w * h, 1.0f );
+
+	vector<CpuFloat2> taps;
+	for( int y = 0; y < h; ++y )
+	{
+		for( int x = 0; x < w; ++x )
+		{
+			float z = gbuffer.viewZ[y * w + x];
+			if( z == 0.0f )
+				continue;
+
+			CpuFloat3 p = gbuffer.ViewPosition( ( float )x, ( float )y, z );
+			const CpuFloat3& n = gbuffer.normal[y * w + x];
+			ao[y * w + x] = ComputeAOPixel( gbuffer, params, rotations[( y % mapSize ) * mapSize + x % mapSize], x, y, p, n, taps );
+		}
+	}
+}
+
+void ComputeAOGroundTruth( const CpuGBuffer& gbuffer, const CpuAOParams& params, int directions, int radii,
+						   int y0, int y1, vector<float>& ao )
+{
+	const int w = gbuffer.width;
+	const int h = gbuffer.height;
+
+	// unit disc offsets: every ring turned by the golden ratio so no two line up
+	vector<CpuFloat2> disc( directions * radii );
+	for( int k = 0; k < radii; ++k )
+	{
+		float turn = k * 0.618034f;
+		turn -= floorf( turn );
+		for( int d = 0; d < directions; ++d )
+		{
+			float angle = ( d + turn ) * 6.2831853f / directions;
+			float r = ( k + 0.5f ) / radii;
+			disc[k * directions + d].x = cosf( angle ) * r;
+			disc[k * directions + d].y = sinf( angle ) * r;
+		}
+	}
+
+	for( int y = y0; y < y1; ++y )
+	{
+		for( int x = 0; x < w; ++x )
+		{
+			float z = gbuffer.viewZ[y * w + x];
+			if( z == 0.0f )
+			{
+				ao[y * w + x] = 1.0f;
+				continue;
+			}
+
+			CpuFloat3 p = gbuffer.ViewPosition( ( float )x, ( float )y, z );
+			const CpuFloat3& n = gbuffer.normal[y * w + x];
+			float rad = 0.5f * params.radius * gbuffer.projScaleX / z * w;
+			float occlusion = 0.0f;
+			for( size_t t = 0; t < disc.size(); ++t )
+			{
+				int tx = min( max( x + ( int )floorf( disc[t].x * rad + 0.5f ), 0 ), w - 1 );
+				int ty = min( max( y + ( int )floorf( disc[t].y * rad + 0.5f ), 0 ), h - 1 );
+				float tz = gbuffer.viewZ[ty * w + tx];
+				if( tz != 0.0f )
+					occlusion += AOTerm( p, n, gbuffer.ViewPosition( ( float )tx, ( float )ty, tz ), params );
+			}
+			ao[y * w + x] = 1.0f - occlusion / disc.size();
+		}
+	}
+}
+
+void ComputeAOHorizon( const CpuGBuffer& gbuffer, const CpuAOParams& params,
+					   const CpuFloat2 rotations[CPU_NUMLAYERS], int directions, int steps,
+					   vector<float>& ao )
+{
+	const float angleBias = 0.1f;		// same constants as PSAOHorizon
+	const float intensity = 1.5f;
+	const int w = gbuffer.width;
+	const int h = gbuffer.height;
+	const float radius2 = params.radius * params.radius;
+	ao.assign( w * h, 1.0f );
+
+	for( int y = 0; y < h; ++y )
+	{
+		for( int x = 0; x < w; ++x )
+		{
+			float z = gbuffer.viewZ[y * w + x];
+			if( z == 0.0f )
+				continue;
+
+			CpuFloat3 p = gbuffer.ViewPosition( ( float )x, ( float )y, z );
+			const CpuFloat3& n = gbuffer.normal[y * w + x];
+
+			float radPixels = 0.5f * params.radius * gbuffer.projScaleX / z * w;
+			float stepPixels = radPixels / ( steps + 1 );
+			if( stepPixels < 1.0f )
+				continue;
+
+			const CpuFloat2& rand = rotations[( y % CPU_INTERLEAVE ) * CPU_INTERLEAVE + x % CPU_INTERLEAVE];
+			float baseAngle = atan2f( rand.y, rand.x );
+			float jitter = rand.x * 0.5f + rand.y * 0.25f + 0.5f;
+			jitter -= floorf( jitter );
+			float angleStep = 6.2831853f / directions;
+
+			float occlusion = 0.0f;
+			for( int d = 0; d < directions; ++d )
+			{
+				float dx = cosf( baseAngle + d * angleStep ) * stepPixels;
+				float dy = sinf( baseAngle + d * angleStep ) * stepPixels;
+
+				float topSin = angleBias;
+				for( int k = 0; k < steps; ++k )
+				{
+					float t = k + jitter + 1.0f;
+					int tx = ( int )floorf( x + dx * t + 0.5f );
+					int ty = ( int )floorf( y + dy * t + 0.5f );
+					if( tx < 0 || ty < 0 || tx >= w || ty >= h )
+						break;
+					float tz = gbuffer.viewZ[ty * w + tx];
+					if( tz == 0.0f )
+						continue;
+
+					CpuFloat3 H = Sub( gbuffer.ViewPosition( ( float )tx, ( float )ty, tz ), p );
+					float l2 = Dot( H, H );
+					if( l2 > 1e-4f )
+					{
+						float sinH = Dot( n, H ) / sqrtf( l2 );
+						if( sinH > topSin )
+						{
+							occlusion += ( sinH - topSin ) * min( max( 1.0f - l2 / radius2, 0.0f ), 1.0f );
+							topSin = sinH;
+						}
+					}
+				}
+			}
+			ao[y * w + x] = 1.0f - min( max( occlusion / directions * intensity, 0.0f ), 1.0f );
+		}
+	}
+}
+
+void DeinterleaveGBuffer( const CpuGBuffer& gbuffer, CpuAOLayers& layers )
+{
+	const int w = gbuffer.width;
+	const int h = gbuffer.height;
+	layers.width = ( w + CPU_INTERLEAVE - 1 ) / CPU_INTERLEAVE;
+	layers.height = ( h + CPU_INTERLEAVE - 1 ) / CPU_INTERLEAVE;
+
+	CpuFloat3 zero = { 0.0f, 0.0f, 0.0f };
+	for( int layer = 0; layer < CPU_NUMLAYERS; ++layer )
+	{
+		layers.viewZ[layer].assign( layers.width * layers.height, 0.0f );
+		layers.normal[layer].assign( layers.width * layers.height, zero );
+	}
+
+	// walk the source in order, scatter into the layers
+	for( int y = 0; y < h; ++y )
+	{
+		int row = y % CPU_INTERLEAVE;
+		int ly = y / CPU_INTERLEAVE;
+		for( int x = 0; x < w; ++x )
+		{
+			int layer = row * CPU_INTERLEAVE + x % CPU_INTERLEAVE;
+			int dst = ly * layers.width + x / CPU_INTERLEAVE;
+			layers.viewZ[layer][dst] = gbuffer.viewZ[y * w + x];
+			layers.normal[layer][dst] = gbuffer.normal[y * w + x];
+		}
+	}
+}
+
+void ComputeAOLayer( const CpuGBuffer& gbuffer, const CpuAOParams& params,
+					 const CpuFloat2 rotations[CPU_NUMLAYERS], CpuAOLayers& layers, int layer )
+{
+	const int lw = layers.width;
+	const int lh = layers.height;
+	const int ox = layer % CPU_INTERLEAVE;
+	const int oy = layer / CPU_INTERLEAVE;
+	const vector<float>& viewZ = layers.viewZ[layer];
+	const vector<CpuFloat3>& normal = layers.normal[layer];
+	vector<float>& ao = layers.ao[layer];
+	ao.assign( lw * lh, 1.0f );
+
+	static thread_local vector<CpuFloat2> taps;		// kept: no allocation per layer and frame
+	for( int y = 0; y < lh; ++y )
+	{
+		for( int x = 0; x < lw; ++x )
+		{
+			float z = viewZ[y * lw + x];
+			if( z == 0.0f )
+				continue;
+
+			CpuFloat3 p = gbuffer.ViewPosition( ( float )( x * CPU_INTERLEAVE + ox ), ( float )( y * CPU_INTERLEAVE + oy ), z );
+			const CpuFloat3& n = normal[y * lw + x];
+
+			// radius in layer texels, one rotation for the whole layer
+			float rad = 0.5f * params.radius * gbuffer.projScaleX / z * lw;
+			TapOffsets( rotations[layer], rad, params.iterations, taps );
+
+			float occlusion = 0.0f;
+			for( size_t t = 0; t < taps.size(); ++t )
+			{
+				int tx = min( max( x + ( int )floorf( taps[t].x + 0.5f ), 0 ), lw - 1 );
+				int ty = min( max( y + ( int )floorf( taps[t].y + 0.5f ), 0 ), lh - 1 );
+				float tz = viewZ[ty * lw + tx];
+				if( tz != 0.0f )
+				{
+					CpuFloat3 q = gbuffer.ViewPosition( ( float )( tx * CPU_INTERLEAVE + ox ),
+														( float )( ty * CPU_INTERLEAVE + oy ), tz );
+					occlusion += AOTerm( p, n, q, params );
+				}
+			}
+			ao[y * lw + x] = 1.0f - occlusion / taps.size();
+		}
+	}
+}
+
+void ReinterleaveAO( const CpuGBuffer& gbuffer, const CpuAOLayers& layers, vector<float>& ao )
+{
+	const int w = gbuffer.width;
+	const int h = gbuffer.height;
+	ao.resize( w * h );
+
+	for( int y = 0; y < h; ++y )
+	{
+		int row = y % CPU_INTERLEAVE;
+		int ly = y / CPU_INTERLEAVE;
+		for( int x = 0; x < w; ++x )
+		{
+			int layer = row * CPU_INTERLEAVE + x % CPU_INTERLEAVE;
+			ao[y * w + x] = layers.ao[layer][ly * layers.width + x / CPU_INTERLEAVE];
+		}
+	}
+}
+
+void ComputeAODeinterleaved( const CpuGBuffer& gbuffer, const CpuAOParams& params,
+							 const CpuFloat2 rotations[CPU_NUMLAYERS], CpuAOLayers& layers,
+							 vector<float>& ao, int numThreads, CpuAOTimings* timings )
+{
+	chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+	DeinterleaveGBuffer( gbuffer, layers );
+	if( timings )
+		timings->deinterleave = MillisecondsSince( start );
+
+	// every layer is an independent job
+	start = chrono::high_resolution_clock::now();
+	numThreads = min( max( numThreads, 1 ), CPU_NUMLAYERS );
+	atomic<int> nextLayer( 0 );
+	vector<thread> workers;
+	for( int i = 0; i < numThreads; ++i )
+	{
+		workers.push_back( thread( [&]()
+		{
+			for( int layer = nextLayer++; layer < CPU_NUMLAYERS; layer = nextLayer++ )
+				ComputeAOLayer( gbuffer, params, rotations, layers, layer );
+		} ) );
+	}
+	for( size_t i = 0; i < workers.size(); ++i )
+		workers[i].join();
+	if( timings )
+		timings->layers = MillisecondsSince( start );
+
+	start = chrono::high_resolution_clock::now();
+	ReinterleaveAO( gbuffer, layers, ao );
+	if( timings )
+		timings->reinterleave = MillisecondsSince( start );
+}
+
+//--------------------------------------------------------------------------------------
+// Blur
+//--------------------------------------------------------------------------------------
+void BlurAO( int width, int height, int step, vector<float>& ao, vector<float>& scratch )
+{
+	static const float weights[9] = { 0.05f, 0.09f, 0.12f, 0.15f, 0.18f, 0.15f, 0.12f, 0.09f, 0.05f };
+	scratch.resize( ao.size() );
+	for( int y = 0; y < height; ++y )
+	{
+		const float* row = &ao[y * width];
+		for( int x = 0; x < width; ++x )
+		{
+			float sum = 0.0f;
+			for( int k = 0; k < 9; ++k )
+				sum += row[( ( x + ( k - 4 ) * step ) % width + width ) % width] * weights[k];
+			scratch[y * width + x] = sum;
+		}
+	}
+	for( int y = 0; y < height; ++y )
+		for( int k = 0; k < 9; ++k )
+		{
+			const float* row = &scratch[( ( y + ( k - 4 ) * step ) % height + height ) % height * width];
+			float* out = &ao[y * width];
+			if( k == 0 )
+				for( int x = 0; x < width; ++x )
+					out[x] = row[x] * weights[k];
+			else
+				for( int x = 0; x < width; ++x )
+					out[x] += row[x] * weights[k];
+		}
+}
+
+//--------------------------------------------------------------------------------------
+// Synthetic G-buffer
+//--------------------------------------------------------------------------------------
+void MakeTestGBuffer( CpuGBuffer& gbuffer, int width, int height )
+{
+	gbuffer.Resize( width, height );
+	gbuffer.projScaleY = 1.0f / tanf( 3.14159265f / 8.0f );
+	gbuffer.projScaleX = gbuffer.projScaleY * height / width;
+	gbuffer.nearZ = 0.1f;
+	gbuffer.farZ = 5000.0f;
+
+	// view space: camera at the origin looking down +Z, ground plane at y = -150
+	static const float spheres[][4] =
+	{
+		{    0.0f,  -50.0f, 800.0f, 100.0f },
+		{  220.0f, -100.0f, 760.0f,  50.0f },
+		{ -200.0f,  -90.0f, 880.0f,  60.0f },
+		{   90.0f, -125.0f, 640.0f,  25.0f },
+	};
+	static const CpuFloat4 sphereColors[] =
+	{
+		{ 0.8f, 0.6f, 0.4f, 1.0f },
+		{ 0.3f, 0.6f, 0.9f, 1.0f },
+		{ 0.9f, 0.3f, 0.3f, 1.0f },
+		{ 0.4f, 0.8f, 0.4f, 1.0f },
+	};
+	const CpuFloat4 groundColor = { 0.6f, 0.6f, 0.55f, 1.0f };
+	const int numSpheres = sizeof( spheres ) / sizeof( spheres[0] );
+	const float groundY = -150.0f;
+
+	for( int y = 0; y < height; ++y )
+	{
+		for( int x = 0; x < width; ++x )
+		{
+			// ray through the pixel at unit depth
+			CpuFloat3 ray = gbuffer.ViewPosition( ( float )x, ( float )y, 1.0f );
+			float bestT = 1e30f;
+			CpuFloat3 bestN = { 0.0f, 0.0f, 0.0f };
+			CpuFloat4 bestColor = groundColor;
+
+			if( ray.y < 0.0f )
+			{
+				float t = groundY / ray.y;
+				if( t < 2000.0f )
+				{
+					bestT = t;
+					bestN.y = 1.0f;
+				}
+			}
+
+			for( int s = 0; s < numSpheres; ++s )
+			{
+				CpuFloat3 c = { spheres[s][0], spheres[s][1], spheres[s][2] };
+				float r = spheres[s][3];
+				float b = Dot( ray, c );
+				float a = Dot( ray, ray );
+				float disc = b * b - a * ( Dot( c, c ) - r * r );
+				if( disc < 0.0f )
+					continue;
+				float t = ( b - sqrtf( disc ) ) / a;
+				if( t > 0.0f && t < bestT )
+				{
+					bestT = t;
+					CpuFloat3 hit = { ray.x * t, ray.y * t, ray.z * t };
+					CpuFloat3 n = Sub( hit, c );
+					bestN.x = n.x / r;
+					bestN.y = n.y / r;
+					bestN.z = n.z / r;
+					bestColor = sphereColors[s];
+				}
+			}
+
+			if( bestT < 1e30f )
+			{
+				gbuffer.viewZ[y * width + x] = bestT;	// ray.z == 1, so t is the view-space Z
+				gbuffer.normal[y * width + x] = bestN;
+				gbuffer.diffuse[y * width + x] = bestColor;
+			}
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Composite
+//--------------------------------------------------------------------------------------
+
+#if defined( _MSC_VER )
+#define CPU_FORCEINLINE __forceinline
+#else
+#define CPU_FORCEINLINE inline __attribute__( ( always_inline ) )
+#endif
+
+static inline CpuFloat3 Normalize( const CpuFloat3& v )
+{
+	float len = sqrtf( Dot( v, v ) );
+	if( len == 0.0f )
+		return v;
+	CpuFloat3 r = { v.x / len, v.y / len, v.z / len };
+	return r;
+}
+
+// One pixel of shadeQuad. Called with constant viewMode / useAO by the
+// specialized versions (every branch folds away) and with variables by
+// CompositeBranching.
+static CPU_FORCEINLINE CpuFloat4 ShadePixel( const CpuGBuffer& gbuffer, const vector<float>& ao,
+											 const CpuFloat3& lightPos, int x, int y,
+											 int viewMode, bool useAO )
+{
+	const int i = y * gbuffer.width + x;
+	const CpuFloat4& diffuse = gbuffer.diffuse[i];
+	if( viewMode == VIEW_DIFFUSE )
+		return diffuse;
+
+	const CpuFloat3& n = gbuffer.normal[i];
+	if( viewMode == VIEW_NORMALS )
+	{
+		CpuFloat4 r = { n.x, n.y, n.z, 1.0f };
+		return r;
+	}
+
+	const float z = gbuffer.viewZ[i];
+	if( z == 0.0f )
+	{
+		CpuFloat4 clear = { 0.0f, 0.125f, 0.3f, 1.0f };
+		return clear;
+	}
+	if( viewMode == VIEW_DEPTH )
+	{
+		// the value PSMRT stores: 1 - z/w
+		float d = 1.0f - gbuffer.farZ / ( gbuffer.farZ - gbuffer.nearZ ) * ( 1.0f - gbuffer.nearZ / z );
+		CpuFloat4 r = { d, d, d, d };
+		return r;
+	}
+
+	CpuFloat3 p = gbuffer.ViewPosition( ( float )x, ( float )y, z );
+	if( viewMode == VIEW_POSITION )
+	{
+		CpuFloat4 r = { p.x, p.y, p.z, 1.0f };
+		return r;
+	}
+
+	float occlusion = 1.0f;
+	if( useAO )
+	{
+		occlusion = ao[i];
+		if( viewMode == VIEW_AO )
+		{
+			CpuFloat4 r = { occlusion, occlusion, occlusion, 1.0f };
+			return r;
+		}
+	}
+
+	// diffuse lighting from vLightPos
+	CpuFloat3 L = Normalize( Sub( lightPos, p ) );
+	float nDotL = max( Dot( Normalize( n ), L ), 0.0f ) * occlusion;
+	CpuFloat4 r = { diffuse.x * nDotL, diffuse.y * nDotL, diffuse.z * nDotL, diffuse.w * nDotL };
+	return r;
+}
+
+template <int ViewMode, bool UseAO>
+static void CompositeRows( const CpuGBuffer& gbuffer, const vector<float>& ao,
+						   const CpuFloat3& lightPos, int y0, int y1, vector<CpuFloat4>& out )
+{
+	for( int y = y0; y < y1; ++y )
+		for( int x = 0; x < gbuffer.width; ++x )
+			out[y * gbuffer.width + x] = ShadePixel( gbuffer, ao, lightPos, x, y, ViewMode, UseAO );
+}
+
+#define COMPOSITE_PERMUTATIONS( view ) { CompositeRows<view, false>, CompositeRows<view, true> }
+
+static const CpuCompositeFunc compositeTable[NUM_VIEW_MODES][2] =
+{
+	COMPOSITE_PERMUTATIONS( VIEW_DIFFUSE ),
+	COMPOSITE_PERMUTATIONS( VIEW_NORMALS ),
+	COMPOSITE_PERMUTATIONS( VIEW_POSITION ),
+	COMPOSITE_PERMUTATIONS( VIEW_DEPTH ),
+	COMPOSITE_PERMUTATIONS( VIEW_COMPOSITE ),
+	COMPOSITE_PERMUTATIONS( VIEW_AO ),
+};
+
+CpuCompositeFunc SelectComposite( int viewMode, bool useAO )
+{
+	if( viewMode < 0 || viewMode >= NUM_VIEW_MODES )
+		viewMode = VIEW_COMPOSITE;
+	return compositeTable[viewMode][useAO ? 1 : 0];
+}
+
+template <int ViewMode, bool UseAO>
+static void CompositeBlocks( const CpuGBuffer& gbuffer, const vector<float>& ao, const CpuFloat3& lightPos,
+							 int x0, int y0, int x1, int y1, int rate, vector<CpuFloat4>& out )
+{
+	const int width = gbuffer.width;
+	for( int by = y0; by < y1; by += rate )
+		for( int bx = x0; bx < x1; bx += rate )
+		{
+			int ex = min( bx + rate, x1 ), ey = min( by + rate, y1 );
+			CpuFloat4 color = ShadePixel( gbuffer, ao, lightPos, min( bx + rate / 2, ex - 1 ),
+										  min( by + rate / 2, ey - 1 ), ViewMode, UseAO );
+			for( int y = by; y < ey; ++y )
+				for( int x = bx; x < ex; ++x )
+					out[y * width + x] = color;
+		}
+}
+
+#define COMPOSITE_BLOCK_PERMUTATIONS( view ) { CompositeBlocks<view, false>, CompositeBlocks<view, true> }
+
+static const CpuCompositeBlocksFunc compositeBlocksTable[NUM_VIEW_MODES][2] =
+{
+	COMPOSITE_BLOCK_PERMUTATIONS( VIEW_DIFFUSE ),
+	COMPOSITE_BLOCK_PERMUTATIONS( VIEW_NORMALS ),
+	COMPOSITE_BLOCK_PERMUTATIONS( VIEW_POSITION ),
+	COMPOSITE_BLOCK_PERMUTATIONS( VIEW_DEPTH ),
+	COMPOSITE_BLOCK_PERMUTATIONS( VIEW_COMPOSITE ),
+	COMPOSITE_BLOCK_PERMUTATIONS( VIEW_AO ),
+};
+
+CpuCompositeBlocksFunc SelectCompositeBlocks( int viewMode, bool useAO )
+{
+	if( viewMode < 0 || viewMode >= NUM_VIEW_MODES )
+		viewMode = VIEW_COMPOSITE;
+	return compositeBlocksTable[viewMode][useAO ? 1 : 0];
+}
+
+CpuFloat4 CompositePixel( const CpuGBuffer& gbuffer, const vector<float>& ao, const CpuFloat3& lightPos, int viewMode,
+						  bool useAO, int x, int y )
+{
+	return ShadePixel( gbuffer, ao, lightPos, x, y, viewMode, useAO );
+}
+
+void CompositeBranching( const CpuGBuffer& gbuffer, const vector<float>& ao,
+						 const CpuFloat3& lightPos, int viewMode, bool useAO, int y0, int y1,
+						 vector<CpuFloat4>& out )
+{
+	for( int y = y0; y < y1; ++y )
+		for( int x = 0; x < gbuffer.width; ++x )
+			out[y * gbuffer.width + x] = ShadePixel( gbuffer, ao, lightPos, x, y, viewMode, useAO );
+}
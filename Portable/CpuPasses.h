@@ -0,0 +1,162 @@
+//--------------------------------------------------------------------------------------
+// File: CpuPasses.h
+//
+// Portable CPU ports of the passes in DeferredShading.fx.
+// No D3D dependencies: these are used by the headless tools and for measuring
+// the cost of the shader techniques on the CPU.
+//--------------------------------------------------------------------------------------
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+struct CpuFloat2 { float x, y; };
+struct CpuFloat3 { float x, y, z; };
+struct CpuFloat4 { float x, y, z, w; };
+
+//--------------------------------------------------------------------------------------
+// The G-buffer slices the AO and composite passes read
+//--------------------------------------------------------------------------------------
+struct CpuGBuffer
+{
+	int						width, height;
+	std::vector<CpuFloat4>	diffuse;		// diffuse slice
+	std::vector<float>		viewZ;			// linear view-space Z (0 = background)
+	std::vector<CpuFloat3>	normal;			// view-space normal
+	float					projScaleX;		// Projection._11
+	float					projScaleY;		// Projection._22
+	float					nearZ, farZ;	// clip planes of the projection
+
+	void Resize( int w, int h );
+
+	// view-space position of the pixel (x, y) at linear depth z
+	CpuFloat3 ViewPosition( float x, float y, float z ) const;
+};
+
+// Synthetic G-buffer for the tools: spheres resting on a ground plane,
+// seen from the default camera (45 degree field of view)
+void MakeTestGBuffer( CpuGBuffer& gbuffer, int width, int height );
+
+//--------------------------------------------------------------------------------------
+// Ambient occlusion parameters (same meaning as the locals of PSAOPyramid / aoTerm)
+//--------------------------------------------------------------------------------------
+struct CpuAOParams
+{
+	float	radius;			// sample radius in view-space units
+	float	scale;			// distance falloff
+	float	intensity;
+	float	bias;
+	int		iterations;		// 4 taps per iteration
+
+	CpuAOParams() : radius( 40.0f ), scale( 4.0f ), intensity( 2.0f ), bias( 0.0f ), iterations( 4 ) {}
+};
+
+//--------------------------------------------------------------------------------------
+// The 4x4 quarter-resolution layers of deinterleaved AO
+//--------------------------------------------------------------------------------------
+#define CPU_INTERLEAVE 4
+#define CPU_NUMLAYERS ( CPU_INTERLEAVE * CPU_INTERLEAVE )
+
+struct CpuAOLayers
+{
+	int						width, height;					// size of one layer
+	std::vector<float>		viewZ[CPU_NUMLAYERS];
+	std::vector<CpuFloat3>	normal[CPU_NUMLAYERS];
+	std::vector<float>		ao[CPU_NUMLAYERS];
+};
+
+// Per pass timings of the deinterleaved AO (milliseconds)
+struct CpuAOTimings
+{
+	double	deinterleave;
+	double	layers;
+	double	reinterleave;
+};
+
+// One rotation vector per 4x4 pixel offset (the CPU stand-in for vectors.png)
+void MakeRotationTable( CpuFloat2 rotations[CPU_NUMLAYERS], unsigned int seed );
+
+// PSAO access pattern: full-resolution taps, rotation picked per pixel
+void ComputeAO( const CpuGBuffer& gbuffer, const CpuAOParams& params,
+				const CpuFloat2 rotations[CPU_NUMLAYERS], std::vector<float>& ao );
+
+// The same with the rotations tiled from a mapSize x mapSize map, like the shader
+// sampling a wrapping rotation texture one texel per pixel
+void ComputeAORotationMap( const CpuGBuffer& gbuffer, const CpuAOParams& params,
+						   const CpuFloat2* rotations, int mapSize, std::vector<float>& ao );
+
+// PSAO of the one pixel (x, y): p and n are its view-space position and normal (a sample
+// of a multisampled pixel, say), the taps read gbuffer. taps is scratch.
+float ComputeAOPixel( const CpuGBuffer& gbuffer, const CpuAOParams& params, const CpuFloat2& rotation, int x, int y,
+					  const CpuFloat3& p, const CpuFloat3& n, std::vector<CpuFloat2>& taps );
+
+// Ground truth for PSAO: the same occlusion term averaged over directions x radii taps
+// evenly covering the sample disc (the radius uniform up to the sample radius, like the
+// 0.25 to 1 steps of the kernel), without rotation noise or blur. Fills the rows
+// [y0, y1) of ao, which has to hold width * height values.
+void ComputeAOGroundTruth( const CpuGBuffer& gbuffer, const CpuAOParams& params, int directions, int radii,
+						   int y0, int y1, std::vector<float>& ao );
+
+// Deinterleaved AO: every layer is one job, run on up to numThreads threads
+void ComputeAODeinterleaved( const CpuGBuffer& gbuffer, const CpuAOParams& params,
+							 const CpuFloat2 rotations[CPU_NUMLAYERS], CpuAOLayers& layers,
+							 std::vector<float>& ao, int numThreads, CpuAOTimings* timings = NULL );
+
+// Horizon-based AO (PSAOHorizon): march `directions` screen-space directions with
+// `steps` taps each, rotated per pixel like PSAO
+void ComputeAOHorizon( const CpuGBuffer& gbuffer, const CpuAOParams& params,
+					   const CpuFloat2 rotations[CPU_NUMLAYERS], int directions, int steps,
+					   std::vector<float>& ao );
+
+// The separate steps of ComputeAODeinterleaved
+void DeinterleaveGBuffer( const CpuGBuffer& gbuffer, CpuAOLayers& layers );
+void ComputeAOLayer( const CpuGBuffer& gbuffer, const CpuAOParams& params,
+					 const CpuFloat2 rotations[CPU_NUMLAYERS], CpuAOLayers& layers, int layer );
+void ReinterleaveAO( const CpuGBuffer& gbuffer, const CpuAOLayers& layers, std::vector<float>& ao );
+
+// The 9-tap Gaussian of PSHBlur then PSVBlur, taps step pixels apart (blurSize of the
+// shader is one texel at 768 rows), wrapping like samPoint. scratch is resized as needed.
+void BlurAO( int width, int height, int step, std::vector<float>& ao, std::vector<float>& scratch );
+
+//--------------------------------------------------------------------------------------
+// Composite (PSQuad)
+//--------------------------------------------------------------------------------------
+
+// What the composite shows (_textureToRender / TexToRender)
+enum CpuViewMode
+{
+	VIEW_DIFFUSE = 0,
+	VIEW_NORMALS,
+	VIEW_POSITION,
+	VIEW_DEPTH,
+	VIEW_COMPOSITE,
+	VIEW_AO,
+	NUM_VIEW_MODES
+};
+
+// Composites the rows [y0, y1) into out (width * height pixels)
+typedef void ( *CpuCompositeFunc )( const CpuGBuffer& gbuffer, const std::vector<float>& ao,
+									const CpuFloat3& lightPos, int y0, int y1,
+									std::vector<CpuFloat4>& out );
+
+// The composite specialized at compile time for this view mode and ao flag:
+// pick it once per frame, then call it for every band of rows
+CpuCompositeFunc SelectComposite( int viewMode, bool useAO );
+
+// Composites the pixels [x0, x1) x [y0, y1) in rate x rate blocks: the pixel of every
+// block nearest its centre is shaded and its color broadcast to the whole block
+// (coarse shading, see ShadingRate.h). Rate 1 is the plain composite.
+typedef void ( *CpuCompositeBlocksFunc )( const CpuGBuffer& gbuffer, const std::vector<float>& ao,
+										  const CpuFloat3& lightPos, int x0, int y0, int x1, int y1, int rate,
+										  std::vector<CpuFloat4>& out );
+
+CpuCompositeBlocksFunc SelectCompositeBlocks( int viewMode, bool useAO );
+
+// The one pixel (x, y), branching like PSQuad
+CpuFloat4 CompositePixel( const CpuGBuffer& gbuffer, const std::vector<float>& ao, const CpuFloat3& lightPos, int viewMode,
+						  bool useAO, int x, int y );
+
+// The same composite branching on view mode and ao flag in every pixel, like PSQuad
+void CompositeBranching( const CpuGBuffer& gbuffer, const std::vector<float>& ao,
+						 const CpuFloat3& lightPos, int viewMode, bool useAO, int y0, int y1,
+						 std::vector<CpuFloat4>& out );
@@ -0,0 +1,495 @@
+//--------------------------------------------------------------------------------------
+// File: CpuRaster.cpp
+//--------------------------------------------------------------------------------------
+#include "CpuRaster.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace std;
+
+//--------------------------------------------------------------------------------------
+// Textures
+//--------------------------------------------------------------------------------------
+static float SrgbToLinear( float c )
+{
+	return c <= 0.04045f ? c / 12.92f : powf( ( c + 0.055f ) / 1.055f, 2.4f );
+}
+
+void MakeCpuTexture( const Image& image, bool srgb, CpuTexture& texture )
+{
+	float table[256];
+	for( int i = 0; i < 256; ++i )
+		table[i] = srgb ? SrgbToLinear( i / 255.0f ) : i / 255.0f;
+	texture.width = image.width;
+	texture.height = image.height;
+	texture.texels.resize( ( size_t )image.width * image.height );
+	for( size_t i = 0; i < texture.texels.size(); ++i )
+	{
+		const unsigned char* p = &image.rgba[i * 4];
+		CpuFloat4 t = { table[p[0]], table[p[1]], table[p[2]], p[3] / 255.0f };
+		texture.texels[i] = t;
+	}
+}
+
+static inline int Wrap( int i, int size )
+{
+	i %= size;
+	return i < 0 ? i + size : i;
+}
+
+// samLinear without mips: bilinear, wrapping
+static inline CpuFloat4 Sample( const CpuTexture& texture, float u, float v )
+{
+	float x = u * texture.width - 0.5f, y = v * texture.height - 0.5f;
+	float fx = floorf( x ), fy = floorf( y );
+	float tx = x - fx, ty = y - fy;
+	int x0 = Wrap( ( int )fx, texture.width ), x1 = Wrap( ( int )fx + 1, texture.width );
+	int y0 = Wrap( ( int )fy, texture.height ), y1 = Wrap( ( int )fy + 1, texture.height );
+	const CpuFloat4& a = texture.texels[y0 * texture.width + x0];
+	const CpuFloat4& b = texture.texels[y0 * texture.width + x1];
+	const CpuFloat4& c = texture.texels[y1 * texture.width + x0];
+	const CpuFloat4& d = texture.texels[y1 * texture.width + x1];
+	float wa = ( 1.0f - tx ) * ( 1.0f - ty ), wb = tx * ( 1.0f - ty ), wc = ( 1.0f - tx ) * ty, wd = tx * ty;
+	CpuFloat4 r = { a.x * wa + b.x * wb + c.x * wc + d.x * wd, a.y * wa + b.y * wb + c.y * wc + d.y * wd,
+					a.z * wa + b.z * wb + c.z * wc + d.z * wd, a.w * wa + b.w * wb + c.w * wc + d.w * wd };
+	return r;
+}
+
+//--------------------------------------------------------------------------------------
+// Vertex shader
+//--------------------------------------------------------------------------------------
+void DisplaceVertices( const CpuMesh& mesh, float puffiness, CpuDisplacedVertices& displaced )
+{
+	size_t count = mesh.vertices.size();
+	displaced.position.resize( count );
+	displaced.normal.resize( count );
+	if( !count )
+		return;
+
+	// a 4-float load at pos or normal stays inside the 32-byte vertex (normal[0], uv)
+	Simd4 puff = S4Splat( puffiness );
+	const FloatVertex* v = &mesh.vertices[0];
+	Vec3* position = &displaced.position[0];
+	Vec3* normal = &displaced.normal[0];
+	for( size_t i = 0; i < count; ++i )
+	{
+		Simd4 n = S4Load( v[i].normal );
+		S4Store3( &position[i].x, S4MulAdd( n, puff, S4Load( v[i].pos ) ) );
+		S4Store3( &normal[i].x, n );
+	}
+}
+
+void TransformDisplaced( const CpuDisplacedVertices& displaced, const CpuCamera& camera, CpuRasterScratch& scratch )
+{
+	size_t count = displaced.position.size();
+	scratch.clip.resize( count );
+	scratch.viewPosition.resize( count );
+	scratch.viewNormal.resize( count );
+	if( !count )
+		return;
+
+	// world * view is affine; normals take it without the translation
+	Mat4 worldView = camera.world * camera.view;
+	Mat4 rotation = worldView;
+	rotation.m[3][0] = rotation.m[3][1] = rotation.m[3][2] = 0.0f;
+	TransformPointsAffine( worldView, &displaced.position[0], &scratch.viewPosition[0], count );
+	TransformPointsAffine( rotation, &displaced.normal[0], &scratch.viewNormal[0], count );
+	TransformPoints( camera.projection, &scratch.viewPosition[0], &scratch.clip[0], count );
+}
+
+void TransformMesh( const CpuMesh& mesh, const CpuCamera& camera, CpuRasterScratch& scratch, CpuGBuffer& gbuffer )
+{
+	DisplaceVertices( mesh, camera.puffiness, scratch.displaced );
+	TransformDisplaced( scratch.displaced, camera, scratch );
+	SetGBufferProjection( camera.projection, gbuffer );
+}
+
+void SetGBufferProjection( const Mat4& p, CpuGBuffer& gbuffer )
+{
+	// Mat4PerspectiveFovLH: _33 = f / (f - n), _43 = -n * _33
+	gbuffer.projScaleX = p.m[0][0];
+	gbuffer.projScaleY = p.m[1][1];
+	gbuffer.nearZ = -p.m[3][2] / p.m[2][2];
+	gbuffer.farZ = p.m[2][2] * gbuffer.nearZ / ( p.m[2][2] - 1.0f );
+}
+
+//--------------------------------------------------------------------------------------
+// Rasterizer
+//--------------------------------------------------------------------------------------
+
+// A vertex after clipping: clip position plus the interpolants of PS_MRT_DIRECT_INPUT
+struct RasterVertex
+{
+	Vec4	clip;
+	float	attributes[8];		// view position (3), view normal (3), texcoord (2)
+};
+
+#define NUM_ATTRIBUTES 8
+
+static void MakeRasterVertex( const CpuMesh& mesh, const CpuRasterScratch& scratch, unsigned int index, RasterVertex& out )
+{
+	out.clip = scratch.clip[index];
+	const Vec3& p = scratch.viewPosition[index];
+	const Vec3& n = scratch.viewNormal[index];
+	const float* uv = mesh.vertices[index].uv;
+	float attributes[NUM_ATTRIBUTES] = { p.x, p.y, p.z, n.x, n.y, n.z, uv[0], uv[1] };
+	memcpy( out.attributes, attributes, sizeof( attributes ) );
+}
+
+// Clips a triangle against z >= 0 (the near plane); up to 4 vertices come out
+static int ClipNear( const RasterVertex in[3], RasterVertex out[4] )
+{
+	int count = 0;
+	for( int i = 0; i < 3; ++i )
+	{
+		const RasterVertex& a = in[i];
+		const RasterVertex& b = in[( i + 1 ) % 3];
+		bool aInside = a.clip.z >= 0.0f, bInside = b.clip.z >= 0.0f;
+		if( aInside )
+			out[count++] = a;
+		if( aInside != bInside )
+		{
+			float t = a.clip.z / ( a.clip.z - b.clip.z );
+			RasterVertex& v = out[count++];
+			v.clip = a.clip + ( b.clip - a.clip ) * t;
+			for( int k = 0; k < NUM_ATTRIBUTES; ++k )
+				v.attributes[k] = a.attributes[k] + ( b.attributes[k] - a.attributes[k] ) * t;
+		}
+	}
+	return count;
+}
+
+// A triangle set up for scan conversion: screen positions, attributes / w and edge
+// functions (e0 is opposite vertex 0 and so on)
+struct TriangleSetup
+{
+	float	invW[3];
+	float	attributes[3][NUM_ATTRIBUTES];
+	float	ex[3], ey[3], ec[3];
+	float	invArea;
+	int		minX, maxX, minY, maxY;
+
+	// false if the triangle is culled or has no pixels in the rows [y0, y1)
+	bool Setup( const RasterVertex& v0, const RasterVertex& v1, const RasterVertex& v2, int width, int height, int y0,
+				int y1, CpuRasterStats& stats )
+	{
+		const RasterVertex* v[3] = { &v0, &v1, &v2 };
+		float sx[3], sy[3];
+		for( int i = 0; i < 3; ++i )
+		{
+			invW[i] = 1.0f / v[i]->clip.w;
+			sx[i] = ( v[i]->clip.x * invW[i] * 0.5f + 0.5f ) * width;
+			sy[i] = ( 0.5f - v[i]->clip.y * invW[i] * 0.5f ) * height;
+		}
+
+		// clockwise on screen (y down) is front facing
+		float area = ( sx[1] - sx[0] ) * ( sy[2] - sy[0] ) - ( sx[2] - sx[0] ) * ( sy[1] - sy[0] );
+		if( !( area > 0.0f ) )
+		{
+			++stats.culled;
+			return false;
+		}
+
+		minX = max( 0, ( int )floorf( min( sx[0], min( sx[1], sx[2] ) ) ) );
+		maxX = min( width - 1, ( int )ceilf( max( sx[0], max( sx[1], sx[2] ) ) ) );
+		minY = max( y0, ( int )floorf( min( sy[0], min( sy[1], sy[2] ) ) ) );
+		maxY = min( y1 - 1, ( int )ceilf( max( sy[0], max( sy[1], sy[2] ) ) ) );
+		if( minX > maxX || minY > maxY )
+			return false;
+
+		// attributes / w, interpolated linearly on screen
+		for( int i = 0; i < 3; ++i )
+			for( int k = 0; k < NUM_ATTRIBUTES; ++k )
+				attributes[i][k] = v[i]->attributes[k] * invW[i];
+
+		invArea = 1.0f / area;
+		for( int i = 0; i < 3; ++i )
+		{
+			int a = ( i + 1 ) % 3, b = ( i + 2 ) % 3;
+			ex[i] = sy[a] - sy[b];
+			ey[i] = sx[b] - sx[a];
+			ec[i] = sx[a] * sy[b] - sx[b] * sy[a];
+		}
+		return true;
+	}
+
+	// Barycentrics of the screen point (px, py); false if it is outside
+	bool Inside( float px, float py, float b[3] ) const
+	{
+		float e[3];
+		for( int i = 0; i < 3; ++i )
+			e[i] = ex[i] * px + ey[i] * py + ec[i];
+		if( e[0] < 0.0f || e[1] < 0.0f || e[2] < 0.0f )
+			return false;
+		Barycentrics( e, b );
+		return true;
+	}
+
+	void Barycentrics( const float e[3], float b[3] ) const
+	{
+		b[0] = e[0] * invArea;
+		b[1] = e[1] * invArea;
+		b[2] = e[2] * invArea;
+	}
+
+	// w at the point, then attribute k there
+	float W( const float b[3] ) const { return 1.0f / ( b[0] * invW[0] + b[1] * invW[1] + b[2] * invW[2] ); }
+	float Attribute( const float b[3], float w, int k ) const
+	{
+		return ( b[0] * attributes[0][k] + b[1] * attributes[1][k] + b[2] * attributes[2][k] ) * w;
+	}
+};
+
+// PSMRTAll for the point with barycentrics b: normal and diffuse
+static inline void ShadeGBuffer( const TriangleSetup& t, const float b[3], float w, const CpuTexture* texture,
+								 CpuFloat3& normal, CpuFloat4& diffuse )
+{
+	normal.x = t.Attribute( b, w, 3 );
+	normal.y = t.Attribute( b, w, 4 );
+	normal.z = t.Attribute( b, w, 5 );
+	if( texture )
+		diffuse = Sample( *texture, t.Attribute( b, w, 6 ), t.Attribute( b, w, 7 ) );
+	else
+	{
+		CpuFloat4 gray = { 0.5f, 0.5f, 0.5f, 1.0f };
+		diffuse = gray;
+	}
+}
+
+static void DrawTriangle( const RasterVertex& v0, const RasterVertex& v1, const RasterVertex& v2, const CpuTexture* texture,
+						  CpuGBuffer& gbuffer, int y0, int y1, CpuRasterStats& stats )
+{
+	TriangleSetup t;
+	if( !t.Setup( v0, v1, v2, gbuffer.width, gbuffer.height, y0, y1, stats ) )
+		return;
+
+	for( int y = t.minY; y <= t.maxY; ++y )
+	{
+		float py = y + 0.5f;
+		for( int x = t.minX; x <= t.maxX; ++x )
+		{
+			float b[3];
+			if( !t.Inside( x + 0.5f, py, b ) )
+				continue;
+			float w = t.W( b );
+
+			// depth test on view Z (0: nothing drawn yet)
+			float z = t.Attribute( b, w, 2 );
+			int pixel = y * gbuffer.width + x;
+			float& depth = gbuffer.viewZ[pixel];
+			if( depth != 0.0f && z >= depth )
+				continue;
+			depth = z;
+			++stats.pixels;
+			ShadeGBuffer( t, b, w, texture, gbuffer.normal[pixel], gbuffer.diffuse[pixel] );
+		}
+	}
+}
+
+// Coverage and the depth test per sample, the pixel shader once per pixel at its centre
+// (extrapolated when the centre is outside the triangle, like non-centroid interpolants)
+static void DrawTriangleMsaa( const RasterVertex& v0, const RasterVertex& v1, const RasterVertex& v2,
+							  const CpuTexture* texture, CpuMsaaGBuffer& gbuffer, int y0, int y1, CpuRasterStats& stats )
+{
+	const int width = gbuffer.plane[0].width, samples = gbuffer.samples;
+	TriangleSetup t;
+	if( !t.Setup( v0, v1, v2, width, gbuffer.plane[0].height, y0, y1, stats ) )
+		return;
+
+	const CpuFloat2* pattern = MsaaSamplePattern( samples );
+	for( int y = t.minY; y <= t.maxY; ++y )
+	{
+		float py = y + 0.5f;
+		for( int x = t.minX; x <= t.maxX; ++x )
+		{
+			float px = x + 0.5f;
+			int pixel = y * width + x;
+			float* depth = &gbuffer.depth[( size_t )pixel * samples];
+			float e[3], b[3];
+			for( int i = 0; i < 3; ++i )
+				e[i] = t.ex[i] * px + t.ey[i] * py + t.ec[i];
+			unsigned int covered = 0;
+			for( int s = 0; s < samples; ++s )
+			{
+				float es[3];
+				for( int i = 0; i < 3; ++i )
+					es[i] = e[i] + t.ex[i] * pattern[s].x + t.ey[i] * pattern[s].y;
+				if( es[0] < 0.0f || es[1] < 0.0f || es[2] < 0.0f )
+					continue;
+				t.Barycentrics( es, b );
+				float z = t.Attribute( b, t.W( b ), 2 );
+				if( depth[s] != 0.0f && z >= depth[s] )
+					continue;
+				depth[s] = z;
+				covered |= 1u << s;
+			}
+			if( !covered )
+				continue;
+			++stats.pixels;
+
+			t.Barycentrics( e, b );
+			float w = t.W( b );
+			float z = t.Attribute( b, w, 2 );
+			CpuFloat3 normal;
+			CpuFloat4 diffuse;
+			ShadeGBuffer( t, b, w, texture, normal, diffuse );
+			for( int s = 0; s < samples; ++s )
+				if( covered & ( 1u << s ) )
+				{
+					CpuGBuffer& plane = gbuffer.plane[s];
+					plane.viewZ[pixel] = z;
+					plane.normal[pixel] = normal;
+					plane.diffuse[pixel] = diffuse;
+				}
+		}
+	}
+}
+
+// What the triangles are drawn into
+struct SingleSampleTarget
+{
+	CpuGBuffer& gbuffer;
+
+	int Height() const { return gbuffer.height; }
+	void Draw( const RasterVertex& v0, const RasterVertex& v1, const RasterVertex& v2, const CpuTexture* texture, int y0,
+			   int y1, CpuRasterStats& stats )
+	{
+		DrawTriangle( v0, v1, v2, texture, gbuffer, y0, y1, stats );
+	}
+};
+
+struct MultisampleTarget
+{
+	CpuMsaaGBuffer& gbuffer;
+
+	int Height() const { return gbuffer.plane[0].height; }
+	void Draw( const RasterVertex& v0, const RasterVertex& v1, const RasterVertex& v2, const CpuTexture* texture, int y0,
+			   int y1, CpuRasterStats& stats )
+	{
+		DrawTriangleMsaa( v0, v1, v2, texture, gbuffer, y0, y1, stats );
+	}
+};
+
+template <class Target>
+static void RasterizeTriangles( const CpuMesh& mesh, const CpuRasterScratch& scratch, Target target, int y0, int y1,
+								CpuRasterStats* stats )
+{
+	CpuRasterStats local;
+	memset( &local, 0, sizeof( local ) );
+	const int height = target.Height();
+	float bandTop = 1.0f - 2.0f * y0 / height, bandBottom = 1.0f - 2.0f * y1 / height;
+	for( size_t s = 0; s < mesh.subsets.size(); ++s )
+	{
+		const CpuMesh::Subset& subset = mesh.subsets[s];
+		const CpuTexture* texture = subset.texture >= 0 && subset.texture < ( int )mesh.textures.size() ?
+									&mesh.textures[subset.texture] : NULL;
+		for( unsigned int t = 0; t + 2 < subset.indexCount; t += 3 )
+		{
+			++local.triangles;
+			unsigned int index[3];
+			for( int i = 0; i < 3; ++i )
+				index[i] = mesh.indices[subset.indexStart + t + i] + subset.vertexStart;
+			const Vec4* c[3] = { &scratch.clip[index[0]], &scratch.clip[index[1]], &scratch.clip[index[2]] };
+
+			// trivially outside a frustum plane, or outside this band of rows
+			bool outside = false;
+			outside = outside || ( c[0]->x > c[0]->w && c[1]->x > c[1]->w && c[2]->x > c[2]->w );
+			outside = outside || ( c[0]->x < -c[0]->w && c[1]->x < -c[1]->w && c[2]->x < -c[2]->w );
+			outside = outside || ( c[0]->y > bandTop * c[0]->w && c[1]->y > bandTop * c[1]->w && c[2]->y > bandTop * c[2]->w );
+			outside = outside ||
+					  ( c[0]->y < bandBottom * c[0]->w && c[1]->y < bandBottom * c[1]->w && c[2]->y < bandBottom * c[2]->w );
+			outside = outside || ( c[0]->z < 0.0f && c[1]->z < 0.0f && c[2]->z < 0.0f );
+			outside = outside || ( c[0]->z > c[0]->w && c[1]->z > c[1]->w && c[2]->z > c[2]->w );
+			if( outside )
+			{
+				++local.culled;
+				continue;
+			}
+
+			RasterVertex in[3];
+			for( int i = 0; i < 3; ++i )
+				MakeRasterVertex( mesh, scratch, index[i], in[i] );
+			if( c[0]->z >= 0.0f && c[1]->z >= 0.0f && c[2]->z >= 0.0f )
+			{
+				target.Draw( in[0], in[1], in[2], texture, y0, y1, local );
+				continue;
+			}
+			++local.clipped;
+			RasterVertex clipped[4];
+			int count = ClipNear( in, clipped );
+			for( int i = 2; i < count; ++i )
+				target.Draw( clipped[0], clipped[i - 1], clipped[i], texture, y0, y1, local );
+		}
+	}
+	if( stats )
+	{
+		stats->triangles += local.triangles;
+		stats->culled += local.culled;
+		stats->clipped += local.clipped;
+		stats->pixels += local.pixels;
+	}
+}
+
+void RasterizeRows( const CpuMesh& mesh, const CpuRasterScratch& scratch, CpuGBuffer& gbuffer, int y0, int y1,
+					CpuRasterStats* stats )
+{
+	SingleSampleTarget target = { gbuffer };
+	RasterizeTriangles( mesh, scratch, target, y0, y1, stats );
+}
+
+void RenderGBuffer( const CpuMesh& mesh, const CpuCamera& camera, int width, int height, CpuRasterScratch& scratch,
+					CpuGBuffer& gbuffer, CpuRasterStats* stats )
+{
+	gbuffer.Resize( width, height );
+	TransformMesh( mesh, camera, scratch, gbuffer );
+	RasterizeRows( mesh, scratch, gbuffer, 0, height, stats );
+}
+
+//--------------------------------------------------------------------------------------
+// Multisampled G-buffer
+//--------------------------------------------------------------------------------------
+const CpuFloat2* MsaaSamplePattern( int samples )
+{
+	// the standard patterns of D3D10.1, in 1/16 pixel from the centre
+	static const CpuFloat2 pattern1[1] = { { 0.0f, 0.0f } };
+	static const CpuFloat2 pattern2[2] = { { 4 / 16.0f, 4 / 16.0f }, { -4 / 16.0f, -4 / 16.0f } };
+	static const CpuFloat2 pattern4[4] = { { -2 / 16.0f, -6 / 16.0f }, { 6 / 16.0f, -2 / 16.0f },
+										   { -6 / 16.0f, 2 / 16.0f }, { 2 / 16.0f, 6 / 16.0f } };
+	static const CpuFloat2 pattern8[8] = { { 1 / 16.0f, -3 / 16.0f }, { -1 / 16.0f, 3 / 16.0f }, { 5 / 16.0f, 1 / 16.0f },
+										   { -3 / 16.0f, -5 / 16.0f }, { -5 / 16.0f, 5 / 16.0f }, { -7 / 16.0f, -1 / 16.0f },
+										   { 3 / 16.0f, 7 / 16.0f }, { 7 / 16.0f, -7 / 16.0f } };
+	switch( samples )
+	{
+	case 2:		return pattern2;
+	case 4:		return pattern4;
+	case 8:		return pattern8;
+	default:	return pattern1;
+	}
+}
+
+void CpuMsaaGBuffer::Resize( int w, int h, int sampleCount )
+{
+	samples = sampleCount;
+	for( int s = 0; s < samples; ++s )
+		plane[s].Resize( w, h );
+	depth.assign( ( size_t )w * h * samples, 0.0f );
+}
+
+void RasterizeRowsMsaa( const CpuMesh& mesh, const CpuRasterScratch& scratch, CpuMsaaGBuffer& gbuffer, int y0, int y1,
+						CpuRasterStats* stats )
+{
+	MultisampleTarget target = { gbuffer };
+	RasterizeTriangles( mesh, scratch, target, y0, y1, stats );
+}
+
+void RenderGBufferMsaa( const CpuMesh& mesh, const CpuCamera& camera, int width, int height, int samples,
+						CpuRasterScratch& scratch, CpuMsaaGBuffer& gbuffer, CpuRasterStats* stats )
+{
+	gbuffer.Resize( width, height, samples );
+	TransformMesh( mesh, camera, scratch, gbuffer.plane[0] );
+	for( int s = 1; s < samples; ++s )
+		SetGBufferProjection( camera.projection, gbuffer.plane[s] );
+	RasterizeRowsMsaa( mesh, scratch, gbuffer, 0, height, stats );
+}
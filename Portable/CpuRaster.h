@@ -0,0 +1,122 @@
+//--------------------------------------------------------------------------------------
+// File: CpuRaster.h
+//
+// CPU port of the G-buffer pass (VSMRTDirect + PSMRTAll): transforms a mesh and
+// rasterizes it into a CpuGBuffer for the other CPU passes, or into a multisampled
+// CpuMsaaGBuffer like DeferredShading -msaa. It matches the default
+// rasterizer state: solid fill, back faces culled, clockwise front faces, clipping at
+// the near plane. Attributes are interpolated perspective-correct, the depth test
+// runs on linear view-space Z, and textures are sampled bilinear with wrapping like
+// samLinear (without mips).
+//--------------------------------------------------------------------------------------
+#pragma once
+
+#include "CpuPasses.h"
+#include "ImageFile.h"
+#include "SimdMath.h"
+#include "VertexQuantize.h"
+
+#include <vector>
+
+// A texture as floats (the shader sees UNORM or, for sRGB formats, linear values)
+struct CpuTexture
+{
+	int						width, height;
+	std::vector<CpuFloat4>	texels;
+};
+
+void MakeCpuTexture( const Image& image, bool srgb, CpuTexture& texture );
+
+struct CpuMesh
+{
+	struct Subset
+	{
+		unsigned int	indexStart, indexCount;		// triangle list
+		unsigned int	vertexStart;				// added to every index
+		int				texture;					// into textures, -1 for none (mid gray)
+	};
+
+	std::vector<FloatVertex>	vertices;
+	std::vector<unsigned int>	indices;
+	std::vector<Subset>			subsets;
+	std::vector<CpuTexture>		textures;
+};
+
+// The constant buffer of the pass
+struct CpuCamera
+{
+	Mat4	world, view, projection;		// projection from Mat4PerspectiveFovLH
+	float	puffiness;						// pushes vertices along their normals
+};
+
+// Object-space vertices after the puffiness (input.Pos + input.Norm * Puffiness)
+struct CpuDisplacedVertices
+{
+	std::vector<Vec3>	position;
+	std::vector<Vec3>	normal;
+};
+
+// Transformed vertices, kept between views so a batch doesn't allocate per view
+struct CpuRasterScratch
+{
+	std::vector<Vec4>		clip;
+	std::vector<Vec3>		viewPosition;
+	std::vector<Vec3>		viewNormal;
+	CpuDisplacedVertices	displaced;		// TransformMesh's own
+};
+
+struct CpuRasterStats
+{
+	unsigned int		triangles;		// submitted
+	unsigned int		culled;			// back facing, degenerate or off screen
+	unsigned int		clipped;		// cut by the near plane
+	unsigned long long	pixels;			// passed the depth test
+};
+
+// The vertex shader for every vertex. Also fills in the projection fields of gbuffer.
+void TransformMesh( const CpuMesh& mesh, const CpuCamera& camera, CpuRasterScratch& scratch, CpuGBuffer& gbuffer );
+
+// The two halves of it, for caching them separately (see VertexCache.h): pushing the
+// vertices out by the puffiness, which only changes with the mesh and the slider, and
+// the world, view and projection transforms (camera.puffiness is not used)
+void DisplaceVertices( const CpuMesh& mesh, float puffiness, CpuDisplacedVertices& displaced );
+void TransformDisplaced( const CpuDisplacedVertices& displaced, const CpuCamera& camera, CpuRasterScratch& scratch );
+
+// The projection fields of gbuffer (the composite needs them to get positions back)
+void SetGBufferProjection( const Mat4& projection, CpuGBuffer& gbuffer );
+
+// Rasterizes every triangle into the rows [y0, y1) of gbuffer, which has to be
+// Resize()d (cleared) first. Bands of rows can run on different threads.
+void RasterizeRows( const CpuMesh& mesh, const CpuRasterScratch& scratch, CpuGBuffer& gbuffer, int y0, int y1,
+					CpuRasterStats* stats = NULL );
+
+// Both, one thread
+void RenderGBuffer( const CpuMesh& mesh, const CpuCamera& camera, int width, int height, CpuRasterScratch& scratch,
+					CpuGBuffer& gbuffer, CpuRasterStats* stats = NULL );
+
+//--------------------------------------------------------------------------------------
+// Multisampled G-buffer
+//--------------------------------------------------------------------------------------
+#define CPU_MAX_MSAA_SAMPLES 8
+
+// Plane s holds sample s of every pixel, so the single-sample passes run on any plane
+struct CpuMsaaGBuffer
+{
+	int					samples;
+	CpuGBuffer			plane[CPU_MAX_MSAA_SAMPLES];
+	std::vector<float>	depth;			// the depth buffer: view Z at every sample, samples per pixel
+
+	void Resize( int w, int h, int samples );
+};
+
+// Sample positions of the standard 1, 2, 4 and 8 sample patterns, in pixels from the
+// pixel centre
+const CpuFloat2* MsaaSamplePattern( int samples );
+
+// RasterizeRows with coverage and the depth test per sample. The pixel shader runs once
+// per pixel and triangle, at the pixel centre, and goes to every sample it covered.
+void RasterizeRowsMsaa( const CpuMesh& mesh, const CpuRasterScratch& scratch, CpuMsaaGBuffer& gbuffer, int y0, int y1,
+						CpuRasterStats* stats = NULL );
+
+void RenderGBufferMsaa( const CpuMesh& mesh, const CpuCamera& camera, int width, int height, int samples,
+						CpuRasterScratch& scratch, CpuMsaaGBuffer& gbuffer, CpuRasterStats* stats = NULL );
@@ -0,0 +1,360 @@
+//--------------------------------------------------------------------------------------
+// File: EffectCache.cpp
+//
+// Content-addressed cache of compiled effects
+//--------------------------------------------------------------------------------------
+#include "EffectCache.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#if defined( _WIN32 )
+#include <windows.h>
+#include <direct.h>
+#include <process.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// On-disk entry: header, then the blob
+#define ENTRY_MAGIC 0x42435846			// "FXCB"
+#define ENTRY_VERSION 2
+
+struct EntryHeader
+{
+	unsigned int		magic;
+	unsigned int		version;
+	EffectHash			key;			// must match the file name
+	unsigned long long	size;			// of the blob
+	EffectHash			blobHash;		// catches truncated or damaged entries
+};
+
+//--------------------------------------------------------------------------------------
+// Hashing
+//--------------------------------------------------------------------------------------
+EffectHash HashBytes( const void* data, size_t size, EffectHash hash )
+{
+	const unsigned char* bytes = ( const unsigned char* )data;
+	for( size_t i = 0; i < size; ++i )
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+// Strings are hashed with their length so ("ab", "c") and ("a", "bc") differ
+static EffectHash HashString( const string& s, EffectHash hash )
+{
+	unsigned long long length = s.size();
+	hash = HashBytes( &length, sizeof( length ), hash );
+	return HashBytes( s.data(), s.size(), hash );
+}
+
+EffectHash HashEffectSource( const EffectSource& source )
+{
+	EffectHash hash = HashBytes( NULL, 0 );
+	unsigned int version = ENTRY_VERSION;
+	hash = HashBytes( &version, sizeof( version ), hash );
+	hash = HashString( source.text, hash );
+	for( size_t i = 0; i < source.includes.size(); ++i )
+	{
+		hash = HashString( source.includes[i].path, hash );
+		hash = HashString( source.includes[i].text, hash );
+	}
+	for( size_t i = 0; i < source.defines.size(); ++i )
+	{
+		hash = HashString( source.defines[i].name, hash );
+		hash = HashString( source.defines[i].definition, hash );
+	}
+	hash = HashString( source.compiler, hash );
+	hash = HashString( source.profile, hash );
+	return HashBytes( &source.flags, sizeof( source.flags ), hash );
+}
+
+//--------------------------------------------------------------------------------------
+// Reading the source
+//--------------------------------------------------------------------------------------
+static bool ReadTextFile( const string& path, string& text )
+{
+	FILE* file = fopen( path.c_str(), "rb" );
+	if( !file )
+		return false;
+	text.clear();
+	char buffer[4096];
+	size_t read;
+	while( ( read = fread( buffer, 1, sizeof( buffer ), file ) ) > 0 )
+		text.append( buffer, read );
+	fclose( file );
+	return true;
+}
+
+static string DirectoryOf( const string& path )
+{
+	size_t slash = path.find_last_of( "/\\" );
+	return slash == string::npos ? string() : path.substr( 0, slash + 1 );
+}
+
+const string* EffectSource::FindInclude( const string& name, const string& from ) const
+{
+	string path = DirectoryOf( from ) + name;
+	for( size_t i = 0; i < includes.size(); ++i )
+		if( includes[i].path == path )
+			return &includes[i].text;
+	return NULL;
+}
+
+// Adds the quoted #includes of text (and theirs) to source.includes
+static bool ReadIncludes( const string& text, const string& directory, EffectSource& source, int depth )
+{
+	if( depth > 16 )
+		return false;				// include cycle
+	size_t pos = 0;
+	while( ( pos = text.find( "#include", pos ) ) != string::npos )
+	{
+		pos += 8;
+		size_t open = text.find_first_not_of( " \t", pos );
+		if( open == string::npos || text[open] != '"' )
+			continue;				// <system> includes are not ours
+		size_t close = text.find( '"', open + 1 );
+		if( close == string::npos )
+			return false;
+		EffectInclude include;
+		include.name = text.substr( open + 1, close - open - 1 );
+		include.path = directory + include.name;
+		if( source.FindInclude( include.name, directory ) )
+			continue;				// same file from somewhere else; a same-named one elsewhere is not
+		if( !ReadTextFile( include.path, include.text ) )
+			return false;
+		source.includes.push_back( include );
+		string nested = include.text;
+		if( !ReadIncludes( nested, DirectoryOf( include.path ), source, depth + 1 ) )
+			return false;
+	}
+	return true;
+}
+
+bool LoadEffectSource( const string& path, EffectSource& source )
+{
+	source.path = path;
+	source.includes.clear();
+	if( !ReadTextFile( path, source.text ) )
+		return false;
+	return ReadIncludes( source.text, DirectoryOf( path ), source, 0 );
+}
+
+//--------------------------------------------------------------------------------------
+// Disk store
+//--------------------------------------------------------------------------------------
+void MakeDirectory( const string& directory )
+{
+#if defined( _WIN32 )
+	_mkdir( directory.c_str() );
+#else
+	mkdir( directory.c_str(), 0755 );
+#endif
+}
+
+bool RenameOver( const string& from, const string& to )
+{
+#if defined( _WIN32 )
+	return MoveFileExA( from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING ) != 0;
+#else
+	return rename( from.c_str(), to.c_str() ) == 0;
+#endif
+}
+
+static int ProcessId()
+{
+#if defined( _WIN32 )
+	return _getpid();
+#else
+	return ( int )getpid();
+#endif
+}
+
+string UniqueTempPath( const string& path )
+{
+	static atomic<unsigned int> counter( 0 );
+	char suffix[64];
+	sprintf( suffix, ".%d.%u.tmp", ProcessId(), counter++ );
+	return path + suffix;
+}
+
+string EffectCache::PathFor( EffectHash key ) const
+{
+	char name[32];
+	sprintf( name, "%016llx.fxo", key );
+	return _directory + "/" + name;
+}
+
+bool EffectCache::Load( EffectHash key, vector<char>& blob ) const
+{
+	FILE* file = fopen( PathFor( key ).c_str(), "rb" );
+	if( !file )
+		return false;
+	EntryHeader header;
+	bool ok = fread( &header, sizeof( header ), 1, file ) == 1 &&
+			  header.magic == ENTRY_MAGIC && header.version == ENTRY_VERSION &&
+			  header.key == key && header.size > 0 && header.size < ( 1ULL << 31 );
+	if( ok )
+	{
+		blob.resize( ( size_t )header.size );
+		ok = fread( &blob[0], 1, blob.size(), file ) == blob.size() &&
+			 HashBytes( &blob[0], blob.size() ) == header.blobHash;
+	}
+	fclose( file );
+	if( !ok )
+		blob.clear();
+	return ok;
+}
+
+static bool FileExists( const string& path )
+{
+	FILE* file = fopen( path.c_str(), "rb" );
+	if( file )
+		fclose( file );
+	return file != NULL;
+}
+
+bool EffectCache::Store( EffectHash key, const vector<char>& blob ) const
+{
+	if( blob.empty() )
+		return false;
+
+	string path = PathFor( key );
+	string temp = UniqueTempPath( path );
+
+	FILE* file = fopen( temp.c_str(), "wb" );
+	if( !file )
+		return false;
+	EntryHeader header;
+	memset( &header, 0, sizeof( header ) );
+	header.magic = ENTRY_MAGIC;
+	header.version = ENTRY_VERSION;
+	header.key = key;
+	header.size = blob.size();
+	header.blobHash = HashBytes( &blob[0], blob.size() );
+	bool ok = fwrite( &header, sizeof( header ), 1, file ) == 1 &&
+			  fwrite( &blob[0], 1, blob.size(), file ) == blob.size();
+	ok = fclose( file ) == 0 && ok;
+
+	// readers see the old entry, no entry or the whole new one
+	if( !ok || !RenameOver( temp, path ) )
+	{
+		remove( temp.c_str() );
+		return false;
+	}
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+// Requests and the worker thread
+//--------------------------------------------------------------------------------------
+EffectCache::EffectCache( const string& directory, EffectCompileFunc compile )
+	: _directory( directory ), _compile( compile ), _quit( false )
+{
+	memset( &_stats, 0, sizeof( _stats ) );
+	MakeDirectory( _directory );
+	_worker = thread( &EffectCache::WorkerLoop, this );
+}
+
+EffectCache::~EffectCache()
+{
+	{
+		lock_guard<mutex> lock( _mutex );
+		_quit = true;
+	}
+	_wake.notify_all();
+	_worker.join();
+}
+
+shared_future<EffectCacheEntry> EffectCache::Request( const EffectSource& source )
+{
+	EffectHash key = HashEffectSource( source );
+
+	lock_guard<mutex> lock( _mutex );
+	map<EffectHash, shared_future<EffectCacheEntry> >::iterator found = _requests.find( key );
+	if( found != _requests.end() )
+	{
+		++_stats.memoryHits;
+		return found->second;
+	}
+
+	unique_ptr<Job> job( new Job );
+	job->key = key;
+	job->source = source;
+	shared_future<EffectCacheEntry> result = job->result.get_future().share();
+	_requests[key] = result;
+	_queue.push_back( move( job ) );
+	_wake.notify_one();
+	return result;
+}
+
+EffectCacheEntry EffectCache::Run( Job& job )
+{
+	chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+	EffectCacheEntry entry;
+	shared_ptr<vector<char> > blob( new vector<char> );
+	bool cached = Load( job.key, *blob );
+	bool badEntry = !cached && FileExists( PathFor( job.key ) );
+	if( cached )
+	{
+		entry.ok = true;
+		entry.fromCache = true;
+	}
+	else
+	{
+		entry.ok = _compile( job.source, *blob, entry.errors ) && !blob->empty();
+		if( entry.ok )
+			Store( job.key, *blob );
+	}
+	entry.blob = blob;
+	entry.ms = chrono::duration<double, milli>( chrono::high_resolution_clock::now() - start ).count();
+
+	lock_guard<mutex> lock( _mutex );
+	if( cached )
+		++_stats.diskHits;
+	else
+	{
+		++_stats.compiles;
+		_stats.compileMs += entry.ms;
+		if( !entry.ok )
+			++_stats.failures;
+	}
+	if( badEntry )
+		++_stats.badEntries;
+	// failed compiles are not remembered, so fixing the source and asking again works
+	if( !entry.ok )
+		_requests.erase( job.key );
+	return entry;
+}
+
+void EffectCache::WorkerLoop()
+{
+	for( ;; )
+	{
+		unique_ptr<Job> job;
+		{
+			unique_lock<mutex> lock( _mutex );
+			while( _queue.empty() && !_quit )
+				_wake.wait( lock );
+			if( _queue.empty() )
+				return;
+			job = move( _queue.front() );
+			_queue.pop_front();
+		}
+		job->result.set_value( Run( *job ) );
+	}
+}
+
+EffectCache::Stats EffectCache::GetStats() const
+{
+	lock_guard<mutex> lock( _mutex );
+	return _stats;
+}
@@ -0,0 +1,150 @@
+//--------------------------------------------------------------------------------------
+// File: EffectCache.h
+//
+// Content-addressed cache of compiled effects. The key is a hash of everything the
+// compile depends on (source text, included files, defines, compiler, profile and
+// flags), so a changed input simply misses and never needs invalidating.
+// Entries are stored one file per key; writes go to a temporary file that is renamed
+// into place, so a crash or a second process never leaves a torn entry behind.
+// Uncached entries are compiled on a worker thread.
+// No D3D dependencies: the compiler is passed in (D3DX10CompileFromMemory in the
+// sample, a stub in the tools).
+//--------------------------------------------------------------------------------------
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef unsigned long long EffectHash;
+
+// 64-bit FNV-1a; pass the previous result as hash to continue a running hash
+EffectHash HashBytes( const void* data, size_t size, EffectHash hash = 14695981039346656037ULL );
+
+// Creates directory if missing (not its parents)
+void MakeDirectory( const std::string& directory );
+
+// Replaces to with from in one step
+bool RenameOver( const std::string& from, const std::string& to );
+
+// A file next to path that no other writer (thread or process) uses, to write path's new
+// contents into before RenameOver
+std::string UniqueTempPath( const std::string& path );
+
+struct EffectDefine
+{
+	std::string		name;
+	std::string		definition;
+};
+
+struct EffectInclude
+{
+	std::string		name;			// as written in the #include
+	std::string		path;			// resolved: the including file's directory + name
+	std::string		text;
+};
+
+//--------------------------------------------------------------------------------------
+// Everything a compile depends on
+//--------------------------------------------------------------------------------------
+struct EffectSource
+{
+	std::string					path;
+	std::string					text;
+	std::vector<EffectInclude>	includes;		// every file quoted #includes reach, once per path, depth first
+	std::vector<EffectDefine>	defines;
+	std::string					compiler;		// compiler and version, e.g. "D3DX10 43"
+	std::string					profile;		// "fx_4_0"
+	unsigned int				flags;			// D3D10_SHADER_* flags
+
+	EffectSource() : flags( 0 ) {}
+
+	// text of the file "#include name" in the file at from (path or an include's path)
+	// refers to, if LoadEffectSource read it (NULL if unknown)
+	const std::string* FindInclude( const std::string& name, const std::string& from ) const;
+};
+
+// Reads path and the files it #includes (quoted includes, relative to the
+// including file). Defines, compiler, profile and flags are left to the caller.
+bool LoadEffectSource( const std::string& path, EffectSource& source );
+
+// The cache key of source
+EffectHash HashEffectSource( const EffectSource& source );
+
+//--------------------------------------------------------------------------------------
+// Result of a request
+//--------------------------------------------------------------------------------------
+struct EffectCacheEntry
+{
+	bool									ok;
+	std::shared_ptr<const std::vector<char> >	blob;		// compiled effect
+	std::string								errors;		// compiler output on failure
+	bool									fromCache;	// false if it had to be compiled
+	double									ms;			// time spent on the worker (load or compile)
+
+	EffectCacheEntry() : ok( false ), fromCache( false ), ms( 0.0 ) {}
+};
+
+// Compiles source into blob. Runs on the worker thread.
+typedef std::function<bool ( const EffectSource& source, std::vector<char>& blob, std::string& errors )> EffectCompileFunc;
+
+//--------------------------------------------------------------------------------------
+// The cache
+//--------------------------------------------------------------------------------------
+class EffectCache
+{
+public:
+	struct Stats
+	{
+		int		memoryHits;		// requests answered from a previous request (device reset)
+		int		diskHits;
+		int		compiles;
+		int		failures;		// compiles that failed
+		int		badEntries;		// entries on disk that failed validation and were recompiled
+		double	compileMs;		// total time in the compiler
+	};
+
+	// Entries live in directory, which is created if needed
+	EffectCache( const std::string& directory, EffectCompileFunc compile );
+	~EffectCache();				// finishes the queued requests
+
+	// The compiled effect for source: ready at once if an earlier request had it,
+	// otherwise loaded from disk or compiled on the worker thread. Concurrent
+	// requests for the same key share one compile.
+	std::shared_future<EffectCacheEntry> Request( const EffectSource& source );
+
+	// Disk store, also used directly by the tools
+	std::string PathFor( EffectHash key ) const;
+	bool Load( EffectHash key, std::vector<char>& blob ) const;
+	bool Store( EffectHash key, const std::vector<char>& blob ) const;
+
+	Stats GetStats() const;
+
+private:
+	struct Job
+	{
+		EffectHash							key;
+		EffectSource						source;
+		std::promise<EffectCacheEntry>		result;
+	};
+
+	void WorkerLoop();
+	EffectCacheEntry Run( Job& job );
+
+	std::string												_directory;
+	EffectCompileFunc										_compile;
+	mutable std::mutex										_mutex;
+	std::condition_variable									_wake;
+	std::deque<std::unique_ptr<Job> >						_queue;
+	std::map<EffectHash, std::shared_future<EffectCacheEntry> >	_requests;
+	Stats													_stats;
+	bool													_quit;
+	std::thread												_worker;
+};
@@ -0,0 +1,313 @@
+//--------------------------------------------------------------------------------------
+// File: ExrFile.cpp
+//--------------------------------------------------------------------------------------
+#include "ExrFile.h"
+#include "VertexQuantize.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+#define EXR_MAGIC 20000630
+#define EXR_NO_COMPRESSION 0
+#define EXR_RLE_COMPRESSION 1
+#define EXR_PIXEL_HALF 1
+#define EXR_PIXEL_FLOAT 2
+
+static bool Fail( string* error, const string& message )
+{
+	if( error )
+		*error = message;
+	return false;
+}
+
+static void Put32( vector<unsigned char>& out, unsigned int v )
+{
+	for( int i = 0; i < 4; ++i )
+		out.push_back( ( unsigned char )( v >> ( i * 8 ) ) );
+}
+
+static void PutAttribute( vector<unsigned char>& out, const char* name, const char* type, const void* value, unsigned int size )
+{
+	out.insert( out.end(), name, name + strlen( name ) + 1 );
+	out.insert( out.end(), type, type + strlen( type ) + 1 );
+	Put32( out, size );
+	out.insert( out.end(), ( const unsigned char* )value, ( const unsigned char* )value + size );
+}
+
+static unsigned int Get32( const unsigned char* p )
+{
+	return p[0] | ( p[1] << 8 ) | ( p[2] << 16 ) | ( ( unsigned int )p[3] << 24 );
+}
+
+//--------------------------------------------------------------------------------------
+// RLE compression (as ImfRleCompressor): bytes split into even and odd halves, delta
+// coded, then runs of 3 to 128 equal bytes and literal spans of up to 127
+//--------------------------------------------------------------------------------------
+
+// Returns the compressed size; out has room for size + size / 127 + 1 bytes
+static size_t RleCompress( const unsigned char* in, size_t size, vector<unsigned char>& scratch, unsigned char* out )
+{
+	// split and delta in one pass: each byte minus the one before it in the split order
+	scratch.resize( size );
+	size_t half = ( size + 1 ) / 2;
+	unsigned char* t = &scratch[0];
+	t[0] = in[0];
+	for( size_t k = 1; k < half; ++k )
+		t[k] = ( unsigned char )( in[2 * k] - in[2 * k - 2] + 128 );
+	if( size > 1 )
+		t[half] = ( unsigned char )( in[1] - in[2 * half - 2] + 128 );
+	for( size_t k = 1; k < size / 2; ++k )
+		t[half + k] = ( unsigned char )( in[2 * k + 1] - in[2 * k - 1] + 128 );
+
+	const unsigned char* runStart = t;
+	const unsigned char* end = t + size;
+	unsigned char* write = out;
+	while( runStart < end )
+	{
+		const unsigned char* limit = min( end, runStart + 128 );
+		const unsigned char* p = runStart + 1;
+		while( p < limit && *p == *runStart )
+			++p;
+		if( p - runStart >= 3 )
+		{
+			*write++ = ( unsigned char )( p - runStart - 1 );
+			*write++ = *runStart;
+			runStart = p;
+			continue;
+		}
+
+		// literals up to where 3 equal bytes start
+		limit = min( end, runStart + 127 );
+		p = runStart + 1;
+		while( p < limit && !( p + 2 < end && p[0] == p[1] && p[1] == p[2] ) )
+			++p;
+		*write++ = ( unsigned char )( runStart - p );
+		memcpy( write, runStart, p - runStart );
+		write += p - runStart;
+		runStart = p;
+	}
+	return write - out;
+}
+
+static bool RleDecompress( const unsigned char* in, size_t size, vector<unsigned char>& scratch, unsigned char* out, size_t outSize )
+{
+	scratch.resize( outSize );
+	size_t n = 0;
+	for( const unsigned char* end = in + size; in < end; )
+	{
+		int count = ( signed char )*in++;
+		if( count < 0 )
+		{
+			if( n + -count > outSize || in + -count > end )
+				return false;
+			memcpy( &scratch[n], in, -count );
+			in += -count;
+			n += -count;
+		}
+		else
+		{
+			if( n + count + 1 > outSize || in >= end )
+				return false;
+			memset( &scratch[n], *in++, count + 1 );
+			n += count + 1;
+		}
+	}
+	if( n != outSize )
+		return false;
+	for( size_t i = 1; i < outSize; ++i )
+		scratch[i] = ( unsigned char )( scratch[i] + scratch[i - 1] - 128 );
+	const unsigned char* t1 = &scratch[0];
+	const unsigned char* t2 = &scratch[0] + ( outSize + 1 ) / 2;
+	for( size_t i = 0; i < outSize; ++i )
+		out[i] = *( i & 1 ? t2++ : t1++ );
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+// Scanline files: header attributes, one offset per line, then the lines; within a
+// line the channels come one after the other, in alphabetical order
+//--------------------------------------------------------------------------------------
+
+// Channel order of the file: indices into image.channels, sorted by name
+static vector<int> SortedChannels( const string& channels )
+{
+	vector<int> order( channels.size() );
+	for( size_t c = 0; c < order.size(); ++c )
+		order[c] = ( int )c;
+	sort( order.begin(), order.end(), [&]( int a, int b ) { return channels[a] < channels[b]; } );
+	return order;
+}
+
+void EncodeExr( const ExrImage& image, bool rle, vector<unsigned char>& out )
+{
+	int numChannels = ( int )image.channels.size();
+	vector<int> order = SortedChannels( image.channels );
+	size_t start = out.size();
+	Put32( out, EXR_MAGIC );
+	Put32( out, 2 );
+
+	vector<unsigned char> channels;
+	for( int c = 0; c < numChannels; ++c )
+	{
+		channels.push_back( image.channels[order[c]] );
+		channels.push_back( 0 );
+		Put32( channels, image.half ? EXR_PIXEL_HALF : EXR_PIXEL_FLOAT );
+		Put32( channels, 0 );				// pLinear, reserved
+		Put32( channels, 1 );				// x and y sampling
+		Put32( channels, 1 );
+	}
+	channels.push_back( 0 );
+	PutAttribute( out, "channels", "chlist", &channels[0], ( unsigned int )channels.size() );
+	unsigned char compression = rle ? EXR_RLE_COMPRESSION : EXR_NO_COMPRESSION;
+	PutAttribute( out, "compression", "compression", &compression, 1 );
+	int window[4] = { 0, 0, image.width - 1, image.height - 1 };
+	PutAttribute( out, "dataWindow", "box2i", window, sizeof( window ) );
+	PutAttribute( out, "displayWindow", "box2i", window, sizeof( window ) );
+	unsigned char lineOrder = 0;			// increasing Y
+	PutAttribute( out, "lineOrder", "lineOrder", &lineOrder, 1 );
+	float aspect = 1.0f, center[2] = { 0.0f, 0.0f }, screenWidth = 1.0f;
+	PutAttribute( out, "pixelAspectRatio", "float", &aspect, 4 );
+	PutAttribute( out, "screenWindowCenter", "v2f", center, 8 );
+	PutAttribute( out, "screenWindowWidth", "float", &screenWidth, 4 );
+	out.push_back( 0 );
+
+	size_t table = out.size();
+	out.resize( table + ( size_t )image.height * 8 );
+
+	int texelBytes = image.half ? 2 : 4;
+	size_t lineBytes = ( size_t )image.width * numChannels * texelBytes;
+	vector<unsigned char> line( lineBytes ), scratch;
+	for( int y = 0; y < image.height; ++y )
+	{
+		// channel planes of the line
+		const float* in = &image.pixels[( size_t )y * image.width * numChannels];
+		unsigned char* p = &line[0];
+		for( int c = 0; c < numChannels; ++c )
+		{
+			for( int x = 0; x < image.width; ++x, p += texelBytes )
+			{
+				float v = in[x * numChannels + order[c]];
+				if( image.half )
+				{
+					unsigned short h = FloatToHalf( v );
+					p[0] = ( unsigned char )h;
+					p[1] = ( unsigned char )( h >> 8 );
+				}
+				else
+					memcpy( p, &v, 4 );
+			}
+		}
+
+		unsigned long long offset = out.size() - start;
+		memcpy( &out[table + y * 8], &offset, 8 );
+		Put32( out, y );
+		size_t sizeAt = out.size();
+		out.resize( sizeAt + 4 + lineBytes + lineBytes / 127 + 1 );
+		size_t dataSize = rle ? RleCompress( &line[0], lineBytes, scratch, &out[sizeAt + 4] ) : lineBytes;
+		// stored as is when compressing doesn't pay
+		if( dataSize >= lineBytes )
+		{
+			dataSize = lineBytes;
+			memcpy( &out[sizeAt + 4], &line[0], lineBytes );
+		}
+		out.resize( sizeAt + 4 + dataSize );
+		unsigned int size32 = ( unsigned int )dataSize;
+		memcpy( &out[sizeAt], &size32, 4 );
+	}
+}
+
+bool DecodeExr( const unsigned char* data, size_t size, ExrImage& image, string* error )
+{
+	if( size < 8 || Get32( data ) != EXR_MAGIC || ( data[4] != 2 ) || data[5] != 0 )
+		return Fail( error, "not a single-part scanline OpenEXR file" );
+
+	// attributes
+	const unsigned char* p = data + 8;
+	const unsigned char* end = data + size;
+	int compression = -1, pixelType = -1;
+	int window[4] = { 0, 0, -1, -1 };
+	image.channels.clear();
+	while( p < end && *p )
+	{
+		const unsigned char* name = p;
+		p += strnlen( ( const char* )p, end - p ) + 1;
+		const unsigned char* type = p;
+		p += strnlen( ( const char* )p, end - p ) + 1;
+		if( p + 4 > end || p + 4 + Get32( p ) > end )
+			return Fail( error, "truncated header" );
+		unsigned int attributeSize = Get32( p );
+		const unsigned char* value = p + 4;
+		p = value + attributeSize;
+		if( !strcmp( ( const char* )type, "chlist" ) )
+		{
+			for( const unsigned char* c = value; c < p && *c; )
+			{
+				size_t length = strnlen( ( const char* )c, p - c );
+				if( length != 1 || c + 18 > p )
+					return Fail( error, "channel names must be one letter" );
+				int channelType = ( int )Get32( c + 2 );
+				if( pixelType >= 0 && channelType != pixelType )
+					return Fail( error, "mixed pixel types" );
+				pixelType = channelType;
+				image.channels += ( char )c[0];
+				c += 18;
+			}
+		}
+		else if( !strcmp( ( const char* )name, "compression" ) && attributeSize == 1 )
+			compression = value[0];
+		else if( !strcmp( ( const char* )name, "dataWindow" ) && attributeSize == 16 )
+			memcpy( window, value, 16 );
+	}
+	if( p >= end )
+		return Fail( error, "truncated header" );
+	++p;
+	if( compression != EXR_NO_COMPRESSION && compression != EXR_RLE_COMPRESSION )
+		return Fail( error, "unsupported compression" );
+	if( pixelType != EXR_PIXEL_HALF && pixelType != EXR_PIXEL_FLOAT )
+		return Fail( error, "unsupported pixel type" );
+
+	image.width = window[2] - window[0] + 1;
+	image.height = window[3] - window[1] + 1;
+	image.half = pixelType == EXR_PIXEL_HALF;
+	int numChannels = ( int )image.channels.size();
+	if( image.width <= 0 || image.height <= 0 || numChannels == 0 || p + ( size_t )image.height * 8 > end )
+		return Fail( error, "bad data window" );
+	image.pixels.assign( ( size_t )image.width * image.height * numChannels, 0.0f );
+
+	// the file lists its channels sorted already
+	int texelBytes = image.half ? 2 : 4;
+	size_t lineBytes = ( size_t )image.width * numChannels * texelBytes;
+	vector<unsigned char> line( lineBytes ), scratch;
+	for( int i = 0; i < image.height; ++i )
+	{
+		unsigned long long offset;
+		memcpy( &offset, p + i * 8, 8 );
+		if( offset + 8 > size )
+			return Fail( error, "bad line offset" );
+		const unsigned char* chunk = data + offset;
+		int y = ( int )Get32( chunk ) - window[1];
+		unsigned int dataSize = Get32( chunk + 4 );
+		if( y < 0 || y >= image.height || offset + 8 + dataSize > size )
+			return Fail( error, "bad line" );
+		if( dataSize == lineBytes )
+			memcpy( &line[0], chunk + 8, lineBytes );
+		else if( compression != EXR_RLE_COMPRESSION || !RleDecompress( chunk + 8, dataSize, scratch, &line[0], lineBytes ) )
+			return Fail( error, "bad compressed line" );
+
+		float* out = &image.pixels[( size_t )y * image.width * numChannels];
+		const unsigned char* q = &line[0];
+		for( int c = 0; c < numChannels; ++c )
+		{
+			for( int x = 0; x < image.width; ++x, q += texelBytes )
+			{
+				if( image.half )
+					out[x * numChannels + c] = HalfToFloat( ( unsigned short )( q[0] | ( q[1] << 8 ) ) );
+				else
+					memcpy( &out[x * numChannels + c], q, 4 );
+			}
+		}
+	}
+	return true;
+}
@@ -0,0 +1,26 @@
+//--------------------------------------------------------------------------------------
+// File: ExrFile.h
+//
+// OpenEXR for the float outputs (depth, normals, AO): single-part scanline images of
+// HALF or FLOAT channels, uncompressed or RLE (lossless, and cheap enough to run on
+// every frame). Reading covers what EncodeExr writes, for the tools' checks.
+//--------------------------------------------------------------------------------------
+#pragma once
+
+#include <string>
+#include <vector>
+
+struct ExrImage
+{
+	int					width, height;
+	std::string			channels;		// one letter per channel, e.g. "Z" or "RGB"
+	bool				half;			// stored as HALF, else FLOAT
+	std::vector<float>	pixels;			// width * height * channels, interleaved, top row first
+
+	ExrImage() : width( 0 ), height( 0 ), half( true ) {}
+};
+
+// Appends the file to out
+void EncodeExr( const ExrImage& image, bool rle, std::vector<unsigned char>& out );
+
+bool DecodeExr( const unsigned char* data, size_t size, ExrImage& image, std::string* error = NULL );
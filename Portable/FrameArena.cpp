@@ -0,0 +1,163 @@
+//--------------------------------------------------------------------------------------
+// File: FrameArena.cpp
+//--------------------------------------------------------------------------------------
+#include "FrameArena.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+
+#if defined( _WIN32 )
+#include <malloc.h>
+#endif
+
+using namespace std;
+
+//--------------------------------------------------------------------------------------
+// Heap fallback
+//--------------------------------------------------------------------------------------
+class HeapArenaFallback : public ArenaFallback
+{
+public:
+	virtual void* Allocate( size_t bytes, size_t alignment )
+	{
+		alignment = max( alignment, sizeof( void* ) );
+#if defined( _WIN32 )
+		return _aligned_malloc( bytes, alignment );
+#else
+		void* p = NULL;
+		return posix_memalign( &p, alignment, bytes ) == 0 ? p : NULL;
+#endif
+	}
+
+	virtual void Free( void* p )
+	{
+#if defined( _WIN32 )
+		_aligned_free( p );
+#else
+		free( p );
+#endif
+	}
+};
+
+ArenaFallback& HeapFallback()
+{
+	static HeapArenaFallback heap;
+	return heap;
+}
+
+//--------------------------------------------------------------------------------------
+// Linear arena
+//--------------------------------------------------------------------------------------
+LinearArena::LinearArena() : _fallback( NULL ), _base( NULL ), _capacity( 0 ), _offset( 0 ), _overflow( NULL ),
+	_overflowBytes( 0 ), _highWater( 0 ), _overflows( 0 ), _overflowTotal( 0 )
+{
+}
+
+LinearArena::~LinearArena()
+{
+	Reset();
+	if( _base )
+		_fallback->Free( _base );
+}
+
+void LinearArena::Init( size_t capacity, ArenaFallback* fallback )
+{
+	Reset();
+	if( _base )
+		_fallback->Free( _base );
+	_fallback = fallback ? fallback : &HeapFallback();
+	_capacity = capacity;
+	_base = capacity ? ( char* )_fallback->Allocate( capacity, 64 ) : NULL;
+	if( !_base )
+		_capacity = 0;
+	_highWater = 0;
+	_overflows = 0;
+	_overflowTotal = 0;
+}
+
+void* LinearArena::Allocate( size_t bytes, size_t alignment )
+{
+	size_t offset = ( _offset + alignment - 1 ) & ~( alignment - 1 );
+	if( offset + bytes <= _capacity )
+	{
+		_offset = offset + bytes;
+		_highWater = max( _highWater, Used() );
+		return _base + offset;
+	}
+
+	// doesn't fit: a block of its own, linked through a header in front of it
+	if( !_fallback )
+		_fallback = &HeapFallback();
+	size_t header = max( alignment, sizeof( Overflow ) );
+	char* block = ( char* )_fallback->Allocate( header + bytes, alignment );
+	if( !block )
+		return NULL;
+	Overflow* overflow = ( Overflow* )block;
+	overflow->next = _overflow;
+	_overflow = overflow;
+	_overflowBytes += bytes;
+	++_overflows;
+	_overflowTotal += bytes;
+	_highWater = max( _highWater, Used() );
+	return block + header;
+}
+
+void LinearArena::Reset()
+{
+	while( _overflow )
+	{
+		Overflow* next = _overflow->next;
+		_fallback->Free( _overflow );
+		_overflow = next;
+	}
+	_offset = 0;
+	_overflowBytes = 0;
+}
+
+//--------------------------------------------------------------------------------------
+// Frame arenas
+//--------------------------------------------------------------------------------------
+FrameArenas::FrameArenas( int numThreads, int numBuffers, size_t bytesPerThread, ArenaFallback* fallback ) :
+	_numThreads( max( numThreads, 1 ) ), _numBuffers( max( numBuffers, 1 ) )
+{
+	for( int i = 0; i < _numThreads * _numBuffers; ++i )
+	{
+		_arenas.push_back( new LinearArena() );
+		_arenas.back()->Init( bytesPerThread, fallback );
+	}
+}
+
+FrameArenas::~FrameArenas()
+{
+	for( size_t i = 0; i < _arenas.size(); ++i )
+		delete _arenas[i];
+}
+
+void FrameArenas::BeginFrame( unsigned int frameIndex )
+{
+	int buffer = ( int )( frameIndex % _numBuffers );
+	for( int thread = 0; thread < _numThreads; ++thread )
+		_arenas[buffer * _numThreads + thread]->Reset();
+}
+
+LinearArena& FrameArenas::Get( unsigned int frameIndex, int worker )
+{
+	// no clamping: two threads on one arena would race on its offset
+	int buffer = ( int )( frameIndex % _numBuffers );
+	int thread = worker + 1;
+	assert( thread >= 0 && thread < _numThreads && "FrameArenas made for fewer threads than there are workers" );
+	return *_arenas[buffer * _numThreads + thread];
+}
+
+FrameArenas::Stats FrameArenas::GetStats() const
+{
+	Stats stats = { _arenas.empty() ? 0 : _arenas[0]->Capacity(), 0, 0, 0 };
+	for( size_t i = 0; i < _arenas.size(); ++i )
+	{
+		stats.highWater = max( stats.highWater, _arenas[i]->HighWater() );
+		stats.overflows += _arenas[i]->Overflows();
+		stats.overflowBytes += _arenas[i]->OverflowBytes();
+	}
+	return stats;
+}
@@ -0,0 +1,109 @@
+//--------------------------------------------------------------------------------------
+// File: FrameArena.h
+//
+// Linear (bump) allocators for the transient CPU-side data of a frame: culling
+// output, draw packets, light lists, tile bins. Allocating is a pointer increment and
+// nothing is freed one by one; the whole arena is reset once the frame is done.
+// FrameArenas keeps one arena per thread for every frame in flight (2 or 3, matching
+// the FramePipeline), so jobs of overlapping frames never share one.
+// What doesn't fit goes to a fallback allocator until the reset, and is counted: the
+// high-water mark tells how big the arenas should have been.
+//--------------------------------------------------------------------------------------
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Where the arena blocks and the overflow come from
+class ArenaFallback
+{
+public:
+	virtual ~ArenaFallback() {}
+	virtual void* Allocate( size_t bytes, size_t alignment ) = 0;
+	virtual void Free( void* p ) = 0;
+};
+
+// Aligned malloc/free
+ArenaFallback& HeapFallback();
+
+class LinearArena
+{
+public:
+	LinearArena();
+	~LinearArena();
+
+	// Gets the block (the only allocation until something overflows)
+	void Init( size_t capacity, ArenaFallback* fallback = NULL );
+
+	// alignment must be a power of 2
+	void* Allocate( size_t bytes, size_t alignment = 16 );
+
+	// Uninitialized room for count T (for plain data: nothing is destroyed)
+	template<typename T> T* Allocate( size_t count )
+	{
+		return ( T* )Allocate( count * sizeof( T ), alignof( T ) < 16 ? 16 : alignof( T ) );
+	}
+
+	// Everything allocated since the last reset is gone; overflow goes back to the fallback
+	void Reset();
+
+	size_t Capacity() const			{ return _capacity; }
+	size_t Used() const				{ return _offset + _overflowBytes; }	// this frame, overflow included
+	size_t HighWater() const		{ return _highWater; }				// most Used() of any frame
+	unsigned int Overflows() const	{ return _overflows; }				// fallback allocations since Init
+	size_t OverflowBytes() const	{ return _overflowTotal; }
+
+private:
+	LinearArena( const LinearArena& );
+	LinearArena& operator=( const LinearArena& );
+
+	struct Overflow
+	{
+		Overflow*	next;
+	};
+
+	ArenaFallback*	_fallback;
+	char*			_base;
+	size_t			_capacity;
+	size_t			_offset;
+	Overflow*		_overflow;			// this frame's fallback blocks
+	size_t			_overflowBytes;
+	size_t			_highWater;
+	unsigned int	_overflows;
+	size_t			_overflowTotal;
+	char			_pad[64];			// keeps the next thread's arena off this cache line
+};
+
+class FrameArenas
+{
+public:
+	// numThreads arenas of bytesPerThread for each of numBuffers frames in flight.
+	// With a JobSystem use NumWorkers() + 1: one for every worker and one for the rest.
+	FrameArenas( int numThreads, int numBuffers, size_t bytesPerThread, ArenaFallback* fallback = NULL );
+	~FrameArenas();
+
+	// Resets the arenas frameIndex will use. Call once frame frameIndex - numBuffers
+	// is done with them (after FramePipeline::WaitForSlot) and before frameIndex starts.
+	void BeginFrame( unsigned int frameIndex );
+
+	// The arena of worker (JobSystem::CurrentWorker, -1 outside the job system) for frameIndex.
+	// worker must be below NumThreads() - 1.
+	LinearArena& Get( unsigned int frameIndex, int worker );
+
+	int NumThreads() const		{ return _numThreads; }
+	int NumBuffers() const		{ return _numBuffers; }
+
+	struct Stats
+	{
+		size_t			capacity;		// of one arena
+		size_t			highWater;		// most any arena needed in one frame
+		unsigned int	overflows;		// fallback allocations, all arenas
+		size_t			overflowBytes;
+	};
+	Stats GetStats() const;
+
+private:
+	int							_numThreads;
+	int							_numBuffers;
+	std::vector<LinearArena*>	_arenas;		// buffer * numThreads + thread
+};
@@ -0,0 +1,268 @@
+//--------------------------------------------------------------------------------------
+// File: FrameCapture.cpp
+//--------------------------------------------------------------------------------------
+#include "FrameCapture.h"
+#include "MappedFile.h"
+
+#include <cstring>
+
+using namespace std;
+
+static const unsigned int CAPTURE_VERSION = 1;
+static const int NUM_GROUPS = 8;
+static const int GROUP_WORDS = 16;
+static const int NUM_WORDS = NUM_GROUPS * GROUP_WORDS;
+static const size_t HEADER_BYTES = 12;
+
+static bool Fail( string* error, const string& message )
+{
+	if( error )
+		*error = message;
+	return false;
+}
+
+FrameInputs::FrameInputs()
+	: elapsed( 0.0f ), puffiness( 0.0f ), ambientOcclusion( true ), textureToRender( 4 ), aoTechnique( 0 ),
+	  horizonDirections( 6 ), horizonSteps( 4 ), width( 1024 ), height( 768 )
+{
+	world = view = projection = quadView = quadProjection = aoView = aoProjection = Mat4Identity();
+}
+
+//--------------------------------------------------------------------------------------
+// Frames as words
+//--------------------------------------------------------------------------------------
+static unsigned int FloatBits( float f )
+{
+	unsigned int bits;
+	memcpy( &bits, &f, 4 );
+	return bits;
+}
+
+static float BitsFloat( unsigned int bits )
+{
+	float f;
+	memcpy( &f, &bits, 4 );
+	return f;
+}
+
+static void ToWords( const FrameInputs& frame, unsigned int words[NUM_WORDS] )
+{
+	const Mat4* matrices[] = { &frame.world, &frame.view, &frame.projection, &frame.quadView,
+							   &frame.quadProjection, &frame.aoView, &frame.aoProjection };
+	for( int g = 0; g < 7; ++g )
+		memcpy( &words[g * GROUP_WORDS], matrices[g]->m, GROUP_WORDS * 4 );
+	unsigned int* scalars = &words[7 * GROUP_WORDS];
+	memset( scalars, 0, GROUP_WORDS * 4 );
+	scalars[0] = FloatBits( frame.puffiness );
+	scalars[1] = frame.ambientOcclusion ? 1 : 0;
+	scalars[2] = ( unsigned int )frame.textureToRender;
+	scalars[3] = ( unsigned int )frame.aoTechnique;
+	scalars[4] = ( unsigned int )frame.horizonDirections;
+	scalars[5] = ( unsigned int )frame.horizonSteps;
+	scalars[6] = ( unsigned int )frame.width;
+	scalars[7] = ( unsigned int )frame.height;
+}
+
+static void FromWords( const unsigned int words[NUM_WORDS], FrameInputs& frame )
+{
+	Mat4* matrices[] = { &frame.world, &frame.view, &frame.projection, &frame.quadView,
+						 &frame.quadProjection, &frame.aoView, &frame.aoProjection };
+	for( int g = 0; g < 7; ++g )
+		memcpy( matrices[g]->m, &words[g * GROUP_WORDS], GROUP_WORDS * 4 );
+	const unsigned int* scalars = &words[7 * GROUP_WORDS];
+	frame.puffiness = BitsFloat( scalars[0] );
+	frame.ambientOcclusion = scalars[1] != 0;
+	frame.textureToRender = ( int )scalars[2];
+	frame.aoTechnique = ( int )scalars[3];
+	frame.horizonDirections = ( int )scalars[4];
+	frame.horizonSteps = ( int )scalars[5];
+	frame.width = ( int )scalars[6];
+	frame.height = ( int )scalars[7];
+}
+
+//--------------------------------------------------------------------------------------
+// Records (little endian)
+//--------------------------------------------------------------------------------------
+static void Put16( vector<unsigned char>& out, unsigned int v )
+{
+	out.push_back( ( unsigned char )v );
+	out.push_back( ( unsigned char )( v >> 8 ) );
+}
+
+static void Put32( vector<unsigned char>& out, unsigned int v )
+{
+	Put16( out, v & 0xffff );
+	Put16( out, v >> 16 );
+}
+
+static unsigned int Get16( const unsigned char* p ) { return p[0] | ( p[1] << 8 ); }
+static unsigned int Get32( const unsigned char* p ) { return Get16( p ) | ( Get16( p + 2 ) << 16 ); }
+
+static void PutHeader( int texScale, vector<unsigned char>& out )
+{
+	out.insert( out.end(), "FCAP", "FCAP" + 4 );
+	Put32( out, CAPTURE_VERSION );
+	Put32( out, ( unsigned int )texScale );
+}
+
+// Appends the record of frame and makes its words the previous ones
+static void PutFrame( const FrameInputs& frame, unsigned int previous[NUM_WORDS], vector<unsigned char>& out )
+{
+	unsigned int words[NUM_WORDS];
+	ToWords( frame, words );
+	Put32( out, FloatBits( frame.elapsed ) );
+	size_t groupMask = out.size();
+	out.push_back( 0 );
+	for( int g = 0; g < NUM_GROUPS; ++g )
+	{
+		const unsigned int* w = &words[g * GROUP_WORDS];
+		const unsigned int* p = &previous[g * GROUP_WORDS];
+		unsigned int mask = 0;
+		for( int i = 0; i < GROUP_WORDS; ++i )
+			mask |= ( w[i] != p[i] ? 1u : 0u ) << i;
+		if( !mask )
+			continue;
+		out[groupMask] |= ( unsigned char )( 1 << g );
+		Put16( out, mask );
+		for( int i = 0; i < GROUP_WORDS; ++i )
+			if( mask & ( 1u << i ) )
+				Put32( out, w[i] );
+	}
+	memcpy( previous, words, sizeof( words ) );
+}
+
+//--------------------------------------------------------------------------------------
+// FrameCaptureWriter
+//--------------------------------------------------------------------------------------
+FrameCaptureWriter::FrameCaptureWriter()
+	: _file( NULL ), _failed( false ), _frames( 0 ), _bytes( 0 )
+{
+}
+
+FrameCaptureWriter::~FrameCaptureWriter()
+{
+	Close();
+}
+
+bool FrameCaptureWriter::Open( const string& path, int texScale, string* error )
+{
+	Close();
+	_file = fopen( path.c_str(), "wb" );
+	if( !_file )
+		return Fail( error, "can't write " + path );
+	_failed = false;
+	_frames = 0;
+	memset( _previous, 0, sizeof( _previous ) );
+	_record.clear();
+	PutHeader( texScale, _record );
+	_failed = fwrite( &_record[0], 1, _record.size(), _file ) != _record.size();
+	_bytes = _record.size();
+	return true;
+}
+
+void FrameCaptureWriter::Write( const FrameInputs& frame )
+{
+	if( !_file )
+		return;
+	_record.clear();
+	PutFrame( frame, _previous, _record );
+	if( fwrite( &_record[0], 1, _record.size(), _file ) != _record.size() )
+		_failed = true;
+	_bytes += _record.size();
+	++_frames;
+}
+
+bool FrameCaptureWriter::Close()
+{
+	if( !_file )
+		return !_failed;
+	if( fclose( _file ) != 0 )
+		_failed = true;
+	_file = NULL;
+	return !_failed;
+}
+
+//--------------------------------------------------------------------------------------
+// In memory
+//--------------------------------------------------------------------------------------
+void EncodeFrameCapture( const FrameCapture& capture, vector<unsigned char>& out )
+{
+	unsigned int previous[NUM_WORDS] = { 0 };
+	out.clear();
+	PutHeader( capture.texScale, out );
+	for( size_t i = 0; i < capture.frames.size(); ++i )
+		PutFrame( capture.frames[i], previous, out );
+}
+
+bool DecodeFrameCapture( const unsigned char* data, size_t size, FrameCapture& capture, string* error )
+{
+	capture.frames.clear();
+	capture.truncated = false;
+	if( size < HEADER_BYTES || memcmp( data, "FCAP", 4 ) )
+		return Fail( error, "not a frame capture" );
+	if( Get32( data + 4 ) != CAPTURE_VERSION )
+		return Fail( error, "unknown frame capture version" );
+	capture.texScale = ( int )Get32( data + 8 );
+
+	unsigned int words[NUM_WORDS] = { 0 };
+	const unsigned char* p = data + HEADER_BYTES;
+	const unsigned char* end = data + size;
+	while( p < end )
+	{
+		// the record is only taken once all of it is there
+		if( end - p < 5 )
+		{
+			capture.truncated = true;
+			break;
+		}
+		unsigned int next[NUM_WORDS];
+		memcpy( next, words, sizeof( words ) );
+		float elapsed = BitsFloat( Get32( p ) );
+		unsigned int groupMask = p[4];
+		const unsigned char* q = p + 5;
+		bool whole = true;
+		for( int g = 0; g < NUM_GROUPS && whole; ++g )
+		{
+			if( !( groupMask & ( 1u << g ) ) )
+				continue;
+			if( end - q < 2 )
+			{
+				whole = false;
+				break;
+			}
+			unsigned int mask = Get16( q );
+			q += 2;
+			for( int i = 0; i < GROUP_WORDS; ++i )
+			{
+				if( !( mask & ( 1u << i ) ) )
+					continue;
+				if( end - q < 4 )
+				{
+					whole = false;
+					break;
+				}
+				next[g * GROUP_WORDS + i] = Get32( q );
+				q += 4;
+			}
+		}
+		if( !whole )
+		{
+			capture.truncated = true;
+			break;
+		}
+		memcpy( words, next, sizeof( words ) );
+		capture.frames.push_back( FrameInputs() );
+		FromWords( words, capture.frames.back() );
+		capture.frames.back().elapsed = elapsed;
+		p = q;
+	}
+	return true;
+}
+
+bool ReadFrameCapture( const string& path, FrameCapture& capture, string* error )
+{
+	MappedFile file;
+	if( !file.Open( path ) )
+		return Fail( error, "can't read " + path );
+	return DecodeFrameCapture( file.Data(), file.Size(), capture, error );
+}
@@ -0,0 +1,84 @@
+//--------------------------------------------------------------------------------------
+// File: FrameCapture.h
+//
+// Recording of the inputs of every frame of the sample: the matrices of g_Camera,
+// t_Camera and ao_Camera, g_World, g_fModelPuffiness, _ambientOcclusion,
+// _textureToRender, the AO technique and the window size. With them a frame can be
+// rendered again without the window, so a slow frame of a session can be reproduced
+// and a whole session becomes a benchmark (see FrameReplay.h).
+//
+// A capture is a header ("FCAP", version, TEXSCALE) followed by one record per frame.
+// The inputs of a frame are 8 groups of 16 words (one group per matrix, one for the
+// scalars) and a record only holds the words that changed since the previous frame:
+//   float	elapsed			seconds since the previous frame
+//   u8		group mask		groups with a changed word
+//   per changed group: u16 word mask, then the changed words
+// A frame that only moves the camera costs about 45 bytes, a still one 5. Words are
+// compared bit for bit, so the replay sees exactly the floats the sample used.
+// A capture cut short by a crash reads up to its last whole record.
+//--------------------------------------------------------------------------------------
+#pragma once
+
+#include "SimdMath.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+struct FrameInputs
+{
+	float	elapsed;							// fElapsedTime
+	Mat4	world;								// g_World
+	Mat4	view, projection;					// g_Camera: the G-buffer pass
+	Mat4	quadView, quadProjection;			// t_Camera: the composite quad
+	Mat4	aoView, aoProjection;				// ao_Camera: the AO and blur quads
+	float	puffiness;							// g_fModelPuffiness
+	bool	ambientOcclusion;					// _ambientOcclusion
+	int		textureToRender;					// _textureToRender (CpuViewMode)
+	int		aoTechnique;						// _aoTechnique: simple, pyramid, deinterleaved, temporal, horizon
+	int		horizonDirections, horizonSteps;	// the horizon preset
+	int		width, height;						// window size; the render targets are texScale times that
+
+	FrameInputs();
+};
+
+struct FrameCapture
+{
+	int							texScale;		// TEXSCALE of the build that recorded it
+	std::vector<FrameInputs>	frames;
+	bool						truncated;		// the last record was cut short
+
+	FrameCapture() : texScale( 1 ), truncated( false ) {}
+};
+
+// Appends frames to a capture file as they happen
+class FrameCaptureWriter
+{
+public:
+	FrameCaptureWriter();
+	~FrameCaptureWriter();
+
+	bool Open( const std::string& path, int texScale, std::string* error = NULL );
+	void Write( const FrameInputs& frame );
+	bool Close();				// false if a write failed
+
+	bool IsOpen() const { return _file != NULL; }
+	unsigned int Frames() const { return _frames; }
+	unsigned long long Bytes() const { return _bytes; }
+
+private:
+	FILE*						_file;
+	bool						_failed;
+	unsigned int				_frames;
+	unsigned long long			_bytes;
+	unsigned int				_previous[128];		// words of the last frame written
+	std::vector<unsigned char>	_record;
+
+	FrameCaptureWriter( const FrameCaptureWriter& );
+	FrameCaptureWriter& operator=( const FrameCaptureWriter& );
+};
+
+// The same format in memory
+void EncodeFrameCapture( const FrameCapture& capture, std::vector<unsigned char>& out );
+bool DecodeFrameCapture( const unsigned char* data, size_t size, FrameCapture& capture, std::string* error = NULL );
+bool ReadFrameCapture( const std::string& path, FrameCapture& capture, std::string* error = NULL );
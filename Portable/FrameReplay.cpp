@@ -0,0 +1,364 @@
+//--------------------------------------------------------------------------------------
+// File: FrameReplay.cpp
+//--------------------------------------------------------------------------------------
+#include "FrameReplay.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <thread>
+
+using namespace std;
+
+typedef chrono::high_resolution_clock Clock;
+
+static double Milliseconds( const Clock::time_point& start )
+{
+	return chrono::duration<double, milli>( Clock::now() - start ).count();
+}
+
+static bool Fail( string* error, const string& message )
+{
+	if( error )
+		*error = message;
+	return false;
+}
+
+const char* ReplayPassName( int pass )
+{
+	static const char* names[NUM_REPLAY_PASSES + 1] = { "gbuffer", "ao", "blur", "composite", "total" };
+	return names[min( max( pass, 0 ), ( int )NUM_REPLAY_PASSES )];
+}
+
+//--------------------------------------------------------------------------------------
+// Replay
+//--------------------------------------------------------------------------------------
+
+// _aoTechnique of the sample
+enum { TECHNIQUE_SIMPLE, TECHNIQUE_PYRAMID, TECHNIQUE_DEINTERLEAVED, TECHNIQUE_TEMPORAL, TECHNIQUE_HORIZON };
+
+// The buffers of the passes, kept from frame to frame
+struct ReplayContext
+{
+	JobSystem*					jobs;
+	const CpuMesh*				mesh;
+	VertexCache					vertexCache;
+	Versioned<Mat4>				world, view, projection;
+	const CpuRasterScratch*		vertices;
+	CpuGBuffer					gbuffer;
+	CpuAOLayers					layers;
+	CpuAOParams					aoParams;
+	CpuFloat2					rotations[CPU_NUMLAYERS];
+	vector<float>				ao, blur;
+	vector<CpuFloat4>			color;
+	CpuCompositeFunc			composite;
+	vector<CpuRasterStats>		rasterStats;	// by worker + 1
+	int							rowsPerJob;
+};
+
+static void RasterizeBand( void* data, int begin, int end )
+{
+	ReplayContext& context = *( ReplayContext* )data;
+	CpuRasterStats& stats = context.rasterStats[context.jobs->CurrentWorker() + 1];
+	RasterizeRows( *context.mesh, *context.vertices, context.gbuffer, begin, end, &stats );
+}
+
+static void AOLayers( void* data, int begin, int end )
+{
+	ReplayContext& context = *( ReplayContext* )data;
+	for( int layer = begin; layer < end; ++layer )
+		ComputeAOLayer( context.gbuffer, context.aoParams, context.rotations, context.layers, layer );
+}
+
+static void CompositeBand( void* data, int begin, int end )
+{
+	ReplayContext& context = *( ReplayContext* )data;
+	const CpuFloat3 lightPos = { 0.0f, -3.0f, -4.0f };	// vLightPos
+	context.composite( context.gbuffer, context.ao, lightPos, begin, end, context.color );
+}
+
+static void RunParallel( ReplayContext& context, int count, int grain, JobFunc func )
+{
+	JobCounter counter;
+	context.jobs->ParallelFor( 0, count, grain, func, &context, &counter );
+	context.jobs->Wait( counter );
+}
+
+static unsigned int HashImage( const vector<CpuFloat4>& color )
+{
+	unsigned int hash = 2166136261u;
+	for( size_t i = 0; i < color.size(); ++i )
+	{
+		const float* c = &color[i].x;
+		for( int k = 0; k < 4; ++k )
+		{
+			float v = min( max( c[k], 0.0f ), 1.0f );
+			hash = ( hash ^ ( unsigned int )( v * 255.0f + 0.5f ) ) * 16777619u;
+		}
+	}
+	return hash;
+}
+
+static void ReplayFrameInputs( ReplayContext& context, const FrameInputs& frame, int width, int height,
+							   ReplayFrame& out )
+{
+	// G-buffer: the vertices (unless nothing moved), then bands of rows
+	Clock::time_point start = Clock::now();
+	CpuCamera camera = { frame.world, frame.view, frame.projection, frame.puffiness };
+	context.world.Set( frame.world );
+	context.view.Set( frame.view );
+	context.projection.Set( frame.projection );
+	context.gbuffer.Resize( width, height );
+	context.vertices = &context.vertexCache.Transform( *context.mesh, 0, camera, 0, context.world.version, 0,
+													  context.view.version + context.projection.version, context.gbuffer );
+	RunParallel( context, height, context.rowsPerJob, RasterizeBand );
+	out.passMs[REPLAY_GBUFFER] = Milliseconds( start );
+
+	start = Clock::now();
+	if( frame.ambientOcclusion )
+	{
+		switch( frame.aoTechnique )
+		{
+		case TECHNIQUE_DEINTERLEAVED:
+			DeinterleaveGBuffer( context.gbuffer, context.layers );
+			RunParallel( context, CPU_NUMLAYERS, 1, AOLayers );
+			ReinterleaveAO( context.gbuffer, context.layers, context.ao );
+			break;
+		case TECHNIQUE_HORIZON:
+			ComputeAOHorizon( context.gbuffer, context.aoParams, context.rotations, frame.horizonDirections,
+							  frame.horizonSteps, context.ao );
+			break;
+		default:
+			ComputeAO( context.gbuffer, context.aoParams, context.rotations, context.ao );
+			break;
+		}
+	}
+	out.passMs[REPLAY_AO] = Milliseconds( start );
+
+	start = Clock::now();
+	if( frame.ambientOcclusion )
+		BlurAO( width, height, max( 1, ( height + 384 ) / 768 ), context.ao, context.blur );
+	out.passMs[REPLAY_BLUR] = Milliseconds( start );
+
+	start = Clock::now();
+	context.color.resize( ( size_t )width * height );
+	context.composite = SelectComposite( frame.textureToRender, frame.ambientOcclusion );
+	RunParallel( context, height, context.rowsPerJob, CompositeBand );
+	out.passMs[REPLAY_COMPOSITE] = Milliseconds( start );
+
+	out.totalMs = 0.0;
+	for( int p = 0; p < NUM_REPLAY_PASSES; ++p )
+		out.totalMs += out.passMs[p];
+	out.hash = HashImage( context.color );
+}
+
+bool ReplayCapture( JobSystem& jobs, const CpuMesh& mesh, const FrameCapture& capture, const ReplayOptions& options,
+					ReplayResult& result, string* error )
+{
+	size_t numFrames = capture.frames.size();
+	if( options.maxFrames > 0 )
+		numFrames = min( numFrames, ( size_t )options.maxFrames );
+	float scale = options.scale > 0.0f ? options.scale : ( float )max( capture.texScale, 1 );
+
+	ReplayContext context;
+	context.jobs = &jobs;
+	context.mesh = &mesh;
+	MakeRotationTable( context.rotations, 1 );
+	context.rasterStats.resize( jobs.NumWorkers() + 1 );
+
+	result.frames.assign( numFrames, ReplayFrame() );
+	result.lateFrames = 0;
+	result.width = result.height = 0;
+	memset( &result.raster, 0, sizeof( result.raster ) );
+
+	Clock::time_point begin = Clock::now();
+	for( int r = 0; r < max( options.repeat, 1 ); ++r )
+	{
+		for( size_t s = 0; s < context.rasterStats.size(); ++s )
+			memset( &context.rasterStats[s], 0, sizeof( CpuRasterStats ) );
+		context.vertexCache.Clear();		// every replay starts cold
+		context.vertexCache.ResetStats();
+
+		Clock::time_point start = Clock::now();
+		double time = 0.0;
+		for( size_t i = 0; i < numFrames; ++i )
+		{
+			const FrameInputs& frame = capture.frames[i];
+			if( i > 0 )
+				time += frame.elapsed;
+			if( options.realtime )
+				this_thread::sleep_until( start + chrono::duration_cast<Clock::duration>( chrono::duration<double>( time ) ) );
+
+			int width = max( 1, ( int )( frame.width * scale + 0.5f ) );
+			int height = max( 1, ( int )( frame.height * scale + 0.5f ) );
+			context.rowsPerJob = max( 8, height / ( jobs.NumWorkers() * 4 ) );
+			ReplayFrame replayed;
+			replayed.time = time;
+			ReplayFrameInputs( context, frame, width, height, replayed );
+			result.width = width;
+			result.height = height;
+
+			if( options.realtime && i + 1 < numFrames )
+			{
+				double due = ( time + capture.frames[i + 1].elapsed ) * 1000.0;
+				if( Milliseconds( start ) > due )
+					++result.lateFrames;
+			}
+
+			// the fastest of the repeats is the least disturbed by the rest of the machine
+			ReplayFrame& kept = result.frames[i];
+			if( r == 0 )
+				kept = replayed;
+			else if( replayed.hash != kept.hash )
+				return Fail( error, "frame " + to_string( i ) + " rendered differently when replayed again" );
+			else
+			{
+				for( int p = 0; p < NUM_REPLAY_PASSES; ++p )
+					kept.passMs[p] = min( kept.passMs[p], replayed.passMs[p] );
+				kept.totalMs = min( kept.totalMs, replayed.totalMs );
+			}
+		}
+
+		if( r == 0 )
+		{
+			for( size_t s = 0; s < context.rasterStats.size(); ++s )
+			{
+				const CpuRasterStats& stats = context.rasterStats[s];
+				result.raster.triangles += stats.triangles;
+				result.raster.culled += stats.culled;
+				result.raster.clipped += stats.clipped;
+				result.raster.pixels += stats.pixels;
+			}
+			result.vertices = context.vertexCache.GetStats();
+		}
+	}
+	result.wallMs = Milliseconds( begin );
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+// Timing files
+//--------------------------------------------------------------------------------------
+bool WriteReplayTimings( const string& path, const ReplayResult& result, const vector<string>& header, string* error )
+{
+	FILE* file = fopen( path.c_str(), "w" );
+	if( !file )
+		return Fail( error, "can't write " + path );
+	for( size_t i = 0; i < header.size(); ++i )
+		fprintf( file, "# %s\n", header[i].c_str() );
+	fprintf( file, "frame,time" );
+	for( int p = 0; p <= NUM_REPLAY_PASSES; ++p )
+		fprintf( file, ",%s", ReplayPassName( p ) );
+	fprintf( file, ",hash\n" );
+	for( size_t i = 0; i < result.frames.size(); ++i )
+	{
+		const ReplayFrame& frame = result.frames[i];
+		fprintf( file, "%u,%.4f", ( unsigned int )i, frame.time );
+		for( int p = 0; p < NUM_REPLAY_PASSES; ++p )
+			fprintf( file, ",%.4f", frame.passMs[p] );
+		fprintf( file, ",%.4f,%08x\n", frame.totalMs, frame.hash );
+	}
+	bool ok = !ferror( file );
+	if( fclose( file ) != 0 )
+		ok = false;
+	return ok ? true : Fail( error, "can't write " + path );
+}
+
+bool ReadReplayTimings( const string& path, vector<ReplayFrame>& frames, string* error )
+{
+	FILE* file = fopen( path.c_str(), "r" );
+	if( !file )
+		return Fail( error, "can't read " + path );
+	frames.clear();
+	char line[512];
+	int lineNumber = 0;
+	bool ok = true;
+	while( ok && fgets( line, sizeof( line ), file ) )
+	{
+		++lineNumber;
+		if( line[0] == '#' || line[0] == '\n' || line[0] == '\r' || !strncmp( line, "frame,", 6 ) )
+			continue;
+		ReplayFrame frame;
+		unsigned int index;
+		ok = sscanf( line, "%u,%lf,%lf,%lf,%lf,%lf,%lf,%x", &index, &frame.time, &frame.passMs[REPLAY_GBUFFER],
+					 &frame.passMs[REPLAY_AO], &frame.passMs[REPLAY_BLUR], &frame.passMs[REPLAY_COMPOSITE],
+					 &frame.totalMs, &frame.hash ) == 8;
+		if( ok )
+			frames.push_back( frame );
+	}
+	fclose( file );
+	if( !ok )
+		return Fail( error, path + ":" + to_string( lineNumber ) + ": not a timing line" );
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+// Diff
+//--------------------------------------------------------------------------------------
+static double FrameMs( const ReplayFrame& frame, int pass )
+{
+	return pass < NUM_REPLAY_PASSES ? frame.passMs[pass] : frame.totalMs;
+}
+
+// p-th percentile of sorted (nearest rank)
+static double Percentile( const vector<double>& sorted, double p )
+{
+	if( sorted.empty() )
+		return 0.0;
+	size_t rank = ( size_t )ceil( p * 0.01 * sorted.size() );
+	return sorted[min( max( rank, ( size_t )1 ), sorted.size() ) - 1];
+}
+
+void DiffReplayTimings( const vector<ReplayFrame>& base, const vector<ReplayFrame>& current,
+						double thresholdPercent, double minMs, ReplayDiff& diff )
+{
+	size_t frames = min( base.size(), current.size() );
+	diff.frames = ( unsigned int )frames;
+	diff.imageMismatches = 0;
+	diff.regressed = false;
+	for( size_t i = 0; i < frames; ++i )
+		if( base[i].hash != current[i].hash )
+			++diff.imageMismatches;
+
+	vector<double> a( frames ), b( frames );
+	for( int p = 0; p <= NUM_REPLAY_PASSES; ++p )
+	{
+		ReplayPassDiff& d = diff.pass[p];
+		d.baseMean = d.newMean = 0.0;
+		d.worstFrame = -1;
+		d.worstBaseMs = d.worstNewMs = 0.0;
+		double worst = 0.0;
+		for( size_t i = 0; i < frames; ++i )
+		{
+			a[i] = FrameMs( base[i], p );
+			b[i] = FrameMs( current[i], p );
+			d.baseMean += a[i];
+			d.newMean += b[i];
+			// the same inputs on both sides, so frames compare one to one
+			if( b[i] - a[i] > worst )
+			{
+				worst = b[i] - a[i];
+				d.worstFrame = ( int )i;
+				d.worstBaseMs = a[i];
+				d.worstNewMs = b[i];
+			}
+		}
+		if( frames )
+		{
+			d.baseMean /= frames;
+			d.newMean /= frames;
+		}
+		sort( a.begin(), a.end() );
+		sort( b.begin(), b.end() );
+		d.baseMedian = Percentile( a, 50.0 );
+		d.newMedian = Percentile( b, 50.0 );
+		d.baseP95 = Percentile( a, 95.0 );
+		d.newP95 = Percentile( b, 95.0 );
+		d.change = d.baseMedian > 0.0 ? ( d.newMedian / d.baseMedian - 1.0 ) * 100.0 : 0.0;
+		d.regressed = d.change > thresholdPercent && d.newMedian - d.baseMedian > minMs;
+		diff.regressed = diff.regressed || d.regressed;
+	}
+}
@@ -0,0 +1,100 @@
+//--------------------------------------------------------------------------------------
+// File: FrameReplay.h
+//
+// Replays a FrameCapture headless through the CPU passes: the G-buffer of g_Camera,
+// g_World and the puffiness, the AO technique of the frame (pyramid and temporal have
+// no CPU port and run as simple SSAO), the blur and the composite of _textureToRender.
+// The quad cameras are in the capture but the CPU passes are screen space and don't
+// need them. Frames run one after another, each pass split over the JobSystem where
+// it can be, either as fast as possible or each at its recorded time. The vertices go
+// through a VertexCache, so frames where neither the camera, the world nor the
+// puffiness moved skip the vertex work like the sample's would.
+//
+// Every frame gets its per-pass milliseconds and a hash of its image, so two builds
+// replaying the same capture can be compared pass by pass (DiffReplayTimings) and
+// checked to render the same thing. Timings go to CSV files, one line per frame:
+//   frame,time,gbuffer,ao,blur,composite,total,hash
+// with '#' lines for what was replayed.
+//--------------------------------------------------------------------------------------
+#pragma once
+
+#include "CpuRaster.h"
+#include "FrameCapture.h"
+#include "JobSystem.h"
+#include "VertexCache.h"
+
+#include <string>
+#include <vector>
+
+enum ReplayPass
+{
+	REPLAY_GBUFFER = 0,
+	REPLAY_AO,
+	REPLAY_BLUR,
+	REPLAY_COMPOSITE,
+	NUM_REPLAY_PASSES
+};
+
+const char* ReplayPassName( int pass );		// "total" for NUM_REPLAY_PASSES
+
+struct ReplayOptions
+{
+	bool	realtime;		// start every frame at its recorded time
+	float	scale;			// render at the window size times this; 0: the capture's texScale
+	int		repeat;			// replay this many times and keep the fastest time of every pass
+	int		maxFrames;		// 0: all
+
+	ReplayOptions() : realtime( false ), scale( 0.0f ), repeat( 1 ), maxFrames( 0 ) {}
+};
+
+struct ReplayFrame
+{
+	double			time;						// recorded, seconds from the first frame
+	double			passMs[NUM_REPLAY_PASSES];
+	double			totalMs;
+	unsigned int	hash;						// FNV-1a of the 8-bit image
+};
+
+struct ReplayResult
+{
+	std::vector<ReplayFrame>	frames;
+	double						wallMs;
+	unsigned int				lateFrames;		// realtime: finished after the next frame was due
+	int							width, height;	// of the last frame
+	CpuRasterStats				raster;			// summed over the frames of one replay
+	VertexCache::Stats			vertices;		// of one replay
+};
+
+bool ReplayCapture( JobSystem& jobs, const CpuMesh& mesh, const FrameCapture& capture, const ReplayOptions& options,
+					ReplayResult& result, std::string* error = NULL );
+
+// CSV of the frames; header lines are written as "# line"
+bool WriteReplayTimings( const std::string& path, const ReplayResult& result, const std::vector<std::string>& header,
+						 std::string* error = NULL );
+bool ReadReplayTimings( const std::string& path, std::vector<ReplayFrame>& frames, std::string* error = NULL );
+
+//--------------------------------------------------------------------------------------
+// Comparing two replays of the same capture
+//--------------------------------------------------------------------------------------
+struct ReplayPassDiff
+{
+	double	baseMean, newMean;
+	double	baseMedian, newMedian;
+	double	baseP95, newP95;
+	double	change;				// of the median, percent
+	int		worstFrame;			// the frame that slowed down the most
+	double	worstBaseMs, worstNewMs;
+	bool	regressed;
+};
+
+struct ReplayDiff
+{
+	ReplayPassDiff	pass[NUM_REPLAY_PASSES + 1];	// the passes, then the whole frame
+	unsigned int	frames;							// compared (the shorter of the two)
+	unsigned int	imageMismatches;				// frames whose hashes differ
+	bool			regressed;						// any pass
+};
+
+// A pass regresses when its median is more than thresholdPercent and minMs slower
+void DiffReplayTimings( const std::vector<ReplayFrame>& base, const std::vector<ReplayFrame>& current,
+						double thresholdPercent, double minMs, ReplayDiff& diff );
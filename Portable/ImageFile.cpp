@@ -0,0 +1,717 @@
+//--------------------------------------------------------------------------------------
+// File: ImageFile.cpp
+//
+// Reading source images for the tools, and writing what they make
+//--------------------------------------------------------------------------------------
+#include "ImageFile.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+static bool ReadAll( const string& path, vector<unsigned char>& bytes )
+{
+	FILE* file = fopen( path.c_str(), "rb" );
+	if( !file )
+		return false;
+	fseek( file, 0, SEEK_END );
+	long size = ftell( file );
+	fseek( file, 0, SEEK_SET );
+	bytes.resize( size > 0 ? ( size_t )size : 0 );
+	bool ok = size > 0 && fread( &bytes[0], 1, bytes.size(), file ) == bytes.size();
+	fclose( file );
+	return ok;
+}
+
+static bool Fail( string* error, const string& message )
+{
+	if( error )
+		*error = message;
+	return false;
+}
+
+//--------------------------------------------------------------------------------------
+// Inflate (RFC 1951) behind a zlib header (RFC 1950)
+//--------------------------------------------------------------------------------------
+struct BitReader
+{
+	const unsigned char*	data;
+	size_t					size, pos;
+	unsigned int			bits;
+	int						count;
+
+	int Bits( int n )					// -1 past the end
+	{
+		while( count < n )
+		{
+			if( pos >= size )
+				return -1;
+			bits |= ( unsigned int )data[pos++] << count;
+			count += 8;
+		}
+		int value = ( int )( bits & ( ( 1u << n ) - 1 ) );
+		bits >>= n;
+		count -= n;
+		return value;
+	}
+};
+
+// Canonical Huffman code: symbols sorted by code length
+struct Huffman
+{
+	short	counts[16];
+	short	symbols[288];
+
+	bool Build( const unsigned char* lengths, int n )
+	{
+		memset( counts, 0, sizeof( counts ) );
+		for( int i = 0; i < n; ++i )
+			++counts[lengths[i]];
+		short offsets[16];
+		offsets[1] = 0;
+		for( int len = 1; len < 15; ++len )
+			offsets[len + 1] = offsets[len] + counts[len];
+		for( int i = 0; i < n; ++i )
+			if( lengths[i] )
+				symbols[offsets[lengths[i]]++] = ( short )i;
+		return true;
+	}
+
+	int Decode( BitReader& in ) const
+	{
+		int code = 0, first = 0, index = 0;
+		for( int len = 1; len < 16; ++len )
+		{
+			int bit = in.Bits( 1 );
+			if( bit < 0 )
+				return -1;
+			code |= bit;
+			int count = counts[len];
+			if( code - count < first )
+				return symbols[index + ( code - first )];
+			index += count;
+			first += count;
+			first <<= 1;
+			code <<= 1;
+		}
+		return -1;
+	}
+};
+
+static const short lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const short lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const short distBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const short distExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+static bool InflateBlock( BitReader& in, const Huffman& lengths, const Huffman& distances, vector<unsigned char>& out )
+{
+	for( ;; )
+	{
+		int symbol = lengths.Decode( in );
+		if( symbol < 0 )
+			return false;
+		if( symbol < 256 )
+			out.push_back( ( unsigned char )symbol );
+		else if( symbol == 256 )
+			return true;
+		else
+		{
+			symbol -= 257;
+			if( symbol >= 29 )
+				return false;
+			int extra = in.Bits( lengthExtra[symbol] );
+			int dist = distances.Decode( in );
+			if( extra < 0 || dist < 0 || dist >= 30 )
+				return false;
+			int length = lengthBase[symbol] + extra;
+			int distExtraBits = in.Bits( distExtra[dist] );
+			if( distExtraBits < 0 )
+				return false;
+			size_t back = ( size_t )( distBase[dist] + distExtraBits );
+			if( back > out.size() )
+				return false;
+			size_t from = out.size() - back;
+			for( int i = 0; i < length; ++i )
+				out.push_back( out[from + i] );
+		}
+	}
+}
+
+bool Inflate( const unsigned char* data, size_t size, vector<unsigned char>& out )
+{
+	if( size < 2 || ( data[0] & 0x0f ) != 8 || ( ( data[0] << 8 ) | data[1] ) % 31 != 0 || ( data[1] & 0x20 ) )
+		return false;
+	BitReader in = { data, size, 2, 0, 0 };
+
+	for( ;; )
+	{
+		int last = in.Bits( 1 );
+		int type = in.Bits( 2 );
+		if( last < 0 || type < 0 )
+			return false;
+
+		if( type == 0 )
+		{
+			// stored: byte aligned length, ~length, bytes
+			in.bits = 0;
+			in.count = 0;
+			if( in.pos + 4 > in.size )
+				return false;
+			unsigned int len = in.data[in.pos] | ( in.data[in.pos + 1] << 8 );
+			unsigned int nlen = in.data[in.pos + 2] | ( in.data[in.pos + 3] << 8 );
+			in.pos += 4;
+			if( len != ( ~nlen & 0xffff ) || in.pos + len > in.size )
+				return false;
+			out.insert( out.end(), in.data + in.pos, in.data + in.pos + len );
+			in.pos += len;
+		}
+		else if( type == 1 )
+		{
+			unsigned char lengths[288];
+			for( int i = 0; i < 144; ++i ) lengths[i] = 8;
+			for( int i = 144; i < 256; ++i ) lengths[i] = 9;
+			for( int i = 256; i < 280; ++i ) lengths[i] = 7;
+			for( int i = 280; i < 288; ++i ) lengths[i] = 8;
+			Huffman literals, distances;
+			literals.Build( lengths, 288 );
+			memset( lengths, 5, 30 );
+			distances.Build( lengths, 30 );
+			if( !InflateBlock( in, literals, distances, out ) )
+				return false;
+		}
+		else if( type == 2 )
+		{
+			int nlen = in.Bits( 5 ) + 257;
+			int ndist = in.Bits( 5 ) + 1;
+			int ncode = in.Bits( 4 ) + 4;
+			if( nlen > 286 || ndist > 30 || ncode < 4 )
+				return false;
+			static const unsigned char order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+			unsigned char lengths[320];
+			memset( lengths, 0, sizeof( lengths ) );
+			for( int i = 0; i < ncode; ++i )
+			{
+				int len = in.Bits( 3 );
+				if( len < 0 )
+					return false;
+				lengths[order[i]] = ( unsigned char )len;
+			}
+			Huffman codes;
+			codes.Build( lengths, 19 );
+			memset( lengths, 0, sizeof( lengths ) );
+			for( int i = 0; i < nlen + ndist; )
+			{
+				int symbol = codes.Decode( in );
+				if( symbol < 0 )
+					return false;
+				if( symbol < 16 )
+				{
+					lengths[i++] = ( unsigned char )symbol;
+					continue;
+				}
+				int repeat, value = 0;
+				if( symbol == 16 )
+				{
+					if( i == 0 )
+						return false;
+					value = lengths[i - 1];
+					repeat = 3 + in.Bits( 2 );
+				}
+				else if( symbol == 17 )
+					repeat = 3 + in.Bits( 3 );
+				else
+					repeat = 11 + in.Bits( 7 );
+				if( repeat < 3 || i + repeat > nlen + ndist )
+					return false;
+				while( repeat-- )
+					lengths[i++] = ( unsigned char )value;
+			}
+			Huffman literals, distances;
+			literals.Build( lengths, nlen );
+			distances.Build( lengths + nlen, ndist );
+			if( !InflateBlock( in, literals, distances, out ) )
+				return false;
+		}
+		else
+			return false;
+
+		if( last )
+			return true;
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// PNG
+//--------------------------------------------------------------------------------------
+static unsigned int BigEndian32( const unsigned char* p )
+{
+	return ( ( unsigned int )p[0] << 24 ) | ( p[1] << 16 ) | ( p[2] << 8 ) | p[3];
+}
+
+static int Paeth( int a, int b, int c )
+{
+	int p = a + b - c;
+	int pa = abs( p - a ), pb = abs( p - b ), pc = abs( p - c );
+	if( pa <= pb && pa <= pc )
+		return a;
+	return pb <= pc ? b : c;
+}
+
+static bool LoadPNG( const vector<unsigned char>& file, Image& image, string* error )
+{
+	static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	if( file.size() < 8 || memcmp( &file[0], signature, 8 ) != 0 )
+		return Fail( error, "not a PNG" );
+
+	int width = 0, height = 0, depth = 0, colorType = 0;
+	vector<unsigned char> idat, palette, transparency;
+	for( size_t pos = 8; pos + 12 <= file.size(); )
+	{
+		unsigned int length = BigEndian32( &file[pos] );
+		const unsigned char* type = &file[pos + 4];
+		const unsigned char* data = &file[pos + 8];
+		if( pos + 12 + length > file.size() )
+			return Fail( error, "truncated PNG" );
+		if( !memcmp( type, "IHDR", 4 ) && length >= 13 )
+		{
+			width = ( int )BigEndian32( data );
+			height = ( int )BigEndian32( data + 4 );
+			depth = data[8];
+			colorType = data[9];
+			if( data[12] != 0 )
+				return Fail( error, "interlaced PNGs are not supported" );
+		}
+		else if( !memcmp( type, "PLTE", 4 ) )
+			palette.assign( data, data + length );
+		else if( !memcmp( type, "tRNS", 4 ) )
+			transparency.assign( data, data + length );
+		else if( !memcmp( type, "IDAT", 4 ) )
+			idat.insert( idat.end(), data, data + length );
+		else if( !memcmp( type, "IEND", 4 ) )
+			break;
+		pos += 12 + length;
+	}
+
+	static const int channelsOf[7] = { 1, 0, 3, 1, 2, 0, 4 };
+	if( width <= 0 || height <= 0 || colorType > 6 || !channelsOf[colorType] ||
+		( depth != 1 && depth != 2 && depth != 4 && depth != 8 && depth != 16 ) ||
+		( depth < 8 && colorType != 0 && colorType != 3 ) || ( colorType == 3 && depth == 16 ) )
+		return Fail( error, "unsupported PNG format" );
+
+	vector<unsigned char> raw;
+	if( !Inflate( idat.empty() ? NULL : &idat[0], idat.size(), raw ) )
+		return Fail( error, "damaged PNG data" );
+
+	const int channels = channelsOf[colorType];
+	const size_t bpp = max( 1, channels * depth / 8 );			// filter distance in bytes
+	const size_t stride = ( ( size_t )width * channels * depth + 7 ) / 8;
+	if( raw.size() < ( stride + 1 ) * height )
+		return Fail( error, "truncated PNG data" );
+
+	// undo the filters in place
+	vector<unsigned char> prior( stride, 0 );
+	vector<unsigned char> pixels( stride * height );
+	for( int y = 0; y < height; ++y )
+	{
+		int filter = raw[y * ( stride + 1 )];
+		unsigned char* row = &pixels[y * stride];
+		memcpy( row, &raw[y * ( stride + 1 ) + 1], stride );
+		for( size_t i = 0; i < stride; ++i )
+		{
+			int a = i >= bpp ? row[i - bpp] : 0;
+			int b = prior[i];
+			int c = i >= bpp ? prior[i - bpp] : 0;
+			switch( filter )
+			{
+			case 0: break;
+			case 1: row[i] = ( unsigned char )( row[i] + a ); break;
+			case 2: row[i] = ( unsigned char )( row[i] + b ); break;
+			case 3: row[i] = ( unsigned char )( row[i] + ( ( a + b ) >> 1 ) ); break;
+			case 4: row[i] = ( unsigned char )( row[i] + Paeth( a, b, c ) ); break;
+			default: return Fail( error, "bad PNG filter" );
+			}
+		}
+		memcpy( &prior[0], row, stride );
+	}
+
+	image.width = width;
+	image.height = height;
+	image.rgba.resize( ( size_t )width * height * 4 );
+	for( int y = 0; y < height; ++y )
+	{
+		const unsigned char* row = &pixels[y * stride];
+		for( int x = 0; x < width; ++x )
+		{
+			// channel c of this pixel, scaled to 8 bits
+			int v[4] = { 0, 0, 0, 255 };
+			for( int c = 0; c < channels; ++c )
+			{
+				if( depth == 16 )
+					v[c] = row[( x * channels + c ) * 2];
+				else if( depth == 8 )
+					v[c] = row[x * channels + c];
+				else
+				{
+					int bit = x * depth;
+					v[c] = ( row[bit >> 3] >> ( 8 - depth - ( bit & 7 ) ) ) & ( ( 1 << depth ) - 1 );
+					if( colorType == 0 )
+						v[c] = v[c] * 255 / ( ( 1 << depth ) - 1 );
+				}
+			}
+			unsigned char* out = &image.rgba[( ( size_t )y * width + x ) * 4];
+			switch( colorType )
+			{
+			case 0: out[0] = out[1] = out[2] = ( unsigned char )v[0]; out[3] = 255; break;
+			case 4: out[0] = out[1] = out[2] = ( unsigned char )v[0]; out[3] = ( unsigned char )v[1]; break;
+			case 2: out[0] = ( unsigned char )v[0]; out[1] = ( unsigned char )v[1]; out[2] = ( unsigned char )v[2]; out[3] = 255; break;
+			case 6: for( int c = 0; c < 4; ++c ) out[c] = ( unsigned char )v[c]; break;
+			case 3:
+				if( ( size_t )v[0] * 3 + 2 >= palette.size() )
+					return Fail( error, "bad PNG palette index" );
+				out[0] = palette[v[0] * 3];
+				out[1] = palette[v[0] * 3 + 1];
+				out[2] = palette[v[0] * 3 + 2];
+				out[3] = ( size_t )v[0] < transparency.size() ? transparency[v[0]] : 255;
+				break;
+			}
+		}
+	}
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+// TGA (types 2 and 10, 24/32 bit)
+//--------------------------------------------------------------------------------------
+static bool LoadTGA( const vector<unsigned char>& file, Image& image, string* error )
+{
+	if( file.size() < 18 )
+		return Fail( error, "not a TGA" );
+	int idLength = file[0], colorMapType = file[1], type = file[2];
+	int width = file[12] | ( file[13] << 8 );
+	int height = file[14] | ( file[15] << 8 );
+	int bits = file[16];
+	bool topDown = ( file[17] & 0x20 ) != 0;
+	if( colorMapType != 0 || ( type != 2 && type != 10 ) || ( bits != 24 && bits != 32 ) || width <= 0 || height <= 0 )
+		return Fail( error, "unsupported TGA format" );
+
+	const int bytes = bits / 8;
+	const size_t count = ( size_t )width * height;
+	image.width = width;
+	image.height = height;
+	image.rgba.resize( count * 4 );
+	size_t pos = 18 + idLength;
+	for( size_t i = 0; i < count; )
+	{
+		int run = 1;
+		bool repeat = false;
+		if( type == 10 )
+		{
+			if( pos >= file.size() )
+				return Fail( error, "truncated TGA" );
+			run = ( file[pos] & 0x7f ) + 1;
+			repeat = ( file[pos] & 0x80 ) != 0;
+			++pos;
+		}
+		for( int r = 0; r < run && i < count; ++r, ++i )
+		{
+			if( pos + bytes > file.size() )
+				return Fail( error, "truncated TGA" );
+			size_t y = i / width, x = i % width;
+			if( !topDown )
+				y = height - 1 - y;
+			unsigned char* out = &image.rgba[( y * width + x ) * 4];
+			out[0] = file[pos + 2];			// stored BGR(A)
+			out[1] = file[pos + 1];
+			out[2] = file[pos];
+			out[3] = bytes == 4 ? file[pos + 3] : 255;
+			if( !repeat || r == run - 1 )
+				pos += bytes;
+		}
+	}
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+// Binary PPM (P6) and PAM (P7, RGB or RGB_ALPHA), 8 bit
+//--------------------------------------------------------------------------------------
+static bool LoadPNM( const vector<unsigned char>& file, Image& image, string* error )
+{
+	string header( file.begin(), file.begin() + min( file.size(), ( size_t )512 ) );
+	int width = 0, height = 0, maxValue = 0, channels = 3;
+	size_t dataStart = 0;
+	if( header.compare( 0, 2, "P6" ) == 0 )
+	{
+		// P6 <ws> width <ws> height <ws> maxval <single ws>
+		int fields[3], n = 0;
+		size_t pos = 2;
+		while( n < 3 && pos < header.size() )
+		{
+			if( header[pos] == '#' )
+				pos = header.find( '\n', pos );
+			else if( isdigit( ( unsigned char )header[pos] ) )
+			{
+				fields[n++] = atoi( header.c_str() + pos );
+				while( pos < header.size() && isdigit( ( unsigned char )header[pos] ) )
+					++pos;
+				continue;
+			}
+			if( pos == string::npos )
+				break;
+			++pos;
+		}
+		if( n < 3 )
+			return Fail( error, "bad PPM header" );
+		width = fields[0];
+		height = fields[1];
+		maxValue = fields[2];
+		dataStart = pos + 1;
+	}
+	else if( header.compare( 0, 2, "P7" ) == 0 )
+	{
+		size_t end = header.find( "ENDHDR\n" );
+		if( end == string::npos )
+			return Fail( error, "bad PAM header" );
+		const char* h = header.c_str();
+		const char* p;
+		if( ( p = strstr( h, "WIDTH " ) ) ) width = atoi( p + 6 );
+		if( ( p = strstr( h, "HEIGHT " ) ) ) height = atoi( p + 7 );
+		if( ( p = strstr( h, "DEPTH " ) ) ) channels = atoi( p + 6 );
+		if( ( p = strstr( h, "MAXVAL " ) ) ) maxValue = atoi( p + 7 );
+		dataStart = end + 7;
+	}
+	else
+		return Fail( error, "not a PPM/PAM" );
+
+	if( width <= 0 || height <= 0 || maxValue != 255 || ( channels != 3 && channels != 4 ) )
+		return Fail( error, "unsupported PPM/PAM format (8-bit RGB or RGBA only)" );
+	const size_t count = ( size_t )width * height;
+	if( dataStart + count * channels > file.size() )
+		return Fail( error, "truncated PPM/PAM" );
+
+	image.width = width;
+	image.height = height;
+	image.rgba.resize( count * 4 );
+	for( size_t i = 0; i < count; ++i )
+	{
+		const unsigned char* in = &file[dataStart + i * channels];
+		unsigned char* out = &image.rgba[i * 4];
+		out[0] = in[0];
+		out[1] = in[1];
+		out[2] = in[2];
+		out[3] = channels == 4 ? in[3] : 255;
+	}
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+// QOI: byte-aligned lossless RGBA, a few times faster than PNG to write and to read
+//--------------------------------------------------------------------------------------
+#define QOI_OP_INDEX	0x00
+#define QOI_OP_DIFF		0x40
+#define QOI_OP_LUMA		0x80
+#define QOI_OP_RUN		0xc0
+#define QOI_OP_RGB		0xfe
+#define QOI_OP_RGBA		0xff
+
+static inline int QoiHash( const unsigned char* p )
+{
+	return ( p[0] * 3 + p[1] * 5 + p[2] * 7 + p[3] * 11 ) & 63;
+}
+
+static void EncodeQOI( const Image& image, vector<unsigned char>& bytes )
+{
+	size_t pixels = ( size_t )image.width * image.height;
+	bytes.resize( 14 + pixels * 5 + 8 );		// worst case, trimmed below
+	unsigned char* out = &bytes[0];
+	memcpy( out, "qoif", 4 );
+	for( int i = 0; i < 4; ++i )
+	{
+		out[4 + i] = ( unsigned char )( image.width >> ( 24 - i * 8 ) );
+		out[8 + i] = ( unsigned char )( image.height >> ( 24 - i * 8 ) );
+	}
+	out[12] = 4;		// RGBA
+	out[13] = 0;		// sRGB with linear alpha
+	out += 14;
+
+	unsigned char index[64][4];
+	memset( index, 0, sizeof( index ) );
+	unsigned char prev[4] = { 0, 0, 0, 255 };
+	int run = 0;
+	for( size_t i = 0; i < pixels; ++i )
+	{
+		const unsigned char* px = &image.rgba[i * 4];
+		if( !memcmp( px, prev, 4 ) )
+		{
+			if( ++run == 62 || i + 1 == pixels )
+			{
+				*out++ = ( unsigned char )( QOI_OP_RUN | ( run - 1 ) );
+				run = 0;
+			}
+			continue;
+		}
+		if( run )
+		{
+			*out++ = ( unsigned char )( QOI_OP_RUN | ( run - 1 ) );
+			run = 0;
+		}
+
+		int hash = QoiHash( px );
+		if( !memcmp( index[hash], px, 4 ) )
+			*out++ = ( unsigned char )( QOI_OP_INDEX | hash );
+		else
+		{
+			memcpy( index[hash], px, 4 );
+			if( px[3] == prev[3] )
+			{
+				int dr = ( signed char )( px[0] - prev[0] );
+				int dg = ( signed char )( px[1] - prev[1] );
+				int db = ( signed char )( px[2] - prev[2] );
+				if( dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1 )
+					*out++ = ( unsigned char )( QOI_OP_DIFF | ( dr + 2 ) << 4 | ( dg + 2 ) << 2 | ( db + 2 ) );
+				else if( dg >= -32 && dg <= 31 && dr - dg >= -8 && dr - dg <= 7 && db - dg >= -8 && db - dg <= 7 )
+				{
+					*out++ = ( unsigned char )( QOI_OP_LUMA | ( dg + 32 ) );
+					*out++ = ( unsigned char )( ( dr - dg + 8 ) << 4 | ( db - dg + 8 ) );
+				}
+				else
+				{
+					*out++ = QOI_OP_RGB;
+					memcpy( out, px, 3 );
+					out += 3;
+				}
+			}
+			else
+			{
+				*out++ = QOI_OP_RGBA;
+				memcpy( out, px, 4 );
+				out += 4;
+			}
+		}
+		memcpy( prev, px, 4 );
+	}
+	static const unsigned char padding[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+	memcpy( out, padding, 8 );
+	bytes.resize( out + 8 - &bytes[0] );
+}
+
+static bool LoadQOI( const vector<unsigned char>& file, Image& image, string* error )
+{
+	if( file.size() < 22 )
+		return Fail( error, "truncated QOI" );
+	image.width = ( int )BigEndian32( &file[4] );
+	image.height = ( int )BigEndian32( &file[8] );
+	if( image.width <= 0 || image.height <= 0 || image.width > 32768 || image.height > 32768 )
+		return Fail( error, "bad QOI size" );
+	size_t pixels = ( size_t )image.width * image.height;
+	image.rgba.resize( pixels * 4 );
+
+	unsigned char index[64][4];
+	memset( index, 0, sizeof( index ) );
+	unsigned char px[4] = { 0, 0, 0, 255 };
+	const unsigned char* in = &file[14];
+	const unsigned char* end = &file[0] + file.size() - 8;
+	int run = 0;
+	for( size_t i = 0; i < pixels; ++i )
+	{
+		if( run )
+			--run;
+		else
+		{
+			if( in >= end )
+				return Fail( error, "truncated QOI" );
+			int op = *in++;
+			if( op == QOI_OP_RGB || op == QOI_OP_RGBA )
+			{
+				int n = op == QOI_OP_RGB ? 3 : 4;
+				if( in + n > end )
+					return Fail( error, "truncated QOI" );
+				memcpy( px, in, n );
+				in += n;
+			}
+			else if( ( op & 0xc0 ) == QOI_OP_INDEX )
+				memcpy( px, index[op], 4 );
+			else if( ( op & 0xc0 ) == QOI_OP_DIFF )
+			{
+				px[0] = ( unsigned char )( px[0] + ( ( op >> 4 ) & 3 ) - 2 );
+				px[1] = ( unsigned char )( px[1] + ( ( op >> 2 ) & 3 ) - 2 );
+				px[2] = ( unsigned char )( px[2] + ( op & 3 ) - 2 );
+			}
+			else if( ( op & 0xc0 ) == QOI_OP_LUMA )
+			{
+				if( in >= end )
+					return Fail( error, "truncated QOI" );
+				int dg = ( op & 63 ) - 32;
+				int next = *in++;
+				px[0] = ( unsigned char )( px[0] + dg - 8 + ( next >> 4 ) );
+				px[1] = ( unsigned char )( px[1] + dg );
+				px[2] = ( unsigned char )( px[2] + dg - 8 + ( next & 15 ) );
+			}
+			else
+				run = op & 63;
+			memcpy( index[QoiHash( px )], px, 4 );
+		}
+		memcpy( &image.rgba[i * 4], px, 4 );
+	}
+	return true;
+}
+
+bool LoadImageFile( const string& path, Image& image, string* error )
+{
+	vector<unsigned char> file;
+	if( !ReadAll( path, file ) )
+		return Fail( error, "can't read " + path );
+	if( file.size() >= 8 && file[0] == 0x89 && file[1] == 'P' )
+		return LoadPNG( file, image, error );
+	if( file.size() >= 4 && !memcmp( &file[0], "qoif", 4 ) )
+		return LoadQOI( file, image, error );
+	if( file[0] == 'P' && ( file[1] == '6' || file[1] == '7' ) )
+		return LoadPNM( file, image, error );
+	return LoadTGA( file, image, error );
+}
+
+static bool HasExtension( const string& path, const char* extension )
+{
+	size_t length = strlen( extension );
+	return path.size() >= length && path.compare( path.size() - length, length, extension ) == 0;
+}
+
+void EncodeImageFile( const string& path, const Image& image, vector<unsigned char>& bytes )
+{
+	if( HasExtension( path, ".qoi" ) )
+	{
+		EncodeQOI( image, bytes );
+		return;
+	}
+
+	bool pam = HasExtension( path, ".pam" );
+	size_t pixels = ( size_t )image.width * image.height;
+	char header[128];
+	int headerSize = pam ? sprintf( header, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n",
+									image.width, image.height )
+						 : sprintf( header, "P6\n%d %d\n255\n", image.width, image.height );
+	bytes.assign( header, header + headerSize );
+	if( pam )
+		bytes.insert( bytes.end(), image.rgba.begin(), image.rgba.begin() + pixels * 4 );
+	else
+	{
+		bytes.resize( headerSize + pixels * 3 );
+		unsigned char* out = &bytes[headerSize];
+		for( size_t i = 0; i < pixels; ++i, out += 3 )
+			memcpy( out, &image.rgba[i * 4], 3 );
+	}
+}
+
+bool SaveImageFile( const string& path, const Image& image )
+{
+	vector<unsigned char> bytes;
+	EncodeImageFile( path, image, bytes );
+	FILE* file = fopen( path.c_str(), "wb" );
+	if( !file )
+		return false;
+	bool ok = fwrite( &bytes[0], 1, bytes.size(), file ) == bytes.size();
+	return fclose( file ) == 0 && ok;
+}
@@ -0,0 +1,29 @@
+//--------------------------------------------------------------------------------------
+// File: ImageFile.h
+//
+// Reading source images for the tools: PNG (non-interlaced), TGA (uncompressed or RLE),
+// binary PPM/PAM and QOI, all converted to 8-bit RGBA. Writing: PPM/PAM and QOI (the
+// fast lossless one for outputs written every frame).
+//--------------------------------------------------------------------------------------
+#pragma once
+
+#include <string>
+#include <vector>
+
+struct Image
+{
+	int							width, height;
+	std::vector<unsigned char>	rgba;			// width * height * 4, top row first
+
+	Image() : width( 0 ), height( 0 ) {}
+};
+
+bool LoadImageFile( const std::string& path, Image& image, std::string* error = NULL );
+
+// QOI (RGBA) for a .qoi path, binary PAM (RGBA) for .pam, else binary PPM (RGB, alpha
+// dropped). Encode replaces bytes with the file.
+void EncodeImageFile( const std::string& path, const Image& image, std::vector<unsigned char>& bytes );
+bool SaveImageFile( const std::string& path, const Image& image );
+
+// zlib stream -> bytes (used by the PNG reader)
+bool Inflate( const unsigned char* data, size_t size, std::vector<unsigned char>& out );
@@ -0,0 +1,511 @@
+//--------------------------------------------------------------------------------------
+// File: JobSystem.cpp
+//
+// The deques follow Le, Pop, Cohen and Zappa Nardelli, "Correct and Efficient
+// Work-Stealing for Weak Memory Models" (PPoPP 2013)
+//--------------------------------------------------------------------------------------
+#include "JobSystem.h"
+
+#include <algorithm>
+
+using namespace std;
+
+#define JOB_DEQUE_SIZE 4096							// jobs queued per worker (power of 2)
+#define JOB_POOL_SIZE ( JOB_DEQUE_SIZE * 2 )		// more than can be queued: a free one is always near
+#define JOB_SPINS 64								// failed searches before yielding
+#define JOB_YIELDS 16								// yields before sleeping
+
+// which worker of which system the calling thread is
+static thread_local const JobSystem* t_system = NULL;
+static thread_local int t_worker = -1;
+
+static unsigned int XorShift( unsigned int& state )
+{
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+//--------------------------------------------------------------------------------------
+// Deque: the owner pushes and pops at the bottom, thieves take from the top
+//--------------------------------------------------------------------------------------
+JobSystem::Worker::Worker() : top( 0 ), bottom( 0 ), slots( JOB_DEQUE_SIZE ), pool( JOB_POOL_SIZE ), poolNext( 0 ),
+	random( 0 ), jobs( 0 ), steals( 0 ), failedSteals( 0 ), sleeps( 0 )
+{
+	for( size_t i = 0; i < pool.size(); ++i )
+		pool[i].queued.store( false, memory_order_relaxed );
+}
+
+bool JobSystem::Worker::Push( Job* job )
+{
+	long long b = bottom.load( memory_order_relaxed );
+	long long t = top.load( memory_order_acquire );
+	if( b - t >= JOB_DEQUE_SIZE )
+		return false;
+	slots[b & ( JOB_DEQUE_SIZE - 1 )].store( job, memory_order_release );		// publishes the job's fields
+	atomic_thread_fence( memory_order_release );
+	bottom.store( b + 1, memory_order_relaxed );
+	return true;
+}
+
+JobSystem::Job* JobSystem::Worker::Pop()
+{
+	long long b = bottom.load( memory_order_relaxed ) - 1;
+	bottom.store( b, memory_order_relaxed );
+	atomic_thread_fence( memory_order_seq_cst );
+	long long t = top.load( memory_order_relaxed );
+	if( t > b )
+	{
+		bottom.store( b + 1, memory_order_relaxed );
+		return NULL;
+	}
+	Job* job = slots[b & ( JOB_DEQUE_SIZE - 1 )].load( memory_order_relaxed );
+	if( t == b )
+	{
+		// the last one: race the thieves for it
+		if( !top.compare_exchange_strong( t, t + 1, memory_order_seq_cst, memory_order_relaxed ) )
+			job = NULL;
+		bottom.store( b + 1, memory_order_relaxed );
+	}
+	return job;
+}
+
+JobSystem::Job* JobSystem::Worker::Steal( bool& lost )
+{
+	long long t = top.load( memory_order_acquire );
+	atomic_thread_fence( memory_order_seq_cst );
+	long long b = bottom.load( memory_order_acquire );
+	lost = false;
+	if( t >= b )
+		return NULL;
+	Job* job = slots[t & ( JOB_DEQUE_SIZE - 1 )].load( memory_order_acquire );
+	if( !top.compare_exchange_strong( t, t + 1, memory_order_seq_cst, memory_order_relaxed ) )
+	{
+		lost = true;
+		return NULL;
+	}
+	return job;
+}
+
+//--------------------------------------------------------------------------------------
+// Scheduler
+//--------------------------------------------------------------------------------------
+JobSystem::JobSystem( int numWorkers ) : _quit( false ), _injectPool( JOB_POOL_SIZE ), _injectNext( 0 ),
+	_injectedCount( 0 ), _externalJobs( 0 ), _sleepers( 0 )
+{
+	if( numWorkers <= 0 )
+		numWorkers = max( 1, ( int )thread::hardware_concurrency() );
+	for( size_t i = 0; i < _injectPool.size(); ++i )
+		_injectPool[i].queued.store( false, memory_order_relaxed );
+	for( int i = 0; i < numWorkers; ++i )
+	{
+		_workers.push_back( new Worker() );
+		_workers[i]->random = 2463534242u + i * 2654435761u;
+	}
+
+	t_system = this;
+	t_worker = 0;
+	for( int i = 1; i < numWorkers; ++i )
+		_threads.push_back( thread( &JobSystem::WorkerLoop, this, i ) );
+}
+
+JobSystem::~JobSystem()
+{
+	_quit = true;
+	{
+		lock_guard<mutex> lock( _sleepMutex );
+		_wake.notify_all();
+	}
+	for( size_t i = 0; i < _threads.size(); ++i )
+		_threads[i].join();
+	for( size_t i = 0; i < _workers.size(); ++i )
+		delete _workers[i];
+	if( t_system == this )
+		t_system = NULL;
+}
+
+int JobSystem::WorkerIndex() const
+{
+	return t_system == this ? t_worker : -1;
+}
+
+// A free pool entry of worker (its own thread only), or of the injection pool (under
+// _injectMutex). NULL when every entry is queued: entries are freed by threads that
+// need the mutex to take them, so waiting here could never end.
+JobSystem::Job* JobSystem::NewJob( int worker )
+{
+	vector<Job>& pool = worker >= 0 ? _workers[worker]->pool : _injectPool;
+	unsigned int& next = worker >= 0 ? _workers[worker]->poolNext : _injectNext;
+	for( int i = 0; i < JOB_POOL_SIZE; ++i )
+	{
+		Job* job = &pool[next++ & ( JOB_POOL_SIZE - 1 )];
+		if( !job->queued.load( memory_order_acquire ) )
+		{
+			job->queued.store( true, memory_order_relaxed );
+			return job;
+		}
+	}
+	return NULL;
+}
+
+void JobSystem::Queue( int worker, Job* job )
+{
+	if( worker >= 0 )
+	{
+		if( !_workers[worker]->Push( job ) )
+		{
+			Execute( job );			// deque full: run it now
+			return;
+		}
+	}
+	else
+	{
+		lock_guard<mutex> lock( _injectMutex );
+		_injected.push_back( job );
+		++_injectedCount;
+	}
+
+	// pairs with the fence in WorkerLoop: either we see the sleeper or it sees the job
+	atomic_thread_fence( memory_order_seq_cst );
+	if( _sleepers.load( memory_order_relaxed ) > 0 )
+	{
+		lock_guard<mutex> lock( _sleepMutex );
+		_wake.notify_one();
+	}
+}
+
+void JobSystem::Run( JobFunc func, void* data, int begin, int end, JobCounter* counter )
+{
+	int worker = WorkerIndex();
+	Job* job;
+	if( worker >= 0 )
+		job = NewJob( worker );
+	else
+	{
+		lock_guard<mutex> lock( _injectMutex );
+		job = NewJob( -1 );
+	}
+	Job inlineJob;
+	if( !job )
+		job = &inlineJob;		// pool full: run it now, as Queue does for a full deque
+	job->func = func;
+	job->data = data;
+	job->begin = begin;
+	job->end = end;
+	job->grain = 0;
+	job->counter = counter;
+	if( counter )
+		counter->pending.fetch_add( 1, memory_order_relaxed );
+	if( job == &inlineJob )
+		Execute( job );
+	else
+		Queue( worker, job );
+}
+
+void JobSystem::ParallelFor( int begin, int end, int grain, JobFunc func, void* data, JobCounter* counter )
+{
+	if( begin >= end )
+		return;
+	int worker = WorkerIndex();
+	Job* job;
+	if( worker >= 0 )
+		job = NewJob( worker );
+	else
+	{
+		lock_guard<mutex> lock( _injectMutex );
+		job = NewJob( -1 );
+	}
+	Job inlineJob;
+	if( !job )
+		job = &inlineJob;		// pool full: run it now, as Queue does for a full deque
+	job->func = func;
+	job->data = data;
+	job->begin = begin;
+	job->end = end;
+	job->grain = max( grain, 1 );
+	job->counter = counter;
+	if( counter )
+		counter->pending.fetch_add( 1, memory_order_relaxed );
+	if( job == &inlineJob )
+		Execute( job );
+	else
+		Queue( worker, job );
+}
+
+JobSystem::Job* JobSystem::FindJob( int worker, unsigned int& random )
+{
+	if( worker >= 0 )
+	{
+		Job* job = _workers[worker]->Pop();
+		if( job )
+			return job;
+	}
+	if( _injectedCount.load( memory_order_relaxed ) > 0 )
+	{
+		lock_guard<mutex> lock( _injectMutex );
+		if( !_injected.empty() )
+		{
+			Job* job = _injected.front();
+			_injected.pop_front();
+			--_injectedCount;
+			return job;
+		}
+	}
+
+	// steal, starting at a random victim
+	int count = ( int )_workers.size();
+	int first = ( int )( XorShift( random ) % ( unsigned int )count );
+	for( int i = 0; i < count; ++i )
+	{
+		int victim = ( first + i ) % count;
+		if( victim == worker )
+			continue;
+		bool lost;
+		Job* job = _workers[victim]->Steal( lost );
+		Worker& stats = *_workers[worker >= 0 ? worker : 0];
+		if( job )
+		{
+			stats.steals.fetch_add( 1, memory_order_relaxed );
+			return job;
+		}
+		stats.failedSteals.fetch_add( 1, memory_order_relaxed );
+	}
+	return NULL;
+}
+
+void JobSystem::Execute( Job* job )
+{
+	// copy it out: the pool entry may be reused once it's released
+	Job local;
+	local.func = job->func;
+	local.data = job->data;
+	local.begin = job->begin;
+	local.end = job->end;
+	local.grain = job->grain;
+	local.counter = job->counter;
+	job->queued.store( false, memory_order_release );
+
+	// split a loop until its piece is small enough: the halves are left for thieves
+	int worker = WorkerIndex();
+	while( local.grain > 0 && local.end - local.begin > local.grain )
+	{
+		int middle = local.begin + ( local.end - local.begin ) / 2;
+		ParallelFor( middle, local.end, local.grain, local.func, local.data, local.counter );
+		local.end = middle;
+	}
+
+	local.func( local.data, local.begin, local.end );
+	if( worker >= 0 )
+		_workers[worker]->jobs.fetch_add( 1, memory_order_relaxed );
+	else
+		_externalJobs.fetch_add( 1, memory_order_relaxed );
+	if( local.counter )
+		local.counter->pending.fetch_sub( 1, memory_order_acq_rel );
+}
+
+void JobSystem::Wait( JobCounter& counter )
+{
+	int worker = WorkerIndex();
+	unsigned int random = worker >= 0 ? _workers[worker]->random : 0x9e3779b9u;
+	int idle = 0;
+	while( counter.pending.load( memory_order_acquire ) > 0 )
+	{
+		Job* job = FindJob( worker, random );
+		if( job )
+		{
+			Execute( job );
+			idle = 0;
+		}
+		else if( ++idle > JOB_SPINS )
+			this_thread::yield();
+	}
+	if( worker >= 0 )
+		_workers[worker]->random = random;
+}
+
+void JobSystem::WorkerLoop( int worker )
+{
+	t_system = this;
+	t_worker = worker;
+	unsigned int random = _workers[worker]->random;
+	int idle = 0;
+	while( !_quit.load( memory_order_relaxed ) )
+	{
+		Job* job = FindJob( worker, random );
+		if( job )
+		{
+			Execute( job );
+			idle = 0;
+			continue;
+		}
+		if( ++idle < JOB_SPINS )
+			continue;
+		if( idle < JOB_SPINS + JOB_YIELDS )
+		{
+			this_thread::yield();
+			continue;
+		}
+
+		// sleep: announce it, then look once more under the lock so a job queued
+		// in between can't be missed (the timeout is only a safety net)
+		_workers[worker]->sleeps.fetch_add( 1, memory_order_relaxed );
+		unique_lock<mutex> lock( _sleepMutex );
+		_sleepers.fetch_add( 1, memory_order_relaxed );
+		atomic_thread_fence( memory_order_seq_cst );
+		job = FindJob( worker, random );
+		if( !job && !_quit.load( memory_order_relaxed ) )
+			_wake.wait_for( lock, chrono::milliseconds( 10 ) );
+		_sleepers.fetch_sub( 1, memory_order_relaxed );
+		lock.unlock();
+		if( job )
+			Execute( job );
+		idle = 0;
+	}
+}
+
+JobSystem::Stats JobSystem::GetStats() const
+{
+	Stats stats = { _externalJobs.load(), 0, 0, 0 };
+	for( size_t i = 0; i < _workers.size(); ++i )
+	{
+		stats.jobs += _workers[i]->jobs.load();
+		stats.steals += _workers[i]->steals.load();
+		stats.failedSteals += _workers[i]->failedSteals.load();
+		stats.sleeps += _workers[i]->sleeps.load();
+	}
+	return stats;
+}
+
+void JobSystem::ResetStats()
+{
+	_externalJobs = 0;
+	for( size_t i = 0; i < _workers.size(); ++i )
+	{
+		_workers[i]->jobs = 0;
+		_workers[i]->steals = 0;
+		_workers[i]->failedSteals = 0;
+		_workers[i]->sleeps = 0;
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Frame pipeline
+//--------------------------------------------------------------------------------------
+FramePipeline::FramePipeline( JobSystem& jobs, const vector<FrameStageFunc>& stages, int framesInFlight ) :
+	_jobs( jobs ), _stages( stages ), _submitted( 0 ), _stageDone( stages.size(), -1 )
+{
+	framesInFlight = max( framesInFlight, 1 );
+	int numStages = min( ( int )stages.size(), 64 );
+	_stages.resize( numStages );
+	_stageDone.resize( numStages );
+	for( int i = 0; i < framesInFlight; ++i )
+	{
+		Slot* slot = new Slot();
+		slot->frame = NULL;
+		slot->index = 0;
+		slot->arrivals = vector<atomic<int> >( numStages );
+		_slots.push_back( slot );
+		for( int stage = 0; stage < numStages; ++stage )
+		{
+			StageJob job = { this, i, stage };
+			_stageJobs.push_back( job );
+		}
+	}
+	_stats.frames = 0;
+	_stats.latencyMs = 0.0;
+	_stats.maxLatencyMs = 0.0;
+}
+
+FramePipeline::~FramePipeline()
+{
+	Flush();
+	for( size_t i = 0; i < _slots.size(); ++i )
+		delete _slots[i];
+}
+
+void FramePipeline::WaitForSlot()
+{
+	_jobs.Wait( _slots[_submitted % _slots.size()]->pending );
+}
+
+void FramePipeline::Submit( void* frame )
+{
+	const int numStages = ( int )_stages.size();
+	const unsigned int n = _submitted;
+	const int slotIndex = ( int )( n % _slots.size() );
+	Slot& slot = *_slots[slotIndex];
+	WaitForSlot();
+	if( numStages == 0 )
+		return;
+
+	// every stage waits for the one before it and for the same stage of the last frame
+	slot.frame = frame;
+	slot.index = n;
+	slot.submitted = chrono::high_resolution_clock::now();
+	for( int stage = 0; stage < numStages; ++stage )
+		slot.arrivals[stage].store( stage > 0 ? 2 : 1, memory_order_relaxed );
+	slot.pending.pending.fetch_add( numStages, memory_order_relaxed );
+
+	// the stages the last frame already finished won't arrive by themselves
+	unsigned long long ready = 0;
+	{
+		lock_guard<mutex> lock( _mutex );
+		_submitted = n + 1;
+		for( int stage = 0; stage < numStages; ++stage )
+			if( n == 0 || _stageDone[stage] >= ( long long )n - 1 )
+				ready |= 1ull << stage;
+	}
+	for( int stage = 0; stage < numStages; ++stage )
+		if( ready & ( 1ull << stage ) )
+			Arrive( slotIndex, stage );
+}
+
+void FramePipeline::Arrive( int slot, int stage )
+{
+	if( _slots[slot]->arrivals[stage].fetch_sub( 1, memory_order_acq_rel ) == 1 )
+		_jobs.Run( RunStage, &_stageJobs[slot * _stages.size() + stage], 0, 0, NULL );
+}
+
+void FramePipeline::RunStage( void* data, int, int )
+{
+	const StageJob& job = *( const StageJob* )data;
+	FramePipeline& pipeline = *job.pipeline;
+	Slot& slot = *pipeline._slots[job.slot];
+	const unsigned int n = slot.index;
+	const int numStages = ( int )pipeline._stages.size();
+	pipeline._stages[job.stage]( pipeline._jobs, slot.frame, n );
+
+	bool nextSubmitted;
+	{
+		lock_guard<mutex> lock( pipeline._mutex );
+		pipeline._stageDone[job.stage] = n;
+		nextSubmitted = pipeline._submitted > n + 1;
+		if( job.stage == numStages - 1 )
+		{
+			double ms = chrono::duration<double, milli>( chrono::high_resolution_clock::now() - slot.submitted ).count();
+			++pipeline._stats.frames;
+			pipeline._stats.latencyMs += ms;
+			pipeline._stats.maxLatencyMs = max( pipeline._stats.maxLatencyMs, ms );
+		}
+	}
+
+	// the next frame's copy of this stage, then the next stage of this frame
+	if( nextSubmitted )
+		pipeline.Arrive( ( job.slot + 1 ) % ( int )pipeline._slots.size(), job.stage );
+	if( job.stage + 1 < numStages )
+		pipeline.Arrive( job.slot, job.stage + 1 );
+	slot.pending.pending.fetch_sub( 1, memory_order_acq_rel );		// the slot may be reused from here on
+}
+
+void FramePipeline::Flush()
+{
+	for( size_t i = 0; i < _slots.size(); ++i )
+		_jobs.Wait( _slots[i]->pending );
+}
+
+FramePipeline::Stats FramePipeline::GetStats() const
+{
+	lock_guard<mutex> lock( _mutex );
+	return _stats;
+}
@@ -0,0 +1,183 @@
+//--------------------------------------------------------------------------------------
+// File: JobSystem.h
+//
+// Work-stealing job scheduler for the CPU-side passes. Every worker owns a deque it
+// pushes and pops at the bottom; idle workers steal from the top of the others', so
+// the hot path takes no lock. Jobs report to a JobCounter; waiting on a counter runs
+// other jobs instead of blocking, so jobs can spawn children and wait for them.
+// The thread that creates the JobSystem is worker 0.
+//
+// FramePipeline runs frames as a chain of stages on top of it: stage k of frame N+1
+// only waits for stage k of frame N, so e.g. the next frame's G-buffer overlaps this
+// frame's AO and composite.
+//--------------------------------------------------------------------------------------
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs [begin, end) of a job (a single job gets the range it was queued with)
+typedef void ( *JobFunc )( void* data, int begin, int end );
+
+// Jobs still to finish. Zero-initialized; the jobs counting on it increment it when
+// queued and decrement it when done.
+struct JobCounter
+{
+	std::atomic<int>	pending;
+
+	JobCounter() : pending( 0 ) {}
+};
+
+class JobSystem
+{
+public:
+	// numWorkers includes the calling thread; 0 = one per hardware thread
+	explicit JobSystem( int numWorkers = 0 );
+	~JobSystem();
+
+	int NumWorkers() const { return ( int )_workers.size(); }
+
+	// Worker index of the calling thread, -1 if it isn't one of ours
+	int CurrentWorker() const { return WorkerIndex(); }
+
+	// Queues func( data, begin, end ) on the calling thread's deque (any thread may call)
+	void Run( JobFunc func, void* data, int begin, int end, JobCounter* counter );
+
+	// func over [begin, end) in ranges of at most grain, split in halves on demand
+	// so idle workers steal big pieces first. Returns at once; wait on counter.
+	void ParallelFor( int begin, int end, int grain, JobFunc func, void* data, JobCounter* counter );
+
+	// Runs jobs until counter reaches zero
+	void Wait( JobCounter& counter );
+
+	struct Stats
+	{
+		unsigned long long	jobs;			// jobs run
+		unsigned long long	steals;			// jobs taken from another worker's deque
+		unsigned long long	failedSteals;	// empty deques or lost races
+		unsigned long long	sleeps;			// times a worker went idle
+	};
+	Stats GetStats() const;
+	void ResetStats();
+
+private:
+	struct Job
+	{
+		JobFunc				func;
+		void*				data;
+		int					begin, end;
+		int					grain;		// > 0: split before running
+		JobCounter*			counter;
+		std::atomic<bool>	queued;		// the pool entry is taken until the job starts
+	};
+
+	// Chase-Lev deque of job pointers plus the pool its jobs come from
+	struct Worker
+	{
+		std::atomic<long long>			top, bottom;
+		std::vector<std::atomic<Job*> >	slots;
+		std::vector<Job>				pool;
+		unsigned int					poolNext;
+		unsigned int					random;
+		std::atomic<unsigned long long>	jobs, steals, failedSteals, sleeps;
+		char							pad[64];	// keeps the next worker's indices off this cache line
+
+		Worker();
+		bool Push( Job* job );
+		Job* Pop();
+		Job* Steal( bool& lost );
+	};
+
+	int WorkerIndex() const;
+	Job* NewJob( int worker );
+	void Queue( int worker, Job* job );
+	Job* FindJob( int worker, unsigned int& random );
+	void Execute( Job* job );
+	void WorkerLoop( int worker );
+
+	std::vector<Worker*>		_workers;
+	std::vector<std::thread>	_threads;
+	std::atomic<bool>			_quit;
+
+	// jobs queued from threads that aren't workers (rare: not lock-free)
+	std::mutex					_injectMutex;
+	std::deque<Job*>			_injected;
+	std::vector<Job>			_injectPool;
+	unsigned int				_injectNext;
+	std::atomic<int>			_injectedCount;
+	std::atomic<unsigned int>	_externalJobs;		// run by threads that aren't workers
+
+	// idle workers sleep here; queueing only locks when someone sleeps
+	std::mutex					_sleepMutex;
+	std::condition_variable		_wake;
+	std::atomic<int>			_sleepers;
+};
+
+//--------------------------------------------------------------------------------------
+// Frame pipelining
+//--------------------------------------------------------------------------------------
+
+// One stage of a frame; frame is the pointer passed to Submit
+typedef void ( *FrameStageFunc )( JobSystem& jobs, void* frame, unsigned int frameIndex );
+
+class FramePipeline
+{
+public:
+	// at most 64 stages
+	FramePipeline( JobSystem& jobs, const std::vector<FrameStageFunc>& stages, int framesInFlight );
+	~FramePipeline();
+
+	// Runs jobs until the frame framesInFlight before the next one is finished, so
+	// its data can be refilled for the next frame
+	void WaitForSlot();
+
+	// Starts the next frame (waits for its slot first)
+	void Submit( void* frame );
+
+	// Waits for every submitted frame
+	void Flush();
+
+	struct Stats
+	{
+		unsigned int	frames;			// completed
+		double			latencyMs;		// total submit -> last stage done
+		double			maxLatencyMs;
+	};
+	Stats GetStats() const;
+
+private:
+	struct Slot
+	{
+		void*								frame;
+		unsigned int						index;
+		std::vector<std::atomic<int> >		arrivals;	// per stage: dependencies still missing
+		JobCounter							pending;	// stage jobs not finished
+		std::chrono::high_resolution_clock::time_point	submitted;
+	};
+
+	struct StageJob
+	{
+		FramePipeline*	pipeline;
+		int				slot;
+		int				stage;
+	};
+
+	static void RunStage( void* data, int begin, int end );
+	void Arrive( int slot, int stage );
+
+	JobSystem&						_jobs;
+	std::vector<FrameStageFunc>		_stages;
+	std::vector<Slot*>				_slots;
+	std::vector<StageJob>			_stageJobs;		// slot * stages + stage
+	unsigned int					_submitted;		// frames submitted so far
+
+	// which frame every stage finished last, and the stats
+	mutable std::mutex				_mutex;
+	std::vector<long long>			_stageDone;
+	Stats							_stats;
+};
@@ -0,0 +1,103 @@
+//--------------------------------------------------------------------------------------
+// File: MappedFile.cpp
+//
+// Read-only memory mapped file
+//--------------------------------------------------------------------------------------
+#include "MappedFile.h"
+
+#if defined( _WIN32 )
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined( _WIN32 )
+
+MappedFile::MappedFile() : _data( NULL ), _size( 0 ), _file( INVALID_HANDLE_VALUE ), _mapping( NULL ) {}
+
+bool MappedFile::Open( const std::string& path )
+{
+	Close();
+	_file = CreateFileA( path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+						 FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL );
+	if( _file == INVALID_HANDLE_VALUE )
+		return false;
+	LARGE_INTEGER size;
+	if( !GetFileSizeEx( _file, &size ) || size.QuadPart == 0 )
+	{
+		Close();
+		return false;
+	}
+	_mapping = CreateFileMappingA( _file, NULL, PAGE_READONLY, 0, 0, NULL );
+	if( _mapping )
+		_data = ( const unsigned char* )MapViewOfFile( _mapping, FILE_MAP_READ, 0, 0, 0 );
+	if( !_data )
+	{
+		Close();
+		return false;
+	}
+	_size = ( size_t )size.QuadPart;
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if( _data )
+		UnmapViewOfFile( _data );
+	if( _mapping )
+		CloseHandle( _mapping );
+	if( _file != INVALID_HANDLE_VALUE )
+		CloseHandle( _file );
+	_data = NULL;
+	_size = 0;
+	_mapping = NULL;
+	_file = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+MappedFile::MappedFile() : _data( NULL ), _size( 0 ), _fd( -1 ) {}
+
+bool MappedFile::Open( const std::string& path )
+{
+	Close();
+	_fd = open( path.c_str(), O_RDONLY );
+	if( _fd < 0 )
+		return false;
+	struct stat info;
+	if( fstat( _fd, &info ) != 0 || info.st_size == 0 )
+	{
+		Close();
+		return false;
+	}
+	void* data = mmap( NULL, ( size_t )info.st_size, PROT_READ, MAP_SHARED, _fd, 0 );
+	if( data == MAP_FAILED )
+	{
+		Close();
+		return false;
+	}
+	_data = ( const unsigned char* )data;
+	_size = ( size_t )info.st_size;
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if( _data )
+		munmap( ( void* )_data, _size );
+	if( _fd >= 0 )
+		close( _fd );
+	_data = NULL;
+	_size = 0;
+	_fd = -1;
+}
+
+#endif
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
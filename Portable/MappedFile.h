@@ -0,0 +1,35 @@
+//--------------------------------------------------------------------------------------
+// File: MappedFile.h
+//
+// Read-only memory mapped file (CreateFileMapping on Windows, mmap elsewhere)
+//--------------------------------------------------------------------------------------
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	bool Open( const std::string& path );
+	void Close();
+
+	const unsigned char*	Data() const { return _data; }
+	size_t					Size() const { return _size; }
+
+private:
+	MappedFile( const MappedFile& );
+	MappedFile& operator=( const MappedFile& );
+
+	const unsigned char*	_data;
+	size_t					_size;
+#if defined( _WIN32 )
+	void*					_file;
+	void*					_mapping;
+#else
+	int						_fd;
+#endif
+};
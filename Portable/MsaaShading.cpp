@@ -0,0 +1,159 @@
+//--------------------------------------------------------------------------------------
+// File: MsaaShading.cpp
+//--------------------------------------------------------------------------------------
+#include "MsaaShading.h"
+
+#include <cmath>
+
+using namespace std;
+
+void CpuMsaaCounts::Add( const CpuMsaaCounts& other )
+{
+	pixels += other.pixels;
+	edgePixels += other.edgePixels;
+	aoShaded += other.aoShaded;
+	compositeShaded += other.compositeShaded;
+}
+
+//--------------------------------------------------------------------------------------
+// Edges
+//--------------------------------------------------------------------------------------
+static inline float NormalCosine( const CpuFloat3& a, const CpuFloat3& b )
+{
+	float lengths = sqrtf( ( a.x * a.x + a.y * a.y + a.z * a.z ) * ( b.x * b.x + b.y * b.y + b.z * b.z ) );
+	return lengths > 0.0f ? ( a.x * b.x + a.y * b.y + a.z * b.z ) / lengths : 1.0f;
+}
+
+unsigned int DetectEdges( const CpuMsaaGBuffer& gbuffer, const CpuEdgeParams& params, int y0, int y1,
+						  vector<unsigned char>& edge )
+{
+	const CpuGBuffer& first = gbuffer.plane[0];
+	const int width = first.width;
+	edge.resize( ( size_t )width * first.height );
+	unsigned int edges = 0;
+	for( int y = y0; y < y1; ++y )
+		for( int x = 0; x < width; ++x )
+		{
+			int pixel = y * width + x;
+			float z = first.viewZ[pixel];
+			const CpuFloat3& n = first.normal[pixel];
+			bool differs = false;
+			for( int s = 1; s < gbuffer.samples && !differs; ++s )
+			{
+				const CpuGBuffer& plane = gbuffer.plane[s];
+				float sz = plane.viewZ[pixel];
+				if( ( z == 0.0f ) != ( sz == 0.0f ) )
+					differs = true;
+				else if( z != 0.0f )
+					differs = fabsf( sz - z ) > params.depthThreshold * z ||
+							  NormalCosine( n, plane.normal[pixel] ) < params.normalThreshold;
+			}
+			edge[pixel] = differs ? 1 : 0;
+			edges += differs ? 1 : 0;
+		}
+	return edges;
+}
+
+//--------------------------------------------------------------------------------------
+// Shading
+//--------------------------------------------------------------------------------------
+void ComputeAOMsaa( const CpuMsaaGBuffer& gbuffer, const vector<unsigned char>& edge, const CpuAOParams& params,
+					const CpuFloat2 rotations[CPU_NUMLAYERS], int y0, int y1, vector<float>& ao, CpuMsaaCounts* counts )
+{
+	const CpuGBuffer& resolved = gbuffer.plane[0];
+	const int width = resolved.width;
+	ao.resize( ( size_t )width * resolved.height );
+
+	static thread_local vector<CpuFloat2> taps;
+	CpuMsaaCounts local;
+	for( int y = y0; y < y1; ++y )
+		for( int x = 0; x < width; ++x )
+		{
+			int pixel = y * width + x;
+			const CpuFloat2& rotation = rotations[( y % CPU_INTERLEAVE ) * CPU_INTERLEAVE + x % CPU_INTERLEAVE];
+			int samples = edge[pixel] ? gbuffer.samples : 1;
+			float sum = 0.0f;
+			for( int s = 0; s < samples; ++s )
+			{
+				const CpuGBuffer& plane = gbuffer.plane[s];
+				float z = plane.viewZ[pixel];
+				if( z == 0.0f )
+				{
+					sum += 1.0f;
+					continue;
+				}
+				CpuFloat3 p = plane.ViewPosition( ( float )x, ( float )y, z );
+				sum += ComputeAOPixel( resolved, params, rotation, x, y, p, plane.normal[pixel], taps );
+				++local.aoShaded;
+			}
+			ao[pixel] = sum / samples;
+		}
+	if( counts )
+		counts->aoShaded += local.aoShaded;
+}
+
+void CompositeMsaa( const CpuMsaaGBuffer& gbuffer, const vector<unsigned char>& edge, const vector<float>& ao,
+					const CpuFloat3& lightPos, int viewMode, bool useAO, int y0, int y1, vector<CpuFloat4>& out,
+					CpuMsaaCounts* counts )
+{
+	const int width = gbuffer.plane[0].width;
+	out.resize( ( size_t )width * gbuffer.plane[0].height );
+
+	CpuMsaaCounts local;
+	for( int y = y0; y < y1; ++y )
+		for( int x = 0; x < width; ++x )
+		{
+			int pixel = y * width + x;
+			++local.pixels;
+			if( !edge[pixel] )
+			{
+				out[pixel] = CompositePixel( gbuffer.plane[0], ao, lightPos, viewMode, useAO, x, y );
+				++local.compositeShaded;
+				continue;
+			}
+
+			++local.edgePixels;
+			CpuFloat4 sum = { 0.0f, 0.0f, 0.0f, 0.0f };
+			for( int s = 0; s < gbuffer.samples; ++s )
+			{
+				CpuFloat4 c = CompositePixel( gbuffer.plane[s], ao, lightPos, viewMode, useAO, x, y );
+				sum.x += c.x;
+				sum.y += c.y;
+				sum.z += c.z;
+				sum.w += c.w;
+			}
+			float scale = 1.0f / gbuffer.samples;
+			CpuFloat4 average = { sum.x * scale, sum.y * scale, sum.z * scale, sum.w * scale };
+			out[pixel] = average;
+			local.compositeShaded += gbuffer.samples;
+		}
+	if( counts )
+	{
+		counts->pixels += local.pixels;
+		counts->edgePixels += local.edgePixels;
+		counts->compositeShaded += local.compositeShaded;
+	}
+}
+
+void DownsampleBox( int width, int height, int scale, const vector<CpuFloat4>& in, vector<CpuFloat4>& out )
+{
+	out.resize( ( size_t )width * height );
+	const int inWidth = width * scale;
+	const float weight = 1.0f / ( scale * scale );
+	for( int y = 0; y < height; ++y )
+		for( int x = 0; x < width; ++x )
+		{
+			CpuFloat4 sum = { 0.0f, 0.0f, 0.0f, 0.0f };
+			for( int sy = 0; sy < scale; ++sy )
+				for( int sx = 0; sx < scale; ++sx )
+				{
+					const CpuFloat4& c = in[( y * scale + sy ) * inWidth + x * scale + sx];
+					sum.x += c.x;
+					sum.y += c.y;
+					sum.z += c.z;
+					sum.w += c.w;
+				}
+			CpuFloat4 average = { sum.x * weight, sum.y * weight, sum.z * weight, sum.w * weight };
+			out[y * width + x] = average;
+		}
+}
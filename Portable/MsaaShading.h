@@ -0,0 +1,61 @@
+//--------------------------------------------------------------------------------------
+// File: MsaaShading.h
+//
+// CPU emulation of the edge-aware MSAA mode (DeferredShading -msaa). Supersampling
+// with TEXSCALE 2 shades four times as many pixels everywhere to anti-alias the edges.
+// The MSAA G-buffer instead keeps several samples per pixel but runs the G-buffer
+// pixel shader once per pixel (see RasterizeRowsMsaa). Interior pixels end up with the
+// same value in every sample. An edge pass marks the pixels whose samples differ in
+// coverage, depth or normal (PSMsaaEdges). AO and the composite then run once per
+// pixel for the rest, and once per sample only on the edges. Counts are kept of every
+// shader invocation, so the cost can be set against supersampling's.
+//--------------------------------------------------------------------------------------
+#pragma once
+
+#include "CpuRaster.h"
+
+#include <vector>
+
+// When two samples of a pixel count as different (EdgeDepthThreshold and
+// EdgeNormalThreshold of the shader)
+struct CpuEdgeParams
+{
+	float	depthThreshold;		// view Z differs by more than this fraction
+	float	normalThreshold;	// the normals' cosine is below this
+
+	CpuEdgeParams() : depthThreshold( 0.01f ), normalThreshold( 0.9f ) {}
+};
+
+// Shader invocations of the passes after the G-buffer
+struct CpuMsaaCounts
+{
+	unsigned long long	pixels;
+	unsigned long long	edgePixels;
+	unsigned long long	aoShaded;			// AO evaluated (background pixels skip it)
+	unsigned long long	compositeShaded;
+
+	CpuMsaaCounts() : pixels( 0 ), edgePixels( 0 ), aoShaded( 0 ), compositeShaded( 0 ) {}
+	void Add( const CpuMsaaCounts& other );
+};
+
+// Sets edge (width * height) to 1 for the pixels of the rows [y0, y1) whose samples
+// differ from sample 0, else 0. Returns how many are edges.
+unsigned int DetectEdges( const CpuMsaaGBuffer& gbuffer, const CpuEdgeParams& params, int y0, int y1,
+						  std::vector<unsigned char>& edge );
+
+// PSAO of the rows [y0, y1) into ao (width * height): sample 0 for the pixels that
+// aren't edges, the average over the samples for edges, every sample's taps reading
+// the resolved G-buffer (plane 0)
+void ComputeAOMsaa( const CpuMsaaGBuffer& gbuffer, const std::vector<unsigned char>& edge, const CpuAOParams& params,
+					const CpuFloat2 rotations[CPU_NUMLAYERS], int y0, int y1, std::vector<float>& ao,
+					CpuMsaaCounts* counts = NULL );
+
+// The composite of the rows [y0, y1): sample 0 for pixels that aren't edges, the
+// average of every sample's composite for edges. ao is per pixel.
+void CompositeMsaa( const CpuMsaaGBuffer& gbuffer, const std::vector<unsigned char>& edge, const std::vector<float>& ao,
+					const CpuFloat3& lightPos, int viewMode, bool useAO, int y0, int y1, std::vector<CpuFloat4>& out,
+					CpuMsaaCounts* counts = NULL );
+
+// Averages every scale x scale block of a supersampled image (width x height is the
+// size after): the resolve supersampling needs
+void DownsampleBox( int width, int height, int scale, const std::vector<CpuFloat4>& in, std::vector<CpuFloat4>& out );
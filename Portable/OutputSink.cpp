@@ -0,0 +1,274 @@
+//--------------------------------------------------------------------------------------
+// File: OutputSink.cpp
+//--------------------------------------------------------------------------------------
+#include "OutputSink.h"
+#include "ExrFile.h"
+#include "ImageFile.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+typedef chrono::high_resolution_clock Clock;
+
+static double Milliseconds( Clock::time_point start )
+{
+	return chrono::duration<double, milli>( Clock::now() - start ).count();
+}
+
+void OutputFrame::Init( int w, int h, int numChannels, OutputTexel type )
+{
+	static const int texelBytes[] = { 1, 2, 4 };
+	width = w;
+	height = h;
+	texelChannels = numChannels;
+	texel = type;
+	rowPitch = w * numChannels * texelBytes[type];
+	data.resize( ( size_t )rowPitch * h );
+	path.clear();
+	encoding = OUTPUT_IMAGE;
+	channels.clear();
+}
+
+//--------------------------------------------------------------------------------------
+// Encoding (on the encoder threads)
+//--------------------------------------------------------------------------------------
+
+// Texels to 0..1 floats and to bytes, per texel type
+static inline float ToFloat( unsigned char v )		{ return v * ( 1.0f / 255.0f ); }
+static inline float ToFloat( unsigned short v )		{ return v * ( 1.0f / 65535.0f ); }
+static inline float ToFloat( float v )				{ return v; }
+static inline unsigned char ToByte( unsigned char v )	{ return v; }
+static inline unsigned char ToByte( unsigned short v )	{ return ( unsigned char )( ( v * 255u + 32767u ) / 65535u ); }
+static inline unsigned char ToByte( float v )			{ return ( unsigned char )( v <= 0.0f ? 0 : v >= 1.0f ? 255 : v * 255.0f + 0.5f ); }
+
+// The first numChannels channels of a row, interleaved
+template<typename T> static void RowToFloat( const T* in, int width, int texelChannels, int numChannels, float* out )
+{
+	for( int x = 0; x < width; ++x, in += texelChannels )
+		for( int c = 0; c < numChannels; ++c )
+			*out++ = ToFloat( in[c] );
+}
+
+// A row as RGBA8: one channel is gray; a missing alpha is opaque
+template<typename T> static void RowToRGBA8( const T* in, int width, int texelChannels, unsigned char* out )
+{
+	for( int x = 0; x < width; ++x, in += texelChannels, out += 4 )
+	{
+		out[0] = ToByte( in[0] );
+		out[1] = ToByte( in[min( 1, texelChannels - 1 )] );
+		out[2] = ToByte( in[min( 2, texelChannels - 1 )] );
+		out[3] = texelChannels == 4 ? ToByte( in[3] ) : 255;
+	}
+}
+
+// Scratch of one encoder thread
+struct EncoderScratch
+{
+	Image		image;
+	ExrImage	exr;
+};
+
+static void Encode( OutputFrame& frame, EncoderScratch& scratch, vector<unsigned char>& bytes )
+{
+	bytes.clear();
+	if( frame.encoding != OUTPUT_IMAGE )
+	{
+		// EXR: the named channels as floats
+		ExrImage& exr = scratch.exr;
+		exr.width = frame.width;
+		exr.height = frame.height;
+		exr.channels = frame.channels.empty() ? string( "RGBA", min( frame.texelChannels, 4 ) ) : frame.channels;
+		exr.half = frame.encoding == OUTPUT_EXR_HALF;
+		int numChannels = min( ( int )exr.channels.size(), frame.texelChannels );
+		exr.channels.resize( numChannels );
+		exr.pixels.resize( ( size_t )frame.width * frame.height * numChannels );
+		for( int y = 0; y < frame.height; ++y )
+		{
+			const unsigned char* row = frame.Row( y );
+			float* out = &exr.pixels[( size_t )y * frame.width * numChannels];
+			if( frame.texel == OUTPUT_UNORM8 )
+				RowToFloat( row, frame.width, frame.texelChannels, numChannels, out );
+			else if( frame.texel == OUTPUT_UNORM16 )
+				RowToFloat( ( const unsigned short* )row, frame.width, frame.texelChannels, numChannels, out );
+			else
+				RowToFloat( ( const float* )row, frame.width, frame.texelChannels, numChannels, out );
+		}
+		EncodeExr( exr, true, bytes );
+		return;
+	}
+
+	// 8-bit RGBA: packed RGBA8 frames are encoded in place
+	Image& image = scratch.image;
+	image.width = frame.width;
+	image.height = frame.height;
+	bool packed = frame.texel == OUTPUT_UNORM8 && frame.texelChannels == 4 && frame.rowPitch == frame.width * 4;
+	if( packed )
+	{
+		image.rgba.swap( frame.data );
+		EncodeImageFile( frame.path, image, bytes );
+		image.rgba.swap( frame.data );
+		return;
+	}
+	image.rgba.resize( ( size_t )frame.width * frame.height * 4 );
+	for( int y = 0; y < frame.height; ++y )
+	{
+		const unsigned char* row = frame.Row( y );
+		unsigned char* out = &image.rgba[( size_t )y * frame.width * 4];
+		if( frame.texel == OUTPUT_UNORM8 )
+			RowToRGBA8( row, frame.width, frame.texelChannels, out );
+		else if( frame.texel == OUTPUT_UNORM16 )
+			RowToRGBA8( ( const unsigned short* )row, frame.width, frame.texelChannels, out );
+		else
+			RowToRGBA8( ( const float* )row, frame.width, frame.texelChannels, out );
+	}
+	EncodeImageFile( frame.path, image, bytes );
+}
+
+static bool WriteFile( const string& path, const vector<unsigned char>& bytes )
+{
+	FILE* file = fopen( path.c_str(), "wb" );
+	if( !file )
+		return false;
+	bool ok = bytes.empty() || fwrite( &bytes[0], 1, bytes.size(), file ) == bytes.size();
+	return fclose( file ) == 0 && ok;
+}
+
+//--------------------------------------------------------------------------------------
+// Output sink
+//--------------------------------------------------------------------------------------
+OutputSink::OutputSink( int poolFrames, int threads ) : _busy( 0 ), _quit( false )
+{
+	for( int i = 0; i < max( poolFrames, 1 ); ++i )
+	{
+		_pool.push_back( new OutputFrame() );
+		_pool.back()->Init( 0, 0, 4, OUTPUT_UNORM8 );
+	}
+	_free = _pool;
+	memset( &_stats, 0, sizeof( _stats ) );
+	if( threads <= 0 )
+		threads = max( 1, ( int )thread::hardware_concurrency() / 4 );
+	for( int i = 0; i < threads; ++i )
+		_threads.push_back( thread( &OutputSink::EncoderLoop, this ) );
+}
+
+OutputSink::~OutputSink()
+{
+	Flush();
+	{
+		lock_guard<mutex> lock( _mutex );
+		_quit = true;
+	}
+	_wakeEncoders.notify_all();
+	for( size_t i = 0; i < _threads.size(); ++i )
+		_threads[i].join();
+	for( size_t i = 0; i < _pool.size(); ++i )
+		delete _pool[i];
+}
+
+OutputFrame* OutputSink::Acquire()
+{
+	unique_lock<mutex> lock( _mutex );
+	if( _free.empty() )
+	{
+		Clock::time_point start = Clock::now();
+		while( _free.empty() )
+			_returned.wait( lock );
+		++_stats.blocked;
+		_stats.blockedMs += Milliseconds( start );
+	}
+	OutputFrame* frame = _free.back();
+	_free.pop_back();
+	return frame;
+}
+
+OutputFrame* OutputSink::TryAcquire()
+{
+	lock_guard<mutex> lock( _mutex );
+	if( _free.empty() )
+	{
+		++_stats.dropped;
+		return NULL;
+	}
+	OutputFrame* frame = _free.back();
+	_free.pop_back();
+	return frame;
+}
+
+void OutputSink::Submit( OutputFrame* frame )
+{
+	{
+		lock_guard<mutex> lock( _mutex );
+		if( frame->path.empty() )
+		{
+			_free.push_back( frame );
+			_returned.notify_all();
+			return;
+		}
+		_queue.push_back( frame );
+		_stats.maxQueued = max( _stats.maxQueued, ( unsigned int )_queue.size() );
+	}
+	_wakeEncoders.notify_one();
+}
+
+void OutputSink::Flush()
+{
+	unique_lock<mutex> lock( _mutex );
+	while( !_queue.empty() || _busy )
+		_returned.wait( lock );
+}
+
+void OutputSink::EncoderLoop()
+{
+	EncoderScratch scratch;
+	vector<unsigned char> bytes;
+	unique_lock<mutex> lock( _mutex );
+	for( ;; )
+	{
+		while( !_quit && _queue.empty() )
+			_wakeEncoders.wait( lock );
+		if( _queue.empty() )
+			return;
+		OutputFrame* frame = _queue.front();
+		_queue.pop_front();
+		++_busy;
+		lock.unlock();
+
+		Clock::time_point start = Clock::now();
+		Encode( *frame, scratch, bytes );
+		double encodeMs = Milliseconds( start );
+		start = Clock::now();
+		bool ok = WriteFile( frame->path, bytes );
+		double writeMs = Milliseconds( start );
+
+		lock.lock();
+		--_busy;
+		if( ok )
+		{
+			++_stats.frames;
+			_stats.rawBytes += ( unsigned long long )frame->rowPitch * frame->height;
+			_stats.fileBytes += bytes.size();
+		}
+		else
+			++_stats.failed;
+		_stats.encodeMs += encodeMs;
+		_stats.writeMs += writeMs;
+		_free.push_back( frame );
+		_returned.notify_all();
+	}
+}
+
+OutputSink::Stats OutputSink::GetStats() const
+{
+	lock_guard<mutex> lock( _mutex );
+	return _stats;
+}
+
+void OutputSink::ResetStats()
+{
+	lock_guard<mutex> lock( _mutex );
+	memset( &_stats, 0, sizeof( _stats ) );
+}
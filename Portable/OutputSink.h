@@ -0,0 +1,110 @@
+//--------------------------------------------------------------------------------------
+// File: OutputSink.h
+//
+// Writes rendered images to disk off the render thread: G-buffer slices, the blurred
+// AO and the composite, for tools downstream. The renderer takes a frame from a fixed
+// pool, fills it (a copy of a mapped staging texture, or CPU pass output) and submits
+// it; encoder threads turn it into a file (QOI or PAM/PPM for 8-bit color, OpenEXR
+// with half or float channels for depth, normals and AO) and give the frame back.
+// The pool is the bound on the queue: Acquire only waits when every frame is still
+// queued or being written, and how long it waited is counted.
+//--------------------------------------------------------------------------------------
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum OutputTexel
+{
+	OUTPUT_UNORM8,
+	OUTPUT_UNORM16,			// e.g. R16G16B16A16_UNORM render targets
+	OUTPUT_FLOAT32,
+};
+
+enum OutputEncoding
+{
+	OUTPUT_IMAGE,			// by the extension of the path, see EncodeImageFile (8 bits)
+	OUTPUT_EXR_HALF,		// OpenEXR, RLE compressed
+	OUTPUT_EXR_FLOAT,
+};
+
+struct OutputFrame
+{
+	int							width, height;
+	int							texelChannels;		// channels in data per texel
+	OutputTexel					texel;
+	int							rowPitch;			// bytes from one row of data to the next
+	std::vector<unsigned char>	data;				// keeps its capacity while pooled
+
+	std::string					path;				// "" hands the frame back unwritten
+	OutputEncoding				encoding;
+	std::string					channels;			// EXR: names of the first texel channels
+													// written, e.g. "Z" (default "RGBA")
+
+	// Sizes data for width x height tightly packed texels and resets the settings
+	void Init( int w, int h, int numChannels, OutputTexel type );
+	unsigned char* Row( int y ) { return &data[( size_t )y * rowPitch]; }
+};
+
+class OutputSink
+{
+public:
+	// poolFrames frames in flight (3 frames' worth of everything exported is triple
+	// buffering); threads 0 = a quarter of the hardware threads, at least one
+	OutputSink( int poolFrames, int threads = 0 );
+	~OutputSink();			// writes what is queued first
+
+	// A free frame: waits while every frame of the pool is queued or being written
+	OutputFrame* Acquire();
+	// ... or NULL instead of waiting (the caller drops or retries the output)
+	OutputFrame* TryAcquire();
+
+	// Queues the frame for encoding; returns at once
+	void Submit( OutputFrame* frame );
+
+	// Waits until everything submitted is written
+	void Flush();
+
+	struct Stats
+	{
+		unsigned int		frames;				// written
+		unsigned int		failed;				// couldn't be written
+		unsigned int		dropped;			// TryAcquire found no free frame
+		unsigned int		blocked;			// Acquire had to wait
+		double				blockedMs;			// ... in all
+		double				encodeMs;			// summed over the threads
+		double				writeMs;
+		unsigned long long	rawBytes;			// of the frames' texels
+		unsigned long long	fileBytes;
+		unsigned int		maxQueued;
+
+		// MB of texels encoded per second of encoding
+		double EncodeMBps() const { return encodeMs > 0.0 ? rawBytes / ( encodeMs * 1000.0 ) : 0.0; }
+	};
+	Stats GetStats() const;
+	void ResetStats();
+
+	int NumThreads() const { return ( int )_threads.size(); }
+
+private:
+	OutputSink( const OutputSink& );
+	OutputSink& operator=( const OutputSink& );
+
+	void EncoderLoop();
+
+	std::vector<OutputFrame*>		_pool;
+	std::vector<OutputFrame*>		_free;
+	std::deque<OutputFrame*>		_queue;
+	int								_busy;				// frames being encoded
+	bool							_quit;
+	Stats							_stats;
+
+	mutable std::mutex				_mutex;
+	std::condition_variable			_wakeEncoders;
+	std::condition_variable			_returned;			// a frame went back to the pool
+	std::vector<std::thread>		_threads;
+};
@@ -0,0 +1,513 @@
+//--------------------------------------------------------------------------------------
+// File: SceneStream.cpp
+//--------------------------------------------------------------------------------------
+#include "SceneStream.h"
+#include "FrameArena.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <map>
+
+using namespace std;
+
+typedef chrono::high_resolution_clock Clock;
+
+static double Milliseconds( const Clock::time_point& start )
+{
+	return chrono::duration<double, milli>( Clock::now() - start ).count();
+}
+
+//--------------------------------------------------------------------------------------
+// Chunk files
+//--------------------------------------------------------------------------------------
+
+// Four independent lanes so it runs at memory speed; reading every byte is also what
+// pages a mapped chunk in
+unsigned long long ChunkChecksum( const void* data, size_t size )
+{
+	const unsigned long long prime = 0x9e3779b97f4a7c15ULL;
+	unsigned long long lanes[4] = { 1, 2, 3, 4 };
+	const unsigned char* bytes = ( const unsigned char* )data;
+	size_t i = 0;
+	for( ; i + 32 <= size; i += 32 )
+		for( int l = 0; l < 4; ++l )
+		{
+			unsigned long long word;
+			memcpy( &word, bytes + i + l * 8, 8 );
+			lanes[l] = ( lanes[l] + word ) * prime;
+		}
+	unsigned long long hash = size;
+	for( int l = 0; l < 4; ++l )
+		hash = ( hash ^ lanes[l] ) * prime;
+	for( ; i < size; ++i )
+		hash = ( hash ^ bytes[i] ) * prime;
+	return hash;
+}
+
+bool AddChunk( SceneIndex& index, const FloatVertex* vertices, int numVertices, const unsigned int* indices, int numIndices )
+{
+	ChunkInfo info;
+	info.id = ( unsigned int )index.chunks.size();
+	char name[32];
+	sprintf( name, "chunk_%05u.chk", info.id );
+	info.file = name;
+
+	float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for( int i = 0; i < numVertices; ++i )
+		for( int c = 0; c < 3; ++c )
+		{
+			lo[c] = min( lo[c], vertices[i].pos[c] );
+			hi[c] = max( hi[c], vertices[i].pos[c] );
+		}
+	float radius = 0.0f;
+	for( int c = 0; c < 3; ++c )
+	{
+		if( numVertices == 0 )
+			lo[c] = hi[c] = 0.0f;
+		info.boxMin[c] = lo[c];
+		info.boxMax[c] = hi[c];
+		info.center[c] = ( lo[c] + hi[c] ) * 0.5f;
+		radius += ( hi[c] - lo[c] ) * ( hi[c] - lo[c] );
+	}
+	info.radius = sqrtf( radius ) * 0.5f;
+
+	// header, vertices, indices: one block
+	ChunkHeader header;
+	memset( &header, 0, sizeof( header ) );
+	header.magic = CHUNK_MAGIC;
+	header.version = CHUNK_VERSION;
+	header.numVertices = numVertices;
+	header.numIndices = numIndices;
+	header.box = MakeQuantBox( vertices, numVertices );
+	header.vertexOffset = ( sizeof( ChunkHeader ) + 15 ) & ~15u;
+	header.indexOffset = header.vertexOffset + numVertices * sizeof( PackedVertex );
+	vector<unsigned char> file( header.indexOffset + numIndices * sizeof( unsigned int ) );
+	QuantizeVertices( vertices, numVertices, header.box, ( PackedVertex* )&file[header.vertexOffset] );
+	if( numIndices )
+		memcpy( &file[header.indexOffset], indices, numIndices * sizeof( unsigned int ) );
+	header.checksum = ChunkChecksum( &file[header.vertexOffset], file.size() - header.vertexOffset );
+	memcpy( &file[0], &header, sizeof( header ) );
+	info.bytes = file.size();
+
+	// write next to the target and rename, so a half written file is never picked up
+	string path = index.directory + "/" + info.file, temp = path + ".tmp";
+	FILE* out = fopen( temp.c_str(), "wb" );
+	if( !out )
+		return false;
+	bool ok = fwrite( &file[0], 1, file.size(), out ) == file.size();
+	ok = fclose( out ) == 0 && ok;
+	remove( path.c_str() );
+	if( !ok || rename( temp.c_str(), path.c_str() ) != 0 )
+	{
+		remove( temp.c_str() );
+		return false;
+	}
+	index.chunks.push_back( info );
+	return true;
+}
+
+int SplitIntoChunks( SceneIndex& index, const FloatVertex* vertices, int numVertices, const unsigned int* indices,
+					 int numIndices, float cellSize )
+{
+	// triangles by cell
+	map<unsigned long long, vector<int> > cells;
+	for( int t = 0; t + 2 < numIndices; t += 3 )
+	{
+		long long cell[3];
+		for( int c = 0; c < 3; ++c )
+		{
+			float centroid = ( vertices[indices[t]].pos[c] + vertices[indices[t + 1]].pos[c] + vertices[indices[t + 2]].pos[c] ) / 3.0f;
+			cell[c] = ( long long )floorf( centroid / cellSize ) & 0x1fffff;
+		}
+		cells[( unsigned long long )( cell[0] | cell[1] << 21 | cell[2] << 42 )].push_back( t );
+	}
+
+	int written = 0;
+	vector<int> remap( numVertices, -1 );
+	vector<FloatVertex> chunkVertices;
+	vector<unsigned int> chunkIndices, used;
+	for( map<unsigned long long, vector<int> >::const_iterator cell = cells.begin(); cell != cells.end(); ++cell )
+	{
+		chunkVertices.clear();
+		chunkIndices.clear();
+		used.clear();
+		for( size_t t = 0; t < cell->second.size(); ++t )
+			for( int corner = 0; corner < 3; ++corner )
+			{
+				unsigned int v = indices[cell->second[t] + corner];
+				if( remap[v] < 0 )
+				{
+					remap[v] = ( int )chunkVertices.size();
+					chunkVertices.push_back( vertices[v] );
+					used.push_back( v );
+				}
+				chunkIndices.push_back( remap[v] );
+			}
+		for( size_t i = 0; i < used.size(); ++i )
+			remap[used[i]] = -1;
+		if( !AddChunk( index, chunkVertices.data(), ( int )chunkVertices.size(), chunkIndices.data(), ( int )chunkIndices.size() ) )
+			return -1;
+		++written;
+	}
+	return written;
+}
+
+bool WriteSceneIndex( const SceneIndex& index )
+{
+	string path = index.directory + "/scene.idx", temp = path + ".tmp";
+	FILE* file = fopen( temp.c_str(), "w" );
+	if( !file )
+		return false;
+	bool ok = fprintf( file, "scene %d %u\n", CHUNK_VERSION, ( unsigned int )index.chunks.size() ) > 0;
+	for( size_t i = 0; ok && i < index.chunks.size(); ++i )
+	{
+		const ChunkInfo& c = index.chunks[i];
+		ok = fprintf( file, "%u %.9g %.9g %.9g %.9g %.9g %.9g %llu %s\n", c.id, c.boxMin[0], c.boxMin[1], c.boxMin[2],
+					  c.boxMax[0], c.boxMax[1], c.boxMax[2], c.bytes, c.file.c_str() ) > 0;
+	}
+	ok = fclose( file ) == 0 && ok;
+	remove( path.c_str() );
+	if( !ok || rename( temp.c_str(), path.c_str() ) != 0 )
+	{
+		remove( temp.c_str() );
+		return false;
+	}
+	return true;
+}
+
+bool ReadSceneIndex( const string& directory, SceneIndex& index )
+{
+	FILE* file = fopen( ( directory + "/scene.idx" ).c_str(), "r" );
+	if( !file )
+		return false;
+	int version = 0;
+	unsigned int count = 0;
+	bool ok = fscanf( file, "scene %d %u", &version, &count ) == 2 && version == CHUNK_VERSION;
+	index.directory = directory;
+	index.chunks.clear();
+	for( unsigned int i = 0; ok && i < count; ++i )
+	{
+		ChunkInfo c;
+		char name[256];
+		ok = fscanf( file, "%u %f %f %f %f %f %f %llu %255s", &c.id, &c.boxMin[0], &c.boxMin[1], &c.boxMin[2], &c.boxMax[0],
+					 &c.boxMax[1], &c.boxMax[2], &c.bytes, name ) == 9 && c.id == i;
+		float radius = 0.0f;
+		for( int a = 0; a < 3; ++a )
+		{
+			c.center[a] = ( c.boxMin[a] + c.boxMax[a] ) * 0.5f;
+			radius += ( c.boxMax[a] - c.boxMin[a] ) * ( c.boxMax[a] - c.boxMin[a] );
+		}
+		c.radius = sqrtf( radius ) * 0.5f;
+		c.file = name;
+		index.chunks.push_back( c );
+	}
+	fclose( file );
+	return ok;
+}
+
+bool ParseChunk( const unsigned char* data, size_t size, ChunkView& view )
+{
+	if( !data || size < sizeof( ChunkHeader ) )
+		return false;
+	const ChunkHeader* header = ( const ChunkHeader* )data;
+	if( header->magic != CHUNK_MAGIC || header->version != CHUNK_VERSION || header->vertexOffset % 16 ||
+		header->vertexOffset < sizeof( ChunkHeader ) ||
+		header->indexOffset != header->vertexOffset + ( size_t )header->numVertices * sizeof( PackedVertex ) ||
+		header->indexOffset + ( size_t )header->numIndices * sizeof( unsigned int ) != size )
+		return false;
+	view.header = header;
+	view.vertices = ( const PackedVertex* )( data + header->vertexOffset );
+	view.indices = ( const unsigned int* )( data + header->indexOffset );
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+// Streamer
+//--------------------------------------------------------------------------------------
+SceneStreamer::SceneStreamer( const SceneIndex& index, const StreamSettings& settings )
+	: _index( index ), _settings( settings ), _frame( 0 ), _loadingBytes( 0 ), _quit( false )
+{
+	Chunk chunk;
+	chunk.state = UNLOADED;
+	chunk.importance = 0.0f;
+	chunk.lastUsed = 0;
+	chunk.wanted = false;
+	chunk.required = false;
+	chunk.file = NULL;
+	memset( &chunk.view, 0, sizeof( chunk.view ) );
+	_chunks.assign( index.chunks.size(), chunk );
+	memset( &_stats, 0, sizeof( _stats ) );
+	for( int i = 0; i < max( 1, settings.loadThreads ); ++i )
+		_threads.push_back( thread( &SceneStreamer::LoaderLoop, this ) );
+}
+
+SceneStreamer::~SceneStreamer()
+{
+	{
+		lock_guard<mutex> lock( _mutex );
+		_quit = true;
+	}
+	_wakeLoaders.notify_all();
+	for( size_t i = 0; i < _threads.size(); ++i )
+		_threads[i].join();
+	for( size_t i = 0; i < _chunks.size(); ++i )
+		delete _chunks[i].file;
+}
+
+// Projected diameter in pixels from the eye and from where the eye is headed
+float SceneStreamer::ComputeImportance( const ChunkInfo& info, const StreamView& view ) const
+{
+	float pixelsPerUnit = view.screenHeight / ( 2.0f * tanf( view.fovY * 0.5f ) );
+	float importance = 0.0f;
+	for( int predicted = 0; predicted < ( view.lookahead > 0.0f ? 2 : 1 ); ++predicted )
+	{
+		float d[3], distance = 0.0f, facing = 0.0f;
+		for( int c = 0; c < 3; ++c )
+		{
+			d[c] = info.center[c] - view.eye[c] - ( predicted ? view.velocity[c] * view.lookahead : 0.0f );
+			distance += d[c] * d[c];
+			facing += d[c] * view.direction[c];
+		}
+		distance = sqrtf( distance );
+		float pixels = distance <= info.radius ? view.screenHeight : 2.0f * info.radius / distance * pixelsPerUnit;
+		if( facing < -info.radius )
+			pixels *= _settings.behindScale;
+		importance = max( importance, pixels );
+	}
+	return importance;
+}
+
+void SceneStreamer::Update( const StreamView& view )
+{
+	vector<float> importance( _chunks.size() );
+	for( size_t i = 0; i < _chunks.size(); ++i )
+		importance[i] = ComputeImportance( _index.chunks[i], view );
+
+	lock_guard<mutex> lock( _mutex );
+	++_frame;
+	_wanted.clear();
+	for( size_t i = 0; i < _chunks.size(); ++i )
+	{
+		_chunks[i].importance = importance[i];
+		_chunks[i].wanted = false;
+		if( importance[i] >= _settings.minPixels )
+			_wanted.push_back( ( unsigned int )i );
+	}
+	sort( _wanted.begin(), _wanted.end(), [&]( unsigned int a, unsigned int b ) { return importance[a] > importance[b]; } );
+
+	// what fits the budget, most important first; the rest would only thrash
+	size_t bytes = 0;
+	size_t fits = 0;
+	for( ; fits < _wanted.size() && bytes + _index.chunks[_wanted[fits]].bytes <= _settings.budgetBytes; ++fits )
+	{
+		bytes += ( size_t )_index.chunks[_wanted[fits]].bytes;
+		_chunks[_wanted[fits]].wanted = true;
+	}
+	_wanted.resize( fits );
+
+	// requeue: unwanted chunks drop out, required ones stay at the head
+	vector<unsigned int> required;
+	for( size_t i = 0; i < _queue.size(); ++i )
+	{
+		Chunk& chunk = _chunks[_queue[i]];
+		if( chunk.required )
+			required.push_back( _queue[i] );
+		else
+			chunk.state = UNLOADED;
+	}
+	_queue.clear();
+	for( size_t i = _wanted.size(); i-- > 0; )
+	{
+		Chunk& chunk = _chunks[_wanted[i]];
+		if( chunk.state == UNLOADED )
+		{
+			chunk.state = QUEUED;
+			_queue.push_back( _wanted[i] );
+		}
+	}
+	_queue.insert( _queue.end(), required.begin(), required.end() );
+	_stats.queued = ( unsigned int )_queue.size();
+	if( !_queue.empty() )
+		_wakeLoaders.notify_all();
+}
+
+const ChunkView* SceneStreamer::Acquire( unsigned int chunk )
+{
+	lock_guard<mutex> lock( _mutex );
+	++_stats.acquires;
+	Chunk& c = _chunks[chunk];
+	if( c.state != RESIDENT )
+	{
+		++_stats.misses;
+		return NULL;
+	}
+	c.lastUsed = _frame;
+	_lru.splice( _lru.begin(), _lru, c.lru );
+	return &c.view;
+}
+
+const ChunkView* SceneStreamer::Require( unsigned int chunk )
+{
+	unique_lock<mutex> lock( _mutex );
+	++_stats.acquires;
+	Chunk& c = _chunks[chunk];
+	if( c.state != RESIDENT )
+	{
+		Clock::time_point start = Clock::now();
+		++_stats.misses;
+		++_stats.stalls;
+		c.required = true;
+		if( c.state == QUEUED )
+			_queue.erase( find( _queue.begin(), _queue.end(), chunk ) );
+		if( c.state != LOADING )
+		{
+			c.state = QUEUED;
+			_queue.push_back( chunk );
+			_wakeLoaders.notify_all();
+		}
+		while( c.state != RESIDENT && c.required )
+			_loaded.wait( lock );
+		c.required = false;
+		_stats.stallMs += Milliseconds( start );
+		if( c.state != RESIDENT )
+			return NULL;
+	}
+	c.lastUsed = _frame;
+	_lru.splice( _lru.begin(), _lru, c.lru );
+	return &c.view;
+}
+
+void SceneStreamer::TakeEvicted( vector<unsigned int>& chunks )
+{
+	lock_guard<mutex> lock( _mutex );
+	chunks.swap( _evicted );
+	_evicted.clear();
+}
+
+const unsigned int* SceneStreamer::TakeEvicted( LinearArena& arena, size_t& count )
+{
+	lock_guard<mutex> lock( _mutex );
+	count = _evicted.size();
+	unsigned int* chunks = arena.Allocate<unsigned int>( count );
+	if( !chunks )
+	{
+		count = 0;			// kept for the next call
+		return NULL;
+	}
+	if( count )
+		memcpy( chunks, &_evicted[0], count * sizeof( unsigned int ) );
+	_evicted.clear();
+	return chunks;
+}
+
+void SceneStreamer::Drain()
+{
+	unique_lock<mutex> lock( _mutex );
+	while( !_queue.empty() || _loadingBytes )
+		_loaded.wait( lock );
+}
+
+SceneStreamer::Stats SceneStreamer::GetStats() const
+{
+	lock_guard<mutex> lock( _mutex );
+	Stats stats = _stats;
+	stats.residentChunks = ( unsigned int )_lru.size();
+	stats.queued = ( unsigned int )_queue.size();
+	return stats;
+}
+
+void SceneStreamer::ResetStats()
+{
+	lock_guard<mutex> lock( _mutex );
+	size_t resident = _stats.residentBytes;
+	memset( &_stats, 0, sizeof( _stats ) );
+	_stats.residentBytes = _stats.peakResidentBytes = resident;
+}
+
+// Unmaps least recently used chunks that are neither wanted nor used this frame until
+// bytes more fit the budget. force: load anyway when nothing can go.
+bool SceneStreamer::MakeRoom( size_t bytes, bool force )
+{
+	list<unsigned int>::iterator i = _lru.end();
+	while( _stats.residentBytes + _loadingBytes + bytes > _settings.budgetBytes && i != _lru.begin() )
+	{
+		--i;
+		Chunk& victim = _chunks[*i];
+		if( victim.wanted || victim.lastUsed == _frame )
+			continue;
+		_stats.residentBytes -= ( size_t )_index.chunks[*i].bytes;
+		++_stats.evictions;
+		_evicted.push_back( *i );
+		delete victim.file;
+		victim.file = NULL;
+		victim.state = UNLOADED;
+		i = _lru.erase( i );
+	}
+	return force || _stats.residentBytes + _loadingBytes + bytes <= _settings.budgetBytes;
+}
+
+void SceneStreamer::LoaderLoop()
+{
+	unique_lock<mutex> lock( _mutex );
+	for( ;; )
+	{
+		while( !_quit && _queue.empty() )
+			_wakeLoaders.wait( lock );
+		if( _quit )
+			return;
+
+		unsigned int id = _queue.back();
+		_queue.pop_back();
+		Chunk& chunk = _chunks[id];
+		size_t bytes = ( size_t )_index.chunks[id].bytes;
+		if( chunk.state != QUEUED )
+		{
+			_loaded.notify_all();		// for Drain
+			continue;
+		}
+		if( !MakeRoom( bytes, chunk.required ) )
+		{
+			// no room until the next Update changes what is wanted
+			chunk.state = UNLOADED;
+			_loaded.notify_all();
+			continue;
+		}
+		chunk.state = LOADING;
+		_loadingBytes += bytes;
+		string path = _index.directory + "/" + _index.chunks[id].file;
+		lock.unlock();
+
+		// map, then read it all: the checksum pages it in here instead of on the render thread
+		Clock::time_point start = Clock::now();
+		MappedFile* file = new MappedFile;
+		ChunkView view;
+		bool ok = file->Open( path ) && file->Size() == bytes && ParseChunk( file->Data(), file->Size(), view ) &&
+				  ChunkChecksum( file->Data() + view.header->vertexOffset, file->Size() - view.header->vertexOffset ) ==
+				  view.header->checksum;
+		double ms = Milliseconds( start );
+
+		lock.lock();
+		_loadingBytes -= bytes;
+		_stats.loadMs += ms;
+		if( ok )
+		{
+			chunk.file = file;
+			chunk.view = view;
+			chunk.state = RESIDENT;
+			chunk.lru = _lru.insert( _lru.begin(), id );
+			_stats.residentBytes += bytes;
+			_stats.peakResidentBytes = max( _stats.peakResidentBytes, _stats.residentBytes );
+			++_stats.loads;
+		}
+		else
+		{
+			delete file;
+			chunk.state = UNLOADED;
+		}
+		chunk.required = false;
+		_loaded.notify_all();
+	}
+}
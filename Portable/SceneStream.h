@@ -0,0 +1,186 @@
+//--------------------------------------------------------------------------------------
+// File: SceneStream.h
+//
+// Out-of-core scenes. A scene is split into spatial chunks, one .chk file each (16-byte
+// quantized vertices and 32-bit indices, see VertexQuantize.h), listed in scene.idx.
+// SceneStreamer maps the chunks a camera needs on its loader threads and unmaps the
+// least recently used ones to stay under a memory budget. What it needs is ranked by
+// screen-space importance: the projected size of a chunk from where the camera is and
+// from where its motion says it will be.
+//--------------------------------------------------------------------------------------
+#pragma once
+
+#include "MappedFile.h"
+#include "VertexQuantize.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class LinearArena;
+
+//--------------------------------------------------------------------------------------
+// Chunk files and the scene index
+//--------------------------------------------------------------------------------------
+#define CHUNK_MAGIC 0x4b4e4843			// "CHNK"
+#define CHUNK_VERSION 1
+
+struct ChunkHeader
+{
+	unsigned int		magic;
+	unsigned int		version;
+	unsigned int		numVertices;
+	unsigned int		numIndices;
+	QuantBox			box;
+	unsigned int		vertexOffset;		// from the start of the file, 16-byte aligned
+	unsigned int		indexOffset;
+	unsigned long long	checksum;			// of the vertices and indices, see ChunkChecksum
+};
+
+// A parsed chunk; the pointers point into the (mapped) file
+struct ChunkView
+{
+	const ChunkHeader*		header;
+	const PackedVertex*		vertices;
+	const unsigned int*		indices;
+};
+
+struct ChunkInfo
+{
+	unsigned int		id;
+	float				boxMin[3], boxMax[3];
+	float				center[3], radius;		// bounding sphere
+	unsigned long long	bytes;					// of the file
+	std::string			file;					// relative to the index
+};
+
+struct SceneIndex
+{
+	std::string				directory;			// of scene.idx
+	std::vector<ChunkInfo>	chunks;
+};
+
+// Quantizes vertices against their box and writes them as chunk id of index (in
+// index.directory)
+bool AddChunk( SceneIndex& index, const FloatVertex* vertices, int numVertices, const unsigned int* indices, int numIndices );
+
+// Splits a mesh into chunks of a grid of cellSize: every triangle goes to the cell of
+// its centroid, with the vertices it uses. Returns the number of chunks written.
+int SplitIntoChunks( SceneIndex& index, const FloatVertex* vertices, int numVertices, const unsigned int* indices,
+					 int numIndices, float cellSize );
+
+bool WriteSceneIndex( const SceneIndex& index );					// index.directory/scene.idx
+bool ReadSceneIndex( const std::string& directory, SceneIndex& index );
+
+bool ParseChunk( const unsigned char* data, size_t size, ChunkView& view );
+unsigned long long ChunkChecksum( const void* data, size_t size );
+
+//--------------------------------------------------------------------------------------
+// Streaming
+//--------------------------------------------------------------------------------------
+struct StreamView
+{
+	float				eye[3];
+	float				direction[3];		// normalized view direction
+	float				velocity[3];		// units per second
+	float				lookahead;			// seconds of predicted motion (0: none)
+	float				fovY;				// radians
+	float				screenHeight;		// pixels
+};
+
+struct StreamSettings
+{
+	size_t				budgetBytes;		// mapped chunks never take more (except Require)
+	int					loadThreads;
+	float				minPixels;			// chunks projected smaller are not wanted
+	float				behindScale;		// importance of chunks behind the camera, 0..1
+
+	StreamSettings() : budgetBytes( 256 << 20 ), loadThreads( 2 ), minPixels( 8.0f ), behindScale( 0.25f ) {}
+};
+
+class SceneStreamer
+{
+public:
+	SceneStreamer( const SceneIndex& index, const StreamSettings& settings );
+	~SceneStreamer();
+
+	// Once per frame: ranks the chunks for view and queues loads, most important first.
+	// Pointers from Acquire/Require stay valid until the next Update.
+	void Update( const StreamView& view );
+
+	// The chunk if it is mapped (and marks it used), else NULL and a miss
+	const ChunkView* Acquire( unsigned int chunk );
+
+	// ... or waits for it, at the head of the queue and over the budget if need be
+	const ChunkView* Require( unsigned int chunk );
+
+	// Chunks wanted by the last Update, most important first
+	const std::vector<unsigned int>& Wanted() const { return _wanted; }
+	float Importance( unsigned int chunk ) const { return _chunks[chunk].importance; }
+
+	// Chunks unmapped since the last call (to release what was made from them)
+	void TakeEvicted( std::vector<unsigned int>& chunks );
+
+	// ... copied into arena (valid until its reset), so a frame doesn't touch the heap
+	const unsigned int* TakeEvicted( LinearArena& arena, size_t& count );
+
+	// Waits until nothing is loading or queued
+	void Drain();
+
+	struct Stats
+	{
+		size_t				residentBytes;
+		size_t				peakResidentBytes;
+		unsigned int		residentChunks;
+		unsigned int		queued;				// waiting to load
+		unsigned long long	loads;
+		unsigned long long	evictions;
+		unsigned long long	acquires;
+		unsigned long long	misses;				// Acquire of a chunk that wasn't mapped
+		unsigned long long	stalls;				// Require had to wait
+		double				stallMs;
+		double				loadMs;				// map + page in, summed over the threads
+	};
+	Stats GetStats() const;
+	void ResetStats();				// counters and peak only
+
+private:
+	enum State { UNLOADED, QUEUED, LOADING, RESIDENT };
+
+	struct Chunk
+	{
+		State							state;
+		float							importance;
+		unsigned int					lastUsed;		// frame of the last Acquire/Require
+		bool							wanted;			// by the last Update
+		bool							required;
+		MappedFile*						file;
+		ChunkView						view;
+		std::list<unsigned int>::iterator	lru;		// in _lru while resident
+	};
+
+	float ComputeImportance( const ChunkInfo& info, const StreamView& view ) const;
+	bool MakeRoom( size_t bytes, bool force );			// with _mutex held
+	void LoaderLoop();
+
+	SceneIndex						_index;
+	StreamSettings					_settings;
+	std::vector<Chunk>				_chunks;
+	std::vector<unsigned int>		_wanted;
+	std::vector<unsigned int>		_queue;				// most important last (popped from the back)
+	std::list<unsigned int>			_lru;				// resident chunks, most recently used first
+	std::vector<unsigned int>		_evicted;
+	unsigned int					_frame;
+	size_t							_loadingBytes;
+
+	mutable std::mutex				_mutex;
+	std::condition_variable			_wakeLoaders;
+	std::condition_variable			_loaded;
+	std::vector<std::thread>		_threads;
+	bool							_quit;
+	Stats							_stats;
+};
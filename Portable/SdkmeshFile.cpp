@@ -0,0 +1,177 @@
+//--------------------------------------------------------------------------------------
+// File: SdkmeshFile.cpp
+//--------------------------------------------------------------------------------------
+#include "SdkmeshFile.h"
+
+#include <cstring>
+
+using namespace std;
+
+//--------------------------------------------------------------------------------------
+// The .sdkmesh layout (SDKmesh.h, version 101)
+//--------------------------------------------------------------------------------------
+#pragma pack( push, 8 )
+struct SdkmeshHeader
+{
+	unsigned int		version;
+	unsigned char		isBigEndian;
+	unsigned long long	headerSize, nonBufferDataSize, bufferDataSize;
+	unsigned int		numVertexBuffers, numIndexBuffers, numMeshes, numTotalSubsets, numFrames, numMaterials;
+	unsigned long long	vertexStreamHeadersOffset, indexStreamHeadersOffset, meshDataOffset, subsetDataOffset,
+						frameDataOffset, materialDataOffset;
+};
+
+struct SdkmeshVertexElement			// D3DVERTEXELEMENT9
+{
+	unsigned short		stream, offset;
+	unsigned char		type, method, usage, usageIndex;
+};
+
+struct SdkmeshVertexBufferHeader
+{
+	unsigned long long		numVertices, sizeBytes, strideBytes;
+	SdkmeshVertexElement	decl[32];
+	unsigned long long		dataOffset;
+};
+
+struct SdkmeshIndexBufferHeader
+{
+	unsigned long long	numIndices, sizeBytes;
+	unsigned int		indexType;
+	unsigned long long	dataOffset;
+};
+
+struct SdkmeshMesh
+{
+	char				name[100];
+	unsigned char		numVertexBuffers;
+	unsigned int		vertexBuffers[16];
+	unsigned int		indexBuffer, numSubsets, numFrameInfluences;
+	float				boundingBoxCenter[3], boundingBoxExtents[3];
+	unsigned long long	subsetOffset, frameInfluenceOffset;
+};
+
+struct SdkmeshSubset
+{
+	char				name[100];
+	unsigned int		materialID, primitiveType;
+	unsigned long long	indexStart, indexCount, vertexStart, vertexCount;
+};
+
+struct SdkmeshMaterial
+{
+	char				name[100];
+	char				materialInstancePath[260];
+	char				diffuseTexture[260], normalTexture[260], specularTexture[260];
+	float				diffuse[4], ambient[4], specular[4], emissive[4];
+	float				power;
+	unsigned long long	runtime[6];		// texture and view pointers filled in by DXUT
+};
+#pragma pack( pop )
+
+static_assert( sizeof( SdkmeshHeader ) == 104 && sizeof( SdkmeshVertexBufferHeader ) == 288 &&
+			   sizeof( SdkmeshIndexBufferHeader ) == 32 && sizeof( SdkmeshMesh ) == 224 &&
+			   sizeof( SdkmeshSubset ) == 144 && sizeof( SdkmeshMaterial ) == 1256, "must match SDKmesh.h" );
+
+#define DECL_FLOAT2 1
+#define DECL_FLOAT3 2
+#define DECL_END 0xff
+#define USAGE_POSITION 0
+#define USAGE_NORMAL 3
+#define USAGE_TEXCOORD 5
+#define INDEX_32BIT 1
+
+bool ReadSdkmesh( const unsigned char* data, size_t size, SdkmeshData& out )
+{
+	const SdkmeshHeader* header = ( const SdkmeshHeader* )data;
+	if( size < sizeof( SdkmeshHeader ) || header->version != 101 || header->numMeshes == 0 || header->numVertexBuffers == 0 ||
+		header->meshDataOffset + sizeof( SdkmeshMesh ) > size ||
+		header->vertexStreamHeadersOffset + header->numVertexBuffers * sizeof( SdkmeshVertexBufferHeader ) > size ||
+		header->indexStreamHeadersOffset + header->numIndexBuffers * sizeof( SdkmeshIndexBufferHeader ) > size ||
+		header->materialDataOffset + header->numMaterials * sizeof( SdkmeshMaterial ) > size )
+		return false;
+	const SdkmeshMesh* mesh = ( const SdkmeshMesh* )( data + header->meshDataOffset );
+	if( mesh->numVertexBuffers == 0 || mesh->vertexBuffers[0] >= header->numVertexBuffers )
+		return false;
+	const SdkmeshVertexBufferHeader* vb = ( const SdkmeshVertexBufferHeader* )( data + header->vertexStreamHeadersOffset ) +
+										  mesh->vertexBuffers[0];
+	if( vb->dataOffset + vb->numVertices * vb->strideBytes > size )
+		return false;
+
+	int offsets[3] = { -1, -1, -1 };
+	for( int i = 0; i < 32 && vb->decl[i].stream != DECL_END; ++i )
+	{
+		const SdkmeshVertexElement& e = vb->decl[i];
+		if( e.usage == USAGE_POSITION && e.type == DECL_FLOAT3 && e.usageIndex == 0 )
+			offsets[0] = e.offset;
+		else if( e.usage == USAGE_NORMAL && e.type == DECL_FLOAT3 && e.usageIndex == 0 )
+			offsets[1] = e.offset;
+		else if( e.usage == USAGE_TEXCOORD && e.type == DECL_FLOAT2 && e.usageIndex == 0 )
+			offsets[2] = e.offset;
+	}
+	if( offsets[0] < 0 || offsets[1] < 0 || offsets[2] < 0 )
+		return false;
+
+	out.stride = ( unsigned int )vb->strideBytes;
+	out.vertices.resize( ( size_t )vb->numVertices );
+	for( size_t i = 0; i < out.vertices.size(); ++i )
+	{
+		const unsigned char* v = data + vb->dataOffset + i * vb->strideBytes;
+		memcpy( out.vertices[i].pos, v + offsets[0], 12 );
+		memcpy( out.vertices[i].normal, v + offsets[1], 12 );
+		memcpy( out.vertices[i].uv, v + offsets[2], 8 );
+	}
+
+	// indices (the index buffer is optional for what the quantizer needs)
+	out.indices.clear();
+	if( mesh->indexBuffer < header->numIndexBuffers )
+	{
+		const SdkmeshIndexBufferHeader* ib = ( const SdkmeshIndexBufferHeader* )( data + header->indexStreamHeadersOffset ) +
+											 mesh->indexBuffer;
+		unsigned int indexBytes = ib->indexType == INDEX_32BIT ? 4 : 2;
+		if( ib->dataOffset + ib->numIndices * indexBytes > size )
+			return false;
+		out.indices.resize( ( size_t )ib->numIndices );
+		const unsigned char* indices = data + ib->dataOffset;
+		for( size_t i = 0; i < out.indices.size(); ++i )
+		{
+			if( indexBytes == 4 )
+				memcpy( &out.indices[i], indices + i * 4, 4 );
+			else
+			{
+				unsigned short index;
+				memcpy( &index, indices + i * 2, 2 );
+				out.indices[i] = index;
+			}
+		}
+	}
+
+	if( mesh->subsetOffset + mesh->numSubsets * sizeof( unsigned int ) > size )
+		return false;
+	const unsigned int* subsetIndices = ( const unsigned int* )( data + mesh->subsetOffset );
+	out.subsets.clear();
+	for( unsigned int i = 0; i < mesh->numSubsets; ++i )
+	{
+		if( subsetIndices[i] >= header->numTotalSubsets ||
+			header->subsetDataOffset + ( subsetIndices[i] + 1ull ) * sizeof( SdkmeshSubset ) > size )
+			return false;
+		const SdkmeshSubset* subset = ( const SdkmeshSubset* )( data + header->subsetDataOffset ) + subsetIndices[i];
+		SdkmeshSubsetInfo info;
+		info.indexStart = ( unsigned int )subset->indexStart;
+		info.indexCount = ( unsigned int )subset->indexCount;
+		info.vertexStart = ( unsigned int )subset->vertexStart;
+		info.vertexCount = ( unsigned int )subset->vertexCount;
+		info.material = subset->materialID;
+		info.primitiveType = subset->primitiveType;
+		if( !out.indices.empty() && subset->indexStart + subset->indexCount > out.indices.size() )
+			return false;
+		out.subsets.push_back( info );
+	}
+
+	const SdkmeshMaterial* materials = ( const SdkmeshMaterial* )( data + header->materialDataOffset );
+	out.diffuseTextures.clear();
+	for( unsigned int m = 0; m < header->numMaterials; ++m )
+		out.diffuseTextures.push_back( string( materials[m].diffuseTexture,
+											   strnlen( materials[m].diffuseTexture, sizeof( materials[m].diffuseTexture ) ) ) );
+	return true;
+}
@@ -0,0 +1,36 @@
+//--------------------------------------------------------------------------------------
+// File: SdkmeshFile.h
+//
+// Reads the parts of an .sdkmesh (version 101, as written for SDKmesh.h) the tools and
+// the CPU passes need, without DXUT: mesh 0's first vertex buffer (float3 position,
+// float3 normal, float2 texcoord), its index buffer, subsets and the diffuse texture
+// name of every material.
+//--------------------------------------------------------------------------------------
+#pragma once
+
+#include "VertexQuantize.h"
+
+#include <string>
+#include <vector>
+
+#define SDKMESH_TRIANGLE_LIST 0			// SDKMESH_PRIMITIVE_TYPE PT_TRIANGLE_LIST
+
+struct SdkmeshSubsetInfo
+{
+	unsigned int	indexStart, indexCount;		// in the index buffer
+	unsigned int	vertexStart, vertexCount;	// vertexStart is added to every index
+	unsigned int	material;
+	unsigned int	primitiveType;
+};
+
+struct SdkmeshData
+{
+	std::vector<FloatVertex>		vertices;
+	std::vector<unsigned int>		indices;			// 16-bit ones widened
+	std::vector<SdkmeshSubsetInfo>	subsets;
+	std::vector<std::string>		diffuseTextures;	// per material, "" for none
+	unsigned int					stride;				// of the vertices in the file
+};
+
+// false if it isn't an sdkmesh with that vertex layout or anything is out of bounds
+bool ReadSdkmesh( const unsigned char* data, size_t size, SdkmeshData& mesh );
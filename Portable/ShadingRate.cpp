@@ -0,0 +1,168 @@
+//--------------------------------------------------------------------------------------
+// File: ShadingRate.cpp
+//--------------------------------------------------------------------------------------
+#include "ShadingRate.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+void CpuRateMap::Resize( int width, int height )
+{
+	tilesX = ( width + CPU_RATE_TILE - 1 ) / CPU_RATE_TILE;
+	tilesY = ( height + CPU_RATE_TILE - 1 ) / CPU_RATE_TILE;
+	rate.assign( ( size_t )tilesX * tilesY, 1 );
+}
+
+CpuRateCounts::CpuRateCounts() : pixels( 0 ), aoShaded( 0 ), compositeShaded( 0 )
+{
+	tiles[0] = tiles[1] = tiles[2] = 0;
+}
+
+void CpuRateCounts::Add( const CpuRateCounts& other )
+{
+	for( int i = 0; i < 3; ++i )
+		tiles[i] += other.tiles[i];
+	pixels += other.pixels;
+	aoShaded += other.aoShaded;
+	compositeShaded += other.compositeShaded;
+}
+
+static inline int RateIndex( int rate )
+{
+	return rate == 4 ? 2 : rate == 2 ? 1 : 0;
+}
+
+//--------------------------------------------------------------------------------------
+// Rate map
+//--------------------------------------------------------------------------------------
+static inline float Luminance( const CpuFloat4& c )
+{
+	return 0.299f * c.x + 0.587f * c.y + 0.114f * c.z;
+}
+
+static inline float NormalCosine( const CpuFloat3& a, const CpuFloat3& b )
+{
+	float lengths = sqrtf( ( a.x * a.x + a.y * a.y + a.z * a.z ) * ( b.x * b.x + b.y * b.y + b.z * b.z ) );
+	return lengths > 0.0f ? ( a.x * b.x + a.y * b.y + a.z * b.z ) / lengths : 1.0f;
+}
+
+// Can the tile [x0, x1) x [y0, y1) be shaded in rate x rate blocks?
+static bool TileAllowsRate( const CpuGBuffer& gbuffer, const CpuRateParams& params, int x0, int y0, int x1, int y1,
+							int rate )
+{
+	const int width = gbuffer.width;
+	float lumaError = 0.0f;
+	int pixels = 0;
+	for( int by = y0; by < y1; by += rate )
+		for( int bx = x0; bx < x1; bx += rate )
+		{
+			int ex = min( bx + rate, x1 ), ey = min( by + rate, y1 );
+			int shaded = min( by + rate / 2, ey - 1 ) * width + min( bx + rate / 2, ex - 1 );
+			float sz = gbuffer.viewZ[shaded];
+			float sluma = Luminance( gbuffer.diffuse[shaded] );
+			const CpuFloat3& sn = gbuffer.normal[shaded];
+			for( int y = by; y < ey; ++y )
+				for( int x = bx; x < ex; ++x )
+				{
+					int pixel = y * width + x;
+					float z = gbuffer.viewZ[pixel];
+					if( ( z == 0.0f ) != ( sz == 0.0f ) )
+						return false;
+					if( z != 0.0f && ( fabsf( z - sz ) > params.depthThreshold * sz ||
+									   NormalCosine( gbuffer.normal[pixel], sn ) < params.normalThreshold ) )
+						return false;
+					float d = Luminance( gbuffer.diffuse[pixel] ) - sluma;
+					lumaError += d * d;
+					++pixels;
+				}
+		}
+	return lumaError <= params.lumaThreshold * params.lumaThreshold * pixels;
+}
+
+void BuildRateMap( const CpuGBuffer& gbuffer, const CpuRateParams& params, int y0, int y1, CpuRateMap& map,
+				   CpuRateCounts* counts )
+{
+	CpuRateCounts local;
+	for( int ty = y0 / CPU_RATE_TILE; ty * CPU_RATE_TILE < y1; ++ty )
+		for( int tx = 0; tx < map.tilesX; ++tx )
+		{
+			int x0 = tx * CPU_RATE_TILE, x1 = min( x0 + CPU_RATE_TILE, gbuffer.width );
+			int ty0 = ty * CPU_RATE_TILE, ty1 = min( ty0 + CPU_RATE_TILE, gbuffer.height );
+			int rate = 1;
+			for( int r = params.maxRate; r > 1 && rate == 1; r /= 2 )
+				if( TileAllowsRate( gbuffer, params, x0, ty0, x1, ty1, r ) )
+					rate = r;
+			map.rate[ty * map.tilesX + tx] = ( unsigned char )rate;
+			++local.tiles[RateIndex( rate )];
+		}
+	if( counts )
+		counts->Add( local );
+}
+
+//--------------------------------------------------------------------------------------
+// Shading
+//--------------------------------------------------------------------------------------
+void ComputeAOCoarse( const CpuGBuffer& gbuffer, const CpuRateMap& map, const CpuAOParams& params,
+					  const CpuFloat2 rotations[CPU_NUMLAYERS], int y0, int y1, vector<float>& ao,
+					  CpuRateCounts* counts )
+{
+	const int width = gbuffer.width;
+	ao.resize( ( size_t )width * gbuffer.height );
+
+	static thread_local vector<CpuFloat2> taps;
+	unsigned long long shadedCount = 0;
+	for( int ty = y0 / CPU_RATE_TILE; ty * CPU_RATE_TILE < y1; ++ty )
+		for( int tx = 0; tx < map.tilesX; ++tx )
+		{
+			const int rate = map.rate[ty * map.tilesX + tx];
+			int x0 = tx * CPU_RATE_TILE, x1 = min( x0 + CPU_RATE_TILE, width );
+			int ty0 = ty * CPU_RATE_TILE, ty1 = min( ty0 + CPU_RATE_TILE, gbuffer.height );
+			for( int by = ty0; by < ty1; by += rate )
+				for( int bx = x0; bx < x1; bx += rate )
+				{
+					int ex = min( bx + rate, x1 ), ey = min( by + rate, ty1 );
+					int sx = min( bx + rate / 2, ex - 1 ), sy = min( by + rate / 2, ey - 1 );
+					float z = gbuffer.viewZ[sy * width + sx];
+					float value = 1.0f;
+					if( z != 0.0f )
+					{
+						CpuFloat3 p = gbuffer.ViewPosition( ( float )sx, ( float )sy, z );
+						const CpuFloat2& rotation = rotations[( sy % CPU_INTERLEAVE ) * CPU_INTERLEAVE + sx % CPU_INTERLEAVE];
+						value = ComputeAOPixel( gbuffer, params, rotation, sx, sy, p, gbuffer.normal[sy * width + sx], taps );
+						++shadedCount;
+					}
+					for( int y = by; y < ey; ++y )
+						for( int x = bx; x < ex; ++x )
+							ao[y * width + x] = value;
+				}
+		}
+	if( counts )
+		counts->aoShaded += shadedCount;
+}
+
+void CompositeCoarse( const CpuGBuffer& gbuffer, const vector<float>& ao, const CpuRateMap& map,
+					  CpuCompositeBlocksFunc composite, const CpuFloat3& lightPos, int y0, int y1,
+					  vector<CpuFloat4>& out, CpuRateCounts* counts )
+{
+	const int width = gbuffer.width;
+	out.resize( ( size_t )width * gbuffer.height );
+
+	CpuRateCounts local;
+	for( int ty = y0 / CPU_RATE_TILE; ty * CPU_RATE_TILE < y1; ++ty )
+		for( int tx = 0; tx < map.tilesX; ++tx )
+		{
+			const int rate = map.rate[ty * map.tilesX + tx];
+			int x0 = tx * CPU_RATE_TILE, x1 = min( x0 + CPU_RATE_TILE, width );
+			int ty0 = ty * CPU_RATE_TILE, ty1 = min( ty0 + CPU_RATE_TILE, gbuffer.height );
+			composite( gbuffer, ao, lightPos, x0, ty0, x1, ty1, rate, out );
+			local.pixels += ( x1 - x0 ) * ( ty1 - ty0 );
+			local.compositeShaded += ( ( x1 - x0 + rate - 1 ) / rate ) * ( ( ty1 - ty0 + rate - 1 ) / rate );
+		}
+	if( counts )
+	{
+		counts->pixels += local.pixels;
+		counts->compositeShaded += local.compositeShaded;
+	}
+}
@@ -0,0 +1,69 @@
+//--------------------------------------------------------------------------------------
+// File: ShadingRate.h
+//
+// Coarse (variable-rate) shading of the passes after the G-buffer. Most of a frame is
+// smooth interiors where shading one pixel in 2x2 or 4x4 and broadcasting it looks
+// the same as shading them all. A rate map gives every 16x16 tile the coarsest rate
+// at which the pixels of each block still match the one that gets shaded: same
+// coverage, view Z and normal within thresholds, and diffuse luminance within an RMS
+// error over the tile. Silhouettes and textured tiles stay at 1x1, background and
+// flat tiles go to 4x4. AO and the composite then shade per block. The GPU does the
+// same for the simple AO (PSShadingRate, PSAOCoarse and PSAOVrs in DeferredShading.fx).
+//--------------------------------------------------------------------------------------
+#pragma once
+
+#include "CpuPasses.h"
+
+#include <vector>
+
+#define CPU_RATE_TILE 16				// RATE_TILE of the shader
+
+// When a block may be shaded by one of its pixels (the ones of cbShadingRate)
+struct CpuRateParams
+{
+	float	lumaThreshold;		// RMS difference of the diffuse luminance to the shaded pixels
+	float	depthThreshold;		// view Z differs from the shaded pixel's by more than this fraction
+	float	normalThreshold;	// the normals' cosine is below this
+	int		maxRate;			// 1, 2 or 4
+
+	CpuRateParams() : lumaThreshold( 0.02f ), depthThreshold( 0.02f ), normalThreshold( 0.95f ), maxRate( 4 ) {}
+};
+
+// The shading rate (block size 1, 2 or 4) of every tile
+struct CpuRateMap
+{
+	int							tilesX, tilesY;
+	std::vector<unsigned char>	rate;
+
+	void Resize( int width, int height );
+	int Rate( int x, int y ) const { return rate[( y / CPU_RATE_TILE ) * tilesX + x / CPU_RATE_TILE]; }
+};
+
+// Tiles and shader invocations
+struct CpuRateCounts
+{
+	unsigned int		tiles[3];			// at 1x1, 2x2, 4x4
+	unsigned long long	pixels;
+	unsigned long long	aoShaded;			// AO evaluated (background pixels skip it)
+	unsigned long long	compositeShaded;
+
+	CpuRateCounts();
+	void Add( const CpuRateCounts& other );
+};
+
+// The rates of the tiles of the rows [y0, y1), which start and end on tile rows (or the
+// last row). map has to be Resize'd to the G-buffer.
+void BuildRateMap( const CpuGBuffer& gbuffer, const CpuRateParams& params, int y0, int y1, CpuRateMap& map,
+				   CpuRateCounts* counts = NULL );
+
+// PSAO of the rows [y0, y1) (on tile rows) into ao (width * height): the pixel of every
+// block nearest its centre, with its own rotation, broadcast to the block
+void ComputeAOCoarse( const CpuGBuffer& gbuffer, const CpuRateMap& map, const CpuAOParams& params,
+					  const CpuFloat2 rotations[CPU_NUMLAYERS], int y0, int y1, std::vector<float>& ao,
+					  CpuRateCounts* counts = NULL );
+
+// The composite of the rows [y0, y1) (on tile rows) at the rate of every tile, through
+// composite (SelectCompositeBlocks)
+void CompositeCoarse( const CpuGBuffer& gbuffer, const std::vector<float>& ao, const CpuRateMap& map,
+					  CpuCompositeBlocksFunc composite, const CpuFloat3& lightPos, int y0, int y1,
+					  std::vector<CpuFloat4>& out, CpuRateCounts* counts = NULL );
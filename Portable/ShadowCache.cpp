@@ -0,0 +1,457 @@
+//--------------------------------------------------------------------------------------
+// File: ShadowCache.cpp
+//
+// Incrementally updated shadow map and its depth-only rasterizer (see ShadowCache.h)
+//--------------------------------------------------------------------------------------
+#include "ShadowCache.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+//--------------------------------------------------------------------------------------
+// Rects and dirty tiles
+//--------------------------------------------------------------------------------------
+static const CpuShadowRect emptyRect = { 0, 0, 0, 0 };
+
+static CpuShadowRect Union( const CpuShadowRect& a, const CpuShadowRect& b )
+{
+	if( a.Empty() )
+		return b;
+	if( b.Empty() )
+		return a;
+	CpuShadowRect r = { min( a.x0, b.x0 ), min( a.y0, b.y0 ), max( a.x1, b.x1 ), max( a.y1, b.y1 ) };
+	return r;
+}
+
+static CpuShadowRect Intersect( const CpuShadowRect& a, const CpuShadowRect& b )
+{
+	CpuShadowRect r = { max( a.x0, b.x0 ), max( a.y0, b.y0 ), min( a.x1, b.x1 ), min( a.y1, b.y1 ) };
+	return r;
+}
+
+void ShadowDirtyTiles::Resize( int size )
+{
+	_tilesX = _tilesY = size / CPU_SHADOW_TILE;
+	_dirty.assign( ( size_t )_tilesX * _tilesY, 0 );
+	_count = 0;
+}
+
+void ShadowDirtyTiles::MarkAll()
+{
+	fill( _dirty.begin(), _dirty.end(), ( unsigned char )1 );
+	_count = ( int )_dirty.size();
+}
+
+void ShadowDirtyTiles::Mark( const CpuShadowRect& rect )
+{
+	if( rect.Empty() || _count == ( int )_dirty.size() )
+		return;
+	int tx0 = max( 0, rect.x0 / CPU_SHADOW_TILE ), tx1 = min( _tilesX - 1, ( rect.x1 - 1 ) / CPU_SHADOW_TILE );
+	int ty0 = max( 0, rect.y0 / CPU_SHADOW_TILE ), ty1 = min( _tilesY - 1, ( rect.y1 - 1 ) / CPU_SHADOW_TILE );
+	for( int ty = ty0; ty <= ty1; ++ty )
+		for( int tx = tx0; tx <= tx1; ++tx )
+		{
+			unsigned char& dirty = _dirty[ty * _tilesX + tx];
+			_count += !dirty;
+			dirty = 1;
+		}
+}
+
+void ShadowDirtyTiles::Mark( const ShadowDirtyTiles& other )
+{
+	for( size_t i = 0; i < _dirty.size(); ++i )
+	{
+		_count += !_dirty[i] && other._dirty[i];
+		_dirty[i] |= other._dirty[i];
+	}
+}
+
+void ShadowDirtyTiles::Clear()
+{
+	fill( _dirty.begin(), _dirty.end(), ( unsigned char )0 );
+	_count = 0;
+}
+
+CpuShadowRect ShadowDirtyTiles::Bounds() const
+{
+	CpuShadowRect bounds = emptyRect;
+	for( int ty = 0; ty < _tilesY; ++ty )
+		for( int tx = 0; tx < _tilesX; ++tx )
+			if( Dirty( tx, ty ) )
+			{
+				CpuShadowRect tile = { tx * CPU_SHADOW_TILE, ty * CPU_SHADOW_TILE,
+									   ( tx + 1 ) * CPU_SHADOW_TILE, ( ty + 1 ) * CPU_SHADOW_TILE };
+				bounds = Union( bounds, tile );
+			}
+	return bounds;
+}
+
+//--------------------------------------------------------------------------------------
+// Rasterizer
+//--------------------------------------------------------------------------------------
+Mat4 ShadowLightMatrix( const Vec3& eye, const Vec3& at, float fovY, float nearZ, float farZ )
+{
+	// an up vector that isn't along the light
+	Vec3 dir = Vec3Normalize( at - eye );
+	Vec3 up = fabsf( dir.y ) > 0.99f ? MakeVec3( 0.0f, 0.0f, 1.0f ) : MakeVec3( 0.0f, 1.0f, 0.0f );
+	return Mat4LookAtLH( eye, at, up ) * Mat4PerspectiveFovLH( fovY, 1.0f, nearZ, farZ );
+}
+
+// Clip space to texels: x, y on the map, clip-space Z, w (0 behind the light)
+static void ToTexels( Vec4* v, size_t count, int size )
+{
+	for( size_t i = 0; i < count; ++i )
+	{
+		if( !( v[i].w > 0.0f ) )
+		{
+			v[i] = MakeVec4( 0.0f, 0.0f, 0.0f, 0.0f );
+			continue;
+		}
+		float invW = 1.0f / v[i].w;
+		v[i].x = ( v[i].x * invW * 0.5f + 0.5f ) * size;
+		v[i].y = ( 0.5f - v[i].y * invW * 0.5f ) * size;
+		v[i].z = v[i].z * invW;
+	}
+}
+
+// Triangles with a vertex behind the light or its near plane are not drawn: the light
+// is meant to be outside the scene
+static inline bool Drawable( const Vec4& a, const Vec4& b, const Vec4& c )
+{
+	return a.w > 0.0f && b.w > 0.0f && c.w > 0.0f && a.z >= 0.0f && b.z >= 0.0f && c.z >= 0.0f;
+}
+
+// Texel coordinate of a bound, clamped before the conversion so far vertices don't overflow
+static inline int Texel( float x, int size, bool upper )
+{
+	x = min( max( x, -1.0f ), size + 1.0f );
+	return upper ? ( int )ceilf( x ) : ( int )floorf( x );
+}
+
+unsigned int DrawShadowTriangle( const Vec4& a, const Vec4& b, const Vec4& c, const CpuShadowRect& rect,
+								 int size, float* depth )
+{
+	// both faces count, so every triangle is turned clockwise
+	const Vec4* v[3] = { &a, &b, &c };
+	float area = ( b.x - a.x ) * ( c.y - a.y ) - ( c.x - a.x ) * ( b.y - a.y );
+	if( area < 0.0f )
+	{
+		swap( v[1], v[2] );
+		area = -area;
+	}
+	if( !( area > 0.0f ) )
+		return 0;
+
+	int minX = max( rect.x0, Texel( min( a.x, min( b.x, c.x ) ), size, false ) );
+	int maxX = min( rect.x1 - 1, Texel( max( a.x, max( b.x, c.x ) ), size, true ) );
+	int minY = max( rect.y0, Texel( min( a.y, min( b.y, c.y ) ), size, false ) );
+	int maxY = min( rect.y1 - 1, Texel( max( a.y, max( b.y, c.y ) ), size, true ) );
+	if( minX > maxX || minY > maxY )
+		return 0;
+
+	float ex[3], ey[3], ec[3];
+	for( int i = 0; i < 3; ++i )
+	{
+		const Vec4& p = *v[( i + 1 ) % 3];
+		const Vec4& q = *v[( i + 2 ) % 3];
+		ex[i] = p.y - q.y;
+		ey[i] = q.x - p.x;
+		ec[i] = p.x * q.y - q.x * p.y;
+	}
+
+	// the edge functions are evaluated at every texel (not stepped), so a texel gets the
+	// same depth whatever rect it is drawn through
+	float invArea = 1.0f / area;
+	unsigned int covered = 0;
+	for( int y = minY; y <= maxY; ++y )
+	{
+		float py = y + 0.5f;
+		float* row = depth + ( size_t )y * size;
+		for( int x = minX; x <= maxX; ++x )
+		{
+			float px = x + 0.5f;
+			float e0 = ex[0] * px + ey[0] * py + ec[0];
+			float e1 = ex[1] * px + ey[1] * py + ec[1];
+			float e2 = ex[2] * px + ey[2] * py + ec[2];
+			if( e0 < 0.0f || e1 < 0.0f || e2 < 0.0f )
+				continue;
+			float z = ( e0 * v[0]->z + e1 * v[1]->z + e2 * v[2]->z ) * invArea;
+			++covered;
+			if( z < row[x] )
+				row[x] = z;
+		}
+	}
+	return covered;
+}
+
+//--------------------------------------------------------------------------------------
+// ShadowCache
+//--------------------------------------------------------------------------------------
+ShadowCacheStats::ShadowCacheStats()
+	: lightChanged( false ), dirtyTiles( 0 ), staticTiles( 0 ), staticTriangles( 0 ), dynamicTriangles( 0 ), texels( 0 )
+{
+}
+
+ShadowCache::ShadowCache( int size )
+	: _size( size ), _tiles( size / CPU_SHADOW_TILE ), _lightVersion( 0 )
+{
+	_bins.resize( ( size_t )_tiles * _tiles );
+	_static.assign( ( size_t )size * size, 1.0f );
+	_depth.assign( ( size_t )size * size, 1.0f );
+	_staticDirty.Resize( size );
+	_dirty.Resize( size );
+	_updated.Resize( size );
+}
+
+void ShadowCache::SetLight( const Mat4& viewProjection )
+{
+	_light.Set( viewProjection );
+}
+
+static void AppendTriangles( const CpuMesh& mesh, unsigned int firstVertex, vector<unsigned int>& triangles )
+{
+	for( size_t s = 0; s < mesh.subsets.size(); ++s )
+	{
+		const CpuMesh::Subset& subset = mesh.subsets[s];
+		for( unsigned int i = 0; i < subset.indexCount; ++i )
+			triangles.push_back( firstVertex + subset.vertexStart + mesh.indices[subset.indexStart + i] );
+	}
+}
+
+void ShadowCache::AddStatic( const CpuMesh& mesh, const Mat4& world )
+{
+	size_t firstVertex = _staticPosition.size(), firstTriangle = _staticTriangles.size() / 3;
+	_staticPosition.resize( firstVertex + mesh.vertices.size() );
+	for( size_t i = 0; i < mesh.vertices.size(); ++i )
+		_staticPosition[firstVertex + i] = MakeVec3( mesh.vertices[i].pos[0], mesh.vertices[i].pos[1], mesh.vertices[i].pos[2] );
+	if( !mesh.vertices.empty() )
+		TransformPointsAffine( world, &_staticPosition[firstVertex], &_staticPosition[firstVertex], mesh.vertices.size() );
+	AppendTriangles( mesh, ( unsigned int )firstVertex, _staticTriangles );
+
+	// a light that changed since the last Update bins everything then
+	if( _lightVersion && _light.version == _lightVersion )
+		_staticDirty.Mark( ProjectStatic( firstVertex, firstTriangle ) );
+}
+
+void ShadowCache::ClearStatic()
+{
+	_staticPosition.clear();
+	_staticScreen.clear();
+	_staticTriangles.clear();
+	for( size_t i = 0; i < _bins.size(); ++i )
+		_bins[i].clear();
+	_staticDirty.MarkAll();
+}
+
+int ShadowCache::AddInstance( const CpuMesh& mesh, const Mat4& world, float puffiness )
+{
+	_instances.push_back( Instance() );
+	Instance& instance = _instances.back();
+	instance.mesh = &mesh;
+	instance.world.Set( world );
+	instance.puffiness.Set( puffiness );
+	instance.worldVersion = instance.puffinessVersion = 0;
+	instance.bounds = emptyRect;
+	AppendTriangles( mesh, 0, instance.triangles );
+	return ( int )_instances.size() - 1;
+}
+
+void ShadowCache::SetInstance( int instance, const Mat4& world, float puffiness )
+{
+	_instances[instance].world.Set( world );
+	_instances[instance].puffiness.Set( puffiness );
+}
+
+void ShadowCache::Invalidate()
+{
+	_staticDirty.MarkAll();
+}
+
+CpuShadowRect ShadowCache::TriangleBounds( const Vec4& a, const Vec4& b, const Vec4& c ) const
+{
+	if( !Drawable( a, b, c ) )
+		return emptyRect;
+	CpuShadowRect r = { Texel( min( a.x, min( b.x, c.x ) ), _size, false ), Texel( min( a.y, min( b.y, c.y ) ), _size, false ),
+						Texel( max( a.x, max( b.x, c.x ) ), _size, true ) + 1, Texel( max( a.y, max( b.y, c.y ) ), _size, true ) + 1 };
+	CpuShadowRect map = { 0, 0, _size, _size };
+	r = Intersect( r, map );
+	return r.Empty() ? emptyRect : r;
+}
+
+CpuShadowRect ShadowCache::TileRect( int tileX, int tileY ) const
+{
+	CpuShadowRect r = { tileX * CPU_SHADOW_TILE, tileY * CPU_SHADOW_TILE,
+						( tileX + 1 ) * CPU_SHADOW_TILE, ( tileY + 1 ) * CPU_SHADOW_TILE };
+	return r;
+}
+
+// Projects the static vertices from firstVertex and bins the triangles from
+// firstTriangle to the tiles they touch; returns the region of those triangles
+CpuShadowRect ShadowCache::ProjectStatic( size_t firstVertex, size_t firstTriangle )
+{
+	size_t count = _staticPosition.size() - firstVertex;
+	_staticScreen.resize( _staticPosition.size() );
+	if( count )
+	{
+		TransformPoints( _light.value, &_staticPosition[firstVertex], &_staticScreen[firstVertex], count );
+		ToTexels( &_staticScreen[firstVertex], count, _size );
+	}
+
+	CpuShadowRect region = emptyRect;
+	for( size_t t = firstTriangle; t < _staticTriangles.size() / 3; ++t )
+	{
+		const unsigned int* i = &_staticTriangles[t * 3];
+		CpuShadowRect r = TriangleBounds( _staticScreen[i[0]], _staticScreen[i[1]], _staticScreen[i[2]] );
+		if( r.Empty() )
+			continue;
+		region = Union( region, r );
+		for( int ty = r.y0 / CPU_SHADOW_TILE; ty <= ( r.y1 - 1 ) / CPU_SHADOW_TILE; ++ty )
+			for( int tx = r.x0 / CPU_SHADOW_TILE; tx <= ( r.x1 - 1 ) / CPU_SHADOW_TILE; ++tx )
+				_bins[ty * _tiles + tx].push_back( ( unsigned int )t );
+	}
+	return region;
+}
+
+void ShadowCache::ProjectInstance( Instance& instance )
+{
+	if( instance.puffinessVersion != instance.puffiness.version )
+		DisplaceVertices( *instance.mesh, instance.puffiness.value, instance.displaced );
+	instance.worldVersion = instance.world.version;
+	instance.puffinessVersion = instance.puffiness.version;
+
+	size_t count = instance.displaced.position.size();
+	instance.screen.resize( count );
+	if( count )
+	{
+		TransformPoints( instance.world.value * _light.value, &instance.displaced.position[0], &instance.screen[0], count );
+		ToTexels( &instance.screen[0], count, _size );
+	}
+
+	instance.bounds = emptyRect;
+	const vector<unsigned int>& triangles = instance.triangles;
+	for( size_t t = 0; t + 2 < triangles.size(); t += 3 )
+		instance.bounds = Union( instance.bounds, TriangleBounds( instance.screen[triangles[t]], instance.screen[triangles[t + 1]],
+																  instance.screen[triangles[t + 2]] ) );
+}
+
+void ShadowCache::Update( ShadowCacheStats* stats )
+{
+	ShadowCacheStats local;
+	ShadowCacheStats& s = stats ? *stats : local;
+	s = ShadowCacheStats();
+
+	// a new light moves everything on the map
+	if( _light.version != _lightVersion )
+	{
+		_lightVersion = _light.version;
+		for( size_t i = 0; i < _bins.size(); ++i )
+			_bins[i].clear();
+		ProjectStatic( 0, 0 );
+		_staticDirty.MarkAll();
+		s.lightChanged = true;
+	}
+	_dirty.Mark( _staticDirty );
+
+	// an instance that moved dirties where it was and where it is
+	for( size_t i = 0; i < _instances.size(); ++i )
+	{
+		Instance& instance = _instances[i];
+		if( !s.lightChanged && instance.worldVersion == instance.world.version &&
+			instance.puffinessVersion == instance.puffiness.version )
+			continue;
+		_dirty.Mark( instance.bounds );
+		ProjectInstance( instance );
+		_dirty.Mark( instance.bounds );
+	}
+
+	// the static cache: its dirty tiles from the triangles binned to them
+	for( int ty = 0; ty < _tiles; ++ty )
+		for( int tx = 0; tx < _tiles; ++tx )
+		{
+			if( !_staticDirty.Dirty( tx, ty ) )
+				continue;
+			CpuShadowRect tile = TileRect( tx, ty );
+			for( int y = tile.y0; y < tile.y1; ++y )
+				fill( &_static[( size_t )y * _size + tile.x0], &_static[( size_t )y * _size + tile.x1], 1.0f );
+			const vector<unsigned int>& bin = _bins[ty * _tiles + tx];
+			for( size_t b = 0; b < bin.size(); ++b )
+			{
+				const unsigned int* i = &_staticTriangles[bin[b] * 3];
+				s.texels += DrawShadowTriangle( _staticScreen[i[0]], _staticScreen[i[1]], _staticScreen[i[2]], tile, _size, &_static[0] );
+			}
+			s.staticTriangles += ( unsigned int )bin.size();
+			++s.staticTiles;
+		}
+
+	// the map: the static cache, then the instances over it
+	for( int ty = 0; ty < _tiles; ++ty )
+		for( int tx = 0; tx < _tiles; ++tx )
+		{
+			if( !_dirty.Dirty( tx, ty ) )
+				continue;
+			CpuShadowRect tile = TileRect( tx, ty );
+			for( int y = tile.y0; y < tile.y1; ++y )
+				copy( &_static[( size_t )y * _size + tile.x0], &_static[( size_t )y * _size + tile.x1], &_depth[( size_t )y * _size + tile.x0] );
+		}
+
+	CpuShadowRect dirtyBounds = _dirty.Bounds();
+	for( size_t n = 0; n < _instances.size(); ++n )
+	{
+		const Instance& instance = _instances[n];
+		if( Intersect( instance.bounds, dirtyBounds ).Empty() )
+			continue;
+		const vector<unsigned int>& triangles = instance.triangles;
+		for( size_t t = 0; t + 2 < triangles.size(); t += 3 )
+		{
+			const Vec4& a = instance.screen[triangles[t]];
+			const Vec4& b = instance.screen[triangles[t + 1]];
+			const Vec4& c = instance.screen[triangles[t + 2]];
+			CpuShadowRect r = Intersect( TriangleBounds( a, b, c ), dirtyBounds );
+			if( r.Empty() )
+				continue;
+			for( int ty = r.y0 / CPU_SHADOW_TILE; ty <= ( r.y1 - 1 ) / CPU_SHADOW_TILE; ++ty )
+				for( int tx = r.x0 / CPU_SHADOW_TILE; tx <= ( r.x1 - 1 ) / CPU_SHADOW_TILE; ++tx )
+					if( _dirty.Dirty( tx, ty ) )
+					{
+						s.texels += DrawShadowTriangle( a, b, c, TileRect( tx, ty ), _size, &_depth[0] );
+						++s.dynamicTriangles;
+					}
+		}
+	}
+
+	s.dirtyTiles = _dirty.Count();
+	_updated = _dirty;
+	_dirty.Clear();
+	_staticDirty.Clear();
+}
+
+//--------------------------------------------------------------------------------------
+// Lookup
+//--------------------------------------------------------------------------------------
+float ShadowVisibility( const ShadowCache& cache, const Vec3& worldPosition, float bias )
+{
+	Vec4 p = Vec4Transform( MakeVec4( worldPosition, 1.0f ), cache.Light() );
+	if( !( p.w > 0.0f ) )
+		return 1.0f;
+	const int size = cache.Size();
+	float invW = 1.0f / p.w;
+	float u = ( p.x * invW * 0.5f + 0.5f ) * size - 0.5f;
+	float v = ( 0.5f - p.y * invW * 0.5f ) * size - 0.5f;
+	float z = p.z * invW - bias;
+	if( !( u > -1.0f && v > -1.0f && u < size && v < size ) )
+		return 1.0f;
+
+	// SampleCmp with LESS_EQUAL: a texel lights the point if the point is not behind it
+	int x0 = ( int )floorf( u ), y0 = ( int )floorf( v );
+	float fx = u - x0, fy = v - y0;
+	const vector<float>& depth = cache.Depth();
+	float lit[4];
+	for( int i = 0; i < 4; ++i )
+	{
+		int x = x0 + ( i & 1 ), y = y0 + ( i >> 1 );
+		lit[i] = x < 0 || y < 0 || x >= size || y >= size || z <= depth[( size_t )y * size + x] ? 1.0f : 0.0f;
+	}
+	return ( lit[0] * ( 1.0f - fx ) + lit[1] * fx ) * ( 1.0f - fy ) + ( lit[2] * ( 1.0f - fx ) + lit[3] * fx ) * fy;
+}
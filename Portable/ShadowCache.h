@@ -0,0 +1,144 @@
+//--------------------------------------------------------------------------------------
+// File: ShadowCache.h
+//
+// Shadow map of the scene light that is only re-rendered where something changed. The
+// map is cut into 32x32 tiles. The static casters are rendered once into a cache of
+// their own, per tile, from the triangles binned to it. A moving instance (the spinning
+// mesh) makes the tiles under it dirty, where it was and where it is now. The light
+// changing, or static casters added, makes the static cache dirty too. Update() then
+// re-renders only the dirty tiles: the static cache, then a copy of it into the map,
+// then the instances that overlap them, so the cost of a frame follows what moved and
+// not the size of the scene. The GPU does the same with scissor rects (UpdateShadows
+// in DeferredShading.cpp); this is the reference, with a small depth-only rasterizer.
+//--------------------------------------------------------------------------------------
+#pragma once
+
+#include "CpuRaster.h"
+#include "VertexCache.h"
+
+#include <vector>
+
+#define CPU_SHADOW_TILE 32					// texels on a side
+
+// Texels [x0, x1) x [y0, y1)
+struct CpuShadowRect
+{
+	int		x0, y0, x1, y1;
+
+	bool Empty() const { return x0 >= x1 || y0 >= y1; }
+};
+
+// The tiles of a map that have to be re-rendered
+class ShadowDirtyTiles
+{
+public:
+	ShadowDirtyTiles() : _tilesX( 0 ), _tilesY( 0 ), _count( 0 ) {}
+
+	void Resize( int size );			// all clean
+	void MarkAll();
+	void Mark( const CpuShadowRect& rect );	// every tile it touches
+	void Mark( const ShadowDirtyTiles& other );
+	void Clear();
+
+	bool Dirty( int tileX, int tileY ) const { return _dirty[tileY * _tilesX + tileX] != 0; }
+	int TilesX() const { return _tilesX; }
+	int TilesY() const { return _tilesY; }
+	int Count() const { return _count; }
+
+	// The texels of the dirty tiles; their bounding rect
+	unsigned long long Texels() const { return ( unsigned long long )_count * CPU_SHADOW_TILE * CPU_SHADOW_TILE; }
+	CpuShadowRect Bounds() const;
+
+private:
+	int							_tilesX, _tilesY;
+	int							_count;
+	std::vector<unsigned char>	_dirty;
+};
+
+// The light's view * projection for a spot light at eye looking at at (clip-space Z of
+// 0..1 is what the map stores)
+Mat4 ShadowLightMatrix( const Vec3& eye, const Vec3& at, float fovY, float nearZ, float farZ );
+
+struct ShadowCacheStats
+{
+	bool				lightChanged;
+	unsigned int		dirtyTiles;			// of the map
+	unsigned int		staticTiles;		// of the static cache
+	unsigned int		staticTriangles;	// drawn into the static cache, once per tile
+	unsigned int		dynamicTriangles;	// drawn into the map, once per dirty tile they touch
+	unsigned long long	texels;				// covered by them
+
+	ShadowCacheStats();
+};
+
+class ShadowCache
+{
+public:
+	// size x size texels, a multiple of CPU_SHADOW_TILE
+	explicit ShadowCache( int size = 1024 );
+
+	// The light (ShadowLightMatrix); everything is re-rendered if it changed
+	void SetLight( const Mat4& viewProjection );
+
+	// Static casters: the mesh's triangles, in world space, are kept. Only the region
+	// they cover gets re-rendered.
+	void AddStatic( const CpuMesh& mesh, const Mat4& world );
+	void ClearStatic();
+
+	// Moving casters; mesh has to outlive the cache. Setting the same world and puffiness
+	// again doesn't make anything dirty.
+	int AddInstance( const CpuMesh& mesh, const Mat4& world, float puffiness = 0.0f );
+	void SetInstance( int instance, const Mat4& world, float puffiness = 0.0f );
+
+	// Re-renders everything at the next Update (to compare against)
+	void Invalidate();
+
+	// Re-renders the dirty tiles
+	void Update( ShadowCacheStats* stats = NULL );
+
+	int Size() const { return _size; }
+	const Mat4& Light() const { return _light.value; }
+	const std::vector<float>& Depth() const { return _depth; }	// clip-space Z, 1 where nothing is
+	const ShadowDirtyTiles& Updated() const { return _updated; }	// the tiles the last Update re-rendered
+	unsigned int StaticTriangles() const { return ( unsigned int )_staticTriangles.size() / 3; }
+
+private:
+	// Vertices in texels: x, y, clip-space Z, and w (<= 0: behind the light)
+	struct Instance
+	{
+		const CpuMesh*			mesh;
+		Versioned<Mat4>			world;
+		Versioned<float>		puffiness;
+		unsigned int			worldVersion, puffinessVersion;	// of screen
+		CpuDisplacedVertices	displaced;
+		std::vector<Vec4>		screen;
+		std::vector<unsigned int>	triangles;
+		CpuShadowRect			bounds;			// of screen, empty if it's nowhere on the map
+	};
+
+	CpuShadowRect ProjectStatic( size_t firstVertex, size_t firstTriangle );
+	void ProjectInstance( Instance& instance );
+	CpuShadowRect TriangleBounds( const Vec4& a, const Vec4& b, const Vec4& c ) const;
+	CpuShadowRect TileRect( int tileX, int tileY ) const;
+
+	int							_size, _tiles;
+	Versioned<Mat4>				_light;
+	unsigned int				_lightVersion;			// the static cache's
+	std::vector<Vec3>			_staticPosition;		// world space
+	std::vector<Vec4>			_staticScreen;
+	std::vector<unsigned int>	_staticTriangles;
+	std::vector< std::vector<unsigned int> >	_bins;	// static triangles touching every tile
+	std::vector<Instance>		_instances;
+	std::vector<float>			_static, _depth;
+	ShadowDirtyTiles			_staticDirty, _dirty, _updated;
+};
+
+// The depth of the triangle (vertices in texels, see ShadowCache) into the texels of
+// rect of a size x size map, both faces, keeping the nearest. Returns the texels covered.
+unsigned int DrawShadowTriangle( const Vec4& a, const Vec4& b, const Vec4& c, const CpuShadowRect& rect,
+								 int size, float* depth );
+
+// How lit the world-space point is: 1 lit, 0 in shadow, in between on the edges. 2x2
+// texels compared to the point's depth minus bias, weighted bilinearly like SampleCmp
+// with a linear comparison filter. Points off the map are lit.
+float ShadowVisibility( const ShadowCache& cache, const Vec3& worldPosition, float bias );
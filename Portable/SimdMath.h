@@ -0,0 +1,614 @@
+//--------------------------------------------------------------------------------------
+// File: SimdMath.h
+//
+// Header-only vector, matrix and quaternion math with SSE/AVX, NEON and scalar
+// backends, picked at compile time (define SIMDMATH_SCALAR to force the scalar one).
+// Same conventions as D3DX: row vectors (v * M), row-major Mat4, left-handed helpers,
+// so a Mat4 can be handed to ID3D10EffectMatrixVariable::SetMatrix like a D3DXMATRIX.
+//--------------------------------------------------------------------------------------
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+#if defined( SIMDMATH_SCALAR )
+#define SIMDMATH_BACKEND "scalar"
+#elif defined( __ARM_NEON ) || defined( _M_ARM64 )
+#define SIMDMATH_NEON 1
+#define SIMDMATH_BACKEND "NEON"
+#include <arm_neon.h>
+#elif defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#define SIMDMATH_SSE 1
+#include <emmintrin.h>
+#if defined( __AVX__ )
+#define SIMDMATH_AVX 1
+#define SIMDMATH_BACKEND "AVX"
+#include <immintrin.h>
+#else
+#define SIMDMATH_BACKEND "SSE2"
+#endif
+#else
+#define SIMDMATH_SCALAR 1
+#define SIMDMATH_BACKEND "scalar"
+#endif
+
+#if defined( _MSC_VER )
+#define SIMDMATH_ALIGN16 __declspec( align( 16 ) )
+#define SIMDMATH_INLINE __forceinline
+#else
+#define SIMDMATH_ALIGN16 __attribute__( ( aligned( 16 ) ) )
+#define SIMDMATH_INLINE inline __attribute__( ( always_inline ) )
+#endif
+
+//--------------------------------------------------------------------------------------
+// Types. Vec3 is 12 bytes like D3DXVECTOR3 (vertex positions); the others are 16-byte
+// aligned so they load straight into a register.
+//--------------------------------------------------------------------------------------
+struct Vec3
+{
+	float x, y, z;
+};
+
+struct SIMDMATH_ALIGN16 Vec4
+{
+	float x, y, z, w;
+};
+
+struct SIMDMATH_ALIGN16 Quat
+{
+	float x, y, z, w;		// w = cos( angle / 2 )
+};
+
+struct SIMDMATH_ALIGN16 Mat4
+{
+	float m[4][4];			// m[row][column], translation in row 3
+};
+
+// The matrices of cbChangesEveryFrame (DeferredShading.fx) in constant buffer order.
+// SetMatrix transposes for the column_major packing of the effect; when writing the
+// buffer directly, store Mat4Transpose of every matrix.
+struct CbChangesEveryFrame
+{
+	Mat4 World;
+	Mat4 View;
+	Mat4 Projection;
+	Mat4 ProjectionInverse;
+};
+
+static_assert( sizeof( Vec3 ) == 12, "Vec3 must match D3DXVECTOR3" );
+static_assert( sizeof( Vec4 ) == 16 && sizeof( Quat ) == 16, "Vec4/Quat must be one register" );
+static_assert( sizeof( Mat4 ) == 64, "Mat4 must match D3DXMATRIX" );
+static_assert( sizeof( CbChangesEveryFrame ) == 256 && offsetof( CbChangesEveryFrame, View ) == 64 &&
+			   offsetof( CbChangesEveryFrame, Projection ) == 128 &&
+			   offsetof( CbChangesEveryFrame, ProjectionInverse ) == 192,
+			   "CbChangesEveryFrame must match the cbuffer layout" );
+
+//--------------------------------------------------------------------------------------
+// Backend: one 4-float register and the few operations everything else is built from
+//--------------------------------------------------------------------------------------
+#if defined( SIMDMATH_SSE )
+
+typedef __m128 Simd4;
+
+SIMDMATH_INLINE Simd4 S4Load( const float* p )				{ return _mm_loadu_ps( p ); }
+SIMDMATH_INLINE void S4Store( float* p, Simd4 a )			{ _mm_storeu_ps( p, a ); }
+SIMDMATH_INLINE Simd4 S4Splat( float f )					{ return _mm_set1_ps( f ); }
+SIMDMATH_INLINE Simd4 S4Add( Simd4 a, Simd4 b )				{ return _mm_add_ps( a, b ); }
+SIMDMATH_INLINE Simd4 S4Sub( Simd4 a, Simd4 b )				{ return _mm_sub_ps( a, b ); }
+SIMDMATH_INLINE Simd4 S4Mul( Simd4 a, Simd4 b )				{ return _mm_mul_ps( a, b ); }
+SIMDMATH_INLINE Simd4 S4MulAdd( Simd4 a, Simd4 b, Simd4 c )	{ return _mm_add_ps( _mm_mul_ps( a, b ), c ); }
+SIMDMATH_INLINE Simd4 S4SplatX( Simd4 a )					{ return _mm_shuffle_ps( a, a, _MM_SHUFFLE( 0, 0, 0, 0 ) ); }
+SIMDMATH_INLINE Simd4 S4SplatY( Simd4 a )					{ return _mm_shuffle_ps( a, a, _MM_SHUFFLE( 1, 1, 1, 1 ) ); }
+SIMDMATH_INLINE Simd4 S4SplatZ( Simd4 a )					{ return _mm_shuffle_ps( a, a, _MM_SHUFFLE( 2, 2, 2, 2 ) ); }
+SIMDMATH_INLINE Simd4 S4SplatW( Simd4 a )					{ return _mm_shuffle_ps( a, a, _MM_SHUFFLE( 3, 3, 3, 3 ) ); }
+
+SIMDMATH_INLINE void S4Transpose( Simd4& r0, Simd4& r1, Simd4& r2, Simd4& r3 )
+{
+	_MM_TRANSPOSE4_PS( r0, r1, r2, r3 );
+}
+
+// xyz of a into p (12 bytes)
+SIMDMATH_INLINE void S4Store3( float* p, Simd4 a )
+{
+	_mm_storel_pi( ( __m64* )p, a );
+	_mm_store_ss( p + 2, _mm_movehl_ps( a, a ) );
+}
+
+// cross product of the xyz parts, w = 0
+SIMDMATH_INLINE Simd4 S4Cross3( Simd4 a, Simd4 b )
+{
+	Simd4 c = _mm_sub_ps( _mm_mul_ps( a, _mm_shuffle_ps( b, b, _MM_SHUFFLE( 3, 0, 2, 1 ) ) ),
+						  _mm_mul_ps( _mm_shuffle_ps( a, a, _MM_SHUFFLE( 3, 0, 2, 1 ) ), b ) );
+	return _mm_shuffle_ps( c, c, _MM_SHUFFLE( 3, 0, 2, 1 ) );
+}
+
+#elif defined( SIMDMATH_NEON )
+
+typedef float32x4_t Simd4;
+
+SIMDMATH_INLINE Simd4 S4Load( const float* p )				{ return vld1q_f32( p ); }
+SIMDMATH_INLINE void S4Store( float* p, Simd4 a )			{ vst1q_f32( p, a ); }
+SIMDMATH_INLINE Simd4 S4Splat( float f )					{ return vdupq_n_f32( f ); }
+SIMDMATH_INLINE Simd4 S4Add( Simd4 a, Simd4 b )				{ return vaddq_f32( a, b ); }
+SIMDMATH_INLINE Simd4 S4Sub( Simd4 a, Simd4 b )				{ return vsubq_f32( a, b ); }
+SIMDMATH_INLINE Simd4 S4Mul( Simd4 a, Simd4 b )				{ return vmulq_f32( a, b ); }
+SIMDMATH_INLINE Simd4 S4MulAdd( Simd4 a, Simd4 b, Simd4 c )	{ return vmlaq_f32( c, a, b ); }
+SIMDMATH_INLINE Simd4 S4SplatX( Simd4 a )					{ return vdupq_lane_f32( vget_low_f32( a ), 0 ); }
+SIMDMATH_INLINE Simd4 S4SplatY( Simd4 a )					{ return vdupq_lane_f32( vget_low_f32( a ), 1 ); }
+SIMDMATH_INLINE Simd4 S4SplatZ( Simd4 a )					{ return vdupq_lane_f32( vget_high_f32( a ), 0 ); }
+SIMDMATH_INLINE Simd4 S4SplatW( Simd4 a )					{ return vdupq_lane_f32( vget_high_f32( a ), 1 ); }
+
+SIMDMATH_INLINE void S4Transpose( Simd4& r0, Simd4& r1, Simd4& r2, Simd4& r3 )
+{
+	float32x4x2_t t01 = vtrnq_f32( r0, r1 );		// x0 x1 z0 z1 | y0 y1 w0 w1
+	float32x4x2_t t23 = vtrnq_f32( r2, r3 );
+	r0 = vcombine_f32( vget_low_f32( t01.val[0] ), vget_low_f32( t23.val[0] ) );
+	r1 = vcombine_f32( vget_low_f32( t01.val[1] ), vget_low_f32( t23.val[1] ) );
+	r2 = vcombine_f32( vget_high_f32( t01.val[0] ), vget_high_f32( t23.val[0] ) );
+	r3 = vcombine_f32( vget_high_f32( t01.val[1] ), vget_high_f32( t23.val[1] ) );
+}
+
+SIMDMATH_INLINE void S4Store3( float* p, Simd4 a )
+{
+	vst1_f32( p, vget_low_f32( a ) );
+	vst1q_lane_f32( p + 2, a, 2 );
+}
+
+// y z x w
+SIMDMATH_INLINE Simd4 S4YZXW( Simd4 a )
+{
+	float32x2_t yz = vext_f32( vget_low_f32( a ), vget_high_f32( a ), 1 );
+	float32x2_t xw = vset_lane_f32( vgetq_lane_f32( a, 3 ), vget_low_f32( a ), 1 );
+	return vcombine_f32( yz, xw );
+}
+
+SIMDMATH_INLINE Simd4 S4Cross3( Simd4 a, Simd4 b )
+{
+	Simd4 c = vmlsq_f32( vmulq_f32( a, S4YZXW( b ) ), S4YZXW( a ), b );
+	return S4YZXW( c );
+}
+
+#else
+
+struct Simd4 { float v[4]; };
+
+SIMDMATH_INLINE Simd4 S4Load( const float* p )				{ Simd4 r; memcpy( r.v, p, 16 ); return r; }
+SIMDMATH_INLINE void S4Store( float* p, Simd4 a )			{ memcpy( p, a.v, 16 ); }
+SIMDMATH_INLINE Simd4 S4Splat( float f )					{ Simd4 r = { { f, f, f, f } }; return r; }
+SIMDMATH_INLINE Simd4 S4Add( Simd4 a, Simd4 b )				{ for( int i = 0; i < 4; ++i ) a.v[i] += b.v[i]; return a; }
+SIMDMATH_INLINE Simd4 S4Sub( Simd4 a, Simd4 b )				{ for( int i = 0; i < 4; ++i ) a.v[i] -= b.v[i]; return a; }
+SIMDMATH_INLINE Simd4 S4Mul( Simd4 a, Simd4 b )				{ for( int i = 0; i < 4; ++i ) a.v[i] *= b.v[i]; return a; }
+SIMDMATH_INLINE Simd4 S4MulAdd( Simd4 a, Simd4 b, Simd4 c )	{ for( int i = 0; i < 4; ++i ) c.v[i] += a.v[i] * b.v[i]; return c; }
+SIMDMATH_INLINE Simd4 S4SplatX( Simd4 a )					{ return S4Splat( a.v[0] ); }
+SIMDMATH_INLINE Simd4 S4SplatY( Simd4 a )					{ return S4Splat( a.v[1] ); }
+SIMDMATH_INLINE Simd4 S4SplatZ( Simd4 a )					{ return S4Splat( a.v[2] ); }
+SIMDMATH_INLINE Simd4 S4SplatW( Simd4 a )					{ return S4Splat( a.v[3] ); }
+
+SIMDMATH_INLINE void S4Transpose( Simd4& r0, Simd4& r1, Simd4& r2, Simd4& r3 )
+{
+	Simd4* rows[4] = { &r0, &r1, &r2, &r3 };
+	for( int i = 0; i < 4; ++i )
+		for( int j = i + 1; j < 4; ++j )
+		{
+			float t = rows[i]->v[j];
+			rows[i]->v[j] = rows[j]->v[i];
+			rows[j]->v[i] = t;
+		}
+}
+
+SIMDMATH_INLINE void S4Store3( float* p, Simd4 a )			{ memcpy( p, a.v, 12 ); }
+
+SIMDMATH_INLINE Simd4 S4Cross3( Simd4 a, Simd4 b )
+{
+	Simd4 r = { { a.v[1] * b.v[2] - a.v[2] * b.v[1], a.v[2] * b.v[0] - a.v[0] * b.v[2], a.v[0] * b.v[1] - a.v[1] * b.v[0], 0.0f } };
+	return r;
+}
+
+#endif
+
+// v * m for a register holding a row vector
+SIMDMATH_INLINE Simd4 S4Transform( Simd4 v, Simd4 r0, Simd4 r1, Simd4 r2, Simd4 r3 )
+{
+	Simd4 r = S4Mul( S4SplatX( v ), r0 );
+	r = S4MulAdd( S4SplatY( v ), r1, r );
+	r = S4MulAdd( S4SplatZ( v ), r2, r );
+	return S4MulAdd( S4SplatW( v ), r3, r );
+}
+
+//--------------------------------------------------------------------------------------
+// Vec3
+//--------------------------------------------------------------------------------------
+inline Vec3 MakeVec3( float x, float y, float z )			{ Vec3 r = { x, y, z }; return r; }
+inline Vec3 operator+( const Vec3& a, const Vec3& b )		{ return MakeVec3( a.x + b.x, a.y + b.y, a.z + b.z ); }
+inline Vec3 operator-( const Vec3& a, const Vec3& b )		{ return MakeVec3( a.x - b.x, a.y - b.y, a.z - b.z ); }
+inline Vec3 operator-( const Vec3& a )						{ return MakeVec3( -a.x, -a.y, -a.z ); }
+inline Vec3 operator*( const Vec3& a, float s )				{ return MakeVec3( a.x * s, a.y * s, a.z * s ); }
+inline float Vec3Dot( const Vec3& a, const Vec3& b )		{ return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline float Vec3Length( const Vec3& a )					{ return sqrtf( Vec3Dot( a, a ) ); }
+
+inline Vec3 Vec3Cross( const Vec3& a, const Vec3& b )
+{
+	return MakeVec3( a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x );
+}
+
+inline Vec3 Vec3Normalize( const Vec3& a )
+{
+	float length = Vec3Length( a );
+	return length > 0.0f ? a * ( 1.0f / length ) : a;
+}
+
+//--------------------------------------------------------------------------------------
+// Vec4
+//--------------------------------------------------------------------------------------
+inline Vec4 MakeVec4( float x, float y, float z, float w )	{ Vec4 r = { x, y, z, w }; return r; }
+inline Vec4 MakeVec4( const Vec3& v, float w )				{ return MakeVec4( v.x, v.y, v.z, w ); }
+inline Simd4 S4Load( const Vec4& v )						{ return S4Load( &v.x ); }
+inline Vec4 S4ToVec4( Simd4 a )								{ Vec4 r; S4Store( &r.x, a ); return r; }
+
+inline Vec4 operator+( const Vec4& a, const Vec4& b )		{ return S4ToVec4( S4Add( S4Load( a ), S4Load( b ) ) ); }
+inline Vec4 operator-( const Vec4& a, const Vec4& b )		{ return S4ToVec4( S4Sub( S4Load( a ), S4Load( b ) ) ); }
+inline Vec4 operator*( const Vec4& a, float s )				{ return S4ToVec4( S4Mul( S4Load( a ), S4Splat( s ) ) ); }
+inline float Vec4Dot( const Vec4& a, const Vec4& b )		{ return a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w; }
+
+//--------------------------------------------------------------------------------------
+// Mat4
+//--------------------------------------------------------------------------------------
+
+// From 16 row-major floats (a D3DXMATRIX, which needn't be aligned)
+inline Mat4 Mat4Load( const float* p )
+{
+	Mat4 r;
+	memcpy( r.m, p, sizeof( r.m ) );
+	return r;
+}
+
+inline Mat4 Mat4Identity()
+{
+	Mat4 r = { { { 1, 0, 0, 0 }, { 0, 1, 0, 0 }, { 0, 0, 1, 0 }, { 0, 0, 0, 1 } } };
+	return r;
+}
+
+inline Mat4 Mat4Translation( float x, float y, float z )
+{
+	Mat4 r = Mat4Identity();
+	r.m[3][0] = x;
+	r.m[3][1] = y;
+	r.m[3][2] = z;
+	return r;
+}
+
+inline Mat4 Mat4Scaling( float x, float y, float z )
+{
+	Mat4 r = Mat4Identity();
+	r.m[0][0] = x;
+	r.m[1][1] = y;
+	r.m[2][2] = z;
+	return r;
+}
+
+// Rotations by angle radians, clockwise looking along the axis (D3DXMatrixRotation*)
+inline Mat4 Mat4RotationX( float angle )
+{
+	Mat4 r = Mat4Identity();
+	float c = cosf( angle ), s = sinf( angle );
+	r.m[1][1] = c; r.m[1][2] = s;
+	r.m[2][1] = -s; r.m[2][2] = c;
+	return r;
+}
+
+inline Mat4 Mat4RotationY( float angle )
+{
+	Mat4 r = Mat4Identity();
+	float c = cosf( angle ), s = sinf( angle );
+	r.m[0][0] = c; r.m[0][2] = -s;
+	r.m[2][0] = s; r.m[2][2] = c;
+	return r;
+}
+
+inline Mat4 Mat4RotationZ( float angle )
+{
+	Mat4 r = Mat4Identity();
+	float c = cosf( angle ), s = sinf( angle );
+	r.m[0][0] = c; r.m[0][1] = s;
+	r.m[1][0] = -s; r.m[1][1] = c;
+	return r;
+}
+
+inline Mat4 Mat4LookAtLH( const Vec3& eye, const Vec3& at, const Vec3& up )
+{
+	Vec3 z = Vec3Normalize( at - eye );
+	Vec3 x = Vec3Normalize( Vec3Cross( up, z ) );
+	Vec3 y = Vec3Cross( z, x );
+	Mat4 r = { { { x.x, y.x, z.x, 0 }, { x.y, y.y, z.y, 0 }, { x.z, y.z, z.z, 0 },
+				 { -Vec3Dot( x, eye ), -Vec3Dot( y, eye ), -Vec3Dot( z, eye ), 1 } } };
+	return r;
+}
+
+inline Mat4 Mat4PerspectiveFovLH( float fovY, float aspect, float zNear, float zFar )
+{
+	float yScale = 1.0f / tanf( fovY * 0.5f );
+	float q = zFar / ( zFar - zNear );
+	Mat4 r = { { { yScale / aspect, 0, 0, 0 }, { 0, yScale, 0, 0 }, { 0, 0, q, 1 }, { 0, 0, -q * zNear, 0 } } };
+	return r;
+}
+
+inline Mat4 operator*( const Mat4& a, const Mat4& b )
+{
+	Simd4 b0 = S4Load( b.m[0] ), b1 = S4Load( b.m[1] ), b2 = S4Load( b.m[2] ), b3 = S4Load( b.m[3] );
+	Mat4 r;
+	for( int i = 0; i < 4; ++i )
+		S4Store( r.m[i], S4Transform( S4Load( a.m[i] ), b0, b1, b2, b3 ) );
+	return r;
+}
+
+inline Mat4 Mat4Transpose( const Mat4& a )
+{
+	Simd4 r0 = S4Load( a.m[0] ), r1 = S4Load( a.m[1] ), r2 = S4Load( a.m[2] ), r3 = S4Load( a.m[3] );
+	S4Transpose( r0, r1, r2, r3 );
+	Mat4 r;
+	S4Store( r.m[0], r0 );
+	S4Store( r.m[1], r1 );
+	S4Store( r.m[2], r2 );
+	S4Store( r.m[3], r3 );
+	return r;
+}
+
+// General inverse (cofactors); false and out untouched if a is singular
+inline bool Mat4Inverse( const Mat4& a, Mat4& out, float* determinant = NULL )
+{
+	const float* m = &a.m[0][0];
+
+	// 2x2 determinants of the top and bottom halves
+	float s0 = m[0] * m[5] - m[4] * m[1];
+	float s1 = m[0] * m[6] - m[4] * m[2];
+	float s2 = m[0] * m[7] - m[4] * m[3];
+	float s3 = m[1] * m[6] - m[5] * m[2];
+	float s4 = m[1] * m[7] - m[5] * m[3];
+	float s5 = m[2] * m[7] - m[6] * m[3];
+	float c5 = m[10] * m[15] - m[14] * m[11];
+	float c4 = m[9] * m[15] - m[13] * m[11];
+	float c3 = m[9] * m[14] - m[13] * m[10];
+	float c2 = m[8] * m[15] - m[12] * m[11];
+	float c1 = m[8] * m[14] - m[12] * m[10];
+	float c0 = m[8] * m[13] - m[12] * m[9];
+
+	float det = s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+	if( determinant )
+		*determinant = det;
+	if( det == 0.0f || !( fabsf( det ) < 1e30f ) )
+		return false;
+	float inv = 1.0f / det;
+
+	Mat4 r = { { { ( m[5] * c5 - m[6] * c4 + m[7] * c3 ) * inv, ( -m[1] * c5 + m[2] * c4 - m[3] * c3 ) * inv,
+				   ( m[13] * s5 - m[14] * s4 + m[15] * s3 ) * inv, ( -m[9] * s5 + m[10] * s4 - m[11] * s3 ) * inv },
+				 { ( -m[4] * c5 + m[6] * c2 - m[7] * c1 ) * inv, ( m[0] * c5 - m[2] * c2 + m[3] * c1 ) * inv,
+				   ( -m[12] * s5 + m[14] * s2 - m[15] * s1 ) * inv, ( m[8] * s5 - m[10] * s2 + m[11] * s1 ) * inv },
+				 { ( m[4] * c4 - m[5] * c2 + m[7] * c0 ) * inv, ( -m[0] * c4 + m[1] * c2 - m[3] * c0 ) * inv,
+				   ( m[12] * s4 - m[13] * s2 + m[15] * s0 ) * inv, ( -m[8] * s4 + m[9] * s2 - m[11] * s0 ) * inv },
+				 { ( -m[4] * c3 + m[5] * c1 - m[6] * c0 ) * inv, ( m[0] * c3 - m[1] * c1 + m[2] * c0 ) * inv,
+				   ( -m[12] * s3 + m[13] * s1 - m[14] * s0 ) * inv, ( m[8] * s3 - m[9] * s1 + m[10] * s0 ) * inv } } };
+	out = r;
+	return true;
+}
+
+// Inverse of a matrix whose last column is (0, 0, 0, 1): rotation, scale, shear and
+// translation, e.g. views and world matrices. A 3x3 inverse from cross products and
+// one transform, about a fifth of the work of Mat4Inverse.
+inline Mat4 Mat4AffineInverse( const Mat4& a )
+{
+	static const float lastRow[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+	Simd4 r0 = S4Load( a.m[0] ), r1 = S4Load( a.m[1] ), r2 = S4Load( a.m[2] ), t = S4Load( a.m[3] );
+
+	// the cofactors are the columns of the inverse (w = 0)
+	Simd4 i0 = S4Cross3( r1, r2 ), i1 = S4Cross3( r2, r0 ), i2 = S4Cross3( r0, r1 ), i3 = S4Splat( 0.0f );
+	float det = a.m[0][0] * ( a.m[1][1] * a.m[2][2] - a.m[1][2] * a.m[2][1] ) +
+				a.m[0][1] * ( a.m[1][2] * a.m[2][0] - a.m[1][0] * a.m[2][2] ) +
+				a.m[0][2] * ( a.m[1][0] * a.m[2][1] - a.m[1][1] * a.m[2][0] );
+	Simd4 inv = S4Splat( det != 0.0f ? 1.0f / det : 0.0f );
+	S4Transpose( i0, i1, i2, i3 );
+	i0 = S4Mul( i0, inv );
+	i1 = S4Mul( i1, inv );
+	i2 = S4Mul( i2, inv );
+
+	// translation: -t * inverse
+	i3 = S4Mul( S4SplatX( t ), i0 );
+	i3 = S4MulAdd( S4SplatY( t ), i1, i3 );
+	i3 = S4MulAdd( S4SplatZ( t ), i2, i3 );
+
+	Mat4 r;
+	S4Store( r.m[0], i0 );
+	S4Store( r.m[1], i1 );
+	S4Store( r.m[2], i2 );
+	S4Store( r.m[3], S4Sub( S4Load( lastRow ), i3 ) );
+	return r;
+}
+
+//--------------------------------------------------------------------------------------
+// Transforms
+//--------------------------------------------------------------------------------------
+inline Vec4 Vec4Transform( const Vec4& v, const Mat4& m )
+{
+	return S4ToVec4( S4Transform( S4Load( v ), S4Load( m.m[0] ), S4Load( m.m[1] ), S4Load( m.m[2] ), S4Load( m.m[3] ) ) );
+}
+
+// (v, 1) * m divided by w (D3DXVec3TransformCoord)
+inline Vec3 Vec3TransformCoord( const Vec3& v, const Mat4& m )
+{
+	Vec4 r = Vec4Transform( MakeVec4( v, 1.0f ), m );
+	float inv = 1.0f / r.w;
+	return MakeVec3( r.x * inv, r.y * inv, r.z * inv );
+}
+
+// (v, 0) * m (D3DXVec3TransformNormal)
+inline Vec3 Vec3TransformNormal( const Vec3& v, const Mat4& m )
+{
+	Vec4 r = Vec4Transform( MakeVec4( v, 0.0f ), m );
+	return MakeVec3( r.x, r.y, r.z );
+}
+
+// Batches: out[i] = ( in[i], 1 ) * m, all four components (e.g. to clip space)
+inline void TransformPoints( const Mat4& m, const Vec3* in, Vec4* out, size_t count )
+{
+	Simd4 r0 = S4Load( m.m[0] ), r1 = S4Load( m.m[1] ), r2 = S4Load( m.m[2] ), r3 = S4Load( m.m[3] );
+	for( size_t i = 0; i < count; ++i )
+	{
+		Simd4 r = S4MulAdd( S4Splat( in[i].x ), r0, r3 );
+		r = S4MulAdd( S4Splat( in[i].y ), r1, r );
+		r = S4MulAdd( S4Splat( in[i].z ), r2, r );
+		S4Store( &out[i].x, r );
+	}
+}
+
+// out[i] = xyz of ( in[i], 1 ) * m for an affine m; in and out may be the same array
+inline void TransformPointsAffine( const Mat4& m, const Vec3* in, Vec3* out, size_t count )
+{
+	size_t i = 0;
+#if defined( SIMDMATH_AVX )
+	// two points per iteration, one in each 128-bit half
+	__m256 r0 = _mm256_broadcast_ps( ( const __m128* )m.m[0] );
+	__m256 r1 = _mm256_broadcast_ps( ( const __m128* )m.m[1] );
+	__m256 r2 = _mm256_broadcast_ps( ( const __m128* )m.m[2] );
+	__m256 r3 = _mm256_broadcast_ps( ( const __m128* )m.m[3] );
+	for( ; i + 2 <= count; i += 2 )
+	{
+		__m256 x = _mm256_insertf128_ps( _mm256_castps128_ps256( _mm_set1_ps( in[i].x ) ), _mm_set1_ps( in[i + 1].x ), 1 );
+		__m256 y = _mm256_insertf128_ps( _mm256_castps128_ps256( _mm_set1_ps( in[i].y ) ), _mm_set1_ps( in[i + 1].y ), 1 );
+		__m256 z = _mm256_insertf128_ps( _mm256_castps128_ps256( _mm_set1_ps( in[i].z ) ), _mm_set1_ps( in[i + 1].z ), 1 );
+		__m256 r = _mm256_add_ps( _mm256_mul_ps( x, r0 ), r3 );
+		r = _mm256_add_ps( _mm256_mul_ps( y, r1 ), r );
+		r = _mm256_add_ps( _mm256_mul_ps( z, r2 ), r );
+		S4Store3( &out[i].x, _mm256_castps256_ps128( r ) );
+		S4Store3( &out[i + 1].x, _mm256_extractf128_ps( r, 1 ) );
+	}
+#endif
+	Simd4 s0 = S4Load( m.m[0] ), s1 = S4Load( m.m[1] ), s2 = S4Load( m.m[2] ), s3 = S4Load( m.m[3] );
+	for( ; i < count; ++i )
+	{
+		Simd4 r = S4MulAdd( S4Splat( in[i].x ), s0, s3 );
+		r = S4MulAdd( S4Splat( in[i].y ), s1, r );
+		r = S4MulAdd( S4Splat( in[i].z ), s2, r );
+		S4Store3( &out[i].x, r );
+	}
+}
+
+// out[i] = in[i] * m
+inline void TransformVec4s( const Mat4& m, const Vec4* in, Vec4* out, size_t count )
+{
+	Simd4 r0 = S4Load( m.m[0] ), r1 = S4Load( m.m[1] ), r2 = S4Load( m.m[2] ), r3 = S4Load( m.m[3] );
+	for( size_t i = 0; i < count; ++i )
+		S4Store( &out[i].x, S4Transform( S4Load( in[i] ), r0, r1, r2, r3 ) );
+}
+
+// TransformPointsAffine without SIMD, to check and time the backends against
+inline void TransformPointsAffineScalar( const Mat4& m, const Vec3* in, Vec3* out, size_t count )
+{
+	for( size_t i = 0; i < count; ++i )
+	{
+		Vec3 p = in[i];
+		out[i].x = p.x * m.m[0][0] + p.y * m.m[1][0] + p.z * m.m[2][0] + m.m[3][0];
+		out[i].y = p.x * m.m[0][1] + p.y * m.m[1][1] + p.z * m.m[2][1] + m.m[3][1];
+		out[i].z = p.x * m.m[0][2] + p.y * m.m[1][2] + p.z * m.m[2][2] + m.m[3][2];
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Quaternions (D3DX conventions: QuatMultiply( a, b ) rotates by a, then by b)
+//--------------------------------------------------------------------------------------
+inline Quat MakeQuat( float x, float y, float z, float w )	{ Quat r = { x, y, z, w }; return r; }
+inline Quat QuatIdentity()									{ return MakeQuat( 0, 0, 0, 1 ); }
+inline Quat QuatConjugate( const Quat& q )					{ return MakeQuat( -q.x, -q.y, -q.z, q.w ); }
+inline float QuatDot( const Quat& a, const Quat& b )		{ return a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w; }
+
+inline Quat QuatNormalize( const Quat& q )
+{
+	float length = sqrtf( QuatDot( q, q ) );
+	float inv = length > 0.0f ? 1.0f / length : 0.0f;
+	return MakeQuat( q.x * inv, q.y * inv, q.z * inv, q.w * inv );
+}
+
+inline Quat QuatRotationAxis( const Vec3& axis, float angle )
+{
+	Vec3 a = Vec3Normalize( axis ) * sinf( angle * 0.5f );
+	return MakeQuat( a.x, a.y, a.z, cosf( angle * 0.5f ) );
+}
+
+inline Quat QuatMultiply( const Quat& a, const Quat& b )
+{
+	// b * a in Hamilton order
+	return MakeQuat( b.w * a.x + b.x * a.w + b.y * a.z - b.z * a.y,
+					 b.w * a.y - b.x * a.z + b.y * a.w + b.z * a.x,
+					 b.w * a.z + b.x * a.y - b.y * a.x + b.z * a.w,
+					 b.w * a.w - b.x * a.x - b.y * a.y - b.z * a.z );
+}
+
+// v rotated by the unit quaternion q, same as v * Mat4RotationQuat( q )
+inline Vec3 QuatRotate( const Vec3& v, const Quat& q )
+{
+	Vec3 u = MakeVec3( q.x, q.y, q.z );
+	Vec3 t = Vec3Cross( u, v ) * 2.0f;
+	return v + t * q.w + Vec3Cross( u, t );
+}
+
+// Shortest-path spherical interpolation of unit quaternions
+inline Quat QuatSlerp( const Quat& a, const Quat& b, float t )
+{
+	float cosAngle = QuatDot( a, b );
+	float sign = 1.0f;
+	if( cosAngle < 0.0f )
+	{
+		cosAngle = -cosAngle;
+		sign = -1.0f;
+	}
+	float wa = 1.0f - t, wb = t;
+	if( cosAngle < 0.9995f )		// otherwise lerp: sin( angle ) is too small to divide by
+	{
+		float angle = acosf( cosAngle );
+		float inv = 1.0f / sinf( angle );
+		wa = sinf( wa * angle ) * inv;
+		wb = sinf( wb * angle ) * inv;
+	}
+	wb *= sign;
+	return QuatNormalize( MakeQuat( a.x * wa + b.x * wb, a.y * wa + b.y * wb, a.z * wa + b.z * wb, a.w * wa + b.w * wb ) );
+}
+
+inline Mat4 Mat4RotationQuat( const Quat& q )
+{
+	float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+	float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+	float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+	Mat4 r = { { { 1 - 2 * ( yy + zz ), 2 * ( xy + wz ), 2 * ( xz - wy ), 0 },
+				 { 2 * ( xy - wz ), 1 - 2 * ( xx + zz ), 2 * ( yz + wx ), 0 },
+				 { 2 * ( xz + wy ), 2 * ( yz - wx ), 1 - 2 * ( xx + yy ), 0 },
+				 { 0, 0, 0, 1 } } };
+	return r;
+}
+
+// Rotation part of m (no scale) as a unit quaternion
+inline Quat QuatFromMat4( const Mat4& a )
+{
+	const float ( *m )[4] = a.m;
+	float trace = m[0][0] + m[1][1] + m[2][2];
+	Quat q;
+	if( trace > 0.0f )
+	{
+		float s = 0.5f / sqrtf( trace + 1.0f );
+		q = MakeQuat( ( m[1][2] - m[2][1] ) * s, ( m[2][0] - m[0][2] ) * s, ( m[0][1] - m[1][0] ) * s, 0.25f / s );
+	}
+	else if( m[0][0] > m[1][1] && m[0][0] > m[2][2] )
+	{
+		float s = 2.0f * sqrtf( 1.0f + m[0][0] - m[1][1] - m[2][2] );
+		q = MakeQuat( 0.25f * s, ( m[1][0] + m[0][1] ) / s, ( m[2][0] + m[0][2] ) / s, ( m[1][2] - m[2][1] ) / s );
+	}
+	else if( m[1][1] > m[2][2] )
+	{
+		float s = 2.0f * sqrtf( 1.0f + m[1][1] - m[0][0] - m[2][2] );
+		q = MakeQuat( ( m[1][0] + m[0][1] ) / s, 0.25f * s, ( m[2][1] + m[1][2] ) / s, ( m[2][0] - m[0][2] ) / s );
+	}
+	else
+	{
+		float s = 2.0f * sqrtf( 1.0f + m[2][2] - m[0][0] - m[1][1] );
+		q = MakeQuat( ( m[2][0] + m[0][2] ) / s, ( m[2][1] + m[1][2] ) / s, 0.25f * s, ( m[0][1] - m[1][0] ) / s );
+	}
+	return QuatNormalize( q );
+}
@@ -0,0 +1,708 @@
+//--------------------------------------------------------------------------------------
+// File: TextureCook.cpp
+//
+// Offline texture cooking
+//--------------------------------------------------------------------------------------
+#include "TextureCook.h"
+#include "EffectCache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <thread>
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#include <emmintrin.h>
+#define COOK_SSE2 1
+#endif
+
+using namespace std;
+
+// Runs body( i ) for i in [0, count) on up to numThreads threads
+static void ParallelFor( int count, int numThreads, const function<void ( int )>& body )
+{
+	numThreads = max( 1, min( numThreads, count ) );
+	if( numThreads == 1 )
+	{
+		for( int i = 0; i < count; ++i )
+			body( i );
+		return;
+	}
+	atomic<int> next( 0 );
+	vector<thread> threads;
+	for( int t = 0; t < numThreads; ++t )
+		threads.push_back( thread( [&]() {
+			for( int i; ( i = next++ ) < count; )
+				body( i );
+		} ) );
+	for( size_t t = 0; t < threads.size(); ++t )
+		threads[t].join();
+}
+
+//--------------------------------------------------------------------------------------
+// Mips
+//--------------------------------------------------------------------------------------
+struct Tap
+{
+	int		index;
+	float	weight;
+};
+
+// sRGB <-> linear
+static float srgbToLinear[256];
+static unsigned char linearToSrgb[4096];
+
+static void BuildGammaTables()
+{
+	static bool built = false;
+	if( built )
+		return;
+	for( int i = 0; i < 256; ++i )
+	{
+		float c = i / 255.0f;
+		srgbToLinear[i] = c <= 0.04045f ? c / 12.92f : powf( ( c + 0.055f ) / 1.055f, 2.4f );
+	}
+	for( int i = 0; i < 4096; ++i )
+	{
+		float l = i / 4095.0f;
+		float c = l <= 0.0031308f ? l * 12.92f : 1.055f * powf( l, 1.0f / 2.4f ) - 0.055f;
+		linearToSrgb[i] = ( unsigned char )( min( max( c, 0.0f ), 1.0f ) * 255.0f + 0.5f );
+	}
+	built = true;
+}
+
+static inline unsigned char ToByte( float v, bool srgb )
+{
+	v = min( max( v, 0.0f ), 1.0f );
+	return srgb ? linearToSrgb[( int )( v * 4095.0f + 0.5f )] : ( unsigned char )( v * 255.0f + 0.5f );
+}
+
+// Zeroth order modified Bessel function of the first kind
+static double BesselI0( double x )
+{
+	double sum = 1.0, term = 1.0;
+	for( int k = 1; k < 32; ++k )
+	{
+		term *= ( x / ( 2.0 * k ) ) * ( x / ( 2.0 * k ) );
+		sum += term;
+	}
+	return sum;
+}
+
+// Weights of the source pixels for every destination pixel along one axis (wrapping,
+// like the Wrap samplers that read these textures)
+static void BuildTaps( int srcSize, int dstSize, MipFilter filter, vector< vector<Tap> >& taps )
+{
+	const double scale = ( double )srcSize / dstSize;
+	const double width = 3.0;			// Kaiser support, in destination pixels
+	const double alpha = 4.0;
+	taps.assign( dstSize, vector<Tap>() );
+	for( int d = 0; d < dstSize; ++d )
+	{
+		double center = ( d + 0.5 ) * scale;		// in source pixel edges
+		double sum = 0.0;
+		vector<double> weights;
+		vector<int> indices;
+		if( filter == MIP_BOX || srcSize == 1 )
+		{
+			// area of every source pixel under the destination pixel
+			double lo = center - 0.5 * scale, hi = center + 0.5 * scale;
+			for( int s = ( int )floor( lo ); s < ( int )ceil( hi ); ++s )
+			{
+				double w = min( hi, s + 1.0 ) - max( lo, ( double )s );
+				if( w > 0.0 )
+				{
+					indices.push_back( s );
+					weights.push_back( w );
+				}
+			}
+		}
+		else
+		{
+			double radius = width * scale;
+			for( int s = ( int )floor( center - radius ); s <= ( int )ceil( center + radius ); ++s )
+			{
+				double t = ( s + 0.5 - center ) / scale;		// distance in destination pixels
+				if( fabs( t ) >= width )
+					continue;
+				double sinc = t == 0.0 ? 1.0 : sin( 3.14159265358979 * t ) / ( 3.14159265358979 * t );
+				double r = t / width;
+				double w = sinc * BesselI0( alpha * sqrt( 1.0 - r * r ) ) / BesselI0( alpha );
+				indices.push_back( s );
+				weights.push_back( w );
+			}
+		}
+		for( size_t i = 0; i < weights.size(); ++i )
+			sum += weights[i];
+		for( size_t i = 0; i < weights.size(); ++i )
+		{
+			Tap tap = { ( ( indices[i] % srcSize ) + srcSize ) % srcSize, ( float )( weights[i] / sum ) };
+			taps[d].push_back( tap );
+		}
+	}
+}
+
+// Halves a linear RGBA float image
+static void Downsample( const vector<float>& src, int srcW, int srcH, MipFilter filter, int numThreads,
+						vector<float>& dst, int dstW, int dstH )
+{
+	vector< vector<Tap> > tapsX, tapsY;
+	BuildTaps( srcW, dstW, filter, tapsX );
+	BuildTaps( srcH, dstH, filter, tapsY );
+
+	// horizontal, then vertical
+	vector<float> rows( ( size_t )dstW * srcH * 4 );
+	ParallelFor( srcH, numThreads, [&]( int y ) {
+		const float* in = &src[( size_t )y * srcW * 4];
+		float* out = &rows[( size_t )y * dstW * 4];
+		for( int x = 0; x < dstW; ++x )
+		{
+			float c[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+			for( size_t t = 0; t < tapsX[x].size(); ++t )
+				for( int k = 0; k < 4; ++k )
+					c[k] += in[tapsX[x][t].index * 4 + k] * tapsX[x][t].weight;
+			memcpy( out + x * 4, c, sizeof( c ) );
+		}
+	} );
+	dst.assign( ( size_t )dstW * dstH * 4, 0.0f );
+	ParallelFor( dstH, numThreads, [&]( int y ) {
+		float* out = &dst[( size_t )y * dstW * 4];
+		for( size_t t = 0; t < tapsY[y].size(); ++t )
+		{
+			const float* in = &rows[( size_t )tapsY[y][t].index * dstW * 4];
+			float w = tapsY[y][t].weight;
+			for( int i = 0; i < dstW * 4; ++i )
+				out[i] += in[i] * w;
+		}
+	} );
+}
+
+void GenerateMips( const Image& image, MipFilter filter, bool srgb, int maxMips, int numThreads, vector<Image>& mips )
+{
+	BuildGammaTables();
+	mips.assign( 1, image );
+	if( maxMips <= 0 )
+		maxMips = COOKED_MAX_MIPS;
+
+	int w = image.width, h = image.height;
+	vector<float> level( ( size_t )w * h * 4 );
+	for( size_t i = 0; i < level.size(); ++i )
+		level[i] = srgb && ( i & 3 ) != 3 ? srgbToLinear[image.rgba[i]] : image.rgba[i] / 255.0f;
+
+	while( ( int )mips.size() < min( maxMips, COOKED_MAX_MIPS ) && ( w > 1 || h > 1 ) )
+	{
+		int nw = max( 1, w / 2 ), nh = max( 1, h / 2 );
+		vector<float> next;
+		Downsample( level, w, h, filter, numThreads, next, nw, nh );
+
+		Image mip;
+		mip.width = nw;
+		mip.height = nh;
+		mip.rgba.resize( next.size() );
+		for( size_t i = 0; i < next.size(); ++i )
+			mip.rgba[i] = ToByte( next[i], srgb && ( i & 3 ) != 3 );
+		mips.push_back( mip );
+
+		// the next level filters the unquantized floats
+		level.swap( next );
+		w = nw;
+		h = nh;
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// BC1 (and the color half of BC3)
+//--------------------------------------------------------------------------------------
+static inline unsigned short To565( const float c[3] )
+{
+	int r = min( max( ( int )( c[0] * ( 31.0f / 255.0f ) + 0.5f ), 0 ), 31 );
+	int g = min( max( ( int )( c[1] * ( 63.0f / 255.0f ) + 0.5f ), 0 ), 63 );
+	int b = min( max( ( int )( c[2] * ( 31.0f / 255.0f ) + 0.5f ), 0 ), 31 );
+	return ( unsigned short )( ( r << 11 ) | ( g << 5 ) | b );
+}
+
+static inline void From565( unsigned short c, float out[3] )
+{
+	int r = ( c >> 11 ) & 31, g = ( c >> 5 ) & 63, b = c & 31;
+	out[0] = ( float )( ( r << 3 ) | ( r >> 2 ) );
+	out[1] = ( float )( ( g << 2 ) | ( g >> 4 ) );
+	out[2] = ( float )( ( b << 3 ) | ( b >> 2 ) );
+}
+
+// Nearest of the 4 palette colors for the 16 pixels (r, g, b: 16 floats each).
+// Returns the summed squared error.
+static float PickColorIndices( const float* r, const float* g, const float* b, const float palette[4][3],
+							   unsigned char indices[16] )
+{
+#if defined( COOK_SSE2 )
+	__m128 total = _mm_setzero_ps();
+	for( int i = 0; i < 16; i += 4 )
+	{
+		__m128 pr = _mm_loadu_ps( r + i ), pg = _mm_loadu_ps( g + i ), pb = _mm_loadu_ps( b + i );
+		__m128 best = _mm_set1_ps( 1e30f );
+		__m128i bestIndex = _mm_setzero_si128();
+		for( int k = 0; k < 4; ++k )
+		{
+			__m128 dr = _mm_sub_ps( pr, _mm_set1_ps( palette[k][0] ) );
+			__m128 dg = _mm_sub_ps( pg, _mm_set1_ps( palette[k][1] ) );
+			__m128 db = _mm_sub_ps( pb, _mm_set1_ps( palette[k][2] ) );
+			__m128 d = _mm_add_ps( _mm_add_ps( _mm_mul_ps( dr, dr ), _mm_mul_ps( dg, dg ) ), _mm_mul_ps( db, db ) );
+			__m128i closer = _mm_castps_si128( _mm_cmplt_ps( d, best ) );
+			best = _mm_min_ps( d, best );
+			bestIndex = _mm_or_si128( _mm_and_si128( closer, _mm_set1_epi32( k ) ), _mm_andnot_si128( closer, bestIndex ) );
+		}
+		total = _mm_add_ps( total, best );
+		int out[4];
+		_mm_storeu_si128( ( __m128i* )out, bestIndex );
+		for( int j = 0; j < 4; ++j )
+			indices[i + j] = ( unsigned char )out[j];
+	}
+	float sums[4];
+	_mm_storeu_ps( sums, total );
+	return sums[0] + sums[1] + sums[2] + sums[3];
+#else
+	float total = 0.0f;
+	for( int i = 0; i < 16; ++i )
+	{
+		float best = 1e30f;
+		for( int k = 0; k < 4; ++k )
+		{
+			float dr = r[i] - palette[k][0], dg = g[i] - palette[k][1], db = b[i] - palette[k][2];
+			float d = dr * dr + dg * dg + db * db;
+			if( d < best )
+			{
+				best = d;
+				indices[i] = ( unsigned char )k;
+			}
+		}
+		total += best;
+	}
+	return total;
+#endif
+}
+
+// Quantizes the endpoints, builds the 4-color palette (c0 > c1) and picks the indices
+static float FitColorEndpoints( const float* r, const float* g, const float* b, const float e0[3], const float e1[3],
+								unsigned short& c0, unsigned short& c1, unsigned char indices[16] )
+{
+	c0 = To565( e0 );
+	c1 = To565( e1 );
+	if( c0 < c1 )
+		swap( c0, c1 );
+	float palette[4][3];
+	From565( c0, palette[0] );
+	From565( c1, palette[1] );
+	for( int k = 0; k < 3; ++k )
+	{
+		palette[2][k] = ( 2.0f * palette[0][k] + palette[1][k] ) / 3.0f;
+		palette[3][k] = ( palette[0][k] + 2.0f * palette[1][k] ) / 3.0f;
+	}
+	if( c0 == c1 )
+	{
+		// one color: 3-color mode, index 0 everywhere
+		memset( indices, 0, 16 );
+		float total = 0.0f;
+		for( int i = 0; i < 16; ++i )
+		{
+			float dr = r[i] - palette[0][0], dg = g[i] - palette[0][1], db = b[i] - palette[0][2];
+			total += dr * dr + dg * dg + db * db;
+		}
+		return total;
+	}
+	return PickColorIndices( r, g, b, palette, indices );
+}
+
+static void EncodeColorBlock( const unsigned char rgba[64], unsigned char out[8] )
+{
+	float r[16], g[16], b[16];
+	float mean[3] = { 0.0f, 0.0f, 0.0f };
+	for( int i = 0; i < 16; ++i )
+	{
+		r[i] = rgba[i * 4];
+		g[i] = rgba[i * 4 + 1];
+		b[i] = rgba[i * 4 + 2];
+		mean[0] += r[i];
+		mean[1] += g[i];
+		mean[2] += b[i];
+	}
+	for( int k = 0; k < 3; ++k )
+		mean[k] /= 16.0f;
+
+	// principal axis of the colors (power iteration on the covariance)
+	float cov[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+	for( int i = 0; i < 16; ++i )
+	{
+		float dr = r[i] - mean[0], dg = g[i] - mean[1], db = b[i] - mean[2];
+		cov[0] += dr * dr; cov[1] += dr * dg; cov[2] += dr * db;
+		cov[3] += dg * dg; cov[4] += dg * db; cov[5] += db * db;
+	}
+	float axis[3] = { 1.0f, 1.0f, 1.0f };
+	for( int iteration = 0; iteration < 6; ++iteration )
+	{
+		float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+		float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+		float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+		float len = max( max( fabsf( x ), fabsf( y ) ), fabsf( z ) );
+		if( len < 1e-6f )
+			break;
+		axis[0] = x / len;
+		axis[1] = y / len;
+		axis[2] = z / len;
+	}
+	float lenSq = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+
+	// endpoints at the extremes along the axis, inset a little
+	float lo = 1e30f, hi = -1e30f;
+	for( int i = 0; i < 16; ++i )
+	{
+		float t = ( ( r[i] - mean[0] ) * axis[0] + ( g[i] - mean[1] ) * axis[1] + ( b[i] - mean[2] ) * axis[2] ) / lenSq;
+		lo = min( lo, t );
+		hi = max( hi, t );
+	}
+	float inset = ( hi - lo ) / 32.0f;
+	lo += inset;
+	hi -= inset;
+	float e0[3], e1[3];
+	for( int k = 0; k < 3; ++k )
+	{
+		e0[k] = min( max( mean[k] + axis[k] * hi, 0.0f ), 255.0f );
+		e1[k] = min( max( mean[k] + axis[k] * lo, 0.0f ), 255.0f );
+	}
+
+	unsigned short c0, c1;
+	unsigned char indices[16];
+	float error = FitColorEndpoints( r, g, b, e0, e1, c0, c1, indices );
+
+	// one least squares refit of the endpoints for the chosen indices
+	if( c0 != c1 )
+	{
+		static const float weight0[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+		float aa = 0.0f, bb = 0.0f, ab = 0.0f, ax[3] = { 0.0f, 0.0f, 0.0f }, bx[3] = { 0.0f, 0.0f, 0.0f };
+		for( int i = 0; i < 16; ++i )
+		{
+			float a = weight0[indices[i]], bw = 1.0f - a;
+			float x[3] = { r[i], g[i], b[i] };
+			aa += a * a;
+			bb += bw * bw;
+			ab += a * bw;
+			for( int k = 0; k < 3; ++k )
+			{
+				ax[k] += a * x[k];
+				bx[k] += bw * x[k];
+			}
+		}
+		float det = aa * bb - ab * ab;
+		if( fabsf( det ) > 1e-6f )
+		{
+			float f0[3], f1[3];
+			for( int k = 0; k < 3; ++k )
+			{
+				f0[k] = min( max( ( ax[k] * bb - bx[k] * ab ) / det, 0.0f ), 255.0f );
+				f1[k] = min( max( ( bx[k] * aa - ax[k] * ab ) / det, 0.0f ), 255.0f );
+			}
+			unsigned short r0, r1;
+			unsigned char refit[16];
+			float refitError = FitColorEndpoints( r, g, b, f0, f1, r0, r1, refit );
+			if( refitError < error )
+			{
+				c0 = r0;
+				c1 = r1;
+				memcpy( indices, refit, 16 );
+			}
+		}
+	}
+
+	unsigned int bits = 0;
+	for( int i = 0; i < 16; ++i )
+		bits |= ( unsigned int )indices[i] << ( i * 2 );
+	out[0] = ( unsigned char )c0;
+	out[1] = ( unsigned char )( c0 >> 8 );
+	out[2] = ( unsigned char )c1;
+	out[3] = ( unsigned char )( c1 >> 8 );
+	out[4] = ( unsigned char )bits;
+	out[5] = ( unsigned char )( bits >> 8 );
+	out[6] = ( unsigned char )( bits >> 16 );
+	out[7] = ( unsigned char )( bits >> 24 );
+}
+
+//--------------------------------------------------------------------------------------
+// BC4 (alpha of BC3, each channel of BC5): 8-value mode between the min and max
+//--------------------------------------------------------------------------------------
+static void EncodeBC4Block( const unsigned char* values, int stride, unsigned char out[8] )
+{
+	float v[16];
+	int lo = 255, hi = 0;
+	for( int i = 0; i < 16; ++i )
+	{
+		v[i] = values[i * stride];
+		lo = min( lo, ( int )values[i * stride] );
+		hi = max( hi, ( int )values[i * stride] );
+	}
+	out[0] = ( unsigned char )hi;
+	out[1] = ( unsigned char )lo;
+	memset( out + 2, 0, 6 );
+	if( hi == lo )
+		return;
+
+	// position between lo (0) and hi (7), mapped to the index order hi, lo, 6/7 hi .. 1/7 hi
+	unsigned char indices[16];
+	float scale = 7.0f / ( hi - lo );
+#if defined( COOK_SSE2 )
+	for( int i = 0; i < 16; i += 4 )
+	{
+		__m128 p = _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( v + i ), _mm_set1_ps( ( float )lo ) ), _mm_set1_ps( scale ) );
+		__m128i position = _mm_cvtps_epi32( p );
+		__m128i index = _mm_and_si128( _mm_sub_epi32( _mm_set1_epi32( 8 ), position ), _mm_set1_epi32( 7 ) );
+		index = _mm_xor_si128( index, _mm_and_si128( _mm_cmplt_epi32( index, _mm_set1_epi32( 2 ) ), _mm_set1_epi32( 1 ) ) );
+		int result[4];
+		_mm_storeu_si128( ( __m128i* )result, index );
+		for( int j = 0; j < 4; ++j )
+			indices[i + j] = ( unsigned char )result[j];
+	}
+#else
+	for( int i = 0; i < 16; ++i )
+	{
+		int position = ( int )( ( v[i] - lo ) * scale + 0.5f );
+		int index = ( 8 - position ) & 7;
+		indices[i] = ( unsigned char )( index < 2 ? index ^ 1 : index );
+	}
+#endif
+	unsigned long long bits = 0;
+	for( int i = 0; i < 16; ++i )
+		bits |= ( unsigned long long )indices[i] << ( i * 3 );
+	for( int i = 0; i < 6; ++i )
+		out[2 + i] = ( unsigned char )( bits >> ( i * 8 ) );
+}
+
+void EncodeBC1Block( const unsigned char rgba[64], unsigned char out[8] )
+{
+	EncodeColorBlock( rgba, out );
+}
+
+void EncodeBC3Block( const unsigned char rgba[64], unsigned char out[16] )
+{
+	EncodeBC4Block( rgba + 3, 4, out );
+	EncodeColorBlock( rgba, out + 8 );
+}
+
+void EncodeBC5Block( const unsigned char rgba[64], unsigned char out[16] )
+{
+	EncodeBC4Block( rgba, 4, out );
+	EncodeBC4Block( rgba + 1, 4, out + 8 );
+}
+
+//--------------------------------------------------------------------------------------
+// Levels
+//--------------------------------------------------------------------------------------
+unsigned int CookedBlockBytes( CookedFormat format )
+{
+	switch( format )
+	{
+	case COOKED_BC1: return 8;
+	case COOKED_BC3: return 16;
+	case COOKED_BC5: return 16;
+	default: return 4;
+	}
+}
+
+unsigned int CookedDXGIFormat( CookedFormat format, bool srgb )
+{
+	switch( format )
+	{
+	case COOKED_BC1: return srgb ? 72 : 71;			// DXGI_FORMAT_BC1_UNORM(_SRGB)
+	case COOKED_BC3: return srgb ? 78 : 77;			// DXGI_FORMAT_BC3_UNORM(_SRGB)
+	case COOKED_BC5: return 83;						// DXGI_FORMAT_BC5_UNORM
+	default: return srgb ? 29 : 28;					// DXGI_FORMAT_R8G8B8A8_UNORM(_SRGB)
+	}
+}
+
+void EncodeLevel( const Image& level, CookedFormat format, int numThreads, CookedLevel& out )
+{
+	out.width = level.width;
+	out.height = level.height;
+	if( format == COOKED_RGBA8 )
+	{
+		out.rowPitch = level.width * 4;
+		out.data = level.rgba;
+		return;
+	}
+
+	const int blocksX = ( level.width + 3 ) / 4, blocksY = ( level.height + 3 ) / 4;
+	const unsigned int blockBytes = CookedBlockBytes( format );
+	out.rowPitch = blocksX * blockBytes;
+	out.data.resize( ( size_t )out.rowPitch * blocksY );
+	ParallelFor( blocksY, numThreads, [&]( int by ) {
+		unsigned char block[64];
+		for( int bx = 0; bx < blocksX; ++bx )
+		{
+			// edge blocks repeat the last row / column
+			for( int y = 0; y < 4; ++y )
+				for( int x = 0; x < 4; ++x )
+				{
+					int sx = min( bx * 4 + x, level.width - 1 ), sy = min( by * 4 + y, level.height - 1 );
+					memcpy( block + ( y * 4 + x ) * 4, &level.rgba[( ( size_t )sy * level.width + sx ) * 4], 4 );
+				}
+			unsigned char* dst = &out.data[( size_t )by * out.rowPitch + bx * blockBytes];
+			if( format == COOKED_BC1 )
+				EncodeBC1Block( block, dst );
+			else if( format == COOKED_BC3 )
+				EncodeBC3Block( block, dst );
+			else
+				EncodeBC5Block( block, dst );
+		}
+	} );
+}
+
+static void DecodeColorBlock( const unsigned char* in, bool alwaysFourColor, unsigned char rgba[64] )
+{
+	unsigned short c0 = ( unsigned short )( in[0] | ( in[1] << 8 ) );
+	unsigned short c1 = ( unsigned short )( in[2] | ( in[3] << 8 ) );
+	unsigned int bits = in[4] | ( in[5] << 8 ) | ( in[6] << 16 ) | ( ( unsigned int )in[7] << 24 );
+	float palette[4][3];
+	From565( c0, palette[0] );
+	From565( c1, palette[1] );
+	bool fourColor = alwaysFourColor || c0 > c1;
+	for( int k = 0; k < 3; ++k )
+	{
+		palette[2][k] = fourColor ? ( 2.0f * palette[0][k] + palette[1][k] ) / 3.0f : ( palette[0][k] + palette[1][k] ) / 2.0f;
+		palette[3][k] = fourColor ? ( palette[0][k] + 2.0f * palette[1][k] ) / 3.0f : 0.0f;
+	}
+	for( int i = 0; i < 16; ++i )
+	{
+		int index = ( bits >> ( i * 2 ) ) & 3;
+		for( int k = 0; k < 3; ++k )
+			rgba[i * 4 + k] = ( unsigned char )( palette[index][k] + 0.5f );
+		rgba[i * 4 + 3] = fourColor || index != 3 ? 255 : 0;
+	}
+}
+
+static void DecodeBC4Block( const unsigned char* in, unsigned char* values, int stride )
+{
+	float a0 = in[0], a1 = in[1];
+	float palette[8] = { a0, a1 };
+	for( int i = 2; i < 8; ++i )
+		palette[i] = a0 > a1 ? ( ( 8 - i ) * a0 + ( i - 1 ) * a1 ) / 7.0f
+							 : ( i < 6 ? ( ( 6 - i ) * a0 + ( i - 1 ) * a1 ) / 5.0f : ( i == 6 ? 0.0f : 255.0f ) );
+	unsigned long long bits = 0;
+	for( int i = 0; i < 6; ++i )
+		bits |= ( unsigned long long )in[2 + i] << ( i * 8 );
+	for( int i = 0; i < 16; ++i )
+		values[i * stride] = ( unsigned char )( palette[( bits >> ( i * 3 ) ) & 7] + 0.5f );
+}
+
+void DecodeLevel( const CookedLevel& level, CookedFormat format, Image& out )
+{
+	out.width = level.width;
+	out.height = level.height;
+	if( format == COOKED_RGBA8 )
+	{
+		out.rgba = level.data;
+		return;
+	}
+	out.rgba.assign( ( size_t )level.width * level.height * 4, 255 );
+	const int blocksX = ( level.width + 3 ) / 4, blocksY = ( level.height + 3 ) / 4;
+	const unsigned int blockBytes = CookedBlockBytes( format );
+	for( int by = 0; by < blocksY; ++by )
+		for( int bx = 0; bx < blocksX; ++bx )
+		{
+			const unsigned char* in = &level.data[( size_t )by * level.rowPitch + bx * blockBytes];
+			unsigned char block[64];
+			memset( block, 255, sizeof( block ) );
+			if( format == COOKED_BC1 )
+				DecodeColorBlock( in, false, block );
+			else if( format == COOKED_BC3 )
+			{
+				DecodeColorBlock( in + 8, true, block );
+				DecodeBC4Block( in, block + 3, 4 );
+			}
+			else
+			{
+				DecodeBC4Block( in, block, 4 );
+				DecodeBC4Block( in + 8, block + 1, 4 );
+				for( int i = 0; i < 16; ++i )
+					block[i * 4 + 2] = 0;
+			}
+			for( int y = 0; y < 4 && by * 4 + y < level.height; ++y )
+				for( int x = 0; x < 4 && bx * 4 + x < level.width; ++x )
+					memcpy( &out.rgba[( ( size_t )( by * 4 + y ) * level.width + bx * 4 + x ) * 4], block + ( y * 4 + x ) * 4, 4 );
+		}
+}
+
+//--------------------------------------------------------------------------------------
+// Container
+//--------------------------------------------------------------------------------------
+static size_t Align( size_t offset )
+{
+	return ( offset + COOKED_ALIGNMENT - 1 ) & ~( size_t )( COOKED_ALIGNMENT - 1 );
+}
+
+bool WriteCookedTexture( const string& path, CookedFormat format, bool srgbFormat, const vector<CookedLevel>& levels )
+{
+	if( levels.empty() || levels.size() > COOKED_MAX_MIPS )
+		return false;
+
+	CookedTextureHeader header;
+	memset( &header, 0, sizeof( header ) );
+	header.magic = COOKED_MAGIC;
+	header.version = COOKED_VERSION;
+	header.format = format;
+	header.dxgiFormat = CookedDXGIFormat( format, srgbFormat );
+	header.width = levels[0].width;
+	header.height = levels[0].height;
+	header.mipCount = ( unsigned int )levels.size();
+	size_t offset = Align( sizeof( header ) );
+	for( size_t i = 0; i < levels.size(); ++i )
+	{
+		header.levels[i].offset = offset;
+		header.levels[i].size = ( unsigned int )levels[i].data.size();
+		header.levels[i].rowPitch = levels[i].rowPitch;
+		offset = Align( offset + levels[i].data.size() );
+	}
+
+	// write next to the target and rename over it, so readers see the old file or the
+	// whole new one, and cookers writing the same target don't share a temp file
+	string temp = UniqueTempPath( path );
+	FILE* file = fopen( temp.c_str(), "wb" );
+	if( !file )
+		return false;
+	static const unsigned char padding[COOKED_ALIGNMENT] = { 0 };
+	bool ok = fwrite( &header, sizeof( header ), 1, file ) == 1;
+	size_t written = sizeof( header );
+	for( size_t i = 0; ok && i < levels.size(); ++i )
+	{
+		size_t pad = ( size_t )header.levels[i].offset - written;
+		ok = fwrite( padding, 1, pad, file ) == pad &&
+			 fwrite( &levels[i].data[0], 1, levels[i].data.size(), file ) == levels[i].data.size();
+		written += pad + levels[i].data.size();
+	}
+	ok = fclose( file ) == 0 && ok;
+	if( !ok || !RenameOver( temp, path ) )
+	{
+		remove( temp.c_str() );
+		return false;
+	}
+	return true;
+}
+
+bool ParseCookedTexture( const unsigned char* data, size_t size, CookedTextureView& view )
+{
+	if( !data || size < sizeof( CookedTextureHeader ) )
+		return false;
+	const CookedTextureHeader* header = ( const CookedTextureHeader* )data;
+	if( header->magic != COOKED_MAGIC || header->version != COOKED_VERSION || header->format >= NUM_COOKED_FORMATS ||
+		header->mipCount == 0 || header->mipCount > COOKED_MAX_MIPS || header->width == 0 || header->height == 0 )
+		return false;
+	view.header = header;
+	for( unsigned int i = 0; i < COOKED_MAX_MIPS; ++i )
+		view.levels[i] = NULL;
+	for( unsigned int i = 0; i < header->mipCount; ++i )
+	{
+		if( header->levels[i].offset % COOKED_ALIGNMENT || header->levels[i].offset + header->levels[i].size > size )
+			return false;
+		view.levels[i] = data + header->levels[i].offset;
+	}
+	return true;
+}
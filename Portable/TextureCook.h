@@ -0,0 +1,97 @@
+//--------------------------------------------------------------------------------------
+// File: TextureCook.h
+//
+// Offline texture cooking: gamma-correct mip generation, BC1/BC3/BC5 block compression
+// and the .ctex container. A .ctex file holds every level already in the layout of its
+// DXGI format, 64-byte aligned, so the sample maps it and hands the levels straight to
+// CreateTexture2D as initial data.
+//--------------------------------------------------------------------------------------
+#pragma once
+
+#include "ImageFile.h"
+
+#include <string>
+#include <vector>
+
+enum CookedFormat
+{
+	COOKED_RGBA8 = 0,			// R8G8B8A8_UNORM
+	COOKED_BC1,					// opaque color, 4 bpp
+	COOKED_BC3,					// color + alpha, 8 bpp
+	COOKED_BC5,					// two channels (red, green), 8 bpp
+	NUM_COOKED_FORMATS
+};
+
+enum MipFilter
+{
+	MIP_BOX = 0,				// 2x2 average (area weighted for odd sizes)
+	MIP_KAISER					// Kaiser-windowed sinc, 3 taps either side
+};
+
+#define COOKED_MAX_MIPS 16
+
+struct CookedLevel
+{
+	int							width, height;
+	unsigned int				rowPitch;		// bytes per row of pixels or of 4x4 blocks
+	std::vector<unsigned char>	data;
+};
+
+//--------------------------------------------------------------------------------------
+// Cooking
+//--------------------------------------------------------------------------------------
+
+// Mip chain of image (level 0 is a copy). With srgb the color channels are filtered
+// in linear space and stored back as sRGB; alpha is always linear. maxMips 0 = full chain.
+void GenerateMips( const Image& image, MipFilter filter, bool srgb, int maxMips, int numThreads,
+				   std::vector<Image>& mips );
+
+// One level in format, blocks spread over numThreads threads
+void EncodeLevel( const Image& level, CookedFormat format, int numThreads, CookedLevel& out );
+
+// ... and back, for measuring the error
+void DecodeLevel( const CookedLevel& level, CookedFormat format, Image& out );
+
+// Single blocks: 16 RGBA pixels, row by row -> 8 (BC1) or 16 (BC3, BC5) bytes
+void EncodeBC1Block( const unsigned char rgba[64], unsigned char out[8] );
+void EncodeBC3Block( const unsigned char rgba[64], unsigned char out[16] );
+void EncodeBC5Block( const unsigned char rgba[64], unsigned char out[16] );
+
+// Size of a block (or pixel for RGBA8) in bytes, and its DXGI format
+unsigned int CookedBlockBytes( CookedFormat format );
+unsigned int CookedDXGIFormat( CookedFormat format, bool srgb );
+
+//--------------------------------------------------------------------------------------
+// The .ctex container
+//--------------------------------------------------------------------------------------
+#define COOKED_MAGIC 0x58455443			// "CTEX"
+#define COOKED_VERSION 1
+#define COOKED_ALIGNMENT 64
+
+struct CookedTextureHeader
+{
+	unsigned int		magic;
+	unsigned int		version;
+	unsigned int		format;			// CookedFormat
+	unsigned int		dxgiFormat;		// what to create the texture as
+	unsigned int		width, height;
+	unsigned int		mipCount;
+	unsigned int		reserved;
+	struct
+	{
+		unsigned long long	offset;		// from the start of the file, COOKED_ALIGNMENT aligned
+		unsigned int		size;
+		unsigned int		rowPitch;
+	}					levels[COOKED_MAX_MIPS];
+};
+
+// A parsed container; the level pointers point into the (mapped) file
+struct CookedTextureView
+{
+	const CookedTextureHeader*	header;
+	const unsigned char*		levels[COOKED_MAX_MIPS];
+};
+
+bool WriteCookedTexture( const std::string& path, CookedFormat format, bool srgbFormat,
+						 const std::vector<CookedLevel>& levels );
+bool ParseCookedTexture( const unsigned char* data, size_t size, CookedTextureView& view );
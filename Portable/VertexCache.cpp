@@ -0,0 +1,139 @@
+//--------------------------------------------------------------------------------------
+// File: VertexCache.cpp
+//--------------------------------------------------------------------------------------
+#include "VertexCache.h"
+
+#include <algorithm>
+#include <chrono>
+
+using namespace std;
+
+typedef chrono::high_resolution_clock Clock;
+
+static double Milliseconds( const Clock::time_point& start )
+{
+	return chrono::duration<double, milli>( Clock::now() - start ).count();
+}
+
+double VertexCache::Stats::SavedMs() const
+{
+	double saved = 0.0;
+	if( displaceMisses )
+		saved += displaceHits * displaceMs / displaceMisses;
+	if( transformMisses )
+		saved += transformHits * transformMs / transformMisses;
+	return saved;
+}
+
+double VertexCache::Stats::HitRate() const
+{
+	unsigned int lookups = displaceHits + displaceMisses + transformHits + transformMisses;
+	return lookups ? ( double )( displaceHits + transformHits ) / lookups : 0.0;
+}
+
+void VertexCache::Stats::Add( const Stats& other )
+{
+	displaceHits += other.displaceHits;
+	displaceMisses += other.displaceMisses;
+	transformHits += other.transformHits;
+	transformMisses += other.transformMisses;
+	displaceMs += other.displaceMs;
+	transformMs += other.transformMs;
+}
+
+VertexCache::VertexCache( int maxEntries )
+	: _maxEntries( max( maxEntries, 1 ) )
+{
+	Clear();
+	ResetStats();
+}
+
+void VertexCache::Clear()
+{
+	_mesh = NULL;
+	_meshVersion = 0;
+	_puffiness = 0.0f;
+	_displacedVersion = 0;
+	_entries.clear();
+	_uses = 0;
+}
+
+void VertexCache::ResetStats()
+{
+	memset( &_stats, 0, sizeof( _stats ) );
+}
+
+const CpuDisplacedVertices& VertexCache::Displace( const CpuMesh& mesh, unsigned int meshVersion, float puffiness )
+{
+	if( _displacedVersion && _mesh == &mesh && _meshVersion == meshVersion && _puffiness == puffiness )
+	{
+		++_stats.displaceHits;
+		return _displaced;
+	}
+
+	// growing the buffers is a one-off, not what a hit saves
+	_displaced.position.resize( mesh.vertices.size() );
+	_displaced.normal.resize( mesh.vertices.size() );
+	Clock::time_point start = Clock::now();
+	DisplaceVertices( mesh, puffiness, _displaced );
+	_mesh = &mesh;
+	_meshVersion = meshVersion;
+	_puffiness = puffiness;
+	++_displacedVersion;
+	++_stats.displaceMisses;
+	_stats.displaceMs += Milliseconds( start );
+	return _displaced;
+}
+
+const CpuRasterScratch& VertexCache::Transform( const CpuMesh& mesh, unsigned int meshVersion, const CpuCamera& camera,
+												unsigned int instance, unsigned int worldVersion,
+												unsigned int cameraId, unsigned int cameraVersion, CpuGBuffer& gbuffer )
+{
+	SetGBufferProjection( camera.projection, gbuffer );
+	const CpuDisplacedVertices& displaced = Displace( mesh, meshVersion, camera.puffiness );
+	++_uses;
+
+	Entry* entry = NULL;
+	for( size_t i = 0; i < _entries.size() && !entry; ++i )
+		if( _entries[i].instance == instance && _entries[i].cameraId == cameraId )
+			entry = &_entries[i];
+	if( entry && entry->displacedVersion == _displacedVersion && entry->worldVersion == worldVersion &&
+		entry->cameraVersion == cameraVersion )
+	{
+		entry->lastUse = _uses;
+		++_stats.transformHits;
+		return entry->vertices;
+	}
+
+	if( !entry )
+	{
+		// a new pair takes a free entry or the least recently used one (and its buffers)
+		if( ( int )_entries.size() < _maxEntries )
+		{
+			_entries.push_back( Entry() );
+			entry = &_entries.back();
+		}
+		else
+		{
+			entry = &_entries[0];
+			for( size_t i = 1; i < _entries.size(); ++i )
+				if( _entries[i].lastUse < entry->lastUse )
+					entry = &_entries[i];
+		}
+		entry->instance = instance;
+		entry->cameraId = cameraId;
+	}
+
+	entry->vertices.clip.resize( displaced.position.size() );
+	entry->vertices.viewPosition.resize( displaced.position.size() );
+	entry->vertices.viewNormal.resize( displaced.position.size() );
+	Clock::time_point start = Clock::now();
+	TransformDisplaced( displaced, camera, entry->vertices );
+	entry->displacedVersion = _displacedVersion;
+	entry->worldVersion = worldVersion;
+	entry->cameraVersion = cameraVersion;
+	entry->lastUse = _uses;
+	++_stats.transformMisses;
+	_stats.transformMs += Milliseconds( start );
+	return entry->vertices;
+}
@@ -0,0 +1,93 @@
+//--------------------------------------------------------------------------------------
+// File: VertexCache.h
+//
+// Incremental vertex processing for the CPU G-buffer pass. VSMRTDirect pushes every
+// vertex out along its normal by the puffiness and then transforms it, every frame
+// and for every view, though the puffiness only changes when its slider moves and
+// most frames see the same model from the same camera as the last one.
+//
+// The cache keeps two levels, each recomputed only when what it depends on changed:
+//  - the displaced object-space vertices, per mesh version and puffiness (SIMD)
+//  - the view-space and clip-space vertices, per (instance, camera) pair, tagged with
+//    the versions of the displaced vertices, the instance's world and the camera
+// Versions are counters the caller bumps (Versioned<T> does it on every change); a
+// cache entry whose versions all match is used as is. One cache per thread.
+//--------------------------------------------------------------------------------------
+#pragma once
+
+#include "CpuRaster.h"
+
+#include <cstring>
+#include <vector>
+
+// A value and a counter that goes up whenever the value changes (bit for bit)
+template<typename T> struct Versioned
+{
+	T				value;
+	unsigned int	version;
+
+	Versioned() : version( 0 ) { memset( &value, 0, sizeof( value ) ); }
+
+	// true if it changed
+	bool Set( const T& v )
+	{
+		if( !memcmp( &v, &value, sizeof( T ) ) && version )
+			return false;
+		value = v;
+		++version;
+		return true;
+	}
+};
+
+class VertexCache
+{
+public:
+	// maxEntries (instance, camera) pairs; the least recently used goes first
+	explicit VertexCache( int maxEntries = 8 );
+
+	// The displaced vertices of mesh, recomputed if meshVersion or puffiness changed
+	// (or it's another mesh)
+	const CpuDisplacedVertices& Displace( const CpuMesh& mesh, unsigned int meshVersion, float puffiness );
+
+	// The transformed vertices of instance seen by camera, recomputed if the displaced
+	// vertices, worldVersion or cameraVersion changed. Fills in the projection fields of
+	// gbuffer either way.
+	const CpuRasterScratch& Transform( const CpuMesh& mesh, unsigned int meshVersion, const CpuCamera& camera,
+									   unsigned int instance, unsigned int worldVersion,
+									   unsigned int cameraId, unsigned int cameraVersion, CpuGBuffer& gbuffer );
+
+	void Clear();
+
+	struct Stats
+	{
+		unsigned int	displaceHits, displaceMisses;
+		unsigned int	transformHits, transformMisses;
+		double			displaceMs, transformMs;		// spent on the misses
+
+		// the hits at the average cost of a miss
+		double SavedMs() const;
+		double HitRate() const;		// of both levels
+		void Add( const Stats& other );
+	};
+	Stats GetStats() const { return _stats; }
+	void ResetStats();
+
+private:
+	struct Entry
+	{
+		unsigned int		instance, cameraId;
+		unsigned int		displacedVersion, worldVersion, cameraVersion;
+		unsigned long long	lastUse;
+		CpuRasterScratch	vertices;
+	};
+
+	const CpuMesh*			_mesh;
+	unsigned int			_meshVersion;
+	float					_puffiness;
+	unsigned int			_displacedVersion;	// bumped when the displaced vertices change
+	CpuDisplacedVertices	_displaced;
+	std::vector<Entry>		_entries;
+	int						_maxEntries;
+	unsigned long long		_uses;
+	Stats					_stats;
+};
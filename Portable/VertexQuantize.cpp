@@ -0,0 +1,421 @@
+//--------------------------------------------------------------------------------------
+// File: VertexQuantize.cpp
+//--------------------------------------------------------------------------------------
+#include "VertexQuantize.h"
+#include "SimdMath.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+#define POSITION_STEPS 65535.0f
+#define NORMAL_STEPS 32767.0f
+
+//--------------------------------------------------------------------------------------
+// Halves
+//--------------------------------------------------------------------------------------
+static unsigned int FloatBits( float f )
+{
+	unsigned int bits;
+	memcpy( &bits, &f, sizeof( bits ) );
+	return bits;
+}
+
+static float BitsFloat( unsigned int bits )
+{
+	float f;
+	memcpy( &f, &bits, sizeof( f ) );
+	return f;
+}
+
+unsigned short FloatToHalf( float f )
+{
+	unsigned int x = FloatBits( f );
+	unsigned int sign = ( x >> 16 ) & 0x8000;
+	x &= 0x7fffffff;
+	if( x > 0x7f800000 )							// NaN
+		return ( unsigned short )( sign | 0x7e00 );
+	if( x >= 0x477ff000 )							// rounds past 65504
+		return ( unsigned short )( sign | 0x7c00 );
+	if( x < 0x38800000 )
+	{
+		// denormal: adding 0.5 lines the mantissa up with the half's and rounds it
+		return ( unsigned short )( sign | ( FloatBits( BitsFloat( x ) + 0.5f ) - 0x3f000000 ) );
+	}
+	// rebias the exponent and round to nearest even
+	x += 0xc8000fff + ( ( x >> 13 ) & 1 );
+	return ( unsigned short )( sign | ( x >> 13 ) );
+}
+
+float HalfToFloat( unsigned short h )
+{
+	unsigned int bits = ( unsigned int )( h & 0x7fff ) << 13;
+	unsigned int exponent = bits & ( 0x7c00 << 13 );
+	bits += ( 127 - 15 ) << 23;
+	if( exponent == ( 0x7c00 << 13 ) )				// inf, NaN
+		bits += ( 128 - 16 ) << 23;
+	else if( exponent == 0 )						// zero, denormal
+		bits = FloatBits( BitsFloat( bits + ( 1 << 23 ) ) - BitsFloat( 113 << 23 ) );
+	return BitsFloat( bits | ( ( unsigned int )( h & 0x8000 ) << 16 ) );
+}
+
+//--------------------------------------------------------------------------------------
+// Octahedral normals
+//--------------------------------------------------------------------------------------
+static float SignNotZero( float x )
+{
+	return x >= 0.0f ? 1.0f : -1.0f;
+}
+
+// Angle between a (any length) and b; atan2 stays accurate where acos( dot ) doesn't
+static double AngleBetween( const float a[3], const float b[3] )
+{
+	double cx = ( double )a[1] * b[2] - ( double )a[2] * b[1];
+	double cy = ( double )a[2] * b[0] - ( double )a[0] * b[2];
+	double cz = ( double )a[0] * b[1] - ( double )a[1] * b[0];
+	double dot = ( double )a[0] * b[0] + ( double )a[1] * b[1] + ( double )a[2] * b[2];
+	return atan2( sqrt( cx * cx + cy * cy + cz * cz ), dot );
+}
+
+double NormalErrorDegrees( const float n[3], const float decoded[3] )
+{
+	return AngleBetween( n, decoded ) * 180.0 / 3.14159265358979;
+}
+
+static short ToSnorm( float x )
+{
+	return ( short )max( -32767.0f, min( 32767.0f, x ) );
+}
+
+void OctDecode( const short e[2], float n[3] )
+{
+	float x = max( e[0] * ( 1.0f / NORMAL_STEPS ), -1.0f );
+	float y = max( e[1] * ( 1.0f / NORMAL_STEPS ), -1.0f );
+	float z = 1.0f - fabsf( x ) - fabsf( y );
+	float t = max( -z, 0.0f );
+	x -= x >= 0.0f ? t : -t;
+	y -= y >= 0.0f ? t : -t;
+	float length = sqrtf( x * x + y * y + z * z );
+	n[0] = x / length;
+	n[1] = y / length;
+	n[2] = z / length;
+}
+
+void OctEncode( const float n[3], short out[2] )
+{
+	float l1 = fabsf( n[0] ) + fabsf( n[1] ) + fabsf( n[2] );
+	if( l1 <= 0.0f )
+	{
+		out[0] = out[1] = 0;
+		return;
+	}
+	float u = n[0] / l1, v = n[1] / l1;
+	if( n[2] < 0.0f )
+	{
+		float fu = ( 1.0f - fabsf( v ) ) * SignNotZero( u );
+		v = ( 1.0f - fabsf( u ) ) * SignNotZero( v );
+		u = fu;
+	}
+
+	// of the four roundings, keep the one that decodes closest to n
+	double bestAngle = 10.0;
+	float su = floorf( u * NORMAL_STEPS ), sv = floorf( v * NORMAL_STEPS );
+	for( int i = 0; i < 4; ++i )
+	{
+		short e[2] = { ToSnorm( su + ( i & 1 ) ), ToSnorm( sv + ( i >> 1 ) ) };
+		float d[3];
+		OctDecode( e, d );
+		double angle = AngleBetween( n, d );
+		if( angle < bestAngle )
+		{
+			bestAngle = angle;
+			out[0] = e[0];
+			out[1] = e[1];
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Quantization
+//--------------------------------------------------------------------------------------
+QuantBox MakeQuantBox( const FloatVertex* vertices, int count )
+{
+	float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for( int i = 0; i < count; ++i )
+		for( int c = 0; c < 3; ++c )
+		{
+			lo[c] = min( lo[c], vertices[i].pos[c] );
+			hi[c] = max( hi[c], vertices[i].pos[c] );
+		}
+	QuantBox box;
+	for( int c = 0; c < 3; ++c )
+	{
+		if( count == 0 )
+			lo[c] = hi[c] = 0.0f;
+		box.offset[c] = lo[c];
+		box.scale[c] = ( hi[c] - lo[c] ) / POSITION_STEPS;
+	}
+	return box;
+}
+
+void QuantizeVertices( const FloatVertex* in, int count, const QuantBox& box, PackedVertex* out )
+{
+	for( int i = 0; i < count; ++i )
+	{
+		for( int c = 0; c < 3; ++c )
+		{
+			float q = box.scale[c] > 0.0f ? ( in[i].pos[c] - box.offset[c] ) / box.scale[c] : 0.0f;
+			out[i].pos[c] = ( unsigned short )max( 0.0f, min( POSITION_STEPS, floorf( q + 0.5f ) ) );
+		}
+		out[i].pos[3] = 0;
+		OctEncode( in[i].normal, out[i].normal );
+		out[i].uv[0] = FloatToHalf( in[i].uv[0] );
+		out[i].uv[1] = FloatToHalf( in[i].uv[1] );
+	}
+}
+
+static VertexRange MakeRange( unsigned int first, unsigned int count )
+{
+	VertexRange range;
+	memset( &range, 0, sizeof( range ) );
+	range.first = first;
+	range.count = count;
+	return range;
+}
+
+void QuantizeMesh( const FloatVertex* vertices, int numVertices, const vector<VertexSpan>& subsets, QuantizedMesh& out )
+{
+	// subsets sorted by their first vertex; overlapping ones merge into one range
+	vector<unsigned int> order( subsets.size() );
+	for( size_t i = 0; i < order.size(); ++i )
+		order[i] = ( unsigned int )i;
+	sort( order.begin(), order.end(), [&]( unsigned int a, unsigned int b ) { return subsets[a].first < subsets[b].first; } );
+
+	out.ranges.clear();
+	out.subsetRange.assign( subsets.size(), 0 );
+	unsigned int next = 0;
+	for( size_t i = 0; i < order.size(); ++i )
+	{
+		unsigned int first = min( subsets[order[i]].first, ( unsigned int )numVertices );
+		unsigned int end = min( first + subsets[order[i]].count, ( unsigned int )numVertices );
+		if( !out.ranges.empty() && first < next )
+		{
+			VertexRange& last = out.ranges.back();
+			last.count = max( last.first + last.count, end ) - last.first;
+		}
+		else
+		{
+			if( first > next )
+				out.ranges.push_back( MakeRange( next, first - next ) );
+			out.ranges.push_back( MakeRange( first, end - first ) );
+		}
+		next = max( next, end );
+		out.subsetRange[order[i]] = ( unsigned int )out.ranges.size() - 1;
+	}
+	if( next < ( unsigned int )numVertices )
+		out.ranges.push_back( MakeRange( next, numVertices - next ) );
+
+	out.vertices.resize( numVertices );
+	for( size_t r = 0; r < out.ranges.size(); ++r )
+	{
+		VertexRange& range = out.ranges[r];
+		range.box = MakeQuantBox( vertices + range.first, range.count );
+		QuantizeVertices( vertices + range.first, range.count, range.box, &out.vertices[range.first] );
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Decoding
+//--------------------------------------------------------------------------------------
+void DecodeVerticesScalar( const PackedVertex* in, int count, const QuantBox& box, FloatVertex* out )
+{
+	for( int i = 0; i < count; ++i )
+	{
+		for( int c = 0; c < 3; ++c )
+			out[i].pos[c] = ( float )in[i].pos[c] * box.scale[c] + box.offset[c];
+		OctDecode( in[i].normal, out[i].normal );
+		out[i].uv[0] = HalfToFloat( in[i].uv[0] );
+		out[i].uv[1] = HalfToFloat( in[i].uv[1] );
+	}
+}
+
+#if defined( SIMDMATH_SSE )
+// 4 halves in the low 16 bits of every lane
+static inline __m128 HalfToFloat4( __m128i h )
+{
+	const __m128i noSign = _mm_set1_epi32( 0x7fff );
+	const __m128 magic = _mm_castsi128_ps( _mm_set1_epi32( ( 254 - 15 ) << 23 ) );
+	const __m128i maxFinite = _mm_set1_epi32( 0x7bff );
+	const __m128 infExponent = _mm_castsi128_ps( _mm_set1_epi32( 255 << 23 ) );
+
+	__m128i magnitude = _mm_and_si128( h, noSign );
+	__m128i sign = _mm_slli_epi32( _mm_xor_si128( h, magnitude ), 16 );
+	// the multiply rebiases the exponent and normalizes denormals in one go
+	__m128 scaled = _mm_mul_ps( _mm_castsi128_ps( _mm_slli_epi32( magnitude, 13 ) ), magic );
+	__m128 infNaN = _mm_and_ps( _mm_castsi128_ps( _mm_cmpgt_epi32( magnitude, maxFinite ) ), infExponent );
+	return _mm_or_ps( scaled, _mm_or_ps( _mm_castsi128_ps( sign ), infNaN ) );
+}
+
+void DecodeVertices( const PackedVertex* in, int count, const QuantBox& box, FloatVertex* out )
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 scaleX = _mm_set1_ps( box.scale[0] ), scaleY = _mm_set1_ps( box.scale[1] ), scaleZ = _mm_set1_ps( box.scale[2] );
+	const __m128 offsetX = _mm_set1_ps( box.offset[0] ), offsetY = _mm_set1_ps( box.offset[1] ), offsetZ = _mm_set1_ps( box.offset[2] );
+	const __m128 normalScale = _mm_set1_ps( 1.0f / NORMAL_STEPS );
+	const __m128 minusOne = _mm_set1_ps( -1.0f ), one = _mm_set1_ps( 1.0f );
+	const __m128 signBit = _mm_set1_ps( -0.0f );
+
+	int i = 0;
+	for( ; i + 4 <= count; i += 4 )
+	{
+		// 4 vertices of 8 shorts -> one register per field pair
+		__m128i a = _mm_loadu_si128( ( const __m128i* )&in[i] ), b = _mm_loadu_si128( ( const __m128i* )&in[i + 1] );
+		__m128i c = _mm_loadu_si128( ( const __m128i* )&in[i + 2] ), d = _mm_loadu_si128( ( const __m128i* )&in[i + 3] );
+		__m128i ab0 = _mm_unpacklo_epi16( a, b ), cd0 = _mm_unpacklo_epi16( c, d );
+		__m128i ab1 = _mm_unpackhi_epi16( a, b ), cd1 = _mm_unpackhi_epi16( c, d );
+		__m128i posXY = _mm_unpacklo_epi32( ab0, cd0 );		// x0 x1 x2 x3 y0 y1 y2 y3
+		__m128i posZW = _mm_unpackhi_epi32( ab0, cd0 );
+		__m128i normal = _mm_unpacklo_epi32( ab1, cd1 );
+		__m128i uv = _mm_unpackhi_epi32( ab1, cd1 );
+
+		// positions: unsigned 16 -> 32 bits
+		__m128 px = _mm_add_ps( _mm_mul_ps( _mm_cvtepi32_ps( _mm_unpacklo_epi16( posXY, zero ) ), scaleX ), offsetX );
+		__m128 py = _mm_add_ps( _mm_mul_ps( _mm_cvtepi32_ps( _mm_unpackhi_epi16( posXY, zero ) ), scaleY ), offsetY );
+		__m128 pz = _mm_add_ps( _mm_mul_ps( _mm_cvtepi32_ps( _mm_unpacklo_epi16( posZW, zero ) ), scaleZ ), offsetZ );
+
+		// normals: signed 16 -> 32 bits, then unfold the octahedron
+		__m128 nx = _mm_cvtepi32_ps( _mm_srai_epi32( _mm_unpacklo_epi16( zero, normal ), 16 ) );
+		__m128 ny = _mm_cvtepi32_ps( _mm_srai_epi32( _mm_unpackhi_epi16( zero, normal ), 16 ) );
+		nx = _mm_max_ps( _mm_mul_ps( nx, normalScale ), minusOne );
+		ny = _mm_max_ps( _mm_mul_ps( ny, normalScale ), minusOne );
+		__m128 nz = _mm_sub_ps( _mm_sub_ps( one, _mm_andnot_ps( signBit, nx ) ), _mm_andnot_ps( signBit, ny ) );
+		__m128 t = _mm_max_ps( _mm_sub_ps( _mm_setzero_ps(), nz ), _mm_setzero_ps() );
+		nx = _mm_sub_ps( nx, _mm_or_ps( t, _mm_and_ps( nx, signBit ) ) );
+		ny = _mm_sub_ps( ny, _mm_or_ps( t, _mm_and_ps( ny, signBit ) ) );
+		__m128 length = _mm_sqrt_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( nx, nx ), _mm_mul_ps( ny, ny ) ), _mm_mul_ps( nz, nz ) ) );
+		nx = _mm_div_ps( nx, length );
+		ny = _mm_div_ps( ny, length );
+		nz = _mm_div_ps( nz, length );
+
+		__m128 u = HalfToFloat4( _mm_unpacklo_epi16( uv, zero ) );
+		__m128 v = HalfToFloat4( _mm_unpackhi_epi16( uv, zero ) );
+
+		// back to 32-byte vertices: two 4x4 transposes
+		_MM_TRANSPOSE4_PS( px, py, pz, nx );
+		_MM_TRANSPOSE4_PS( ny, nz, u, v );
+		float* o = out[i].pos;
+		_mm_storeu_ps( o, px );
+		_mm_storeu_ps( o + 4, ny );
+		_mm_storeu_ps( o + 8, py );
+		_mm_storeu_ps( o + 12, nz );
+		_mm_storeu_ps( o + 16, pz );
+		_mm_storeu_ps( o + 20, u );
+		_mm_storeu_ps( o + 24, nx );
+		_mm_storeu_ps( o + 28, v );
+	}
+	DecodeVerticesScalar( in + i, count - i, box, out + i );
+}
+#else
+void DecodeVertices( const PackedVertex* in, int count, const QuantBox& box, FloatVertex* out )
+{
+	DecodeVerticesScalar( in, count, box, out );
+}
+#endif
+
+//--------------------------------------------------------------------------------------
+// Error
+//--------------------------------------------------------------------------------------
+QuantError MeasureQuantError( const FloatVertex* original, const PackedVertex* packed, int count, const QuantBox& box )
+{
+	QuantError error = { 0.0, 0.0, 0.0, 0.0, 0.0 };
+	error.positionBound = 0.5 * sqrt( ( double )box.scale[0] * box.scale[0] + ( double )box.scale[1] * box.scale[1] +
+									  ( double )box.scale[2] * box.scale[2] );
+	float maxUV = 0.0f;
+	vector<FloatVertex> decoded( count );
+	DecodeVerticesScalar( packed, count, box, decoded.data() );
+	for( int i = 0; i < count; ++i )
+	{
+		const FloatVertex& a = original[i];
+		const FloatVertex& b = decoded[i];
+		double dx = a.pos[0] - b.pos[0], dy = a.pos[1] - b.pos[1], dz = a.pos[2] - b.pos[2];
+		error.maxPosition = max( error.maxPosition, sqrt( dx * dx + dy * dy + dz * dz ) );
+
+		if( a.normal[0] != 0.0f || a.normal[1] != 0.0f || a.normal[2] != 0.0f )
+			error.maxNormalDegrees = max( error.maxNormalDegrees, NormalErrorDegrees( a.normal, b.normal ) );
+		for( int c = 0; c < 2; ++c )
+		{
+			error.maxUV = max( error.maxUV, ( double )fabsf( a.uv[c] - b.uv[c] ) );
+			maxUV = max( maxUV, fabsf( a.uv[c] ) );
+		}
+	}
+	// half a half ulp at the largest uv (2^-11 relative; 2^-25 absolute below 2^-14)
+	error.uvBound = max( ldexp( 1.0, ( int )floor( log2( max( maxUV, 6.1035e-5f ) ) ) - 11 ), ldexp( 1.0, -25 ) );
+	return error;
+}
+
+//--------------------------------------------------------------------------------------
+// Container
+//--------------------------------------------------------------------------------------
+bool WriteQuantizedMesh( const string& path, const QuantizedMesh& mesh, unsigned int sourceStride )
+{
+	QuantizedMeshHeader header;
+	memset( &header, 0, sizeof( header ) );
+	header.magic = QVTX_MAGIC;
+	header.version = QVTX_VERSION;
+	header.numVertices = ( unsigned int )mesh.vertices.size();
+	header.numRanges = ( unsigned int )mesh.ranges.size();
+	header.numSubsets = ( unsigned int )mesh.subsetRange.size();
+	header.stride = sizeof( PackedVertex );
+	header.sourceStride = sourceStride;
+	size_t tables = sizeof( header ) + mesh.ranges.size() * sizeof( VertexRange ) + mesh.subsetRange.size() * sizeof( unsigned int );
+	header.vertexOffset = ( unsigned int )( ( tables + 15 ) & ~( size_t )15 );
+
+	// write next to the target and rename, so a half written file is never picked up
+	string temp = path + ".tmp";
+	FILE* file = fopen( temp.c_str(), "wb" );
+	if( !file )
+		return false;
+	static const unsigned char padding[16] = { 0 };
+	bool ok = fwrite( &header, sizeof( header ), 1, file ) == 1 &&
+			  fwrite( mesh.ranges.data(), sizeof( VertexRange ), mesh.ranges.size(), file ) == mesh.ranges.size() &&
+			  fwrite( mesh.subsetRange.data(), sizeof( unsigned int ), mesh.subsetRange.size(), file ) == mesh.subsetRange.size() &&
+			  fwrite( padding, 1, header.vertexOffset - tables, file ) == header.vertexOffset - tables &&
+			  fwrite( mesh.vertices.data(), sizeof( PackedVertex ), mesh.vertices.size(), file ) == mesh.vertices.size();
+	ok = fclose( file ) == 0 && ok;
+	remove( path.c_str() );
+	if( !ok || rename( temp.c_str(), path.c_str() ) != 0 )
+	{
+		remove( temp.c_str() );
+		return false;
+	}
+	return true;
+}
+
+bool ParseQuantizedMesh( const unsigned char* data, size_t size, QuantizedMeshView& view )
+{
+	if( !data || size < sizeof( QuantizedMeshHeader ) )
+		return false;
+	const QuantizedMeshHeader* header = ( const QuantizedMeshHeader* )data;
+	if( header->magic != QVTX_MAGIC || header->version != QVTX_VERSION || header->stride != sizeof( PackedVertex ) ||
+		header->vertexOffset % 16 )
+		return false;
+	size_t tables = sizeof( QuantizedMeshHeader ) + ( size_t )header->numRanges * sizeof( VertexRange ) +
+					( size_t )header->numSubsets * sizeof( unsigned int );
+	if( tables > header->vertexOffset || header->vertexOffset + ( size_t )header->numVertices * sizeof( PackedVertex ) > size )
+		return false;
+	view.header = header;
+	view.ranges = ( const VertexRange* )( data + sizeof( QuantizedMeshHeader ) );
+	view.subsetRange = ( const unsigned int* )( view.ranges + header->numRanges );
+	view.vertices = ( const PackedVertex* )( data + header->vertexOffset );
+	for( unsigned int i = 0; i < header->numSubsets; ++i )
+		if( view.subsetRange[i] >= header->numRanges )
+			return false;
+	for( unsigned int i = 0; i < header->numRanges; ++i )
+		if( ( size_t )view.ranges[i].first + view.ranges[i].count > header->numVertices )
+			return false;
+	return true;
+}
@@ -0,0 +1,135 @@
+//--------------------------------------------------------------------------------------
+// File: VertexQuantize.h
+//
+// Compressed vertex format for the G-buffer pass: 16 bytes instead of the 32 of VPNS.
+// -position: 3 x 16-bit unorm within the bounding box of its vertex range, the box is
+//  handed to the shader per subset (R16G16B16A16_UNORM, w unused)
+// -normal: octahedral, 2 x 16-bit snorm (R16G16_SNORM)
+// -texcoord: 2 x half (R16G16_FLOAT)
+// DXGI has no three-channel 16-bit format, so 16 bytes is as small as it gets without
+// dropping position precision to 10 bits.
+// The .qvtx container holds the boxes and the packed vertices of one vertex buffer,
+// in its original order, so the index buffer and draw calls stay as they are.
+//--------------------------------------------------------------------------------------
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Same layout as VPNS (and the decoded output)
+struct FloatVertex
+{
+	float			pos[3];
+	float			normal[3];
+	float			uv[2];
+};
+
+struct PackedVertex
+{
+	unsigned short	pos[4];			// unorm, within the box; pos[3] = 0
+	short			normal[2];		// snorm, octahedral
+	unsigned short	uv[2];			// half
+};
+
+static_assert( sizeof( FloatVertex ) == 32, "FloatVertex must match VPNS" );
+static_assert( sizeof( PackedVertex ) == 16, "PackedVertex must match the input layout" );
+
+// position = offset + unorm16 * scale (scale = box extent / 65535)
+struct QuantBox
+{
+	float			offset[3];
+	float			scale[3];
+};
+
+// Vertices quantized against the same box
+struct VertexRange
+{
+	unsigned int	first, count;
+	QuantBox		box;
+};
+
+// A subset's vertices, as the draw call sees them
+struct VertexSpan
+{
+	unsigned int	first, count;
+};
+
+struct QuantizedMesh
+{
+	std::vector<VertexRange>	ranges;			// cover every vertex exactly once
+	std::vector<unsigned int>	subsetRange;	// range (box) of every subset
+	std::vector<PackedVertex>	vertices;
+};
+
+//--------------------------------------------------------------------------------------
+// Encoding and decoding
+//--------------------------------------------------------------------------------------
+
+// Smallest box around count vertices
+QuantBox MakeQuantBox( const FloatVertex* vertices, int count );
+
+// Every subset gets the box of its vertices; subsets whose vertices overlap share one.
+// Vertices no subset uses get ranges of their own.
+void QuantizeMesh( const FloatVertex* vertices, int numVertices, const std::vector<VertexSpan>& subsets,
+				   QuantizedMesh& out );
+
+void QuantizeVertices( const FloatVertex* in, int count, const QuantBox& box, PackedVertex* out );
+
+// 4 vertices at a time with SSE2 (scalar on the other SimdMath backends); same results
+// as DecodeVerticesScalar
+void DecodeVertices( const PackedVertex* in, int count, const QuantBox& box, FloatVertex* out );
+void DecodeVerticesScalar( const PackedVertex* in, int count, const QuantBox& box, FloatVertex* out );
+
+// Octahedral unit vector <-> 2 x snorm16. The encoder picks the rounding that decodes
+// closest to n (n need not be normalized).
+void OctEncode( const float n[3], short out[2] );
+void OctDecode( const short e[2], float n[3] );
+
+// Angle between n (any length) and its decoded direction
+double NormalErrorDegrees( const float n[3], const float decoded[3] );
+
+// IEEE half, round to nearest even
+unsigned short FloatToHalf( float f );
+float HalfToFloat( unsigned short h );
+
+// Worst error of count vertices against the originals; the bounds follow from the
+// format (positions: half a step of the box; uvs: half an ulp of the largest uv)
+struct QuantError
+{
+	double			maxPosition;		// object space distance
+	double			positionBound;
+	double			maxNormalDegrees;
+	double			maxUV;
+	double			uvBound;
+};
+QuantError MeasureQuantError( const FloatVertex* original, const PackedVertex* packed, int count, const QuantBox& box );
+
+//--------------------------------------------------------------------------------------
+// The .qvtx container
+//--------------------------------------------------------------------------------------
+#define QVTX_MAGIC 0x58545651			// "QVTX"
+#define QVTX_VERSION 1
+
+struct QuantizedMeshHeader
+{
+	unsigned int		magic;
+	unsigned int		version;
+	unsigned int		numVertices;
+	unsigned int		numRanges;
+	unsigned int		numSubsets;
+	unsigned int		stride;				// sizeof( PackedVertex )
+	unsigned int		sourceStride;		// of the vertex buffer it was made from
+	unsigned int		vertexOffset;		// from the start of the file, 16-byte aligned
+};
+
+// A parsed container; the pointers point into the (mapped) file
+struct QuantizedMeshView
+{
+	const QuantizedMeshHeader*	header;
+	const VertexRange*			ranges;
+	const unsigned int*			subsetRange;
+	const PackedVertex*			vertices;
+};
+
+bool WriteQuantizedMesh( const std::string& path, const QuantizedMesh& mesh, unsigned int sourceStride );
+bool ParseQuantizedMesh( const unsigned char* data, size_t size, QuantizedMeshView& view );
@@ -0,0 +1,148 @@
+//--------------------------------------------------------------------------------------
+// File: AOBench.cpp
+//
+// Times the CPU ports of the ambient occlusion techniques on a synthetic G-buffer.
+// Usage: AOBench [width height [threads [runs]]]
+//
+// Besides the time, every technique reports its noise: the RMS difference between
+// its result and a 3x3 box filtered copy of it. Noisier kernels need wider blurs.
+//--------------------------------------------------------------------------------------
+#include "../Portable/CpuPasses.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+using namespace std;
+
+// the horizon-based AO presets of the sample UI (directions x steps)
+static const int horizonPresets[][2] = { { 4, 3 }, { 6, 4 }, { 8, 6 } };
+
+static double Noise( const CpuGBuffer& gbuffer, const vector<float>& ao )
+{
+	const int w = gbuffer.width;
+	const int h = gbuffer.height;
+	double sumSq = 0.0;
+	int count = 0;
+	for( int y = 1; y < h - 1; ++y )
+	{
+		for( int x = 1; x < w - 1; ++x )
+		{
+			if( gbuffer.viewZ[y * w + x] == 0.0f )
+				continue;
+			float box = 0.0f;
+			for( int j = -1; j <= 1; ++j )
+				for( int i = -1; i <= 1; ++i )
+					box += ao[( y + j ) * w + x + i];
+			double d = ao[y * w + x] - box / 9.0f;
+			sumSq += d * d;
+			++count;
+		}
+	}
+	return count ? sqrt( sumSq / count ) : 0.0;
+}
+
+static void Report( const char* name, double ms, int width, int height, double noise )
+{
+	printf( "%-30s %10.2f %10.1f %10.4f\n", name, ms, width * height / ( ms * 1000.0 ), noise );
+}
+
+static double Milliseconds( const chrono::high_resolution_clock::time_point& start )
+{
+	return chrono::duration<double, milli>( chrono::high_resolution_clock::now() - start ).count();
+}
+
+int main( int argc, char* argv[] )
+{
+	int width = 2048;		// 1024x768 * TEXSCALE
+	int height = 1536;
+	int threads = ( int )thread::hardware_concurrency();
+	int runs = 5;
+	if( argc >= 3 )
+	{
+		width = atoi( argv[1] );
+		height = atoi( argv[2] );
+	}
+	if( argc >= 4 )
+		threads = atoi( argv[3] );
+	if( argc >= 5 )
+		runs = atoi( argv[4] );
+	if( width <= 0 || height <= 0 || runs <= 0 )
+	{
+		fprintf( stderr, "usage: AOBench [width height [threads [runs]]]\n" );
+		return 1;
+	}
+
+	CpuGBuffer gbuffer;
+	MakeTestGBuffer( gbuffer, width, height );
+
+	CpuFloat2 rotations[CPU_NUMLAYERS];
+	MakeRotationTable( rotations, 1 );
+
+	CpuAOParams params;
+	vector<float> reference, deinterleaved, deinterleaved1;
+	vector<float> horizon[sizeof( horizonPresets ) / sizeof( horizonPresets[0] )];
+	double horizonMs[sizeof( horizonPresets ) / sizeof( horizonPresets[0] )];
+	const int numPresets = sizeof( horizonPresets ) / sizeof( horizonPresets[0] );
+	CpuAOLayers layers;
+
+	// best of n runs for every variant
+	double bestReference = 1e30;
+	CpuAOTimings best1 = { 1e30, 1e30, 1e30 }, bestN = { 1e30, 1e30, 1e30 };
+	for( int i = 0; i < numPresets; ++i )
+		horizonMs[i] = 1e30;
+
+	for( int run = 0; run < runs; ++run )
+	{
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		ComputeAO( gbuffer, params, rotations, reference );
+		bestReference = min( bestReference, Milliseconds( start ) );
+
+		CpuAOTimings t;
+		ComputeAODeinterleaved( gbuffer, params, rotations, layers, deinterleaved1, 1, &t );
+		if( t.deinterleave + t.layers + t.reinterleave < best1.deinterleave + best1.layers + best1.reinterleave )
+			best1 = t;
+
+		ComputeAODeinterleaved( gbuffer, params, rotations, layers, deinterleaved, threads, &t );
+		if( t.deinterleave + t.layers + t.reinterleave < bestN.deinterleave + bestN.layers + bestN.reinterleave )
+			bestN = t;
+
+		for( int i = 0; i < numPresets; ++i )
+		{
+			start = chrono::high_resolution_clock::now();
+			ComputeAOHorizon( gbuffer, params, rotations, horizonPresets[i][0], horizonPresets[i][1], horizon[i] );
+			horizonMs[i] = min( horizonMs[i], Milliseconds( start ) );
+		}
+	}
+
+	printf( "AO %dx%d, best of %d runs\n\n", width, height, runs );
+
+	// per pass timings of the deinterleaved version
+	printf( "%-30s %10s %10s %10s %10s\n", "deinterleaved AO", "split ms", "ao ms", "merge ms", "total ms" );
+	printf( "%-30s %10.2f %10.2f %10.2f %10.2f\n", "1 thread",
+			best1.deinterleave, best1.layers, best1.reinterleave, best1.deinterleave + best1.layers + best1.reinterleave );
+	char label[64];
+	if( threads > 1 )
+	{
+		sprintf( label, "%d threads", threads );
+		printf( "%-30s %10.2f %10.2f %10.2f %10.2f\n", label,
+				bestN.deinterleave, bestN.layers, bestN.reinterleave, bestN.deinterleave + bestN.layers + bestN.reinterleave );
+	}
+	printf( "\n" );
+
+	// cost and noise of every kernel
+	printf( "%-30s %10s %10s %10s\n", "kernel", "ms", "MPix/s", "noise" );
+	sprintf( label, "PSAO (%d taps)", params.iterations * 4 );
+	Report( label, bestReference, width, height, Noise( gbuffer, reference ) );
+	sprintf( label, "PSAO deinterleaved (%d taps)", params.iterations * 4 );
+	Report( label, bestN.deinterleave + bestN.layers + bestN.reinterleave, width, height, Noise( gbuffer, deinterleaved ) );
+	for( int i = 0; i < numPresets; ++i )
+	{
+		sprintf( label, "HBAO %dx%d (%d taps)", horizonPresets[i][0], horizonPresets[i][1],
+				 horizonPresets[i][0] * horizonPresets[i][1] );
+		Report( label, horizonMs[i], width, height, Noise( gbuffer, horizon[i] ) );
+	}
+	return 0;
+}
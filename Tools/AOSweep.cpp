@@ -0,0 +1,255 @@
+//--------------------------------------------------------------------------------------
+// File: AOSweep.cpp
+//
+// Sweeps the PSAO parameters (see Portable/AOSweep.h) over a grid on the JobSystem and
+// prints the Pareto front of time against error to the ground truth, and where the
+// shader's own settings (4 iterations, one-texel blur) fall. Lists are comma separated;
+// a parameter not given keeps the default grid. The G-buffer is the synthetic one of
+// the tools, or a mesh seen from the sample's starting camera.
+// Usage: AOSweep [width height] [-mesh m.sdkmesh] [-radius 40] [-scale 2,4,8] [-intensity 1,2,3]
+//                [-bias 0,0.05] [-iterations 1,2,4,8] [-blur 0,1,2] [-truth directions radii]
+//                [-runs n] [-workers n] [-ssim] [-csv results.csv]
+//--------------------------------------------------------------------------------------
+#include "../Portable/AOSweep.h"
+#include "../Portable/BatchRender.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+typedef chrono::high_resolution_clock Clock;
+
+static int failures = 0;
+
+static double Milliseconds( const Clock::time_point& start )
+{
+	return chrono::duration<double, milli>( Clock::now() - start ).count();
+}
+
+static void Check( bool ok, const char* what )
+{
+	printf( "%-56s %s\n", what, ok ? "ok" : "FAILED" );
+	if( !ok )
+		++failures;
+}
+
+static void PrintHeader()
+{
+	printf( "%8s %7s %9s %6s %5s %5s %10s %8s %8s\n", "radius", "scale", "intensity", "bias", "iter", "blur", "ms",
+			"RMSE", "SSIM" );
+}
+
+static void PrintResult( const AOSweepResult& result )
+{
+	const CpuAOParams& p = result.config.params;
+	printf( "%8.1f %7.2f %9.2f %6.3f %5d %5d %10.2f %8.4f %8.4f\n", p.radius, p.scale, p.intensity, p.bias, p.iterations,
+			result.config.blur, result.ms, result.rmse, result.ssim );
+}
+
+static bool WriteCsv( const char* path, const vector<AOSweepResult>& results )
+{
+	FILE* file = fopen( path, "w" );
+	if( !file )
+		return false;
+	fprintf( file, "radius,scale,intensity,bias,iterations,blur,ms,rmse,ssim,front\n" );
+	for( size_t i = 0; i < results.size(); ++i )
+	{
+		const AOSweepResult& r = results[i];
+		const CpuAOParams& p = r.config.params;
+		fprintf( file, "%g,%g,%g,%g,%d,%d,%.4f,%.6f,%.6f,%d\n", p.radius, p.scale, p.intensity, p.bias, p.iterations,
+				 r.config.blur, r.ms, r.rmse, r.ssim, r.front ? 1 : 0 );
+	}
+	return fclose( file ) == 0;
+}
+
+//--------------------------------------------------------------------------------------
+// Checks, on a small G-buffer
+//--------------------------------------------------------------------------------------
+static void RunChecks( JobSystem& jobs )
+{
+	CpuGBuffer gbuffer;
+	MakeTestGBuffer( gbuffer, 128, 96 );
+	CpuAOParams params;
+	vector<float> truth, finer;
+	ComputeAOGroundTruth( jobs, gbuffer, params, 32, 16, truth );
+	ComputeAOGroundTruth( jobs, gbuffer, params, 64, 32, finer );
+
+	double rmse, ssim;
+	CompareAO( gbuffer, truth, truth, rmse, ssim );
+	Check( rmse == 0.0 && fabs( ssim - 1.0 ) < 1e-9, "metrics: the truth against itself" );
+	CompareAO( gbuffer, truth, finer, rmse, ssim );
+	printf( "ground truth 512 against 2048 taps: RMSE %.4f, SSIM %.4f\n", rmse, ssim );
+	Check( rmse < 0.01 && ssim > 0.98, "ground truth: converged" );
+	double darker;
+	vector<float> shifted( truth );
+	for( size_t i = 0; i < shifted.size(); ++i )
+		shifted[i] -= 0.1f;
+	CompareAO( gbuffer, shifted, truth, darker, ssim );
+	Check( fabs( darker - 0.1 ) < 1e-4 && ssim < 1.0, "metrics: a darker copy" );
+
+	vector<AOSweepConfig> configs( 2 );
+	configs[0].params.iterations = 1;
+	configs[1].params.iterations = 8;
+	configs[0].blur = configs[1].blur = 0;
+	vector<AOSweepResult> results;
+	RunAOSweep( jobs, gbuffer, truth, configs, 1, results );
+	Check( results[1].rmse < results[0].rmse && results[1].ssim > results[0].ssim,
+		   "more iterations get closer to the truth" );
+
+	// a made-up set: the front is what nothing beats on both counts
+	results.resize( 5 );
+	const double points[5][2] = { { 1.0, 0.5 }, { 2.0, 0.3 }, { 2.5, 0.4 }, { 3.0, 0.1 }, { 1.5, 0.6 } };
+	for( int i = 0; i < 5; ++i )
+	{
+		results[i].ms = points[i][0];
+		results[i].rmse = points[i][1];
+	}
+	vector<AOSweepResult> front = MarkParetoFront( results, false );
+	Check( front.size() == 3 && results[0].front && results[1].front && !results[2].front && results[3].front &&
+		   !results[4].front && front[0].ms == 1.0 && front[2].ms == 3.0, "Pareto front" );
+}
+
+//--------------------------------------------------------------------------------------
+// Sweep
+//--------------------------------------------------------------------------------------
+static int Usage()
+{
+	fprintf( stderr, "usage: AOSweep [width height] [-mesh m.sdkmesh] [-radius 40] [-scale 2,4,8] [-intensity 1,2,3]\n"
+					 "               [-bias 0,0.05] [-iterations 1,2,4,8] [-blur 0,1,2] [-truth directions radii]\n"
+					 "               [-runs n] [-workers n] [-ssim] [-csv results.csv]\n" );
+	return 1;
+}
+
+int main( int argc, char* argv[] )
+{
+	int width = 512, height = 384;
+	int truthDirections = 32, truthRadii = 16;
+	int runs = 3, workers = 0;
+	bool bySsim = false;
+	const char* meshPath = NULL;
+	const char* csvPath = NULL;
+	AOSweepGrid grid;
+	int arg = 1;
+	if( argc >= 3 && argv[1][0] != '-' )
+	{
+		width = atoi( argv[1] );
+		height = atoi( argv[2] );
+		arg = 3;
+	}
+	for( ; arg < argc; ++arg )
+	{
+		bool hasValue = arg + 1 < argc;
+		bool ok = true;
+		if( !strcmp( argv[arg], "-ssim" ) )
+			bySsim = true;
+		else if( !hasValue )
+			ok = false;
+		else if( !strcmp( argv[arg], "-mesh" ) )
+			meshPath = argv[++arg];
+		else if( !strcmp( argv[arg], "-csv" ) )
+			csvPath = argv[++arg];
+		else if( !strcmp( argv[arg], "-runs" ) )
+			runs = atoi( argv[++arg] );
+		else if( !strcmp( argv[arg], "-workers" ) )
+			workers = atoi( argv[++arg] );
+		else if( !strcmp( argv[arg], "-radius" ) )
+			ok = ParseSweepList( argv[++arg], grid.radius );
+		else if( !strcmp( argv[arg], "-scale" ) )
+			ok = ParseSweepList( argv[++arg], grid.scale );
+		else if( !strcmp( argv[arg], "-intensity" ) )
+			ok = ParseSweepList( argv[++arg], grid.intensity );
+		else if( !strcmp( argv[arg], "-bias" ) )
+			ok = ParseSweepList( argv[++arg], grid.bias );
+		else if( !strcmp( argv[arg], "-iterations" ) )
+			ok = ParseSweepList( argv[++arg], grid.iterations ) &&
+				 find( grid.iterations.begin(), grid.iterations.end(), 0 ) == grid.iterations.end();
+		else if( !strcmp( argv[arg], "-blur" ) )
+			ok = ParseSweepList( argv[++arg], grid.blur );
+		else if( !strcmp( argv[arg], "-truth" ) && arg + 2 < argc )
+		{
+			truthDirections = atoi( argv[++arg] );
+			truthRadii = atoi( argv[++arg] );
+		}
+		else
+			ok = false;
+		if( !ok )
+			return Usage();
+	}
+	if( width <= 0 || height <= 0 || truthDirections <= 0 || truthRadii <= 0 || runs <= 0 )
+		return Usage();
+
+	JobSystem jobs( workers );
+	RunChecks( jobs );
+
+	CpuGBuffer gbuffer;
+	if( meshPath )
+	{
+		CpuMesh mesh;
+		string error;
+		if( !LoadCpuMesh( meshPath, mesh, &error ) )
+		{
+			fprintf( stderr, "%s\n", error.c_str() );
+			return 1;
+		}
+		vector<BatchView> views;
+		ParseBatch( "size " + to_string( width ) + " " + to_string( height ) + "\ncamera 0 0 -800 0 0 0\n", views );
+		CpuRasterScratch scratch;
+		RenderGBuffer( mesh, MakeBatchCamera( views[0] ), width, height, scratch, gbuffer );
+	}
+	else
+		MakeTestGBuffer( gbuffer, width, height );
+
+	Clock::time_point start = Clock::now();
+	vector<float> truth;
+	ComputeAOGroundTruth( jobs, gbuffer, CpuAOParams(), truthDirections, truthRadii, truth );
+	printf( "\n%dx%d %s, ground truth of %d taps a pixel in %.0f ms\n", width, height, meshPath ? meshPath : "test G-buffer",
+			truthDirections * truthRadii, Milliseconds( start ) );
+
+	vector<AOSweepConfig> configs;
+	grid.Expand( configs );
+	// the shader's own settings go in too, to place them against the front
+	AOSweepConfig shader;
+	shader.blur = max( 1, ( height + 384 ) / 768 );
+	configs.push_back( shader );
+	start = Clock::now();
+	vector<AOSweepResult> results;
+	RunAOSweep( jobs, gbuffer, truth, configs, runs, results );
+	printf( "%u configurations in %.0f ms on %d workers\n\n", ( unsigned int )configs.size(), Milliseconds( start ),
+			jobs.NumWorkers() );
+
+	// the parallel times carry the contention of the other workers: time the front alone
+	vector<AOSweepResult> front = MarkParetoFront( results, bySsim );
+	if( jobs.NumWorkers() > 1 )
+	{
+		for( size_t i = 0; i < results.size(); ++i )
+			if( results[i].front )
+				results[i].ms = TimeAOConfig( gbuffer, results[i].config, max( runs, 3 ) );
+		front = MarkParetoFront( results, bySsim );
+	}
+	printf( "Pareto front, time against %s:\n", bySsim ? "1 - SSIM" : "RMSE" );
+	PrintHeader();
+	for( size_t i = 0; i < front.size(); ++i )
+		PrintResult( front[i] );
+
+	const AOSweepResult& own = results.back();
+	unsigned int better = 0;
+	for( size_t i = 0; i < results.size(); ++i )
+		better += results[i].ms <= own.ms && ( bySsim ? results[i].ssim > own.ssim : results[i].rmse < own.rmse );
+	printf( "\nshader settings (%d iterations, blur %d):\n", own.config.params.iterations, own.config.blur );
+	PrintHeader();
+	PrintResult( own );
+	printf( "%s; %u configurations are as fast and closer to the truth\n\n", own.front ? "on the front" : "not on the front",
+			better );
+
+	if( csvPath && !WriteCsv( csvPath, results ) )
+	{
+		fprintf( stderr, "can't write %s\n", csvPath );
+		return 1;
+	}
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,440 @@
+//--------------------------------------------------------------------------------------
+// File: ArenaBench.cpp
+//
+// Runs a CPU frame (culling, draw packets, tile light bins, AO, composite) through the
+// frame pipeline with its transient data in FrameArenas, and counts every operator new
+// the steady-state frames make: there must be none. Also checks the overflow to the
+// fallback allocator and times arena allocation against new/delete.
+// Usage: ArenaBench [workers [frames [arena KB]]]
+//--------------------------------------------------------------------------------------
+#include "../Portable/CpuPasses.h"
+#include "../Portable/FrameArena.h"
+#include "../Portable/JobSystem.h"
+#include "../Portable/SimdMath.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+typedef chrono::high_resolution_clock Clock;
+
+//--------------------------------------------------------------------------------------
+// Every general-heap allocation of the process goes through here
+//--------------------------------------------------------------------------------------
+static atomic<unsigned long long> heapAllocations( 0 );
+
+static void* CountedAllocate( size_t size )
+{
+	++heapAllocations;
+	void* p = malloc( size ? size : 1 );
+	if( !p )
+		throw bad_alloc();
+	return p;
+}
+
+void* operator new( size_t size )
+{
+	return CountedAllocate( size );
+}
+
+void* operator new[]( size_t size )
+{
+	return CountedAllocate( size );
+}
+
+void operator delete( void* p ) noexcept
+{
+	free( p );
+}
+
+void operator delete[]( void* p ) noexcept
+{
+	free( p );
+}
+
+void operator delete( void* p, size_t ) noexcept
+{
+	free( p );
+}
+
+void operator delete[]( void* p, size_t ) noexcept
+{
+	free( p );
+}
+
+static int failures = 0;
+
+static double Milliseconds( const Clock::time_point& start )
+{
+	return chrono::duration<double, milli>( Clock::now() - start ).count();
+}
+
+static void Check( bool ok, const char* what )
+{
+	printf( "%-56s %s\n", what, ok ? "ok" : "FAILED" );
+	if( !ok )
+		++failures;
+}
+
+// Counts what the overflow takes and gives back
+class CountingFallback : public ArenaFallback
+{
+public:
+	CountingFallback() : allocated( 0 ), freed( 0 ) {}
+	virtual void* Allocate( size_t bytes, size_t alignment )
+	{
+		++allocated;
+		return HeapFallback().Allocate( bytes, alignment );
+	}
+	virtual void Free( void* p )
+	{
+		++freed;
+		HeapFallback().Free( p );
+	}
+	atomic<int> allocated, freed;
+};
+
+//--------------------------------------------------------------------------------------
+// The frame
+//--------------------------------------------------------------------------------------
+#define WIDTH 256
+#define HEIGHT 192
+#define TILE 16
+#define NUM_OBJECTS 20000
+#define CULL_CHUNK 512
+#define NUM_CHUNKS ( ( NUM_OBJECTS + CULL_CHUNK - 1 ) / CULL_CHUNK )
+#define NUM_LIGHTS 64
+
+struct DrawPacket
+{
+	unsigned long long	key;		// sorted on: depth bucket, then object
+	unsigned int		object;
+};
+
+struct CullOutput
+{
+	unsigned int*	visible;		// in the worker's frame arena
+	int				count;
+};
+
+struct Frame
+{
+	JobSystem*			jobs;
+	FrameArenas*		arenas;
+	unsigned int		index;
+	Mat4				viewProjection;
+	CullOutput			chunks[NUM_CHUNKS];
+	DrawPacket*			packets;
+	int					numPackets;
+	unsigned short*		tileLights;		// light indices of every tile, tileStart[t] .. tileStart[t + 1]
+	int*				tileStart;
+	CpuGBuffer			gbuffer;
+	CpuAOLayers			layers;
+	vector<float>		ao;
+	vector<CpuFloat4>	out;
+};
+
+static vector<Vec3> objectCenters;
+static vector<Vec3> lightCenters;
+static CpuFloat2 rotations[CPU_NUMLAYERS];
+
+static LinearArena& Arena( Frame& frame )
+{
+	return frame.arenas->Get( frame.index, frame.jobs->CurrentWorker() );
+}
+
+static void CullChunks( void* data, int begin, int end )
+{
+	Frame& frame = *( Frame* )data;
+	for( int chunk = begin; chunk < end; ++chunk )
+	{
+		int first = chunk * CULL_CHUNK;
+		int count = min( CULL_CHUNK, NUM_OBJECTS - first );
+		LinearArena& arena = Arena( frame );
+		Vec4* clip = arena.Allocate<Vec4>( count );
+		TransformPoints( frame.viewProjection, &objectCenters[first], clip, count );
+
+		CullOutput& output = frame.chunks[chunk];
+		output.visible = arena.Allocate<unsigned int>( count );
+		output.count = 0;
+		for( int i = 0; i < count; ++i )
+			if( clip[i].w > 0.0f && fabsf( clip[i].x ) <= clip[i].w && fabsf( clip[i].y ) <= clip[i].w )
+				output.visible[output.count++] = first + i;
+	}
+}
+
+static void AOLayers( void* data, int begin, int end )
+{
+	Frame& frame = *( Frame* )data;
+	for( int layer = begin; layer < end; ++layer )
+		ComputeAOLayer( frame.gbuffer, CpuAOParams(), rotations, frame.layers, layer );
+}
+
+static void CompositeBands( void* data, int begin, int end )
+{
+	Frame& frame = *( Frame* )data;
+	const CpuFloat3 lightPos = { 0.0f, -3.0f, -4.0f };
+	SelectComposite( VIEW_COMPOSITE, true )( frame.gbuffer, frame.ao, lightPos, begin, end, frame.out );
+}
+
+static bool PacketOrder( const DrawPacket& a, const DrawPacket& b )
+{
+	return a.key < b.key;
+}
+
+// G-buffer and culling
+static void CullStage( JobSystem& jobs, void* data, unsigned int index )
+{
+	Frame& frame = *( Frame* )data;
+	frame.index = index;
+	Mat4 view = Mat4LookAtLH( MakeVec3( sinf( index * 0.01f ) * 800.0f, 0.0f, -800.0f ), MakeVec3( 0, 0, 0 ), MakeVec3( 0, 1, 0 ) );
+	frame.viewProjection = view * Mat4PerspectiveFovLH( 3.14159f / 4.0f, ( float )WIDTH / HEIGHT, 2.0f, 4000.0f );
+
+	JobCounter counter;
+	jobs.ParallelFor( 0, NUM_CHUNKS, 4, CullChunks, &frame, &counter );
+	MakeTestGBuffer( frame.gbuffer, WIDTH, HEIGHT );
+	jobs.Wait( counter );
+}
+
+// draw packets, light bins and AO
+static void BinStage( JobSystem& jobs, void* data, unsigned int )
+{
+	Frame& frame = *( Frame* )data;
+	LinearArena& arena = Arena( frame );
+
+	frame.numPackets = 0;
+	for( int chunk = 0; chunk < NUM_CHUNKS; ++chunk )
+		frame.numPackets += frame.chunks[chunk].count;
+	frame.packets = arena.Allocate<DrawPacket>( frame.numPackets );
+	int packet = 0;
+	for( int chunk = 0; chunk < NUM_CHUNKS; ++chunk )
+		for( int i = 0; i < frame.chunks[chunk].count; ++i )
+		{
+			unsigned int object = frame.chunks[chunk].visible[i];
+			Vec4 clip = Vec4Transform( MakeVec4( objectCenters[object], 1.0f ), frame.viewProjection );
+			frame.packets[packet].key = ( ( unsigned long long )( clip.w * 16.0f ) << 32 ) | object;
+			frame.packets[packet++].object = object;
+		}
+	sort( frame.packets, frame.packets + frame.numPackets, PacketOrder );
+
+	// lights into screen tiles: count, prefix sum, fill
+	const int tilesX = WIDTH / TILE, tilesY = HEIGHT / TILE, numTiles = tilesX * tilesY;
+	int* rect = arena.Allocate<int>( NUM_LIGHTS * 4 );
+	frame.tileStart = arena.Allocate<int>( numTiles + 1 );
+	fill( frame.tileStart, frame.tileStart + numTiles + 1, 0 );
+	for( int light = 0; light < NUM_LIGHTS; ++light )
+	{
+		Vec3 p = Vec3TransformCoord( lightCenters[light], frame.viewProjection );
+		int cx = ( int )( ( p.x * 0.5f + 0.5f ) * tilesX ), cy = ( int )( ( p.y * 0.5f + 0.5f ) * tilesY );
+		rect[light * 4 + 0] = max( cx - 1, 0 );
+		rect[light * 4 + 1] = max( cy - 1, 0 );
+		rect[light * 4 + 2] = min( cx + 1, tilesX - 1 );
+		rect[light * 4 + 3] = min( cy + 1, tilesY - 1 );
+		for( int ty = rect[light * 4 + 1]; ty <= rect[light * 4 + 3]; ++ty )
+			for( int tx = rect[light * 4 + 0]; tx <= rect[light * 4 + 2]; ++tx )
+				++frame.tileStart[ty * tilesX + tx + 1];
+	}
+	for( int tile = 0; tile < numTiles; ++tile )
+		frame.tileStart[tile + 1] += frame.tileStart[tile];
+	frame.tileLights = arena.Allocate<unsigned short>( frame.tileStart[numTiles] );
+	int* cursor = arena.Allocate<int>( numTiles );
+	copy( frame.tileStart, frame.tileStart + numTiles, cursor );
+	for( int light = 0; light < NUM_LIGHTS; ++light )
+		for( int ty = rect[light * 4 + 1]; ty <= rect[light * 4 + 3]; ++ty )
+			for( int tx = rect[light * 4 + 0]; tx <= rect[light * 4 + 2]; ++tx )
+				frame.tileLights[cursor[ty * tilesX + tx]++] = ( unsigned short )light;
+
+	DeinterleaveGBuffer( frame.gbuffer, frame.layers );
+	JobCounter counter;
+	jobs.ParallelFor( 0, CPU_NUMLAYERS, 1, AOLayers, &frame, &counter );
+	jobs.Wait( counter );
+	ReinterleaveAO( frame.gbuffer, frame.layers, frame.ao );
+}
+
+static void CompositeStage( JobSystem& jobs, void* data, unsigned int )
+{
+	Frame& frame = *( Frame* )data;
+	frame.out.resize( WIDTH * HEIGHT );
+	JobCounter counter;
+	jobs.ParallelFor( 0, HEIGHT, 16, CompositeBands, &frame, &counter );
+	jobs.Wait( counter );
+}
+
+//--------------------------------------------------------------------------------------
+// Allocation timing
+//--------------------------------------------------------------------------------------
+struct AllocationTest
+{
+	FrameArenas*		arenas;
+	JobSystem*			jobs;
+	bool				useArena;
+	unsigned int		frame;
+	vector<char*>		pointers;		// new / delete: freed when the frame is done
+	atomic<unsigned long long>	checksum;
+};
+
+static void AllocateMany( void* data, int begin, int end )
+{
+	AllocationTest& test = *( AllocationTest* )data;
+	unsigned long long sum = 0;
+	for( int i = begin; i < end; ++i )
+	{
+		size_t bytes = 16 + ( i & 15 ) * 16;
+		if( test.useArena )
+		{
+			char* p = ( char* )test.arenas->Get( test.frame, test.jobs->CurrentWorker() ).Allocate( bytes );
+			p[0] = ( char )i;
+			sum += p[0];
+		}
+		else
+		{
+			char* p = new char[bytes];
+			p[0] = ( char )i;
+			sum += p[0];
+			test.pointers[i] = p;
+		}
+	}
+	test.checksum += sum;
+}
+
+static void FreeMany( void* data, int begin, int end )
+{
+	AllocationTest& test = *( AllocationTest* )data;
+	for( int i = begin; i < end; ++i )
+		delete[] test.pointers[i];
+}
+
+int main( int argc, char* argv[] )
+{
+	int workers = max( 1, ( int )thread::hardware_concurrency() );
+	int frames = 60;
+	int arenaKB = 1024;
+	if( argc >= 2 )
+		workers = atoi( argv[1] );
+	if( argc >= 3 )
+		frames = atoi( argv[2] );
+	if( argc >= 4 )
+		arenaKB = atoi( argv[3] );
+	if( workers <= 0 || frames <= 0 || arenaKB <= 0 )
+	{
+		fprintf( stderr, "usage: ArenaBench [workers [frames [arena KB]]]\n" );
+		return 1;
+	}
+
+	// overflow and reset
+	{
+		CountingFallback fallback;
+		LinearArena arena;
+		arena.Init( 1024, &fallback );
+		void* a = arena.Allocate( 1000 );
+		void* b = arena.Allocate( 4096, 64 );
+		void* c = arena.Allocate( 100 );
+		Check( a && b && c && ( ( size_t )b & 63 ) == 0, "arena and overflow allocations, aligned" );
+		Check( arena.Overflows() == 2 && arena.Used() == 1000 + 4096 + 100, "overflow counted" );
+		arena.Reset();
+		Check( fallback.freed == fallback.allocated - 1, "reset returns the overflow to the fallback" );
+		Check( arena.HighWater() == 1000 + 4096 + 100 && arena.Used() == 0, "high-water mark survives the reset" );
+	}
+
+	// the scene
+	unsigned int state = 1;
+	for( int i = 0; i < NUM_OBJECTS; ++i )
+	{
+		state = state * 1664525u + 1013904223u;
+		float x = ( ( state >> 8 ) & 1023 ) - 512.0f;
+		state = state * 1664525u + 1013904223u;
+		float z = ( ( state >> 8 ) & 2047 ) - 512.0f;
+		objectCenters.push_back( MakeVec3( x * 2.0f, ( ( state >> 4 ) & 255 ) - 128.0f, z ) );
+	}
+	for( int i = 0; i < NUM_LIGHTS; ++i )
+		lightCenters.push_back( MakeVec3( ( i % 8 ) * 100.0f - 350.0f, -100.0f, ( i / 8 ) * 100.0f ) );
+	MakeRotationTable( rotations, 1 );
+
+	// pipelined frames: everything transient from the arenas
+	const int framesInFlight = 2;
+	JobSystem jobs( workers );
+	FrameArenas arenas( jobs.NumWorkers() + 1, framesInFlight, ( size_t )arenaKB * 1024 );
+	vector<FrameStageFunc> stages;
+	stages.push_back( CullStage );
+	stages.push_back( BinStage );
+	stages.push_back( CompositeStage );
+	vector<Frame> frameData( framesInFlight );
+	for( int i = 0; i < framesInFlight; ++i )
+	{
+		frameData[i].jobs = &jobs;
+		frameData[i].arenas = &arenas;
+	}
+
+	FramePipeline pipeline( jobs, stages, framesInFlight );
+	const int warmup = 8;
+	unsigned long long allocationsBefore = 0;
+	unsigned int overflowsBefore = 0;
+	Clock::time_point start;
+	for( int n = 0; n < warmup + frames; ++n )
+	{
+		if( n == warmup )
+		{
+			pipeline.Flush();
+			allocationsBefore = heapAllocations;
+			overflowsBefore = arenas.GetStats().overflows;
+			start = Clock::now();
+		}
+		pipeline.WaitForSlot();
+		arenas.BeginFrame( n );
+		pipeline.Submit( &frameData[n % framesInFlight] );
+	}
+	pipeline.Flush();
+	double frameMs = Milliseconds( start ) / frames;
+	unsigned long long steadyAllocations = heapAllocations - allocationsBefore;
+	FrameArenas::Stats stats = arenas.GetStats();
+
+	printf( "\n%d workers, %d frames in flight, %d KB per arena\n", workers, framesInFlight, arenaKB );
+	printf( "%-36s %12.2f\n", "ms per frame", frameMs );
+	printf( "%-36s %12llu\n", "heap allocations, steady state", steadyAllocations );
+	printf( "%-36s %12u\n", "arena overflows, steady state", stats.overflows - overflowsBefore );
+	printf( "%-36s %12.1f\n", "arena high-water mark (KB)", stats.highWater / 1024.0 );
+	printf( "%-36s %12d\n\n", "visible objects (last frame)", frameData[( warmup + frames - 1 ) % framesInFlight].numPackets );
+	Check( steadyAllocations == 0, "no heap allocations in steady-state frames" );
+	Check( stats.overflows == overflowsBefore || stats.highWater > stats.capacity, "arena overflow only past its capacity" );
+
+	// arena vs new/delete, on the job system: frames of 2048 allocations that live
+	// until the frame is done
+	const int perFrame = 2048, allocationFrames = 512;
+	double ms[2];
+	AllocationTest test;
+	test.arenas = &arenas;
+	test.jobs = &jobs;
+	test.pointers.resize( perFrame );
+	for( int useArena = 0; useArena < 2; ++useArena )
+	{
+		test.useArena = useArena != 0;
+		test.checksum = 0;
+		start = Clock::now();
+		for( int n = 0; n < allocationFrames; ++n )
+		{
+			test.frame = n;
+			if( test.useArena )
+				arenas.BeginFrame( n );
+			JobCounter counter;
+			jobs.ParallelFor( 0, perFrame, 256, AllocateMany, &test, &counter );
+			jobs.Wait( counter );
+			if( !test.useArena )
+			{
+				jobs.ParallelFor( 0, perFrame, 256, FreeMany, &test, &counter );
+				jobs.Wait( counter );
+			}
+		}
+		ms[useArena] = Milliseconds( start );
+	}
+	const int allocations = perFrame * allocationFrames;
+	printf( "%-36s %12s\n", "1M allocations of 16-256 bytes", "ns each" );
+	printf( "%-36s %12.1f\n", "new / delete", ms[0] * 1e6 / allocations );
+	printf( "%-36s %12.1f\n", "frame arena", ms[1] * 1e6 / allocations );
+	Check( arenas.GetStats().overflows == stats.overflows, "allocation frames fit the arenas" );
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,230 @@
+//--------------------------------------------------------------------------------------
+// File: AssetLoadBench.cpp
+//
+// Loads a generated stand-in for the sample's assets (a mesh naming its material
+// textures, vectors.png and the effect) one after another and through the AssetLoader,
+// and reports the time until everything is finalized.
+// Usage: AssetLoadBench [threads [textures [decode passes [directory]]]]
+//--------------------------------------------------------------------------------------
+#include "../Portable/AssetLoader.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+using namespace std;
+
+static int decodePasses = 8;				// CPU cost of a decode, passes over the bytes
+static const int effectMs = 60;			// stand-in for waiting on the effect cache
+static int failures = 0;
+
+static double Milliseconds( const chrono::high_resolution_clock::time_point& start )
+{
+	return chrono::duration<double, milli>( chrono::high_resolution_clock::now() - start ).count();
+}
+
+static void Check( bool ok, const char* what )
+{
+	printf( "%-48s %s\n", what, ok ? "ok" : "FAILED" );
+	if( !ok )
+		++failures;
+}
+
+static bool WriteFile( const string& path, const string& contents )
+{
+	FILE* file = fopen( path.c_str(), "wb" );
+	if( !file )
+		return false;
+	bool ok = fwrite( contents.data(), 1, contents.size(), file ) == contents.size();
+	return fclose( file ) == 0 && ok;
+}
+
+static bool ReadBytes( const string& path, vector<char>& bytes )
+{
+	FILE* file = fopen( path.c_str(), "rb" );
+	if( !file )
+		return false;
+	fseek( file, 0, SEEK_END );
+	bytes.resize( ftell( file ) );
+	fseek( file, 0, SEEK_SET );
+	bytes.resize( fread( bytes.data(), 1, bytes.size(), file ) );
+	fclose( file );
+	return true;
+}
+
+// A decode that costs CPU time proportional to the size
+static shared_ptr<void> Decode( const vector<char>& bytes )
+{
+	unsigned int hash = 2166136261u;
+	for( int pass = 0; pass < decodePasses; ++pass )
+		for( size_t i = 0; i < bytes.size(); ++i )
+			hash = ( hash ^ ( unsigned char )bytes[i] ) * 16777619u;
+	return shared_ptr<void>( new unsigned int( hash ) );
+}
+
+// The texture names listed at the top of a mesh file, one per line up to a blank line
+static vector<string> MaterialTextures( const vector<char>& bytes )
+{
+	vector<string> names;
+	istringstream in( string( bytes.begin(), bytes.end() ) );
+	string line;
+	while( getline( in, line ) && !line.empty() )
+		names.push_back( line );
+	return names;
+}
+
+int main( int argc, char* argv[] )
+{
+	int threads = ( int )thread::hardware_concurrency();
+	int numTextures = 6;
+	if( argc >= 2 )
+		threads = atoi( argv[1] );
+	if( argc >= 3 )
+		numTextures = atoi( argv[2] );
+	if( argc >= 4 )
+		decodePasses = atoi( argv[3] );
+	string directory = argc >= 5 ? string( argv[4] ) + "/" : string();
+	if( threads <= 0 || numTextures < 0 || decodePasses < 0 )
+	{
+		fprintf( stderr, "usage: AssetLoadBench [threads [textures [decode passes [directory]]]]\n" );
+		return 1;
+	}
+
+	// generate the assets
+	string meshText;
+	for( int i = 0; i < numTextures; ++i )
+	{
+		char name[64];
+		sprintf( name, "bench_texture%d.bin", i );
+		meshText += string( name ) + "\n";
+		if( !WriteFile( directory + name, string( ( 256 << 10 ) * ( 1 + i % 4 ), ( char )i ) ) )
+		{
+			fprintf( stderr, "can't write %s%s\n", directory.c_str(), name );
+			return 1;
+		}
+	}
+	meshText += "\n" + string( 1 << 20, 'v' );		// vertex and index data
+	if( !WriteFile( directory + "bench_mesh.bin", meshText ) ||
+		!WriteFile( directory + "bench_vectors.bin", string( 64 * 64 * 4, 'r' ) ) )
+	{
+		fprintf( stderr, "can't write to %s\n", directory.empty() ? "." : directory.c_str() );
+		return 1;
+	}
+
+	// one after another, like OnD3D10CreateDevice before
+	chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+	{
+		this_thread::sleep_for( chrono::milliseconds( effectMs ) );
+		vector<char> bytes;
+		ReadBytes( directory + "bench_mesh.bin", bytes );
+		Decode( bytes );
+		vector<string> names = MaterialTextures( bytes );
+		names.push_back( "bench_vectors.bin" );
+		for( size_t i = 0; i < names.size(); ++i )
+			if( ReadBytes( directory + names[i], bytes ) )
+				Decode( bytes );
+	}
+	double sequentialMs = Milliseconds( start );
+
+	// through the loader
+	thread::id renderThread = this_thread::get_id();
+	bool finalizedOnRenderThread = true;
+	vector<string> finalizeOrder;
+	AssetLoader::Stats stats;
+	string error;
+	bool ok;
+	{
+		AssetLoader loader( threads );
+		auto finalize = [&]( Asset& asset ) -> bool {
+			finalizedOnRenderThread = finalizedOnRenderThread && this_thread::get_id() == renderThread;
+			finalizeOrder.push_back( asset.name );
+			return true;
+		};
+		auto decode = []( Asset& asset ) -> bool {
+			asset.decoded = Decode( asset.bytes );
+			return true;
+		};
+
+		loader.Add( "effect", "", vector<AssetId>(), []( Asset& ) -> bool {
+			this_thread::sleep_for( chrono::milliseconds( effectMs ) );
+			return true;
+		}, finalize );
+		loader.Add( "vectors", directory + "bench_vectors.bin", vector<AssetId>(), decode, finalize );
+
+		// the mesh adds its textures, and the vertex buffers that need them, once it is parsed
+		loader.Add( "mesh", directory + "bench_mesh.bin", vector<AssetId>(),
+			[&]( Asset& asset ) -> bool {
+				asset.decoded = Decode( asset.bytes );
+				vector<string> names = MaterialTextures( asset.bytes );
+				vector<AssetId> needed( 1, asset.id );
+				for( size_t i = 0; i < names.size(); ++i )
+					needed.push_back( loader.Add( names[i], directory + names[i], vector<AssetId>( 1, asset.id ),
+												  decode, finalize ) );
+				loader.Add( "mesh buffers", "", needed, nullptr, finalize );
+				return true;
+			}, finalize );
+
+		ok = loader.Finalize( true );
+		stats = loader.GetStats();
+		error = loader.FirstError();
+
+		printf( "%-24s %10s %10s %10s %10s %10s\n", "asset", "read ms", "decode ms", "final ms", "loaded at", "done at" );
+		for( AssetId id = 0; id < stats.assets; ++id )
+		{
+			const Asset& asset = loader.Get( id );
+			printf( "%-24s %10.2f %10.2f %10.2f %10.2f %10.2f\n", asset.name.c_str(), asset.readMs, asset.decodeMs,
+					asset.finalizeMs, asset.loadedAt, asset.finalizedAt );
+		}
+		printf( "\n" );
+
+		// a missing file fails it and what depends on it, without hanging Finalize
+		AssetLoader broken( threads );
+		AssetId missing = broken.Add( "missing", directory + "bench_missing.bin", vector<AssetId>(), nullptr, nullptr );
+		broken.Add( "needs missing", "", vector<AssetId>( 1, missing ), nullptr, nullptr );
+		Check( !broken.Finalize( true ) && broken.GetStats().failed == 2, "missing file fails its dependents" );
+
+		// ... unless it is optional: then they go on without it, also when it fails later
+		AssetLoader optional( threads );
+		vector<AssetId> parts;
+		parts.push_back( optional.Add( "missing", directory + "bench_missing.bin", vector<AssetId>(), nullptr, nullptr, true ) );
+		parts.push_back( optional.Add( "bad decode", "", vector<AssetId>(), []( Asset& ) -> bool { return false; }, nullptr, true ) );
+		parts.push_back( optional.Add( "bad finalize", "", vector<AssetId>(), nullptr, []( Asset& ) -> bool { return false; }, true ) );
+		bool finalizedWithout = false;
+		optional.Add( "needs optional", "", parts, nullptr, [&]( Asset& ) -> bool { finalizedWithout = true; return true; } );
+		Check( optional.Finalize( true ) && optional.GetStats().failed == 3 && finalizedWithout,
+			   "optional assets don't fail their dependents" );
+	}
+
+	size_t meshAt = find( finalizeOrder.begin(), finalizeOrder.end(), string( "mesh" ) ) - finalizeOrder.begin();
+	size_t buffersAt = find( finalizeOrder.begin(), finalizeOrder.end(), string( "mesh buffers" ) ) - finalizeOrder.begin();
+	bool texturesBetween = true;
+	for( int i = 0; i < numTextures; ++i )
+	{
+		char name[64];
+		sprintf( name, "bench_texture%d.bin", i );
+		size_t at = find( finalizeOrder.begin(), finalizeOrder.end(), string( name ) ) - finalizeOrder.begin();
+		texturesBetween = texturesBetween && meshAt < at && at < buffersAt;
+	}
+	Check( ok && error.empty() && stats.assets == numTextures + 4, "all assets loaded" );
+	Check( finalizedOnRenderThread, "finalize runs on the render thread" );
+	Check( texturesBetween && buffersAt < finalizeOrder.size(), "mesh, then its textures, then its buffers" );
+
+	for( int i = 0; i < numTextures; ++i )
+	{
+		char name[64];
+		sprintf( name, "bench_texture%d.bin", i );
+		remove( ( directory + name ).c_str() );
+	}
+	remove( ( directory + "bench_mesh.bin" ).c_str() );
+	remove( ( directory + "bench_vectors.bin" ).c_str() );
+
+	printf( "\n%d assets, %d threads\n", stats.assets, threads );
+	printf( "%-32s %10.2f ms\n", "one after another", sequentialMs );
+	printf( "%-32s %10.2f ms\n", "loader, until all finalized", stats.wallMs );
+	printf( "%-32s %10.2f ms\n", "  sum of all assets", stats.sumMs );
+	printf( "%-32s %10.2f ms\n", "  slowest dependency chain", stats.criticalMs );
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,387 @@
+//--------------------------------------------------------------------------------------
+// File: BatchRender.cpp
+//
+// Renders the views of a batch file (see Portable/BatchRender.h) of an .sdkmesh on the
+// CPU, as many at a time as there are workers, and reports views per second.
+// -bench renders a synthetic scene instead: it checks the rasterizer (culling, clipping,
+// depth, coverage), the batch file parser, that parallel batches match serial ones and
+// that exported slices read back, then measures views per second against the number of
+// workers.
+// Usage: BatchRender mesh.sdkmesh batch.txt [workers]
+//        BatchRender -bench [views [width height]]
+//--------------------------------------------------------------------------------------
+#include "../Portable/BatchRender.h"
+#include "../Portable/ExrFile.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+using namespace std;
+
+typedef chrono::high_resolution_clock Clock;
+
+static int failures = 0;
+
+static double Milliseconds( const Clock::time_point& start )
+{
+	return chrono::duration<double, milli>( Clock::now() - start ).count();
+}
+
+static void Check( bool ok, const char* what )
+{
+	printf( "%-56s %s\n", what, ok ? "ok" : "FAILED" );
+	if( !ok )
+		++failures;
+}
+
+static bool ReadFileBytes( const string& path, vector<unsigned char>& bytes )
+{
+	FILE* file = fopen( path.c_str(), "rb" );
+	if( !file )
+		return false;
+	fseek( file, 0, SEEK_END );
+	bytes.resize( ( size_t )max( ftell( file ), 1L ) );
+	fseek( file, 0, SEEK_SET );
+	bool ok = fread( &bytes[0], 1, bytes.size(), file ) == bytes.size();
+	fclose( file );
+	return ok;
+}
+
+static void PrintStats( const BatchStats& stats )
+{
+	printf( "%u views in %.1f ms: %.1f views/s\n", stats.views, stats.wallMs, stats.ViewsPerSecond() );
+	printf( "per view: G-buffer %.2f ms, AO %.2f ms, composite %.2f ms, write %.2f ms\n", stats.gbufferMs / stats.views,
+			stats.aoMs / stats.views, stats.compositeMs / stats.views, stats.writeMs / stats.views );
+	printf( "%u triangles, %u culled, %u clipped, %llu pixels; %.1f MB written\n", stats.raster.triangles,
+			stats.raster.culled, stats.raster.clipped, stats.raster.pixels, stats.bytesWritten / 1048576.0 );
+	printf( "vertex cache: %.0f%% hits, %.2f ms saved\n", stats.vertices.HitRate() * 100.0, stats.vertices.SavedMs() );
+	printf( "output: %u files, encoding %.1f MB/s, %.1f ms writing, workers blocked %u times for %.1f ms\n",
+			stats.output.frames, stats.output.EncodeMBps(), stats.output.writeMs, stats.output.blocked, stats.output.blockedMs );
+}
+
+//--------------------------------------------------------------------------------------
+// Synthetic scene: spheres on a checkered ground plane, in model space of the sample
+// (the world turns it 180 degrees about Z, so the ground is at +Y here)
+//--------------------------------------------------------------------------------------
+static void AddSphere( CpuMesh& mesh, float cx, float cy, float cz, float radius, int rows, int columns, int texture )
+{
+	CpuMesh::Subset subset;
+	subset.indexStart = ( unsigned int )mesh.indices.size();
+	subset.vertexStart = ( unsigned int )mesh.vertices.size();
+	subset.texture = texture;
+	for( int y = 0; y <= rows; ++y )
+		for( int x = 0; x <= columns; ++x )
+		{
+			float theta = 3.14159265f * y / rows, phi = 2.0f * 3.14159265f * x / columns;
+			FloatVertex v;
+			v.normal[0] = sinf( theta ) * cosf( phi );
+			v.normal[1] = cosf( theta );
+			v.normal[2] = sinf( theta ) * sinf( phi );
+			v.pos[0] = cx + v.normal[0] * radius;
+			v.pos[1] = cy + v.normal[1] * radius;
+			v.pos[2] = cz + v.normal[2] * radius;
+			v.uv[0] = 4.0f * x / columns;
+			v.uv[1] = 2.0f * y / rows;
+			mesh.vertices.push_back( v );
+		}
+	for( int y = 0; y < rows; ++y )
+		for( int x = 0; x < columns; ++x )
+		{
+			unsigned int i = y * ( columns + 1 ) + x, below = i + columns + 1;
+			unsigned int quad[6] = { i, i + 1, below, i + 1, below + 1, below };
+			mesh.indices.insert( mesh.indices.end(), quad, quad + 6 );
+		}
+	subset.indexCount = ( unsigned int )mesh.indices.size() - subset.indexStart;
+	mesh.subsets.push_back( subset );
+}
+
+static void AddGround( CpuMesh& mesh, float y, float extent, int cells, int texture )
+{
+	CpuMesh::Subset subset;
+	subset.indexStart = ( unsigned int )mesh.indices.size();
+	subset.vertexStart = ( unsigned int )mesh.vertices.size();
+	subset.texture = texture;
+	for( int z = 0; z <= cells; ++z )
+		for( int x = 0; x <= cells; ++x )
+		{
+			FloatVertex v = { { -extent + 2.0f * extent * x / cells, y, -extent + 2.0f * extent * z / cells },
+							  { 0.0f, -1.0f, 0.0f }, { 8.0f * x / cells, 8.0f * z / cells } };
+			mesh.vertices.push_back( v );
+		}
+	for( int z = 0; z < cells; ++z )
+		for( int x = 0; x < cells; ++x )
+		{
+			unsigned int i = z * ( cells + 1 ) + x, next = i + cells + 1;
+			unsigned int quad[6] = { i, i + 1, next, i + 1, next + 1, next };
+			mesh.indices.insert( mesh.indices.end(), quad, quad + 6 );
+		}
+	subset.indexCount = ( unsigned int )mesh.indices.size() - subset.indexStart;
+	mesh.subsets.push_back( subset );
+}
+
+static void MakeChecker( CpuTexture& texture, CpuFloat4 a, CpuFloat4 b )
+{
+	texture.width = texture.height = 64;
+	texture.texels.resize( 64 * 64 );
+	for( int y = 0; y < 64; ++y )
+		for( int x = 0; x < 64; ++x )
+			texture.texels[y * 64 + x] = ( ( x / 8 ) ^ ( y / 8 ) ) & 1 ? a : b;
+}
+
+static void MakeBenchScene( CpuMesh& mesh )
+{
+	mesh = CpuMesh();
+	mesh.textures.resize( 2 );
+	MakeChecker( mesh.textures[0], CpuFloat4{ 0.8f, 0.8f, 0.75f, 1.0f }, CpuFloat4{ 0.4f, 0.4f, 0.38f, 1.0f } );
+	MakeChecker( mesh.textures[1], CpuFloat4{ 0.9f, 0.5f, 0.3f, 1.0f }, CpuFloat4{ 0.7f, 0.3f, 0.2f, 1.0f } );
+	AddGround( mesh, 150.0f, 1500.0f, 64, 0 );
+	AddSphere( mesh, 0.0f, 50.0f, 0.0f, 100.0f, 64, 128, 1 );
+	AddSphere( mesh, -220.0f, 100.0f, -40.0f, 50.0f, 32, 64, 1 );
+	AddSphere( mesh, 200.0f, 90.0f, 80.0f, 60.0f, 32, 64, -1 );
+	AddSphere( mesh, -90.0f, 125.0f, -160.0f, 25.0f, 16, 32, 1 );
+}
+
+//--------------------------------------------------------------------------------------
+// Checks
+//--------------------------------------------------------------------------------------
+static BatchView DefaultView( int width, int height )
+{
+	vector<BatchView> views;
+	ParseBatch( "size " + to_string( width ) + " " + to_string( height ) + "\ncamera 0 0 -800 0 0 0\n", views );
+	return views[0];
+}
+
+static void CheckParser()
+{
+	const char* text =
+		"# thumbnails\n"
+		"size 320 240\n"
+		"view normals   # sticky\n"
+		"ao off\n"
+		"output out/t%04d.pam\n"
+		"camera 0 0 -800 0 0 0\n"
+		"fov 60\n"
+		"export depth ao\n"
+		"exr float\n"
+		"orbit 8 800 100 0 0 0\n";
+	vector<BatchView> views;
+	string error;
+	bool ok = ParseBatch( text, views, &error );
+	Check( ok && views.size() == 9 && views[8].width == 320 && views[8].viewMode == VIEW_NORMALS && !views[8].ao &&
+		   views[0].output == "out/t0000.pam" && views[8].output == "out/t0008.pam" &&
+		   fabsf( views[8].fovY - 3.14159265f / 3.0f ) < 1e-5f && fabsf( views[0].fovY - 3.14159265f / 4.0f ) < 1e-5f,
+		   "batch file: settings hold for the cameras after them" );
+	Check( ok && views[0].exports == 0 && views[0].exrHalf && views[8].exports == ( EXPORT_DEPTH | EXPORT_AO ) &&
+		   !views[8].exrHalf && ExportPath( views[8], 3 ) == "out/t0008_ao.exr", "batch file: exports" );
+	Check( fabsf( views[1].eye.z + 800.0f ) < 1e-3f && fabsf( views[1].eye.y - 100.0f ) < 1e-3f &&
+		   fabsf( views[3].eye.x - 800.0f ) < 1e-2f, "batch file: orbit starts in front and goes around Y" );
+	views.clear();
+	Check( !ParseBatch( "size 64 64\nview sideways\n", views, &error ) && error.find( "line 2" ) == 0,
+		   "batch file: errors name the line" );
+}
+
+static void CheckRasterizer()
+{
+	// one sphere of radius 100 at view Z 800: a disc of known size, front half only
+	CpuMesh sphere;
+	AddSphere( sphere, 0.0f, 0.0f, 0.0f, 100.0f, 96, 192, -1 );
+	BatchView view = DefaultView( 512, 512 );
+	CpuRasterScratch scratch;
+	CpuGBuffer gbuffer;
+	CpuRasterStats stats;
+	memset( &stats, 0, sizeof( stats ) );
+	RenderGBuffer( sphere, MakeBatchCamera( view ), view.width, view.height, scratch, gbuffer, &stats );
+
+	// projected radius of a sphere: r / sqrt( d^2 - r^2 ) in units of the focal length
+	double radiusPixels = 100.0 / sqrt( 800.0 * 800.0 - 100.0 * 100.0 ) * gbuffer.projScaleY * view.height / 2.0;
+	double expected = 3.14159265 * radiusPixels * radiusPixels;
+	size_t covered = 0;
+	float nearest = 1e30f;
+	double facing = 0.0;
+	for( size_t i = 0; i < gbuffer.viewZ.size(); ++i )
+		if( gbuffer.viewZ[i] != 0.0f )
+		{
+			++covered;
+			nearest = min( nearest, gbuffer.viewZ[i] );
+			facing += gbuffer.normal[i].z;
+		}
+	printf( "sphere: %u pixels (%.0f expected), nearest Z %.2f, %u of %u triangles culled\n", ( unsigned int )covered,
+			expected, nearest, stats.culled, stats.triangles );
+	Check( fabs( covered / expected - 1.0 ) < 0.02, "sphere covers its projected disc" );
+	Check( fabsf( nearest - 700.0f ) < 0.5f, "depth is linear view Z" );
+	Check( facing < -0.5 * covered, "normals face the camera" );
+	Check( stats.pixels < covered * 1.001, "pixels drawn once (back faces culled)" );
+
+	// from inside the sphere every face is a back face
+	BatchView inside = view;
+	inside.eye = MakeVec3( 0.0f, 0.0f, -10.0f );
+	RenderGBuffer( sphere, MakeBatchCamera( inside ), inside.width, inside.height, scratch, gbuffer );
+	Check( count( gbuffer.viewZ.begin(), gbuffer.viewZ.end(), 0.0f ) == ( ptrdiff_t )gbuffer.viewZ.size(),
+		   "nothing drawn from inside a closed mesh" );
+
+	// the camera just above a big ground plane: triangles behind the eye get clipped
+	CpuMesh ground;
+	AddGround( ground, 150.0f, 3000.0f, 8, -1 );
+	BatchView low = view;
+	low.eye = MakeVec3( 0.0f, -140.0f, 0.0f );				// 10 above the ground (the world flips Y)
+	low.at = MakeVec3( 0.0f, -145.0f, 1000.0f );
+	memset( &stats, 0, sizeof( stats ) );
+	RenderGBuffer( ground, MakeBatchCamera( low ), low.width, low.height, scratch, gbuffer, &stats );
+	bool finite = true;
+	size_t groundPixels = 0;
+	for( size_t i = 0; i < gbuffer.viewZ.size(); ++i )
+		if( gbuffer.viewZ[i] != 0.0f )
+		{
+			++groundPixels;
+			finite = finite && gbuffer.viewZ[i] >= gbuffer.nearZ * 0.99f && gbuffer.viewZ[i] <= gbuffer.farZ &&
+					 gbuffer.normal[i].x == gbuffer.normal[i].x;
+		}
+	Check( stats.clipped > 0 && finite && groundPixels > gbuffer.viewZ.size() / 3, "near plane clipping" );
+	Check( fabsf( gbuffer.nearZ - 0.1f ) < 1e-4f && fabsf( gbuffer.farZ - 5000.0f ) < 25.0f, "clip planes from the projection" );
+}
+
+//--------------------------------------------------------------------------------------
+// Bench
+//--------------------------------------------------------------------------------------
+static int Bench( int numViews, int width, int height )
+{
+	CheckParser();
+	CheckRasterizer();
+
+	CpuMesh mesh;
+	MakeBenchScene( mesh );
+	numViews = max( numViews, ( int )NUM_VIEW_MODES );		// at least one view per view mode
+	string text = "size " + to_string( width ) + " " + to_string( height ) + "\norbit " + to_string( numViews ) +
+				  " 800 250 0 -50 0\n";
+	vector<BatchView> views;
+	ParseBatch( text, views );
+	for( size_t v = 0; v < views.size(); ++v )
+	{
+		views[v].output.clear();
+		views[v].viewMode = ( int )( v % NUM_VIEW_MODES );			// every view mode
+	}
+
+	// the same images whatever runs them
+	BatchStats stats;
+	vector<Image> serial, parallel;
+	{
+		JobSystem jobs( 1 );
+		RenderBatch( jobs, mesh, views, stats, NULL, &serial );
+	}
+	int hardware = max( 1, ( int )thread::hardware_concurrency() );
+	{
+		JobSystem jobs( max( 4, hardware ) );
+		RenderBatch( jobs, mesh, views, stats, NULL, &parallel );
+	}
+	bool same = serial.size() == parallel.size();
+	for( size_t v = 0; same && v < serial.size(); ++v )
+		same = serial[v].rgba == parallel[v].rgba;
+	Check( same, "parallel batch matches the serial one" );
+
+	size_t lit = 0;
+	for( size_t i = 0; i < serial[VIEW_COMPOSITE].rgba.size(); i += 4 )
+		lit += serial[VIEW_COMPOSITE].rgba[i] > 40;
+	Check( lit > serial[VIEW_COMPOSITE].rgba.size() / 4 / 10, "composite view is lit" );
+
+	// written views read back the same, and so do the exports
+	const char* path = "BatchRenderBench.pam";
+	vector<BatchView> one( 1, views[VIEW_COMPOSITE] );
+	one[0].output = path;
+	one[0].exports = EXPORT_DIFFUSE | EXPORT_NORMAL | EXPORT_DEPTH | EXPORT_AO;
+	one[0].exrHalf = false;
+	vector<Image> written;
+	Image read;
+	{
+		JobSystem jobs( 1 );
+		RenderBatch( jobs, mesh, one, stats, NULL, &written );
+	}
+	Check( LoadImageFile( path, read ) && read.rgba == written[0].rgba && read.rgba == serial[VIEW_COMPOSITE].rgba,
+		   "written view reads back" );
+	Check( stats.output.frames == 5 && ExportPath( one[0], 2 ) == "BatchRenderBench_depth.exr", "exports are written" );
+
+	BatchContext context;
+	RenderBatchView( mesh, one[0], context, read );
+	vector<unsigned char> file;
+	ExrImage depth;
+	bool depthSame = false;
+	if( ReadFileBytes( ExportPath( one[0], 2 ), file ) && DecodeExr( &file[0], file.size(), depth ) && depth.channels == "Z" )
+		depthSame = depth.pixels == context.gbuffer.viewZ;
+	Check( depthSame, "exported depth is the G-buffer's view Z" );
+	remove( path );
+	for( int e = 0; e < NUM_EXPORTS; ++e )
+		remove( ExportPath( one[0], e ).c_str() );
+
+	// throughput: composite with AO, every view written
+	for( size_t v = 0; v < views.size(); ++v )
+	{
+		views[v].viewMode = VIEW_COMPOSITE;
+		views[v].output = "BatchRenderBench_" + to_string( v ) + ".ppm";
+	}
+	printf( "\n%d views of %dx%d, %u triangles each, composite with AO\n\n", numViews, width, height,
+			( unsigned int )( mesh.indices.size() / 3 ) );
+	printf( "%-8s %10s %10s %12s %10s %10s %10s\n", "workers", "wall ms", "views/s", "G-buffer ms", "AO ms", "comp ms",
+			"write ms" );
+	double single = 0.0;
+	for( int workers = 1; workers <= max( 4, hardware ); workers *= 2 )
+	{
+		JobSystem jobs( workers );
+		RenderBatch( jobs, mesh, views, stats );
+		if( workers == 1 )
+			single = stats.ViewsPerSecond();
+		printf( "%-8d %10.1f %10.2f %12.2f %10.2f %10.2f %10.2f\n", workers, stats.wallMs, stats.ViewsPerSecond(),
+				stats.gbufferMs / stats.views, stats.aoMs / stats.views, stats.compositeMs / stats.views,
+				stats.writeMs / stats.views );
+	}
+	printf( "(%d hardware threads; 1 worker: %.2f views/s)\n\n", hardware, single );
+	for( size_t v = 0; v < views.size(); ++v )
+		remove( views[v].output.c_str() );
+	return failures ? 1 : 0;
+}
+
+int main( int argc, char* argv[] )
+{
+	if( argc >= 2 && strcmp( argv[1], "-bench" ) == 0 )
+	{
+		int views = argc >= 3 ? atoi( argv[2] ) : 24;
+		int width = argc >= 5 ? atoi( argv[3] ) : 640;
+		int height = argc >= 5 ? atoi( argv[4] ) : 480;
+		if( views <= 0 || width <= 0 || height <= 0 )
+		{
+			fprintf( stderr, "usage: BatchRender -bench [views [width height]]\n" );
+			return 1;
+		}
+		return Bench( views, width, height );
+	}
+	if( argc < 3 || argc > 4 )
+	{
+		fprintf( stderr, "usage: BatchRender mesh.sdkmesh batch.txt [workers]\n       BatchRender -bench [views [width height]]\n" );
+		return 1;
+	}
+
+	Clock::time_point start = Clock::now();
+	CpuMesh mesh;
+	vector<BatchView> views;
+	string error;
+	int missing = 0;
+	if( !LoadCpuMesh( argv[1], mesh, &error, &missing ) || !ReadBatchFile( argv[2], views, &error ) )
+	{
+		fprintf( stderr, "%s\n", error.c_str() );
+		return 1;
+	}
+	printf( "%s: %u vertices, %u triangles, %u textures (%d missing) in %.1f ms\n", argv[1],
+			( unsigned int )mesh.vertices.size(), ( unsigned int )( mesh.indices.size() / 3 ), ( unsigned int )mesh.textures.size(),
+			missing, Milliseconds( start ) );
+
+	JobSystem jobs( argc >= 4 ? atoi( argv[3] ) : 0 );
+	BatchStats stats;
+	bool ok = RenderBatch( jobs, mesh, views, stats );
+	PrintStats( stats );
+	if( !ok )
+		fprintf( stderr, "%u files couldn't be written\n", stats.failedWrites );
+	return ok ? 0 : 1;
+}
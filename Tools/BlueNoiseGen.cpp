@@ -0,0 +1,253 @@
+//--------------------------------------------------------------------------------------
+// File: BlueNoiseGen.cpp
+//
+// Generates (or loads) the blue-noise rotation maps the sample uses in place of
+// vectors.png and compares them with white noise and the 4x4 rotation table:
+// generation time cold and cached, low-frequency energy of the maps, and the AO error
+// left after a small blur at 1, 2 and 4 iterations.
+// Usage: BlueNoiseGen [size [cache directory [width height]]]
+//--------------------------------------------------------------------------------------
+#include "../Portable/BlueNoise.h"
+#include "../Portable/CpuPasses.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+using namespace std;
+
+static int failures = 0;
+
+static double Milliseconds( const chrono::high_resolution_clock::time_point& start )
+{
+	return chrono::duration<double, milli>( chrono::high_resolution_clock::now() - start ).count();
+}
+
+static void Check( bool ok, const char* what )
+{
+	printf( "%-56s %s\n", what, ok ? "ok" : "FAILED" );
+	if( !ok )
+		++failures;
+}
+
+// Share of the variance of a wrapping size x size map that survives a 3x3 box
+// filter: about 1/9 for white noise, much less for blue noise
+static double LowFrequencyEnergy( const float* values, int size )
+{
+	double mean = 0.0;
+	for( int i = 0; i < size * size; ++i )
+		mean += values[i];
+	mean /= size * size;
+
+	double total = 0.0, low = 0.0;
+	for( int y = 0; y < size; ++y )
+	{
+		for( int x = 0; x < size; ++x )
+		{
+			double box = 0.0;
+			for( int j = -1; j <= 1; ++j )
+				for( int i = -1; i <= 1; ++i )
+					box += values[( ( y + j + size ) % size ) * size + ( x + i + size ) % size] - mean;
+			box /= 9.0;
+			double d = values[y * size + x] - mean;
+			total += d * d;
+			low += box * box;
+		}
+	}
+	return total > 0.0 ? low / total : 0.0;
+}
+
+// (2 * radius + 1)^2 box filter of the ao, skipping background pixels
+static void Blur( const CpuGBuffer& gbuffer, const vector<float>& ao, int radius, vector<float>& out )
+{
+	const int w = gbuffer.width;
+	const int h = gbuffer.height;
+	out = ao;
+	for( int y = 0; y < h; ++y )
+	{
+		for( int x = 0; x < w; ++x )
+		{
+			if( gbuffer.viewZ[y * w + x] == 0.0f )
+				continue;
+			float sum = 0.0f;
+			int count = 0;
+			for( int j = max( y - radius, 0 ); j <= min( y + radius, h - 1 ); ++j )
+				for( int i = max( x - radius, 0 ); i <= min( x + radius, w - 1 ); ++i )
+					if( gbuffer.viewZ[j * w + i] != 0.0f )
+					{
+						sum += ao[j * w + i];
+						++count;
+					}
+			out[y * w + x] = sum / count;
+		}
+	}
+}
+
+static double Rmse( const CpuGBuffer& gbuffer, const vector<float>& a, const vector<float>& b )
+{
+	double sumSq = 0.0;
+	int count = 0;
+	for( size_t i = 0; i < a.size(); ++i )
+	{
+		if( gbuffer.viewZ[i] == 0.0f )
+			continue;
+		double d = a[i] - b[i];
+		sumSq += d * d;
+		++count;
+	}
+	return count ? sqrt( sumSq / count ) : 0.0;
+}
+
+static void RotationsFromRanks( const unsigned short* ranks, int size, vector<CpuFloat2>& rotations )
+{
+	const int n = size * size;
+	rotations.resize( n );
+	for( int i = 0; i < n; ++i )
+	{
+		float angle = ( ranks[i] + 0.5f ) / n * 6.2831853f;
+		rotations[i].x = cosf( angle );
+		rotations[i].y = sinf( angle );
+	}
+}
+
+static void WhiteRotations( unsigned int seed, int size, vector<CpuFloat2>& rotations )
+{
+	unsigned int state = seed;
+	rotations.resize( size * size );
+	for( int i = 0; i < size * size; ++i )
+	{
+		state = state * 1664525u + 1013904223u;
+		float angle = ( state >> 8 ) * ( 1.0f / 16777216.0f ) * 6.2831853f;
+		rotations[i].x = cosf( angle );
+		rotations[i].y = sinf( angle );
+	}
+}
+
+int main( int argc, char* argv[] )
+{
+	BlueNoiseParams params;
+	string directory = "BlueNoise";
+	int width = 512;
+	int height = 384;
+	if( argc >= 2 )
+		params.size = atoi( argv[1] );
+	if( argc >= 3 )
+		directory = argv[2];
+	if( argc >= 5 )
+	{
+		width = atoi( argv[3] );
+		height = atoi( argv[4] );
+	}
+	if( params.size < 4 || params.size > 256 || width <= 0 || height <= 0 )
+	{
+		fprintf( stderr, "usage: BlueNoiseGen [size [cache directory [width height]]]\n" );
+		return 1;
+	}
+	const int threads = max( 1, ( int )thread::hardware_concurrency() );
+	const int n = params.size * params.size;
+
+	// generation
+	vector<unsigned short> ranks, ranks1, cached;
+	chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+	GenerateBlueNoise( params, 1, ranks1 );
+	double ms1 = Milliseconds( start );
+	start = chrono::high_resolution_clock::now();
+	GenerateBlueNoise( params, threads, ranks );
+	double msN = Milliseconds( start );
+
+	bool fromCache = false;
+	LoadOrGenerateBlueNoise( directory, params, threads, cached, &fromCache );
+	start = chrono::high_resolution_clock::now();
+	bool loaded = LoadOrGenerateBlueNoise( directory, params, threads, cached, &fromCache );
+	double msCached = Milliseconds( start );
+
+	printf( "blue noise %dx%d, %d layers\n\n", params.size, params.size, params.layers );
+	printf( "%-30s %10s\n", "", "ms" );
+	printf( "%-30s %10.2f\n", "generate, 1 thread", ms1 );
+	char label[64];
+	sprintf( label, "generate, %d threads", threads );
+	printf( "%-30s %10.2f\n", label, msN );
+	printf( "%-30s %10.2f\n\n", "load from cache", msCached );
+
+	vector<bool> seen( n, false );
+	bool permutation = true;
+	for( int i = 0; i < n; ++i )
+	{
+		permutation = permutation && ranks[i] < n && !seen[ranks[i]];
+		if( ranks[i] < n )
+			seen[ranks[i]] = true;
+	}
+	Check( permutation, "layer 0 is a permutation of the ranks" );
+	Check( ranks == ranks1, "same result on 1 and n threads" );
+	Check( loaded && fromCache && cached == ranks, "second load comes from the cache" );
+
+	// spectrum: thresholded rank maps and the maps themselves
+	vector<float> blueValues( n ), whiteValues( n );
+	vector<CpuFloat2> white;
+	WhiteRotations( 7, params.size, white );
+	for( int i = 0; i < n; ++i )
+	{
+		blueValues[i] = ( float )ranks[i];
+		whiteValues[i] = atan2f( white[i].y, white[i].x );
+	}
+	double blueLow = LowFrequencyEnergy( &blueValues[0], params.size );
+	double whiteLow = LowFrequencyEnergy( &whiteValues[0], params.size );
+	printf( "\n%-30s %10s\n", "low-frequency energy", "share" );
+	printf( "%-30s %10.4f\n", "white", whiteLow );
+	printf( "%-30s %10.4f\n\n", "blue", blueLow );
+	Check( blueLow < whiteLow * 0.5, "blue noise has less low-frequency energy" );
+
+	// AO error after a blur against a converged reference (many white maps averaged)
+	CpuGBuffer gbuffer;
+	MakeTestGBuffer( gbuffer, width, height );
+	CpuFloat2 table[CPU_NUMLAYERS];
+	MakeRotationTable( table, 1 );
+	vector<CpuFloat2> blue;
+	RotationsFromRanks( &ranks[0], params.size, blue );
+
+	CpuAOParams aoParams;
+	aoParams.iterations = 8;
+	vector<float> reference( width * height, 0.0f ), ao;
+	const int referenceMaps = 16;
+	for( int m = 0; m < referenceMaps; ++m )
+	{
+		vector<CpuFloat2> rotations;
+		WhiteRotations( 100 + m, params.size, rotations );
+		ComputeAORotationMap( gbuffer, aoParams, &rotations[0], params.size, ao );
+		for( size_t i = 0; i < ao.size(); ++i )
+			reference[i] += ao[i] / referenceMaps;
+	}
+
+	printf( "AO error vs reference, %dx%d\n\n", width, height );
+	printf( "%-30s %10s %10s %10s\n", "rotations", "raw", "3x3 blur", "5x5 blur" );
+	static const int iterations[] = { 1, 2, 4 };
+	bool blueBetter = true;
+	vector<float> blurred;
+	for( int it = 0; it < 3; ++it )
+	{
+		aoParams.iterations = iterations[it];
+		double errors[3][3];
+		for( int kind = 0; kind < 3; ++kind )
+		{
+			if( kind == 0 )
+				ComputeAO( gbuffer, aoParams, table, ao );
+			else
+				ComputeAORotationMap( gbuffer, aoParams, kind == 1 ? &white[0] : &blue[0], params.size, ao );
+			errors[kind][0] = Rmse( gbuffer, ao, reference );
+			Blur( gbuffer, ao, 1, blurred );
+			errors[kind][1] = Rmse( gbuffer, blurred, reference );
+			Blur( gbuffer, ao, 2, blurred );
+			errors[kind][2] = Rmse( gbuffer, blurred, reference );
+
+			static const char* names[] = { "4x4 table", "white", "blue" };
+			sprintf( label, "%s, %d taps", names[kind], iterations[it] * 4 );
+			printf( "%-30s %10.4f %10.4f %10.4f\n", label, errors[kind][0], errors[kind][1], errors[kind][2] );
+		}
+		blueBetter = blueBetter && errors[2][1] < errors[1][1];
+	}
+	printf( "\n" );
+	Check( blueBetter, "blue noise blurs out better than white noise" );
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,91 @@
+//--------------------------------------------------------------------------------------
+// File: CompositeBench.cpp
+//
+// Times the CPU port of the composite (PSQuad) for every view mode, branching on the
+// view mode and ao flag per pixel against the permutation picked once per frame.
+// Usage: CompositeBench [width height [runs]]
+//--------------------------------------------------------------------------------------
+#include "../Portable/CpuPasses.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+static const char* viewNames[NUM_VIEW_MODES] = { "diffuse", "normals", "position", "depth", "composite", "ao" };
+
+static double Milliseconds( const chrono::high_resolution_clock::time_point& start )
+{
+	return chrono::duration<double, milli>( chrono::high_resolution_clock::now() - start ).count();
+}
+
+int main( int argc, char* argv[] )
+{
+	int width = 2048;		// 1024x768 * TEXSCALE
+	int height = 1536;
+	int runs = 5;
+	if( argc >= 3 )
+	{
+		width = atoi( argv[1] );
+		height = atoi( argv[2] );
+	}
+	if( argc >= 4 )
+		runs = atoi( argv[3] );
+	if( width <= 0 || height <= 0 || runs <= 0 )
+	{
+		fprintf( stderr, "usage: CompositeBench [width height [runs]]\n" );
+		return 1;
+	}
+
+	CpuGBuffer gbuffer;
+	MakeTestGBuffer( gbuffer, width, height );
+
+	CpuFloat2 rotations[CPU_NUMLAYERS];
+	MakeRotationTable( rotations, 1 );
+	vector<float> ao;
+	ComputeAO( gbuffer, CpuAOParams(), rotations, ao );
+
+	const CpuFloat3 lightPos = { 0.0f, -3.0f, -4.0f };	// vLightPos
+	vector<CpuFloat4> branching( width * height ), specialized( width * height );
+
+	printf( "composite %dx%d, best of %d runs, %d permutations\n\n", width, height, runs, NUM_VIEW_MODES * 2 );
+	printf( "%-20s %12s %12s %10s\n", "view", "branching ms", "selected ms", "speedup" );
+
+	double totalBranching = 0.0, totalSpecialized = 0.0;
+	for( int view = 0; view < NUM_VIEW_MODES; ++view )
+	{
+		for( int useAO = 0; useAO < 2; ++useAO )
+		{
+			double bestBranching = 1e30, bestSpecialized = 1e30;
+			for( int run = 0; run < runs; ++run )
+			{
+				chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+				CompositeBranching( gbuffer, ao, lightPos, view, useAO != 0, 0, height, branching );
+				bestBranching = min( bestBranching, Milliseconds( start ) );
+
+				start = chrono::high_resolution_clock::now();
+				CpuCompositeFunc composite = SelectComposite( view, useAO != 0 );
+				composite( gbuffer, ao, lightPos, 0, height, specialized );
+				bestSpecialized = min( bestSpecialized, Milliseconds( start ) );
+			}
+
+			// both must produce the same image
+			if( memcmp( &branching[0], &specialized[0], branching.size() * sizeof( CpuFloat4 ) ) != 0 )
+			{
+				fprintf( stderr, "%s%s: permutation differs from the branching composite\n",
+						 viewNames[view], useAO ? " + ao" : "" );
+				return 1;
+			}
+
+			char label[64];
+			sprintf( label, "%s%s", viewNames[view], useAO ? " + ao" : "" );
+			printf( "%-20s %12.2f %12.2f %9.2fx\n", label, bestBranching, bestSpecialized, bestBranching / bestSpecialized );
+			totalBranching += bestBranching;
+			totalSpecialized += bestSpecialized;
+		}
+	}
+	printf( "\n%-20s %12.2f %12.2f %9.2fx\n", "all", totalBranching, totalSpecialized, totalBranching / totalSpecialized );
+	return 0;
+}
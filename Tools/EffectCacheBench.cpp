@@ -0,0 +1,270 @@
+//--------------------------------------------------------------------------------------
+// File: EffectCacheBench.cpp
+//
+// Exercises the compiled-effect cache with a stub compiler: startup time cold (compile),
+// after a device reset (earlier request) and warm (on disk), plus checks of the key,
+// the shared compiles, the atomic writes and the recovery from damaged entries.
+// Without an effect file it looks for DeferredShading.fx here and in the parent
+// directories, then falls back to a small stand-in effect.
+// Usage: EffectCacheBench [effect file [compile ms [cache directory]]]
+//--------------------------------------------------------------------------------------
+#include "../Portable/EffectCache.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+static int compileDelayMs = 250;		// stand-in for compiling DeferredShading.fx
+static int failures = 0;
+
+static double Milliseconds( const chrono::high_resolution_clock::time_point& start )
+{
+	return chrono::duration<double, milli>( chrono::high_resolution_clock::now() - start ).count();
+}
+
+static void Check( bool ok, const char* what )
+{
+	printf( "%-56s %s\n", what, ok ? "ok" : "FAILED" );
+	if( !ok )
+		++failures;
+}
+
+// The stub compiler: takes a while, output depends on every input, fails on "#error"
+static bool StubCompile( const EffectSource& source, vector<char>& blob, string& errors )
+{
+	this_thread::sleep_for( chrono::milliseconds( compileDelayMs ) );
+	if( source.text.find( "#error" ) != string::npos )
+	{
+		errors = source.path + ": #error";
+		return false;
+	}
+	EffectHash hash = HashEffectSource( source );
+	blob.assign( ( const char* )&hash, ( const char* )&hash + sizeof( hash ) );
+	blob.insert( blob.end(), source.text.begin(), source.text.end() );
+	return true;
+}
+
+static bool WriteTextFile( const string& path, const char* text )
+{
+	FILE* file = fopen( path.c_str(), "wb" );
+	if( !file )
+		return false;
+	bool ok = fputs( text, file ) >= 0;
+	return fclose( file ) == 0 && ok;
+}
+
+static bool SameBlob( const EffectCacheEntry& entry, const EffectSource& source )
+{
+	vector<char> expected;
+	string errors;
+	int delay = compileDelayMs;
+	compileDelayMs = 0;
+	StubCompile( source, expected, errors );
+	compileDelayMs = delay;
+	return entry.ok && entry.blob && *entry.blob == expected;
+}
+
+int main( int argc, char* argv[] )
+{
+	if( argc >= 3 )
+		compileDelayMs = atoi( argv[2] );
+	string directory = argc >= 4 ? argv[3] : "EffectCache";
+
+	// two different common.fxh, one next to main.fx and one next to sub/user.fxh that includes it
+	MakeDirectory( directory );
+	string tree = directory + "/IncludeTest/";
+	MakeDirectory( tree );
+	MakeDirectory( tree + "sub" );
+	bool wroteTree = WriteTextFile( tree + "main.fx", "#include \"common.fxh\"\n#include \"sub/user.fxh\"\n"
+										"float4 PS() : SV_Target { return a + b; }\n" ) &&
+					 WriteTextFile( tree + "common.fxh", "float4 a;\n" ) &&
+					 WriteTextFile( tree + "sub/user.fxh", "#include \"common.fxh\"\n" ) &&
+					 WriteTextFile( tree + "sub/common.fxh", "float4 b;\n" );
+
+	string path;
+	if( argc >= 2 )
+		path = argv[1];
+	else
+	{
+		const char* candidates[] = { "DeferredShading.fx", "../DeferredShading.fx", "../../DeferredShading.fx" };
+		path = tree + "main.fx";
+		for( size_t i = 0; i < sizeof( candidates ) / sizeof( candidates[0] ); ++i )
+		{
+			FILE* file = fopen( candidates[i], "rb" );
+			if( file )
+			{
+				fclose( file );
+				path = candidates[i];
+				break;
+			}
+		}
+	}
+
+	EffectSource source;
+	if( !LoadEffectSource( path, source ) )
+	{
+		fprintf( stderr, "usage: EffectCacheBench [effect file [compile ms [cache directory]]]\n"
+				 "can't read %s\n", path.c_str() );
+		return 1;
+	}
+	source.compiler = "D3DX10 43, D3D10 29";
+	source.profile = "fx_4_0";
+	source.flags = 0x800;				// D3D10_SHADER_ENABLE_STRICTNESS
+
+	// a define no earlier run used, so the first request really is cold
+	EffectDefine run;
+	run.name = "CACHE_BENCH_RUN";
+	char stamp[32];
+	sprintf( stamp, "%lld", ( long long )chrono::system_clock::now().time_since_epoch().count() );
+	run.definition = stamp;
+	source.defines.push_back( run );
+
+	printf( "%s: %u bytes, %u includes, stub compile %d ms\n\n", path.c_str(),
+			( unsigned int )source.text.size(), ( unsigned int )source.includes.size(), compileDelayMs );
+
+	// the key covers every input
+	{
+		EffectHash key = HashEffectSource( source );
+		EffectSource other = source;
+		Check( HashEffectSource( other ) == key, "key: same inputs, same key" );
+		other.text += " ";
+		Check( HashEffectSource( other ) != key, "key: source text" );
+		other = source;
+		other.defines[0].definition += "1";
+		Check( HashEffectSource( other ) != key, "key: defines" );
+		other = source;
+		other.compiler = "D3DX10 42, D3D10 29";
+		Check( HashEffectSource( other ) != key, "key: compiler version" );
+		other = source;
+		other.profile = "fx_4_1";
+		Check( HashEffectSource( other ) != key, "key: profile" );
+		other = source;
+		other.flags |= 1;
+		Check( HashEffectSource( other ) != key, "key: flags" );
+		other = source;
+		EffectInclude include = { "common.fxh", "common.fxh", "float4 a;" };
+		other.includes.push_back( include );
+		EffectHash withInclude = HashEffectSource( other );
+		other.includes.back().text = "float4 b;";
+		Check( withInclude != key && HashEffectSource( other ) != withInclude, "key: included files" );
+		other.includes.back().text = "float4 a;";
+		other.includes.back().path = "sub/common.fxh";
+		Check( HashEffectSource( other ) != withInclude, "key: included file paths" );
+	}
+
+	// same-named includes in different directories are different files
+	{
+		EffectSource nested;
+		bool loaded = wroteTree && LoadEffectSource( tree + "main.fx", nested );
+		const string* outer = nested.FindInclude( "common.fxh", nested.path );
+		const string* inner = nested.FindInclude( "common.fxh", tree + "sub/user.fxh" );
+		Check( loaded && nested.includes.size() == 3 && outer && *outer == "float4 a;\n" && inner && *inner == "float4 b;\n",
+			   "includes: resolved against the including file" );
+		EffectSource edited = nested;
+		for( size_t i = 0; i < edited.includes.size(); ++i )
+			if( edited.includes[i].path == tree + "sub/common.fxh" )
+				edited.includes[i].text = "float4 c;\n";
+		Check( loaded && HashEffectSource( edited ) != HashEffectSource( nested ), "key: nested same-named include" );
+	}
+
+	double coldMs, resetMs, warmMs;
+	{
+		EffectCache cache( directory, StubCompile );
+
+		// cold start: compiled on the worker thread while the caller goes on
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		shared_future<EffectCacheEntry> request = cache.Request( source );
+		double requestMs = Milliseconds( start );
+		EffectCacheEntry entry = request.get();
+		coldMs = Milliseconds( start );
+		Check( SameBlob( entry, source ) && !entry.fromCache, "cold: compiled" );
+		Check( requestMs < compileDelayMs / 2.0, "cold: request returns before the compile ends" );
+
+		// device reset: the effect is recreated from the earlier request
+		start = chrono::high_resolution_clock::now();
+		entry = cache.Request( source ).get();
+		resetMs = Milliseconds( start );
+		Check( SameBlob( entry, source ) && cache.GetStats().memoryHits == 1, "device reset: answered from memory" );
+	}
+	{
+		// warm start: a new process finds the entry on disk
+		EffectCache cache( directory, StubCompile );
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		EffectCacheEntry entry = cache.Request( source ).get();
+		warmMs = Milliseconds( start );
+		Check( SameBlob( entry, source ) && entry.fromCache && cache.GetStats().compiles == 0, "warm: loaded from disk" );
+	}
+	{
+		// concurrent requests for one key share one compile
+		EffectCache cache( directory, StubCompile );
+		EffectSource changed = source;
+		changed.defines[0].definition += "-shared";
+		vector<thread> threads;
+		vector<EffectCacheEntry> entries( 8 );
+		for( size_t i = 0; i < entries.size(); ++i )
+			threads.push_back( thread( [&, i]() { entries[i] = cache.Request( changed ).get(); } ) );
+		bool allSame = true;
+		for( size_t i = 0; i < threads.size(); ++i )
+		{
+			threads[i].join();
+			allSame = allSame && SameBlob( entries[i], changed ) && entries[i].blob == entries[0].blob;
+		}
+		Check( allSame && cache.GetStats().compiles == 1, "8 threads, one key: one compile" );
+
+		// racing writers: a reader sees no entry or a whole one, never a torn one
+		EffectHash key = HashEffectSource( changed ) ^ 1;
+		vector<char> blobs[4];
+		for( int i = 0; i < 4; ++i )
+			blobs[i].assign( 64 * 1024 * ( i + 1 ), ( char )( 'a' + i ) );
+		bool stored = true, consistent = true;
+		threads.clear();
+		for( int i = 0; i < 4; ++i )
+			threads.push_back( thread( [&, i]() {
+				for( int n = 0; n < 20; ++n )
+					if( !cache.Store( key, blobs[i] ) )
+						stored = false;
+			} ) );
+		for( int n = 0; n < 200; ++n )
+		{
+			vector<char> blob;
+			if( cache.Load( key, blob ) )
+				consistent = consistent && ( blob == blobs[0] || blob == blobs[1] || blob == blobs[2] || blob == blobs[3] );
+		}
+		for( size_t i = 0; i < threads.size(); ++i )
+			threads[i].join();
+		Check( stored && consistent, "4 writers, 1 reader: no torn entries" );
+		remove( cache.PathFor( key ).c_str() );
+	}
+	{
+		// a damaged entry is detected and recompiled
+		EffectCache cache( directory, StubCompile );
+		EffectHash key = HashEffectSource( source );
+		FILE* file = fopen( cache.PathFor( key ).c_str(), "r+b" );
+		if( file )
+		{
+			fseek( file, -1, SEEK_END );
+			fputc( 0x5a, file );
+			fclose( file );
+		}
+		EffectCacheEntry entry = cache.Request( source ).get();
+		EffectCache::Stats stats = cache.GetStats();
+		Check( SameBlob( entry, source ) && stats.badEntries == 1 && stats.compiles == 1, "damaged entry: recompiled" );
+
+		// failed compiles are reported and not cached
+		EffectSource broken = source;
+		broken.text += "\n#error\n";
+		entry = cache.Request( broken ).get();
+		Check( !entry.ok && !entry.errors.empty(), "compile error: reported" );
+		cache.Request( broken ).get();
+		Check( cache.GetStats().failures == 2, "compile error: not cached" );
+	}
+
+	printf( "\n%-20s %10s\n", "startup", "ms" );
+	printf( "%-20s %10.2f\n", "cold (compile)", coldMs );
+	printf( "%-20s %10.2f\n", "device reset", resetMs );
+	printf( "%-20s %10.2f\n", "warm (disk)", warmMs );
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,402 @@
+//--------------------------------------------------------------------------------------
+// File: FrameReplay.cpp
+//
+// Replays a frame capture recorded by the sample (DeferredShading -capture, or the
+// Capture Frames checkbox) through the CPU passes and writes the per-pass time of
+// every frame, then compares the timings of two builds pass by pass.
+// -bench makes a synthetic capture of a synthetic scene: it checks the capture format
+// (round trip, bytes per frame, cut-short files), that replays render the same images
+// on any number of workers, the timing files and the diff, then measures a replay.
+// Usage: FrameReplay capture.fcap mesh.sdkmesh [-realtime] [-scale s] [-repeat n] [-workers n] [-o timings.csv]
+//        FrameReplay -diff base.csv new.csv [threshold % [min ms]]
+//        FrameReplay -bench [frames [width height]]
+//--------------------------------------------------------------------------------------
+#include "../Portable/BatchRender.h"
+#include "../Portable/FrameReplay.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+using namespace std;
+
+static int failures = 0;
+
+static void Check( bool ok, const char* what )
+{
+	printf( "%-56s %s\n", what, ok ? "ok" : "FAILED" );
+	if( !ok )
+		++failures;
+}
+
+static void PrintReplay( const ReplayResult& result )
+{
+	size_t frames = max( result.frames.size(), ( size_t )1 );
+	double pass[NUM_REPLAY_PASSES] = { 0.0 }, total = 0.0, worst = 0.0;
+	size_t worstFrame = 0;
+	for( size_t i = 0; i < result.frames.size(); ++i )
+	{
+		const ReplayFrame& frame = result.frames[i];
+		for( int p = 0; p < NUM_REPLAY_PASSES; ++p )
+			pass[p] += frame.passMs[p];
+		total += frame.totalMs;
+		if( frame.totalMs > worst )
+		{
+			worst = frame.totalMs;
+			worstFrame = i;
+		}
+	}
+	printf( "%u frames of %dx%d in %.1f ms: %.1f frames/s\n", ( unsigned int )result.frames.size(), result.width,
+			result.height, result.wallMs, result.frames.size() * 1000.0 / max( result.wallMs, 1e-3 ) );
+	printf( "per frame:" );
+	for( int p = 0; p < NUM_REPLAY_PASSES; ++p )
+		printf( " %s %.2f ms,", ReplayPassName( p ), pass[p] / frames );
+	printf( " total %.2f ms; slowest frame %u at %.2f ms\n", total / frames, ( unsigned int )worstFrame, worst );
+	printf( "vertex cache: displaced %u hits / %u misses, transformed %u hits / %u misses (%.0f%%), %.2f ms saved\n",
+			result.vertices.displaceHits, result.vertices.displaceMisses, result.vertices.transformHits,
+			result.vertices.transformMisses, result.vertices.HitRate() * 100.0, result.vertices.SavedMs() );
+	if( result.lateFrames )
+		printf( "%u frames finished after the next one was due\n", result.lateFrames );
+}
+
+static void PrintDiff( const ReplayDiff& diff, double thresholdPercent )
+{
+	printf( "%-10s %10s %10s %8s %10s %10s   %s\n", "pass", "base ms", "new ms", "change", "base p95", "new p95",
+			"slowed down most" );
+	for( int p = 0; p <= NUM_REPLAY_PASSES; ++p )
+	{
+		const ReplayPassDiff& d = diff.pass[p];
+		printf( "%-10s %10.3f %10.3f %+7.1f%% %10.3f %10.3f   ", ReplayPassName( p ), d.baseMedian, d.newMedian, d.change,
+				d.baseP95, d.newP95 );
+		if( d.worstFrame >= 0 )
+			printf( "frame %d: %.3f -> %.3f ms", d.worstFrame, d.worstBaseMs, d.worstNewMs );
+		printf( "%s\n", d.regressed ? "  REGRESSED" : "" );
+	}
+	printf( "(medians of %u frames; a pass regresses when its median is %.1f%% slower)\n", diff.frames, thresholdPercent );
+	if( diff.imageMismatches )
+		printf( "images differ on %u frames\n", diff.imageMismatches );
+}
+
+//--------------------------------------------------------------------------------------
+// Synthetic capture: a sphere on a ground plane, the camera going around it, the
+// model spinning in the second half and the settings changing now and then
+//--------------------------------------------------------------------------------------
+static void AddSphere( CpuMesh& mesh, float cx, float cy, float cz, float radius, int rows, int columns )
+{
+	CpuMesh::Subset subset = { ( unsigned int )mesh.indices.size(), 0, ( unsigned int )mesh.vertices.size(), 0 };
+	for( int y = 0; y <= rows; ++y )
+		for( int x = 0; x <= columns; ++x )
+		{
+			float theta = 3.14159265f * y / rows, phi = 2.0f * 3.14159265f * x / columns;
+			FloatVertex v;
+			v.normal[0] = sinf( theta ) * cosf( phi );
+			v.normal[1] = cosf( theta );
+			v.normal[2] = sinf( theta ) * sinf( phi );
+			v.pos[0] = cx + v.normal[0] * radius;
+			v.pos[1] = cy + v.normal[1] * radius;
+			v.pos[2] = cz + v.normal[2] * radius;
+			v.uv[0] = 4.0f * x / columns;
+			v.uv[1] = 2.0f * y / rows;
+			mesh.vertices.push_back( v );
+		}
+	for( int y = 0; y < rows; ++y )
+		for( int x = 0; x < columns; ++x )
+		{
+			unsigned int i = y * ( columns + 1 ) + x, below = i + columns + 1;
+			unsigned int quad[6] = { i, i + 1, below, i + 1, below + 1, below };
+			mesh.indices.insert( mesh.indices.end(), quad, quad + 6 );
+		}
+	subset.indexCount = ( unsigned int )mesh.indices.size() - subset.indexStart;
+	mesh.subsets.push_back( subset );
+}
+
+static void MakeBenchScene( CpuMesh& mesh )
+{
+	mesh = CpuMesh();
+	mesh.textures.resize( 1 );
+	CpuTexture& texture = mesh.textures[0];
+	texture.width = texture.height = 64;
+	texture.texels.resize( 64 * 64 );
+	for( int y = 0; y < 64; ++y )
+		for( int x = 0; x < 64; ++x )
+			texture.texels[y * 64 + x] = ( ( x / 8 ) ^ ( y / 8 ) ) & 1 ? CpuFloat4{ 0.9f, 0.5f, 0.3f, 1.0f }
+																		: CpuFloat4{ 0.7f, 0.6f, 0.5f, 1.0f };
+	AddSphere( mesh, 0.0f, 50.0f, 0.0f, 100.0f, 48, 96 );
+	AddSphere( mesh, -200.0f, 90.0f, 60.0f, 60.0f, 24, 48 );
+	AddSphere( mesh, 0.0f, 4150.0f, 0.0f, 4000.0f, 48, 96 );		// the ground, seen from outside
+}
+
+static void MakeBenchCapture( int numFrames, int width, int height, FrameCapture& capture )
+{
+	capture.texScale = 1;
+	capture.frames.assign( numFrames, FrameInputs() );
+	Vec3 at = MakeVec3( 0.0f, 0.0f, 0.0f ), up = MakeVec3( 0.0f, 1.0f, 0.0f );
+	for( int i = 0; i < numFrames; ++i )
+	{
+		FrameInputs& frame = capture.frames[i];
+		float angle = 6.2831853f * i / numFrames;
+		frame.elapsed = i ? 1.0f / 60.0f : 0.0f;
+		frame.world = Mat4RotationZ( 3.14159265f + ( i >= numFrames / 2 ? angle : 0.0f ) );
+		frame.view = Mat4LookAtLH( MakeVec3( 800.0f * sinf( angle ), -250.0f, -800.0f * cosf( angle ) ), at, up );
+		frame.projection = Mat4PerspectiveFovLH( 3.14159265f / 4, ( float )width / height, 0.1f, 5000.0f );
+		frame.quadView = Mat4LookAtLH( MakeVec3( 0.0f, 0.0f, 800.0f ), at, up );
+		frame.quadProjection = frame.aoProjection = frame.projection;
+		frame.aoView = Mat4LookAtLH( MakeVec3( 0.0f, 0.0f, 927.0f ), at, up );
+		frame.width = width;
+		frame.height = height;
+		frame.aoTechnique = ( i / 8 ) % 5;				// every technique
+		frame.textureToRender = ( i / 8 ) % 3 ? VIEW_COMPOSITE : ( i / 8 ) % NUM_VIEW_MODES;
+		frame.ambientOcclusion = i % 16 != 15;
+		frame.puffiness = i >= numFrames * 3 / 4 ? 2.0f : 0.0f;
+	}
+}
+
+static bool SameInputs( const FrameInputs& a, const FrameInputs& b )
+{
+	return a.elapsed == b.elapsed && !memcmp( &a.world, &b.world, sizeof( Mat4 ) ) &&
+		   !memcmp( &a.view, &b.view, sizeof( Mat4 ) ) && !memcmp( &a.projection, &b.projection, sizeof( Mat4 ) ) &&
+		   !memcmp( &a.quadView, &b.quadView, sizeof( Mat4 ) ) &&
+		   !memcmp( &a.quadProjection, &b.quadProjection, sizeof( Mat4 ) ) &&
+		   !memcmp( &a.aoView, &b.aoView, sizeof( Mat4 ) ) && !memcmp( &a.aoProjection, &b.aoProjection, sizeof( Mat4 ) ) &&
+		   a.puffiness == b.puffiness && a.ambientOcclusion == b.ambientOcclusion &&
+		   a.textureToRender == b.textureToRender && a.aoTechnique == b.aoTechnique &&
+		   a.horizonDirections == b.horizonDirections && a.horizonSteps == b.horizonSteps && a.width == b.width &&
+		   a.height == b.height;
+}
+
+static bool SameCapture( const FrameCapture& a, const FrameCapture& b )
+{
+	bool same = a.texScale == b.texScale && a.frames.size() == b.frames.size();
+	for( size_t i = 0; same && i < a.frames.size(); ++i )
+		same = SameInputs( a.frames[i], b.frames[i] );
+	return same;
+}
+
+static void CheckFormat( const FrameCapture& capture )
+{
+	vector<unsigned char> bytes;
+	EncodeFrameCapture( capture, bytes );
+	FrameCapture decoded;
+	Check( DecodeFrameCapture( &bytes[0], bytes.size(), decoded ) && SameCapture( capture, decoded ) && !decoded.truncated,
+		   "capture: frames read back bit for bit" );
+
+	// a frame where only the camera moved, then a still one
+	FrameCapture three;
+	three.frames.assign( 3, capture.frames[1] );
+	three.frames[1].view = three.frames[2].view = capture.frames[2].view;
+	vector<unsigned char> sizes[3];
+	for( int n = 0; n < 3; ++n )
+	{
+		FrameCapture first = three;
+		first.frames.resize( n + 1 );
+		EncodeFrameCapture( first, sizes[n] );
+	}
+	size_t moved = sizes[1].size() - sizes[0].size(), still = sizes[2].size() - sizes[1].size();
+	printf( "capture: %u frames in %u bytes (%.1f per frame); camera move %u bytes, still frame %u\n",
+			( unsigned int )capture.frames.size(), ( unsigned int )bytes.size(),
+			( double )bytes.size() / capture.frames.size(), ( unsigned int )moved, ( unsigned int )still );
+	Check( moved <= 64 && still <= 5, "capture: only what changed is stored" );
+
+	Check( DecodeFrameCapture( &bytes[0], bytes.size() - 3, decoded ) && decoded.truncated &&
+		   decoded.frames.size() == capture.frames.size() - 1, "capture: a cut short file keeps its whole frames" );
+	Check( !DecodeFrameCapture( &bytes[0], 8, decoded ), "capture: bad header refused" );
+
+	const char* path = "FrameReplayBench.fcap";
+	FrameCaptureWriter writer;
+	bool ok = writer.Open( path, capture.texScale );
+	for( size_t i = 0; i < capture.frames.size(); ++i )
+		writer.Write( capture.frames[i] );
+	ok = writer.Close() && ok && writer.Bytes() == bytes.size();
+	Check( ok && ReadFrameCapture( path, decoded ) && SameCapture( capture, decoded ), "capture: writer matches the encoder" );
+	remove( path );
+}
+
+//--------------------------------------------------------------------------------------
+// Bench
+//--------------------------------------------------------------------------------------
+static int Bench( int numFrames, int width, int height )
+{
+	FrameCapture capture;
+	MakeBenchCapture( numFrames, width, height, capture );
+	CheckFormat( capture );
+
+	CpuMesh mesh;
+	MakeBenchScene( mesh );
+	int hardware = max( 1, ( int )thread::hardware_concurrency() );
+	ReplayOptions options;
+	ReplayResult serial, parallel;
+	{
+		JobSystem jobs( 1 );
+		ReplayCapture( jobs, mesh, capture, options, serial );
+	}
+	bool same = true;
+	{
+		JobSystem jobs( max( 4, hardware ) );
+		options.repeat = 2;
+		string error;
+		same = ReplayCapture( jobs, mesh, capture, options, parallel, &error );
+		if( !same )
+			printf( "%s\n", error.c_str() );
+	}
+	for( size_t i = 0; same && i < serial.frames.size(); ++i )
+		same = serial.frames[i].hash == parallel.frames[i].hash;
+	Check( same && serial.frames.size() == capture.frames.size(), "replay renders the same on any number of workers" );
+	unsigned int distinct = 0;
+	for( size_t i = 1; i < serial.frames.size(); ++i )
+		distinct += serial.frames[i].hash != serial.frames[i - 1].hash;
+	Check( distinct > serial.frames.size() / 2, "frames follow the captured camera" );
+
+	// timing files and the diff
+	const char* basePath = "FrameReplayBench_base.csv";
+	vector<string> header( 1, "bench capture" );
+	vector<ReplayFrame> base, current;
+	bool ok = WriteReplayTimings( basePath, serial, header ) && ReadReplayTimings( basePath, base );
+	for( size_t i = 0; ok && i < base.size(); ++i )
+		ok = base[i].hash == serial.frames[i].hash && fabs( base[i].totalMs - serial.frames[i].totalMs ) < 1e-3;
+	Check( ok && base.size() == serial.frames.size(), "timings read back" );
+	remove( basePath );
+
+	ReplayDiff diff;
+	DiffReplayTimings( base, base, 5.0, 0.0, diff );
+	Check( !diff.regressed && !diff.imageMismatches && diff.pass[REPLAY_GBUFFER].change == 0.0, "diff: a build against itself" );
+	current = base;
+	for( size_t i = 0; i < current.size(); ++i )
+	{
+		current[i].passMs[REPLAY_GBUFFER] *= 1.2;
+		current[i].totalMs += base[i].passMs[REPLAY_GBUFFER] * 0.2;
+	}
+	current[3].passMs[REPLAY_COMPOSITE] += 1000.0;		// one slow frame doesn't move the median
+	current[5].hash ^= 1;
+	DiffReplayTimings( base, current, 5.0, 0.0, diff );
+	Check( diff.regressed && diff.pass[REPLAY_GBUFFER].regressed && !diff.pass[REPLAY_AO].regressed &&
+		   !diff.pass[REPLAY_COMPOSITE].regressed && diff.pass[REPLAY_COMPOSITE].worstFrame == 3 &&
+		   diff.imageMismatches == 1, "diff: finds the slow pass, frame and changed image" );
+	printf( "\n" );
+	PrintDiff( diff, 5.0 );
+
+	// at the recorded cadence: never ahead of the capture
+	printf( "\n" );
+	{
+		JobSystem jobs( hardware );
+		ReplayOptions realtime;
+		realtime.realtime = true;
+		realtime.maxFrames = min( numFrames, 30 );
+		ReplayResult result;
+		ReplayCapture( jobs, mesh, capture, realtime, result );
+		double recorded = result.frames.back().time * 1000.0;
+		printf( "realtime: %u frames in %.1f ms, recorded %.1f ms, %u late\n", ( unsigned int )result.frames.size(),
+				result.wallMs, recorded, result.lateFrames );
+		Check( result.wallMs >= recorded, "realtime replay keeps the recorded cadence" );
+	}
+
+	printf( "\nas fast as possible, %d workers:\n", hardware );
+	{
+		JobSystem jobs( hardware );
+		ReplayResult result;
+		ReplayCapture( jobs, mesh, capture, ReplayOptions(), result );
+		PrintReplay( result );
+	}
+	printf( "\n" );
+	return failures ? 1 : 0;
+}
+
+static int Diff( const char* basePath, const char* newPath, double thresholdPercent, double minMs )
+{
+	vector<ReplayFrame> base, current;
+	string error;
+	if( !ReadReplayTimings( basePath, base, &error ) || !ReadReplayTimings( newPath, current, &error ) )
+	{
+		fprintf( stderr, "%s\n", error.c_str() );
+		return 1;
+	}
+	if( base.size() != current.size() )
+		printf( "%u and %u frames: comparing the first %u\n", ( unsigned int )base.size(), ( unsigned int )current.size(),
+				( unsigned int )min( base.size(), current.size() ) );
+	ReplayDiff diff;
+	DiffReplayTimings( base, current, thresholdPercent, minMs, diff );
+	PrintDiff( diff, thresholdPercent );
+	return diff.regressed || diff.imageMismatches ? 1 : 0;
+}
+
+static int Usage()
+{
+	fprintf( stderr, "usage: FrameReplay capture.fcap mesh.sdkmesh [-realtime] [-scale s] [-repeat n] [-workers n] [-o timings.csv]\n"
+					 "       FrameReplay -diff base.csv new.csv [threshold %% [min ms]]\n"
+					 "       FrameReplay -bench [frames [width height]]\n" );
+	return 1;
+}
+
+int main( int argc, char* argv[] )
+{
+	if( argc >= 2 && strcmp( argv[1], "-bench" ) == 0 )
+	{
+		int frames = argc >= 3 ? atoi( argv[2] ) : 64;
+		int width = argc >= 5 ? atoi( argv[3] ) : 320;
+		int height = argc >= 5 ? atoi( argv[4] ) : 240;
+		if( frames < 8 || width <= 0 || height <= 0 )
+			return Usage();
+		return Bench( frames, width, height );
+	}
+	if( argc >= 4 && strcmp( argv[1], "-diff" ) == 0 )
+		return Diff( argv[2], argv[3], argc >= 5 ? atof( argv[4] ) : 5.0, argc >= 6 ? atof( argv[5] ) : 0.05 );
+	if( argc < 3 || argv[1][0] == '-' )
+		return Usage();
+
+	ReplayOptions options;
+	int workers = 0;
+	string output;
+	for( int i = 3; i < argc; ++i )
+	{
+		if( !strcmp( argv[i], "-realtime" ) )
+			options.realtime = true;
+		else if( !strcmp( argv[i], "-scale" ) && i + 1 < argc )
+			options.scale = ( float )atof( argv[++i] );
+		else if( !strcmp( argv[i], "-repeat" ) && i + 1 < argc )
+			options.repeat = atoi( argv[++i] );
+		else if( !strcmp( argv[i], "-workers" ) && i + 1 < argc )
+			workers = atoi( argv[++i] );
+		else if( !strcmp( argv[i], "-o" ) && i + 1 < argc )
+			output = argv[++i];
+		else
+			return Usage();
+	}
+
+	FrameCapture capture;
+	CpuMesh mesh;
+	string error;
+	int missing = 0;
+	if( !ReadFrameCapture( argv[1], capture, &error ) || !LoadCpuMesh( argv[2], mesh, &error, &missing ) )
+	{
+		fprintf( stderr, "%s\n", error.c_str() );
+		return 1;
+	}
+	printf( "%s: %u frames%s, %u triangles (%d textures missing)\n", argv[1], ( unsigned int )capture.frames.size(),
+			capture.truncated ? " (cut short)" : "", ( unsigned int )( mesh.indices.size() / 3 ), missing );
+
+	JobSystem jobs( workers );
+	ReplayResult result;
+	if( !ReplayCapture( jobs, mesh, capture, options, result, &error ) )
+	{
+		fprintf( stderr, "%s\n", error.c_str() );
+		return 1;
+	}
+	PrintReplay( result );
+	if( output.empty() )
+		return 0;
+
+	char line[256];
+	vector<string> header;
+	header.push_back( string( "capture " ) + argv[1] + ", mesh " + argv[2] );
+	snprintf( line, sizeof( line ), "%dx%d, %d workers, %s, fastest of %d", result.width, result.height, jobs.NumWorkers(),
+			  options.realtime ? "realtime" : "as fast as possible", max( options.repeat, 1 ) );
+	header.push_back( line );
+	if( !WriteReplayTimings( output, result, header, &error ) )
+	{
+		fprintf( stderr, "%s\n", error.c_str() );
+		return 1;
+	}
+	return 0;
+}
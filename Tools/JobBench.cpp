@@ -0,0 +1,291 @@
+//--------------------------------------------------------------------------------------
+// File: JobBench.cpp
+//
+// Throughput and latency of the job system against the number of workers: empty jobs,
+// the CPU AO layers and composite bands as parallel loops, the delay from queueing a
+// job to its start, and whole frames (G-buffer -> AO -> composite) run through the
+// frame pipeline with 1, 2 and 3 frames in flight. Checks the loops, nesting and the
+// pipeline's ordering first.
+// Usage: JobBench [max workers [width height [frames]]]
+//--------------------------------------------------------------------------------------
+#include "../Portable/CpuPasses.h"
+#include "../Portable/JobSystem.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace std;
+
+typedef chrono::high_resolution_clock Clock;
+
+static int failures = 0;
+static int width = 512;
+static int height = 384;
+static CpuFloat2 rotations[CPU_NUMLAYERS];
+
+static double Milliseconds( const Clock::time_point& start )
+{
+	return chrono::duration<double, milli>( Clock::now() - start ).count();
+}
+
+static void Check( bool ok, const char* what )
+{
+	printf( "%-56s %s\n", what, ok ? "ok" : "FAILED" );
+	if( !ok )
+		++failures;
+}
+
+//--------------------------------------------------------------------------------------
+// Checks
+//--------------------------------------------------------------------------------------
+static void CountIndices( void* data, int begin, int end )
+{
+	atomic<int>* hits = ( atomic<int>* )data;
+	for( int i = begin; i < end; ++i )
+		++hits[i];
+}
+
+struct Nested
+{
+	JobSystem*			jobs;
+	vector<atomic<int> >*	hits;
+};
+
+// every outer index runs an inner loop of 100 and waits for it
+static void OuterLoop( void* data, int begin, int end )
+{
+	Nested& nested = *( Nested* )data;
+	for( int i = begin; i < end; ++i )
+	{
+		JobCounter counter;
+		nested.jobs->ParallelFor( i * 100, i * 100 + 100, 7, CountIndices, &( *nested.hits )[0], &counter );
+		nested.jobs->Wait( counter );
+	}
+}
+
+// the pipeline's ordering: stage k of frame n after stage k - 1 of frame n and stage k of frame n - 1
+static atomic<int> orderSequence( 0 );
+static atomic<int> orderErrors( 0 );
+static int stageSeen[3];
+
+struct OrderFrame
+{
+	int		stamp[3];
+};
+
+static void OrderStage( int stage, void* frame, unsigned int index )
+{
+	OrderFrame& f = *( OrderFrame* )frame;
+	if( stage > 0 && f.stamp[stage - 1] < 0 )
+		++orderErrors;
+	if( stageSeen[stage] != ( int )index - 1 )
+		++orderErrors;
+	stageSeen[stage] = index;
+	this_thread::sleep_for( chrono::microseconds( 200 * ( 3 - stage ) ) );
+	f.stamp[stage] = orderSequence++;
+}
+
+static void OrderStage0( JobSystem&, void* frame, unsigned int index ) { OrderStage( 0, frame, index ); }
+static void OrderStage1( JobSystem&, void* frame, unsigned int index ) { OrderStage( 1, frame, index ); }
+static void OrderStage2( JobSystem&, void* frame, unsigned int index ) { OrderStage( 2, frame, index ); }
+
+//--------------------------------------------------------------------------------------
+// Work
+//--------------------------------------------------------------------------------------
+static void EmptyJob( void*, int, int ) {}
+
+struct Frame
+{
+	CpuGBuffer				gbuffer;
+	CpuAOLayers				layers;
+	vector<float>			ao;
+	vector<CpuFloat4>		out;
+};
+
+static void AOLayers( void* data, int begin, int end )
+{
+	Frame& frame = *( Frame* )data;
+	for( int layer = begin; layer < end; ++layer )
+		ComputeAOLayer( frame.gbuffer, CpuAOParams(), rotations, frame.layers, layer );
+}
+
+static void CompositeBands( void* data, int begin, int end )
+{
+	Frame& frame = *( Frame* )data;
+	const CpuFloat3 lightPos = { 0.0f, -3.0f, -4.0f };
+	SelectComposite( VIEW_COMPOSITE, true )( frame.gbuffer, frame.ao, lightPos, begin, end, frame.out );
+}
+
+static void GBufferStage( JobSystem&, void* data, unsigned int )
+{
+	Frame& frame = *( Frame* )data;
+	MakeTestGBuffer( frame.gbuffer, width, height );
+	frame.out.resize( width * height );
+}
+
+static void AOStage( JobSystem& jobs, void* data, unsigned int )
+{
+	Frame& frame = *( Frame* )data;
+	DeinterleaveGBuffer( frame.gbuffer, frame.layers );
+	JobCounter counter;
+	jobs.ParallelFor( 0, CPU_NUMLAYERS, 1, AOLayers, &frame, &counter );
+	jobs.Wait( counter );
+	ReinterleaveAO( frame.gbuffer, frame.layers, frame.ao );
+}
+
+static void CompositeStage( JobSystem& jobs, void* data, unsigned int )
+{
+	Frame& frame = *( Frame* )data;
+	JobCounter counter;
+	jobs.ParallelFor( 0, height, 16, CompositeBands, &frame, &counter );
+	jobs.Wait( counter );
+}
+
+struct Latency
+{
+	Clock::time_point	queued;
+	double				ms;
+};
+
+static void StampLatency( void* data, int, int )
+{
+	Latency& latency = *( Latency* )data;
+	latency.ms = Milliseconds( latency.queued );
+}
+
+int main( int argc, char* argv[] )
+{
+	int maxWorkers = 64;
+	int frames = 12;
+	if( argc >= 2 )
+		maxWorkers = atoi( argv[1] );
+	if( argc >= 4 )
+	{
+		width = atoi( argv[2] );
+		height = atoi( argv[3] );
+	}
+	if( argc >= 5 )
+		frames = atoi( argv[4] );
+	if( maxWorkers <= 0 || width <= 0 || height <= 0 || frames <= 0 )
+	{
+		fprintf( stderr, "usage: JobBench [max workers [width height [frames]]]\n" );
+		return 1;
+	}
+	MakeRotationTable( rotations, 1 );
+
+	{
+		JobSystem jobs( 4 );
+		vector<atomic<int> > hits( 100000 );
+		for( size_t i = 0; i < hits.size(); ++i )
+			hits[i] = 0;
+		JobCounter counter;
+		jobs.ParallelFor( 0, ( int )hits.size(), 13, CountIndices, &hits[0], &counter );
+		jobs.Wait( counter );
+		bool once = true;
+		for( size_t i = 0; i < hits.size(); ++i )
+			once = once && hits[i] == 1;
+		Check( once, "parallel loop runs every index once" );
+
+		for( size_t i = 0; i < hits.size(); ++i )
+			hits[i] = 0;
+		Nested nested = { &jobs, &hits };
+		jobs.ParallelFor( 0, 1000, 3, OuterLoop, &nested, &counter );
+		jobs.Wait( counter );
+		once = true;
+		for( size_t i = 0; i < hits.size(); ++i )
+			once = once && hits[i] == 1;
+		Check( once, "nested loops waiting inside jobs" );
+
+		for( int i = 0; i < 3; ++i )
+			stageSeen[i] = -1;
+		vector<FrameStageFunc> stages;
+		stages.push_back( OrderStage0 );
+		stages.push_back( OrderStage1 );
+		stages.push_back( OrderStage2 );
+		vector<OrderFrame> orderFrames( 3 );
+		{
+			FramePipeline pipeline( jobs, stages, 3 );
+			for( int n = 0; n < 30; ++n )
+			{
+				pipeline.WaitForSlot();			// frame n - 3 is done with the data
+				for( int s = 0; s < 3; ++s )
+					orderFrames[n % 3].stamp[s] = -1;
+				pipeline.Submit( &orderFrames[n % 3] );
+			}
+			pipeline.Flush();
+			Check( pipeline.GetStats().frames == 30, "pipeline completes every frame" );
+		}
+		Check( orderErrors == 0, "pipeline keeps stage and frame order" );
+	}
+
+	printf( "\n%dx%d, %d hardware threads\n\n", width, height, ( int )thread::hardware_concurrency() );
+	printf( "%8s %12s %10s %10s %10s %10s %10s %10s %10s\n", "workers", "jobs M/s", "AO ms", "comp ms",
+			"start p50", "start p99", "1 fps", "2 fps", "3 fps" );
+	printf( "%8s %12s %10s %10s %10s %10s %10s %10s %10s\n", "", "", "", "", "us", "us", "", "", "" );
+
+	vector<double> latencyMs[4];
+	for( int workers = 1; workers <= maxWorkers; workers *= 2 )
+	{
+		JobSystem jobs( workers );
+
+		// empty jobs queued one by one from the main thread
+		const int emptyJobs = 200000;
+		Clock::time_point start = Clock::now();
+		JobCounter counter;
+		for( int i = 0; i < emptyJobs; ++i )
+			jobs.Run( EmptyJob, NULL, 0, 0, &counter );
+		jobs.Wait( counter );
+		double emptyMs = Milliseconds( start );
+
+		// the parallel passes of one frame
+		Frame frame;
+		GBufferStage( jobs, &frame, 0 );
+		double aoMs = 1e30, compositeMs = 1e30;
+		for( int run = 0; run < 3; ++run )
+		{
+			start = Clock::now();
+			AOStage( jobs, &frame, 0 );
+			aoMs = min( aoMs, Milliseconds( start ) );
+			start = Clock::now();
+			CompositeStage( jobs, &frame, 0 );
+			compositeMs = min( compositeMs, Milliseconds( start ) );
+		}
+
+		// queue -> start, with the workers idle in between
+		vector<double> delays;
+		for( int i = 0; i < 200; ++i )
+		{
+			this_thread::sleep_for( chrono::microseconds( 300 ) );
+			Latency latency;
+			latency.queued = Clock::now();
+			jobs.Run( StampLatency, &latency, 0, 0, &counter );
+			jobs.Wait( counter );
+			delays.push_back( latency.ms * 1000.0 );
+		}
+		sort( delays.begin(), delays.end() );
+
+		// whole frames through the pipeline
+		double fps[3];
+		for( int inFlight = 1; inFlight <= 3; ++inFlight )
+		{
+			vector<Frame> frameData( inFlight );
+			vector<FrameStageFunc> stages;
+			stages.push_back( GBufferStage );
+			stages.push_back( AOStage );
+			stages.push_back( CompositeStage );
+			FramePipeline pipeline( jobs, stages, inFlight );
+			start = Clock::now();
+			for( int n = 0; n < frames; ++n )
+				pipeline.Submit( &frameData[n % inFlight] );
+			pipeline.Flush();
+			fps[inFlight - 1] = frames * 1000.0 / Milliseconds( start );
+		}
+
+		printf( "%8d %12.2f %10.2f %10.2f %10.1f %10.1f %10.1f %10.1f %10.1f\n", workers,
+				emptyJobs / ( emptyMs * 1000.0 ), aoMs, compositeMs,
+				delays[delays.size() / 2], delays[delays.size() * 99 / 100], fps[0], fps[1], fps[2] );
+	}
+	return failures ? 1 : 0;
+}
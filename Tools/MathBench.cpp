@@ -0,0 +1,204 @@
+//--------------------------------------------------------------------------------------
+// File: MathBench.cpp
+//
+// Checks SimdMath.h against straightforward scalar math (inverses, quaternions, the
+// batch transforms) and times the batch transform and the inverses.
+// Build it with -DSIMDMATH_SCALAR, -mavx or for ARM to compare the backends.
+// Usage: MathBench [points [runs]]
+//--------------------------------------------------------------------------------------
+#include "../Portable/SimdMath.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace std;
+
+static int failures = 0;
+static volatile float sink = 0.0f;		// keeps the timed loops from being optimized out
+
+static double Milliseconds( const chrono::high_resolution_clock::time_point& start )
+{
+	return chrono::duration<double, milli>( chrono::high_resolution_clock::now() - start ).count();
+}
+
+static void Check( bool ok, const char* what )
+{
+	printf( "%-56s %s\n", what, ok ? "ok" : "FAILED" );
+	if( !ok )
+		++failures;
+}
+
+static float Random( unsigned int& state )
+{
+	state = state * 1664525u + 1013904223u;
+	return ( state >> 8 ) * ( 1.0f / 16777216.0f ) * 2.0f - 1.0f;
+}
+
+static float MaxDifference( const Mat4& a, const Mat4& b )
+{
+	float d = 0.0f;
+	for( int i = 0; i < 4; ++i )
+		for( int j = 0; j < 4; ++j )
+			d = max( d, fabsf( a.m[i][j] - b.m[i][j] ) );
+	return d;
+}
+
+// A world-like matrix: rotation, non-uniform scale, translation
+static Mat4 RandomAffine( unsigned int& state )
+{
+	Quat q = QuatNormalize( MakeQuat( Random( state ), Random( state ), Random( state ), Random( state ) ) );
+	return Mat4Scaling( 1.5f + Random( state ), 1.5f + Random( state ), 1.5f + Random( state ) ) *
+		   Mat4RotationQuat( q ) * Mat4Translation( Random( state ) * 100.0f, Random( state ) * 100.0f, Random( state ) * 100.0f );
+}
+
+int main( int argc, char* argv[] )
+{
+	size_t points = 1 << 20;
+	int runs = 10;
+	if( argc >= 2 )
+		points = ( size_t )atoi( argv[1] );
+	if( argc >= 3 )
+		runs = atoi( argv[2] );
+	if( points == 0 || runs <= 0 )
+	{
+		fprintf( stderr, "usage: MathBench [points [runs]]\n" );
+		return 1;
+	}
+	printf( "SimdMath backend: %s\n\n", SIMDMATH_BACKEND );
+
+	unsigned int state = 1;
+
+	// products against a plain triple loop
+	{
+		Mat4 a = RandomAffine( state ), b = Mat4PerspectiveFovLH( 0.785f, 4.0f / 3.0f, 2.0f, 4000.0f ), expected;
+		for( int i = 0; i < 4; ++i )
+			for( int j = 0; j < 4; ++j )
+			{
+				expected.m[i][j] = 0.0f;
+				for( int k = 0; k < 4; ++k )
+					expected.m[i][j] += a.m[i][k] * b.m[k][j];
+			}
+		Check( MaxDifference( a * b, expected ) < 1e-3f, "Mat4 product" );
+		Mat4 t = Mat4Transpose( a );
+		Check( t.m[1][0] == a.m[0][1] && t.m[3][2] == a.m[2][3] && t.m[0][3] == a.m[3][0], "transpose" );
+	}
+
+	// inverses
+	{
+		bool general = true, affine = true;
+		for( int i = 0; i < 100; ++i )
+		{
+			Mat4 a = RandomAffine( state ), inv;
+			general = general && Mat4Inverse( a, inv ) && MaxDifference( a * inv, Mat4Identity() ) < 1e-4f;
+			affine = affine && MaxDifference( a * Mat4AffineInverse( a ), Mat4Identity() ) < 1e-4f;
+		}
+		Mat4 proj = Mat4PerspectiveFovLH( 0.785f, 4.0f / 3.0f, 2.0f, 4000.0f ), inv;
+		general = general && Mat4Inverse( proj, inv ) && MaxDifference( proj * inv, Mat4Identity() ) < 1e-4f;
+		Check( general, "general inverse (worlds and a projection)" );
+		Check( affine, "affine inverse" );
+		Check( !Mat4Inverse( Mat4Scaling( 1.0f, 0.0f, 1.0f ), inv ), "singular matrix is rejected" );
+
+		Vec3 eye = MakeVec3( 0.0f, 0.0f, -800.0f ), at = MakeVec3( 0.0f, 0.0f, 0.0f ), up = MakeVec3( 0.0f, 1.0f, 0.0f );
+		Mat4 view = Mat4LookAtLH( eye, at, up );
+		Vec3 origin = Vec3TransformCoord( MakeVec3( 0.0f, 0.0f, 0.0f ), Mat4AffineInverse( view ) );
+		Check( Vec3Length( origin - eye ) < 1e-3f, "inverse view puts the camera at the eye" );
+	}
+
+	// quaternions
+	{
+		bool matrix = true, roundTrip = true, rotate = true;
+		for( int i = 0; i < 100; ++i )
+		{
+			Quat a = QuatNormalize( MakeQuat( Random( state ), Random( state ), Random( state ), Random( state ) ) );
+			Quat b = QuatNormalize( MakeQuat( Random( state ), Random( state ), Random( state ), Random( state ) ) );
+			matrix = matrix && MaxDifference( Mat4RotationQuat( QuatMultiply( a, b ) ),
+											  Mat4RotationQuat( a ) * Mat4RotationQuat( b ) ) < 1e-4f;
+			Quat c = QuatFromMat4( Mat4RotationQuat( a ) );
+			roundTrip = roundTrip && fabsf( fabsf( QuatDot( a, c ) ) - 1.0f ) < 1e-4f;
+			Vec3 v = MakeVec3( Random( state ), Random( state ), Random( state ) );
+			rotate = rotate && Vec3Length( QuatRotate( v, a ) - Vec3TransformNormal( v, Mat4RotationQuat( a ) ) ) < 1e-4f;
+		}
+		Check( matrix, "QuatMultiply matches the matrix product" );
+		Check( roundTrip, "quaternion -> matrix -> quaternion" );
+		Check( rotate, "QuatRotate matches the matrix" );
+		Check( MaxDifference( Mat4RotationQuat( QuatRotationAxis( MakeVec3( 0, 0, 1 ), 1.0f ) ), Mat4RotationZ( 1.0f ) ) < 1e-5f,
+			   "axis rotation matches Mat4RotationZ" );
+		Quat a = QuatRotationAxis( MakeVec3( 0, 1, 0 ), 0.2f ), b = QuatRotationAxis( MakeVec3( 0, 1, 0 ), 1.4f );
+		Quat half = QuatSlerp( a, b, 0.5f ), expected = QuatRotationAxis( MakeVec3( 0, 1, 0 ), 0.8f );
+		Check( fabsf( QuatDot( half, expected ) - 1.0f ) < 1e-5f && fabsf( QuatDot( QuatSlerp( a, b, 0.0f ), a ) - 1.0f ) < 1e-5f,
+			   "slerp" );
+	}
+
+	// batch transforms
+	vector<Vec3> in( points ), out( points ), reference( points );
+	vector<Vec4> out4( points );
+	for( size_t i = 0; i < points; ++i )
+		in[i] = MakeVec3( Random( state ) * 100.0f, Random( state ) * 100.0f, Random( state ) * 100.0f );
+	Mat4 world = RandomAffine( state );
+	{
+		TransformPointsAffine( world, &in[0], &out[0], points );
+		TransformPointsAffineScalar( world, &in[0], &reference[0], points );
+		TransformPoints( world, &in[0], &out4[0], points );
+		float d = 0.0f, d4 = 0.0f;
+		for( size_t i = 0; i < points; ++i )
+		{
+			d = max( d, Vec3Length( out[i] - reference[i] ) );
+			d4 = max( d4, Vec3Length( MakeVec3( out4[i].x, out4[i].y, out4[i].z ) - reference[i] ) + fabsf( out4[i].w - 1.0f ) );
+		}
+		Check( d < 1e-3f, "TransformPointsAffine matches the scalar loop" );
+		Check( d4 < 1e-3f, "TransformPoints matches the scalar loop" );
+	}
+
+	// timings, best of n runs
+	double scalarMs = 1e30, simdMs = 1e30, pointsMs = 1e30;
+	for( int run = 0; run < runs; ++run )
+	{
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		TransformPointsAffineScalar( world, &in[0], &reference[0], points );
+		scalarMs = min( scalarMs, Milliseconds( start ) );
+		start = chrono::high_resolution_clock::now();
+		TransformPointsAffine( world, &in[0], &out[0], points );
+		simdMs = min( simdMs, Milliseconds( start ) );
+		start = chrono::high_resolution_clock::now();
+		TransformPoints( world, &in[0], &out4[0], points );
+		pointsMs = min( pointsMs, Milliseconds( start ) );
+		sink = sink + reference[run % points].x + out[run % points].x + out4[run % points].w;
+	}
+
+	const int matrices = 1 << 10;		// stays in cache: times the math, not memory
+	vector<Mat4> worlds( matrices ), inverses( matrices );
+	for( int i = 0; i < matrices; ++i )
+		worlds[i] = RandomAffine( state );
+	double generalMs = 1e30, affineMs = 1e30, productMs = 1e30;
+	for( int run = 0; run < runs; ++run )
+	{
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		for( int repeat = 0; repeat < 64; ++repeat )
+			for( int i = 0; i < matrices; ++i )
+				Mat4Inverse( worlds[i], inverses[i] );
+		generalMs = min( generalMs, Milliseconds( start ) );
+		start = chrono::high_resolution_clock::now();
+		for( int repeat = 0; repeat < 64; ++repeat )
+			for( int i = 0; i < matrices; ++i )
+				inverses[i] = Mat4AffineInverse( worlds[i] );
+		affineMs = min( affineMs, Milliseconds( start ) );
+		start = chrono::high_resolution_clock::now();
+		for( int repeat = 0; repeat < 64; ++repeat )
+			for( int i = 0; i < matrices; ++i )
+				inverses[i] = worlds[i] * world;
+		productMs = min( productMs, Milliseconds( start ) );
+		sink = sink + inverses[run].m[3][0];
+	}
+
+	printf( "\n%-36s %10s %12s\n", "", "ms", "M/s" );
+	printf( "%-36s %10.2f %12.1f\n", "transform points, scalar", scalarMs, points / ( scalarMs * 1000.0 ) );
+	printf( "%-36s %10.2f %12.1f\n", "transform points, affine", simdMs, points / ( simdMs * 1000.0 ) );
+	printf( "%-36s %10.2f %12.1f\n", "transform points, to Vec4", pointsMs, points / ( pointsMs * 1000.0 ) );
+	printf( "%-36s %10.2f %12.1f\n", "Mat4 product", productMs, matrices * 64 / ( productMs * 1000.0 ) );
+	printf( "%-36s %10.2f %12.1f\n", "Mat4Inverse", generalMs, matrices * 64 / ( generalMs * 1000.0 ) );
+	printf( "%-36s %10.2f %12.1f\n", "Mat4AffineInverse", affineMs, matrices * 64 / ( affineMs * 1000.0 ) );
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,398 @@
+//--------------------------------------------------------------------------------------
+// File: MsaaBench.cpp
+//
+// Measures the edge-aware MSAA mode (see Portable/MsaaShading.h) against the TEXSCALE
+// supersampling it replaces, on the CPU. It checks the multisampled rasterizer and the
+// edge pass, then renders a synthetic scene (or a mesh seen from the sample's starting
+// camera) in several modes: no anti-aliasing, TEXSCALE 2, MSAA shading edges per
+// sample, and MSAA shading every sample. For each mode it counts the shader
+// invocations of every pass and measures the error to a 4x4 supersampled reference.
+// Usage: MsaaBench [width height] [-mesh m.sdkmesh] [-samples 2|4|8] [-runs n]
+//--------------------------------------------------------------------------------------
+#include "../Portable/BatchRender.h"
+#include "../Portable/MsaaShading.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+typedef chrono::high_resolution_clock Clock;
+
+static int failures = 0;
+
+static double Milliseconds( const Clock::time_point& start )
+{
+	return chrono::duration<double, milli>( Clock::now() - start ).count();
+}
+
+static void Check( bool ok, const char* what )
+{
+	printf( "%-56s %s\n", what, ok ? "ok" : "FAILED" );
+	if( !ok )
+		++failures;
+}
+
+//--------------------------------------------------------------------------------------
+// Synthetic scene: spheres in front of a big one, which is the ground
+//--------------------------------------------------------------------------------------
+static void AddSphere( CpuMesh& mesh, float cx, float cy, float cz, float radius, int rows, int columns )
+{
+	CpuMesh::Subset subset = { ( unsigned int )mesh.indices.size(), 0, ( unsigned int )mesh.vertices.size(), 0 };
+	for( int y = 0; y <= rows; ++y )
+		for( int x = 0; x <= columns; ++x )
+		{
+			float theta = 3.14159265f * y / rows, phi = 2.0f * 3.14159265f * x / columns;
+			FloatVertex v;
+			v.normal[0] = sinf( theta ) * cosf( phi );
+			v.normal[1] = cosf( theta );
+			v.normal[2] = sinf( theta ) * sinf( phi );
+			v.pos[0] = cx + v.normal[0] * radius;
+			v.pos[1] = cy + v.normal[1] * radius;
+			v.pos[2] = cz + v.normal[2] * radius;
+			v.uv[0] = 4.0f * x / columns;
+			v.uv[1] = 2.0f * y / rows;
+			mesh.vertices.push_back( v );
+		}
+	for( int y = 0; y < rows; ++y )
+		for( int x = 0; x < columns; ++x )
+		{
+			unsigned int i = y * ( columns + 1 ) + x, below = i + columns + 1;
+			unsigned int quad[6] = { i, i + 1, below, i + 1, below + 1, below };
+			mesh.indices.insert( mesh.indices.end(), quad, quad + 6 );
+		}
+	subset.indexCount = ( unsigned int )mesh.indices.size() - subset.indexStart;
+	mesh.subsets.push_back( subset );
+}
+
+static void MakeBenchScene( CpuMesh& mesh )
+{
+	mesh = CpuMesh();
+	mesh.textures.resize( 1 );
+	CpuTexture& texture = mesh.textures[0];
+	texture.width = texture.height = 64;
+	texture.texels.resize( 64 * 64 );
+	for( int y = 0; y < 64; ++y )
+		for( int x = 0; x < 64; ++x )
+			texture.texels[y * 64 + x] = ( ( x / 8 ) ^ ( y / 8 ) ) & 1 ? CpuFloat4{ 0.9f, 0.5f, 0.3f, 1.0f }
+																		: CpuFloat4{ 0.7f, 0.6f, 0.5f, 1.0f };
+	AddSphere( mesh, 0.0f, 50.0f, 0.0f, 100.0f, 48, 96 );
+	AddSphere( mesh, -200.0f, 90.0f, 60.0f, 60.0f, 24, 48 );
+	AddSphere( mesh, 190.0f, 20.0f, -120.0f, 35.0f, 16, 32 );
+	AddSphere( mesh, 0.0f, 4150.0f, 0.0f, 4000.0f, 48, 96 );		// the ground, seen from outside
+}
+
+static BatchView MakeView( int width, int height )
+{
+	vector<BatchView> views;
+	ParseBatch( "size " + to_string( width ) + " " + to_string( height ) + "\ncamera 0 -150 -700 0 0 0\n", views );
+	return views[0];
+}
+
+//--------------------------------------------------------------------------------------
+// One frame in every mode
+//--------------------------------------------------------------------------------------
+struct Mode
+{
+	const char*	name;
+	int			scale;			// supersampling (TEXSCALE)
+	int			samples;		// MSAA, 1 for none
+	bool		everySample;	// shade every sample, not just the edges'
+};
+
+struct ModeResult
+{
+	CpuMsaaCounts		counts;			// composite per output pixel for supersampling
+	unsigned long long	gbufferShaded;	// G-buffer pixel shader invocations
+	double				gbufferMs, aoMs, compositeMs;
+	vector<CpuFloat4>	color;			// at the output size
+};
+
+static const CpuFloat3 lightPos = { 0.0f, -3.0f, -4.0f };	// vLightPos
+
+static void RenderMode( const CpuMesh& mesh, int width, int height, const Mode& mode, bool useAO, ModeResult& result )
+{
+	BatchView view = MakeView( width * mode.scale, height * mode.scale );
+	CpuCamera camera = MakeBatchCamera( view );
+	const int w = view.width, h = view.height;
+	CpuFloat2 rotations[CPU_NUMLAYERS];
+	MakeRotationTable( rotations, 1 );
+	CpuRasterScratch scratch;
+	CpuRasterStats raster;
+	memset( &raster, 0, sizeof( raster ) );
+	vector<float> ao, blur;
+	const int blurStep = max( 1, ( h + 384 ) / 768 );
+	result.counts = CpuMsaaCounts();
+
+	if( mode.samples == 1 )
+	{
+		Clock::time_point start = Clock::now();
+		CpuGBuffer gbuffer;
+		RenderGBuffer( mesh, camera, w, h, scratch, gbuffer, &raster );
+		result.gbufferMs = Milliseconds( start );
+
+		start = Clock::now();
+		if( useAO )
+		{
+			ComputeAO( gbuffer, CpuAOParams(), rotations, ao );
+			BlurAO( w, h, blurStep, ao, blur );
+			for( size_t i = 0; i < gbuffer.viewZ.size(); ++i )
+				result.counts.aoShaded += gbuffer.viewZ[i] != 0.0f;
+		}
+		result.aoMs = Milliseconds( start );
+
+		start = Clock::now();
+		vector<CpuFloat4> color( ( size_t )w * h );
+		CompositeBranching( gbuffer, ao, lightPos, VIEW_COMPOSITE, useAO, 0, h, color );
+		result.counts.pixels = result.counts.compositeShaded = ( unsigned long long )w * h;
+		if( mode.scale > 1 )
+			DownsampleBox( width, height, mode.scale, color, result.color );
+		else
+			result.color.swap( color );
+		result.compositeMs = Milliseconds( start );
+	}
+	else
+	{
+		Clock::time_point start = Clock::now();
+		CpuMsaaGBuffer gbuffer;
+		RenderGBufferMsaa( mesh, camera, w, h, mode.samples, scratch, gbuffer, &raster );
+		vector<unsigned char> edge;
+		DetectEdges( gbuffer, CpuEdgeParams(), 0, h, edge );
+		if( mode.everySample )
+			edge.assign( edge.size(), 1 );
+		result.gbufferMs = Milliseconds( start );
+
+		start = Clock::now();
+		if( useAO )
+		{
+			ComputeAOMsaa( gbuffer, edge, CpuAOParams(), rotations, 0, h, ao, &result.counts );
+			BlurAO( w, h, blurStep, ao, blur );
+		}
+		result.aoMs = Milliseconds( start );
+
+		start = Clock::now();
+		CompositeMsaa( gbuffer, edge, ao, lightPos, VIEW_COMPOSITE, useAO, 0, h, result.color, &result.counts );
+		result.compositeMs = Milliseconds( start );
+	}
+	result.gbufferShaded = raster.pixels;
+}
+
+static double Rmse( const vector<CpuFloat4>& a, const vector<CpuFloat4>& b, const vector<unsigned char>* mask = NULL )
+{
+	double sum = 0.0;
+	size_t count = 0;
+	for( size_t i = 0; i < a.size(); ++i )
+	{
+		if( mask && !( *mask )[i] )
+			continue;
+		double dx = a[i].x - b[i].x, dy = a[i].y - b[i].y, dz = a[i].z - b[i].z;
+		sum += dx * dx + dy * dy + dz * dz;
+		++count;
+	}
+	return count ? sqrt( sum / ( 3.0 * count ) ) : 0.0;
+}
+
+//--------------------------------------------------------------------------------------
+// Checks
+//--------------------------------------------------------------------------------------
+static void RunChecks( const CpuMesh& scene )
+{
+	const int width = 160, height = 120;
+	CpuCamera camera = MakeBatchCamera( MakeView( width, height ) );
+	CpuRasterScratch scratch;
+
+	CpuGBuffer single;
+	RenderGBuffer( scene, camera, width, height, scratch, single );
+	CpuMsaaGBuffer one;
+	RenderGBufferMsaa( scene, camera, width, height, 1, scratch, one );
+	Check( one.plane[0].viewZ == single.viewZ && !memcmp( &one.plane[0].normal[0], &single.normal[0],
+																  single.normal.size() * sizeof( CpuFloat3 ) ),
+		   "1 sample rasterizes like the single-sample G-buffer" );
+
+	// a triangle whose edge is the diagonal of pixel (1, 1) of a 4x4 target: samples 0
+	// and 2 of the 4x pattern are on its side, 1 and 3 aren't
+	CpuMesh corner;
+	FloatVertex vertex = { { 0, 0, 0 }, { 0, 0, -1 }, { 0, 0 } };
+	corner.vertices.assign( 3, vertex );
+	unsigned int indices[3] = { 0, 1, 2 };
+	corner.indices.assign( indices, indices + 3 );
+	CpuMesh::Subset subset = { 0, 3, 0, -1 };
+	corner.subsets.push_back( subset );
+	CpuRasterScratch clip;
+	clip.viewPosition.assign( 3, MakeVec3( 0.0f, 0.0f, 1.0f ) );
+	clip.viewNormal.assign( 3, MakeVec3( 0.0f, 0.0f, -1.0f ) );
+	const float screen[3][2] = { { 3.0f, 0.0f }, { 0.0f, 3.0f }, { -10.0f, -10.0f } };
+	for( int i = 0; i < 3; ++i )
+		clip.clip.push_back( MakeVec4( screen[i][0] / 2.0f - 1.0f, 1.0f - screen[i][1] / 2.0f, 0.5f, 1.0f ) );
+	CpuMsaaGBuffer tiny;
+	tiny.Resize( 4, 4, 4 );
+	CpuRasterStats stats;
+	memset( &stats, 0, sizeof( stats ) );
+	RasterizeRowsMsaa( corner, clip, tiny, 0, 4, &stats );
+	const int pixel = 1 * 4 + 1;
+	Check( tiny.plane[0].viewZ[pixel] != 0.0f && tiny.plane[1].viewZ[pixel] == 0.0f &&
+		   tiny.plane[2].viewZ[pixel] != 0.0f && tiny.plane[3].viewZ[pixel] == 0.0f, "coverage per sample" );
+	unsigned int covered = 0;
+	for( int i = 0; i < 16; ++i )
+	{
+		bool any = false;
+		for( int s = 0; s < 4; ++s )
+			any = any || tiny.plane[s].viewZ[i] != 0.0f;
+		covered += any ? 1 : 0;
+	}
+	Check( stats.pixels == covered, "the pixel shader runs once per pixel, not per sample" );
+	vector<unsigned char> edge;
+	DetectEdges( tiny, CpuEdgeParams(), 0, 4, edge );
+	Check( edge[pixel] && !edge[0], "partly covered pixels are edges, covered ones aren't" );
+
+	// the scene: few edges, and shading only them per sample changes nothing
+	CpuMsaaGBuffer msaa;
+	RenderGBufferMsaa( scene, camera, width, height, 4, scratch, msaa );
+	unsigned int edges = DetectEdges( msaa, CpuEdgeParams(), 0, height, edge );
+	Check( edges > 0 && edges < width * height / 8, "edges are a small part of the scene" );
+	bool interiorsMatch = true;
+	for( int i = 0; i < width * height; ++i )
+		for( int s = 1; s < 4; ++s )
+			if( !edge[i] && fabsf( msaa.plane[s].viewZ[i] - msaa.plane[0].viewZ[i] ) > 0.01f * msaa.plane[0].viewZ[i] )
+				interiorsMatch = false;
+	Check( interiorsMatch, "samples of pixels that aren't edges agree" );
+
+	CpuFloat2 rotations[CPU_NUMLAYERS];
+	MakeRotationTable( rotations, 1 );
+	vector<unsigned char> all( edge.size(), 1 );
+	vector<float> aoEdges, aoAll;
+	vector<CpuFloat4> colorEdges, colorAll;
+	CpuMsaaCounts countEdges, countAll;
+	ComputeAOMsaa( msaa, edge, CpuAOParams(), rotations, 0, height, aoEdges, &countEdges );
+	ComputeAOMsaa( msaa, all, CpuAOParams(), rotations, 0, height, aoAll, &countAll );
+	CompositeMsaa( msaa, edge, aoEdges, lightPos, VIEW_COMPOSITE, true, 0, height, colorEdges, &countEdges );
+	CompositeMsaa( msaa, all, aoAll, lightPos, VIEW_COMPOSITE, true, 0, height, colorAll, &countAll );
+	// samples under the thresholds still differ a little (two triangles of one surface)
+	Check( Rmse( colorEdges, colorAll ) < 0.005, "edge-aware shading is close to shading every sample" );
+	Check( countEdges.compositeShaded == ( unsigned long long )width * height + 3ull * edges &&
+		   countAll.compositeShaded == 4ull * width * height, "composite invocations: 1 per pixel, 4 per edge" );
+	Check( countEdges.aoShaded * 2 < countAll.aoShaded, "AO runs per sample only on edges" );
+}
+
+static int Usage()
+{
+	fprintf( stderr, "usage: MsaaBench [width height] [-mesh m.sdkmesh] [-samples 2|4|8] [-runs n]\n" );
+	return 2;
+}
+
+int main( int argc, char* argv[] )
+{
+	int width = 640, height = 480, samples = 4, runs = 3;
+	const char* meshPath = NULL;
+	int arg = 1;
+	if( argc > 2 && argv[1][0] != '-' )
+	{
+		width = atoi( argv[1] );
+		height = atoi( argv[2] );
+		arg = 3;
+	}
+	for( ; arg < argc; ++arg )
+	{
+		if( arg + 1 >= argc )
+			return Usage();
+		if( !strcmp( argv[arg], "-mesh" ) )
+			meshPath = argv[++arg];
+		else if( !strcmp( argv[arg], "-samples" ) )
+			samples = atoi( argv[++arg] );
+		else if( !strcmp( argv[arg], "-runs" ) )
+			runs = atoi( argv[++arg] );
+		else
+			return Usage();
+	}
+	if( width <= 0 || height <= 0 || runs <= 0 || ( samples != 2 && samples != 4 && samples != 8 ) )
+		return Usage();
+
+	CpuMesh scene;
+	MakeBenchScene( scene );
+	RunChecks( scene );
+
+	CpuMesh mesh;
+	if( meshPath )
+	{
+		string error;
+		if( !LoadCpuMesh( meshPath, mesh, &error ) )
+		{
+			fprintf( stderr, "%s\n", error.c_str() );
+			return 1;
+		}
+	}
+	else
+		mesh = scene;
+
+	char msaaEdges[64], msaaAll[64];
+	snprintf( msaaEdges, sizeof( msaaEdges ), "%dx MSAA, edges per sample", samples );
+	snprintf( msaaAll, sizeof( msaaAll ), "%dx MSAA, every sample", samples );
+	const Mode modes[] =
+	{
+		{ "no anti-aliasing", 1, 1, false },
+		{ "TEXSCALE 2", 2, 1, false },
+		{ msaaEdges, 1, samples, false },
+		{ msaaAll, 1, samples, true },
+	};
+	const int numModes = sizeof( modes ) / sizeof( modes[0] );
+
+	// the reference, without AO: its rotation noise changes with the resolution and
+	// would drown the edges
+	Mode reference = { "reference", 4, 1, false };
+	ModeResult truth;
+	RenderMode( mesh, width, height, reference, false, truth );
+
+	// the edges the error is also measured on: the MSAA pass's own
+	CpuMsaaGBuffer msaa;
+	CpuRasterScratch scratch;
+	RenderGBufferMsaa( mesh, MakeBatchCamera( MakeView( width, height ) ), width, height, samples, scratch, msaa );
+	vector<unsigned char> edge;
+	unsigned int edges = DetectEdges( msaa, CpuEdgeParams(), 0, height, edge );
+
+	printf( "\n%dx%d %s, %u edge pixels (%.1f%%); error to 4x4 supersampling, composite without AO\n", width, height,
+			meshPath ? meshPath : "synthetic scene", edges, 100.0 * edges / ( width * height ) );
+	printf( "%-28s %10s %10s %10s %8s %8s %8s %8s %9s %9s\n", "mode", "G-buf PS", "AO", "composite", "vs SSAA",
+			"G-buf ms", "AO ms", "comp ms", "RMSE", "edge RMSE" );
+	ModeResult results[numModes];
+	for( int m = 0; m < numModes; ++m )
+	{
+		ModeResult& result = results[m];
+		ModeResult timed;
+		double best[3] = { 1e30, 1e30, 1e30 };
+		for( int run = 0; run < runs; ++run )
+		{
+			RenderMode( mesh, width, height, modes[m], true, timed );
+			best[0] = min( best[0], timed.gbufferMs );
+			best[1] = min( best[1], timed.aoMs );
+			best[2] = min( best[2], timed.compositeMs );
+		}
+		RenderMode( mesh, width, height, modes[m], false, result );
+		result.counts = timed.counts;
+		result.gbufferShaded = timed.gbufferShaded;
+		result.gbufferMs = best[0];
+		result.aoMs = best[1];
+		result.compositeMs = best[2];
+	}
+	const ModeResult& ssaa = results[1];
+	for( int m = 0; m < numModes; ++m )
+	{
+		const ModeResult& r = results[m];
+		double shaded = ( double )( r.gbufferShaded + r.counts.aoShaded + r.counts.compositeShaded );
+		double ssaaShaded = ( double )( ssaa.gbufferShaded + ssaa.counts.aoShaded + ssaa.counts.compositeShaded );
+		printf( "%-28s %10llu %10llu %10llu %7.0f%% %8.2f %8.2f %8.2f %9.5f %9.5f\n", modes[m].name, r.gbufferShaded,
+				r.counts.aoShaded, r.counts.compositeShaded, 100.0 * shaded / ssaaShaded, r.gbufferMs, r.aoMs,
+				r.compositeMs, Rmse( r.color, truth.color ), Rmse( r.color, truth.color, &edge ) );
+	}
+	printf( "(shader invocations with AO on; \"vs SSAA\" is all of them against TEXSCALE 2's; G-buffer ms includes\n"
+			" the edge pass; best of %d runs)\n\n", runs );
+
+	double none = Rmse( results[0].color, truth.color, &edge ), texScale = Rmse( ssaa.color, truth.color, &edge );
+	double edgeAware = Rmse( results[2].color, truth.color, &edge );
+	Check( edgeAware < none * 0.75, "MSAA edges are closer to the reference than no AA" );
+	Check( edgeAware < texScale * 1.25, "MSAA edges are about as close as TEXSCALE 2's" );
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,398 @@
+//--------------------------------------------------------------------------------------
+// File: OutputBench.cpp
+//
+// Checks the output formats (QOI, OpenEXR half/float, raw and RLE) and the OutputSink,
+// times encoding each of them, then exports the G-buffer slices, AO and composite of
+// a synthetic frame every frame of a render loop: written on the render thread
+// against handed to the sink. The loop sleeps for the GPU time of a frame, like the
+// render thread waiting on Present.
+// Usage: OutputBench [width height [frames [frame ms]]]
+//--------------------------------------------------------------------------------------
+#include "../Portable/CpuPasses.h"
+#include "../Portable/ExrFile.h"
+#include "../Portable/ImageFile.h"
+#include "../Portable/OutputSink.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+using namespace std;
+
+typedef chrono::high_resolution_clock Clock;
+
+static int failures = 0;
+
+static double Milliseconds( const Clock::time_point& start )
+{
+	return chrono::duration<double, milli>( Clock::now() - start ).count();
+}
+
+static void Check( bool ok, const char* what )
+{
+	printf( "%-56s %s\n", what, ok ? "ok" : "FAILED" );
+	if( !ok )
+		++failures;
+}
+
+//--------------------------------------------------------------------------------------
+// One frame's outputs, laid out like the render targets: the four R16G16B16A16_UNORM
+// slices of _mrtTex (diffuse, normal, position, depth), the blurred AO (_vgTex) and
+// the 8-bit composite
+//--------------------------------------------------------------------------------------
+#define NUM_OUTPUTS 6
+
+struct Output
+{
+	const char*		name;
+	OutputEncoding	encoding;
+	const char*		channels;
+	const char*		extension;
+};
+
+static const Output outputs[NUM_OUTPUTS] =
+{
+	{ "diffuse",	OUTPUT_IMAGE,		"",		".qoi" },
+	{ "normal",		OUTPUT_EXR_HALF,	"RGB",	".exr" },
+	{ "position",	OUTPUT_EXR_HALF,	"RGB",	".exr" },
+	{ "depth",		OUTPUT_EXR_HALF,	"Z",	".exr" },
+	{ "ao",			OUTPUT_EXR_HALF,	"Y",	".exr" },
+	{ "composite",	OUTPUT_IMAGE,		"",		".qoi" },
+};
+
+struct SourceFrame
+{
+	int								width, height;
+	vector<unsigned short>			slices[NUM_OUTPUTS - 1];	// RGBA16
+	vector<unsigned char>			composite;					// RGBA8
+};
+
+static unsigned short Unorm16( float v )
+{
+	return ( unsigned short )( min( max( v, 0.0f ), 1.0f ) * 65535.0f + 0.5f );
+}
+
+static void MakeSourceFrame( int width, int height, SourceFrame& frame )
+{
+	CpuGBuffer gbuffer;
+	MakeTestGBuffer( gbuffer, width, height );
+	CpuFloat2 rotations[CPU_NUMLAYERS];
+	MakeRotationTable( rotations, 1 );
+	vector<float> ao, scratch;
+	ComputeAO( gbuffer, CpuAOParams(), rotations, ao );
+	BlurAO( width, height, 1, ao, scratch );
+	vector<CpuFloat4> color( ( size_t )width * height );
+	const CpuFloat3 lightPos = { 0.0f, -3.0f, -4.0f };	// vLightPos
+	SelectComposite( VIEW_COMPOSITE, true )( gbuffer, ao, lightPos, 0, height, color );
+
+	frame.width = width;
+	frame.height = height;
+	size_t pixels = ( size_t )width * height;
+	for( int s = 0; s < NUM_OUTPUTS - 1; ++s )
+		frame.slices[s].resize( pixels * 4 );
+	frame.composite.resize( pixels * 4 );
+	for( size_t i = 0; i < pixels; ++i )
+	{
+		float z = gbuffer.viewZ[i];
+		CpuFloat3 p = gbuffer.ViewPosition( ( float )( i % width ), ( float )( i / width ), z );
+		const float texels[NUM_OUTPUTS - 1][4] =
+		{
+			{ gbuffer.diffuse[i].x, gbuffer.diffuse[i].y, gbuffer.diffuse[i].z, gbuffer.diffuse[i].w },
+			{ gbuffer.normal[i].x * 0.5f + 0.5f, gbuffer.normal[i].y * 0.5f + 0.5f, gbuffer.normal[i].z * 0.5f + 0.5f, 1.0f },
+			{ p.x / 2000.0f + 0.5f, p.y / 2000.0f + 0.5f, p.z / gbuffer.farZ, 1.0f },
+			{ z / gbuffer.farZ, 0.0f, 0.0f, 1.0f },
+			{ ao[i], ao[i], ao[i], 1.0f },
+		};
+		for( int s = 0; s < NUM_OUTPUTS - 1; ++s )
+			for( int c = 0; c < 4; ++c )
+				frame.slices[s][i * 4 + c] = Unorm16( texels[s][c] );
+		const float* rgba = &color[i].x;
+		for( int c = 0; c < 4; ++c )
+			frame.composite[i * 4 + c] = ( unsigned char )( min( max( rgba[c], 0.0f ), 1.0f ) * 255.0f + 0.5f );
+	}
+}
+
+// Fills frame with output o of source, like copying a mapped staging texture
+static void FillFrame( const SourceFrame& source, int o, const string& path, OutputFrame& frame )
+{
+	if( o == NUM_OUTPUTS - 1 )
+	{
+		frame.Init( source.width, source.height, 4, OUTPUT_UNORM8 );
+		memcpy( &frame.data[0], &source.composite[0], frame.data.size() );
+	}
+	else
+	{
+		frame.Init( source.width, source.height, 4, OUTPUT_UNORM16 );
+		memcpy( &frame.data[0], &source.slices[o][0], frame.data.size() );
+	}
+	frame.path = path;
+	frame.encoding = outputs[o].encoding;
+	frame.channels = outputs[o].channels;
+}
+
+//--------------------------------------------------------------------------------------
+// Checks
+//--------------------------------------------------------------------------------------
+static void CheckFormats()
+{
+	// EXR: exact as float, to half precision as half, channels sorted by name
+	ExrImage image;
+	image.width = 61;
+	image.height = 17;
+	image.channels = "ZY";
+	for( int i = 0; i < image.width * image.height; ++i )
+	{
+		image.pixels.push_back( i < 200 ? 1000.0f : ( i % 13 ) * 0.37f );		// runs and noise
+		image.pixels.push_back( i < 200 ? 0.5f : ( float )( rand() % 1000 ) / 999.0f );
+	}
+	bool exact = true, close = true, sorted = true;
+	size_t sizes[2][2];
+	for( int rle = 0; rle < 2; ++rle )
+	{
+		for( int half = 0; half < 2; ++half )
+		{
+			image.half = half != 0;
+			vector<unsigned char> file;
+			EncodeExr( image, rle != 0, file );
+			sizes[rle][half] = file.size();
+			ExrImage read;
+			if( !DecodeExr( &file[0], file.size(), read ) || read.channels != "YZ" || read.half != image.half ||
+				read.pixels.size() != image.pixels.size() )
+			{
+				sorted = false;
+				continue;
+			}
+			for( size_t i = 0; i < read.pixels.size(); i += 2 )
+			{
+				float z = image.pixels[i], y = image.pixels[i + 1];
+				if( half )
+					close = close && fabsf( read.pixels[i] - y ) <= y / 1024.0f && fabsf( read.pixels[i + 1] - z ) <= z / 1024.0f;
+				else
+					exact = exact && read.pixels[i] == y && read.pixels[i + 1] == z;
+			}
+		}
+	}
+	Check( sorted, "EXR: reads back, channels in file order" );
+	Check( exact, "EXR: float channels are exact" );
+	Check( close, "EXR: half channels within half precision" );
+	Check( sizes[1][0] < sizes[0][0] && sizes[1][1] < sizes[0][1], "EXR: RLE is smaller on runs" );
+
+	// QOI: every op (runs, index, diffs, luma, full RGB and RGBA)
+	Image qoi;
+	qoi.width = 97;
+	qoi.height = 33;
+	for( int y = 0; y < qoi.height; ++y )
+		for( int x = 0; x < qoi.width; ++x )
+		{
+			unsigned char px[4] = { ( unsigned char )( x * 2 ), ( unsigned char )( y < 10 ? 7 : x * 5 + y ),
+									( unsigned char )( y > 20 ? rand() : 40 ), ( unsigned char )( x < 50 ? 255 : y * 7 ) };
+			qoi.rgba.insert( qoi.rgba.end(), px, px + 4 );
+		}
+	Image read;
+	Check( SaveImageFile( "OutputBench.qoi", qoi ) && LoadImageFile( "OutputBench.qoi", read ) && read.width == qoi.width &&
+		   read.height == qoi.height && read.rgba == qoi.rgba, "QOI: lossless round trip" );
+	remove( "OutputBench.qoi" );
+}
+
+static void CheckSink()
+{
+	OutputSink sink( 2, 1 );
+	OutputFrame* a = sink.Acquire();
+	OutputFrame* b = sink.Acquire();
+	Check( a && b && a != b && !sink.TryAcquire() && sink.GetStats().dropped == 1, "sink: the pool bounds the queue" );
+
+	// 16-bit one-channel frame to 8-bit gray, written on the encoder thread
+	a->Init( 3, 2, 1, OUTPUT_UNORM16 );
+	const unsigned short gray[6] = { 0, 65535, 32768, 257, 514, 65535 };
+	memcpy( &a->data[0], gray, sizeof( gray ) );
+	a->path = "OutputBench.pam";
+	sink.Submit( a );
+	b->Init( 4, 4, 1, OUTPUT_FLOAT32 );
+	b->path = "no such directory/OutputBench.exr";
+	b->encoding = OUTPUT_EXR_FLOAT;
+	sink.Submit( b );
+	sink.Flush();
+
+	Image read;
+	bool converted = LoadImageFile( "OutputBench.pam", read ) && read.width == 3 && read.height == 2;
+	const unsigned char expected[6] = { 0, 255, 128, 1, 2, 255 };
+	for( int i = 0; converted && i < 6; ++i )
+		converted = read.rgba[i * 4] == expected[i] && read.rgba[i * 4 + 2] == expected[i] && read.rgba[i * 4 + 3] == 255;
+	Check( converted, "sink: 16-bit gray frames are converted" );
+	OutputSink::Stats stats = sink.GetStats();
+	Check( stats.frames == 1 && stats.failed == 1 && sink.TryAcquire() && sink.TryAcquire(),
+		   "sink: failed writes are counted, frames come back" );
+	remove( "OutputBench.pam" );
+}
+
+//--------------------------------------------------------------------------------------
+// Bench
+//--------------------------------------------------------------------------------------
+static string OutputPath( int frame, int o )
+{
+	char path[64];
+	sprintf( path, "OutputBench_%03d_%s%s", frame, outputs[o].name, outputs[o].extension );
+	return path;
+}
+
+static void RemoveOutputs( int frames )
+{
+	for( int f = 0; f < frames; ++f )
+		for( int o = 0; o < NUM_OUTPUTS; ++o )
+			remove( OutputPath( f, o ).c_str() );
+}
+
+// Encodes every output once on this thread: MB/s of texels and file size
+static void EncodeRates( const SourceFrame& source )
+{
+	printf( "\n%-10s %-10s %10s %10s %10s\n", "output", "format", "ms", "MB/s", "ratio" );
+	OutputSink sink( 1, 1 );
+	const char* formats[] = { "qoi", "exr half", "exr half", "exr half", "exr half", "qoi" };
+	for( int o = 0; o < NUM_OUTPUTS; ++o )
+	{
+		OutputFrame* frame = sink.Acquire();
+		FillFrame( source, o, OutputPath( 0, o ), *frame );
+		size_t raw = frame->data.size();
+		sink.ResetStats();
+		sink.Submit( frame );
+		sink.Flush();
+		OutputSink::Stats stats = sink.GetStats();
+		printf( "%-10s %-10s %10.2f %10.1f %10.2f\n", outputs[o].name, formats[o], stats.encodeMs, stats.EncodeMBps(),
+				stats.fileBytes ? ( double )raw / stats.fileBytes : 0.0 );
+	}
+
+	// the other choices for the composite and the depth
+	Image image;
+	image.width = source.width;
+	image.height = source.height;
+	image.rgba = source.composite;
+	vector<unsigned char> bytes;
+	Clock::time_point start = Clock::now();
+	EncodeImageFile( "x.ppm", image, bytes );
+	double ms = Milliseconds( start );
+	printf( "%-10s %-10s %10.2f %10.1f %10.2f\n", "composite", "ppm", ms, image.rgba.size() / ( ms * 1000.0 ),
+			( double )image.rgba.size() / bytes.size() );
+	ExrImage depth;
+	depth.width = source.width;
+	depth.height = source.height;
+	depth.channels = "Z";
+	depth.half = false;
+	for( size_t i = 0; i < source.slices[3].size(); i += 4 )
+		depth.pixels.push_back( source.slices[3][i] / 65535.0f );
+	for( int rle = 0; rle < 2; ++rle )
+	{
+		bytes.clear();
+		start = Clock::now();
+		EncodeExr( depth, rle != 0, bytes );
+		ms = Milliseconds( start );
+		printf( "%-10s %-10s %10.2f %10.1f %10.2f\n", "depth", rle ? "exr float" : "exr raw", ms,
+				source.slices[3].size() * 2 / ( ms * 1000.0 ), ( double )source.slices[3].size() * 2 / bytes.size() );
+	}
+	RemoveOutputs( 1 );
+}
+
+struct LoopResult
+{
+	double		ms;				// whole loop, sink flushed
+	double		renderThreadMs;	// worst frame's time on the render thread outside the GPU wait
+	double		exportMs;		// all frames' time exporting on the render thread
+};
+
+// frames of frameMs each exporting every output; sink NULL writes them on the spot
+static LoopResult RenderLoop( const SourceFrame& source, int frames, double frameMs, OutputSink* sink )
+{
+	LoopResult result = { 0.0, 0.0, 0.0 };
+	OutputFrame inline_;
+	vector<unsigned char> bytes;
+	Clock::time_point loopStart = Clock::now();
+	for( int f = 0; f < frames; ++f )
+	{
+		this_thread::sleep_for( chrono::microseconds( ( long long )( frameMs * 1000.0 ) ) );
+
+		Clock::time_point start = Clock::now();
+		for( int o = 0; o < NUM_OUTPUTS; ++o )
+		{
+			if( sink )
+			{
+				OutputFrame* frame = sink->Acquire();
+				FillFrame( source, o, OutputPath( f, o ), *frame );
+				sink->Submit( frame );
+			}
+			else
+			{
+				// the same encoders, on this thread
+				OutputSink once( 1, 1 );
+				OutputFrame* frame = once.Acquire();
+				FillFrame( source, o, OutputPath( f, o ), *frame );
+				once.Submit( frame );
+				once.Flush();
+			}
+		}
+		double ms = Milliseconds( start );
+		result.exportMs += ms;
+		result.renderThreadMs = max( result.renderThreadMs, ms );
+	}
+	if( sink )
+		sink->Flush();
+	result.ms = Milliseconds( loopStart );
+	RemoveOutputs( frames );
+	return result;
+}
+
+int main( int argc, char* argv[] )
+{
+	int width = 1024, height = 768, frames = 20;
+	double frameMs = 100.0;
+	if( argc >= 3 )
+	{
+		width = atoi( argv[1] );
+		height = atoi( argv[2] );
+	}
+	if( argc >= 4 )
+		frames = atoi( argv[3] );
+	if( argc >= 5 )
+		frameMs = atof( argv[4] );
+	if( width <= 0 || height <= 0 || frames <= 0 || frameMs < 0.0 )
+	{
+		fprintf( stderr, "usage: OutputBench [width height [frames [frame ms]]]\n" );
+		return 1;
+	}
+
+	CheckFormats();
+	CheckSink();
+
+	SourceFrame source;
+	MakeSourceFrame( width, height, source );
+	size_t frameBytes = 0;
+	for( int s = 0; s < NUM_OUTPUTS - 1; ++s )
+		frameBytes += source.slices[s].size() * 2;
+	frameBytes += source.composite.size();
+	printf( "\n%dx%d: %d outputs, %.1f MB of texels per frame\n", width, height, NUM_OUTPUTS, frameBytes / 1048576.0 );
+	EncodeRates( source );
+
+	// export every frame of a render loop
+	printf( "\n%d frames of %.1f ms, every output exported\n\n", frames, frameMs );
+	printf( "%-22s %10s %10s %14s %12s %10s %10s\n", "", "fps", "loop ms", "worst frame ms", "export ms", "blocked", "MB/s" );
+	LoopResult sync = RenderLoop( source, frames, frameMs, NULL );
+	printf( "%-22s %10.1f %10.1f %14.2f %12.1f %10s %10s\n", "on the render thread", frames * 1000.0 / sync.ms, sync.ms,
+			sync.renderThreadMs, sync.exportMs, "-", "-" );
+	for( int threads = 1; threads <= 2; ++threads )
+	{
+		// three frames' worth of outputs in flight
+		OutputSink sink( 3 * NUM_OUTPUTS, threads );
+		LoopResult async = RenderLoop( source, frames, frameMs, &sink );
+		OutputSink::Stats stats = sink.GetStats();
+		char name[32];
+		sprintf( name, "sink, %d thread%s", threads, threads > 1 ? "s" : "" );
+		printf( "%-22s %10.1f %10.1f %14.2f %12.1f %5u %4.0fms %10.1f\n", name, frames * 1000.0 / async.ms, async.ms,
+				async.renderThreadMs, async.exportMs, stats.blocked, stats.blockedMs, stats.EncodeMBps() );
+		if( stats.failed )
+			Check( false, "sink: every output written" );
+	}
+	printf( "(%u hardware threads)\n", thread::hardware_concurrency() );
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,370 @@
+//--------------------------------------------------------------------------------------
+// File: ShadingRateBench.cpp
+//
+// Quality and cost of coarse (variable-rate) shading (see Portable/ShadingRate.h)
+// against shading every pixel, on the CPU. It checks the rate map and the coarse
+// passes, then renders a synthetic scene (or a mesh seen from the sample's starting
+// camera) with AO and the composite at full rate and with the rate map of a few
+// threshold presets. For each it reports the tiles at every rate, the shader
+// invocations and milliseconds of every pass, and the RMSE and mean SSIM (of the
+// luminance, covered pixels) of the image against the full-rate one.
+// Usage: ShadingRateBench [width height] [-mesh m.sdkmesh] [-runs n]
+//--------------------------------------------------------------------------------------
+#include "../Portable/AOSweep.h"
+#include "../Portable/BatchRender.h"
+#include "../Portable/ShadingRate.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+typedef chrono::high_resolution_clock Clock;
+
+static int failures = 0;
+
+static double Milliseconds( const Clock::time_point& start )
+{
+	return chrono::duration<double, milli>( Clock::now() - start ).count();
+}
+
+static void Check( bool ok, const char* what )
+{
+	printf( "%-56s %s\n", what, ok ? "ok" : "FAILED" );
+	if( !ok )
+		++failures;
+}
+
+//--------------------------------------------------------------------------------------
+// Synthetic scene: spheres in front of a big one, which is the ground
+//--------------------------------------------------------------------------------------
+static void AddSphere( CpuMesh& mesh, float cx, float cy, float cz, float radius, int rows, int columns )
+{
+	CpuMesh::Subset subset = { ( unsigned int )mesh.indices.size(), 0, ( unsigned int )mesh.vertices.size(), 0 };
+	for( int y = 0; y <= rows; ++y )
+		for( int x = 0; x <= columns; ++x )
+		{
+			float theta = 3.14159265f * y / rows, phi = 2.0f * 3.14159265f * x / columns;
+			FloatVertex v;
+			v.normal[0] = sinf( theta ) * cosf( phi );
+			v.normal[1] = cosf( theta );
+			v.normal[2] = sinf( theta ) * sinf( phi );
+			v.pos[0] = cx + v.normal[0] * radius;
+			v.pos[1] = cy + v.normal[1] * radius;
+			v.pos[2] = cz + v.normal[2] * radius;
+			v.uv[0] = 4.0f * x / columns;
+			v.uv[1] = 2.0f * y / rows;
+			mesh.vertices.push_back( v );
+		}
+	for( int y = 0; y < rows; ++y )
+		for( int x = 0; x < columns; ++x )
+		{
+			unsigned int i = y * ( columns + 1 ) + x, below = i + columns + 1;
+			unsigned int quad[6] = { i, i + 1, below, i + 1, below + 1, below };
+			mesh.indices.insert( mesh.indices.end(), quad, quad + 6 );
+		}
+	subset.indexCount = ( unsigned int )mesh.indices.size() - subset.indexStart;
+	mesh.subsets.push_back( subset );
+}
+
+// The spheres are checkered with a texture of two close colors, the ground is plain
+static void MakeBenchScene( CpuMesh& mesh )
+{
+	mesh = CpuMesh();
+	mesh.textures.resize( 2 );
+	CpuTexture& texture = mesh.textures[0];
+	texture.width = texture.height = 64;
+	texture.texels.resize( 64 * 64 );
+	for( int y = 0; y < 64; ++y )
+		for( int x = 0; x < 64; ++x )
+			texture.texels[y * 64 + x] = ( ( x / 8 ) ^ ( y / 8 ) ) & 1 ? CpuFloat4{ 0.9f, 0.5f, 0.3f, 1.0f }
+																		: CpuFloat4{ 0.7f, 0.6f, 0.5f, 1.0f };
+	CpuTexture& plain = mesh.textures[1];
+	plain.width = plain.height = 1;
+	plain.texels.assign( 1, CpuFloat4{ 0.6f, 0.6f, 0.55f, 1.0f } );
+	AddSphere( mesh, 0.0f, 50.0f, 0.0f, 100.0f, 48, 96 );
+	AddSphere( mesh, -200.0f, 90.0f, 60.0f, 60.0f, 24, 48 );
+	AddSphere( mesh, 190.0f, 20.0f, -120.0f, 35.0f, 16, 32 );
+	AddSphere( mesh, 0.0f, 4150.0f, 0.0f, 4000.0f, 48, 96 );		// the ground, seen from outside
+	mesh.subsets.back().texture = 1;
+}
+
+static BatchView MakeView( int width, int height )
+{
+	vector<BatchView> views;
+	ParseBatch( "size " + to_string( width ) + " " + to_string( height ) + "\ncamera 0 -150 -700 0 0 0\n", views );
+	return views[0];
+}
+
+//--------------------------------------------------------------------------------------
+// One frame at full rate or through a rate map
+//--------------------------------------------------------------------------------------
+static const CpuFloat3 lightPos = { 0.0f, -3.0f, -4.0f };	// vLightPos
+
+struct FrameResult
+{
+	CpuRateCounts		counts;
+	double				mapMs, aoMs, compositeMs;
+	vector<float>		ao;
+	vector<CpuFloat4>	color;
+};
+
+// params NULL: every pixel, through the plain passes
+static void ShadeFrame( const CpuGBuffer& gbuffer, const CpuRateParams* params, FrameResult& result )
+{
+	const int w = gbuffer.width, h = gbuffer.height;
+	CpuFloat2 rotations[CPU_NUMLAYERS];
+	MakeRotationTable( rotations, 1 );
+	const int blurStep = max( 1, ( h + 384 ) / 768 );
+	vector<float> blur;
+	result.counts = CpuRateCounts();
+
+	if( !params )
+	{
+		result.mapMs = 0.0;
+		Clock::time_point start = Clock::now();
+		ComputeAO( gbuffer, CpuAOParams(), rotations, result.ao );
+		BlurAO( w, h, blurStep, result.ao, blur );
+		result.aoMs = Milliseconds( start );
+
+		start = Clock::now();
+		result.color.resize( ( size_t )w * h );
+		SelectComposite( VIEW_COMPOSITE, true )( gbuffer, result.ao, lightPos, 0, h, result.color );
+		result.compositeMs = Milliseconds( start );
+
+		result.counts.tiles[0] = ( ( w + CPU_RATE_TILE - 1 ) / CPU_RATE_TILE ) * ( ( h + CPU_RATE_TILE - 1 ) / CPU_RATE_TILE );
+		result.counts.pixels = result.counts.compositeShaded = ( unsigned long long )w * h;
+		for( size_t i = 0; i < gbuffer.viewZ.size(); ++i )
+			result.counts.aoShaded += gbuffer.viewZ[i] != 0.0f;
+		return;
+	}
+
+	Clock::time_point start = Clock::now();
+	CpuRateMap map;
+	map.Resize( w, h );
+	BuildRateMap( gbuffer, *params, 0, h, map, &result.counts );
+	result.mapMs = Milliseconds( start );
+
+	start = Clock::now();
+	ComputeAOCoarse( gbuffer, map, CpuAOParams(), rotations, 0, h, result.ao, &result.counts );
+	BlurAO( w, h, blurStep, result.ao, blur );
+	result.aoMs = Milliseconds( start );
+
+	start = Clock::now();
+	CompositeCoarse( gbuffer, result.ao, map, SelectCompositeBlocks( VIEW_COMPOSITE, true ), lightPos, 0, h,
+					 result.color, &result.counts );
+	result.compositeMs = Milliseconds( start );
+}
+
+static double Rmse( const vector<CpuFloat4>& a, const vector<CpuFloat4>& b )
+{
+	double sum = 0.0;
+	for( size_t i = 0; i < a.size(); ++i )
+	{
+		double dx = a[i].x - b[i].x, dy = a[i].y - b[i].y, dz = a[i].z - b[i].z;
+		sum += dx * dx + dy * dy + dz * dz;
+	}
+	return a.empty() ? 0.0 : sqrt( sum / ( 3.0 * a.size() ) );
+}
+
+static double LuminanceSsim( const CpuGBuffer& gbuffer, const vector<CpuFloat4>& a, const vector<CpuFloat4>& b )
+{
+	vector<float> la( a.size() ), lb( b.size() );
+	for( size_t i = 0; i < a.size(); ++i )
+	{
+		la[i] = 0.299f * a[i].x + 0.587f * a[i].y + 0.114f * a[i].z;
+		lb[i] = 0.299f * b[i].x + 0.587f * b[i].y + 0.114f * b[i].z;
+	}
+	double rmse, ssim;
+	CompareAO( gbuffer, la, lb, rmse, ssim );
+	return ssim;
+}
+
+//--------------------------------------------------------------------------------------
+// Checks
+//--------------------------------------------------------------------------------------
+static void RunChecks( const CpuMesh& scene )
+{
+	const int width = 320, height = 240;
+	CpuRasterScratch scratch;
+	CpuGBuffer gbuffer;
+	RenderGBuffer( scene, MakeBatchCamera( MakeView( width, height ) ), width, height, scratch, gbuffer );
+
+	FrameResult full, one, coarse;
+	ShadeFrame( gbuffer, NULL, full );
+	CpuRateParams fullRate;
+	fullRate.maxRate = 1;
+	ShadeFrame( gbuffer, &fullRate, one );
+	Check( one.counts.tiles[0] == full.counts.tiles[0] && one.ao == full.ao &&
+		   !memcmp( &one.color[0], &full.color[0], full.color.size() * sizeof( CpuFloat4 ) ),
+		   "rate 1 everywhere shades like the full-rate passes" );
+
+	const CpuRateParams defaults;
+	CpuRateMap map;
+	map.Resize( width, height );
+	CpuRateCounts counts;
+	BuildRateMap( gbuffer, defaults, 0, height, map, &counts );
+	bool backgroundCoarse = true, silhouettesFull = true;
+	unsigned long long blocks = 0;
+	for( int ty = 0; ty < map.tilesY; ++ty )
+		for( int tx = 0; tx < map.tilesX; ++tx )
+		{
+			int covered = 0, pixels = 0;
+			for( int y = ty * CPU_RATE_TILE; y < min( ( ty + 1 ) * CPU_RATE_TILE, height ); ++y )
+				for( int x = tx * CPU_RATE_TILE; x < min( ( tx + 1 ) * CPU_RATE_TILE, width ); ++x, ++pixels )
+					covered += gbuffer.viewZ[y * width + x] != 0.0f;
+			int rate = map.rate[ty * map.tilesX + tx];
+			if( covered == 0 && rate != 4 )
+				backgroundCoarse = false;
+			if( covered != 0 && covered != pixels && rate != 1 )
+				silhouettesFull = false;
+			blocks += ( unsigned long long )( ( CPU_RATE_TILE + rate - 1 ) / rate ) * ( ( CPU_RATE_TILE + rate - 1 ) / rate );
+		}
+	Check( backgroundCoarse, "tiles of background only are shaded 4x4" );
+	Check( silhouettesFull, "tiles across silhouettes are shaded 1x1" );
+	Check( counts.tiles[0] + counts.tiles[1] + counts.tiles[2] == ( unsigned int )( map.tilesX * map.tilesY ) &&
+		   counts.tiles[1] + counts.tiles[2] > 0, "every tile gets a rate, some coarse ones" );
+
+	ShadeFrame( gbuffer, &defaults, coarse );
+	bool uniform = true;
+	for( int y = 0; y < height; ++y )
+		for( int x = 0; x < width; ++x )
+		{
+			int rate = map.Rate( x, y );
+			int bx = x / rate * rate, by = y / rate * rate;
+			int sx = min( bx + rate / 2, width - 1 ), sy = min( by + rate / 2, height - 1 );
+			if( memcmp( &coarse.color[y * width + x], &coarse.color[sy * width + sx], sizeof( CpuFloat4 ) ) )
+				uniform = false;
+		}
+	Check( uniform, "every block shows the color of its shaded pixel" );
+	Check( coarse.counts.compositeShaded == blocks && coarse.counts.pixels == ( unsigned long long )width * height,
+		   "composite invocations: one per block" );
+	Check( coarse.counts.aoShaded < full.counts.aoShaded, "AO runs once per covered block" );
+
+	double shaded = ( double )( coarse.counts.aoShaded + coarse.counts.compositeShaded );
+	double fullShaded = ( double )( full.counts.aoShaded + full.counts.compositeShaded );
+	Check( shaded < 0.6 * fullShaded && LuminanceSsim( gbuffer, coarse.color, full.color ) > 0.98,
+		   "the default rates: < 60% of the invocations, SSIM > 0.98" );
+}
+
+//--------------------------------------------------------------------------------------
+// Report
+//--------------------------------------------------------------------------------------
+struct Preset
+{
+	const char*		name;
+	CpuRateParams	params;
+};
+
+static CpuRateParams MakeParams( float luma, float depth, float normal )
+{
+	CpuRateParams params;
+	params.lumaThreshold = luma;
+	params.depthThreshold = depth;
+	params.normalThreshold = normal;
+	return params;
+}
+
+static int Usage()
+{
+	fprintf( stderr, "usage: ShadingRateBench [width height] [-mesh m.sdkmesh] [-runs n]\n" );
+	return 2;
+}
+
+int main( int argc, char* argv[] )
+{
+	int width = 640, height = 480, runs = 3;
+	const char* meshPath = NULL;
+	int arg = 1;
+	if( argc > 2 && argv[1][0] != '-' )
+	{
+		width = atoi( argv[1] );
+		height = atoi( argv[2] );
+		arg = 3;
+	}
+	for( ; arg < argc; ++arg )
+	{
+		if( arg + 1 >= argc )
+			return Usage();
+		if( !strcmp( argv[arg], "-mesh" ) )
+			meshPath = argv[++arg];
+		else if( !strcmp( argv[arg], "-runs" ) )
+			runs = atoi( argv[++arg] );
+		else
+			return Usage();
+	}
+	if( width <= 0 || height <= 0 || runs <= 0 )
+		return Usage();
+
+	CpuMesh scene;
+	MakeBenchScene( scene );
+	RunChecks( scene );
+
+	CpuMesh mesh;
+	if( meshPath )
+	{
+		string error;
+		if( !LoadCpuMesh( meshPath, mesh, &error ) )
+		{
+			fprintf( stderr, "%s\n", error.c_str() );
+			return 1;
+		}
+	}
+	else
+		mesh = scene;
+
+	CpuRasterScratch scratch;
+	CpuGBuffer gbuffer;
+	RenderGBuffer( mesh, MakeBatchCamera( MakeView( width, height ) ), width, height, scratch, gbuffer );
+
+	const Preset presets[] =
+	{
+		{ "conservative", MakeParams( 0.01f, 0.01f, 0.98f ) },
+		{ "default", CpuRateParams() },
+		{ "aggressive", MakeParams( 0.05f, 0.05f, 0.9f ) },
+	};
+	const int numPresets = sizeof( presets ) / sizeof( presets[0] );
+
+	// the fastest of runs of every pass
+	FrameResult results[numPresets + 1];
+	for( int p = 0; p <= numPresets; ++p )
+	{
+		FrameResult& result = results[p];
+		double best[3] = { 1e30, 1e30, 1e30 };
+		for( int run = 0; run < runs; ++run )
+		{
+			ShadeFrame( gbuffer, p ? &presets[p - 1].params : NULL, result );
+			best[0] = min( best[0], result.mapMs );
+			best[1] = min( best[1], result.aoMs );
+			best[2] = min( best[2], result.compositeMs );
+		}
+		result.mapMs = best[0];
+		result.aoMs = best[1];
+		result.compositeMs = best[2];
+	}
+
+	const FrameResult& full = results[0];
+	printf( "\n%dx%d %s, %dx%d tiles, AO (blurred) and composite\n", width, height,
+			meshPath ? meshPath : "synthetic scene", CPU_RATE_TILE, CPU_RATE_TILE );
+	printf( "%-14s %5s %5s %5s %9s %9s %7s %7s %7s %7s %8s %8s\n", "rates", "1x1", "2x2", "4x4", "AO", "composite",
+			"vs full", "map ms", "AO ms", "comp ms", "RMSE", "SSIM" );
+	for( int p = 0; p <= numPresets; ++p )
+	{
+		const FrameResult& r = results[p];
+		const CpuRateCounts& c = r.counts;
+		double tiles = c.tiles[0] + c.tiles[1] + c.tiles[2];
+		double shaded = ( double )( c.aoShaded + c.compositeShaded );
+		double fullShaded = ( double )( full.counts.aoShaded + full.counts.compositeShaded );
+		printf( "%-14s %4.0f%% %4.0f%% %4.0f%% %9llu %9llu %6.0f%% %7.2f %7.2f %7.2f %8.5f %8.5f\n",
+				p ? presets[p - 1].name : "full rate", 100.0 * c.tiles[0] / tiles, 100.0 * c.tiles[1] / tiles,
+				100.0 * c.tiles[2] / tiles, c.aoShaded, c.compositeShaded, 100.0 * shaded / fullShaded, r.mapMs,
+				r.aoMs, r.compositeMs, Rmse( r.color, full.color ), LuminanceSsim( gbuffer, r.color, full.color ) );
+	}
+	printf( "(tiles at every rate; AO and composite invocations, \"vs full\" is both against full rate; best of %d runs;\n"
+			" RMSE of the image and mean SSIM of its luminance against full rate)\n", runs );
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,330 @@
+//--------------------------------------------------------------------------------------
+// File: ShadowCacheBench.cpp
+//
+// Cost of keeping the shadow map of the scene light up to date incrementally (see
+// Portable/ShadowCache.h) against re-rendering it every frame, on the CPU. It checks
+// that after every kind of change (nothing, a spinning instance, static casters added,
+// the light moved) the incremental map is the same, bit for bit, as one rendered from
+// scratch, and that only the tiles that changed were re-rendered. Then it spins a
+// caster over grounds with more and more static spheres and reports the milliseconds,
+// dirty tiles and triangles of a frame both ways: the full render grows with the scene,
+// the incremental one follows only the spinning caster (the mesh, if one is given).
+// Usage: ShadowCacheBench [size] [-mesh m.sdkmesh] [-frames n]
+//--------------------------------------------------------------------------------------
+#include "../Portable/BatchRender.h"
+#include "../Portable/ShadowCache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+typedef chrono::high_resolution_clock Clock;
+
+static int failures = 0;
+
+static double Milliseconds( const Clock::time_point& start )
+{
+	return chrono::duration<double, milli>( Clock::now() - start ).count();
+}
+
+static void Check( bool ok, const char* what )
+{
+	printf( "%-56s %s\n", what, ok ? "ok" : "FAILED" );
+	if( !ok )
+		++failures;
+}
+
+//--------------------------------------------------------------------------------------
+// Synthetic scene: a ground grid with spheres on it (static) and a flattened sphere
+// spinning above them (the instance)
+//--------------------------------------------------------------------------------------
+static void AddSphere( CpuMesh& mesh, float cx, float cy, float cz, float radius, int rows, int columns )
+{
+	CpuMesh::Subset subset = { ( unsigned int )mesh.indices.size(), 0, ( unsigned int )mesh.vertices.size(), 0 };
+	for( int y = 0; y <= rows; ++y )
+		for( int x = 0; x <= columns; ++x )
+		{
+			float theta = 3.14159265f * y / rows, phi = 2.0f * 3.14159265f * x / columns;
+			FloatVertex v;
+			v.normal[0] = sinf( theta ) * cosf( phi );
+			v.normal[1] = cosf( theta );
+			v.normal[2] = sinf( theta ) * sinf( phi );
+			v.pos[0] = cx + v.normal[0] * radius;
+			v.pos[1] = cy + v.normal[1] * radius;
+			v.pos[2] = cz + v.normal[2] * radius;
+			v.uv[0] = 4.0f * x / columns;
+			v.uv[1] = 2.0f * y / rows;
+			mesh.vertices.push_back( v );
+		}
+	for( int y = 0; y < rows; ++y )
+		for( int x = 0; x < columns; ++x )
+		{
+			unsigned int i = y * ( columns + 1 ) + x, below = i + columns + 1;
+			unsigned int quad[6] = { i, i + 1, below, i + 1, below + 1, below };
+			mesh.indices.insert( mesh.indices.end(), quad, quad + 6 );
+		}
+	subset.indexCount = ( unsigned int )mesh.indices.size() - subset.indexStart;
+	mesh.subsets.push_back( subset );
+}
+
+// cells x cells quads on y = 0, from -extent to extent
+static void AddGround( CpuMesh& mesh, float extent, int cells )
+{
+	CpuMesh::Subset subset = { ( unsigned int )mesh.indices.size(), 0, ( unsigned int )mesh.vertices.size(), 0 };
+	for( int z = 0; z <= cells; ++z )
+		for( int x = 0; x <= cells; ++x )
+		{
+			FloatVertex v;
+			v.pos[0] = -extent + 2.0f * extent * x / cells;
+			v.pos[1] = 0.0f;
+			v.pos[2] = -extent + 2.0f * extent * z / cells;
+			v.normal[0] = v.normal[2] = 0.0f;
+			v.normal[1] = 1.0f;
+			v.uv[0] = ( float )x / cells;
+			v.uv[1] = ( float )z / cells;
+			mesh.vertices.push_back( v );
+		}
+	for( int z = 0; z < cells; ++z )
+		for( int x = 0; x < cells; ++x )
+		{
+			unsigned int i = z * ( cells + 1 ) + x, next = i + cells + 1;
+			unsigned int quad[6] = { i, next, i + 1, i + 1, next, next + 1 };
+			mesh.indices.insert( mesh.indices.end(), quad, quad + 6 );
+		}
+	subset.indexCount = ( unsigned int )mesh.indices.size() - subset.indexStart;
+	mesh.subsets.push_back( subset );
+}
+
+// perSide x perSide spheres resting on the ground, away from its centre
+static void MakeSpheres( CpuMesh& mesh, int perSide )
+{
+	mesh = CpuMesh();
+	float spacing = 1800.0f / perSide, radius = spacing * 0.3f;
+	for( int z = 0; z < perSide; ++z )
+		for( int x = 0; x < perSide; ++x )
+		{
+			float cx = -900.0f + spacing * ( x + 0.5f ), cz = -900.0f + spacing * ( z + 0.5f );
+			if( fabsf( cx ) < 300.0f && fabsf( cz ) < 300.0f )
+				continue;
+			AddSphere( mesh, cx, radius, cz, radius, 12, 24 );
+		}
+}
+
+struct BenchScene
+{
+	CpuMesh		ground, spheres, caster;
+	Mat4		light;
+};
+
+static Mat4 CasterWorld( float angle )
+{
+	return Mat4Scaling( 250.0f, 30.0f, 60.0f ) * Mat4RotationY( angle ) * Mat4Translation( 0.0f, 250.0f, 0.0f );
+}
+
+static Mat4 MakeLight( float x )
+{
+	return ShadowLightMatrix( MakeVec3( x, 1600.0f, -400.0f ), MakeVec3( 0.0f, 0.0f, 0.0f ), 1.4f, 100.0f, 4000.0f );
+}
+
+// The scene in a cache, its caster at angle; extra is a static mesh too
+static int Populate( ShadowCache& cache, const BenchScene& scene, float angle, const CpuMesh* extra = NULL )
+{
+	cache.SetLight( scene.light );
+	cache.AddStatic( scene.ground, Mat4Identity() );
+	cache.AddStatic( scene.spheres, Mat4Identity() );
+	if( extra )
+		cache.AddStatic( *extra, Mat4Identity() );
+	return cache.AddInstance( scene.caster, CasterWorld( angle ) );
+}
+
+// The map of the same scene rendered from scratch
+static bool MatchesFullRender( const ShadowCache& cache, const BenchScene& scene, float angle, const CpuMesh* extra = NULL )
+{
+	ShadowCache reference( cache.Size() );
+	BenchScene moved = scene;
+	moved.light = cache.Light();
+	Populate( reference, moved, angle, extra );
+	reference.Update();
+	return reference.Depth() == cache.Depth();
+}
+
+//--------------------------------------------------------------------------------------
+// Checks
+//--------------------------------------------------------------------------------------
+static void RunChecks( const BenchScene& scene )
+{
+	const int size = 512, allTiles = ( size / CPU_SHADOW_TILE ) * ( size / CPU_SHADOW_TILE );
+
+	ShadowDirtyTiles tiles;
+	tiles.Resize( size );
+	CpuShadowRect rect = { 40, 10, 70, 33 };
+	tiles.Mark( rect );
+	tiles.Mark( rect );
+	Check( tiles.Count() == 4 && tiles.Dirty( 1, 0 ) && tiles.Dirty( 2, 1 ) && tiles.Dirty( 1, 1 ) && !tiles.Dirty( 0, 0 ) && !tiles.Dirty( 3, 0 ),
+		   "dirty tiles: a rect marks the tiles it touches, once" );
+
+	// a triangle drawn through two halves of the map is the triangle drawn at once
+	vector<float> whole( size * size, 1.0f ), halves( size * size, 1.0f );
+	Vec4 a = MakeVec4( 10.3f, 20.7f, 0.2f, 1.0f ), b = MakeVec4( 400.1f, 90.2f, 0.6f, 1.0f ), c = MakeVec4( 150.5f, 480.9f, 0.9f, 1.0f );
+	CpuShadowRect all = { 0, 0, size, size }, left = { 0, 0, 200, size }, right = { 200, 0, size, size };
+	unsigned int covered = DrawShadowTriangle( a, b, c, all, size, &whole[0] );
+	unsigned int split = DrawShadowTriangle( a, c, b, left, size, &halves[0] ) + DrawShadowTriangle( a, b, c, right, size, &halves[0] );
+	Check( covered > 0 && covered == split && whole == halves, "rasterizer: both faces, the same through any rect" );
+
+	ShadowCache cache( size );
+	const float step = 0.05f;
+	int caster = Populate( cache, scene, 0.0f );
+	ShadowCacheStats stats;
+	cache.Update( &stats );
+	Check( stats.lightChanged && stats.dirtyTiles == ( unsigned int )allTiles && stats.staticTiles == ( unsigned int )allTiles,
+		   "first update renders every tile" );
+
+	cache.Update( &stats );
+	Check( !stats.lightChanged && stats.dirtyTiles == 0 && !stats.staticTriangles && !stats.dynamicTriangles,
+		   "nothing changed: nothing re-rendered" );
+	cache.SetInstance( caster, CasterWorld( 0.0f ) );
+	cache.Update( &stats );
+	Check( stats.dirtyTiles == 0, "the same world again: nothing re-rendered" );
+
+	// spinning: a few tiles, none of the static cache, and the same map as a full render
+	bool exact = true, few = true;
+	for( int frame = 1; frame <= 8; ++frame )
+	{
+		cache.SetInstance( caster, CasterWorld( frame * step ) );
+		cache.Update( &stats );
+		few = few && stats.dirtyTiles > 0 && stats.dirtyTiles < ( unsigned int )allTiles / 4 && !stats.staticTiles;
+		exact = exact && MatchesFullRender( cache, scene, frame * step );
+	}
+	Check( few, "spinning caster: only its tiles, static cache kept" );
+	Check( exact, "spinning caster: map equals a full render" );
+
+	// the caster shadows the ground under it; far from it the ground is lit
+	const float bias = 0.0005f;
+	Vec3 lightPos = MakeVec3( 0.0f, 1600.0f, -400.0f );
+	Vec3 casterCentre = MakeVec3( 0.0f, 250.0f, 0.0f );
+	Vec3 under = casterCentre + ( casterCentre - lightPos ) * ( 250.0f / 1600.0f );
+	Check( ShadowVisibility( cache, under, bias ) == 0.0f && ShadowVisibility( cache, MakeVec3( 0.0f, 0.0f, -850.0f ), bias ) == 1.0f,
+		   "visibility: shadowed under the caster, lit away from it" );
+
+	// a static caster added: its region only, then the same as a full render
+	CpuMesh extra;
+	AddSphere( extra, 500.0f, 60.0f, 0.0f, 60.0f, 12, 24 );
+	cache.AddStatic( extra, Mat4Identity() );
+	cache.Update( &stats );
+	Check( stats.staticTiles > 0 && stats.staticTiles < ( unsigned int )allTiles / 4 &&
+		   MatchesFullRender( cache, scene, 8 * step, &extra ), "static caster added: its tiles only, exact" );
+
+	// a moved light re-renders everything
+	cache.SetLight( MakeLight( 200.0f ) );
+	cache.Update( &stats );
+	Check( stats.lightChanged && stats.dirtyTiles == ( unsigned int )allTiles && MatchesFullRender( cache, scene, 8 * step, &extra ),
+		   "light moved: every tile, exact" );
+
+	cache.Invalidate();
+	cache.Update( &stats );
+	Check( stats.dirtyTiles == ( unsigned int )allTiles && stats.staticTiles == ( unsigned int )allTiles, "invalidate: every tile" );
+}
+
+//--------------------------------------------------------------------------------------
+// Report: a frame of the spinning caster, incremental and full, for growing scenes
+//--------------------------------------------------------------------------------------
+static int Usage()
+{
+	fprintf( stderr, "usage: ShadowCacheBench [size] [-mesh m.sdkmesh] [-frames n]\n" );
+	return 2;
+}
+
+int main( int argc, char* argv[] )
+{
+	int size = 1024, frames = 30;
+	const char* meshPath = NULL;
+	int arg = 1;
+	if( argc > 1 && argv[1][0] != '-' )
+	{
+		size = atoi( argv[1] );
+		arg = 2;
+	}
+	for( ; arg < argc; ++arg )
+	{
+		if( arg + 1 >= argc )
+			return Usage();
+		if( !strcmp( argv[arg], "-mesh" ) )
+			meshPath = argv[++arg];
+		else if( !strcmp( argv[arg], "-frames" ) )
+			frames = atoi( argv[++arg] );
+		else
+			return Usage();
+	}
+	if( size < CPU_SHADOW_TILE || size % CPU_SHADOW_TILE || frames <= 0 )
+		return Usage();
+
+	BenchScene scene;
+	AddGround( scene.ground, 1000.0f, 32 );
+	MakeSpheres( scene.spheres, 4 );
+	AddSphere( scene.caster, 0.0f, 0.0f, 0.0f, 1.0f, 16, 32 );
+	scene.light = MakeLight( 0.0f );
+	RunChecks( scene );
+
+	if( meshPath )
+	{
+		// the mesh is about 200 across (the sample's); the caster scales it to 500
+		string error;
+		CpuMesh mesh;
+		if( !LoadCpuMesh( meshPath, mesh, &error ) )
+		{
+			fprintf( stderr, "%s\n", error.c_str() );
+			return 1;
+		}
+		float radius = 0.0f;
+		for( size_t i = 0; i < mesh.vertices.size(); ++i )
+			radius = max( radius, Vec3Length( MakeVec3( mesh.vertices[i].pos[0], mesh.vertices[i].pos[1], mesh.vertices[i].pos[2] ) ) );
+		for( size_t i = 0; i < mesh.vertices.size() && radius > 0.0f; ++i )
+			for( int k = 0; k < 3; ++k )
+				mesh.vertices[i].pos[k] /= radius;
+		scene.caster = mesh;
+	}
+
+	printf( "\n%dx%d map, %dx%d tiles, caster %s spinning %d frames\n", size, size, CPU_SHADOW_TILE, CPU_SHADOW_TILE,
+			meshPath ? meshPath : "(flattened sphere)", frames );
+	printf( "%-8s %10s %9s %9s %9s %11s %11s %9s\n", "spheres", "static tri", "full ms", "incr ms", "dirty", "full tris",
+			"incr tris", "speedup" );
+	const int sides[] = { 4, 8, 16, 32 };
+	for( int s = 0; s < ( int )( sizeof( sides ) / sizeof( sides[0] ) ); ++s )
+	{
+		MakeSpheres( scene.spheres, sides[s] );
+		ShadowCache cache( size );
+		int caster = Populate( cache, scene, 0.0f );
+		cache.Update();
+
+		// every frame both ways: moved, then everything again
+		double fullMs = 0.0, incrementalMs = 0.0;
+		unsigned long long dirty = 0, fullTriangles = 0, incrementalTriangles = 0;
+		for( int frame = 1; frame <= frames; ++frame )
+		{
+			ShadowCacheStats stats;
+			cache.SetInstance( caster, CasterWorld( frame * 0.05f ) );
+			Clock::time_point start = Clock::now();
+			cache.Update( &stats );
+			incrementalMs += Milliseconds( start );
+			dirty += stats.dirtyTiles;
+			incrementalTriangles += stats.staticTriangles + stats.dynamicTriangles;
+
+			cache.Invalidate();
+			start = Clock::now();
+			cache.Update( &stats );
+			fullMs += Milliseconds( start );
+			fullTriangles += stats.staticTriangles + stats.dynamicTriangles;
+		}
+		printf( "%-8d %10u %9.3f %9.3f %8.1f%% %11llu %11llu %8.1fx\n", ( int )scene.spheres.subsets.size(),
+				cache.StaticTriangles(), fullMs / frames, incrementalMs / frames,
+				100.0 * dirty / ( ( double )frames * ( size / CPU_SHADOW_TILE ) * ( size / CPU_SHADOW_TILE ) ),
+				fullTriangles / frames, incrementalTriangles / frames, incrementalMs > 0.0 ? fullMs / incrementalMs : 0.0 );
+	}
+	printf( "(per frame, averaged: ms of Update, dirty tiles of the map, triangles drawn counted once per tile)\n" );
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,401 @@
+//--------------------------------------------------------------------------------------
+// File: StreamBench.cpp
+//
+// Generates a large terrain scene (one chunk per tile) and flies a camera over it in
+// real time with a SceneStreamer under a memory budget: chunks in view that aren't
+// mapped yet count as misses (pop-in), the ones under the camera are required (stalls).
+// Compares ranking by distance alone, by screen-space importance, and by importance
+// with the camera's predicted motion. Also checks splitting, the index, checksums and
+// the LRU order.
+// Usage: StreamBench [directory [tiles per side [budget MB [frames]]]]
+// The scene is generated into directory (default StreamScene) unless it is there; the
+// sample streams it from a directory called Scene.
+//--------------------------------------------------------------------------------------
+#include "../Portable/SceneStream.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#if defined( _WIN32 )
+#include <direct.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+typedef chrono::high_resolution_clock Clock;
+
+static int failures = 0;
+
+static double Milliseconds( const Clock::time_point& start )
+{
+	return chrono::duration<double, milli>( Clock::now() - start ).count();
+}
+
+static void Check( bool ok, const char* what )
+{
+	printf( "%-56s %s\n", what, ok ? "ok" : "FAILED" );
+	if( !ok )
+		++failures;
+}
+
+static void MakeDir( const string& directory )
+{
+#if defined( _WIN32 )
+	_mkdir( directory.c_str() );
+#else
+	mkdir( directory.c_str(), 0755 );
+#endif
+}
+
+// Drops the chunk files from the page cache, so loads read the disk again (Linux)
+static bool DropPageCache( const SceneIndex& index )
+{
+#if defined( __linux__ )
+	for( size_t i = 0; i < index.chunks.size(); ++i )
+	{
+		int fd = open( ( index.directory + "/" + index.chunks[i].file ).c_str(), O_RDONLY );
+		if( fd < 0 )
+			return false;
+		posix_fadvise( fd, 0, 0, POSIX_FADV_DONTNEED );
+		close( fd );
+	}
+	return true;
+#else
+	( void )index;
+	return false;
+#endif
+}
+
+//--------------------------------------------------------------------------------------
+// The terrain
+//--------------------------------------------------------------------------------------
+#define TILE_SIZE 64.0f
+#define TILE_GRID 96						// vertices per tile side
+
+static float Height( float x, float z )
+{
+	return 12.0f * sinf( x * 0.013f ) * cosf( z * 0.011f ) + 4.0f * sinf( x * 0.071f + z * 0.053f ) +
+		   1.5f * cosf( x * 0.29f - z * 0.23f );
+}
+
+static void MakeTile( int tx, int tz, int grid, vector<FloatVertex>& vertices, vector<unsigned int>& indices )
+{
+	vertices.clear();
+	indices.clear();
+	float step = TILE_SIZE / ( grid - 1 );
+	for( int z = 0; z < grid; ++z )
+		for( int x = 0; x < grid; ++x )
+		{
+			FloatVertex v;
+			float wx = tx * TILE_SIZE + x * step, wz = tz * TILE_SIZE + z * step;
+			v.pos[0] = wx;
+			v.pos[1] = Height( wx, wz );
+			v.pos[2] = wz;
+			float dx = ( Height( wx + 0.01f, wz ) - Height( wx - 0.01f, wz ) ) / 0.02f;
+			float dz = ( Height( wx, wz + 0.01f ) - Height( wx, wz - 0.01f ) ) / 0.02f;
+			float length = sqrtf( dx * dx + 1.0f + dz * dz );
+			v.normal[0] = -dx / length;
+			v.normal[1] = 1.0f / length;
+			v.normal[2] = -dz / length;
+			v.uv[0] = wx / TILE_SIZE;
+			v.uv[1] = wz / TILE_SIZE;
+			vertices.push_back( v );
+		}
+	for( int z = 0; z + 1 < grid; ++z )
+		for( int x = 0; x + 1 < grid; ++x )
+		{
+			unsigned int i = z * grid + x;
+			unsigned int quad[6] = { i, i + grid, i + 1, i + 1, i + grid, i + grid + 1 };
+			indices.insert( indices.end(), quad, quad + 6 );
+		}
+}
+
+static bool GenerateScene( const string& directory, int side, SceneIndex& index )
+{
+	MakeDir( directory );
+	index.directory = directory;
+	index.chunks.clear();
+	vector<FloatVertex> vertices;
+	vector<unsigned int> indices;
+	for( int tz = 0; tz < side; ++tz )
+		for( int tx = 0; tx < side; ++tx )
+		{
+			MakeTile( tx, tz, TILE_GRID, vertices, indices );
+			if( !AddChunk( index, vertices.data(), ( int )vertices.size(), indices.data(), ( int )indices.size() ) )
+				return false;
+		}
+	return WriteSceneIndex( index );
+}
+
+//--------------------------------------------------------------------------------------
+// The flight
+//--------------------------------------------------------------------------------------
+struct FlightResult
+{
+	SceneStreamer::Stats	stats;
+	unsigned long long		visible;		// chunk draws wanted
+	double					worstFrameMs;
+};
+
+static void CameraAt( double t, float extent, StreamView& view )
+{
+	// figure eights over the middle of the terrain at 150 units/s or so
+	float cx = extent * 0.5f, r = extent * 0.35f;
+	float a = ( float )( t * 0.18 );
+	float x = cx + r * sinf( a ), z = cx + r * sinf( 2.0f * a ) * 0.6f;
+	float dx = r * cosf( a ) * 0.18f, dz = r * cosf( 2.0f * a ) * 1.2f * 0.18f;
+	float length = sqrtf( dx * dx + dz * dz );
+	view.eye[0] = x;
+	view.eye[1] = Height( x, z ) + 25.0f;
+	view.eye[2] = z;
+	view.velocity[0] = dx;
+	view.velocity[1] = 0.0f;
+	view.velocity[2] = dz;
+	// looking ahead and a little down
+	view.direction[0] = dx / length * 0.96f;
+	view.direction[1] = -0.28f;
+	view.direction[2] = dz / length * 0.96f;
+	view.fovY = 3.14159f / 4.0f;
+	view.screenHeight = 768.0f;
+}
+
+static bool InView( const ChunkInfo& chunk, const StreamView& view, float minPixels )
+{
+	float d[3], distance = 0.0f, along = 0.0f;
+	for( int c = 0; c < 3; ++c )
+	{
+		d[c] = chunk.center[c] - view.eye[c];
+		distance += d[c] * d[c];
+		along += d[c] * view.direction[c];
+	}
+	distance = sqrtf( distance );
+	if( distance <= chunk.radius )
+		return true;
+	float pixels = 2.0f * chunk.radius / distance * view.screenHeight / ( 2.0f * tanf( view.fovY * 0.5f ) );
+	// inside a cone a bit wider than the frustum's diagonal
+	return pixels >= minPixels && along >= distance * cosf( view.fovY * 0.9f ) - chunk.radius;
+}
+
+static FlightResult Fly( const SceneIndex& index, int side, size_t budget, int frames, float lookahead, float behindScale )
+{
+	StreamSettings settings;
+	settings.budgetBytes = budget;
+	settings.loadThreads = 2;
+	settings.minPixels = 6.0f;
+	settings.behindScale = behindScale;
+	SceneStreamer streamer( index, settings );
+
+	FlightResult result;
+	result.visible = 0;
+	result.worstFrameMs = 0.0;
+	const double frameSeconds = 1.0 / 60.0;
+	float extent = side * TILE_SIZE;
+	int tilesPerSide = side;
+	Clock::time_point start = Clock::now();
+	for( int f = 0; f < frames; ++f )
+	{
+		Clock::time_point frameStart = Clock::now();
+		StreamView view;
+		CameraAt( f * frameSeconds, extent, view );
+		view.lookahead = lookahead;
+		streamer.Update( view );
+
+		// the tile under the camera has to be there (ground, collision)
+		int tx = min( max( ( int )( view.eye[0] / TILE_SIZE ), 0 ), tilesPerSide - 1 );
+		int tz = min( max( ( int )( view.eye[2] / TILE_SIZE ), 0 ), tilesPerSide - 1 );
+		streamer.Require( tz * tilesPerSide + tx );
+
+		// the rest is drawn if it is there
+		for( size_t c = 0; c < index.chunks.size(); ++c )
+			if( InView( index.chunks[c], view, settings.minPixels ) )
+			{
+				++result.visible;
+				streamer.Acquire( ( unsigned int )c );
+			}
+
+		result.worstFrameMs = max( result.worstFrameMs, Milliseconds( frameStart ) );
+		this_thread::sleep_until( start + chrono::microseconds( ( long long )( ( f + 1 ) * frameSeconds * 1e6 ) ) );
+	}
+	result.stats = streamer.GetStats();
+	return result;
+}
+
+//--------------------------------------------------------------------------------------
+// Checks on a small scene
+//--------------------------------------------------------------------------------------
+static void SmallChecks( const string& directory )
+{
+	MakeDir( directory );
+
+	// 3x3 tiles as one mesh, split back into cells of a tile
+	vector<FloatVertex> mesh, tile;
+	vector<unsigned int> meshIndices, tileIndices;
+	for( int tz = 0; tz < 3; ++tz )
+		for( int tx = 0; tx < 3; ++tx )
+		{
+			MakeTile( tx, tz, 17, tile, tileIndices );
+			for( size_t i = 0; i < tileIndices.size(); ++i )
+				meshIndices.push_back( tileIndices[i] + ( unsigned int )mesh.size() );
+			mesh.insert( mesh.end(), tile.begin(), tile.end() );
+		}
+	SceneIndex index;
+	index.directory = directory;
+	int chunks = SplitIntoChunks( index, mesh.data(), ( int )mesh.size(), meshIndices.data(), ( int )meshIndices.size(), TILE_SIZE );
+	size_t triangles = 0;
+	bool positionsOk = true;
+	for( size_t c = 0; c < index.chunks.size(); ++c )
+	{
+		MappedFile file;
+		ChunkView view;
+		if( !file.Open( directory + "/" + index.chunks[c].file ) || !ParseChunk( file.Data(), file.Size(), view ) )
+		{
+			positionsOk = false;
+			continue;
+		}
+		triangles += view.header->numIndices / 3;
+		vector<FloatVertex> decoded( view.header->numVertices );
+		DecodeVertices( view.vertices, view.header->numVertices, view.header->box, decoded.data() );
+		for( size_t v = 0; v < decoded.size(); ++v )
+			for( int a = 0; a < 3; ++a )
+				positionsOk = positionsOk && decoded[v].pos[a] >= index.chunks[c].boxMin[a] - 0.01f &&
+							  decoded[v].pos[a] <= index.chunks[c].boxMax[a] + 0.01f &&
+							  index.chunks[c].boxMax[a] - index.chunks[c].boxMin[a] < TILE_SIZE * 1.1f;
+	}
+	// the cells are 3D: the hills cross y = 0, so more than the 9 tiles
+	Check( chunks >= 9 && triangles == meshIndices.size() / 3 && positionsOk, "split into cells keeps every triangle" );
+	size_t splitFiles = index.chunks.size();
+
+	// the rest on tiles of one size
+	index.chunks.clear();
+	for( int t = 0; t < 9; ++t )
+	{
+		MakeTile( t % 3, t / 3, 17, tile, tileIndices );
+		AddChunk( index, tile.data(), ( int )tile.size(), tileIndices.data(), ( int )tileIndices.size() );
+	}
+	SceneIndex read;
+	Check( WriteSceneIndex( index ) && ReadSceneIndex( directory, read ) && read.chunks.size() == 9 &&
+		   read.chunks[4].bytes == index.chunks[4].bytes && read.chunks[4].file == index.chunks[4].file &&
+		   fabsf( read.chunks[4].radius - index.chunks[4].radius ) < 1e-3f, "scene.idx round trip" );
+
+	// LRU: room for 3 chunks, nothing wanted (the camera is far away)
+	StreamSettings settings;
+	settings.budgetBytes = ( size_t )index.chunks[0].bytes * 3 + 16;
+	settings.loadThreads = 1;
+	SceneStreamer streamer( read, settings );
+	StreamView far;
+	memset( &far, 0, sizeof( far ) );
+	far.eye[1] = 1e7f;
+	far.direction[1] = -1.0f;
+	far.fovY = 1.0f;
+	far.screenHeight = 768.0f;
+	for( unsigned int c = 0; c < 3; ++c )
+	{
+		streamer.Update( far );
+		streamer.Require( c );
+	}
+	streamer.Update( far );
+	streamer.Acquire( 0 );							// 1 is now the least recently used
+	streamer.Update( far );
+	bool loaded = streamer.Require( 3 ) != NULL;
+	vector<unsigned int> evicted;
+	streamer.TakeEvicted( evicted );
+	SceneStreamer::Stats stats = streamer.GetStats();
+	Check( loaded && evicted.size() == 1 && evicted[0] == 1 && stats.residentChunks == 3 &&
+		   stats.peakResidentBytes <= settings.budgetBytes, "LRU evicts the least recently used chunk" );
+	Check( streamer.Acquire( 1 ) == NULL && streamer.Acquire( 0 ) != NULL && streamer.Acquire( 2 ) != NULL, "evicted chunk misses" );
+
+	// a corrupt chunk doesn't load
+	string path = directory + "/" + read.chunks[5].file;
+	FILE* file = fopen( path.c_str(), "r+b" );
+	if( file )
+	{
+		fseek( file, ( long )read.chunks[5].bytes - 5, SEEK_SET );
+		fputc( 0x5a ^ fgetc( file ), file );
+		fclose( file );
+	}
+	streamer.Update( far );
+	Check( file && streamer.Require( 5 ) == NULL, "checksum mismatch rejected" );
+
+	char name[32];
+	for( size_t c = 0; c < splitFiles; ++c )
+	{
+		sprintf( name, "/chunk_%05u.chk", ( unsigned int )c );
+		remove( ( directory + name ).c_str() );
+	}
+	remove( ( directory + "/scene.idx" ).c_str() );
+}
+
+int main( int argc, char* argv[] )
+{
+	string directory = argc >= 2 ? argv[1] : "StreamScene";
+	int side = argc >= 3 ? atoi( argv[2] ) : 32;
+	int budgetMB = argc >= 4 ? atoi( argv[3] ) : 48;
+	int frames = argc >= 5 ? atoi( argv[4] ) : 600;
+	if( side < 2 || budgetMB <= 0 || frames <= 0 )
+	{
+		fprintf( stderr, "usage: StreamBench [directory [tiles per side [budget MB [frames]]]]\n" );
+		return 1;
+	}
+
+	SmallChecks( directory + "_checks" );
+
+	SceneIndex index;
+	if( !ReadSceneIndex( directory, index ) || index.chunks.size() != ( size_t )side * side )
+	{
+		Clock::time_point start = Clock::now();
+		if( !GenerateScene( directory, side, index ) )
+		{
+			fprintf( stderr, "can't write the scene to %s\n", directory.c_str() );
+			return 1;
+		}
+		printf( "generated %d x %d tiles in %.0f ms\n", side, side, Milliseconds( start ) );
+	}
+	unsigned long long sceneBytes = 0;
+	for( size_t c = 0; c < index.chunks.size(); ++c )
+		sceneBytes += index.chunks[c].bytes;
+	size_t budget = ( size_t )budgetMB << 20;
+	printf( "\n%u chunks, %.1f MB, budget %d MB, %d frames at 60 Hz, page cache %s\n\n", ( unsigned int )index.chunks.size(),
+			sceneBytes / 1048576.0, budgetMB, frames, DropPageCache( index ) ? "dropped before every run" : "kept" );
+
+	struct Config
+	{
+		const char*		name;
+		float			lookahead;
+		float			behindScale;
+	};
+	const Config configs[] =
+	{
+		{ "distance", 0.0f, 1.0f },
+		{ "screen importance", 0.0f, 0.25f },
+		{ "importance + prediction (1 s)", 1.0f, 0.25f },
+	};
+	printf( "%-30s %8s %7s %7s %9s %7s %7s %8s %9s\n", "ranking", "misses", "miss %", "stalls", "stall ms", "loads",
+			"evicts", "peak MB", "load MB/s" );
+	for( size_t c = 0; c < sizeof( configs ) / sizeof( configs[0] ); ++c )
+	{
+		DropPageCache( index );
+		FlightResult r = Fly( index, side, budget, frames, configs[c].lookahead, configs[c].behindScale );
+		const SceneStreamer::Stats& s = r.stats;
+		double loadedMB = 0.0;
+		printf( "%-30s %8llu %6.2f%% %7llu %9.1f %7llu %7llu %8.1f %9.0f\n", configs[c].name, s.misses - s.stalls,
+				100.0 * ( s.misses - s.stalls ) / max( 1ull, r.visible ), s.stalls, s.stallMs, s.loads, s.evictions,
+				s.peakResidentBytes / 1048576.0,
+				( loadedMB = s.loads * ( double )index.chunks[0].bytes / 1048576.0 ) / max( 1e-3, s.loadMs / 1000.0 ) );
+		if( c == sizeof( configs ) / sizeof( configs[0] ) - 1 )
+		{
+			printf( "\n" );
+			Check( s.peakResidentBytes <= budget + index.chunks[0].bytes, "resident bytes stay within the budget" );
+			Check( s.loads > 0 && r.worstFrameMs < 1000.0, "chunks stream in during the flight" );
+		}
+	}
+	return failures ? 1 : 0;
+}
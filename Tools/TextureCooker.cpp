@@ -0,0 +1,271 @@
+//--------------------------------------------------------------------------------------
+// File: TextureCooker.cpp
+//
+// Cooks a source image (PNG, TGA, PPM/PAM) into a .ctex container: mips filtered in
+// linear space, block compressed, laid out for upload as-is.
+// Usage: TextureCooker input output.ctex [-format rgba8|bc1|bc3|bc5] [-filter box|kaiser]
+//                      [-mips n] [-linear] [-srgbformat] [-threads n]
+//        TextureCooker -bench [size [threads]]
+//
+// -linear filters the mips without the sRGB curve (normal maps, vectors.png);
+// -srgbformat marks the texture *_SRGB so the sampler linearizes it. The sample's
+// shaders expect gamma-space values from the diffuse textures, so it is off by default.
+//--------------------------------------------------------------------------------------
+#include "../Portable/MappedFile.h"
+#include "../Portable/TextureCook.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+using namespace std;
+
+volatile unsigned int touchedSink;			// keeps the reads of the mapped file
+
+static const char* formatNames[NUM_COOKED_FORMATS] = { "rgba8", "bc1", "bc3", "bc5" };
+
+static double Milliseconds( const chrono::high_resolution_clock::time_point& start )
+{
+	return chrono::duration<double, milli>( chrono::high_resolution_clock::now() - start ).count();
+}
+
+static size_t PixelsOf( const vector<Image>& mips )
+{
+	size_t pixels = 0;
+	for( size_t i = 0; i < mips.size(); ++i )
+		pixels += ( size_t )mips[i].width * mips[i].height;
+	return pixels;
+}
+
+// PSNR of the channels the format keeps
+static double PSNR( const Image& a, const Image& b, CookedFormat format )
+{
+	int channels = format == COOKED_BC5 ? 2 : format == COOKED_BC1 ? 3 : 4;
+	double sumSq = 0.0;
+	for( size_t i = 0; i < a.rgba.size(); i += 4 )
+		for( int c = 0; c < channels; ++c )
+		{
+			double d = ( double )a.rgba[i + c] - b.rgba[i + c];
+			sumSq += d * d;
+		}
+	double mse = sumSq / ( a.rgba.size() / 4 * channels );
+	return mse == 0.0 ? 99.0 : 10.0 * log10( 255.0 * 255.0 / mse );
+}
+
+struct CookResult
+{
+	double		mipsMs, encodeMs;
+	size_t		pixels, bytes;
+	double		psnr;			// of level 0
+};
+
+static CookResult Cook( const Image& image, CookedFormat format, MipFilter filter, bool srgb, int maxMips, int threads,
+						vector<CookedLevel>& levels )
+{
+	CookResult result;
+	vector<Image> mips;
+	chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+	GenerateMips( image, filter, srgb, maxMips, threads, mips );
+	result.mipsMs = Milliseconds( start );
+
+	start = chrono::high_resolution_clock::now();
+	levels.resize( mips.size() );
+	for( size_t i = 0; i < mips.size(); ++i )
+		EncodeLevel( mips[i], format, threads, levels[i] );
+	result.encodeMs = Milliseconds( start );
+
+	result.pixels = PixelsOf( mips );
+	result.bytes = 0;
+	for( size_t i = 0; i < levels.size(); ++i )
+		result.bytes += levels[i].data.size();
+	Image decoded;
+	DecodeLevel( levels[0], format, decoded );
+	result.psnr = PSNR( image, decoded, format );
+	return result;
+}
+
+// Something with gradients, edges and noise to compress
+static void MakeTestImage( int size, Image& image )
+{
+	image.width = image.height = size;
+	image.rgba.resize( ( size_t )size * size * 4 );
+	unsigned int seed = 1;
+	for( int y = 0; y < size; ++y )
+		for( int x = 0; x < size; ++x )
+		{
+			seed = seed * 1664525u + 1013904223u;
+			int noise = ( int )( seed >> 28 ) - 8;
+			unsigned char* p = &image.rgba[( ( size_t )y * size + x ) * 4];
+			bool stripe = ( ( x / 64 ) + ( y / 64 ) ) & 1;
+			float dx = x - size * 0.5f, dy = y - size * 0.5f;
+			bool disc = dx * dx + dy * dy < size * size * 0.09f;
+			p[0] = ( unsigned char )min( max( x * 255 / size + noise, 0 ), 255 );
+			p[1] = ( unsigned char )min( max( ( stripe ? 200 : 60 ) + noise, 0 ), 255 );
+			p[2] = ( unsigned char )min( max( ( disc ? 220 : y * 255 / size ) + noise, 0 ), 255 );
+			p[3] = ( unsigned char )( disc ? 255 : 128 + ( x & 127 ) );
+		}
+}
+
+static int Bench( int size, int threads )
+{
+	Image image;
+	MakeTestImage( size, image );
+	printf( "%dx%d test image, %d threads\n\n", size, size, threads );
+
+	// mip generation
+	printf( "%-24s %10s %10s\n", "mips", "ms", "MPix/s" );
+	vector<Image> mips;
+	const char* filterNames[2] = { "box", "kaiser" };
+	for( int f = 0; f < 2; ++f )
+	{
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		GenerateMips( image, ( MipFilter )f, true, 0, threads, mips );
+		double ms = Milliseconds( start );
+		printf( "%-24s %10.2f %10.1f\n", filterNames[f], ms, size * ( double )size / ( ms * 1000.0 ) );
+	}
+
+	// encoders, on the whole chain
+	size_t pixels = PixelsOf( mips );
+	printf( "\n%-24s %10s %10s %10s %10s %8s %8s\n", "encoder", "1 thr ms", "MPix/s", "N thr ms", "MPix/s", "PSNR", "ratio" );
+	for( int f = 0; f < NUM_COOKED_FORMATS; ++f )
+	{
+		CookedFormat format = ( CookedFormat )f;
+		vector<CookedLevel> levels( mips.size() );
+		double ms[2];
+		for( int pass = 0; pass < 2; ++pass )
+		{
+			chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+			for( size_t i = 0; i < mips.size(); ++i )
+				EncodeLevel( mips[i], format, pass == 0 ? 1 : threads, levels[i] );
+			ms[pass] = Milliseconds( start );
+		}
+		size_t bytes = 0;
+		for( size_t i = 0; i < levels.size(); ++i )
+			bytes += levels[i].data.size();
+		Image decoded;
+		DecodeLevel( levels[0], format, decoded );
+		printf( "%-24s %10.2f %10.1f %10.2f %10.1f %8.2f %7.1fx\n", formatNames[f], ms[0], pixels / ( ms[0] * 1000.0 ),
+				ms[1], pixels / ( ms[1] * 1000.0 ), PSNR( mips[0], decoded, format ), pixels * 4.0 / bytes );
+	}
+
+	// load: decoding + mips at runtime, against mapping the cooked file
+	vector<CookedLevel> levels;
+	Cook( image, COOKED_BC1, MIP_KAISER, true, 0, threads, levels );
+	const char* path = "TextureCookerBench.ctex";
+	if( !WriteCookedTexture( path, COOKED_BC1, false, levels ) )
+	{
+		fprintf( stderr, "can't write %s\n", path );
+		return 1;
+	}
+	chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+	GenerateMips( image, MIP_BOX, false, 0, 1, mips );
+	double runtimeMs = Milliseconds( start );
+
+	start = chrono::high_resolution_clock::now();
+	MappedFile file;
+	CookedTextureView view;
+	unsigned int touched = 0;
+	if( file.Open( path ) && ParseCookedTexture( file.Data(), file.Size(), view ) )
+		for( unsigned int i = 0; i < view.header->mipCount; ++i )
+			for( unsigned int b = 0; b < view.header->levels[i].size; b += 4096 )
+				touched += view.levels[i][b];			// what the upload would read
+	double cookedMs = Milliseconds( start );
+	file.Close();
+	remove( path );
+	touchedSink = touched;
+	printf( "\n%-24s %10.2f ms\n", "runtime mips (RGBA8)", runtimeMs );
+	printf( "%-24s %10.2f ms\n", "map cooked BC1", cookedMs );
+	printf( "%-24s %10.1f MB -> %0.1f MB\n", "texture memory", PixelsOf( mips ) * 4.0 / ( 1 << 20 ),
+			( double )( ( size_t )size * size / 2 * 4 / 3 ) / ( 1 << 20 ) );
+	return 0;
+}
+
+int main( int argc, char* argv[] )
+{
+	int threads = ( int )thread::hardware_concurrency();
+	if( threads <= 0 )
+		threads = 1;
+	if( argc >= 2 && !strcmp( argv[1], "-bench" ) )
+		return Bench( argc >= 3 ? atoi( argv[2] ) : 2048, argc >= 4 ? atoi( argv[3] ) : threads );
+
+	const char* usage = "usage: TextureCooker input output.ctex [-format rgba8|bc1|bc3|bc5] [-filter box|kaiser]\n"
+						"                     [-mips n] [-linear] [-srgbformat] [-threads n]\n"
+						"       TextureCooker -bench [size [threads]]\n";
+	if( argc < 3 )
+	{
+		fprintf( stderr, "%s", usage );
+		return 1;
+	}
+	CookedFormat format = COOKED_BC1;
+	MipFilter filter = MIP_KAISER;
+	int maxMips = 0;
+	bool srgb = true, srgbFormat = false;
+	for( int i = 3; i < argc; ++i )
+	{
+		string arg = argv[i];
+		if( arg == "-format" && i + 1 < argc )
+		{
+			string name = argv[++i];
+			int f = 0;
+			while( f < NUM_COOKED_FORMATS && name != formatNames[f] )
+				++f;
+			if( f == NUM_COOKED_FORMATS )
+			{
+				fprintf( stderr, "unknown format %s\n%s", name.c_str(), usage );
+				return 1;
+			}
+			format = ( CookedFormat )f;
+		}
+		else if( arg == "-filter" && i + 1 < argc )
+			filter = !strcmp( argv[++i], "box" ) ? MIP_BOX : MIP_KAISER;
+		else if( arg == "-mips" && i + 1 < argc )
+			maxMips = atoi( argv[++i] );
+		else if( arg == "-threads" && i + 1 < argc )
+			threads = max( 1, atoi( argv[++i] ) );
+		else if( arg == "-linear" )
+			srgb = false;
+		else if( arg == "-srgbformat" )
+			srgbFormat = true;
+		else
+		{
+			fprintf( stderr, "unknown option %s\n%s", arg.c_str(), usage );
+			return 1;
+		}
+	}
+	if( format == COOKED_BC5 )
+		srgb = srgbFormat = false;			// two data channels
+
+	Image image;
+	string error;
+	chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+	if( !LoadImageFile( argv[1], image, &error ) )
+	{
+		fprintf( stderr, "%s: %s\n", argv[1], error.c_str() );
+		return 1;
+	}
+	double decodeMs = Milliseconds( start );
+	if( format != COOKED_RGBA8 && ( image.width % 4 || image.height % 4 ) )
+	{
+		fprintf( stderr, "%s: %dx%d, block compressed textures need multiples of 4\n", argv[1], image.width, image.height );
+		return 1;
+	}
+
+	vector<CookedLevel> levels;
+	CookResult result = Cook( image, format, filter, srgb, maxMips, threads, levels );
+	if( !WriteCookedTexture( argv[2], format, srgbFormat, levels ) )
+	{
+		fprintf( stderr, "can't write %s\n", argv[2] );
+		return 1;
+	}
+
+	printf( "%s: %dx%d -> %s, %s, %u mips (%s%s filter)\n", argv[1], image.width, image.height, argv[2],
+			formatNames[format], ( unsigned int )levels.size(), srgb ? "gamma-correct " : "", filter == MIP_BOX ? "box" : "kaiser" );
+	printf( "  decode %0.2f ms, mips %0.2f ms, encode %0.2f ms (%0.1f MPix/s, %d threads)\n", decodeMs, result.mipsMs,
+			result.encodeMs, result.pixels / ( result.encodeMs * 1000.0 ), threads );
+	printf( "  %0.1f KB (%0.1fx smaller than RGBA8 with mips), level 0 PSNR %0.2f dB\n", result.bytes / 1024.0,
+			result.pixels * 4.0 / result.bytes, result.psnr );
+	return 0;
+}
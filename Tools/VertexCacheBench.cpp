@@ -0,0 +1,212 @@
+//--------------------------------------------------------------------------------------
+// File: VertexCacheBench.cpp
+//
+// Checks the VertexCache (SIMD displacement against the shader's formula, cached
+// vertices against TransformMesh, invalidation by every version, eviction) and times
+// the vertex work of a frame with and without it: a still camera, a moving camera with
+// the puffiness left alone, the puffiness slider moving, and four views of two
+// instances drawn every frame.
+// Usage: VertexCacheBench [vertices [frames]]
+//--------------------------------------------------------------------------------------
+#include "../Portable/VertexCache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace std;
+
+typedef chrono::high_resolution_clock Clock;
+
+static int failures = 0;
+
+static double Milliseconds( const Clock::time_point& start )
+{
+	return chrono::duration<double, milli>( Clock::now() - start ).count();
+}
+
+static void Check( bool ok, const char* what )
+{
+	printf( "%-56s %s\n", what, ok ? "ok" : "FAILED" );
+	if( !ok )
+		++failures;
+}
+
+// A lumpy sphere of about count vertices
+static void MakeMesh( CpuMesh& mesh, int count )
+{
+	int columns = max( 8, ( int )sqrtf( count * 2.0f ) );
+	int rows = max( 4, count / columns );
+	mesh.vertices.resize( rows * columns );
+	for( int y = 0; y < rows; ++y )
+		for( int x = 0; x < columns; ++x )
+		{
+			float theta = 3.14159265f * ( y + 0.5f ) / rows, phi = 6.2831853f * x / columns;
+			FloatVertex& v = mesh.vertices[y * columns + x];
+			v.normal[0] = sinf( theta ) * cosf( phi );
+			v.normal[1] = cosf( theta );
+			v.normal[2] = sinf( theta ) * sinf( phi );
+			float radius = 100.0f + 5.0f * sinf( 7.0f * phi ) * sinf( 5.0f * theta );
+			for( int c = 0; c < 3; ++c )
+				v.pos[c] = v.normal[c] * radius;
+			v.uv[0] = ( float )x / columns;
+			v.uv[1] = ( float )y / rows;
+		}
+}
+
+static CpuCamera MakeCamera( float angle, float puffiness )
+{
+	CpuCamera camera;
+	camera.world = Mat4RotationZ( 3.14159265f );
+	camera.view = Mat4LookAtLH( MakeVec3( 800.0f * sinf( angle ), 0.0f, -800.0f * cosf( angle ) ), MakeVec3( 0.0f, 0.0f, 0.0f ),
+								MakeVec3( 0.0f, 1.0f, 0.0f ) );
+	camera.projection = Mat4PerspectiveFovLH( 3.14159265f / 4, 4.0f / 3.0f, 0.1f, 5000.0f );
+	camera.puffiness = puffiness;
+	return camera;
+}
+
+static bool SameVertices( const CpuRasterScratch& a, const CpuRasterScratch& b )
+{
+	return a.clip.size() == b.clip.size() &&
+		   !memcmp( &a.clip[0], &b.clip[0], a.clip.size() * sizeof( Vec4 ) ) &&
+		   !memcmp( &a.viewPosition[0], &b.viewPosition[0], a.viewPosition.size() * sizeof( Vec3 ) ) &&
+		   !memcmp( &a.viewNormal[0], &b.viewNormal[0], a.viewNormal.size() * sizeof( Vec3 ) );
+}
+
+static void RunChecks( const CpuMesh& mesh )
+{
+	// VS: input.Pos + input.Norm * Puffiness
+	CpuDisplacedVertices displaced;
+	DisplaceVertices( mesh, 7.5f, displaced );
+	bool same = displaced.position.size() == mesh.vertices.size();
+	for( size_t i = 0; same && i < mesh.vertices.size(); ++i )
+	{
+		const FloatVertex& v = mesh.vertices[i];
+		for( int c = 0; c < 3; ++c )
+			same = same && fabsf( ( &displaced.position[i].x )[c] - ( v.pos[c] + v.normal[c] * 7.5f ) ) < 1e-4f &&
+				   ( &displaced.normal[i].x )[c] == v.normal[c];
+	}
+	Check( same, "SIMD displacement matches the vertex shader" );
+
+	VertexCache cache;
+	CpuGBuffer gbuffer, direct;
+	CpuRasterScratch scratch;
+	CpuCamera camera = MakeCamera( 0.3f, 7.5f );
+	TransformMesh( mesh, camera, scratch, direct );
+	Versioned<Mat4> world, view;
+	world.Set( camera.world );
+	view.Set( camera.view );
+	const CpuRasterScratch* cached = &cache.Transform( mesh, 0, camera, 0, world.version, 0, view.version, gbuffer );
+	Check( SameVertices( *cached, scratch ) && gbuffer.projScaleY == direct.projScaleY && gbuffer.farZ == direct.farZ,
+		   "cached vertices are TransformMesh's" );
+
+	cache.Transform( mesh, 0, camera, 0, world.version, 0, view.version, gbuffer );
+	VertexCache::Stats stats = cache.GetStats();
+	Check( stats.transformHits == 1 && stats.transformMisses == 1 && stats.displaceHits == 1, "same versions hit" );
+
+	// every input invalidates
+	Check( !view.Set( camera.view ), "an unchanged value keeps its version" );
+	camera = MakeCamera( 0.4f, 7.5f );
+	view.Set( camera.view );
+	cached = &cache.Transform( mesh, 0, camera, 0, world.version, 0, view.version, gbuffer );
+	TransformMesh( mesh, camera, scratch, direct );
+	bool cameraMiss = SameVertices( *cached, scratch );
+	camera.puffiness = 2.0f;
+	cached = &cache.Transform( mesh, 0, camera, 0, world.version, 0, view.version, gbuffer );
+	TransformMesh( mesh, camera, scratch, direct );
+	bool puffMiss = SameVertices( *cached, scratch );
+	camera.world = Mat4RotationZ( 1.0f );
+	world.Set( camera.world );
+	cached = &cache.Transform( mesh, 0, camera, 0, world.version, 0, view.version, gbuffer );
+	TransformMesh( mesh, camera, scratch, direct );
+	bool worldMiss = SameVertices( *cached, scratch );
+	cache.Transform( mesh, 1, camera, 0, world.version, 0, view.version, gbuffer );
+	stats = cache.GetStats();
+	Check( cameraMiss && puffMiss && worldMiss && stats.transformMisses == 5 && stats.displaceMisses == 3,
+		   "camera, world, puffiness and mesh versions invalidate" );
+
+	// pairs beyond the capacity evict the least recently used
+	VertexCache small( 2 );
+	small.Transform( mesh, 0, camera, 0, 1, 0, 1, gbuffer );
+	small.Transform( mesh, 0, camera, 0, 1, 1, 1, gbuffer );
+	small.Transform( mesh, 0, camera, 0, 1, 0, 1, gbuffer );		// pair 0 is now the newest
+	small.Transform( mesh, 0, camera, 0, 1, 2, 1, gbuffer );		// evicts pair 1
+	small.Transform( mesh, 0, camera, 0, 1, 0, 1, gbuffer );
+	small.Transform( mesh, 0, camera, 0, 1, 1, 1, gbuffer );
+	stats = small.GetStats();
+	Check( stats.transformHits == 2 && stats.transformMisses == 4, "least recently used pair is evicted" );
+}
+
+//--------------------------------------------------------------------------------------
+// Frames
+//--------------------------------------------------------------------------------------
+enum Scenario { STILL, ORBIT, SLIDER, FOUR_VIEWS, NUM_SCENARIOS };
+static const char* scenarioNames[NUM_SCENARIOS] = { "still camera", "moving camera", "puffiness slider",
+													"2 instances x 2 cameras" };
+
+// The vertex work of frames of a scenario, cached or not; returns the milliseconds
+static double RunFrames( const CpuMesh& mesh, Scenario scenario, int frames, bool useCache, VertexCache::Stats& stats )
+{
+	VertexCache cache;
+	CpuRasterScratch scratch;
+	CpuGBuffer gbuffer;
+	Versioned<Mat4> worlds[2], views[2];
+	unsigned long long checksum = 0;
+	Clock::time_point start = Clock::now();
+	for( int f = 0; f < frames; ++f )
+	{
+		int passes = scenario == FOUR_VIEWS ? 4 : 1;
+		for( int p = 0; p < passes; ++p )
+		{
+			int instance = p / 2, cameraId = p % 2;
+			float angle = scenario == ORBIT ? f * 0.01f : cameraId * 1.5f;
+			float puffiness = scenario == SLIDER ? ( f % 20 ) * 0.5f : 2.0f;
+			CpuCamera camera = MakeCamera( angle, puffiness );
+			camera.world = camera.world * Mat4Translation( instance * 300.0f, 0.0f, 0.0f );
+			const CpuRasterScratch* vertices = &scratch;
+			if( useCache )
+			{
+				worlds[instance].Set( camera.world );
+				views[cameraId].Set( camera.view );
+				vertices = &cache.Transform( mesh, 0, camera, instance, worlds[instance].version, cameraId,
+											 views[cameraId].version, gbuffer );
+			}
+			else
+				TransformMesh( mesh, camera, scratch, gbuffer );
+			checksum += ( unsigned long long )vertices->clip[f % vertices->clip.size()].x;
+		}
+	}
+	double ms = Milliseconds( start );
+	stats = cache.GetStats();
+	return checksum == 1 ? -ms : ms;		// keeps the work from being optimized away
+}
+
+int main( int argc, char* argv[] )
+{
+	int vertices = argc >= 2 ? atoi( argv[1] ) : 100000;
+	int frames = argc >= 3 ? atoi( argv[2] ) : 200;
+	if( vertices <= 0 || frames <= 0 )
+	{
+		fprintf( stderr, "usage: VertexCacheBench [vertices [frames]]\n" );
+		return 1;
+	}
+
+	CpuMesh mesh;
+	MakeMesh( mesh, vertices );
+	RunChecks( mesh );
+
+	printf( "\n%u vertices, %d frames (SIMD backend: %s)\n\n", ( unsigned int )mesh.vertices.size(), frames, SIMDMATH_BACKEND );
+	printf( "%-26s %12s %12s %10s %10s %12s\n", "scenario", "direct ms", "cached ms", "speedup", "hit rate", "saved ms" );
+	for( int s = 0; s < NUM_SCENARIOS; ++s )
+	{
+		VertexCache::Stats stats;
+		double direct = RunFrames( mesh, ( Scenario )s, frames, false, stats );
+		double cached = RunFrames( mesh, ( Scenario )s, frames, true, stats );
+		printf( "%-26s %12.3f %12.3f %9.1fx %9.0f%% %12.3f\n", scenarioNames[s], direct / frames, cached / frames,
+				direct / max( cached, 1e-6 ), stats.HitRate() * 100.0, stats.SavedMs() / frames );
+	}
+	printf( "(per frame)\n\n" );
+	return failures ? 1 : 0;
+}
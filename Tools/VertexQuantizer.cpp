@@ -0,0 +1,244 @@
+//--------------------------------------------------------------------------------------
+// File: VertexQuantizer.cpp
+//
+// Converts the first vertex buffer of an .sdkmesh (position, normal, texcoord) into a
+// .qvtx: 16-byte quantized vertices plus a box per subset. The sample uses
+// tiny.sdkmesh.qvtx when it sits next to the mesh.
+// Usage: VertexQuantizer input.sdkmesh [output.qvtx]
+//        VertexQuantizer -bench [vertices]
+//
+// Both report the worst position/normal/uv error against its bound and the vertex fetch
+// bytes of the G-buffer pass before and after.
+//--------------------------------------------------------------------------------------
+#include "../Portable/MappedFile.h"
+#include "../Portable/SdkmeshFile.h"
+#include "../Portable/SimdMath.h"
+#include "../Portable/VertexQuantize.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+typedef chrono::high_resolution_clock Clock;
+
+static int failures = 0;
+
+static double Milliseconds( const Clock::time_point& start )
+{
+	return chrono::duration<double, milli>( Clock::now() - start ).count();
+}
+
+static void Check( bool ok, const char* what )
+{
+	printf( "%-56s %s\n", what, ok ? "ok" : "FAILED" );
+	if( !ok )
+		++failures;
+}
+
+//--------------------------------------------------------------------------------------
+// Report
+//--------------------------------------------------------------------------------------
+static QuantError Report( const vector<FloatVertex>& vertices, const QuantizedMesh& mesh, unsigned int sourceStride,
+						  unsigned long long indices )
+{
+	QuantError worst = { 0.0, 0.0, 0.0, 0.0, 0.0 };
+	printf( "%-8s %10s %12s %12s %10s %12s %12s\n", "range", "vertices", "pos error", "pos bound", "normal deg",
+			"uv error", "uv bound" );
+	for( size_t r = 0; r < mesh.ranges.size(); ++r )
+	{
+		const VertexRange& range = mesh.ranges[r];
+		QuantError e = MeasureQuantError( &vertices[range.first], &mesh.vertices[range.first], range.count, range.box );
+		printf( "%-8d %10u %12.3g %12.3g %10.4f %12.3g %12.3g\n", ( int )r, range.count, e.maxPosition, e.positionBound,
+				e.maxNormalDegrees, e.maxUV, e.uvBound );
+		worst.maxPosition = max( worst.maxPosition, e.maxPosition );
+		worst.positionBound = max( worst.positionBound, e.positionBound );
+		worst.maxNormalDegrees = max( worst.maxNormalDegrees, e.maxNormalDegrees );
+		worst.maxUV = max( worst.maxUV, e.maxUV );
+		worst.uvBound = max( worst.uvBound, e.uvBound );
+	}
+
+	// every index fetches a vertex unless the post-transform cache has it: vertices
+	// is the lower bound, indices the upper one
+	double before = ( double )vertices.size() * sourceStride, after = ( double )mesh.vertices.size() * sizeof( PackedVertex );
+	printf( "\n%-36s %12s %12s\n", "bytes", "float", "quantized" );
+	printf( "%-36s %12.0f %12.0f\n", "vertex buffer", before, after );
+	printf( "%-36s %12.0f %12.0f\n", "fetch per G-buffer pass (indices)", ( double )indices * sourceStride,
+			( double )indices * sizeof( PackedVertex ) );
+	printf( "%-36s %11.0f%%\n\n", "saved", 100.0 * ( 1.0 - after / before ) );
+	return worst;
+}
+
+//--------------------------------------------------------------------------------------
+// Benchmark mesh: a bumpy sphere in bands (one subset each), seams duplicated like an
+// exporter would, uvs wrapping past 1
+//--------------------------------------------------------------------------------------
+static void MakeTestMesh( int numVertices, vector<FloatVertex>& vertices, vector<VertexSpan>& subsets )
+{
+	int columns = max( 8, ( int )sqrt( ( double )numVertices ) );
+	int rows = max( 8, numVertices / columns );
+	int bands = 4;
+	vertices.clear();
+	subsets.clear();
+	for( int band = 0; band < bands; ++band )
+	{
+		VertexSpan span = { ( unsigned int )vertices.size(), 0 };
+		for( int y = band * rows / bands; y <= ( band + 1 ) * rows / bands; ++y )
+			for( int x = 0; x <= columns; ++x )
+			{
+				float theta = 3.14159265f * y / rows, phi = 2.0f * 3.14159265f * x / columns;
+				float r = 40.0f + 3.0f * sinf( phi * 5.0f ) * sinf( theta * 7.0f );
+				FloatVertex v;
+				v.normal[0] = sinf( theta ) * cosf( phi );
+				v.normal[1] = cosf( theta );
+				v.normal[2] = sinf( theta ) * sinf( phi );
+				for( int c = 0; c < 3; ++c )
+					v.pos[c] = v.normal[c] * r + ( c == 1 ? 60.0f : 0.0f );
+				v.uv[0] = 3.0f * x / columns;
+				v.uv[1] = ( float )y / rows;
+				vertices.push_back( v );
+			}
+		span.count = ( unsigned int )vertices.size() - span.first;
+		subsets.push_back( span );
+	}
+	// a fifth subset reusing the vertices of the first two (shares their box)
+	VertexSpan overlap = { subsets[0].first + subsets[0].count / 2, subsets[0].count };
+	subsets.push_back( overlap );
+}
+
+static int Bench( int numVertices )
+{
+	// halves: every finite one survives the round trip, rounding is to nearest even
+	bool halvesOk = true;
+	for( unsigned int h = 0; h < 0x10000; ++h )
+		if( ( h & 0x7c00 ) != 0x7c00 && FloatToHalf( HalfToFloat( ( unsigned short )h ) ) != h )
+			halvesOk = false;
+	halvesOk = halvesOk && FloatToHalf( 1.0f + 1.0f / 2048.0f ) == 0x3c00 && FloatToHalf( 1.0f + 3.0f / 2048.0f ) == 0x3c02 &&
+			   FloatToHalf( 65520.0f ) == 0x7c00 && FloatToHalf( 65519.0f ) == 0x7bff && FloatToHalf( 1e-8f ) == 0;
+	Check( halvesOk, "half round trip and rounding" );
+
+	// octahedral: worst angle over a dense set of directions
+	double worstDegrees = 0.0;
+	for( int i = 0; i < 200000; ++i )
+	{
+		float z = 1.0f - 2.0f * ( i + 0.5f ) / 200000.0f, phi = i * 2.39996323f;
+		float n[3] = { sqrtf( 1.0f - z * z ) * cosf( phi ), sqrtf( 1.0f - z * z ) * sinf( phi ), z }, d[3];
+		short e[2];
+		OctEncode( n, e );
+		OctDecode( e, d );
+		worstDegrees = max( worstDegrees, NormalErrorDegrees( n, d ) );
+	}
+	printf( "%-56s %.5f deg\n", "octahedral 2x16 worst error", worstDegrees );
+	Check( worstDegrees < 0.01, "octahedral normals within 0.01 degrees" );
+
+	vector<FloatVertex> vertices;
+	vector<VertexSpan> subsets;
+	MakeTestMesh( numVertices, vertices, subsets );
+	QuantizedMesh mesh;
+	Clock::time_point start = Clock::now();
+	QuantizeMesh( vertices.data(), ( int )vertices.size(), subsets, mesh );
+	double quantizeMs = Milliseconds( start );
+	Check( mesh.ranges.size() == 3 && mesh.subsetRange[4] == mesh.subsetRange[0] && mesh.subsetRange[1] == mesh.subsetRange[0],
+		   "overlapping subsets share a box" );
+
+	unsigned int covered = 0;
+	for( size_t r = 0; r < mesh.ranges.size(); ++r )
+		covered += mesh.ranges[r].first == covered ? mesh.ranges[r].count : 0;
+	Check( covered == vertices.size(), "ranges cover every vertex once" );
+
+	printf( "\n%u vertices, %u subsets, quantized in %.1f ms\n\n", ( unsigned int )vertices.size(),
+			( unsigned int )subsets.size(), quantizeMs );
+	QuantError worst = Report( vertices, mesh, sizeof( FloatVertex ), vertices.size() * 6ull );
+	Check( worst.maxPosition <= worst.positionBound * 1.01, "position error within half a step" );
+	Check( worst.maxUV <= worst.uvBound, "uv error within half an ulp" );
+	Check( worst.maxNormalDegrees < 0.01, "mesh normals within 0.01 degrees" );
+
+	// decoders: SIMD must match the scalar reference bit for bit
+	vector<FloatVertex> simd( vertices.size() ), scalar( vertices.size() );
+	for( size_t r = 0; r < mesh.ranges.size(); ++r )
+	{
+		const VertexRange& range = mesh.ranges[r];
+		DecodeVertices( &mesh.vertices[range.first], range.count, range.box, &simd[range.first] );
+		DecodeVerticesScalar( &mesh.vertices[range.first], range.count, range.box, &scalar[range.first] );
+	}
+	Check( memcmp( simd.data(), scalar.data(), simd.size() * sizeof( FloatVertex ) ) == 0, "SIMD decoder matches scalar" );
+
+	const int passes = 20;
+	double ms[2];
+	for( int s = 0; s < 2; ++s )
+	{
+		start = Clock::now();
+		for( int p = 0; p < passes; ++p )
+			for( size_t r = 0; r < mesh.ranges.size(); ++r )
+			{
+				const VertexRange& range = mesh.ranges[r];
+				( s ? DecodeVertices : DecodeVerticesScalar )( &mesh.vertices[range.first], range.count, range.box, &simd[range.first] );
+			}
+		ms[s] = Milliseconds( start ) / passes;
+	}
+	printf( "%-36s %12s\n", "decode", "M vertices/s" );
+	printf( "%-36s %12.1f\n", "scalar", vertices.size() / ms[0] / 1000.0 );
+	printf( "%-36s %12.1f\n\n", "SIMD (" SIMDMATH_BACKEND ")", vertices.size() / ms[1] / 1000.0 );
+
+	// container
+	const char* path = "VertexQuantizerBench.qvtx";
+	bool written = WriteQuantizedMesh( path, mesh, sizeof( FloatVertex ) );
+	MappedFile file;
+	QuantizedMeshView view;
+	bool parsed = written && file.Open( path ) && ParseQuantizedMesh( file.Data(), file.Size(), view );
+	Check( parsed && view.header->numVertices == vertices.size() && view.header->numSubsets == subsets.size() &&
+		   memcmp( view.vertices, mesh.vertices.data(), mesh.vertices.size() * sizeof( PackedVertex ) ) == 0 &&
+		   memcmp( view.ranges, mesh.ranges.data(), mesh.ranges.size() * sizeof( VertexRange ) ) == 0,
+		   ".qvtx round trip" );
+	Check( !ParseQuantizedMesh( file.Data(), parsed ? file.Size() - 1 : 0, view ), "truncated .qvtx rejected" );
+	file.Close();
+	remove( path );
+	return failures ? 1 : 0;
+}
+
+int main( int argc, char* argv[] )
+{
+	if( argc >= 2 && strcmp( argv[1], "-bench" ) == 0 )
+		return Bench( argc >= 3 ? max( 64, atoi( argv[2] ) ) : 1 << 20 );
+	if( argc < 2 || argc > 3 )
+	{
+		fprintf( stderr, "usage: VertexQuantizer input.sdkmesh [output.qvtx]\n       VertexQuantizer -bench [vertices]\n" );
+		return 1;
+	}
+
+	string input = argv[1], output = argc >= 3 ? argv[2] : input + ".qvtx";
+	MappedFile file;
+	SdkmeshData sdkmesh;
+	if( !file.Open( input ) || !ReadSdkmesh( file.Data(), file.Size(), sdkmesh ) )
+	{
+		fprintf( stderr, "%s: not an sdkmesh with float3 position, float3 normal and float2 texcoord\n", input.c_str() );
+		return 1;
+	}
+	const vector<FloatVertex>& vertices = sdkmesh.vertices;
+	unsigned int stride = sdkmesh.stride;
+	vector<VertexSpan> subsets;
+	unsigned long long indices = 0;
+	for( size_t i = 0; i < sdkmesh.subsets.size(); ++i )
+	{
+		VertexSpan span = { sdkmesh.subsets[i].vertexStart, sdkmesh.subsets[i].vertexCount };
+		subsets.push_back( span );
+		indices += sdkmesh.subsets[i].indexCount;
+	}
+
+	QuantizedMesh mesh;
+	QuantizeMesh( vertices.data(), ( int )vertices.size(), subsets, mesh );
+	printf( "%s: %u vertices (%u bytes each), %u subsets\n\n", input.c_str(), ( unsigned int )vertices.size(), stride,
+			( unsigned int )subsets.size() );
+	Report( vertices, mesh, stride, indices );
+	if( !WriteQuantizedMesh( output, mesh, stride ) )
+	{
+		fprintf( stderr, "can't write %s\n", output.c_str() );
+		return 1;
+	}
+	printf( "wrote %s\n", output.c_str() );
+	return 0;
+}